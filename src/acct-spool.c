@@ -0,0 +1,843 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <talloc.h>
+#include <ccan/list/list.h>
+#include <ccan/htable/htable.h>
+#include <ccan/hash/hash.h>
+#include <acct-spool.h>
+
+/* The file starts with a header of the magic, the version and the offset
+ * of the oldest unacknowledged record. Each record has a header of its
+ * size (including the header), type, key length and time, followed by
+ * the key and the data. The integers are big endian. The type of the
+ * records removed after the oldest is overwritten with REC_REMOVED, so
+ * that they are not sent again. */
+#define SPOOL_MAGIC "OCAS"
+#define SPOOL_VERSION 1
+#define HDR_SIZE 16
+#define REC_HDR_SIZE 14
+#define REC_REMOVED 0
+
+/* the acknowledged part of the file is removed once it exceeds that size,
+ * and is more than half the file */
+#define COMPACT_SIZE (1024*1024)
+
+typedef struct acct_rec_st {
+	struct list_node list;
+	acct_spool_st *sp;
+
+	uint64_t off;
+	unsigned size;
+	unsigned type;
+	time_t ts;
+	char *key;
+
+	unsigned inflight;
+	unsigned indexed; /* whether in the interims table */
+	unsigned superseded; /* replaced while in flight */
+} acct_rec_st;
+
+/* an interim record not yet written */
+typedef struct acct_buf_st {
+	struct list_node list;
+	char *key;
+	time_t ts;
+	uint8_t *data;
+	unsigned size;
+} acct_buf_st;
+
+struct acct_spool_st {
+	struct list_node list;
+
+	char *file;
+	int fd;
+	uint64_t consumed; /* as written in the header */
+	uint64_t end;
+	unsigned unsynced;
+	time_t last_sync;
+
+	/* the unacknowledged records, in the file order */
+	struct list_head pending;
+	unsigned pending_size;
+	/* the pending interim records by their key */
+	struct htable interims;
+
+	struct list_head buffered;
+	unsigned buffered_size;
+	unsigned flush_secs;
+	time_t next_flush;
+
+	unsigned max_inflight;
+	unsigned inflight;
+	unsigned backoff;
+	time_t retry_at;
+
+	acct_spool_send_func send;
+	void *priv;
+
+	uint64_t sent;
+	uint64_t retries;
+	uint64_t coalesced;
+};
+
+static LIST_HEAD(acct_spools);
+
+static size_t rehash(const void *_e, void *unused)
+{
+	const acct_rec_st *e = _e;
+
+	return hash_any(e->key, strlen(e->key), 0);
+}
+
+static bool rec_cmp(const void *_e, void *key)
+{
+	const acct_rec_st *e = _e;
+
+	return strcmp(e->key, key) == 0;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, v >> 32);
+	put_u32(p + 4, v & 0xffffffff);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static int write_all(int fd, const void *data, unsigned size, uint64_t off)
+{
+	const uint8_t *p = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pwrite(fd, p, size, off);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		off += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *data, unsigned size, uint64_t off)
+{
+	uint8_t *p = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pread(fd, p, size, off);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		off += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int write_header(int fd, uint64_t consumed)
+{
+	uint8_t hdr[HDR_SIZE];
+
+	memcpy(hdr, SPOOL_MAGIC, 4);
+	put_u32(hdr + 4, SPOOL_VERSION);
+	put_u64(hdr + 8, consumed);
+
+	return write_all(fd, hdr, sizeof(hdr), 0);
+}
+
+static unsigned encode_rec(uint8_t *p, unsigned type, const char *key, time_t ts,
+			   const void *data, unsigned size)
+{
+	unsigned key_len = strlen(key);
+	unsigned total = REC_HDR_SIZE + key_len + size;
+
+	put_u32(p, total);
+	p[4] = type;
+	p[5] = key_len;
+	put_u64(p + 6, ts);
+	memcpy(p + REC_HDR_SIZE, key, key_len);
+	memcpy(p + REC_HDR_SIZE + key_len, data, size);
+
+	return total;
+}
+
+static void remove_rec(acct_spool_st *sp, acct_rec_st *rec)
+{
+	static const uint8_t removed = REC_REMOVED;
+
+	if (write_all(sp->fd, &removed, 1, rec->off + 4) < 0)
+		syslog(LOG_ERR, "acct-spool: error writing to %s", sp->file);
+
+	if (rec->indexed)
+		htable_del(&sp->interims, rehash(rec, NULL), rec);
+	list_del(&rec->list);
+	sp->pending_size--;
+	talloc_free(rec);
+}
+
+/* An interim or stop record supersedes the pending interim record of
+ * its session */
+static void index_rec(acct_spool_st *sp, acct_rec_st *rec)
+{
+	acct_rec_st *old;
+	size_t h;
+
+	if (rec->type != ACCT_REC_INTERIM && rec->type != ACCT_REC_STOP)
+		return;
+
+	h = rehash(rec, NULL);
+	old = htable_get(&sp->interims, h, rec_cmp, rec->key);
+	if (old != NULL) {
+		htable_del(&sp->interims, h, old);
+		old->indexed = 0;
+		sp->coalesced++;
+
+		if (old->inflight)
+			old->superseded = 1;
+		else
+			remove_rec(sp, old);
+	}
+
+	if (rec->type == ACCT_REC_INTERIM) {
+		if (htable_add(&sp->interims, h, rec))
+			rec->indexed = 1;
+	}
+}
+
+static acct_rec_st *new_rec(acct_spool_st *sp, uint64_t off, unsigned size,
+			    unsigned type, const char *key, unsigned key_len,
+			    time_t ts)
+{
+	acct_rec_st *rec;
+
+	rec = talloc_zero(sp, acct_rec_st);
+	if (rec == NULL)
+		return NULL;
+
+	rec->key = talloc_strndup(rec, key, key_len);
+	if (rec->key == NULL) {
+		talloc_free(rec);
+		return NULL;
+	}
+
+	rec->sp = sp;
+	rec->off = off;
+	rec->size = size;
+	rec->type = type;
+	rec->ts = ts;
+
+	list_add_tail(&sp->pending, &rec->list);
+	sp->pending_size++;
+
+	index_rec(sp, rec);
+	return rec;
+}
+
+/* Writes the records in @buf at the end of the file */
+static int append(acct_spool_st *sp, const uint8_t *buf, unsigned size)
+{
+	if (write_all(sp->fd, buf, size, sp->end) < 0) {
+		int e = errno;
+		syslog(LOG_ERR, "acct-spool: error writing to %s: %s", sp->file, strerror(e));
+		if (ftruncate(sp->fd, sp->end) < 0)
+			syslog(LOG_ERR, "acct-spool: error truncating %s", sp->file);
+		return -1;
+	}
+
+	sp->end += size;
+	sp->unsynced = 1;
+	return 0;
+}
+
+static int append_rec(acct_spool_st *sp, unsigned type, const char *key, time_t ts,
+		      const void *data, unsigned size)
+{
+	uint8_t buf[ACCT_SPOOL_MAX_RECORD];
+	uint64_t off = sp->end;
+	unsigned total;
+
+	total = encode_rec(buf, type, key, ts, data, size);
+	if (append(sp, buf, total) < 0)
+		return -1;
+
+	if (new_rec(sp, off, total, type, key, strlen(key), ts) == NULL)
+		return -1;
+
+	return 0;
+}
+
+/* Writes the buffered interim records with a single write */
+static void flush(acct_spool_st *sp, time_t now)
+{
+	acct_buf_st *b, *btmp;
+	uint8_t *buf;
+	uint64_t off;
+	unsigned size = 0, pos;
+
+	list_for_each(&sp->buffered, b, list) {
+		size += REC_HDR_SIZE + strlen(b->key) + b->size;
+	}
+
+	buf = talloc_size(sp, size);
+	if (buf == NULL)
+		goto retry;
+
+	pos = 0;
+	list_for_each(&sp->buffered, b, list) {
+		pos += encode_rec(buf + pos, ACCT_REC_INTERIM, b->key, b->ts, b->data, b->size);
+	}
+
+	off = sp->end;
+	if (append(sp, buf, size) < 0) {
+		talloc_free(buf);
+		goto retry;
+	}
+
+	list_for_each_safe(&sp->buffered, b, btmp, list) {
+		pos = REC_HDR_SIZE + strlen(b->key) + b->size;
+		new_rec(sp, off, pos, ACCT_REC_INTERIM, b->key, strlen(b->key), b->ts);
+		off += pos;
+
+		list_del(&b->list);
+		talloc_free(b);
+	}
+	sp->buffered_size = 0;
+
+	talloc_free(buf);
+	return;
+ retry:
+	sp->next_flush = now + sp->flush_secs;
+}
+
+static acct_buf_st *find_buffered(acct_spool_st *sp, const char *key)
+{
+	acct_buf_st *b;
+
+	list_for_each(&sp->buffered, b, list) {
+		if (strcmp(b->key, key) == 0)
+			return b;
+	}
+
+	return NULL;
+}
+
+int acct_spool_add(acct_spool_st *sp, unsigned type, const char *key, time_t ts,
+		   const void *data, unsigned size)
+{
+	acct_buf_st *b;
+	unsigned key_len = strlen(key);
+
+	if (key_len > 255 || REC_HDR_SIZE + key_len + size > ACCT_SPOOL_MAX_RECORD)
+		return -1;
+
+	if (type != ACCT_REC_INTERIM) {
+		/* the stop record carries the final stats */
+		if (type == ACCT_REC_STOP && (b = find_buffered(sp, key)) != NULL) {
+			list_del(&b->list);
+			talloc_free(b);
+			sp->buffered_size--;
+			sp->coalesced++;
+		}
+
+		return append_rec(sp, type, key, ts, data, size);
+	}
+
+	b = find_buffered(sp, key);
+	if (b != NULL) {
+		talloc_free(b->data);
+		b->data = NULL;
+		sp->coalesced++;
+	} else {
+		if (sp->end - sp->consumed > ACCT_SPOOL_MAX_SIZE) {
+			syslog(LOG_WARNING, "acct-spool: %s is full; dropping interim update of %s",
+			       sp->file, key);
+			return -1;
+		}
+
+		b = talloc_zero(sp, acct_buf_st);
+		if (b == NULL)
+			return -1;
+
+		b->key = talloc_strdup(b, key);
+		if (b->key == NULL) {
+			talloc_free(b);
+			return -1;
+		}
+
+		if (sp->buffered_size == 0)
+			sp->next_flush = ts + sp->flush_secs;
+		list_add_tail(&sp->buffered, &b->list);
+		sp->buffered_size++;
+	}
+
+	b->ts = ts;
+	b->size = size;
+	b->data = talloc_memdup(b, data, size);
+	if (b->data == NULL && size > 0) {
+		list_del(&b->list);
+		talloc_free(b);
+		sp->buffered_size--;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void set_backoff(acct_spool_st *sp, time_t now)
+{
+	if (sp->backoff == 0)
+		sp->backoff = ACCT_SPOOL_MIN_BACKOFF;
+	else if (sp->backoff < ACCT_SPOOL_MAX_BACKOFF)
+		sp->backoff = (sp->backoff * 2 > ACCT_SPOOL_MAX_BACKOFF) ?
+			      ACCT_SPOOL_MAX_BACKOFF : sp->backoff * 2;
+
+	sp->retry_at = now + sp->backoff;
+	syslog(LOG_INFO, "acct-spool: sending from %s failed; retrying in %u secs",
+	       sp->file, sp->backoff);
+}
+
+void acct_spool_done(void *handle, int ok)
+{
+	acct_rec_st *rec = handle;
+	acct_spool_st *sp = rec->sp;
+
+	rec->inflight = 0;
+	sp->inflight--;
+
+	if (ok) {
+		sp->sent++;
+		sp->backoff = 0;
+		remove_rec(sp, rec);
+		return;
+	}
+
+	sp->retries++;
+	if (sp->retry_at <= time(0))
+		set_backoff(sp, time(0));
+
+	/* no need to retry a record which is replaced */
+	if (rec->superseded)
+		remove_rec(sp, rec);
+}
+
+static void send_pending(acct_spool_st *sp, time_t now)
+{
+	uint8_t buf[ACCT_SPOOL_MAX_RECORD];
+	acct_rec_st *rec, *tmp;
+	unsigned key_len;
+	int ret;
+
+	if (sp->retry_at > now)
+		return;
+
+	list_for_each_safe(&sp->pending, rec, tmp, list) {
+		if (sp->inflight >= sp->max_inflight)
+			break;
+
+		if (rec->inflight)
+			continue;
+
+		key_len = strlen(rec->key);
+		if (rec->size > sizeof(buf) ||
+		    read_all(sp->fd, buf, rec->size, rec->off) < 0) {
+			syslog(LOG_ERR, "acct-spool: error reading record of %s from %s; skipping",
+			       rec->key, sp->file);
+			remove_rec(sp, rec);
+			continue;
+		}
+
+		rec->inflight = 1;
+		sp->inflight++;
+
+		ret = sp->send(sp->priv, rec, rec->type, rec->ts,
+			       buf + REC_HDR_SIZE + key_len,
+			       rec->size - REC_HDR_SIZE - key_len);
+		if (ret < 0) {
+			rec->inflight = 0;
+			sp->inflight--;
+			sp->retries++;
+			set_backoff(sp, now);
+			break;
+		}
+	}
+}
+
+/* Replaces the file with its unacknowledged part */
+static void compact(acct_spool_st *sp)
+{
+	uint8_t buf[16*1024];
+	acct_rec_st *rec;
+	uint64_t off, delta;
+	unsigned size;
+	char *tmpfile;
+	int fd;
+
+	tmpfile = talloc_asprintf(sp, "%s.tmp", sp->file);
+	if (tmpfile == NULL)
+		return;
+
+	fd = open(tmpfile, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (fd == -1)
+		goto fail;
+
+	if (write_header(fd, HDR_SIZE) < 0)
+		goto fail;
+
+	for (off = sp->consumed; off < sp->end; off += size) {
+		size = (sp->end - off > sizeof(buf)) ? sizeof(buf) : sp->end - off;
+		if (read_all(sp->fd, buf, size, off) < 0 ||
+		    write_all(fd, buf, size, off - sp->consumed + HDR_SIZE) < 0)
+			goto fail;
+	}
+
+	if (fdatasync(fd) < 0 || rename(tmpfile, sp->file) < 0)
+		goto fail;
+
+	close(sp->fd);
+	sp->fd = fd;
+
+	delta = sp->consumed - HDR_SIZE;
+	list_for_each(&sp->pending, rec, list) {
+		rec->off -= delta;
+	}
+	sp->end -= delta;
+	sp->consumed = HDR_SIZE;
+	sp->unsynced = 0;
+
+	talloc_free(tmpfile);
+	return;
+ fail:
+	syslog(LOG_ERR, "acct-spool: could not compact %s", sp->file);
+	if (fd != -1) {
+		close(fd);
+		unlink(tmpfile);
+	}
+	talloc_free(tmpfile);
+}
+
+static void update_consumed(acct_spool_st *sp)
+{
+	acct_rec_st *rec;
+	uint64_t consumed;
+
+	rec = list_top(&sp->pending, acct_rec_st, list);
+	consumed = (rec != NULL) ? rec->off : sp->end;
+	if (consumed == sp->consumed)
+		return;
+
+	if (rec == NULL && sp->buffered_size == 0) {
+		/* everything is acknowledged */
+		if (ftruncate(sp->fd, HDR_SIZE) == 0) {
+			sp->end = HDR_SIZE;
+			consumed = HDR_SIZE;
+		}
+	} else if (consumed - HDR_SIZE >= COMPACT_SIZE &&
+		   consumed - HDR_SIZE >= (sp->end - HDR_SIZE) / 2) {
+		sp->consumed = consumed;
+		compact(sp);
+		consumed = sp->consumed;
+	}
+
+	sp->consumed = consumed;
+	if (write_header(sp->fd, sp->consumed) < 0)
+		syslog(LOG_ERR, "acct-spool: error writing to %s", sp->file);
+}
+
+void acct_spool_process(acct_spool_st *sp, time_t now)
+{
+	if (sp->buffered_size > 0 && now >= sp->next_flush)
+		flush(sp, now);
+
+	if (sp->unsynced && now > sp->last_sync) {
+		if (fdatasync(sp->fd) < 0)
+			syslog(LOG_ERR, "acct-spool: error syncing %s", sp->file);
+		sp->unsynced = 0;
+		sp->last_sync = now;
+	}
+
+	send_pending(sp, now);
+	update_consumed(sp);
+}
+
+int acct_spool_timeout(acct_spool_st *sp, time_t now)
+{
+	int t = -1, n;
+
+	if (sp->buffered_size > 0) {
+		n = (sp->next_flush > now) ? sp->next_flush - now : 0;
+		if (t == -1 || n < t)
+			t = n;
+	}
+
+	if (sp->unsynced) {
+		n = (sp->last_sync >= now) ? 1 : 0;
+		if (t == -1 || n < t)
+			t = n;
+	}
+
+	if (sp->pending_size > sp->inflight && sp->inflight < sp->max_inflight) {
+		n = (sp->retry_at > now) ? sp->retry_at - now : 0;
+		if (t == -1 || n < t)
+			t = n;
+	}
+
+	return t;
+}
+
+void acct_spool_stats(acct_spool_st *sp, time_t now, acct_spool_stats_st *st)
+{
+	acct_rec_st *rec;
+	acct_buf_st *b;
+	time_t oldest = now;
+
+	memset(st, 0, sizeof(*st));
+
+	rec = list_top(&sp->pending, acct_rec_st, list);
+	if (rec != NULL && rec->ts < oldest)
+		oldest = rec->ts;
+
+	list_for_each(&sp->buffered, b, list) {
+		if (b->ts < oldest)
+			oldest = b->ts;
+	}
+
+	st->records = sp->pending_size + sp->buffered_size;
+	st->bytes = sp->end - sp->consumed;
+	st->lag = now - oldest;
+	st->inflight = sp->inflight;
+	st->sent = sp->sent;
+	st->retries = sp->retries;
+	st->coalesced = sp->coalesced;
+}
+
+/* Reads the header and indexes the unacknowledged records; a partially
+ * written record at the end is removed. */
+static int load(acct_spool_st *sp)
+{
+	uint8_t hdr[HDR_SIZE];
+	char key[256];
+	struct stat st;
+	uint64_t off;
+	unsigned size, key_len, type;
+
+	if (fstat(sp->fd, &st) < 0)
+		return -1;
+
+	if (st.st_size < HDR_SIZE) {
+		if (ftruncate(sp->fd, 0) < 0 || write_header(sp->fd, HDR_SIZE) < 0)
+			return -1;
+		sp->consumed = sp->end = HDR_SIZE;
+		return 0;
+	}
+
+	if (read_all(sp->fd, hdr, sizeof(hdr), 0) < 0)
+		return -1;
+
+	if (memcmp(hdr, SPOOL_MAGIC, 4) != 0 || get_u32(hdr + 4) != SPOOL_VERSION) {
+		syslog(LOG_ERR, "acct-spool: %s is not an accounting spool", sp->file);
+		return -1;
+	}
+
+	sp->consumed = get_u64(hdr + 8);
+	if (sp->consumed < HDR_SIZE || sp->consumed > (uint64_t)st.st_size)
+		sp->consumed = HDR_SIZE;
+
+	for (off = sp->consumed; off + REC_HDR_SIZE <= (uint64_t)st.st_size; off += size) {
+		if (read_all(sp->fd, hdr, REC_HDR_SIZE, off) < 0)
+			return -1;
+
+		size = get_u32(hdr);
+		type = hdr[4];
+		key_len = hdr[5];
+		if (size < REC_HDR_SIZE + key_len || size > ACCT_SPOOL_MAX_RECORD ||
+		    off + size > (uint64_t)st.st_size || type > ACCT_REC_STOP)
+			break;
+
+		if (type == REC_REMOVED)
+			continue;
+
+		if (read_all(sp->fd, key, key_len, off + REC_HDR_SIZE) < 0)
+			return -1;
+
+		if (new_rec(sp, off, size, type, key, key_len, get_u64(hdr + 6)) == NULL)
+			return -1;
+	}
+
+	if (off != (uint64_t)st.st_size) {
+		syslog(LOG_WARNING, "acct-spool: discarding incomplete record at the end of %s",
+		       sp->file);
+		if (ftruncate(sp->fd, off) < 0)
+			return -1;
+	}
+
+	sp->end = off;
+	if (sp->pending_size > 0)
+		syslog(LOG_INFO, "acct-spool: %u records to be sent from %s",
+		       sp->pending_size, sp->file);
+	return 0;
+}
+
+static int spool_destructor(acct_spool_st *sp)
+{
+	list_del(&sp->list);
+
+	if (sp->fd != -1) {
+		if (sp->buffered_size > 0)
+			flush(sp, time(0));
+		update_consumed(sp);
+		if (sp->unsynced)
+			fdatasync(sp->fd);
+		close(sp->fd);
+	}
+
+	htable_clear(&sp->interims);
+	return 0;
+}
+
+acct_spool_st *acct_spool_open(void *pool, const char *file, unsigned flush_secs,
+			       unsigned max_inflight, acct_spool_send_func send,
+			       void *priv)
+{
+	acct_spool_st *sp;
+	int e;
+
+	sp = talloc_zero(pool, acct_spool_st);
+	if (sp == NULL)
+		return NULL;
+
+	sp->file = talloc_strdup(sp, file);
+	if (sp->file == NULL) {
+		talloc_free(sp);
+		return NULL;
+	}
+
+	sp->flush_secs = flush_secs;
+	sp->max_inflight = max_inflight ? max_inflight : 1;
+	sp->send = send;
+	sp->priv = priv;
+	list_head_init(&sp->pending);
+	list_head_init(&sp->buffered);
+	htable_init(&sp->interims, rehash, NULL);
+
+	list_add_tail(&acct_spools, &sp->list);
+	talloc_set_destructor(sp, spool_destructor);
+
+	sp->fd = open(file, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if (sp->fd == -1) {
+		e = errno;
+		syslog(LOG_ERR, "acct-spool: cannot open %s: %s", file, strerror(e));
+		talloc_free(sp);
+		return NULL;
+	}
+
+	if (load(sp) < 0) {
+		syslog(LOG_ERR, "acct-spool: cannot read %s", file);
+		close(sp->fd);
+		sp->fd = -1;
+		talloc_free(sp);
+		return NULL;
+	}
+
+	return sp;
+}
+
+int acct_spools_timeout(void)
+{
+	acct_spool_st *sp;
+	time_t now = time(0);
+	int t = -1, n;
+
+	list_for_each(&acct_spools, sp, list) {
+		n = acct_spool_timeout(sp, now);
+		if (n != -1 && (t == -1 || n < t))
+			t = n;
+	}
+
+	return (t == -1) ? -1 : t * 1000;
+}
+
+void acct_spools_process(void)
+{
+	acct_spool_st *sp;
+	time_t now = time(0);
+
+	list_for_each(&acct_spools, sp, list) {
+		acct_spool_process(sp, now);
+	}
+}
+
+unsigned acct_spools_stats(acct_spool_stats_st *st)
+{
+	acct_spool_stats_st one;
+	acct_spool_st *sp;
+	time_t now = time(0);
+	unsigned n = 0;
+
+	memset(st, 0, sizeof(*st));
+
+	list_for_each(&acct_spools, sp, list) {
+		acct_spool_stats(sp, now, &one);
+		st->records += one.records;
+		st->bytes += one.bytes;
+		if (one.lag > st->lag)
+			st->lag = one.lag;
+		st->inflight += one.inflight;
+		st->sent += one.sent;
+		st->retries += one.retries;
+		st->coalesced += one.coalesced;
+		n++;
+	}
+
+	return n;
+}
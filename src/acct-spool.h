@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ACCT_SPOOL_H
+# define ACCT_SPOOL_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* An append-only spool of accounting records, drained by a sender with
+ * a bounded number of records in flight.
+ *
+ * The start and stop records are written as they are added. The interim
+ * records are buffered, replacing any earlier interim record of the same
+ * session, and are written together once per flush interval. A record
+ * waiting in the spool is also dropped when a newer interim or stop record
+ * of its session is written, so that a backlog accumulated while the
+ * server was unreachable is sent with a single update per session.
+ *
+ * The records are removed once acknowledged; the offset of the oldest
+ * unacknowledged record is kept in the file header, and on restart the
+ * records after it are sent again. A failed record is retried, and the
+ * sending is paused with an exponential backoff.
+ */
+
+#define ACCT_REC_START 1
+#define ACCT_REC_INTERIM 2
+#define ACCT_REC_STOP 3
+
+#define ACCT_SPOOL_FLUSH_SECS 5
+#define ACCT_SPOOL_MAX_INFLIGHT 64
+#define ACCT_SPOOL_MAX_RECORD 4096
+
+/* the interim records are dropped while the spool exceeds that size */
+#define ACCT_SPOOL_MAX_SIZE (64*1024*1024)
+
+#define ACCT_SPOOL_MIN_BACKOFF 5
+#define ACCT_SPOOL_MAX_BACKOFF 300
+
+typedef struct acct_spool_st acct_spool_st;
+
+/* Sends a record; it returns zero once the record is submitted, in
+ * which case acct_spool_done() is to be called with @handle. The spool
+ * must not be released while records are submitted. */
+typedef int (*acct_spool_send_func)(void *priv, void *handle, unsigned type,
+				    time_t ts, const uint8_t *data, unsigned size);
+
+typedef struct acct_spool_stats_st {
+	unsigned records; /* the records not acknowledged, including the buffered */
+	uint64_t bytes; /* the spool size not acknowledged */
+	unsigned lag; /* the age of the oldest record in seconds */
+	unsigned inflight;
+	uint64_t sent;
+	uint64_t retries;
+	uint64_t coalesced; /* interim records replaced by newer */
+} acct_spool_stats_st;
+
+acct_spool_st *acct_spool_open(void *pool, const char *file, unsigned flush_secs,
+			       unsigned max_inflight, acct_spool_send_func send,
+			       void *priv);
+
+/* @key identifies the session of the record */
+int acct_spool_add(acct_spool_st *sp, unsigned type, const char *key, time_t ts,
+		   const void *data, unsigned size);
+
+/* Completes a submitted record; it is removed on success */
+void acct_spool_done(void *handle, int ok);
+
+/* Writes the buffered records when due, and sends the waiting ones */
+void acct_spool_process(acct_spool_st *sp, time_t now);
+/* Returns the seconds until acct_spool_process() has work, or -1 */
+int acct_spool_timeout(acct_spool_st *sp, time_t now);
+void acct_spool_stats(acct_spool_st *sp, time_t now, acct_spool_stats_st *st);
+
+/* The spools of the process, driven by its event loop */
+int acct_spools_timeout(void); /* in milliseconds */
+void acct_spools_process(void);
+/* Sums the stats of all spools; returns the number of spools */
+unsigned acct_spools_stats(acct_spool_stats_st *st);
+
+#endif
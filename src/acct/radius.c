@@ -42,6 +42,43 @@
 #include "acct/radius.h"
 #include "common-config.h"
 
+static void spool_request_done(void *priv, int status, const rad_reply_st *reply)
+{
+	acct_spool_done(priv, status == RAD_OK);
+}
+
+/* Sends a record of the spool; the delay since the event is added */
+static int spool_send(void *priv, void *handle, unsigned type, time_t ts,
+		      const uint8_t *data, unsigned size)
+{
+	struct radius_vhost_ctx *vctx = priv;
+	time_t now = time(0);
+	rad_req_st *r;
+
+	r = rad_req_new(vctx->client, RAD_CODE_ACCOUNTING_REQUEST);
+	if (r == NULL)
+		return -1;
+
+	if (rad_req_add_raw(r, data, size) < 0 ||
+	    rad_req_add_int(r, PW_ACCT_DELAY_TIME, (now > ts) ? now - ts : 0) < 0) {
+		talloc_free(r);
+		return -1;
+	}
+
+	return rad_req_send(r, spool_request_done, handle);
+}
+
+/* Adds the request to the spool; the request is kept */
+static int spool_request(struct radius_vhost_ctx *vctx, rad_req_st *r, unsigned type,
+			 const common_acct_info_st *ai)
+{
+	const uint8_t *attrs;
+	unsigned size;
+
+	attrs = rad_req_attrs(r, &size);
+	return acct_spool_add(vctx->spool, type, ai->safe_id, time(0), attrs, size);
+}
+
 static void acct_radius_vhost_init(void **_vctx, void *pool, void *additional)
 {
 	radius_cfg_st *config = additional;
@@ -65,10 +102,25 @@ static void acct_radius_vhost_init(void **_vctx, void *pool, void *additional)
 		vctx->nas_identifier[0] = 0;
 	}
 
-	if (rc_read_dictionary(vctx->rh, rc_conf_str(vctx->rh, "dictionary")) != 0) {
-		fprintf(stderr, "error reading the radius dictionary\n");
-		exit(1);
+	vctx->client = radius_client_from_config(vctx, vctx->rh, "acctserver",
+						 1813, config->max_rate);
+	if (vctx->client == NULL)
+		goto fail;
+
+	/* the records are only sent from the spool, so that sec-mod does
+	 * not wait for the server */
+	if (config->acct_spool == NULL) {
+		fprintf(stderr, "radius: the accounting method requires the spool option\n");
+		goto fail;
+	}
+
+	vctx->spool = acct_spool_open(vctx, config->acct_spool, ACCT_SPOOL_FLUSH_SECS,
+				      ACCT_SPOOL_MAX_INFLIGHT, spool_send, vctx);
+	if (vctx->spool == NULL) {
+		fprintf(stderr, "radius: cannot open accounting spool %s\n", config->acct_spool);
+		goto fail;
 	}
+
 	*_vctx = vctx;
 
 	return;
@@ -81,134 +133,109 @@ static void acct_radius_vhost_deinit(void *_vctx)
 {
 	struct radius_vhost_ctx *vctx = _vctx;
 
+	/* the spool is written out once the requests are released */
+	talloc_free(vctx->client);
+	vctx->client = NULL;
+	talloc_free(vctx->spool);
+	vctx->spool = NULL;
+
 	if (vctx->rh != NULL)
 		rc_destroy(vctx->rh);
 }
 
-static void append_stats(rc_handle *rh, VALUE_PAIR **send, stats_st *stats)
+static void append_stats(rad_req_st *r, stats_st *stats)
 {
-	uint32_t uin, uout;
-
 	if (stats->uptime) {
-		uin = stats->uptime;
-		rc_avpair_add(rh, send, PW_ACCT_SESSION_TIME, &uin, -1, 0);
+		rad_req_add_int(r, PW_ACCT_SESSION_TIME, stats->uptime);
 	}
 
-	uin = stats->bytes_in;
-	uout = stats->bytes_out;
-
-	rc_avpair_add(rh, send, PW_ACCT_INPUT_OCTETS, &uin, -1, 0);
-	rc_avpair_add(rh, send, PW_ACCT_OUTPUT_OCTETS, &uout, -1, 0);
+	rad_req_add_int(r, PW_ACCT_INPUT_OCTETS, stats->bytes_in);
+	rad_req_add_int(r, PW_ACCT_OUTPUT_OCTETS, stats->bytes_out);
 
-	uin = stats->bytes_in / 4294967296;
-	rc_avpair_add(rh, send, PW_ACCT_INPUT_GIGAWORDS, &uin, -1, 0);
-
-	uout = stats->bytes_out / 4294967296;
-	rc_avpair_add(rh, send, PW_ACCT_OUTPUT_GIGAWORDS, &uout, -1, 0);
+	rad_req_add_int(r, PW_ACCT_INPUT_GIGAWORDS, stats->bytes_in / 4294967296);
+	rad_req_add_int(r, PW_ACCT_OUTPUT_GIGAWORDS, stats->bytes_out / 4294967296);
 
 	return;
 }
 
-static void append_acct_standard(struct radius_vhost_ctx *vctx, rc_handle *rh, const common_acct_info_st *ai, VALUE_PAIR **send)
+static void append_acct_standard(struct radius_vhost_ctx *vctx, rad_req_st *r, const common_acct_info_st *ai)
 {
-	uint32_t i;
+	radius_add_nas_info(r, ai->our_ip, vctx->nas_identifier);
 
-	if (vctx->nas_identifier[0] != 0) {
-		rc_avpair_add(rh, send, PW_NAS_IDENTIFIER, vctx->nas_identifier, -1, 0);
-	}
-
-	if (ai->our_ip[0] != 0) {
-		struct in_addr in;
-		struct in6_addr in6;
-
-		if (inet_pton(AF_INET, ai->our_ip, &in) != 0) {
-			in.s_addr = ntohl(in.s_addr);
-			rc_avpair_add(rh, send, PW_NAS_IP_ADDRESS, (char*)&in, sizeof(struct in_addr), 0);
-		} else if (inet_pton(AF_INET6, ai->our_ip, &in6) != 0) {
-			rc_avpair_add(rh, send, PW_NAS_IPV6_ADDRESS, (char*)&in6, sizeof(struct in6_addr), 0);
-		}
-	}
-
-	rc_avpair_add(rh, send, PW_USER_NAME, ai->username, -1, 0);
-
-	i = PW_FRAMED;
-	rc_avpair_add(rh, send, PW_SERVICE_TYPE, &i, -1, 0);
-
-	i = PW_PPP;
-	rc_avpair_add(rh, send, PW_FRAMED_PROTOCOL, &i, -1, 0);
+	rad_req_add_str(r, PW_USER_NAME, ai->username);
+	rad_req_add_int(r, PW_NAS_PORT, ai->id);
+	rad_req_add_int(r, PW_SERVICE_TYPE, PW_FRAMED);
+	rad_req_add_int(r, PW_FRAMED_PROTOCOL, PW_PPP);
 
 	if (ai->ipv4[0] != 0) {
 		struct in_addr in;
 		if (inet_pton(AF_INET, ai->ipv4, &in) == 1) {
-			in.s_addr = ntohl(in.s_addr);
-			if (rc_avpair_add(rh, send, PW_FRAMED_IP_ADDRESS, &in, sizeof(in), 0) == NULL) {
-				return;
-			}
+			rad_req_add(r, PW_FRAMED_IP_ADDRESS, &in, sizeof(in));
 		}
 	}
 
-#ifndef LEGACY_RADIUS /* bug in freeradius-client */
 	if (ai->ipv6[0] != 0) {
 		struct in6_addr in;
 		if (inet_pton(AF_INET6, ai->ipv6, &in) == 1) {
-			if (rc_avpair_add(rh, send, PW_FRAMED_IPV6_ADDRESS, &in, sizeof(in), 0) == NULL) {
-				return;
-			}
+			rad_req_add(r, PW_FRAMED_IPV6_ADDRESS, &in, sizeof(in));
 		}
 	}
-#endif
 
-	rc_avpair_add(rh, send, PW_CALLING_STATION_ID, ai->remote_ip, -1, 0);
-	rc_avpair_add(rh, send, PW_ACCT_SESSION_ID, ai->safe_id, -1, 0);
-
-	i = PW_RADIUS;
-	rc_avpair_add(rh, send, PW_ACCT_AUTHENTIC, &i, -1, 0);
+	rad_req_add_str(r, PW_CALLING_STATION_ID, ai->remote_ip);
+	rad_req_add_str(r, PW_ACCT_SESSION_ID, ai->safe_id);
+	rad_req_add_int(r, PW_ACCT_AUTHENTIC, PW_RADIUS);
+	/* identifies the record when sent again from the spool */
+	rad_req_add_int(r, PW_EVENT_TIMESTAMP, time(0));
 
 	return;
 }
 
+/* The interim updates and the stop records are not waited for; their
+ * outcome is only logged. */
+static void acct_request_done(void *priv, int status, const rad_reply_st *reply)
+{
+	const char *what = priv;
+
+	if (status != RAD_OK) {
+		syslog(LOG_INFO, "radius-auth: %s: no reply from the radius servers (%d)", what, status);
+	}
+}
+
 static void radius_acct_session_stats(void *_vctx, unsigned auth_method, const common_acct_info_st *ai, stats_st *stats)
 {
 	int ret;
-	uint32_t status_type;
-	VALUE_PAIR *send = NULL, *recvd = NULL;
+	rad_req_st *r;
 	struct radius_vhost_ctx *vctx = _vctx;
 
-	status_type = PW_STATUS_ALIVE;
-
 	syslog(LOG_DEBUG, "radius-auth: sending session interim update");
 
-	if (rc_avpair_add(vctx->rh, &send, PW_ACCT_STATUS_TYPE, &status_type, -1, 0) == NULL) {
-		goto cleanup;
-	}
-
-	append_acct_standard(vctx, vctx->rh, ai, &send);
-	append_stats(vctx->rh, &send, stats);
+	r = rad_req_new(vctx->client, RAD_CODE_ACCOUNTING_REQUEST);
+	if (r == NULL)
+		return;
 
-	ret = rc_aaa(vctx->rh, ai->id, send, &recvd, NULL, 1, PW_ACCOUNTING_REQUEST);
+	rad_req_add_int(r, PW_ACCT_STATUS_TYPE, PW_STATUS_ALIVE);
+	append_acct_standard(vctx, r, ai);
+	append_stats(r, stats);
 
-	if (recvd != NULL)
-		rc_avpair_free(recvd);
+	if (spool_request(vctx, r, ACCT_REC_INTERIM, ai) == 0) {
+		talloc_free(r);
+		return;
+	}
 
-	if (ret != OK_RC) {
-		syslog(LOG_AUTH, "radius-auth: radius_open_session: %d", ret);
-		goto cleanup;
+	ret = rad_req_send(r, acct_request_done, (void*)"radius_session_stats");
+	if (ret < 0) {
+		syslog(LOG_AUTH, "radius-auth: radius_session_stats: %d", ret);
 	}
 
- cleanup:
-	rc_avpair_free(send);
 	return;
 }
 
 static int radius_acct_open_session(void *_vctx, unsigned auth_method, const common_acct_info_st *ai, const void *sid, unsigned sid_size)
 {
 	int ret;
-	uint32_t status_type;
-	VALUE_PAIR *send = NULL, *recvd = NULL;
+	rad_req_st *r;
 	struct radius_vhost_ctx *vctx = _vctx;
 
-	status_type = PW_STATUS_START;
-
 	if (sid_size != SID_SIZE) {
 		syslog(LOG_DEBUG, "radius-auth: incorrect sid size");
 		return -1;
@@ -216,77 +243,74 @@ static int radius_acct_open_session(void *_vctx, unsigned auth_method, const com
 
 	syslog(LOG_DEBUG, "radius-auth: opening session %s", ai->safe_id);
 
-	if (rc_avpair_add(vctx->rh, &send, PW_ACCT_STATUS_TYPE, &status_type, -1, 0) == NULL) {
-		ret = -1;
-		goto cleanup;
-	}
+	r = rad_req_new(vctx->client, RAD_CODE_ACCOUNTING_REQUEST);
+	if (r == NULL)
+		return -1;
+
+	rad_req_add_int(r, PW_ACCT_STATUS_TYPE, PW_STATUS_START);
 
 	if (ai->user_agent[0] != 0) {
-		rc_avpair_add(vctx->rh, &send, PW_CONNECT_INFO, ai->user_agent, -1, 0);
+		rad_req_add_str(r, PW_CONNECT_INFO, ai->user_agent);
 	}
 
-	append_acct_standard(vctx, vctx->rh, ai, &send);
-
-	ret = rc_aaa(vctx->rh, ai->id, send, &recvd, NULL, 1, PW_ACCOUNTING_REQUEST);
+	append_acct_standard(vctx, r, ai);
 
-	if (recvd != NULL)
-		rc_avpair_free(recvd);
-
-	if (ret != OK_RC) {
-		syslog(LOG_AUTH, "radius-auth: radius_open_session: %d", ret);
-		ret = -1;
-		goto cleanup;
+	/* once in the spool, the record is sent even if the server is
+	 * down; the session is only allowed once it is there */
+	ret = spool_request(vctx, r, ACCT_REC_START, ai);
+	talloc_free(r);
+	if (ret < 0) {
+		syslog(LOG_AUTH, "radius-auth: radius_open_session: cannot spool the record");
+		return -1;
 	}
 
-	ret = 0;
- cleanup:
-	rc_avpair_free(send);
-	return ret;
+	return 0;
 }
 
 static void radius_acct_close_session(void *_vctx, unsigned auth_method, const common_acct_info_st *ai, stats_st *stats, unsigned discon_reason)
 {
 	int ret;
-	uint32_t status_type;
-	VALUE_PAIR *send = NULL, *recvd = NULL;
+	uint32_t cause;
+	rad_req_st *r;
 	struct radius_vhost_ctx *vctx = _vctx;
 
-	status_type = PW_STATUS_STOP;
-
 	syslog(LOG_DEBUG, "radius-auth: closing session");
-	if (rc_avpair_add(vctx->rh, &send, PW_ACCT_STATUS_TYPE, &status_type, -1, 0) == NULL)
+
+	r = rad_req_new(vctx->client, RAD_CODE_ACCOUNTING_REQUEST);
+	if (r == NULL)
 		return;
 
+	rad_req_add_int(r, PW_ACCT_STATUS_TYPE, PW_STATUS_STOP);
+
 	if (discon_reason == REASON_USER_DISCONNECT)
-		ret = PW_USER_REQUEST;
+		cause = PW_USER_REQUEST;
 	else if (discon_reason == REASON_SERVER_DISCONNECT)
-		ret = PW_ADMIN_RESET;
+		cause = PW_ADMIN_RESET;
 	else if (discon_reason == REASON_IDLE_TIMEOUT)
-		ret = PW_ACCT_IDLE_TIMEOUT;
+		cause = PW_ACCT_IDLE_TIMEOUT;
 	else if (discon_reason == REASON_SESSION_TIMEOUT)
-		ret = PW_ACCT_SESSION_TIMEOUT;
+		cause = PW_ACCT_SESSION_TIMEOUT;
 	else if (discon_reason == REASON_DPD_TIMEOUT)
-		ret = PW_LOST_CARRIER;
+		cause = PW_LOST_CARRIER;
 	else if (discon_reason == REASON_ERROR)
-		ret = PW_USER_ERROR;
+		cause = PW_USER_ERROR;
 	else
-		ret = PW_LOST_SERVICE;
-	rc_avpair_add(vctx->rh, &send, PW_ACCT_TERMINATE_CAUSE, &ret, -1, 0);
+		cause = PW_LOST_SERVICE;
+	rad_req_add_int(r, PW_ACCT_TERMINATE_CAUSE, cause);
 
-	append_acct_standard(vctx, vctx->rh, ai, &send);
-	append_stats(vctx->rh, &send, stats);
+	append_acct_standard(vctx, r, ai);
+	append_stats(r, stats);
 
-	ret = rc_aaa(vctx->rh, ai->id, send, &recvd, NULL, 1, PW_ACCOUNTING_REQUEST);
-	if (recvd != NULL)
-		rc_avpair_free(recvd);
+	if (spool_request(vctx, r, ACCT_REC_STOP, ai) == 0) {
+		talloc_free(r);
+		return;
+	}
 
-	if (ret != OK_RC) {
+	ret = rad_req_send(r, acct_request_done, (void*)"radius_close_session");
+	if (ret < 0) {
 		syslog(LOG_INFO, "radius-auth: radius_close_session: %d", ret);
-		goto cleanup;
 	}
 
- cleanup:
- 	rc_avpair_free(send);
 	return;
 }
 
@@ -380,6 +380,7 @@ static void gssapi_group_list(void *pool, void *_additional, char ***groupname,
 }
 
 const struct auth_mod_st gssapi_auth_funcs = {
+	.name = "gssapi",
 	.type = AUTH_TYPE_GSSAPI,
 	.auth_init = gssapi_auth_init,
 	.auth_deinit = gssapi_auth_deinit,
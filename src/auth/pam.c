@@ -331,7 +331,11 @@ static void pam_group_list(void *pool, void *_additional, char ***groupname, uns
 }
 
 const struct auth_mod_st pam_auth_funcs = {
+  .name = "pam",
   .type = AUTH_TYPE_PAM | AUTH_TYPE_USERNAME_PASS,
+  /* the conversation runs in a co-routine and pcl keeps the
+   * current co-routine in a global */
+  .max_concurrency = 1,
   .auth_init = pam_auth_init,
   .auth_deinit = pam_auth_deinit,
   .auth_msg = pam_auth_msg,
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <talloc.h>
+#include <ccan/htable/htable.h>
+#include <ccan/hash/hash.h>
+#include <common.h>
+#include "plain-index.h"
+
+/* the entries are allocated from blocks of that size */
+#define BLOCK_SIZE (64*1024)
+
+typedef struct plain_entry_st {
+	const char *groups;
+	const char *cpass;
+	char username[1]; /* followed by the groups and the hash */
+} plain_entry_st;
+
+struct plain_index_st {
+	char *file;
+
+	pthread_mutex_t lock;
+
+	/* the entries, allocated from the blocks under @data */
+	struct htable ht;
+	void *data;
+	char *block;
+	size_t block_left;
+	unsigned entries;
+
+	/* the file as read */
+	unsigned loaded;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	time_t load_time;
+};
+
+static size_t entry_rehash(const void *_e, void *unused)
+{
+	const plain_entry_st *e = _e;
+	return hash_any(e->username, strlen(e->username), 0);
+}
+
+static bool username_cmp(const void *_e, void *username)
+{
+	const plain_entry_st *e = _e;
+	return strcmp(e->username, username) == 0;
+}
+
+/* Returns the field at @*sp, and moves @*sp after its separator */
+static char *next_field(char **sp)
+{
+	char *p = *sp, *e;
+
+	if (p == NULL)
+		return NULL;
+
+	e = strchr(p, ':');
+	if (e != NULL)
+		*e++ = 0;
+	*sp = e;
+	return p;
+}
+
+static void *entry_alloc(struct plain_index_st *idx, void *data, size_t size)
+{
+	void *p;
+
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (size > idx->block_left) {
+		idx->block = talloc_size(data, size > BLOCK_SIZE ? size : BLOCK_SIZE);
+		if (idx->block == NULL)
+			return NULL;
+		idx->block_left = talloc_get_size(idx->block);
+	}
+
+	p = idx->block;
+	idx->block += size;
+	idx->block_left -= size;
+	return p;
+}
+
+/* Reads the file into a new table; on success the previous table
+ * is replaced. */
+static int load(struct plain_index_st *idx, const struct stat *st)
+{
+	FILE *fp;
+	char line[512];
+	ssize_t ll;
+	char *p, *sp, *groups, *cpass;
+	plain_entry_st *e;
+	struct htable ht;
+	void *data;
+	size_t hval;
+	unsigned entries = 0;
+	int ret = -1;
+
+	fp = fopen(idx->file, "r");
+	if (fp == NULL) {
+		syslog(LOG_AUTH,
+		       "error in plain authentication; cannot open: %s",
+		       idx->file);
+		return -1;
+	}
+
+	data = talloc_new(idx);
+	if (data == NULL)
+		goto exit;
+
+	htable_init(&ht, entry_rehash, NULL);
+	idx->block_left = 0;
+
+	line[sizeof(line)-1] = 0;
+	while ((p=fgets(line, sizeof(line)-1, fp)) != NULL) {
+		ll = strlen(p);
+
+		if (ll <= 4)
+			continue;
+
+		if (line[ll - 1] == '\n') {
+			ll--;
+			line[ll] = 0;
+		}
+		if (line[ll - 1] == '\r') {
+			ll--;
+			line[ll] = 0;
+		}
+
+		sp = line;
+		p = next_field(&sp);
+		groups = next_field(&sp);
+		cpass = next_field(&sp);
+		if (p == NULL || groups == NULL || cpass == NULL)
+			continue;
+
+		hval = hash_any(p, strlen(p), 0);
+		if (htable_get(&ht, hval, username_cmp, p) != NULL)
+			continue;
+
+		/* the fields are separated by the null terminators */
+		e = entry_alloc(idx, data, offsetof(plain_entry_st, username) + ll + 1);
+		if (e == NULL)
+			goto fail;
+
+		memcpy(e->username, line, ll + 1);
+		e->groups = e->username + (groups - line);
+		e->cpass = e->username + (cpass - line);
+
+		if (!htable_add(&ht, hval, e))
+			goto fail;
+		entries++;
+	}
+
+	if (ferror(fp))
+		goto fail;
+
+	htable_clear(&idx->ht);
+	talloc_free(idx->data);
+	idx->ht = ht;
+	idx->data = data;
+	idx->entries = entries;
+
+	idx->loaded = 1;
+	idx->dev = st->st_dev;
+	idx->ino = st->st_ino;
+	idx->size = st->st_size;
+	idx->mtime = st->st_mtime;
+	idx->ctime = st->st_ctime;
+	idx->load_time = time(0);
+	ret = 0;
+	goto exit;
+
+ fail:
+	syslog(LOG_AUTH,
+	       "error in plain authentication; cannot read: %s",
+	       idx->file);
+	htable_clear(&ht);
+	talloc_free(data);
+ exit:
+	safe_memset(line, 0, sizeof(line));
+	fclose(fp);
+	return ret;
+}
+
+/* Reads the file again if it is replaced or modified since read. A
+ * modification within the second it was read cannot be told by the
+ * time stamps, so such a file is read again until that second passes. */
+static int update(struct plain_index_st *idx)
+{
+	struct stat st;
+
+	if (stat(idx->file, &st) == -1) {
+		syslog(LOG_AUTH,
+		       "error in plain authentication; cannot open: %s",
+		       idx->file);
+		return -1;
+	}
+
+	if (idx->loaded && st.st_dev == idx->dev && st.st_ino == idx->ino &&
+	    st.st_size == idx->size && st.st_mtime == idx->mtime &&
+	    st.st_ctime == idx->ctime && st.st_mtime < idx->load_time &&
+	    st.st_ctime < idx->load_time)
+		return 0;
+
+	return load(idx, &st);
+}
+
+static int plain_index_destructor(struct plain_index_st *idx)
+{
+	htable_clear(&idx->ht);
+	pthread_mutex_destroy(&idx->lock);
+	return 0;
+}
+
+plain_index_st *plain_index_new(void *pool, const char *file)
+{
+	struct plain_index_st *idx;
+
+	idx = talloc_zero(pool, struct plain_index_st);
+	if (idx == NULL)
+		return NULL;
+
+	idx->file = talloc_strdup(idx, file);
+	if (idx->file == NULL) {
+		talloc_free(idx);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&idx->lock, NULL) != 0) {
+		talloc_free(idx);
+		return NULL;
+	}
+
+	htable_init(&idx->ht, entry_rehash, NULL);
+	talloc_set_destructor(idx, plain_index_destructor);
+
+	return idx;
+}
+
+int plain_index_lookup(plain_index_st *idx, const char *username,
+		       char *groups, size_t groups_size,
+		       char *cpass, size_t cpass_size)
+{
+	const plain_entry_st *e;
+	int ret;
+
+	pthread_mutex_lock(&idx->lock);
+	ret = update(idx);
+	if (ret < 0)
+		goto exit;
+
+	e = htable_get(&idx->ht, hash_any(username, strlen(username), 0),
+		       username_cmp, username);
+	if (e == NULL) {
+		ret = 0;
+		goto exit;
+	}
+
+	strlcpy(groups, e->groups, groups_size);
+	strlcpy(cpass, e->cpass, cpass_size);
+	ret = 1;
+ exit:
+	pthread_mutex_unlock(&idx->lock);
+	return ret;
+}
+
+int plain_index_size(plain_index_st *idx)
+{
+	int ret;
+
+	pthread_mutex_lock(&idx->lock);
+	ret = update(idx);
+	if (ret == 0)
+		ret = idx->entries;
+	pthread_mutex_unlock(&idx->lock);
+	return ret;
+}
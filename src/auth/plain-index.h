@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PLAIN_INDEX_H
+# define PLAIN_INDEX_H
+
+#include <stddef.h>
+
+/* An index by username of the entries of a plain password file
+ * (username:groups:crypt-hash). The file is read on the first lookup,
+ * and read again by the lookups which find it replaced or modified. On
+ * duplicate usernames the first entry applies. */
+
+typedef struct plain_index_st plain_index_st;
+
+plain_index_st *plain_index_new(void *pool, const char *file);
+
+/* Copies the groups and the hash of @username. Returns 1 if found, 0
+ * if not, and -1 if the file cannot be read. Safe to call from
+ * multiple threads. */
+int plain_index_lookup(plain_index_st *idx, const char *username,
+		       char *groups, size_t groups_size,
+		       char *cpass, size_t cpass_size);
+
+/* Returns the number of users, reading the file if needed, or -1 */
+int plain_index_size(plain_index_st *idx);
+
+#endif
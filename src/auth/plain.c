@@ -30,6 +30,7 @@
 #include <vpn.h>
 #include <c-ctype.h>
 #include "plain.h"
+#include "plain-index.h"
 #include "common-config.h"
 #include "auth/common.h"
 #include <ccan/htable/htable.h>
@@ -53,20 +54,40 @@ struct plain_ctx_st {
 	unsigned failed; /* non-zero if the username is wrong */
 
 	const struct plain_cfg_st *config;
+	struct plain_vctx_st *vctx;
+};
+
+struct plain_vctx_st {
+	const struct plain_cfg_st *config;
+	plain_index_st *passwd; /* NULL if no password file is set */
 };
 
 static void plain_vhost_init(void **vctx, void *pool, void *additional)
 {
 	struct plain_cfg_st *config = additional;
-
-	/* vctx is plain_cfg_st */
+	struct plain_vctx_st *vc;
 
 	if (config == NULL) {
 		fprintf(stderr, "plain: no configuration passed!\n");
 		exit(1);
 	}
 
-	*vctx = (void*)config;
+	vc = talloc_zero(pool, struct plain_vctx_st);
+	if (vc == NULL) {
+		fprintf(stderr, "plain: memory error\n");
+		exit(1);
+	}
+
+	vc->config = config;
+	if (config->passwd) {
+		vc->passwd = plain_index_new(vc, config->passwd);
+		if (vc->passwd == NULL) {
+			fprintf(stderr, "plain: memory error\n");
+			exit(1);
+		}
+	}
+
+	*vctx = vc;
 
 #ifdef HAVE_LIBOATH
 	oath_init();
@@ -133,87 +154,29 @@ break_group_list(void *pool, char *text,
  */
 static int read_auth_pass(struct plain_ctx_st *pctx)
 {
-	FILE *fp;
-	char line[512];
-	ssize_t ll;
-	char *p, *sp;
+	char groups[512];
 	int ret;
 
-	if (pctx->config->passwd == NULL) {
+	if (pctx->vctx->passwd == NULL) {
 		/* no password file is set */
 		return 0;
 	}
 
-	pctx->failed = 1;
-
-	fp = fopen(pctx->config->passwd, "r");
-	if (fp == NULL) {
-		syslog(LOG_AUTH,
-		       "error in plain authentication; cannot open: %s",
-		       pctx->config->passwd);
+	ret = plain_index_lookup(pctx->vctx->passwd, pctx->username,
+				 groups, sizeof(groups),
+				 pctx->cpass, sizeof(pctx->cpass));
+	if (ret < 0)
 		return -1;
-	}
-
-	line[sizeof(line)-1] = 0;
-	while ((p=fgets(line, sizeof(line)-1, fp)) != NULL) {
-		ll = strlen(p);
 
-		if (ll <= 4)
-			continue;
-
-		if (line[ll - 1] == '\n') {
-			ll--;
-			line[ll] = 0;
-		}
-		if (line[ll - 1] == '\r') {
-			ll--;
-			line[ll] = 0;
-		}
-#ifdef HAVE_STRSEP
-		sp = line;
-		p = strsep(&sp, ":");
-
-		if (p != NULL && strcmp(pctx->username, p) == 0) {
-			p = strsep(&sp, ":");
-			if (p != NULL) {
-				break_group_list(pctx, p, pctx->groupnames, &pctx->groupnames_size);
-
-				p = strsep(&sp, ":");
-				if (p != NULL) {
-					strlcpy(pctx->cpass, p, sizeof(pctx->cpass));
-					pctx->failed = 0;
-					ret = 0;
-					goto exit;
-				}
-			}
-		}
-
-#else
-		p = strtok_r(line, ":", &sp);
-
-		if (p != NULL && strcmp(pctx->username, p) == 0) {
-			p = strtok_r(NULL, ":", &sp);
-			if (p != NULL) {
-				break_group_list(pctx, p, pctx->groupnames, &pctx->groupnames_size);
-
-				p = strtok_r(NULL, ":", &sp);
-				if (p != NULL) {
-					strlcpy(pctx->cpass, p, sizeof(pctx->cpass));
-					pctx->failed = 0;
-					ret = 0;
-					goto exit;
-				}
-			}
-		}
-#endif
+	if (ret == 0) {
+		pctx->failed = 1;
+		return 0;
 	}
 
+	break_group_list(pctx, groups, pctx->groupnames, &pctx->groupnames_size);
+
 	/* always succeed */
-	ret = 0;
- exit:
-	safe_memset(line, 0, sizeof(line));
-	fclose(fp);
-	return ret;
+	return 0;
 }
 
 static int plain_auth_init(void **ctx, void *pool, void *vctx, const common_auth_init_st *info)
@@ -233,7 +196,8 @@ static int plain_auth_init(void **ctx, void *pool, void *vctx, const common_auth
 
 	strlcpy(pctx->username, info->username, sizeof(pctx->username));
 	pctx->pass_msg = NULL; /* use default */
-	pctx->config = vctx;
+	pctx->vctx = vctx;
+	pctx->config = pctx->vctx->config;
 
 	/* this doesn't fail on password mismatch but sets p->failed */
 	ret = read_auth_pass(pctx);
@@ -477,8 +441,12 @@ static void plain_group_list(void *pool, void *additional, char ***groupname, un
 }
 
 const struct auth_mod_st plain_auth_funcs = {
+	.name = "plain",
 	.type = AUTH_TYPE_PLAIN | AUTH_TYPE_USERNAME_PASS,
 	.allows_retries = 1,
+	/* crypt() returns a static buffer and the OTP file is
+	 * updated in place */
+	.max_concurrency = 1,
 	.vhost_init = plain_vhost_init,
 	.auth_init = plain_auth_init,
 	.auth_deinit = plain_auth_deinit,
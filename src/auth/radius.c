@@ -41,9 +41,11 @@
 # include <radcli/radcli.h>
 #endif
 
-#define RAD_GROUP_NAME PW_CLASS
-#define RAD_IPV4_DNS1 ((311<<16)|(28))
-#define RAD_IPV4_DNS2 ((311<<16)|(29))
+#include <radius-client.h>
+
+#define MS_VENDOR_ID 311
+#define MS_PRIMARY_DNS_SERVER 28
+#define MS_SECONDARY_DNS_SERVER 29
 
 #if defined(LEGACY_RADIUS)
 # ifndef PW_DELEGATED_IPV6_PREFIX
@@ -54,9 +56,124 @@
 # endif
 #endif
 
-#if RADCLI_VERSION_NUMBER < 0x010207
-# define CHALLENGE_RC 3
-#endif
+/* Finds the secret of a server in the servers file of the radiusclient
+ * configuration; the lines of that file are of the "host secret" format. */
+static char *find_server_secret(void *pool, rc_handle *rh, const char *host)
+{
+	char line[512];
+	char *name, *secret, *sp;
+	const char *file;
+	char *ret = NULL;
+	FILE *fp;
+
+	file = rc_conf_str(rh, "servers");
+	if (file == NULL)
+		return NULL;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return NULL;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		name = strtok_r(line, " \t\r\n", &sp);
+		if (name == NULL || name[0] == '#')
+			continue;
+
+		secret = strtok_r(NULL, " \t\r\n", &sp);
+		if (secret != NULL && strcmp(name, host) == 0) {
+			ret = talloc_strdup(pool, secret);
+			break;
+		}
+	}
+
+	safe_memset(line, 0, sizeof(line));
+	fclose(fp);
+	return ret;
+}
+
+/* Creates a client for the servers listed in the @option of the
+ * radiusclient configuration ("authserver" or "acctserver"). The
+ * timeouts and retries are taken from the same configuration. */
+rad_client_st *radius_client_from_config(void *pool, rc_handle *rh, const char *option,
+					 unsigned default_port, unsigned max_rate)
+{
+	rad_client_st *client;
+	SERVER *srv;
+	char *secret;
+	int timeout, retries, deadtime, i;
+
+	srv = rc_conf_srv(rh, option);
+	if (srv == NULL || srv->max <= 0) {
+		fprintf(stderr, "radius: no %s is set in the radius configuration\n", option);
+		return NULL;
+	}
+
+	timeout = rc_conf_int(rh, "radius_timeout");
+	if (timeout <= 0)
+		timeout = 3;
+	retries = rc_conf_int(rh, "radius_retries");
+	if (retries < 0)
+		retries = 0;
+	deadtime = rc_conf_int(rh, "radius_deadtime");
+	if (deadtime <= 0)
+		deadtime = 30;
+
+	client = rad_client_new(pool, timeout*1000, retries, deadtime, max_rate);
+	if (client == NULL)
+		return NULL;
+
+	for (i = 0; i < srv->max; i++) {
+		if (srv->secret[i] != NULL)
+			secret = talloc_strdup(client, srv->secret[i]);
+		else
+			secret = find_server_secret(client, rh, srv->name[i]);
+
+		if (secret == NULL) {
+			fprintf(stderr, "radius: no secret found for server %s\n", srv->name[i]);
+			goto fail;
+		}
+
+		if (rad_client_add_server(client, srv->name[i], srv->port[i],
+					  default_port, secret) < 0) {
+			fprintf(stderr, "radius: could not use server %s\n", srv->name[i]);
+			goto fail;
+		}
+		safe_memset(secret, 0, strlen(secret));
+		talloc_free(secret);
+	}
+
+	return client;
+ fail:
+	talloc_free(client);
+	return NULL;
+}
+
+/* Adds the NAS-IP-Address or the NAS-IPv6-Address, and the NAS-Identifier
+ * of the server; if none is known, the local host name is used for the latter */
+void radius_add_nas_info(rad_req_st *r, const char *our_ip, const char *nas_identifier)
+{
+	struct in_addr in;
+	struct in6_addr in6;
+	char host[64];
+	unsigned have_ip = 0;
+
+	if (our_ip[0] != 0) {
+		if (inet_pton(AF_INET, our_ip, &in) != 0) {
+			rad_req_add(r, PW_NAS_IP_ADDRESS, &in, sizeof(in));
+			have_ip = 1;
+		} else if (inet_pton(AF_INET6, our_ip, &in6) != 0) {
+			rad_req_add(r, PW_NAS_IPV6_ADDRESS, &in6, sizeof(in6));
+			have_ip = 1;
+		}
+	}
+
+	if (nas_identifier[0] != 0) {
+		rad_req_add_str(r, PW_NAS_IDENTIFIER, nas_identifier);
+	} else if (have_ip == 0 && gethostname(host, sizeof(host)) == 0) {
+		host[sizeof(host)-1] = 0;
+		rad_req_add_str(r, PW_NAS_IDENTIFIER, host);
+	}
+}
 
 static void radius_vhost_init(void **_vctx, void *pool, void *additional)
 {
@@ -81,10 +198,12 @@ static void radius_vhost_init(void **_vctx, void *pool, void *additional)
 		vctx->nas_identifier[0] = 0;
 	}
 
-	if (rc_read_dictionary(vctx->rh, rc_conf_str(vctx->rh, "dictionary")) != 0) {
-		fprintf(stderr, "error reading the radius dictionary\n");
-		exit(1);
-	}
+	vctx->client = radius_client_from_config(vctx, vctx->rh, "authserver",
+						 1812, config->max_rate);
+	if (vctx->client == NULL)
+		goto fail;
+	rad_client_allow_no_msg_auth(vctx->client, config->no_msg_auth);
+
 	*_vctx = vctx;
 
 	return;
@@ -97,6 +216,9 @@ static void radius_vhost_deinit(void *_vctx)
 {
 	struct radius_vhost_ctx *vctx = _vctx;
 
+	talloc_free(vctx->client);
+	vctx->client = NULL;
+
 	if (vctx->rh != NULL)
 		rc_destroy(vctx->rh);
 }
@@ -239,206 +361,242 @@ static void parse_groupnames(struct radius_ctx_st *pctx, const char *full)
 	}
 }
 
-/* Returns 0 if the user is successfully authenticated, and sets the appropriate group name.
- */
-static int radius_auth_pass(void *ctx, const char *pass, unsigned pass_len)
+static uint32_t attr_to_uint(const rad_attr_st *a)
 {
-	struct radius_ctx_st *pctx = ctx;
-	VALUE_PAIR *send = NULL, *recvd = NULL;
-	uint32_t service;
-	char route[64];
-	char txt[64];
-	VALUE_PAIR *vp;
-	int ret;
+	return ((uint32_t)a->data[0] << 24) | ((uint32_t)a->data[1] << 16) |
+	       ((uint32_t)a->data[2] << 8) | a->data[3];
+}
 
-	/* send Access-Request */
-	syslog(LOG_DEBUG, "radius-auth: communicating username (%s) and password", pctx->username);
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_NAME, pctx->username, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		return ERR_AUTH_FAIL;
-	}
+/* Reads a prefix attribute (Framed-IPv6-Prefix, Delegated-IPv6-Prefix);
+ * its format is: reserved, prefix length, prefix */
+static int attr_to_ipv6_prefix(const rad_attr_st *a, char *txt, unsigned txt_size,
+			       unsigned *prefix)
+{
+	uint8_t ipv6[16];
 
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_USER_PASSWORD, (char*)pass, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
+	if (a->len <= 2 || a->len > 18 || a->data[1] > 128)
+		return -1;
 
-	if (pctx->our_ip[0] != 0) {
-		struct in_addr in;
-		struct in6_addr in6;
+	memset(ipv6, 0, sizeof(ipv6));
+	memcpy(ipv6, a->data+2, a->len-2);
+	if (inet_ntop(AF_INET6, ipv6, txt, txt_size) == NULL)
+		return -1;
 
-		if (inet_pton(AF_INET, pctx->our_ip, &in) != 0) {
-			in.s_addr = ntohl(in.s_addr);
-			rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IP_ADDRESS, (char*)&in, sizeof(struct in_addr), 0);
-		} else if (inet_pton(AF_INET6, pctx->our_ip, &in6) != 0) {
-			rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IPV6_ADDRESS, (char*)&in6, sizeof(struct in6_addr), 0);
-		}
-	}
+	*prefix = a->data[1];
+	return 0;
+}
 
-	if (pctx->vctx->nas_identifier[0] != 0) {
-		if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_IDENTIFIER, pctx->vctx->nas_identifier, -1, 0) == NULL) {
-			syslog(LOG_ERR,
-			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-			       pctx->username);
-			ret = ERR_AUTH_FAIL;
-			goto cleanup;
-		}
-	}
+static void append_pass_msg(struct radius_ctx_st *pctx, const rad_attr_st *a)
+{
+	unsigned len = strlen(pctx->pass_msg);
 
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_CALLING_STATION_ID, pctx->remote_ip, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
+	if (len + a->len + 1 > sizeof(pctx->pass_msg))
+		return;
 
-	if (pctx->user_agent[0] != 0) {
-		if (rc_avpair_add(pctx->vctx->rh, &send, PW_CONNECT_INFO, pctx->user_agent, -1, 0) == NULL) {
-			syslog(LOG_ERR,
-			       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-			       pctx->username);
-			ret = ERR_AUTH_FAIL;
-			goto cleanup;
-		}
-	}
+	memcpy(pctx->pass_msg+len, a->data, a->len);
+	pctx->pass_msg[len+a->len] = 0;
+}
 
-	service = PW_AUTHENTICATE_ONLY;
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_SERVICE_TYPE, &service, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
-	}
+/* Reads the configuration sent by the server on Access-Accept */
+static int parse_accept(struct radius_ctx_st *pctx, const rad_reply_st *reply)
+{
+	char route[MAX_IP_STR+8];
+	char txt[MAX_IP_STR];
+	rad_attr_st a;
+	unsigned prefix;
+	char *str;
+
+	memset(&a, 0, sizeof(a));
+	while (rad_reply_next(reply, &a)) {
+		if (a.vendor == MS_VENDOR_ID) {
+			if (a.type == MS_PRIMARY_DNS_SERVER && a.len == 4) {
+				/* MS-Primary-DNS-Server */
+				inet_ntop(AF_INET, a.data, pctx->ipv4_dns1, sizeof(pctx->ipv4_dns1));
+			} else if (a.type == MS_SECONDARY_DNS_SERVER && a.len == 4) {
+				/* MS-Secondary-DNS-Server */
+				inet_ntop(AF_INET, a.data, pctx->ipv4_dns2, sizeof(pctx->ipv4_dns2));
+			}
+			continue;
+		} else if (a.vendor != 0) {
+			continue;
+		}
 
-	service = PW_ASYNC;
-	if (rc_avpair_add(pctx->vctx->rh, &send, PW_NAS_PORT_TYPE, &service, -1, 0) == NULL) {
-		syslog(LOG_ERR,
-		       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
-		       pctx->username);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
+		if (a.type == PW_SERVICE_TYPE && a.len == 4) {
+			if (attr_to_uint(&a) != PW_FRAMED) {
+				syslog(LOG_ERR,
+				       "%s:%u: unknown radius service type '%d'", __func__, __LINE__,
+				       (int)attr_to_uint(&a));
+				return -1;
+			}
+		} else if (a.type == PW_CLASS) {
+			/* Group-Name */
+			str = talloc_strndup(pctx, (char*)a.data, a.len);
+			if (str != NULL) {
+				parse_groupnames(pctx, str);
+				talloc_free(str);
+			}
+		} else if (a.type == PW_FRAMED_IPV6_ADDRESS && a.len == 16) {
+			/* Framed-IPv6-Address */
+			if (inet_ntop(AF_INET6, a.data, pctx->ipv6, sizeof(pctx->ipv6)) != NULL) {
+				pctx->ipv6_subnet_prefix = 64;
+				strlcpy(pctx->ipv6_net, pctx->ipv6, sizeof(pctx->ipv6_net));
+			}
+		} else if (a.type == PW_DELEGATED_IPV6_PREFIX) {
+			/* Delegated-IPv6-Prefix */
+			if (attr_to_ipv6_prefix(&a, pctx->ipv6, sizeof(pctx->ipv6), &prefix) == 0)
+				pctx->ipv6_subnet_prefix = prefix;
+		} else if (a.type == PW_FRAMED_IPV6_PREFIX) {
+			/* Framed-IPv6-Prefix */
+			if (attr_to_ipv6_prefix(&a, txt, sizeof(txt), &prefix) == 0) {
+				snprintf(route, sizeof(route), "%s/%u", txt, prefix);
+				append_route(pctx, route, strlen(route));
+			}
+		} else if (a.type == PW_DNS_SERVER_IPV6_ADDRESS && a.len == 16) {
+			/* DNS-Server-IPv6-Address */
+			if (pctx->ipv6_dns1[0] == 0)
+				inet_ntop(AF_INET6, a.data, pctx->ipv6_dns1, sizeof(pctx->ipv6_dns1));
+			else
+				inet_ntop(AF_INET6, a.data, pctx->ipv6_dns2, sizeof(pctx->ipv6_dns2));
+		} else if (a.type == PW_FRAMED_IP_ADDRESS && a.len == 4) {
+			/* Framed-IP-Address */
+			if (attr_to_uint(&a) != 0xffffffff && attr_to_uint(&a) != 0xfffffffe) {
+				/* According to RFC2865 the values above (fe) instruct the
+				 * server to assign an address from the pool of the server,
+				 * and (ff) to assign address as negotiated with the client.
+				 * We don't negotiate with clients.
+				 */
+				inet_ntop(AF_INET, a.data, pctx->ipv4, sizeof(pctx->ipv4));
+			}
+		} else if (a.type == PW_FRAMED_IP_NETMASK && a.len == 4) {
+			/* Framed-IP-Netmask */
+			inet_ntop(AF_INET, a.data, pctx->ipv4_mask, sizeof(pctx->ipv4_mask));
+		} else if (a.type == PW_FRAMED_ROUTE || a.type == PW_FRAMED_IPV6_ROUTE) {
+			/* Framed-Route, Framed-IPv6-Route */
+			str = talloc_strndup(pctx, (char*)a.data, a.len);
+			if (str != NULL) {
+				append_route(pctx, str, strlen(str));
+				talloc_free(str);
+			}
+		} else if (a.type == PW_ACCT_INTERIM_INTERVAL && a.len == 4) {
+			pctx->interim_interval_secs = attr_to_uint(&a);
+		} else if (a.type == PW_SESSION_TIMEOUT && a.len == 4) {
+			pctx->session_timeout_secs = attr_to_uint(&a);
+		} else if (a.type != RAD_ATTR_REPLY_MESSAGE && a.type != RAD_ATTR_MESSAGE_AUTHENTICATOR) {
+			syslog(LOG_DEBUG, "radius-auth: ignoring server's attribute %u", a.type);
+		}
 	}
 
-	pctx->pass_msg[0] = 0;
-	ret = rc_aaa(pctx->vctx->rh, pctx->id, send, &recvd, pctx->pass_msg, 1, PW_ACCESS_REQUEST);
-
-	if (ret == OK_RC) {
-		uint32_t ipv4;
-		uint8_t ipv6[16];
+	return 0;
+}
 
-		vp = recvd;
+/* Completes the Access-Request; the result is passed to the caller of
+ * radius_auth_pass_async(), if any. */
+static void auth_pass_done(void *priv, int status, const rad_reply_st *reply)
+{
+	struct radius_ctx_st *pctx = priv;
+	void (*done)(void *, int);
+	rad_attr_st a;
+	int ret;
 
-		while(vp != NULL) {
-			if (vp->attribute == PW_SERVICE_TYPE && vp->lvalue != PW_FRAMED) {
-				syslog(LOG_ERR,
-				       "%s:%u: unknown radius service type '%d'", __func__, __LINE__,
-				       (int)vp->lvalue);
-				goto fail;
-			} else if (vp->attribute == RAD_GROUP_NAME && vp->type == PW_TYPE_STRING) {
-				/* Group-Name */
-				parse_groupnames(pctx, vp->strvalue);
-			} else if (vp->attribute == PW_FRAMED_IPV6_ADDRESS && vp->type == PW_TYPE_IPV6ADDR) {
-				/* Framed-IPv6-Address */
-				if (inet_ntop(AF_INET6, vp->strvalue, pctx->ipv6, sizeof(pctx->ipv6)) != NULL) {
-					pctx->ipv6_subnet_prefix = 64;
-					strlcpy(pctx->ipv6_net, pctx->ipv6, sizeof(pctx->ipv6_net));
-				}
-			} else if (vp->attribute == PW_DELEGATED_IPV6_PREFIX && vp->type == PW_TYPE_IPV6PREFIX) {
-				/* Delegated-IPv6-Prefix */
-				if (inet_ntop(AF_INET6, vp->strvalue, pctx->ipv6, sizeof(pctx->ipv6)) != NULL) {
-					memset(ipv6, 0, sizeof(ipv6)); 
-					memcpy(ipv6, vp->strvalue+2, vp->lvalue-2); 
-					if (inet_ntop(AF_INET6, ipv6, pctx->ipv6, sizeof(pctx->ipv6)) != NULL) {
-						pctx->ipv6_subnet_prefix = (unsigned)(unsigned char)vp->strvalue[1];
-					}
-				}
-			} else if (vp->attribute == PW_FRAMED_IPV6_PREFIX && vp->type == PW_TYPE_IPV6PREFIX) {
-				if (vp->lvalue > 2 && vp->lvalue <= 18) {
-					/* Framed-IPv6-Prefix */
-					memset(ipv6, 0, sizeof(ipv6)); 
-					memcpy(ipv6, vp->strvalue+2, vp->lvalue-2); 
-					if (inet_ntop(AF_INET6, ipv6, txt, sizeof(txt)) != NULL) {
-						snprintf(route, sizeof(route), "%s/%u", txt, (unsigned)(unsigned char)vp->strvalue[1]);
-						append_route(pctx, vp->strvalue, vp->lvalue);
-					}
-				}
-			} else if (vp->attribute == PW_DNS_SERVER_IPV6_ADDRESS && vp->type == PW_TYPE_IPV6ADDR) {
-				/* DNS-Server-IPv6-Address */
-				if (pctx->ipv6_dns1[0] == 0)
-					inet_ntop(AF_INET6, vp->strvalue, pctx->ipv6_dns1, sizeof(pctx->ipv6_dns1));
-				else
-					inet_ntop(AF_INET6, vp->strvalue, pctx->ipv6_dns2, sizeof(pctx->ipv6_dns2));
-			} else if (vp->attribute == PW_FRAMED_IP_ADDRESS && vp->type == PW_TYPE_IPADDR) {
-				/* Framed-IP-Address */
-				if (vp->lvalue != 0xffffffff && vp->lvalue != 0xfffffffe) {
-					/* According to RFC2865 the values above (fe) instruct the
-					 * server to assign an address from the pool of the server,
-					 * and (ff) to assign address as negotiated with the client.
-					 * We don't negotiate with clients.
-					 */
-					ipv4 = htonl(vp->lvalue);
-					inet_ntop(AF_INET, &ipv4, pctx->ipv4, sizeof(pctx->ipv4));
-				}
-			} else if (vp->attribute == PW_FRAMED_IP_NETMASK && vp->type == PW_TYPE_IPADDR) {
-				/* Framed-IP-Netmask */
-				ipv4 = htonl(vp->lvalue);
-				inet_ntop(AF_INET, &ipv4, pctx->ipv4_mask, sizeof(pctx->ipv4_mask));
-			} else if (vp->attribute == RAD_IPV4_DNS1 && vp->type == PW_TYPE_IPADDR) {
-				/* MS-Primary-DNS-Server */
-				ipv4 = htonl(vp->lvalue);
-				inet_ntop(AF_INET, &ipv4, pctx->ipv4_dns1, sizeof(pctx->ipv4_dns1));
-			} else if (vp->attribute == RAD_IPV4_DNS2 && vp->type == PW_TYPE_IPADDR) {
-				/* MS-Secondary-DNS-Server */
-				ipv4 = htonl(vp->lvalue);
-				inet_ntop(AF_INET, &ipv4, pctx->ipv4_dns2, sizeof(pctx->ipv4_dns2));
-			} else if (vp->attribute == PW_FRAMED_ROUTE && vp->type == PW_TYPE_STRING) {
-				/* Framed-Route */
-				append_route(pctx, vp->strvalue, vp->lvalue);
-			} else if (vp->attribute == PW_FRAMED_IPV6_ROUTE && vp->type == PW_TYPE_STRING) {
-				/* Framed-IPv6-Route */
-				append_route(pctx, vp->strvalue, vp->lvalue);
-			} else if (vp->attribute == PW_ACCT_INTERIM_INTERVAL && vp->type == PW_TYPE_INTEGER) {
-				pctx->interim_interval_secs = vp->lvalue;
-			} else if (vp->attribute == PW_SESSION_TIMEOUT && vp->type == PW_TYPE_INTEGER) {
-				pctx->session_timeout_secs = vp->lvalue;
-			} else {
-				syslog(LOG_DEBUG, "radius-auth: ignoring server's value %u of type %u", (int)vp->attribute, (int)vp->type);
-			}
-			vp = vp->next;
+	if (status == RAD_OK) {
+		memset(&a, 0, sizeof(a));
+		while (rad_reply_next(reply, &a)) {
+			if (a.vendor == 0 && a.type == RAD_ATTR_REPLY_MESSAGE)
+				append_pass_msg(pctx, &a);
 		}
+	}
 
+	if (status == RAD_OK && reply->code == RAD_CODE_ACCESS_ACCEPT &&
+	    parse_accept(pctx, reply) == 0) {
 		ret = 0;
-		goto cleanup;
 	} else {
- fail:
+		if (status != RAD_OK) {
+			syslog(LOG_ERR, "radius-auth: no reply from the radius servers for user '%s' (%d)",
+			       pctx->username, status);
+		}
+
 		if (pctx->pass_msg[0] == 0)
 			strlcpy(pctx->pass_msg, pass_msg_failed, sizeof(pctx->pass_msg));
 
 		if (pctx->retries++ < MAX_PASSWORD_TRIES-1) {
 			ret = ERR_AUTH_CONTINUE;
-			goto cleanup;
+		} else {
+			syslog(LOG_AUTH,
+			       "radius-auth: error authenticating user '%s' (code %d)",
+			       pctx->username, (status == RAD_OK) ? (int)reply->code : status);
+			ret = ERR_AUTH_FAIL;
 		}
+	}
 
-		syslog(LOG_AUTH,
-		       "radius-auth: error authenticating user '%s' (code %d)",
-		       pctx->username, ret);
-		ret = ERR_AUTH_FAIL;
-		goto cleanup;
+	pctx->result = ret;
+
+	if (pctx->done != NULL) {
+		done = pctx->done;
+		pctx->done = NULL;
+		done(pctx->done_priv, ret);
 	}
+}
 
- cleanup:
-	if (send != NULL)
-		rc_avpair_free(send);
-	if (recvd != NULL)
-		rc_avpair_free(recvd);
-	return ret;
+static rad_req_st *new_access_request(struct radius_ctx_st *pctx, const char *pass, unsigned pass_len)
+{
+	rad_req_st *r;
+
+	r = rad_req_new(pctx->vctx->client, RAD_CODE_ACCESS_REQUEST);
+	if (r == NULL)
+		return NULL;
+
+	if (rad_req_add_str(r, PW_USER_NAME, pctx->username) < 0 ||
+	    rad_req_set_password(r, pass, pass_len) < 0 ||
+	    rad_req_add_str(r, PW_CALLING_STATION_ID, pctx->remote_ip) < 0 ||
+	    rad_req_add_int(r, PW_SERVICE_TYPE, PW_AUTHENTICATE_ONLY) < 0 ||
+	    rad_req_add_int(r, PW_NAS_PORT_TYPE, PW_ASYNC) < 0 ||
+	    rad_req_add_int(r, PW_NAS_PORT, pctx->id) < 0)
+		goto fail;
+
+	if (pctx->user_agent[0] != 0) {
+		if (rad_req_add_str(r, PW_CONNECT_INFO, pctx->user_agent) < 0)
+			goto fail;
+	}
+
+	radius_add_nas_info(r, pctx->our_ip, pctx->vctx->nas_identifier);
+
+	return r;
+ fail:
+	syslog(LOG_ERR,
+	       "%s:%u: error in constructing radius message for user '%s'", __func__, __LINE__,
+	       pctx->username);
+	talloc_free(r);
+	return NULL;
+}
+
+/* Sends the Access-Request and returns ERR_WAIT_FOR_AUTH; done() is called
+ * once the server replies, or none of the servers does.
+ */
+static int radius_auth_pass_async(void *ctx, const char *pass, unsigned pass_len,
+				  void (*done)(void *priv, int result), void *priv)
+{
+	struct radius_ctx_st *pctx = ctx;
+	rad_req_st *r;
+	int ret;
+
+	syslog(LOG_DEBUG, "radius-auth: communicating username (%s) and password", pctx->username);
+
+	r = new_access_request(pctx, pass, pass_len);
+	if (r == NULL)
+		return ERR_AUTH_FAIL;
+
+	pctx->pass_msg[0] = 0;
+	pctx->done = done;
+	pctx->done_priv = priv;
+
+	ret = rad_req_send(r, auth_pass_done, pctx);
+	if (ret < 0) {
+		pctx->done = NULL;
+		auth_pass_done(pctx, ret, NULL);
+		return pctx->result;
+	}
+
+	return ERR_WAIT_FOR_AUTH;
 }
 
 static int radius_auth_msg(void *ctx, void *pool, passwd_msg_st *pst)
@@ -459,14 +617,17 @@ static void radius_auth_deinit(void *ctx)
 }
 
 const struct auth_mod_st radius_auth_funcs = {
+	.name = "radius",
 	.type = AUTH_TYPE_RADIUS | AUTH_TYPE_USERNAME_PASS,
 	.allows_retries = 1,
+	/* the calls share the vhost state and the radius client */
+	.max_concurrency = 1,
 	.vhost_init = radius_vhost_init,
 	.vhost_deinit = radius_vhost_deinit,
 	.auth_init = radius_auth_init,
 	.auth_deinit = radius_auth_deinit,
 	.auth_msg = radius_auth_msg,
-	.auth_pass = radius_auth_pass,
+	.auth_pass_async = radius_auth_pass_async,
 	.auth_user = radius_auth_user,
 	.auth_group = radius_auth_group,
 	.group_list = NULL
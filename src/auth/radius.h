@@ -31,9 +31,14 @@
 #   include <radcli/radcli.h>
 #  endif
 
+#include <radius-client.h>
+#include <acct-spool.h>
+
 struct radius_vhost_ctx {
 	rc_handle *rh;
 	char nas_identifier[64];
+	rad_client_st *client;
+	acct_spool_st *spool; /* accounting only */
 };
 
 struct radius_ctx_st {
@@ -67,10 +72,19 @@ struct radius_ctx_st {
 	unsigned retries;
 	unsigned id;
 
+	/* the pending password verification */
+	void (*done)(void *priv, int result);
+	void *done_priv;
+	int result;
+
 	struct radius_vhost_ctx *vctx;
 };
 
 extern const struct auth_mod_st radius_auth_funcs;
 
+rad_client_st *radius_client_from_config(void *pool, rc_handle *rh, const char *option,
+					 unsigned default_port, unsigned max_rate);
+void radius_add_nas_info(rad_req_st *r, const char *our_ip, const char *nas_identifier);
+
 # endif
 #endif
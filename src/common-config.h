@@ -47,6 +47,9 @@ typedef struct gssapi_cfg_st {
 typedef struct radius_cfg_st {
 	char *config;
 	char *nas_identifier;
+	unsigned max_rate; /* new requests per second; zero for no limit */
+	unsigned no_msg_auth; /* accept replies without a Message-Authenticator */
+	char *acct_spool; /* the accounting records spool file */
 } radius_cfg_st;
 
 typedef struct plain_cfg_st {
@@ -119,9 +119,19 @@ const char *cmd_request_to_str(unsigned _cmd)
 		return "ban IP";
 	case CMD_BAN_IP_REPLY:
 		return "ban IP reply";
+	case CMD_SETUP_TIME:
+		return "setup time";
+	case CMD_SESSION_TELEMETRY:
+		return "session telemetry";
+	case CMD_HOOK_RUN:
+		return "run hook";
+	case CMD_HOOK_RESULT:
+		return "hook result";
 
 	case CMD_SEC_CLI_STATS:
 		return "sm: worker cli stats";
+	case CMD_SEC_SESSION_FETCH:
+		return "sm: session fetch";
 	case CMD_SECM_CLI_STATS:
 		return "sm: main cli stats";
 	case CMD_SEC_AUTH_INIT:
@@ -530,6 +540,99 @@ int recv_msg_headers(int fd, uint8_t *cmd, unsigned timeout)
 	return l32;
 }
 
+/* Messages on the worker to sec-mod channel carry an id after the
+ * length, which matches each reply to its request. */
+int send_msg_id(void *pool, int fd, uint8_t cmd, uint32_t id,
+		const void *msg, pack_size_func get_size, pack_func pack)
+{
+	struct iovec iov[2];
+	struct msghdr hdr;
+	uint8_t header[MSG_ID_HEADER_SIZE];
+	void *packed = NULL;
+	uint32_t length32;
+	size_t length = 0;
+	int ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	if (msg)
+		length = get_size(msg);
+
+	if (length >= UINT32_MAX)
+		return -1;
+
+	length32 = length;
+	header[0] = cmd;
+	memcpy(&header[1], &length32, 4);
+	memcpy(&header[5], &id, 4);
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+
+	hdr.msg_iov = iov;
+	hdr.msg_iovlen = 1;
+
+	if (length > 0) {
+		packed = talloc_size(pool, length);
+		if (packed == NULL) {
+			syslog(LOG_ERR, "%s:%u: memory error", __FILE__,
+			       __LINE__);
+			return -1;
+		}
+
+		iov[1].iov_base = packed;
+		iov[1].iov_len = length;
+
+		ret = pack(msg, packed);
+		if (ret == 0) {
+			syslog(LOG_ERR, "%s:%u: packing error", __FILE__,
+			       __LINE__);
+			ret = -1;
+			goto cleanup;
+		}
+
+		hdr.msg_iovlen++;
+	}
+
+	do {
+		ret = sendmsg(fd, &hdr, 0);
+	} while (ret == -1 && errno == EINTR);
+	if (ret < 0) {
+		int e = errno;
+		syslog(LOG_ERR, "%s:%u: %s", __FILE__, __LINE__, strerror(e));
+	}
+
+ cleanup:
+	if (length > 0)
+		safe_memset(packed, 0, length);
+	talloc_free(packed);
+	return ret;
+}
+
+/* Returns the length of the message, or a negative error code */
+int recv_msg_headers_id(int fd, uint8_t *cmd, uint32_t *id, unsigned timeout)
+{
+	uint8_t header[MSG_ID_HEADER_SIZE];
+	uint32_t l32;
+	int ret;
+
+	ret = force_read_timeout(fd, header, sizeof(header), timeout);
+	if (ret == -1) {
+		if (errno == ENOENT)
+			return ERR_PEER_TERMINATED;
+		return ERR_BAD_COMMAND;
+	}
+
+	*cmd = header[0];
+	memcpy(&l32, &header[1], 4);
+	memcpy(id, &header[5], 4);
+
+	if (l32 > INT32_MAX)
+		return ERR_BAD_COMMAND;
+
+	return l32;
+}
+
 int recv_msg_data(int fd, uint8_t *cmd, uint8_t *data, size_t data_size,
 		  int *received_fd)
 {
@@ -79,6 +79,13 @@ inline static int recv_msg(void *pool, int fd, uint8_t cmd,
 }
 
 int recv_msg_headers(int fd, uint8_t *cmd, unsigned timeout);
+
+/* cmd, length and request id */
+#define MSG_ID_HEADER_SIZE 9
+
+int send_msg_id(void *pool, int fd, uint8_t cmd, uint32_t id,
+		const void *msg, pack_size_func get_size, pack_func pack);
+int recv_msg_headers_id(int fd, uint8_t *cmd, uint32_t *id, unsigned timeout);
 int recv_msg_data(int fd, uint8_t *cmd, uint8_t *data, size_t data_size, int *received_fd);
 
 const char* cmd_request_to_str(unsigned cmd);
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include "timer-wheel.h"
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+/* the seconds spanned by a slot of the level, and by the whole level */
+#define LEVEL_SPAN(level) ((time_t)1 << (WHEEL_SLOT_BITS * (level)))
+#define DUE_LEVEL WHEEL_LEVELS
+
+void timer_wheel_init(timer_wheel_st *w, time_t now, void *priv)
+{
+	unsigned i, j;
+
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++)
+			list_head_init(&w->slots[i][j]);
+		w->count[i] = 0;
+	}
+	list_head_init(&w->due);
+	w->elems = 0;
+	w->now = now;
+	w->priv = priv;
+}
+
+void wheel_timer_init(wheel_timer_st *t, wheel_timer_func func)
+{
+	t->expires = 0;
+	t->func = func;
+	t->level = -1;
+}
+
+/* Moves all the timers of @from at the end of @to */
+static void move_list(struct list_head *to, struct list_head *from)
+{
+	if (list_empty(from))
+		return;
+
+	from->n.next->prev = to->n.prev;
+	to->n.prev->next = from->n.next;
+	from->n.prev->next = &to->n;
+	to->n.prev = from->n.prev;
+	list_head_init(from);
+}
+
+static void place_timer(timer_wheel_st *w, wheel_timer_st *t)
+{
+	time_t expires = t->expires;
+	time_t delta;
+	unsigned level;
+
+	if (expires < w->now) {
+		list_add_tail(&w->due, &t->list);
+		t->level = DUE_LEVEL;
+		return;
+	}
+
+	delta = expires - w->now;
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < LEVEL_SPAN(level + 1))
+			break;
+	}
+
+	/* beyond the wheel; it is placed again when its slot is reached */
+	if (delta >= LEVEL_SPAN(WHEEL_LEVELS))
+		expires = w->now + LEVEL_SPAN(WHEEL_LEVELS) - 1;
+
+	list_add_tail(&w->slots[level][(expires >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK],
+		      &t->list);
+	t->level = level;
+	w->count[level]++;
+}
+
+void timer_wheel_add(timer_wheel_st *w, wheel_timer_st *t, time_t expires)
+{
+	timer_wheel_del(w, t);
+
+	t->expires = expires;
+	place_timer(w, t);
+	w->elems++;
+}
+
+void timer_wheel_del(timer_wheel_st *w, wheel_timer_st *t)
+{
+	if (t->level == -1)
+		return;
+
+	list_del(&t->list);
+	if (t->level != DUE_LEVEL)
+		w->count[t->level]--;
+	t->level = -1;
+	w->elems--;
+}
+
+/* Moves the timers of the upper level slots which start at the current
+ * second to the levels below */
+static void cascade(timer_wheel_st *w)
+{
+	struct list_head l;
+	wheel_timer_st *t;
+	unsigned level;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if ((w->now & (LEVEL_SPAN(level) - 1)) != 0)
+			break;
+
+		list_head_init(&l);
+		move_list(&l, &w->slots[level][(w->now >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK]);
+
+		while ((t = list_top(&l, wheel_timer_st, list)) != NULL) {
+			list_del(&t->list);
+			w->count[level]--;
+			place_timer(w, t);
+		}
+	}
+}
+
+/* The timers are removed one at a time, as the function of one may delete
+ * the others */
+static unsigned run_timers(timer_wheel_st *w, struct list_head *l)
+{
+	wheel_timer_st *t;
+	unsigned ran = 0;
+
+	while ((t = list_top(l, wheel_timer_st, list)) != NULL) {
+		timer_wheel_del(w, t);
+		t->func(w->priv, t);
+		ran++;
+	}
+
+	return ran;
+}
+
+unsigned timer_wheel_run(timer_wheel_st *w, time_t now)
+{
+	struct list_head l;
+	time_t next, span;
+	unsigned level, ran = 0;
+
+	list_head_init(&l);
+	move_list(&l, &w->due);
+	ran += run_timers(w, &l);
+
+	while (w->now <= now) {
+		if (w->elems == 0) {
+			w->now = now + 1;
+			break;
+		}
+
+		cascade(w);
+
+		move_list(&l, &w->slots[0][w->now & SLOT_MASK]);
+		w->now++;
+		ran += run_timers(w, &l);
+
+		/* skip the seconds with no timers due and nothing to cascade */
+		span = 1;
+		for (level = 0; level < WHEEL_LEVELS - 1 && w->count[level] == 0; level++)
+			span = LEVEL_SPAN(level + 1);
+		next = (w->now + span - 1) & ~(span - 1);
+		w->now = next <= now ? next : now + 1;
+	}
+
+	/* the timers re-armed for the past by the functions run */
+	move_list(&l, &w->due);
+	ran += run_timers(w, &l);
+
+	return ran;
+}
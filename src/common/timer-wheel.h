@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TIMER_WHEEL_H
+# define TIMER_WHEEL_H
+
+#include <time.h>
+#include <ccan/list/list.h>
+#include <ccan/container_of/container_of.h>
+
+/* A hierarchical timer wheel with a resolution of a second, used to
+ * expire the entries of the databases without scanning them.
+ *
+ * The timers are embedded in the entries. Each level has WHEEL_SLOTS
+ * slots, with a slot of a level spanning the whole of the previous
+ * level; the timers due within WHEEL_SLOTS seconds are kept in the slot
+ * of their second, and the later ones in the slot of the first level
+ * which covers them. When the time reaches a slot of an upper level its
+ * timers are moved to the levels below, so that each timer is moved at
+ * most WHEEL_LEVELS times. The timers due beyond the range of the wheel
+ * are kept in its last slot and placed again when it is reached.
+ *
+ * Adding, re-arming and removing a timer take constant time, and running
+ * the wheel takes time proportional to the timers which are due.
+ */
+
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_LEVELS 4
+
+struct wheel_timer_st;
+
+/* Called for a timer which is due. The timer is no longer armed, and the
+ * function may re-arm it, or free the structure containing it. */
+typedef void (*wheel_timer_func)(void *priv, struct wheel_timer_st *t);
+
+typedef struct wheel_timer_st {
+	struct list_node list;
+	time_t expires;
+	wheel_timer_func func;
+	int level; /* the level it is in, or -1 when not armed */
+} wheel_timer_st;
+
+typedef struct timer_wheel_st {
+	struct list_head slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	struct list_head due; /* the timers armed for the past */
+	unsigned count[WHEEL_LEVELS];
+	unsigned elems;
+	time_t now; /* the next second to be run */
+	void *priv; /* passed to the functions of the timers */
+} timer_wheel_st;
+
+void timer_wheel_init(timer_wheel_st *w, time_t now, void *priv);
+
+void wheel_timer_init(wheel_timer_st *t, wheel_timer_func func);
+
+#define wheel_timer_armed(t) ((t)->level != -1)
+
+/* Arms the timer to be run once the wheel is run for @expires, or
+ * re-arms it if it already is */
+void timer_wheel_add(timer_wheel_st *w, wheel_timer_st *t, time_t expires);
+void timer_wheel_del(timer_wheel_st *w, wheel_timer_st *t);
+
+/* Runs the functions of the timers due up to and including @now, and
+ * returns their number */
+unsigned timer_wheel_run(timer_wheel_st *w, time_t now);
+
+#endif
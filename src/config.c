@@ -51,6 +51,7 @@
 #include <vpn.h>
 #include <main.h>
 #include <tlslib.h>
+#include <sealed-cookie.h>
 #include <occtl/ctl.h>
 #include "common-config.h"
 
@@ -491,6 +492,10 @@ static void apply_default_conf(vhost_cfg_st *vhost, unsigned reload)
 	if (!reload) { /* perm config defaults */
 		tls_vhost_init(vhost);
 		vhost->perm_config.stats_reset_time = 24*60*60*7; /* weekly */
+		vhost->perm_config.hook_runner = 1;
+		vhost->perm_config.max_concurrent_hooks = DEFAULT_MAX_CONCURRENT_HOOKS;
+		vhost->perm_config.auth_threads = DEFAULT_AUTH_THREADS;
+		vhost->perm_config.sealed_cookie_lifetime = SEALED_COOKIE_DEFAULT_LIFETIME;
 	}
 
 	vhost->perm_config.config->mobile_idle_timeout = (unsigned)-1;
@@ -500,6 +505,9 @@ static void apply_default_conf(vhost_cfg_st *vhost, unsigned reload)
 	vhost->perm_config.config->auth_timeout = DEFAULT_AUTH_TIMEOUT_SECS;
 	vhost->perm_config.config->ban_reset_time = DEFAULT_BAN_RESET_TIME;
 	vhost->perm_config.config->max_ban_score = DEFAULT_MAX_BAN_SCORE;
+	vhost->perm_config.config->ban_ipv4_prefix = DEFAULT_BAN_IPV4_PREFIX;
+	vhost->perm_config.config->ban_ipv6_prefix = DEFAULT_BAN_IPV6_PREFIX;
+	vhost->perm_config.config->max_ban_prefix_score = DEFAULT_MAX_BAN_PREFIX_SCORE;
 	vhost->perm_config.config->ban_points_wrong_password = DEFAULT_PASSWORD_POINTS;
 	vhost->perm_config.config->ban_points_connect = DEFAULT_CONNECT_POINTS;
 	vhost->perm_config.config->ban_points_kkdcp = DEFAULT_KKDCP_POINTS;
@@ -511,6 +519,8 @@ static void apply_default_conf(vhost_cfg_st *vhost, unsigned reload)
 	vhost->perm_config.config->use_utmp = 1;
 	vhost->perm_config.config->keepalive = 3600;
 	vhost->perm_config.config->dpd = 60;
+	vhost->perm_config.config->pending_queue_size = DEFAULT_PENDING_QUEUE_SIZE;
+	vhost->perm_config.config->overload_retry_after = DEFAULT_OVERLOAD_RETRY_AFTER;
 
 }
 
@@ -767,6 +777,42 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 			 * re-read configuration too */
 			if (!PWARN_ON_VHOST(vhost->name, "server-stats-reset-time", stats_reset_time))
 				READ_NUMERIC(vhost->perm_config.stats_reset_time);
+		} else if (strcmp(name, "use-hook-runner") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "use-hook-runner", hook_runner))
+				READ_TF(vhost->perm_config.hook_runner);
+		} else if (strcmp(name, "max-concurrent-hooks") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "max-concurrent-hooks", max_concurrent_hooks))
+				READ_NUMERIC(vhost->perm_config.max_concurrent_hooks);
+		} else if (strcmp(name, "auth-threads") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "auth-threads", auth_threads))
+				READ_NUMERIC(vhost->perm_config.auth_threads);
+		} else if (strcmp(name, "key-threads") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "key-threads", key_threads))
+				READ_NUMERIC(vhost->perm_config.key_threads);
+		} else if (strcmp(name, "sealed-cookie-key-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "sealed-cookie-key-file", sealed_cookie_key_file))
+				PREAD_STRING(pool, vhost->perm_config.sealed_cookie_key_file);
+		} else if (strcmp(name, "sealed-cookie-lifetime") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "sealed-cookie-lifetime", sealed_cookie_lifetime))
+				READ_NUMERIC(vhost->perm_config.sealed_cookie_lifetime);
+		} else if (strcmp(name, "sealed-cookie-revocation-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "sealed-cookie-revocation-file", sealed_cookie_revocation_file))
+				PREAD_STRING(pool, vhost->perm_config.sealed_cookie_revocation_file);
+		} else if (strcmp(name, "tls-session-tickets") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "tls-session-tickets", tls_session_tickets))
+				READ_TF(vhost->perm_config.tls_session_tickets);
+		} else if (strcmp(name, "shared-state-server") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "shared-state-server", shared_state_server))
+				PREAD_STRING(pool, vhost->perm_config.shared_state_server);
+		} else if (strcmp(name, "metrics-socket-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "metrics-socket-file", metrics_socket_file))
+				PREAD_STRING(pool, vhost->perm_config.metrics_socket_file);
+		} else if (strcmp(name, "metrics-port") == 0) {
+			if (!PWARN_ON_VHOST(vhost->name, "metrics-port", metrics_port))
+				READ_NUMERIC(vhost->perm_config.metrics_port);
+		} else if (strcmp(name, "event-socket-file") == 0) {
+			if (!PWARN_ON_VHOST_STRDUP(vhost->name, "event-socket-file", event_socket_file))
+				PREAD_STRING(pool, vhost->perm_config.event_socket_file);
 		} else if (strcmp(name, "pid-file") == 0) {
 			if (pid_file[0] == 0) {
 				READ_STATIC_STRING(pid_file);
@@ -883,6 +929,9 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 	} else if (strcmp(name, "ping-leases") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "ping_leases", ping_leases))
 			READ_TF(config->ping_leases);
+	} else if (strcmp(name, "tun-pool-size") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "tun-pool-size", tun_pool_size))
+			READ_NUMERIC(config->tun_pool_size);
 	} else if (strcmp(name, "restrict-user-to-routes") == 0) {
 		READ_TF(config->restrict_user_to_routes);
 	} else if (strcmp(name, "restrict-user-to-ports") == 0) {
@@ -936,6 +985,15 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 	} else if (strcmp(name, "max-clients") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "max-clients", max_clients))
 			READ_NUMERIC(config->max_clients);
+	} else if (strcmp(name, "max-pending-clients") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "max-pending-clients", max_pending_clients))
+			READ_NUMERIC(config->max_pending_clients);
+	} else if (strcmp(name, "pending-queue-size") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "pending-queue-size", pending_queue_size))
+			READ_NUMERIC(config->pending_queue_size);
+	} else if (strcmp(name, "overload-retry-after") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "overload-retry-after", overload_retry_after))
+			READ_NUMERIC(config->overload_retry_after);
 	} else if (strcmp(name, "min-reauth-time") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "min-reauth-time", min_reauth_time))
 			READ_NUMERIC(config->min_reauth_time);
@@ -945,6 +1003,15 @@ static int cfg_ini_handler(void *_ctx, const char *section, const char *name, co
 	} else if (strcmp(name, "max-ban-score") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "max-ban-score", max_ban_score))
 			READ_NUMERIC( config->max_ban_score);
+	} else if (strcmp(name, "ban-ipv4-prefix") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "ban-ipv4-prefix", ban_ipv4_prefix))
+			READ_NUMERIC(config->ban_ipv4_prefix);
+	} else if (strcmp(name, "ban-ipv6-prefix") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "ban-ipv6-prefix", ban_ipv6_prefix))
+			READ_NUMERIC(config->ban_ipv6_prefix);
+	} else if (strcmp(name, "max-ban-prefix-score") == 0) {
+		if (!WARN_ON_VHOST(vhost->name, "max-ban-prefix-score", max_ban_prefix_score))
+			READ_NUMERIC(config->max_ban_prefix_score);
 	} else if (strcmp(name, "ban-points-wrong-password") == 0) {
 		if (!WARN_ON_VHOST(vhost->name, "ban-points-wrong-password", ban_points_wrong_password))
 			READ_NUMERIC(config->ban_points_wrong_password);
@@ -1345,6 +1412,30 @@ static void check_cfg(vhost_cfg_st *vhost, vhost_cfg_st *defvhost, unsigned sile
 		}
 	}
 
+#ifdef HAVE_RADIUS
+	/* the radius accounting records are only sent from the spool */
+	if (vhost->perm_config.acct.amod == &radius_acct_funcs &&
+	    ((radius_cfg_st *)vhost->perm_config.acct.additional)->acct_spool == NULL) {
+		fprintf(stderr, ERRSTR"%sthe radius accounting method requires the 'spool' option\n",
+			PREFIX_VHOST(vhost));
+		exit(1);
+	}
+#endif
+
+	/* the shared state is sealed with the key of the cookies */
+	if (defvhost->perm_config.shared_state_server &&
+	    defvhost->perm_config.sealed_cookie_key_file == NULL) {
+		fprintf(stderr, ERRSTR"%s'shared-state-server' requires 'sealed-cookie-key-file' to be set\n",
+			PREFIX_VHOST(vhost));
+		exit(1);
+	}
+
+	if (defvhost->perm_config.sealed_cookie_key_file &&
+	    vhost->perm_config.sup_config_type == SUP_CONFIG_RADIUS && !silent) {
+		fprintf(stderr, WARNSTR"%sthe sessions with radius supplemental config are not restored from their sealed cookies\n",
+			PREFIX_VHOST(vhost));
+	}
+
 }
 
 static const struct option long_options[] = {
@@ -38,6 +38,28 @@
 #define REASON_ERROR 6
 #define REASON_SESSION_TIMEOUT 7
 
+/* The phases of the session setup, in the order they happen. The
+ * ones timed by the workers, and by sec-mod for them, are sent to main
+ * with a single CMD_SETUP_TIME at the end of the worker's setup. */
+typedef enum {
+	SETUP_QUEUE, /* waiting for admission */
+	SETUP_FORK, /* the worker starting */
+	SETUP_TLS_HANDSHAKE,
+	SETUP_AUTH_QUEUE, /* the auth module calls waiting for a sec-mod thread */
+	SETUP_AUTH, /* the auth module calls; excludes the time the client takes to reply */
+	SETUP_COOKIE, /* until main has accepted the cookie; includes the next three */
+	SETUP_SESSION_OPEN, /* the session open in sec-mod */
+	SETUP_TUN, /* the device and the routes */
+	SETUP_CONNECT_SCRIPT,
+	SETUP_CSTP_CONNECT, /* until the CONNECT reply */
+	SETUP_DTLS, /* from the CONNECT reply to the DTLS handshake */
+	SETUP_PHASES
+} setup_phase_t;
+
+#define SETUP_WORKER_PHASE(p) ((p) == SETUP_FORK || (p) == SETUP_TLS_HANDSHAKE || \
+	(p) == SETUP_AUTH_QUEUE || (p) == SETUP_AUTH || (p) == SETUP_COOKIE || \
+	(p) == SETUP_CSTP_CONNECT || (p) == SETUP_DTLS)
+
 /* Timeout (secs) for communication between main and sec-mod */
 #define MAIN_SEC_MOD_TIMEOUT 120
 #define MAX_WAIT_SECS 3
@@ -73,6 +95,12 @@ typedef enum {
 	CMD_SESSION_INFO = 13,
 	CMD_BAN_IP = 16,
 	CMD_BAN_IP_REPLY = 17,
+	CMD_SETUP_TIME = 18,
+	CMD_SESSION_TELEMETRY = 19,
+
+	/* from main to the hook runner and vice versa */
+	CMD_HOOK_RUN = 40,
+	CMD_HOOK_RESULT = 41,
 
 	/* from worker to sec-mod */
 	CMD_SEC_AUTH_INIT = 120,
@@ -84,6 +112,7 @@ typedef enum {
 	CMD_SEC_SIGN_HASH,
 	CMD_SEC_GET_PK,
 	CMD_SEC_CLI_STATS,
+	CMD_SEC_SESSION_FETCH,
 
 	/* from main to sec-mod and vice versa */
 	MIN_SECM_CMD=239,
@@ -114,6 +143,11 @@ typedef enum {
 #define ERR_PEER_TERMINATED -11
 #define ERR_CTL -12
 #define ERR_NO_CMD_FD -13
+#define ERR_WAIT_FOR_PROBE -14
+#define ERR_WAIT_FOR_AUTH -15
+#define ERR_WAIT_FOR_KEY -16
+#define ERR_WAIT_FOR_STATE -17
+#define ERR_WAIT_FOR_NETLINK -18
 
 #define ERR_WORKER_TERMINATED ERR_PEER_TERMINATED
 
@@ -25,6 +25,7 @@
 #include <config.h>
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
 
 /* emulate gnulib's gettime using gettimeofday to avoid linking to
  * librt */
@@ -43,6 +44,20 @@ struct timeval tv;
 #endif
 }
 
+/* a fine-grained monotonic clock, for measuring short intervals */
+inline static void
+gettime_mono (struct timespec *t)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  clock_gettime (CLOCK_MONOTONIC, t);
+#else
+struct timeval tv;
+  gettimeofday (&tv, NULL);
+  t->tv_sec = tv.tv_sec;
+  t->tv_nsec = tv.tv_usec * 1000;
+#endif
+}
+
 inline static
 unsigned int
 timespec_sub_ms (struct timespec *a, struct timespec *b)
@@ -51,4 +66,12 @@ timespec_sub_ms (struct timespec *a, struct timespec *b)
           (b->tv_sec * 1000 + b->tv_nsec / (1000 * 1000)));
 }
 
+inline static
+uint64_t
+timespec_sub_us (struct timespec *a, struct timespec *b)
+{
+  return ((uint64_t)a->tv_sec * 1000000 + a->tv_nsec / 1000 -
+          ((uint64_t)b->tv_sec * 1000000 + b->tv_nsec / 1000));
+}
+
 #endif
@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <talloc.h>
+#include <system.h>
+#include <cloexec.h>
+#include <ccan/list/list.h>
+#include <common.h>
+#include <vpn.h>
+#include <ipc.pb-c.h>
+#include <hook-runner.h>
+
+/* The hook runner is a small process forked by main before it
+ * loads any per-connection state. Main used to fork itself for every
+ * connect, disconnect and host-update script; with many clients that
+ * copies its full page table per event. Here scripts are queued and at
+ * most max_running of them are executed at once. The scripts of a single
+ * session (worker pid) are executed in the order they were received, and
+ * the disconnect script of a session is skipped when its connect script
+ * failed; main queues both while the connect script is pending.
+ */
+
+typedef struct hook_job_st {
+	struct list_node list;
+	pid_t pid; /* the script's pid when running */
+	HookRunMsg *msg;
+} hook_job_st;
+
+/* A session whose connect script failed */
+typedef struct failed_connect_st {
+	struct list_node list;
+	uint32_t session;
+	time_t time;
+} failed_connect_st;
+
+typedef struct hook_runner_st {
+	struct list_head queue;
+	unsigned queued;
+	struct list_head running;
+	unsigned n_running;
+	unsigned max_running;
+
+	struct list_head failed; /* of failed_connect_st, the oldest first */
+	unsigned n_failed;
+
+	int cmd_fd;
+
+	int event_fd;
+	int subscribers[MAX_EVENT_SUBSCRIBERS];
+	unsigned n_subscribers;
+} hook_runner_st;
+
+static volatile sig_atomic_t need_reap = 0;
+
+static void handle_sigchld(int signo)
+{
+	need_reap = 1;
+}
+
+static void send_result(hook_runner_st *h, uint32_t id, unsigned status)
+{
+	HookResultMsg msg = HOOK_RESULT_MSG__INIT;
+	int ret;
+
+	msg.id = id;
+	msg.status = status;
+
+	ret = send_msg(h, h->cmd_fd, CMD_HOOK_RESULT, &msg,
+		       (pack_size_func) hook_result_msg__get_packed_size,
+		       (pack_func) hook_result_msg__pack);
+	if (ret < 0) {
+		syslog(LOG_ERR, "hook-runner: could not send result to main");
+	}
+}
+
+static void remove_subscriber(hook_runner_st *h, unsigned i)
+{
+	close(h->subscribers[i]);
+	h->subscribers[i] = h->subscribers[--h->n_subscribers];
+}
+
+/* Forwards the event (without the script) to the subscribers. The
+ * sockets are non-blocking; a subscriber that does not keep up loses
+ * events rather than delaying the scripts. */
+static void publish_event(hook_runner_st *h, const HookRunMsg *job_msg)
+{
+	HookRunMsg msg = HOOK_RUN_MSG__INIT;
+	uint8_t *packed;
+	uint32_t length;
+	unsigned i;
+	int ret;
+
+	if (h->n_subscribers == 0)
+		return;
+
+	msg.reason = job_msg->reason;
+	msg.session = job_msg->session;
+	msg.env = job_msg->env;
+	msg.n_env = job_msg->n_env;
+
+	length = hook_run_msg__get_packed_size(&msg);
+
+	/* same framing as send_msg() */
+	packed = talloc_size(h, 5 + length);
+	if (packed == NULL)
+		return;
+
+	packed[0] = CMD_HOOK_RUN;
+	memcpy(&packed[1], &length, 4);
+	hook_run_msg__pack(&msg, &packed[5]);
+
+	for (i = 0; i < h->n_subscribers;) {
+		ret = send(h->subscribers[i], packed, 5 + length, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			remove_subscriber(h, i);
+			continue;
+		}
+		i++;
+	}
+
+	talloc_free(packed);
+}
+
+static void record_failed_connect(hook_runner_st *h, uint32_t session)
+{
+	failed_connect_st *f, *pos;
+	time_t now = time(0);
+
+	list_for_each_safe(&h->failed, f, pos, list) {
+		if (now - f->time < FAILED_CONNECT_TIME && h->n_failed < MAX_QUEUED_HOOKS)
+			break;
+		list_del(&f->list);
+		h->n_failed--;
+		talloc_free(f);
+	}
+
+	f = talloc(h, failed_connect_st);
+	if (f == NULL)
+		return;
+
+	f->session = session;
+	f->time = now;
+	list_add_tail(&h->failed, &f->list);
+	h->n_failed++;
+}
+
+/* Returns non-zero if the last connect script of the session failed,
+ * and forgets it */
+static unsigned take_failed_connect(hook_runner_st *h, uint32_t session)
+{
+	failed_connect_st *f, *pos;
+
+	list_for_each_safe(&h->failed, f, pos, list) {
+		if (f->session == session) {
+			list_del(&f->list);
+			h->n_failed--;
+			talloc_free(f);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#define IS_REASON(job, r) (strcmp((job)->msg->reason, r) == 0)
+
+static unsigned session_is_running(hook_runner_st *h, uint32_t session)
+{
+	hook_job_st *job;
+
+	list_for_each(&h->running, job, list) {
+		if (job->msg->session == session)
+			return 1;
+	}
+	return 0;
+}
+
+static void exec_job(hook_runner_st *h, hook_job_st *job)
+{
+	sigset_t emptyset;
+	unsigned i;
+
+	sigemptyset(&emptyset);
+	sigprocmask(SIG_SETMASK, &emptyset, NULL);
+	ocsignal(SIGCHLD, SIG_DFL);
+
+	for (i = 0; i < job->msg->n_env; i++)
+		putenv(job->msg->env[i]);
+
+	/* set stdout to be stderr to avoid confusing scripts - note we have stdout closed */
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		int e = errno;
+		syslog(LOG_INFO, "hook-runner: cannot dup2(STDERR_FILENO, STDOUT_FILENO): %s", strerror(e));
+	}
+
+	execl(job->msg->script, job->msg->script, NULL);
+
+	syslog(LOG_ERR, "hook-runner: could not execute script %s", job->msg->script);
+	exit(1);
+}
+
+/* Starts the queued jobs in order, skipping the ones whose session
+ * has a script already running. */
+static void start_jobs(hook_runner_st *h)
+{
+	hook_job_st *job, *pos;
+	pid_t pid;
+
+	list_for_each_safe(&h->queue, job, pos, list) {
+		if (h->n_running >= h->max_running)
+			return;
+
+		if (session_is_running(h, job->msg->session))
+			continue;
+
+		list_del(&job->list);
+		h->queued--;
+
+		/* a failure of an earlier session with the same pid is
+		 * forgotten on the next connect */
+		if (IS_REASON(job, "connect")) {
+			take_failed_connect(h, job->msg->session);
+		} else if (IS_REASON(job, "disconnect") &&
+			   take_failed_connect(h, job->msg->session)) {
+			syslog(LOG_DEBUG, "hook-runner: skipping the disconnect script of %u; its connect script failed",
+			       (unsigned)job->msg->session);
+			if (job->msg->id != 0)
+				send_result(h, job->msg->id, 1);
+			talloc_free(job);
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			exec_job(h, job);
+		} else if (pid == -1) {
+			syslog(LOG_ERR, "hook-runner: could not fork()");
+			if (IS_REASON(job, "connect"))
+				record_failed_connect(h, job->msg->session);
+			if (job->msg->id != 0)
+				send_result(h, job->msg->id, 1);
+			talloc_free(job);
+			continue;
+		}
+
+		job->pid = pid;
+		list_add_tail(&h->running, &job->list);
+		h->n_running++;
+	}
+}
+
+static void reap_jobs(hook_runner_st *h)
+{
+	hook_job_st *job, *pos;
+	int status, estatus;
+	pid_t pid;
+
+	need_reap = 0;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		list_for_each_safe(&h->running, job, pos, list) {
+			if (job->pid != pid)
+				continue;
+
+			estatus = WEXITSTATUS(status);
+			if (WIFSIGNALED(status))
+				estatus = 1;
+
+			if (estatus != 0 && IS_REASON(job, "connect"))
+				record_failed_connect(h, job->msg->session);
+
+			if (job->msg->id != 0)
+				send_result(h, job->msg->id, estatus);
+
+			list_del(&job->list);
+			h->n_running--;
+			talloc_free(job);
+			break;
+		}
+	}
+}
+
+static void handle_main_command(hook_runner_st *h)
+{
+	hook_job_st *job;
+	int ret;
+
+	job = talloc_zero(h, hook_job_st);
+	if (job == NULL) {
+		syslog(LOG_ERR, "hook-runner: memory error");
+		exit(1);
+	}
+
+	ret = recv_msg(job, h->cmd_fd, CMD_HOOK_RUN,
+		       (void *)&job->msg,
+		       (unpack_func) hook_run_msg__unpack, 0);
+	if (ret == ERR_PEER_TERMINATED) {
+		/* main has exited */
+		exit(0);
+	} else if (ret < 0) {
+		syslog(LOG_ERR, "hook-runner: error receiving command from main");
+		exit(1);
+	}
+
+	publish_event(h, job->msg);
+
+	if (job->msg->script == NULL) {
+		talloc_free(job);
+		return;
+	}
+
+	if (h->queued >= MAX_QUEUED_HOOKS) {
+		syslog(LOG_ERR, "hook-runner: too many queued scripts; ignoring %s (%s)",
+		       job->msg->script, job->msg->reason);
+		if (job->msg->id != 0)
+			send_result(h, job->msg->id, 1);
+		talloc_free(job);
+		return;
+	}
+
+	list_add_tail(&h->queue, &job->list);
+	h->queued++;
+}
+
+static void accept_subscriber(hook_runner_st *h)
+{
+	int fd;
+
+	fd = accept(h->event_fd, NULL, NULL);
+	if (fd == -1)
+		return;
+
+	if (h->n_subscribers >= MAX_EVENT_SUBSCRIBERS) {
+		syslog(LOG_INFO, "hook-runner: too many event subscribers; rejecting");
+		close(fd);
+		return;
+	}
+
+	set_cloexec_flag(fd, 1);
+	h->subscribers[h->n_subscribers++] = fd;
+}
+
+/* Subscribers only receive; anything readable is either the end of
+ * the connection or garbage that we discard. */
+static void check_subscriber(hook_runner_st *h, unsigned i)
+{
+	uint8_t buf[64];
+	int ret;
+
+	ret = recv(h->subscribers[i], buf, sizeof(buf), MSG_DONTWAIT);
+	if (ret == 0 || (ret == -1 && errno != EAGAIN && errno != EINTR))
+		remove_subscriber(h, i);
+}
+
+static int listen_event_socket(const char *event_socket)
+{
+	struct sockaddr_un sa;
+	int fd, ret, e;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlcpy(sa.sun_path, event_socket, sizeof(sa.sun_path)) >= sizeof(sa.sun_path)) {
+		syslog(LOG_ERR, "hook-runner: event socket path too long: %s", event_socket);
+		return -1;
+	}
+	remove(event_socket);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd == -1) {
+		e = errno;
+		syslog(LOG_ERR, "hook-runner: could not create socket '%s': %s", event_socket,
+		       strerror(e));
+		return -1;
+	}
+	set_cloexec_flag(fd, 1);
+
+	umask(066);
+	ret = bind(fd, (struct sockaddr *)&sa, SUN_LEN(&sa));
+	if (ret == -1) {
+		e = errno;
+		syslog(LOG_ERR, "hook-runner: could not bind socket '%s': %s", event_socket,
+		       strerror(e));
+		close(fd);
+		return -1;
+	}
+
+	ret = listen(fd, 16);
+	if (ret == -1) {
+		e = errno;
+		syslog(LOG_ERR, "hook-runner: could not listen to socket '%s': %s",
+		       event_socket, strerror(e));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void hook_runner_server(int cmd_fd, unsigned max_running, const char *event_socket)
+{
+	hook_runner_st *h;
+	fd_set rd_set;
+	int n, ret, e;
+	unsigned i;
+#ifdef HAVE_PSELECT
+	struct timespec ts;
+#else
+	struct timeval ts;
+#endif
+	sigset_t emptyset, blockset;
+
+	sigemptyset(&blockset);
+	sigemptyset(&emptyset);
+	sigaddset(&blockset, SIGCHLD);
+
+	h = talloc_zero(NULL, hook_runner_st);
+	if (h == NULL) {
+		syslog(LOG_ERR, "hook-runner: memory error");
+		exit(1);
+	}
+
+	list_head_init(&h->queue);
+	list_head_init(&h->running);
+	list_head_init(&h->failed);
+	h->cmd_fd = cmd_fd;
+	h->max_running = max_running;
+	if (h->max_running == 0)
+		h->max_running = 1;
+
+	h->event_fd = -1;
+	if (event_socket != NULL)
+		h->event_fd = listen_event_socket(event_socket);
+
+	ocsignal(SIGINT, SIG_DFL);
+	ocsignal(SIGTERM, SIG_DFL);
+	ocsignal(SIGHUP, SIG_IGN);
+	ocsignal(SIGALRM, SIG_IGN);
+	ocsignal(SIGCHLD, handle_sigchld);
+
+	sigprocmask(SIG_BLOCK, &blockset, NULL);
+
+	for (;;) {
+		if (need_reap)
+			reap_jobs(h);
+
+		start_jobs(h);
+
+		FD_ZERO(&rd_set);
+		n = 0;
+
+		FD_SET(cmd_fd, &rd_set);
+		n = MAX(n, cmd_fd);
+
+		if (h->event_fd >= 0) {
+			FD_SET(h->event_fd, &rd_set);
+			n = MAX(n, h->event_fd);
+		}
+
+		for (i = 0; i < h->n_subscribers; i++) {
+			FD_SET(h->subscribers[i], &rd_set);
+			n = MAX(n, h->subscribers[i]);
+		}
+
+#ifdef HAVE_PSELECT
+		ts.tv_nsec = 0;
+		ts.tv_sec = 120;
+		ret = pselect(n + 1, &rd_set, NULL, NULL, &ts, &emptyset);
+#else
+		ts.tv_usec = 0;
+		ts.tv_sec = 120;
+		sigprocmask(SIG_UNBLOCK, &blockset, NULL);
+		ret = select(n + 1, &rd_set, NULL, NULL, &ts);
+		sigprocmask(SIG_BLOCK, &blockset, NULL);
+#endif
+		if (ret == 0 || (ret == -1 && errno == EINTR))
+			continue;
+
+		if (ret < 0) {
+			e = errno;
+			syslog(LOG_ERR, "hook-runner: error in pselect(): %s",
+			       strerror(e));
+			exit(1);
+		}
+
+		/* the subscribers are checked before any new accept() or
+		 * event could re-arrange the array */
+		for (i = h->n_subscribers; i > 0; i--) {
+			if (FD_ISSET(h->subscribers[i-1], &rd_set))
+				check_subscriber(h, i-1);
+		}
+
+		if (FD_ISSET(cmd_fd, &rd_set))
+			handle_main_command(h);
+
+		if (h->event_fd >= 0 && FD_ISSET(h->event_fd, &rd_set))
+			accept_subscriber(h);
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HOOK_RUNNER_H
+# define HOOK_RUNNER_H
+
+/* Maximum number of scripts waiting for a free slot */
+#define MAX_QUEUED_HOOKS 4096
+
+/* The time a failed connect script is remembered, waiting for the
+ * disconnect script of its session to be skipped */
+#define FAILED_CONNECT_TIME 600
+
+/* Maximum number of connected event stream subscribers */
+#define MAX_EVENT_SUBSCRIBERS 32
+
+/* The hook runner process. It receives HookRunMsg from main over cmd_fd,
+ * executes at most max_running scripts at a time, and reports the exit
+ * status of the scripts main waits for. When event_socket is set, each
+ * event is also forwarded to the processes connected to it. */
+void hook_runner_server(int cmd_fd, unsigned max_running, const char *event_socket);
+
+#endif
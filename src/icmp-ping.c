@@ -86,7 +86,14 @@
 #include <errno.h>
 #include <gnutls/crypto.h>
 #include <icmp-ping.h>
-#include <poll.h>
+#include <ip-lease.h>
+#include <ip-util.h>
+#include <cloexec.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+#include <ccan/list/list.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #ifndef ICMP_DEST_UNREACH
 # ifdef ICMP_UNREACH
@@ -138,211 +145,558 @@ static int in_cksum(unsigned short *buf, int sz)
 	return ans;
 }
 
-inline static int retry(int e)
+/* The time in seconds we wait for a reply; an echo request is
+ * sent every PING_INTERVAL seconds until then. */
+#define PING_TIMEOUT 3
+#define PING_INTERVAL 1
+#define PING_TIMER_INTERVAL 0.25
+
+/* How long the result of a probe is remembered */
+#define PING_CACHE_BUSY_TIME 300
+#define PING_CACHE_FREE_TIME 30
+#define PING_CACHE_MAX 4096
+
+/* The number of addresses found in use, before the lease fails */
+#define MAX_PROBE_ROUNDS 8
+
+struct ping_cache_st {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	time_t expires;
+	unsigned busy;
+};
+
+struct icmp_probe_st {
+	struct list_node list;
+	struct proc_st *proc;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint16_t seq;
+	ev_tstamp started;
+	ev_tstamp last_sent;
+};
+
+struct icmp_ping_st {
+	int fd4;
+	int fd6;
+	ev_io io4;
+	ev_io io6;
+	ev_timer timer;
+
+	uint16_t id;
+	uint16_t seq;
+	struct list_head probes;
+
+	struct htable cache;
+	unsigned cache_size;
+};
+
+static size_t rehash(const void *_e, void *unused)
+{
+	const struct ping_cache_st *e = _e;
+
+	return hash_any(SA_IN_P_GENERIC(&e->addr, e->addr_len), SA_IN_SIZE(e->addr_len), 0);
+}
+
+static bool cache_cmp(const void *_c1, void *_c2)
 {
-	if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR)
+	const struct ping_cache_st *c1 = _c1;
+	struct ping_cache_st *c2 = _c2;
+
+	if (c1->addr_len == c2->addr_len &&
+	    memcmp(SA_IN_P_GENERIC(&c1->addr, c1->addr_len),
+		   SA_IN_P_GENERIC(&c2->addr, c2->addr_len),
+		   SA_IN_SIZE(c1->addr_len)) == 0)
 		return 1;
-	else
-		return 0;
+
+	return 0;
 }
 
-#define PING_TIMEOUT 3
+/* Returns the cached entry of the address, if it has not expired */
+static struct ping_cache_st *cache_find(struct icmp_ping_st *ping,
+					 const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+	struct ping_cache_st t, *e;
+	size_t h;
+
+	memcpy(&t.addr, addr, addr_len);
+	t.addr_len = addr_len;
+	h = rehash(&t, NULL);
+
+	e = htable_get(&ping->cache, h, cache_cmp, &t);
+	if (e == NULL)
+		return NULL;
+
+	if (e->expires <= time(0)) {
+		htable_del(&ping->cache, h, e);
+		ping->cache_size--;
+		talloc_free(e);
+		return NULL;
+	}
 
-static
-ssize_t recvfrom_timeout(int sockfd, void *buf, size_t len, int flags,
-			 struct sockaddr *src_addr, socklen_t * addrlen)
+	return e;
+}
+
+static void cache_expire(struct icmp_ping_st *ping)
 {
-	int ret;
-    struct pollfd pfd;
+	struct ping_cache_st *e;
+	struct htable_iter iter;
+	time_t now = time(0);
+
+	e = htable_first(&ping->cache, &iter);
+	while (e != NULL) {
+		if (e->expires <= now) {
+			htable_delval(&ping->cache, &iter);
+			ping->cache_size--;
+			talloc_free(e);
+		}
+		e = htable_next(&ping->cache, &iter);
+	}
+}
 
-    pfd.fd = sockfd;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
+static void cache_add(struct icmp_ping_st *ping,
+		      const struct sockaddr_storage *addr, socklen_t addr_len, unsigned busy)
+{
+	struct ping_cache_st *e;
+
+	e = cache_find(ping, addr, addr_len);
+	if (e == NULL) {
+		if (ping->cache_size >= PING_CACHE_MAX) {
+			cache_expire(ping);
+			if (ping->cache_size >= PING_CACHE_MAX)
+				return;
+		}
 
-    ret = poll(&pfd, 1, 250);
-	if (ret == -1)
-		return -1;
-	else if (ret > 0)
-		return recvfrom(sockfd, buf, len, 0, src_addr, addrlen);
-	else
-		return -1;
+		e = talloc_zero(ping, struct ping_cache_st);
+		if (e == NULL)
+			return;
 
+		memcpy(&e->addr, addr, addr_len);
+		e->addr_len = addr_len;
 
+		if (htable_add(&ping->cache, rehash(e, NULL), e) == 0) {
+			talloc_free(e);
+			return;
+		}
+		ping->cache_size++;
+	}
+
+	e->busy = busy;
+	e->expires = time(0) + (busy ? PING_CACHE_BUSY_TIME : PING_CACHE_FREE_TIME);
 }
 
-int icmp_ping4(main_server_st * s, struct sockaddr_in *addr1)
+unsigned icmp_ping_is_busy(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_len)
 {
-	struct icmp *pkt;
-	int pingsock, c, e;
-	char packet1[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
-	char buf1[64];
-	time_t now;
-	uint16_t id1;
-	unsigned gotreply = 0, unreachable = 0;
+	struct ping_cache_st *e;
 
-	if (GETCONFIG(s)->ping_leases == 0)
+	if (s->ping == NULL)
 		return 0;
 
-	gnutls_rnd(GNUTLS_RND_NONCE, &id1, sizeof(id1));
-
-	pingsock = socket(AF_INET, SOCK_RAW, 1);
-	if (pingsock == -1) {
-		e = errno;
-		mslog(s, NULL, LOG_INFO,
-		      "could not open raw socket for ping: %s", strerror(e));
+	e = cache_find(s->ping, addr, addr_len);
+	if (e == NULL)
 		return 0;
+
+	return e->busy;
+}
+
+static int send_echo(main_server_st *s, struct icmp_probe_st *p)
+{
+	struct icmp_ping_st *ping = s->ping;
+	char packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
+	int ret, fd;
+	size_t len;
+
+	memset(packet, 0, sizeof(packet));
+
+	if (p->addr_len == sizeof(struct sockaddr_in)) {
+		struct icmp *pkt = (struct icmp *) packet;
+
+		fd = ping->fd4;
+		pkt->icmp_type = ICMP_ECHO;
+		pkt->icmp_id = ping->id;
+		pkt->icmp_seq = p->seq;
+		len = DEFDATALEN + ICMP_MINLEN;
+		pkt->icmp_cksum =
+		    in_cksum((unsigned short *) pkt, len);
+	} else {
+		struct icmp6_hdr *pkt = (struct icmp6_hdr *) packet;
+
+		/* the checksum is calculated by the kernel */
+		fd = ping->fd6;
+		pkt->icmp6_type = ICMP6_ECHO_REQUEST;
+		pkt->icmp6_id = ping->id;
+		pkt->icmp6_seq = p->seq;
+		len = DEFDATALEN + sizeof(struct icmp6_hdr);
 	}
 
-	pkt = (struct icmp *) packet1;
-	memset(pkt, 0, sizeof(packet1));
-	pkt->icmp_type = ICMP_ECHO;
-	pkt->icmp_id = id1;
-	pkt->icmp_cksum =
-	    in_cksum((unsigned short *) pkt, sizeof(packet1));
+	do {
+		ret = sendto(fd, packet, len, 0, (struct sockaddr *) &p->addr, p->addr_len);
+	} while (ret == -1 && errno == EINTR);
+
+	p->last_sent = ev_now(loop);
+	return ret;
+}
+
+/* Called when the probes of a session are complete. It either
+ * continues the session setup or fails it. */
+static void probes_completed(main_server_st *s, struct proc_st *proc)
+{
+	int ret;
+
+	ret = handle_leases_probed(s, proc, proc->probe_error);
+	if (ret < 0) {
+		/* takes care of free */
+		remove_proc(s, proc, RPROC_KILL);
+	}
+}
 
-	while ((c = sendto(pingsock, packet1, DEFDATALEN + ICMP_MINLEN, 0,
-			   (struct sockaddr *) addr1,
-			   sizeof(*addr1)) == -1) && retry(errno));
-	/* listen for replies */
+static void start_probe(main_server_st *s, struct proc_st *proc,
+			struct ip_lease_st *lease);
 
-	now = time(0);
-	while (time(0) - now < PING_TIMEOUT
-	       && (unreachable + gotreply) < 2) {
-		struct sockaddr_in from;
-		socklen_t fromlen = sizeof(from);
+/* The probe is already removed from the probes list */
+static void probe_done(main_server_st *s, struct icmp_probe_st *p, unsigned busy)
+{
+	struct proc_st *proc = p->proc;
+	char buf[64];
+	int ret;
 
-		c = recvfrom_timeout(pingsock, packet1, sizeof(packet1), 0,
-				     (struct sockaddr *) &from, &fromlen);
+	cache_add(s->ping, &p->addr, p->addr_len, busy);
+	proc->pending_probes--;
+
+	mslog(s, proc, LOG_INFO, "pinged %s and is %sin use",
+	      human_addr((void *)&p->addr, p->addr_len, buf, sizeof(buf)),
+	      busy ? "" : "not ");
+
+	if (busy && proc->probe_error == 0) {
+		/* release the lease and look for another address */
+		if (p->addr_len == sizeof(struct sockaddr_in)) {
+			talloc_free(proc->ipv4);
+			proc->ipv4 = NULL;
+		} else {
+			talloc_free(proc->ipv6);
+			proc->ipv6 = NULL;
+		}
 
-		if (c < 0) {
-			continue;
-		} else if (c >= 76 && fromlen == sizeof(struct sockaddr_in)) {	/* icmp6_hdr */
-			if (memcmp
-			    (SA_IN_P(&from), SA_IN_P(addr1),
-			     SA_IN_SIZE(sizeof(*addr1))) == 0) {
-
-#ifdef HAVE_STRUCT_IPHDR_IHL
-				struct iphdr *iphdr =
-				    (struct iphdr *) packet1;
-				pkt = (struct icmp *) (packet1 + (iphdr->ihl << 2));	/* skip ip hdr */
-#else
-				pkt = (struct icmp *) (packet1 + ((packet1[0] & 0x0f) << 2));	/* skip ip hdr */
-#endif
-				if (pkt->icmp_id == id1) {
-					if (pkt->icmp_type == ICMP_ECHOREPLY)
-						gotreply++;
-					else if (pkt->icmp_type == ICMP_DEST_UNREACH)
-						unreachable++;
-                                }
+		if (++proc->probe_rounds >= MAX_PROBE_ROUNDS) {
+			mslog(s, proc, LOG_ERR, "could not find an IP which is not in use");
+			proc->probe_error = ERR_NO_IP;
+		} else {
+			ret = get_ip_leases(s, proc);
+			if (ret < 0) {
+				proc->probe_error = ret;
+			} else {
+				if (p->addr_len == sizeof(struct sockaddr_in))
+					start_probe(s, proc, proc->ipv4);
+				else
+					start_probe(s, proc, proc->ipv6);
 			}
 		}
 	}
 
-	close(pingsock);
+	talloc_free(p);
 
-	if (gotreply > 0) {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in), buf1,
-				 sizeof(buf1)));
-		return gotreply;
-	} else {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is not in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in), buf1,
-				 sizeof(buf1)));
-		return 0;
+	if (proc->pending_probes == 0)
+		probes_completed(s, proc);
+}
+
+static struct icmp_probe_st *find_expired(struct icmp_ping_st *ping, ev_tstamp now)
+{
+	struct icmp_probe_st *p;
+
+	list_for_each(&ping->probes, p, list) {
+		if (now - p->started >= PING_TIMEOUT)
+			return p;
+	}
+	return NULL;
+}
+
+static void ping_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+	struct icmp_ping_st *ping = s->ping;
+	struct icmp_probe_st *p;
+	ev_tstamp now = ev_now(loop);
+
+	/* completing a probe may continue the session setup, which
+	 * may in turn cancel other probes; rescan after each one */
+	while ((p = find_expired(ping, now)) != NULL) {
+		list_del(&p->list);
+		probe_done(s, p, 0);
+	}
+
+	list_for_each(&ping->probes, p, list) {
+		if (now - p->last_sent >= PING_INTERVAL)
+			send_echo(s, p);
+	}
+
+	if (list_empty(&ping->probes))
+		ev_timer_stop(loop, &ping->timer);
+}
+
+static void reply_received(main_server_st *s, struct sockaddr_storage *from,
+			   socklen_t from_len, uint16_t seq)
+{
+	struct icmp_probe_st *p;
+
+	list_for_each(&s->ping->probes, p, list) {
+		if (p->seq == seq && p->addr_len == from_len &&
+		    memcmp(SA_IN_P_GENERIC(&p->addr, from_len), SA_IN_P_GENERIC(from, from_len),
+			   SA_IN_SIZE(from_len)) == 0) {
+			list_del(&p->list);
+			probe_done(s, p, 1);
+			return;
+		}
+	}
+}
+
+static void ping4_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+	struct icmp_ping_st *ping = s->ping;
+	char packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	struct icmp *pkt;
+	unsigned hlen;
+	int ret;
+
+	for (;;) {
+		from_len = sizeof(from);
+		ret = recvfrom(ping->fd4, packet, sizeof(packet), 0,
+			       (struct sockaddr *) &from, &from_len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (from_len != sizeof(struct sockaddr_in))
+			continue;
+
+		/* skip ip hdr */
+		hlen = (packet[0] & 0x0f) << 2;
+		if (ret < hlen + ICMP_MINLEN)
+			continue;
+
+		pkt = (struct icmp *) (packet + hlen);
+		if (pkt->icmp_type == ICMP_ECHOREPLY && pkt->icmp_id == ping->id)
+			reply_received(s, &from, from_len, pkt->icmp_seq);
 	}
 }
 
-int icmp_ping6(main_server_st * s,
-	       struct sockaddr_in6 *addr1)
+static void ping6_cb(struct ev_loop *loop, ev_io *w, int revents)
 {
+	main_server_st *s = ev_userdata(loop);
+	struct icmp_ping_st *ping = s->ping;
+	char packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
+	struct sockaddr_storage from;
+	socklen_t from_len;
 	struct icmp6_hdr *pkt;
-	char buf1[64];
-	int pingsock, c, e;
+	int ret;
+
+	for (;;) {
+		from_len = sizeof(from);
+		ret = recvfrom(ping->fd6, packet, sizeof(packet), 0,
+			       (struct sockaddr *) &from, &from_len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (from_len != sizeof(struct sockaddr_in6) || ret < sizeof(struct icmp6_hdr))
+			continue;
+
+		pkt = (struct icmp6_hdr *) packet;
+		if (pkt->icmp6_type == ICMP6_ECHO_REPLY && pkt->icmp6_id == ping->id)
+			reply_received(s, &from, from_len, pkt->icmp6_seq);
+	}
+}
+
+static int open_ping_socket(main_server_st *s, int family)
+{
+	int fd, e;
 #if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
 	int sockopt;
 #endif
-	char packet1[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
-	uint16_t id1;
-	unsigned gotreply = 0, unreachable = 0;
-	time_t now;
-
-	if (GETCONFIG(s)->ping_leases == 0)
-		return 0;
-
-	gnutls_rnd(GNUTLS_RND_NONCE, &id1, sizeof(id1));
 
-	pingsock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
-	if (pingsock == -1) {
+	if (family == AF_INET)
+		fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+	else
+		fd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+	if (fd == -1) {
 		e = errno;
 		mslog(s, NULL, LOG_INFO,
 		      "could not open raw socket for ping: %s", strerror(e));
-		return 0;
+		return -1;
 	}
 
-	pkt = (struct icmp6_hdr *) packet1;
-	memset(pkt, 0, sizeof(packet1));
-	pkt->icmp6_type = ICMP6_ECHO_REQUEST;
-	pkt->icmp6_id = id1;
+	set_non_block(fd);
+	set_cloexec_flag(fd, 1);
 
+	if (family == AF_INET6) {
+#ifdef ICMP6_FILTER
+		struct icmp6_filter filter;
+
+		/* we are only interested in echo replies */
+		ICMP6_FILTER_SETBLOCKALL(&filter);
+		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+		setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+#endif
 #if defined(SOL_RAW) && defined(IPV6_CHECKSUM)
-	sockopt = offsetof(struct icmp6_hdr, icmp6_cksum);
-	setsockopt(pingsock, SOL_RAW, IPV6_CHECKSUM,
-		   &sockopt, sizeof(sockopt));
+		sockopt = offsetof(struct icmp6_hdr, icmp6_cksum);
+		setsockopt(fd, SOL_RAW, IPV6_CHECKSUM,
+			   &sockopt, sizeof(sockopt));
 #endif
-	while ((c =
-		sendto(pingsock, packet1,
-		       DEFDATALEN + sizeof(struct icmp6_hdr), 0,
-		       (struct sockaddr *) addr1,
-		       sizeof(*addr1)) == -1) && retry(errno));
-
-	/* listen for replies */
-	now = time(0);
-	while (time(0) - now < PING_TIMEOUT
-	       && (unreachable + gotreply) < 2) {
-		struct sockaddr_in6 from;
-		socklen_t fromlen = sizeof(from);
-		c = recvfrom_timeout(pingsock, packet1,
-				     sizeof(packet1), 0,
-				     (struct sockaddr *)
-				     &from, &fromlen);
-		if (c < 0) {
-			continue;
-		} else if (c >= 8 && fromlen == sizeof(struct sockaddr_in6)) {	/* icmp6_hdr */
-			if (memcmp
-			    (SA_IN6_P(&from), SA_IN6_P(addr1),
-			     SA_IN_SIZE(sizeof(*addr1))) == 0) {
-
-				pkt = (struct icmp6_hdr *) packet1;
-				if (pkt->icmp6_id == id1) {
-					if (pkt->icmp6_type == ICMP6_ECHO_REPLY)
-						gotreply++;
-					else if (pkt->icmp6_type == ICMP6_DST_UNREACH)
-						unreachable++;
-				}
-			}
-		}
 	}
 
-	close(pingsock);
+	return fd;
+}
 
-	if (gotreply > 0) {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in6), buf1,
-				 sizeof(buf1)));
-		return gotreply;
-	} else {
-		mslog(s, NULL, LOG_INFO,
-		      "pinged %s and is not in use",
-		      human_addr((void *) addr1,
-				 sizeof(struct sockaddr_in6), buf1,
-				 sizeof(buf1)));
+/* Opens the ping sockets on first use */
+static struct icmp_ping_st *get_ping(main_server_st *s)
+{
+	struct icmp_ping_st *ping;
+
+	if (s->ping)
+		return s->ping;
+
+	ping = talloc_zero(s, struct icmp_ping_st);
+	if (ping == NULL)
+		return NULL;
+
+	gnutls_rnd(GNUTLS_RND_NONCE, &ping->id, sizeof(ping->id));
+	list_head_init(&ping->probes);
+	htable_init(&ping->cache, rehash, NULL);
+
+	ping->fd4 = open_ping_socket(s, AF_INET);
+	ping->fd6 = open_ping_socket(s, AF_INET6);
+
+	if (ping->fd4 >= 0) {
+		ev_io_init(&ping->io4, ping4_cb, ping->fd4, EV_READ);
+		ev_io_start(loop, &ping->io4);
+	}
+
+	if (ping->fd6 >= 0) {
+		ev_io_init(&ping->io6, ping6_cb, ping->fd6, EV_READ);
+		ev_io_start(loop, &ping->io6);
+	}
+
+	ev_init(&ping->timer, ping_timer_cb);
+	ping->timer.repeat = PING_TIMER_INTERVAL;
+
+	s->ping = ping;
+	return ping;
+}
+
+void icmp_ping_deinit(main_server_st *s)
+{
+	struct icmp_ping_st *ping = s->ping;
+	struct ping_cache_st *e;
+	struct htable_iter iter;
+
+	if (ping == NULL)
+		return;
+
+	if (loop) {
+		ev_io_stop(loop, &ping->io4);
+		ev_io_stop(loop, &ping->io6);
+		ev_timer_stop(loop, &ping->timer);
+	}
+
+	if (ping->fd4 >= 0)
+		close(ping->fd4);
+	if (ping->fd6 >= 0)
+		close(ping->fd6);
+
+	e = htable_first(&ping->cache, &iter);
+	while (e != NULL) {
+		talloc_free(e);
+		e = htable_next(&ping->cache, &iter);
+	}
+	htable_clear(&ping->cache);
+
+	talloc_free(ping);
+	s->ping = NULL;
+}
+
+static void start_probe(main_server_st *s, struct proc_st *proc,
+			struct ip_lease_st *lease)
+{
+	struct icmp_ping_st *ping = s->ping;
+	struct icmp_probe_st *p;
+	struct ping_cache_st *e;
+	int fd;
+
+	/* explicit IPs are not probed */
+	if (lease == NULL || lease->db == NULL)
+		return;
+
+	fd = (lease->rip_len == sizeof(struct sockaddr_in)) ? ping->fd4 : ping->fd6;
+	if (fd < 0)
+		return;
+
+	e = cache_find(ping, &lease->rip, lease->rip_len);
+	if (e != NULL && e->busy == 0)
+		return;
+
+	p = talloc_zero(ping, struct icmp_probe_st);
+	if (p == NULL)
+		return;
+
+	p->proc = proc;
+	memcpy(&p->addr, &lease->rip, lease->rip_len);
+	p->addr_len = lease->rip_len;
+	p->seq = ++ping->seq;
+	p->started = ev_now(loop);
+
+	if (send_echo(s, p) < 0) {
+		/* treat it as not in use */
+		talloc_free(p);
+		return;
+	}
+
+	list_add_tail(&ping->probes, &p->list);
+	proc->pending_probes++;
+
+	if (!ev_is_active(&ping->timer))
+		ev_timer_again(loop, &ping->timer);
+}
+
+int icmp_probe_leases(main_server_st *s, struct proc_st *proc)
+{
+	if (GETCONFIG(s)->ping_leases == 0)
+		return 0;
+
+	if (get_ping(s) == NULL)
 		return 0;
+
+	proc->probe_rounds = 0;
+	proc->probe_error = 0;
+
+	start_probe(s, proc, proc->ipv4);
+	/* only single addresses are probed */
+	if (proc->ipv6 && proc->ipv6->prefix == 128)
+		start_probe(s, proc, proc->ipv6);
+
+	if (proc->pending_probes > 0)
+		return ERR_WAIT_FOR_PROBE;
+
+	return 0;
+}
+
+void icmp_probe_cancel(main_server_st *s, struct proc_st *proc)
+{
+	struct icmp_probe_st *p, *pos;
+
+	if (s->ping == NULL || proc->pending_probes == 0)
+		return;
+
+	list_for_each_safe(&s->ping->probes, p, pos, list) {
+		if (p->proc == proc) {
+			list_del(&p->list);
+			talloc_free(p);
+		}
 	}
+	proc->pending_probes = 0;
 }
@@ -23,9 +23,18 @@
 
 #include <main.h>
 
-/* returns the number of positive replies received or
- * 0 if no host with this IP exists. */
-int icmp_ping4(main_server_st* s, struct sockaddr_in* addr1);
-int icmp_ping6(main_server_st* s, struct sockaddr_in6* addr1);
+/* The leases are probed asynchronously using a single raw socket per
+ * address family, watched by the main loop. */
+void icmp_ping_deinit(main_server_st *s);
+
+/* Starts probing the leases of proc which are not known to be free.
+ * It returns zero if no probe is needed, ERR_WAIT_FOR_PROBE if
+ * handle_leases_probed() will be called when the probes complete, or
+ * a negative error code. */
+int icmp_probe_leases(main_server_st *s, struct proc_st *proc);
+void icmp_probe_cancel(main_server_st *s, struct proc_st *proc);
+
+/* returns non-zero if the address recently replied to a ping */
+unsigned icmp_ping_is_busy(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_len);
 
 #endif
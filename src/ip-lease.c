@@ -26,6 +26,8 @@
 #include <gnutls/crypto.h>
 #include <icmp-ping.h>
 #include <arpa/inet.h>
+#include <gettime.h>
+#include <tracepoints.h>
 
 void ip_from_seed(uint8_t *seed, unsigned seed_size,
 		void *ip, size_t ip_size)
@@ -52,6 +54,7 @@ void ip_lease_deinit(struct ip_lease_db_st* db)
 {
 struct ip_lease_st * cache;
 struct htable_iter iter;
+ip_pool_st *pool, *pos;
 
 	cache = htable_first(&db->ht, &iter);
 	while(cache != NULL) {
@@ -62,6 +65,11 @@ struct htable_iter iter;
 		cache = htable_next(&db->ht, &iter);
 	}
 	htable_clear(&db->ht);
+
+	list_for_each_safe(&db->pools, pool, pos, list) {
+		list_del(&pool->list);
+		talloc_free(pool);
+	}
 	
 	return;
 }
@@ -76,6 +84,7 @@ const struct ip_lease_st * e = _e;
 void ip_lease_init(struct ip_lease_db_st* db)
 {
 	htable_init(&db->ht, rehash, NULL);
+	list_head_init(&db->pools);
 }
 
 static bool ip_lease_cmp(const void* _c1, void* _c2)
@@ -152,6 +161,109 @@ static int is_ipv4_ok(main_server_st *s, struct sockaddr_storage *ip, struct soc
 #define MAX_IP_TRIES 16
 #define FIXED_IPS 5
 
+/* Returns the pool of the network, creating it if necessary. It returns
+ * NULL if the network is too large to be tracked by a pool; its
+ * addresses are then selected by random probing. */
+static ip_pool_st *get_ip_pool(main_server_st *s, int family, const uint8_t *network,
+			       unsigned prefix, unsigned slot_prefix)
+{
+	ip_pool_st *pool;
+	unsigned size = (family == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+	if (prefix > slot_prefix || slot_prefix - prefix > IP_POOL_MAX_BITS)
+		return NULL;
+
+	list_for_each(&s->ip_leases.pools, pool, list) {
+		if (pool->family == family && pool->prefix == prefix &&
+		    pool->slot_prefix == slot_prefix &&
+		    memcmp(pool->network, network, size) == 0)
+			return pool;
+	}
+
+	pool = ip_pool_new(s, 1U << (slot_prefix - prefix));
+	if (pool == NULL)
+		return NULL;
+
+	pool->family = family;
+	memcpy(pool->network, network, size);
+	pool->prefix = prefix;
+	pool->slot_prefix = slot_prefix;
+
+	/* the network address, and our address (network + 1) */
+	ip_pool_take(pool, 0);
+	if (family == AF_INET || slot_prefix == 128)
+		ip_pool_take(pool, 1);
+	/* the broadcast address */
+	if (family == AF_INET)
+		ip_pool_take(pool, pool->size - 1);
+
+	list_add(&s->ip_leases.pools, &pool->list);
+
+	return pool;
+}
+
+static uint32_t ipv4_to_slot(ip_pool_st *pool, struct sockaddr_storage *ip)
+{
+	uint32_t addr;
+
+	memcpy(&addr, SA_IN_U8_P(ip), 4);
+	return ntohl(addr) & (pool->size - 1);
+}
+
+static void slot_to_ipv4(ip_pool_st *pool, uint32_t idx, struct sockaddr_storage *ip)
+{
+	uint32_t addr;
+
+	memcpy(&addr, pool->network, 4);
+	addr = htonl(ntohl(addr) | idx);
+	memcpy(SA_IN_U8_P(ip), &addr, 4);
+}
+
+/* IPv6 slots are subnets of slot_prefix; the slot number is
+ * placed right before the subnet's host bits. */
+static uint32_t ipv6_to_slot(ip_pool_st *pool, struct sockaddr_storage *ip)
+{
+	unsigned shift = 128 - pool->slot_prefix;
+	uint64_t v = 0;
+	int k, pos;
+
+	for (k = 0; k < 8; k++) {
+		pos = 15 - shift/8 - k;
+		if (pos < 0)
+			break;
+		v |= ((uint64_t)SA_IN6_U8_P(ip)[pos]) << (8*k);
+	}
+
+	return (v >> (shift%8)) & (pool->size - 1);
+}
+
+static void slot_to_ipv6(ip_pool_st *pool, uint32_t idx, struct sockaddr_storage *ip)
+{
+	unsigned shift = 128 - pool->slot_prefix;
+	uint64_t v = ((uint64_t)idx) << (shift%8);
+	int pos = 15 - shift/8;
+
+	memcpy(SA_IN6_U8_P(ip), pool->network, 16);
+	for (; v != 0 && pos >= 0; pos--) {
+		SA_IN6_U8_P(ip)[pos] |= v & 0xff;
+		v >>= 8;
+	}
+}
+
+static unsigned mask_to_prefix4(struct sockaddr_storage *mask)
+{
+	uint32_t m;
+
+	memcpy(&m, SA_IN_U8_P(mask), 4);
+	m = ntohl(m);
+
+	/* non-contiguous masks are not handled by pools */
+	if ((~m & (~m + 1)) != 0)
+		return 0;
+
+	return 32 - __builtin_popcount(~m);
+}
+
 static
 int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 {
@@ -162,6 +274,9 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 	int ret;
 	const char *c_network, *c_netmask;
 	char buf[64];
+	ip_pool_st *pool = NULL;
+	uint32_t idx = 0, next = 0;
+	unsigned taken = 0;
 
 	/* Our IP accounting */
 	if (proc->config->ipv4_net && proc->config->ipv4_netmask) {
@@ -246,6 +361,8 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 		return ERR_MEM;
 	proc->ipv4->db = &s->ip_leases;
 
+	pool = get_ip_pool(s, AF_INET, SA_IN_U8_P(&network), mask_to_prefix4(&mask), 32);
+
        	memcpy(&tmp, &network, sizeof(tmp));
      	((struct sockaddr_in*)&tmp)->sin_family = AF_INET;
 	((struct sockaddr_in*)&tmp)->sin_port = 0;
@@ -255,7 +372,15 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 	((struct sockaddr_in*)&rnd)->sin_port = 0;
 
 	do {
-		if (max_loops == 0) {
+		if (taken) {
+			/* the previous candidate was rejected; the pool
+			 * search continues after it */
+			ip_pool_put(pool, idx);
+			taken = 0;
+		}
+
+		/* with a pool, the search ends once no slot is left */
+		if (max_loops == 0 && pool == NULL) {
 			mslog(s, proc, LOG_ERR, "could not figure out a valid IPv4 IP");
 			ret = ERR_NO_IP;
 			goto fail;
@@ -264,13 +389,28 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 			memcpy(SA_IN_U8_P(&rnd), proc->ipv4_seed, 4);
 		} else {
 			if (max_loops < MAX_IP_TRIES-FIXED_IPS) {
-				gnutls_rnd(GNUTLS_RND_NONCE, SA_IN_U8_P(&rnd), sizeof(struct in_addr));
+				if (pool) {
+					/* the seeded addresses are taken; use the first free one */
+					ret = ip_pool_get_from(pool, next);
+					if (ret < 0) {
+						mslog(s, proc, LOG_ERR, "there is no usable address in the IPv4 pool");
+						ret = ERR_NO_IP;
+						goto fail;
+					}
+					idx = ret;
+					next = idx + 1;
+					taken = 1;
+					slot_to_ipv4(pool, idx, &rnd);
+				} else {
+					gnutls_rnd(GNUTLS_RND_NONCE, SA_IN_U8_P(&rnd), sizeof(struct in_addr));
+				}
 			} else {
 				ip_from_seed(SA_IN_U8_P(&rnd), sizeof(struct in_addr),
 					     SA_IN_U8_P(&rnd), sizeof(struct in_addr));
 			}
 		}
-		max_loops--;
+		if (max_loops > 0)
+			max_loops--;
 
 		/* Mask the random number with the netmask */
         	for (i=0;i<sizeof(struct in_addr);i++) {
@@ -281,7 +421,18 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
         	for (i=0;i<sizeof(struct in_addr);i++)
         		SA_IN_U8_P(&rnd)[i] |= (SA_IN_U8_P(&network)[i]);
 
-		/* check if it exists in the hash table */
+		if (pool && !taken) {
+			idx = ipv4_to_slot(pool, &rnd);
+			if (ip_pool_take(pool, idx) < 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot assign remote IP %s; it is in use or invalid",
+				      human_addr((void*)&rnd, sizeof(struct sockaddr_in), buf, sizeof(buf)));
+				continue;
+			}
+			taken = 1;
+		}
+
+		/* check if it exists in the hash table; with a pool that
+		 * only happens on overlapping networks */
 		if (is_ipv4_ok(s, &rnd, &network, &mask) == 0) {
 			mslog(s, proc, LOG_DEBUG, "cannot assign remote IP %s; it is in use or invalid", 
 			      human_addr((void*)&rnd, sizeof(struct sockaddr_in), buf, sizeof(buf)));
@@ -305,10 +456,17 @@ int get_ipv4_lease(main_server_st* s, struct proc_st* proc)
 		mslog(s, proc, LOG_DEBUG, "selected IP: %s",
 		      human_addr((void*)&proc->ipv4->rip, proc->ipv4->rip_len, buf, sizeof(buf)));
 
-       		if (icmp_ping4(s, (void*)&proc->ipv4->rip) == 0)
-       			break;
+		/* skip addresses recently found in use; the rest are
+		 * probed asynchronously by icmp_probe_leases() */
+		if (icmp_ping_is_busy(s, &proc->ipv4->rip, proc->ipv4->rip_len) == 0)
+			break;
 	} while(1);
 
+	if (taken) {
+		proc->ipv4->pool = pool;
+		proc->ipv4->pool_idx = idx;
+	}
+
 	return 0;
 
 fail:
@@ -328,6 +486,9 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 	unsigned prefix, subnet_prefix ;
 	int ret;
 	char buf[64];
+	ip_pool_st *pool = NULL;
+	uint32_t idx = 0, next = 0;
+	unsigned taken = 0;
 
 	if (proc->config->ipv6_net && proc->config->ipv6_subnet_prefix) {
 		c_network = proc->config->ipv6_net;
@@ -407,12 +568,22 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 		return ERR_MEM;
 	proc->ipv6->db = &s->ip_leases;
 
+	pool = get_ip_pool(s, AF_INET6, SA_IN6_U8_P(&network), prefix, subnet_prefix);
+
   	memcpy(&tmp, &network, sizeof(tmp));
        	((struct sockaddr_in6*)&tmp)->sin6_family = AF_INET6;
        	((struct sockaddr_in6*)&tmp)->sin6_port = 0;
 
 	do {
-		if (max_loops == 0) {
+		if (taken) {
+			/* the previous candidate was rejected; the pool
+			 * search continues after it */
+			ip_pool_put(pool, idx);
+			taken = 0;
+		}
+
+		/* with a pool, the search ends once no slot is left */
+		if (max_loops == 0 && pool == NULL) {
 			mslog(s, NULL, LOG_ERR, "could not figure out a valid IPv6 IP");
 			ret = ERR_NO_IP;
 			goto fail;
@@ -426,13 +597,28 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 				     SA_IN6_U8_P(&rnd), sizeof(struct in6_addr));
 		} else {
 			if (max_loops < MAX_IP_TRIES-FIXED_IPS) {
-				gnutls_rnd(GNUTLS_RND_NONCE, SA_IN_U8_P(&rnd), sizeof(struct in6_addr));
+				if (pool) {
+					/* the seeded subnets are taken; use the first free one */
+					ret = ip_pool_get_from(pool, next);
+					if (ret < 0) {
+						mslog(s, proc, LOG_ERR, "there is no usable address in the IPv6 pool");
+						ret = ERR_NO_IP;
+						goto fail;
+					}
+					idx = ret;
+					next = idx + 1;
+					taken = 1;
+					slot_to_ipv6(pool, idx, &rnd);
+				} else {
+					gnutls_rnd(GNUTLS_RND_NONCE, SA_IN_U8_P(&rnd), sizeof(struct in6_addr));
+				}
 			} else {
 				ip_from_seed(SA_IN6_U8_P(&rnd), sizeof(struct in6_addr),
 					     SA_IN6_U8_P(&rnd), sizeof(struct in6_addr));
 			}
 		}
-		max_loops--;
+		if (max_loops > 0)
+			max_loops--;
 
 		/* Mask the random number with the netmask */
        		for (i=0;i<sizeof(struct in6_addr);i++)
@@ -442,6 +628,16 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
        		for (i=0;i<sizeof(struct in6_addr);i++)
        			SA_IN6_U8_P(&rnd)[i] |= (SA_IN6_U8_P(&network)[i]);
 
+		if (pool && !taken) {
+			idx = ipv6_to_slot(pool, &rnd);
+			if (ip_pool_take(pool, idx) < 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot assign local IP %s; it is in use or invalid",
+				      human_addr((void*)&rnd, sizeof(struct sockaddr_in6), buf, sizeof(buf)));
+				continue;
+			}
+			taken = 1;
+		}
+
 		/* make the sig of our subnet */
 	       	((struct sockaddr_in6*)&proc->ipv6->sig)->sin6_family = AF_INET6;
 	       	((struct sockaddr_in6*)&proc->ipv6->sig)->sin6_port = 0;
@@ -462,10 +658,15 @@ int get_ipv6_lease(main_server_st* s, struct proc_st* proc)
 		mslog(s, proc, LOG_DEBUG, "selected IP: %s",
 		      human_addr((void*)&proc->ipv6->rip, proc->ipv6->rip_len, buf, sizeof(buf)));
 
-        	if (proc->ipv6->prefix != 128 || icmp_ping6(s, (void*)&proc->ipv6->rip) == 0)
-        		break;
+		if (icmp_ping_is_busy(s, &proc->ipv6->rip, proc->ipv6->rip_len) == 0)
+			break;
         } while(1);
 
+	if (taken) {
+		proc->ipv6->pool = pool;
+		proc->ipv6->pool_idx = idx;
+	}
+
  finish:
 	/* LIP = network address + 1 */
 	memcpy(&proc->ipv6->lip, &network, sizeof(struct sockaddr_in6));
@@ -489,15 +690,36 @@ int unref_ip_lease(struct ip_lease_st *lease)
 {
 	if (lease->db) {
 		htable_del(&lease->db->ht, rehash(lease, NULL), lease);
+		if (lease->pool)
+			ip_pool_put(lease->pool, lease->pool_idx);
 	}
 
 	return 0;
 }
 
-int get_ip_leases(main_server_st *s, struct proc_st *proc)
+static void update_lease_stats(main_server_st *s, struct timespec *start)
+{
+	struct timespec now;
+	uint64_t usecs;
+
+	gettime_mono(&now);
+	usecs = timespec_sub_us(&now, start);
+	if (usecs > UINT32_MAX)
+		usecs = UINT32_MAX;
+
+	s->stats.ip_leases++;
+	if (usecs > s->stats.max_lease_usecs)
+		s->stats.max_lease_usecs = usecs;
+	s->stats.avg_lease_usecs = (s->stats.avg_lease_usecs*(s->stats.ip_leases-1)+usecs) / s->stats.ip_leases;
+}
+
+static int _get_ip_leases(main_server_st *s, struct proc_st *proc)
 {
 int ret;
 char buf[128];
+struct timespec start;
+
+	gettime_mono(&start);
 
 	if (proc->ipv4 == NULL) {
 		ret = get_ipv4_lease(s, proc);
@@ -541,9 +763,22 @@ char buf[128];
 			human_addr((void*)&proc->ipv6->rip, proc->ipv6->rip_len, buf, sizeof(buf)),
 			proc->ipv6->prefix);
 
+	update_lease_stats(s, &start);
+
 	return 0;
 }
 
+int get_ip_leases(main_server_st *s, struct proc_st *proc)
+{
+	int ret;
+
+	TRACE0(lease_start);
+	ret = _get_ip_leases(s, proc);
+	TRACE1(lease_done, ret);
+
+	return ret;
+}
+
 void remove_ip_leases(main_server_st* s, struct proc_st* proc)
 {
 	if (proc->ipv4) {
@@ -560,3 +795,16 @@ void remove_ip_lease(main_server_st* s, struct ip_lease_st * lease)
 {
 	talloc_free(lease);
 }
+
+void ip_pool_stats(struct ip_lease_db_st* db, struct ip_pool_stats_st *st)
+{
+	ip_pool_st *pool;
+
+	memset(st, 0, sizeof(*st));
+
+	list_for_each(&db->pools, pool, list) {
+		st->size += pool->size;
+		st->used += pool->used;
+		st->fragments += ip_pool_fragments(pool);
+	}
+}
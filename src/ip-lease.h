@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <ccan/hash/hash.h>
 #include <main.h>
+#include <ip-pool.h>
 
 struct ip_lease_st {
         /* In IPv4 this is the same as rip, in IPv6
@@ -41,6 +42,17 @@ struct ip_lease_st {
         unsigned prefix; /* in ipv6 */
 
         struct ip_lease_db_st* db;
+
+        /* the pool slot of this lease, if any */
+        ip_pool_st *pool;
+        uint32_t pool_idx;
+};
+
+/* the sum of all pools */
+struct ip_pool_stats_st {
+	uint32_t size;
+	uint32_t used;
+	uint32_t fragments;
 };
 
 void ip_lease_deinit(struct ip_lease_db_st* db);
@@ -52,4 +64,6 @@ int get_ip_leases(struct main_server_st* s, struct proc_st* proc);
 void remove_ip_leases(struct main_server_st* s, struct proc_st* proc);
 void remove_ip_lease(main_server_st* s, struct ip_lease_st * lease);
 
+void ip_pool_stats(struct ip_lease_db_st* db, struct ip_pool_stats_st *st);
+
 #endif
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <talloc.h>
+#include <ip-pool.h>
+
+#define WORDS(bits) (((bits)+63)/64)
+#define BIT(i) (((uint64_t)1) << ((i)%64))
+
+ip_pool_st *ip_pool_new(void *pool, uint32_t size)
+{
+	ip_pool_st *p;
+	uint32_t bits, words;
+	unsigned l;
+
+	if (size == 0 || size > (1U << IP_POOL_MAX_BITS))
+		return NULL;
+
+	p = talloc_zero(pool, ip_pool_st);
+	if (p == NULL)
+		return NULL;
+
+	p->size = size;
+
+	bits = size;
+	for (l = 0; l < IP_POOL_MAX_LEVELS; l++) {
+		words = WORDS(bits);
+
+		p->map[l] = talloc_array(p, uint64_t, words);
+		if (p->map[l] == NULL)
+			goto fail;
+
+		/* all slots (or all lower level words) are free */
+		memset(p->map[l], 0xff, words * sizeof(uint64_t));
+		if (bits % 64)
+			p->map[l][words-1] = BIT(bits) - 1;
+
+		p->levels = l + 1;
+		if (words == 1)
+			break;
+		bits = words;
+	}
+
+	return p;
+ fail:
+	talloc_free(p);
+	return NULL;
+}
+
+static void mark_used(ip_pool_st *p, uint32_t idx)
+{
+	unsigned l;
+
+	for (l = 0; l < p->levels; l++) {
+		p->map[l][idx/64] &= ~BIT(idx);
+		if (p->map[l][idx/64] != 0)
+			break;
+		/* the word became full; mark it in the upper level */
+		idx /= 64;
+	}
+	p->used++;
+}
+
+int64_t ip_pool_get(ip_pool_st *p)
+{
+	uint32_t idx = 0;
+	unsigned l;
+
+	if (p->used >= p->size)
+		return -1;
+
+	for (l = p->levels; l > 0; l--) {
+		uint64_t w = p->map[l-1][idx];
+
+		if (w == 0) /* cannot happen unless the levels are inconsistent */
+			return -1;
+		idx = idx * 64 + __builtin_ctzll(w);
+	}
+
+	mark_used(p, idx);
+	return idx;
+}
+
+/* Returns the lowest index not below @from with a set bit in level @l,
+ * or -1 */
+static int64_t find_set(const ip_pool_st *p, unsigned l, uint32_t from)
+{
+	uint32_t bits = p->size, words;
+	uint64_t w;
+	int64_t up;
+	unsigned i;
+
+	for (i = 0; i < l; i++)
+		bits = WORDS(bits);
+	words = WORDS(bits);
+
+	if (from / 64 >= words)
+		return -1;
+
+	/* the bits of the word from @from on */
+	w = p->map[l][from/64] & ~(BIT(from) - 1);
+	if (w != 0)
+		return (from & ~63U) + __builtin_ctzll(w);
+
+	if (l + 1 == p->levels)
+		return -1;
+
+	/* the next word with a set bit */
+	up = find_set(p, l + 1, from/64 + 1);
+	if (up < 0)
+		return -1;
+
+	return up * 64 + __builtin_ctzll(p->map[l][up]);
+}
+
+int64_t ip_pool_get_from(ip_pool_st *p, uint32_t from)
+{
+	int64_t idx;
+
+	if (p->used >= p->size)
+		return -1;
+
+	idx = find_set(p, 0, from);
+	if (idx < 0)
+		return -1;
+
+	mark_used(p, idx);
+	return idx;
+}
+
+int ip_pool_take(ip_pool_st *p, uint32_t idx)
+{
+	if (idx >= p->size)
+		return -1;
+
+	if ((p->map[0][idx/64] & BIT(idx)) == 0)
+		return -1;
+
+	mark_used(p, idx);
+	return 0;
+}
+
+void ip_pool_put(ip_pool_st *p, uint32_t idx)
+{
+	unsigned l;
+	uint64_t old;
+
+	if (idx >= p->size || (p->map[0][idx/64] & BIT(idx)) != 0)
+		return;
+
+	for (l = 0; l < p->levels; l++) {
+		old = p->map[l][idx/64];
+		p->map[l][idx/64] |= BIT(idx);
+		if (old != 0)
+			break;
+		idx /= 64;
+	}
+	p->used--;
+}
+
+unsigned ip_pool_fragments(const ip_pool_st *p)
+{
+	uint32_t i, words = WORDS(p->size);
+	uint64_t w, carry = 0;
+	unsigned total = 0;
+
+	for (i = 0; i < words; i++) {
+		w = p->map[0][i];
+		/* count the free bits whose predecessor is used */
+		total += __builtin_popcountll(w & ~((w << 1) | carry));
+		carry = w >> 63;
+	}
+
+	return total;
+}
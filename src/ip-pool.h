@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef IP_POOL_H
+# define IP_POOL_H
+
+#include <stdint.h>
+#include <ccan/list/list.h>
+
+/* Networks with more addresses (or IPv6 subnets) than that are not
+ * tracked by a pool; random probing is sufficient for them. */
+#define IP_POOL_MAX_BITS 24
+#define IP_POOL_MAX_LEVELS 5
+
+/* A pool of addresses of a network. The free slots are kept in a
+ * hierarchical bitmap; each bit of level n+1 marks a word of level n with
+ * at least one free slot, so that allocation and release take at most
+ * IP_POOL_MAX_LEVELS word operations. */
+typedef struct ip_pool_st {
+	struct list_node list;
+
+	/* the network this pool serves */
+	int family;
+	uint8_t network[16];
+	unsigned prefix;
+	unsigned slot_prefix; /* the prefix of a single lease */
+
+	uint32_t size; /* number of slots */
+	uint32_t used;
+	unsigned levels;
+	uint64_t *map[IP_POOL_MAX_LEVELS]; /* a set bit marks a free slot */
+} ip_pool_st;
+
+ip_pool_st *ip_pool_new(void *pool, uint32_t size);
+
+/* Returns the lowest free slot marking it as used, or -1 */
+int64_t ip_pool_get(ip_pool_st *p);
+
+/* Returns the lowest free slot not below @from marking it as used, or
+ * -1. It allows a search to skip the slots it rejected without holding
+ * them. */
+int64_t ip_pool_get_from(ip_pool_st *p, uint32_t from);
+
+/* Marks the given slot as used; returns -1 if it was not free */
+int ip_pool_take(ip_pool_st *p, uint32_t idx);
+void ip_pool_put(ip_pool_st *p, uint32_t idx);
+
+/* Returns the number of ranges of consecutive free slots */
+unsigned ip_pool_fragments(const ip_pool_st *p);
+
+#endif
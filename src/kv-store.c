@@ -0,0 +1,960 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <talloc.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <ccan/htable/htable.h>
+#include <ccan/hash/hash.h>
+#include <ccan/list/list.h>
+#include <cloexec.h>
+#include <common.h>
+#include <gettime.h>
+#include <kv-store.h>
+
+/* The memcached text protocol; each request has a single reply line,
+ * except for get, whose value follows the line */
+#define KV_GET 1
+#define KV_SET 2
+#define KV_DEL 3
+#define KV_ADD 4 /* creates the counter of an incr; the reply is ignored */
+#define KV_INCR 5
+
+#define MAX_KEY_SIZE 250
+#define MAX_LINE_SIZE (MAX_KEY_SIZE + 64)
+#define MAX_OUT_SIZE (1024*1024)
+
+/* The sealed values are: nonce | encrypted value | tag, where the key
+ * of the value is authenticated along with it */
+#define NONCE_SIZE 12
+#define TAG_SIZE 16
+#define SEAL_OVERHEAD (NONCE_SIZE + TAG_SIZE)
+
+#define ID_KEY_LABEL "ocserv shared state id"
+#define VALUE_KEY_LABEL "ocserv shared state value"
+
+typedef struct kv_op_st {
+	struct list_node list;
+	unsigned type;
+	char *key; /* for get, to cache the value */
+
+	kv_get_func get_done;
+	kv_incr_func incr_done;
+	void *priv;
+
+	uint64_t deadline;
+} kv_op_st;
+
+typedef struct kv_cache_st {
+	char *key;
+	uint8_t *data;
+	unsigned size;
+	time_t expires;
+} kv_cache_st;
+
+struct kv_store_st {
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	int fd;
+	unsigned connected; /* connect() completed */
+	uint64_t retry_at;
+
+	unsigned timeout_ms;
+	unsigned cache_secs;
+
+	/* the cluster key */
+	unsigned keyed;
+	uint8_t id_key[KV_KEY_SIZE];
+	uint8_t value_key[KV_KEY_SIZE];
+	uint8_t plain[KV_MAX_VALUE_SIZE]; /* the opened value of a get */
+
+	uint8_t *out;
+	unsigned out_len;
+	uint8_t in[MAX_LINE_SIZE + KV_MAX_VALUE_SIZE + 2 + 5];
+	unsigned in_len;
+
+	/* the requests sent, in order */
+	struct list_head pending;
+	unsigned npending;
+
+	struct htable cache;
+	time_t last_expire;
+
+	kv_update_func update;
+	void *update_priv;
+	int last_fd;
+	unsigned last_events;
+
+	unsigned long requests;
+	unsigned long errors;
+	unsigned long cache_hits;
+	unsigned long rejected;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	gettime_mono(&ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t cache_rehash(const void *_e, void *unused)
+{
+	const kv_cache_st *e = _e;
+	return hash_any(e->key, strlen(e->key), 0);
+}
+
+static bool cache_cmp(const void *_e, void *key)
+{
+	const kv_cache_st *e = _e;
+	return strcmp(e->key, key) == 0;
+}
+
+static int kv_destructor(kv_store_st *kv)
+{
+	if (kv->fd != -1)
+		close(kv->fd);
+	/* the requests are released with the store, without completion */
+	htable_clear(&kv->cache);
+	safe_memset(kv->id_key, 0, sizeof(kv->id_key));
+	safe_memset(kv->value_key, 0, sizeof(kv->value_key));
+	return 0;
+}
+
+kv_store_st *kv_store_new(void *pool, const char *server, unsigned timeout_ms,
+			  unsigned cache_secs)
+{
+	struct addrinfo hints, *res = NULL;
+	kv_store_st *kv;
+	char *host, *p;
+	const char *port = NULL;
+	char service[8];
+	int ret;
+
+	kv = talloc_zero(pool, kv_store_st);
+	if (kv == NULL)
+		return NULL;
+
+	kv->fd = -1;
+	kv->last_fd = -1;
+	kv->timeout_ms = timeout_ms ? timeout_ms : KV_DEFAULT_TIMEOUT_MS;
+	kv->cache_secs = cache_secs;
+	list_head_init(&kv->pending);
+	htable_init(&kv->cache, cache_rehash, NULL);
+	talloc_set_destructor(kv, kv_destructor);
+
+	kv->name = talloc_strdup(kv, server);
+	host = talloc_strdup(kv, server);
+	if (kv->name == NULL || host == NULL)
+		goto fail;
+
+	/* host, host:port, [ipv6] or [ipv6]:port */
+	if (host[0] == '[') {
+		host++;
+		p = strchr(host, ']');
+		if (p == NULL)
+			goto fail_parse;
+		*p++ = 0;
+		if (*p == ':')
+			port = p + 1;
+		else if (*p != 0)
+			goto fail_parse;
+	} else {
+		p = strchr(host, ':');
+		if (p != NULL && strchr(p + 1, ':') == NULL) {
+			*p = 0;
+			port = p + 1;
+		}
+	}
+
+	if (port == NULL || *port == 0) {
+		snprintf(service, sizeof(service), "%u", KV_DEFAULT_PORT);
+		port = service;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0) {
+		syslog(LOG_ERR, "shared state: cannot resolve %s: %s", server, gai_strerror(ret));
+		goto fail;
+	}
+
+	if (res->ai_addrlen > sizeof(kv->addr)) {
+		freeaddrinfo(res);
+		goto fail;
+	}
+	memcpy(&kv->addr, res->ai_addr, res->ai_addrlen);
+	kv->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	return kv;
+
+ fail_parse:
+	syslog(LOG_ERR, "shared state: cannot parse server '%s'", server);
+ fail:
+	talloc_free(kv);
+	return NULL;
+}
+
+void kv_store_set_update_func(kv_store_st *kv, kv_update_func update, void *priv)
+{
+	kv->update = update;
+	kv->update_priv = priv;
+	kv->last_fd = -1;
+	kv->last_events = 0;
+}
+
+int kv_store_set_key(kv_store_st *kv, const uint8_t secret[KV_KEY_SIZE])
+{
+	if (gnutls_hmac_fast(GNUTLS_MAC_SHA256, secret, KV_KEY_SIZE,
+			     ID_KEY_LABEL, sizeof(ID_KEY_LABEL)-1, kv->id_key) < 0 ||
+	    gnutls_hmac_fast(GNUTLS_MAC_SHA256, secret, KV_KEY_SIZE,
+			     VALUE_KEY_LABEL, sizeof(VALUE_KEY_LABEL)-1, kv->value_key) < 0)
+		return -1;
+
+	kv->keyed = 1;
+	return 0;
+}
+
+void kv_store_get_stats(kv_store_st *kv, kv_store_stats_st *st)
+{
+	st->name = kv->name;
+	st->connected = kv->connected;
+	st->pending = kv->npending;
+	st->cached = kv->cache.elems;
+	st->requests = kv->requests;
+	st->errors = kv->errors;
+	st->cache_hits = kv->cache_hits;
+	st->rejected = kv->rejected;
+}
+
+int kv_store_fd(kv_store_st *kv)
+{
+	return kv->fd;
+}
+
+unsigned kv_store_events(kv_store_st *kv)
+{
+	if (kv->fd == -1)
+		return 0;
+
+	if (kv->connected == 0 || kv->out_len > 0)
+		return POLLIN|POLLOUT;
+	return POLLIN;
+}
+
+static void notify(kv_store_st *kv)
+{
+	unsigned events = kv_store_events(kv);
+
+	if (kv->update == NULL)
+		return;
+
+	if (kv->fd != kv->last_fd || events != kv->last_events) {
+		kv->last_fd = kv->fd;
+		kv->last_events = events;
+		kv->update(kv->update_priv, kv->fd, events);
+	}
+}
+
+/* The key is ocserv:<prefix>:<id in hex>; with a cluster key the id is
+ * replaced by HMAC(id key, prefix | 0 | id), so that the ids, such as the
+ * session IDs, are not exposed to the server. */
+static int make_key(kv_store_st *kv, char *key, unsigned key_size, const char *prefix,
+		    const void *id, unsigned id_size)
+{
+	uint8_t mac[32], in[KV_MAX_ID_SIZE + 32];
+	const uint8_t *p = id;
+	unsigned i, len, plen;
+
+	if (id_size > KV_MAX_ID_SIZE)
+		return -1;
+
+	if (kv->keyed) {
+		plen = strlen(prefix);
+		if (plen >= sizeof(in) - KV_MAX_ID_SIZE)
+			return -1;
+		memcpy(in, prefix, plen + 1);
+		memcpy(&in[plen + 1], id, id_size);
+		if (gnutls_hmac_fast(GNUTLS_MAC_SHA256, kv->id_key, sizeof(kv->id_key),
+				     in, plen + 1 + id_size, mac) < 0)
+			return -1;
+		p = mac;
+		id_size = sizeof(mac);
+	}
+
+	len = snprintf(key, key_size, "ocserv:%s:", prefix);
+	if (len + id_size*2 + 1 > key_size)
+		return -1;
+
+	for (i = 0; i < id_size; i++)
+		len += sprintf(&key[len], "%.2x", (unsigned)p[i]);
+	return 0;
+}
+
+/* Encrypts @size bytes of @data in place and writes the tag over them and
+ * @key in @tag, or decrypts them and writes the tag to compare */
+static int crypt_value(kv_store_st *kv, const char *key, const uint8_t nonce[NONCE_SIZE],
+		       uint8_t *data, unsigned size, unsigned encrypt, uint8_t tag[TAG_SIZE])
+{
+	gnutls_cipher_hd_t h;
+	gnutls_datum_t k = {kv->value_key, sizeof(kv->value_key)};
+	gnutls_datum_t iv = {(void*)nonce, NONCE_SIZE};
+	int ret;
+
+	ret = gnutls_cipher_init(&h, GNUTLS_CIPHER_AES_256_GCM, &k, &iv);
+	if (ret < 0)
+		return -1;
+
+	ret = gnutls_cipher_add_auth(h, key, strlen(key));
+	if (ret >= 0 && size > 0) {
+		if (encrypt)
+			ret = gnutls_cipher_encrypt(h, data, size);
+		else
+			ret = gnutls_cipher_decrypt(h, data, size);
+	}
+	if (ret >= 0)
+		ret = gnutls_cipher_tag(h, tag, TAG_SIZE);
+
+	gnutls_cipher_deinit(h);
+	return ret < 0 ? -1 : 0;
+}
+
+/* Writes the sealed @data of @key in @out, of size + SEAL_OVERHEAD bytes */
+static int seal_value(kv_store_st *kv, const char *key, const void *data, unsigned size,
+		      uint8_t *out)
+{
+	if (gnutls_rnd(GNUTLS_RND_NONCE, out, NONCE_SIZE) < 0)
+		return -1;
+
+	memcpy(out + NONCE_SIZE, data, size);
+	return crypt_value(kv, key, out, out + NONCE_SIZE, size, 1, out + NONCE_SIZE + size);
+}
+
+/* Opens the sealed value of @key into kv->plain; returns its size or -1 */
+static int open_value(kv_store_st *kv, const char *key, const uint8_t *data, unsigned size)
+{
+	uint8_t tag[TAG_SIZE];
+	unsigned i, diff, psize;
+
+	if (size < SEAL_OVERHEAD)
+		return -1;
+	psize = size - SEAL_OVERHEAD;
+
+	memcpy(kv->plain, data + NONCE_SIZE, psize);
+	if (crypt_value(kv, key, data, kv->plain, psize, 0, tag) < 0)
+		return -1;
+
+	for (i = diff = 0; i < TAG_SIZE; i++)
+		diff |= tag[i] ^ data[size - TAG_SIZE + i];
+	if (diff != 0) {
+		safe_memset(kv->plain, 0, psize);
+		return -1;
+	}
+
+	return psize;
+}
+
+/* The cache */
+
+static kv_cache_st *cache_find(kv_store_st *kv, const char *key)
+{
+	kv_cache_st *e;
+
+	e = htable_get(&kv->cache, hash_any(key, strlen(key), 0), cache_cmp, (void*)key);
+	if (e == NULL)
+		return NULL;
+
+	if (time(0) >= e->expires) {
+		htable_del(&kv->cache, cache_rehash(e, NULL), e);
+		talloc_free(e);
+		return NULL;
+	}
+
+	return e;
+}
+
+static void cache_del(kv_store_st *kv, const char *key)
+{
+	kv_cache_st *e;
+
+	e = htable_get(&kv->cache, hash_any(key, strlen(key), 0), cache_cmp, (void*)key);
+	if (e != NULL) {
+		htable_del(&kv->cache, cache_rehash(e, NULL), e);
+		talloc_free(e);
+	}
+}
+
+static void cache_expire(kv_store_st *kv, time_t now)
+{
+	struct htable_iter iter;
+	kv_cache_st *e;
+
+	e = htable_first(&kv->cache, &iter);
+	while (e != NULL) {
+		if (now >= e->expires) {
+			htable_delval(&kv->cache, &iter);
+			talloc_free(e);
+		}
+		e = htable_next(&kv->cache, &iter);
+	}
+	kv->last_expire = now;
+}
+
+static void cache_put(kv_store_st *kv, const char *key, const void *data,
+		      unsigned size, unsigned ttl)
+{
+	kv_cache_st *e;
+	time_t now = time(0);
+	unsigned secs = kv->cache_secs;
+
+	if (secs == 0)
+		return;
+
+	cache_del(kv, key);
+
+	if (kv->cache.elems >= KV_MAX_CACHED) {
+		cache_expire(kv, now);
+		if (kv->cache.elems >= KV_MAX_CACHED)
+			return;
+	}
+
+	if (ttl != 0 && ttl < secs)
+		secs = ttl;
+
+	e = talloc(kv, kv_cache_st);
+	if (e == NULL)
+		return;
+
+	e->key = talloc_strdup(e, key);
+	e->data = talloc_memdup(e, data, size);
+	e->size = size;
+	e->expires = now + secs;
+
+	if (e->key == NULL || (e->data == NULL && size > 0) ||
+	    htable_add(&kv->cache, cache_rehash(e, NULL), e) == 0)
+		talloc_free(e);
+}
+
+/* The connection */
+
+static void fail_op(kv_op_st *op, int status)
+{
+	if (op->get_done)
+		op->get_done(op->priv, status, NULL);
+	else if (op->incr_done)
+		op->incr_done(op->priv, status, 0);
+}
+
+/* Closes the connection and fails the outstanding requests */
+static void kv_reset(kv_store_st *kv, const char *reason)
+{
+	kv_op_st *op;
+
+	if (reason != NULL)
+		syslog(LOG_INFO, "shared state: connection to %s closed: %s", kv->name, reason);
+
+	if (kv->fd != -1)
+		close(kv->fd);
+	kv->fd = -1;
+	kv->connected = 0;
+	kv->out_len = 0;
+	kv->in_len = 0;
+
+	/* the completion functions may make new requests, which fail */
+	kv->retry_at = now_ms() + KV_RETRY_SECS*1000;
+
+	while ((op = list_top(&kv->pending, kv_op_st, list)) != NULL) {
+		list_del(&op->list);
+		kv->npending--;
+		kv->errors++;
+		fail_op(op, KV_ERR_UNAVAILABLE);
+		talloc_free(op);
+	}
+
+	notify(kv);
+}
+
+static int kv_connect(kv_store_st *kv)
+{
+	int ret, e;
+
+	if (kv->fd != -1)
+		return 0;
+
+	if (now_ms() < kv->retry_at)
+		return -1;
+
+	kv->fd = socket(kv->addr.ss_family, SOCK_STREAM, 0);
+	if (kv->fd == -1) {
+		e = errno;
+		syslog(LOG_ERR, "shared state: cannot create socket: %s", strerror(e));
+		kv->retry_at = now_ms() + KV_RETRY_SECS*1000;
+		return -1;
+	}
+	set_cloexec_flag(kv->fd, 1);
+	set_non_block(kv->fd);
+
+	ret = connect(kv->fd, (struct sockaddr*)&kv->addr, kv->addr_len);
+	if (ret == 0) {
+		kv->connected = 1;
+	} else if (errno == EINPROGRESS) {
+		kv->connected = 0;
+	} else {
+		e = errno;
+		kv_reset(kv, strerror(e));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns -1 if the connection failed */
+static int kv_flush(kv_store_st *kv)
+{
+	struct pollfd pfd;
+	socklen_t len;
+	int ret, e;
+
+	if (kv->fd == -1)
+		return 0;
+
+	if (kv->connected == 0) {
+		pfd.fd = kv->fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 0) <= 0)
+			return 0;
+
+		len = sizeof(e);
+		if (getsockopt(kv->fd, SOL_SOCKET, SO_ERROR, &e, &len) < 0)
+			e = errno;
+		if (e != 0) {
+			kv_reset(kv, strerror(e));
+			return -1;
+		}
+		kv->connected = 1;
+	}
+
+	while (kv->out_len > 0) {
+		ret = send(kv->fd, kv->out, kv->out_len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			e = errno;
+			if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR)
+				break;
+			kv_reset(kv, strerror(e));
+			return -1;
+		}
+
+		memmove(kv->out, kv->out + ret, kv->out_len - ret);
+		kv->out_len -= ret;
+	}
+
+	return 0;
+}
+
+/* Queues a request, which is sent by kv_store_process(); @data, if set,
+ * follows the command line */
+static kv_op_st *queue_op(kv_store_st *kv, unsigned type, const char *line,
+			  const void *data, unsigned size)
+{
+	unsigned len = strlen(line);
+	unsigned total = len + (data ? size + 2 : 0);
+	kv_op_st *op;
+	uint8_t *out;
+
+	if (kv_connect(kv) < 0)
+		return NULL;
+
+	if (kv->npending >= KV_MAX_PENDING || kv->out_len + total > MAX_OUT_SIZE) {
+		kv->errors++;
+		return NULL;
+	}
+
+	op = talloc_zero(kv, kv_op_st);
+	if (op == NULL)
+		return NULL;
+
+	out = talloc_realloc_size(kv, kv->out, kv->out_len + total);
+	if (out == NULL) {
+		talloc_free(op);
+		return NULL;
+	}
+	kv->out = out;
+
+	memcpy(&kv->out[kv->out_len], line, len);
+	kv->out_len += len;
+	if (data) {
+		memcpy(&kv->out[kv->out_len], data, size);
+		memcpy(&kv->out[kv->out_len + size], "\r\n", 2);
+		kv->out_len += size + 2;
+	}
+
+	op->type = type;
+	op->deadline = now_ms() + kv->timeout_ms;
+	list_add_tail(&kv->pending, &op->list);
+	kv->npending++;
+	kv->requests++;
+
+	return op;
+}
+
+int kv_store_get(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		 kv_value_st *value, kv_get_func done, void *priv)
+{
+	char key[MAX_KEY_SIZE+1];
+	char line[MAX_LINE_SIZE];
+	kv_cache_st *e;
+	kv_op_st *op;
+
+	if (make_key(kv, key, sizeof(key), prefix, id, id_size) < 0)
+		return KV_ERR_SERVER;
+
+	e = cache_find(kv, key);
+	if (e != NULL) {
+		kv->cache_hits++;
+		value->data = e->data;
+		value->size = e->size;
+		return 1;
+	}
+
+	snprintf(line, sizeof(line), "get %s\r\n", key);
+	op = queue_op(kv, KV_GET, line, NULL, 0);
+	if (op == NULL)
+		return KV_ERR_UNAVAILABLE;
+
+	op->key = talloc_strdup(op, key);
+	op->get_done = done;
+	op->priv = priv;
+
+	notify(kv);
+	return 0;
+}
+
+int kv_store_set(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		 const void *data, unsigned size, unsigned ttl)
+{
+	kv_op_st *op;
+	char key[MAX_KEY_SIZE+1];
+	char line[MAX_LINE_SIZE];
+	uint8_t sealed[KV_MAX_VALUE_SIZE];
+	const void *out = data;
+	unsigned out_size = size;
+
+	if (size > KV_MAX_VALUE_SIZE - (kv->keyed ? SEAL_OVERHEAD : 0) ||
+	    make_key(kv, key, sizeof(key), prefix, id, id_size) < 0)
+		return KV_ERR_SERVER;
+
+	if (kv->keyed) {
+		if (seal_value(kv, key, data, size, sealed) < 0)
+			return KV_ERR_SERVER;
+		out = sealed;
+		out_size = size + SEAL_OVERHEAD;
+	}
+
+	cache_put(kv, key, data, size, ttl);
+
+	snprintf(line, sizeof(line), "set %s 0 %u %u\r\n", key, ttl, out_size);
+	op = queue_op(kv, KV_SET, line, out, out_size);
+	if (out == sealed)
+		safe_memset(sealed, 0, out_size);
+	if (op == NULL)
+		return KV_ERR_UNAVAILABLE;
+
+	notify(kv);
+	return 0;
+}
+
+int kv_store_del(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size)
+{
+	char key[MAX_KEY_SIZE+1];
+	char line[MAX_LINE_SIZE];
+
+	if (make_key(kv, key, sizeof(key), prefix, id, id_size) < 0)
+		return KV_ERR_SERVER;
+
+	cache_del(kv, key);
+
+	snprintf(line, sizeof(line), "delete %s\r\n", key);
+	if (queue_op(kv, KV_DEL, line, NULL, 0) == NULL)
+		return KV_ERR_UNAVAILABLE;
+
+	notify(kv);
+	return 0;
+}
+
+int kv_store_incr(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		  unsigned delta, unsigned ttl, kv_incr_func done, void *priv)
+{
+	char key[MAX_KEY_SIZE+1];
+	char line[MAX_LINE_SIZE];
+	kv_op_st *op;
+
+	if (make_key(kv, key, sizeof(key), prefix, id, id_size) < 0)
+		return KV_ERR_SERVER;
+
+	if (kv->npending + 2 > KV_MAX_PENDING) {
+		kv->errors++;
+		return KV_ERR_UNAVAILABLE;
+	}
+
+	/* the counter is created, unless it exists, and then incremented */
+	snprintf(line, sizeof(line), "add %s 0 %u 1\r\n", key, ttl);
+	if (queue_op(kv, KV_ADD, line, "0", 1) == NULL)
+		return KV_ERR_UNAVAILABLE;
+
+	snprintf(line, sizeof(line), "incr %s %u\r\n", key, delta);
+	op = queue_op(kv, KV_INCR, line, NULL, 0);
+	if (op == NULL) {
+		notify(kv);
+		return KV_ERR_UNAVAILABLE;
+	}
+
+	op->incr_done = done;
+	op->priv = priv;
+
+	notify(kv);
+	return 0;
+}
+
+int kv_store_timeout(kv_store_st *kv)
+{
+	kv_op_st *op;
+	uint64_t now;
+
+	op = list_top(&kv->pending, kv_op_st, list);
+	if (op == NULL)
+		return -1;
+
+	now = now_ms();
+	if (now >= op->deadline)
+		return 0;
+	return op->deadline - now;
+}
+
+static unsigned line_is(const uint8_t *line, unsigned len, const char *str)
+{
+	unsigned slen = strlen(str);
+
+	return (len == slen && memcmp(line, str, slen) == 0);
+}
+
+static unsigned line_starts(const uint8_t *line, unsigned len, const char *str)
+{
+	unsigned slen = strlen(str);
+
+	return (len >= slen && memcmp(line, str, slen) == 0);
+}
+
+/* Completes the request with the reply at the start of the input.
+ * Returns the size of the reply, zero if it is incomplete, or -1 if it
+ * cannot be parsed. */
+static int parse_reply(kv_store_st *kv, kv_op_st *op)
+{
+	const uint8_t *line = kv->in, *eol;
+	unsigned len, total, flags, size;
+	char tmp[MAX_LINE_SIZE];
+	kv_value_st value;
+	char *end;
+	uint64_t n;
+	int ret;
+
+	eol = memmem(kv->in, kv->in_len, "\r\n", 2);
+	if (eol == NULL)
+		return (kv->in_len >= MAX_LINE_SIZE) ? -1 : 0;
+	len = eol - line;
+	total = len + 2;
+
+	if (line_is(line, len, "ERROR") || line_starts(line, len, "SERVER_ERROR") ||
+	    line_starts(line, len, "CLIENT_ERROR")) {
+		kv->errors++;
+		fail_op(op, KV_ERR_SERVER);
+		return total;
+	}
+
+	switch (op->type) {
+	case KV_GET:
+		if (line_is(line, len, "END")) {
+			fail_op(op, KV_ERR_NOT_FOUND);
+			return total;
+		}
+
+		if (!line_starts(line, len, "VALUE ") || len >= sizeof(tmp))
+			return -1;
+
+		memcpy(tmp, line, len);
+		tmp[len] = 0;
+		if (sscanf(tmp, "VALUE %*s %u %u", &flags, &size) != 2 ||
+		    size > KV_MAX_VALUE_SIZE)
+			return -1;
+
+		if (kv->in_len < total + size + 2 + 5)
+			return 0;
+
+		if (memcmp(&kv->in[total + size], "\r\nEND\r\n", 7) != 0)
+			return -1;
+
+		value.data = &kv->in[total];
+		value.size = size;
+
+		if (kv->keyed) {
+			ret = open_value(kv, op->key, value.data, value.size);
+			if (ret < 0) {
+				syslog(LOG_WARNING, "shared state: ignoring a value of %s which was not sealed with the cluster key",
+				       kv->name);
+				kv->rejected++;
+				fail_op(op, KV_ERR_NOT_FOUND);
+				return total + size + 2 + 5;
+			}
+			value.data = kv->plain;
+			value.size = ret;
+		}
+
+		cache_put(kv, op->key, value.data, value.size, 0);
+
+		if (op->get_done)
+			op->get_done(op->priv, KV_OK, &value);
+		if (kv->keyed)
+			safe_memset(kv->plain, 0, value.size);
+		return total + size + 2 + 5;
+
+	case KV_SET:
+		if (!line_is(line, len, "STORED")) {
+			kv->errors++;
+			return line_is(line, len, "NOT_STORED") ? (int)total : -1;
+		}
+		return total;
+
+	case KV_DEL:
+		if (!line_is(line, len, "DELETED") && !line_is(line, len, "NOT_FOUND"))
+			return -1;
+		return total;
+
+	case KV_ADD:
+		if (!line_is(line, len, "STORED") && !line_is(line, len, "NOT_STORED"))
+			return -1;
+		return total;
+
+	case KV_INCR:
+		if (line_is(line, len, "NOT_FOUND")) {
+			fail_op(op, KV_ERR_NOT_FOUND);
+			return total;
+		}
+
+		if (len == 0 || len >= sizeof(tmp))
+			return -1;
+		memcpy(tmp, line, len);
+		tmp[len] = 0;
+		n = strtoull(tmp, &end, 10);
+		if (*end != 0)
+			return -1;
+
+		if (op->incr_done)
+			op->incr_done(op->priv, KV_OK, n);
+		return total;
+	}
+
+	return -1;
+}
+
+static void kv_receive(kv_store_st *kv)
+{
+	kv_op_st *op;
+	int ret, e;
+
+	while (kv->fd != -1 && kv->connected) {
+		/* a complete reply always fits */
+		if (kv->in_len >= sizeof(kv->in)) {
+			kv_reset(kv, "reply too long");
+			return;
+		}
+
+		ret = recv(kv->fd, &kv->in[kv->in_len], sizeof(kv->in) - kv->in_len, 0);
+		if (ret < 0) {
+			e = errno;
+			if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR)
+				return;
+			kv_reset(kv, strerror(e));
+			return;
+		}
+
+		if (ret == 0) {
+			kv_reset(kv, "closed by server");
+			return;
+		}
+		kv->in_len += ret;
+
+		while ((op = list_top(&kv->pending, kv_op_st, list)) != NULL) {
+			ret = parse_reply(kv, op);
+			if (ret == 0)
+				break;
+			if (ret < 0) {
+				kv_reset(kv, "unexpected reply");
+				return;
+			}
+
+			list_del(&op->list);
+			kv->npending--;
+			talloc_free(op);
+
+			memmove(kv->in, kv->in + ret, kv->in_len - ret);
+			kv->in_len -= ret;
+		}
+
+		if (list_empty(&kv->pending) && kv->in_len > 0) {
+			kv_reset(kv, "unexpected reply");
+			return;
+		}
+	}
+}
+
+void kv_store_process(kv_store_st *kv)
+{
+	kv_op_st *op;
+	time_t now = time(0);
+
+	if (kv_flush(kv) == 0)
+		kv_receive(kv);
+
+	/* the requests of the completion functions */
+	kv_flush(kv);
+
+	op = list_top(&kv->pending, kv_op_st, list);
+	if (op != NULL && now_ms() >= op->deadline)
+		kv_reset(kv, "timeout");
+
+	if (now != kv->last_expire)
+		cache_expire(kv, now);
+
+	notify(kv);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KV_STORE_H
+# define KV_STORE_H
+
+#include <stdint.h>
+#include <poll.h>
+
+/* A store of the state shared by the servers of a cluster, kept on a
+ * memcached server. The local databases of each process (the cookies,
+ * the TLS sessions and the ban scores) remain as they are; they write
+ * their changes through to the store, and consult it when a key is not
+ * found locally.
+ *
+ * The client is non-blocking and driven by the event loop of its process.
+ * The requests are pipelined over a single TCP connection and matched to
+ * their replies by their order. A request which is not answered within
+ * the timeout closes the connection and fails the outstanding ones; the
+ * connection is retried after KV_RETRY_SECS, and the requests made while
+ * it is down fail immediately, so that the callers fall back to their
+ * local state.
+ *
+ * The values read and written are kept in a local cache for a few
+ * seconds, so that repeated lookups are served without a round trip.
+ *
+ * With a cluster key, set by kv_store_set_key(), the ids are replaced in
+ * the keys by their HMAC, and the values are sealed with AES-256-GCM
+ * bound to their key; the values which fail that check are treated as
+ * not found. The counters are kept in the clear, as the server adds to
+ * them.
+ */
+
+#define KV_DEFAULT_PORT 11211
+#define KV_DEFAULT_TIMEOUT_MS 500
+#define KV_DEFAULT_CACHE_SECS 5
+#define KV_RETRY_SECS 5
+
+#define KV_MAX_ID_SIZE 64
+#define KV_MAX_VALUE_SIZE (8*1024)
+#define KV_KEY_SIZE 32
+#define KV_MAX_PENDING 1024
+#define KV_MAX_CACHED 4096
+
+/* the status passed to the completion functions */
+#define KV_OK 0
+#define KV_ERR_NOT_FOUND -1
+#define KV_ERR_UNAVAILABLE -2
+#define KV_ERR_SERVER -3
+
+typedef struct kv_store_st kv_store_st;
+
+typedef struct kv_value_st {
+	const uint8_t *data;
+	unsigned size;
+} kv_value_st;
+
+/* Called from kv_store_process(); the value is only valid during the
+ * call and is set on KV_OK */
+typedef void (*kv_get_func)(void *priv, int status, const kv_value_st *value);
+typedef void (*kv_incr_func)(void *priv, int status, uint64_t value);
+
+/* Called when the descriptor or the events to poll for change */
+typedef void (*kv_update_func)(void *priv, int fd, unsigned events);
+
+typedef struct kv_store_stats_st {
+	const char *name;
+	unsigned connected;
+	unsigned pending;
+	unsigned cached;
+	unsigned long requests;
+	unsigned long errors;
+	unsigned long cache_hits;
+	unsigned long rejected; /* values which failed the cluster key check */
+} kv_store_stats_st;
+
+/* @server: the memcached server, as host[:port]
+ * @timeout_ms: the time to wait for each reply
+ * @cache_secs: the time the values are cached locally; zero for none
+ */
+kv_store_st *kv_store_new(void *pool, const char *server, unsigned timeout_ms,
+			  unsigned cache_secs);
+
+void kv_store_set_update_func(kv_store_st *kv, kv_update_func update, void *priv);
+/* Sets the secret shared by the servers of the cluster */
+int kv_store_set_key(kv_store_st *kv, const uint8_t secret[KV_KEY_SIZE]);
+void kv_store_get_stats(kv_store_st *kv, kv_store_stats_st *st);
+
+/* The keys are formed by a prefix, naming the database, and an id of up
+ * to KV_MAX_ID_SIZE bytes. */
+
+/* Looks up a value. If it is cached, it is set in @value and 1 is
+ * returned. Otherwise the server is asked, zero is returned and done()
+ * is called once the reply is received. On failure a negative status is
+ * returned and done() is not called. */
+int kv_store_get(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		 kv_value_st *value, kv_get_func done, void *priv);
+
+/* These do not wait for the reply; @ttl is in seconds, zero for none */
+int kv_store_set(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		 const void *data, unsigned size, unsigned ttl);
+int kv_store_del(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size);
+
+/* Adds @delta to a counter, which is created with @ttl if it does not
+ * exist; done(), if set, is called with its new value. */
+int kv_store_incr(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		  unsigned delta, unsigned ttl, kv_incr_func done, void *priv);
+
+/* The descriptor to poll, or -1, and the events to poll for */
+int kv_store_fd(kv_store_st *kv);
+unsigned kv_store_events(kv_store_st *kv);
+/* Returns the milliseconds until the next request times out, or -1 */
+int kv_store_timeout(kv_store_st *kv);
+/* Sends the buffered requests, receives the replies and calls their
+ * completion functions, and expires the requests and the cached values */
+void kv_store_process(kv_store_st *kv);
+
+#endif
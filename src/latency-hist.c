@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <latency-hist.h>
+
+static unsigned msb(uint64_t v)
+{
+	unsigned bits = 0;
+
+	while (v >>= 1)
+		bits++;
+
+	return bits;
+}
+
+/* The values below HIST_SUB_BUCKETS have a bucket each; the others are
+ * placed by their highest bit and the HIST_SUB_BITS bits following it */
+static unsigned bucket_of(uint64_t v)
+{
+	unsigned e;
+
+	if (v < HIST_SUB_BUCKETS)
+		return v;
+
+	e = msb(v);
+	if (e >= HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS +
+	       ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* the first value past the bucket */
+static uint64_t bucket_end(unsigned idx)
+{
+	unsigned e;
+
+	if (idx < HIST_SUB_BUCKETS)
+		return idx + 1;
+
+	e = idx / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+
+	return ((uint64_t)(HIST_SUB_BUCKETS + idx % HIST_SUB_BUCKETS + 1)) << (e - HIST_SUB_BITS);
+}
+
+void latency_hist_add_n(latency_hist_st *h, uint64_t usecs, uint64_t n)
+{
+	if (n == 0)
+		return;
+
+	h->buckets[bucket_of(usecs)] += n;
+	h->count += n;
+	h->sum += usecs * n;
+	if (usecs > h->max)
+		h->max = usecs;
+}
+
+void latency_hist_add(latency_hist_st *h, uint64_t usecs)
+{
+	latency_hist_add_n(h, usecs, 1);
+}
+
+uint64_t latency_hist_percentile(const latency_hist_st *h, unsigned pct)
+{
+	uint64_t rank, seen = 0, end;
+	unsigned i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (h->count * pct + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	end = bucket_end(i) - 1;
+	if (i == HIST_BUCKETS - 1 || end > h->max)
+		return h->max;
+
+	return end;
+}
+
+uint64_t latency_hist_count_below(const latency_hist_st *h, uint64_t limit)
+{
+	uint64_t total = 0;
+	unsigned i;
+
+	for (i = 0; i < HIST_BUCKETS - 1 && bucket_end(i) <= limit; i++)
+		total += h->buckets[i];
+
+	return total;
+}
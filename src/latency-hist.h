@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LATENCY_HIST_H
+# define LATENCY_HIST_H
+
+#include <stdint.h>
+
+/* A histogram of durations in microseconds, in the way of the HDR
+ * histograms: each power of two is split in HIST_SUB_BUCKETS buckets of
+ * equal width, so that any value is known within 1/HIST_SUB_BUCKETS of
+ * it, with a fixed number of buckets over the whole range. The values
+ * from 2^HIST_MAX_BITS are counted in the last bucket.
+ */
+#define HIST_SUB_BITS 2
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 32
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct latency_hist_st {
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+} latency_hist_st;
+
+void latency_hist_add(latency_hist_st *h, uint64_t usecs);
+/* Adds @n values of @usecs */
+void latency_hist_add_n(latency_hist_st *h, uint64_t usecs, uint64_t n);
+
+/* Returns the value below which @pct percent of the values are, rounded
+ * up to the end of its bucket */
+uint64_t latency_hist_percentile(const latency_hist_st *h, unsigned pct);
+
+/* Returns the values below @limit, which is exact when @limit is a power
+ * of two */
+uint64_t latency_hist_count_below(const latency_hist_st *h, uint64_t limit);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Admission control for new connections.
+ *
+ * Each worker counts as pending from the moment it is forked until it
+ * presents a cookie to main (or exits). When max-pending-clients is set
+ * and that many workers are pending, newly accepted connections are not
+ * forked; they are put on a bounded FIFO and are dispatched as soon as
+ * pending workers complete. While the queue is non-empty the workers are
+ * started in overload mode, in which they serve clients reconnecting with
+ * a cookie, but reply to new logins with 503 and a Retry-After header.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <common.h>
+#include <syslog.h>
+#include <vpn.h>
+#include <main.h>
+#include <main-admission.h>
+#include <worker.h>
+#include <gettime.h>
+#include <ccan/list/list.h>
+
+void admission_queue_init(main_server_st *s)
+{
+	list_head_init(&s->admission_queue.head);
+	s->admission_queue.total = 0;
+}
+
+static void drop_entry(main_server_st *s, admission_entry_st *e)
+{
+	list_del(&e->list);
+	s->admission_queue.total--;
+	close(e->fd);
+	talloc_free(e);
+}
+
+/* Closes all queued connections. Used on exit and in the
+ * forked children. */
+void admission_queue_deinit(main_server_st *s)
+{
+	admission_entry_st *e = NULL, *pos;
+
+	list_for_each_safe(&s->admission_queue.head, e, pos, list) {
+		drop_entry(s, e);
+	}
+}
+
+/* Returns non-zero if a new connection cannot be given a worker
+ * at this time. We also queue when there are other connections
+ * waiting, so that the queue is served in order. */
+unsigned admission_must_queue(main_server_st *s)
+{
+	unsigned max = GETCONFIG(s)->max_pending_clients;
+
+	if (max == 0)
+		return 0;
+
+	if (s->stats.pending_clients >= max || s->admission_queue.total > 0)
+		return 1;
+
+	return 0;
+}
+
+/* Queues the connection in @fd, using the addresses recorded in s->ws.
+ * On failure the connection is closed and -1 is returned.
+ */
+int admission_enqueue(main_server_st *s, int fd, int stype)
+{
+	struct worker_st *ws = s->ws;
+	admission_entry_st *e;
+
+	if (s->admission_queue.total >= GETCONFIG(s)->pending_queue_size) {
+		mslog(s, NULL, LOG_INFO, "admission queue is full (pending: %u, queued: %u); dropping connection",
+		      s->stats.pending_clients, s->admission_queue.total);
+		goto fail;
+	}
+
+	e = talloc_zero(s, admission_entry_st);
+	if (e == NULL)
+		goto fail;
+
+	e->fd = fd;
+	e->stype = stype;
+	memcpy(&e->remote_addr, &ws->remote_addr, ws->remote_addr_len);
+	e->remote_addr_len = ws->remote_addr_len;
+	memcpy(&e->our_addr, &ws->our_addr, ws->our_addr_len);
+	e->our_addr_len = ws->our_addr_len;
+	e->queued = time(0);
+	gettime_mono(&e->accepted);
+
+	list_add_tail(&s->admission_queue.head, &e->list);
+	s->admission_queue.total++;
+
+	if (s->admission_queue.total == 1)
+		mslog(s, NULL, LOG_INFO, "reached maximum pending client limit (pending: %u); queueing connections",
+		      s->stats.pending_clients);
+
+	return 0;
+ fail:
+	s->stats.admission_drops++;
+	close(fd);
+	return -1;
+}
+
+/* Starts workers for the queued connections, while there is capacity,
+ * both in pending workers and in clients. Connections which have been
+ * waiting for longer than the auth timeout are dropped, as the client
+ * will have given up on them. As the queue is ordered by time, these are
+ * always found at its head.
+ */
+void admission_dispatch(main_server_st *s)
+{
+	struct worker_st *ws = s->ws;
+	admission_entry_st *e = NULL, *pos;
+	unsigned max = GETCONFIG(s)->max_pending_clients;
+	unsigned max_clients = GETCONFIG(s)->max_clients;
+	time_t now = time(0);
+	struct timespec mono;
+
+	list_for_each_safe(&s->admission_queue.head, e, pos, list) {
+		if (now - e->queued > GETCONFIG(s)->auth_timeout) {
+			s->stats.admission_drops++;
+			drop_entry(s, e);
+			continue;
+		}
+
+		if (max > 0 && s->stats.pending_clients >= max)
+			break;
+
+		if (max_clients > 0 && s->stats.active_clients >= max_clients)
+			break;
+
+		list_del(&e->list);
+		s->admission_queue.total--;
+
+		gettime_mono(&mono);
+		record_setup_time(s, SETUP_QUEUE, timespec_sub_us(&mono, &e->accepted));
+
+		memcpy(&ws->remote_addr, &e->remote_addr, e->remote_addr_len);
+		ws->remote_addr_len = e->remote_addr_len;
+		memcpy(&ws->our_addr, &e->our_addr, e->our_addr_len);
+		ws->our_addr_len = e->our_addr_len;
+
+		spawn_worker(s, e->fd, e->stype);
+		talloc_free(e);
+	}
+}
+
+void admission_track(main_server_st *s, struct proc_st *proc)
+{
+	proc->pending = 1;
+	s->stats.pending_clients++;
+}
+
+/* Called once the worker has presented a cookie, or has been
+ * removed; it frees its slot for the queued connections. A removed
+ * worker also frees a client slot, so the queue is served in both
+ * cases. */
+void admission_release(main_server_st *s, struct proc_st *proc)
+{
+	if (proc->pending != 0) {
+		proc->pending = 0;
+		s->stats.pending_clients--;
+	}
+
+#ifndef UNDER_TEST
+	if (s->admission_queue.total > 0)
+		ev_idle_start(loop, &admission_watcher);
+#endif
+}
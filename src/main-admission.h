@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MAIN_ADMISSION_H
+# define MAIN_ADMISSION_H
+
+# include "main.h"
+
+/* An accepted connection waiting for a worker slot */
+typedef struct admission_entry_st {
+	struct list_node list;
+
+	int fd;
+	int stype;
+	struct sockaddr_storage remote_addr;
+	socklen_t remote_addr_len;
+	struct sockaddr_storage our_addr;
+	socklen_t our_addr_len;
+
+	time_t queued; /* the time it was put in the queue */
+	struct timespec accepted;
+} admission_entry_st;
+
+void admission_queue_init(main_server_st *s);
+void admission_queue_deinit(main_server_st *s);
+unsigned admission_must_queue(main_server_st *s);
+int admission_enqueue(main_server_st *s, int fd, int stype);
+void admission_dispatch(main_server_st *s);
+void admission_track(main_server_st *s, struct proc_st *proc);
+void admission_release(main_server_st *s, struct proc_st *proc);
+
+#endif
@@ -42,6 +42,8 @@
 #include <vpn.h>
 #include <tun.h>
 #include <main.h>
+#include <main-metrics.h>
+#include <gettime.h>
 #include <ccan/list/list.h>
 #include <common.h>
 
@@ -168,8 +170,10 @@ int handle_auth_cookie_req(main_server_st* s, struct proc_st* proc,
 {
 int ret;
 struct proc_st *old_proc;
+struct timespec start, now;
 
-	if (req->cookie.data == NULL || req->cookie.len != sizeof(proc->sid))
+	if (req->cookie.data == NULL || req->cookie.len < sizeof(proc->sid) ||
+	    req->cookie.len > MAX_COOKIE_SIZE)
 		return -1;
 
 	/* generate a new DTLS session ID for each connection, to allow
@@ -179,12 +183,15 @@ struct proc_st *old_proc;
 		return -1;
 	proc->dtls_session_id_size = sizeof(proc->dtls_session_id);
 
-	/* loads sup config and basic proc info (e.g., username) */
+	/* loads sup config and basic proc info (e.g., username and sid) */
+	gettime_mono(&start);
 	ret = session_open(s, proc, req->cookie.data, req->cookie.len);
 	if (ret < 0) {
 		mslog(s, proc, LOG_INFO, "could not open session");
 		return -1;
 	}
+	gettime_mono(&now);
+	record_setup_time(s, SETUP_SESSION_OPEN, timespec_sub_us(&now, &start));
 
 	/* Put into right cgroup */
         if (proc->config->cgroup != NULL) {
@@ -192,7 +199,7 @@ struct proc_st *old_proc;
 	}
 
 	/* check for a user with the same sid as in the cookie */
-	old_proc = proc_search_sid(s, req->cookie.data);
+	old_proc = proc_search_sid(s, proc->sid);
 	if (old_proc != NULL) {
 		mslog(s, old_proc, LOG_INFO, "disconnecting previous user session due to session re-use");
 
@@ -212,10 +219,9 @@ struct proc_st *old_proc;
 		mslog(s, proc, LOG_INFO, "new user session");
 	}
 
-	/* update the SID */
-	memcpy(proc->sid, req->cookie.data, req->cookie.len);
 	/* this also hints to call session_close() */
 	proc->active_sid = 1;
+	metrics_session_open(s, proc);
 
 	/* add the links to proc hash */
 	if (proc_table_add(s, proc) < 0) {
@@ -237,8 +243,7 @@ struct proc_st *old_proc;
  */
 int check_multiple_users(main_server_st *s, struct proc_st* proc)
 {
-struct proc_st *ctmp = NULL, *cpos;
-unsigned int entries = 1; /* that one */
+unsigned int entries;
 unsigned max;
 
 	max = proc->config->max_same_clients;
@@ -246,16 +251,14 @@ unsigned max;
 	if (max == 0)
 		return 0;
 
-	list_for_each_safe(&s->proc_list.head, ctmp, cpos, list) {
-		if (ctmp != proc && ctmp->pid != -1) {
-			if (strcmp(proc->username, ctmp->username) == 0) {
-				entries++;
+	/* the sessions of the user, which include that one once it
+	 * is opened */
+	entries = proc_count_user(s, proc->username);
+	if (proc->user == NULL)
+		entries++;
 
-				if (entries > max)
-					return -1;
-			}
-		}
-	}
+	if (entries > max)
+		return -1;
 
 	return 0;
 }
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/select.h>
@@ -41,38 +42,202 @@
 #include <main.h>
 #include <main-ban.h>
 #include <arpa/inet.h>
-#include <ccan/hash/hash.h>
-#include <ccan/htable/htable.h>
 
-static size_t rehash(const void *_e, void *unused)
+/* The entries are kept in a binary trie of their prefixes, one for each
+ * address family, in which the nodes with a single child are merged to
+ * their child. The prefixes covering an address are found by a single
+ * walk from the root, which visits at most as many nodes as the bits of
+ * the address. The entries are also armed in a timer wheel at the time
+ * they are to be removed, so that their expiration only visits those
+ * which are.
+ */
+typedef struct ban_node_st {
+	uint8_t key[16];
+	unsigned len; /* the prefix length of the node */
+	struct ban_node_st *parent;
+	struct ban_node_st *child[2];
+	ban_entry_st *entry; /* NULL for the nodes where prefixes diverge */
+} ban_node_st;
+
+typedef struct ban_db_st {
+	ban_node_st *root[2]; /* IPv4 and IPv6 */
+	timer_wheel_st timers;
+	unsigned elems;
+} ban_db_st;
+
+/* the prefixes of an address which are looked up; there are two unless
+ * the prefix length was reconfigured */
+#define MAX_BAN_MATCHES 8
+
+#define ROOT(db, size) (&(db)->root[(size) == 16 ? 1 : 0])
+
+static unsigned get_bit(const uint8_t *key, unsigned bit)
 {
-	ban_entry_st *e = (void*)_e;
-	return hash_any(e->ip.ip, e->ip.size, 0);
+	return (key[bit / 8] >> (7 - bit % 8)) & 1;
 }
 
-/* The first argument is the entry from the hash, and
- * the second is the entry from check_if_banned().
- */
-static bool ban_entry_cmp(const void *_c1, void *_c2)
+/* Returns the number of the leading bits, up to @max, that are equal */
+static unsigned common_bits(const uint8_t *a, const uint8_t *b, unsigned max)
 {
-	const struct ban_entry_st *c1 = _c1;
-	struct ban_entry_st *c2 = _c2;
+	unsigned i, n = 0;
+	uint8_t x;
+
+	for (i = 0; n < max; i++) {
+		x = a[i] ^ b[i];
+		if (x == 0) {
+			n += 8;
+			continue;
+		}
+		while ((x & 0x80) == 0) {
+			x <<= 1;
+			n++;
+		}
+		break;
+	}
 
-	if (c1->ip.size == c2->ip.size && memcmp(c1->ip.ip, c2->ip.ip, c1->ip.size) == 0)
-		return 1;
-	return 0;
+	return MIN(n, max);
+}
+
+static void mask_prefix(uint8_t *key, unsigned len)
+{
+	unsigned i;
+
+	for (i = len / 8; i < 16; i++) {
+		if (i == len / 8 && len % 8 != 0)
+			key[i] &= 0xff << (8 - len % 8);
+		else
+			key[i] = 0;
+	}
+}
+
+static ban_node_st *new_node(ban_db_st *db, const uint8_t *key, unsigned len)
+{
+	ban_node_st *n;
+
+	n = talloc_zero(db, ban_node_st);
+	if (n == NULL)
+		return NULL;
+
+	memcpy(n->key, key, sizeof(n->key));
+	mask_prefix(n->key, len);
+	n->len = len;
+	return n;
+}
+
+/* Returns the node of the prefix, adding it if @create is set */
+static ban_node_st *trie_get(ban_db_st *db, ban_node_st **root,
+			     const uint8_t *key, unsigned len, unsigned create)
+{
+	ban_node_st **link = root, *parent = NULL, *n, *m;
+	unsigned common;
+
+	while ((n = *link) != NULL) {
+		common = common_bits(key, n->key, MIN(len, n->len));
+		if (common == n->len) {
+			if (n->len == len)
+				return n;
+			parent = n;
+			link = &n->child[get_bit(key, n->len)];
+			continue;
+		}
+
+		if (create == 0)
+			return NULL;
+
+		/* the prefix diverges from the node's, or is a prefix of it;
+		 * a node for their common prefix takes its place */
+		m = new_node(db, key, common);
+		if (m == NULL)
+			return NULL;
+
+		m->parent = parent;
+		m->child[get_bit(n->key, common)] = n;
+		n->parent = m;
+		*link = m;
+
+		if (common == len)
+			return m;
+
+		parent = m;
+		link = &m->child[get_bit(key, common)];
+	}
+
+	if (create == 0)
+		return NULL;
+
+	n = new_node(db, key, len);
+	if (n == NULL)
+		return NULL;
+
+	n->parent = parent;
+	*link = n;
+	return n;
 }
 
+/* Removes the nodes, starting from @n, which no longer hold an entry
+ * or separate two subtries */
+static void trie_prune(ban_node_st **root, ban_node_st *n)
+{
+	ban_node_st *parent, *child, **link;
+
+	while (n != NULL && n->entry == NULL) {
+		if (n->child[0] != NULL && n->child[1] != NULL)
+			return;
+
+		parent = n->parent;
+		if (parent != NULL)
+			link = &parent->child[get_bit(n->key, parent->len)];
+		else
+			link = root;
+
+		child = n->child[0] != NULL ? n->child[0] : n->child[1];
+		*link = child;
+		if (child != NULL)
+			child->parent = parent;
+		talloc_free(n);
+
+		/* the parent lost a child only if there was none to take
+		 * the node's place */
+		if (child != NULL)
+			return;
+		n = parent;
+	}
+}
+
+/* Finds the entries of the prefixes which cover @key, from the shortest
+ * to the longest; returns their number */
+static unsigned trie_match(ban_node_st *root, const uint8_t *key, unsigned len,
+			   ban_entry_st **entries, unsigned max)
+{
+	ban_node_st *n = root;
+	unsigned found = 0;
+
+	while (n != NULL && n->len <= len && found < max) {
+		if (common_bits(key, n->key, n->len) != n->len)
+			break;
+
+		if (n->entry != NULL)
+			entries[found++] = n->entry;
+
+		if (n->len == len)
+			break;
+		n = n->child[get_bit(key, n->len)];
+	}
+
+	return found;
+}
+
+static void ban_entry_expired(void *priv, wheel_timer_st *t);
 
 void *main_ban_db_init(main_server_st *s)
 {
-	struct htable *db = talloc(s, struct htable);
+	ban_db_st *db = talloc_zero(s, ban_db_st);
 	if (db == NULL) {
 		fprintf(stderr, "error initializing ban DB\n");
 		exit(1);
 	}
 
-	htable_init(db, rehash, NULL);
+	timer_wheel_init(&db->timers, time(0), s);
 	s->ban_db = db;
 
 	return db;
@@ -80,17 +245,13 @@ void *main_ban_db_init(main_server_st *s)
 
 void main_ban_db_deinit(main_server_st *s)
 {
-struct htable *db = s->ban_db;
-
-	if (db != NULL) {
-		htable_clear(db);
-		talloc_free(db);
-	}
+	talloc_free(s->ban_db);
+	s->ban_db = NULL;
 }
 
 unsigned main_ban_db_elems(main_server_st *s)
 {
-struct htable *db = s->ban_db;
+ban_db_st *db = s->ban_db;
 
 	if (db)
 		return db->elems;
@@ -98,106 +259,292 @@ struct htable *db = s->ban_db;
 		return 0;
 }
 
-static void massage_ipv6_address(ban_entry_st *t)
+static int iterate_node(ban_node_st *n, ban_entry_func func, void *priv)
 {
-	if (t->ip.size == 16) {
-		memset(&t->ip.ip[8], 0, 8);
+	int ret;
+
+	if (n == NULL)
+		return 0;
+
+	if (n->entry != NULL) {
+		ret = func(priv, n->entry);
+		if (ret < 0)
+			return ret;
 	}
+
+	ret = iterate_node(n->child[0], func, priv);
+	if (ret < 0)
+		return ret;
+	return iterate_node(n->child[1], func, priv);
 }
 
-/* returns -1 if the user is already banned, and zero otherwise */
-static
-int add_ip_to_ban_list(main_server_st *s, const unsigned char *ip, unsigned ip_size, unsigned score)
+/* The entries are visited in the order of their prefixes */
+int main_ban_db_iterate(main_server_st *s, ban_entry_func func, void *priv)
 {
-	struct htable *db = s->ban_db;
-	struct ban_entry_st *e;
-	ban_entry_st t;
-	time_t now = time(0);
-	time_t expiration = now + GETCONFIG(s)->min_reauth_time;
-	int ret = 0;
-	char str_ip[MAX_IP_STR];
-	const char *p_str_ip = NULL;
-	unsigned print_msg;
+	ban_db_st *db = s->ban_db;
+	int ret;
 
-	if (db == NULL || GETCONFIG(s)->max_ban_score == 0 || ip == NULL || (ip_size != 4 && ip_size != 16))
+	if (db == NULL)
 		return 0;
 
-	memcpy(t.ip.ip, ip, ip_size);
-	t.ip.size = ip_size;
+	ret = iterate_node(db->root[0], func, priv);
+	if (ret < 0)
+		return ret;
+	return iterate_node(db->root[1], func, priv);
+}
 
-	/* In IPv6 treat a /64 as a single address */
-	massage_ipv6_address(&t);
+/* The score at which the entry is banned */
+unsigned ban_entry_max_score(main_server_st *s, const ban_entry_st *e)
+{
+	if (e->prefix < BAN_HOST_PREFIX(e->ip.size)) {
+		/* the prefixes are no longer scored */
+		if (GETCONFIG(s)->max_ban_prefix_score <= 0)
+			return UINT_MAX;
+		return GETCONFIG(s)->max_ban_prefix_score;
+	}
+	return GETCONFIG(s)->max_ban_score;
+}
 
-	e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
-	if (e == NULL) { /* new entry */
-		e = talloc_zero(db, ban_entry_st);
-		if (e == NULL) {
-			return 0;
-		}
+/* The prefix, shorter than the address, over which the scores are added
+ * up; zero if not used */
+static unsigned aggregate_prefix(main_server_st *s, unsigned size)
+{
+	unsigned prefix;
 
-		memcpy(&e->ip, &t.ip, sizeof(e->ip));
-		e->last_reset = now;
+	if (GETCONFIG(s)->max_ban_prefix_score <= 0)
+		return 0;
 
-		if (htable_add(db, rehash(e, NULL), e) == 0) {
-			mslog(s, NULL, LOG_INFO,
-			       "could not add ban entry to hash table");
-			goto fail;
-		}
-	} else {
-		if (now > e->last_reset + GETCONFIG(s)->ban_reset_time) {
-			e->score = 0;
-			e->last_reset = now;
-		}
+	prefix = size == 16 ? GETCONFIG(s)->ban_ipv6_prefix : GETCONFIG(s)->ban_ipv4_prefix;
+	if (prefix >= BAN_HOST_PREFIX(size))
+		return 0;
+	return prefix;
+}
+
+/* Each ban of an entry lasts twice as much as its previous one */
+static time_t ban_time(main_server_st *s, unsigned bans)
+{
+	return GETCONFIG(s)->min_reauth_time << MIN(bans - 1, MAX_BAN_ESCALATION);
+}
+
+/* An entry is kept while it is banned or counts its score, and so are
+ * the bans it had, which escalate the next */
+static void update_entry(main_server_st *s, ban_entry_st *e)
+{
+	timer_wheel_add(&s->ban_db->timers, &e->timer,
+			MAX(e->expires, e->last_reset + GETCONFIG(s)->ban_reset_time));
+}
+
+static ban_entry_st *get_entry(main_server_st *s, const uint8_t *ip, unsigned ip_size,
+			       unsigned prefix, time_t now)
+{
+	ban_db_st *db = s->ban_db;
+	ban_node_st *n;
+	ban_entry_st *e;
+
+	n = trie_get(db, ROOT(db, ip_size), ip, prefix, 1);
+	if (n == NULL)
+		return NULL;
+
+	if (n->entry != NULL)
+		return n->entry;
+
+	e = talloc_zero(n, ban_entry_st);
+	if (e == NULL)
+		goto fail;
+
+	memcpy(e->ip.ip, n->key, sizeof(e->ip.ip));
+	e->ip.size = ip_size;
+	e->prefix = prefix;
+	e->last_reset = now;
+	e->node = n;
+
+	wheel_timer_init(&e->timer, ban_entry_expired);
+	timer_wheel_add(&db->timers, &e->timer, now);
+
+	n->entry = e;
+	db->elems++;
+	return e;
+ fail:
+	trie_prune(ROOT(db, ip_size), n);
+	return NULL;
+}
+
+static void del_entry(main_server_st *s, ban_entry_st *e)
+{
+	ban_db_st *db = s->ban_db;
+	ban_node_st *n = e->node;
+	unsigned size = e->ip.size;
+
+	timer_wheel_del(&db->timers, &e->timer);
+	n->entry = NULL;
+	db->elems--;
+	talloc_free(e);
+	trie_prune(ROOT(db, size), n);
+}
+
+static void ban_entry_expired(void *priv, wheel_timer_st *t)
+{
+	del_entry(priv, container_of(t, ban_entry_st, timer));
+}
+
+static const char *entry_to_str(const ban_entry_st *e, char *str, unsigned str_size)
+{
+	char tmp[MAX_IP_STR];
+
+	if (inet_ntop(e->ip.size == 16 ? AF_INET6 : AF_INET, e->ip.ip, tmp, sizeof(tmp)) == NULL)
+		return NULL;
+
+	if (e->prefix < BAN_HOST_PREFIX(e->ip.size))
+		snprintf(str, str_size, "%s/%u", tmp, e->prefix);
+	else
+		strlcpy(str, tmp, str_size);
+	return str;
+}
+
+/* returns 1 if the entry is banned with its new score, and zero otherwise */
+static unsigned add_points(main_server_st *s, ban_entry_st *e, unsigned score, time_t now)
+{
+	unsigned max = ban_entry_max_score(s, e);
+	char str_ip[MAX_IP_STR + 4];
+	const char *p_str_ip;
+	unsigned print_msg;
+
+	/* the score is counted anew after its reset time, or after a ban
+	 * ends */
+	if (now > e->last_reset + GETCONFIG(s)->ban_reset_time ||
+	    (e->score >= max && now > e->expires)) {
+		e->score = 0;
+		e->last_reset = now;
 	}
 
 	/* if the user is already banned, don't increase the expiration time
 	 * on further attempts, or the user will never be unbanned if he
 	 * periodically polls the server */
-	if (e->score < GETCONFIG(s)->max_ban_score) {
-		e->expires = expiration;
-		print_msg = 0;
-	} else
-		print_msg = 1;
+	print_msg = 0;
+	if (e->score < max) {
+		if (e->score + score >= max) {
+			e->bans++;
+			s->stats.total_bans++;
+			e->expires = now + ban_time(s, e->bans);
+			print_msg = 1;
+		} else {
+			e->expires = now + GETCONFIG(s)->min_reauth_time;
+		}
+	}
 	e->score += score;
 
-	if (ip_size == 4)
-		p_str_ip = inet_ntop(AF_INET, ip, str_ip, sizeof(str_ip));
-	else
-		p_str_ip = inet_ntop(AF_INET6, ip, str_ip, sizeof(str_ip));
+	update_entry(s, e);
+
+	p_str_ip = entry_to_str(e, str_ip, sizeof(str_ip));
 
-	if (GETCONFIG(s)->max_ban_score > 0 && e->score >= GETCONFIG(s)->max_ban_score) {
+	if (e->score >= max) {
 		if (print_msg && p_str_ip) {
-			mslog(s, NULL, LOG_INFO, "added IP '%s' (with score %d) to ban list, will be reset at: %s", str_ip, e->score, ctime(&e->expires));
+			mslog(s, NULL, LOG_INFO, "added IP '%s' (with score %d, ban %u) to ban list, will be reset at: %s",
+			      str_ip, e->score, e->bans, ctime(&e->expires));
 		}
-		ret = -1;
-	} else {
-		if (p_str_ip) {
-			mslog(s, NULL, LOG_DEBUG, "added %d points (total %d) for IP '%s' to ban list", score, e->score, str_ip);
-		}
-		ret = 0;
+		return 1;
 	}
 
-	return ret;
- fail:
-	talloc_free(e);
-	return ret;
+	if (p_str_ip) {
+		mslog(s, NULL, LOG_DEBUG, "added %d points (total %d) for IP '%s' to ban list", score, e->score, str_ip);
+	}
+	return 0;
+}
+
+typedef struct ban_incr_st {
+	main_server_st *s;
+	inaddr_st ip;
+} ban_incr_st;
+
+/* Raises the score of the entry to the total of the cluster */
+static void ban_incr_done(void *priv, int status, uint64_t value)
+{
+	ban_incr_st *b = priv;
+	main_server_st *s = b->s;
+	ban_node_st *n;
+	ban_entry_st *e;
+
+	if (status != KV_OK || s->ban_db == NULL || value > UINT_MAX)
+		goto finish;
+
+	n = trie_get(s->ban_db, ROOT(s->ban_db, b->ip.size), b->ip.ip,
+		     BAN_HOST_PREFIX(b->ip.size), 0);
+	if (n == NULL || n->entry == NULL)
+		goto finish;
+
+	e = n->entry;
+	if (value > e->score)
+		add_points(s, e, value - e->score, time(0));
+
+ finish:
+	talloc_free(b);
+}
+
+/* Adds the points to the score of the cluster; the entry's score is
+ * raised to that once it is received */
+static void share_ban_points(main_server_st *s, ban_entry_st *e, unsigned score)
+{
+	ban_incr_st *b;
+
+	if (s->kv == NULL || score == 0)
+		return;
+
+	b = talloc(s, ban_incr_st);
+	if (b == NULL)
+		return;
+
+	b->s = s;
+	memcpy(&b->ip, &e->ip, sizeof(b->ip));
+
+	if (kv_store_incr(s->kv, "ban", e->ip.ip, e->ip.size, score,
+			  GETCONFIG(s)->ban_reset_time, ban_incr_done, b) < 0)
+		talloc_free(b);
+}
+
+/* Adds the points to the address, and if @aggregate is set to its prefix.
+ * Returns -1 if either is banned, and zero otherwise */
+static
+int add_ip_to_ban_list(main_server_st *s, const unsigned char *ip, unsigned ip_size,
+		       unsigned score, unsigned aggregate)
+{
+	ban_entry_st *e;
+	time_t now = time(0);
+	unsigned prefix, banned;
+
+	if (s->ban_db == NULL || GETCONFIG(s)->max_ban_score == 0 || ip == NULL || (ip_size != 4 && ip_size != 16))
+		return 0;
+
+	e = get_entry(s, ip, ip_size, BAN_HOST_PREFIX(ip_size), now);
+	if (e == NULL)
+		return 0;
+
+	banned = add_points(s, e, score, now);
+	share_ban_points(s, e, score);
+
+	prefix = aggregate ? aggregate_prefix(s, ip_size) : 0;
+	if (prefix > 0) {
+		e = get_entry(s, ip, ip_size, prefix, now);
+		if (e != NULL)
+			banned |= add_points(s, e, score, now);
+	}
+
+	return banned ? -1 : 0;
 }
 
 int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score)
 {
-	struct htable *db = s->ban_db;
-	ban_entry_st t;
+	inaddr_st t;
 	int ret = 0;
 
-	if (db == NULL || GETCONFIG(s)->max_ban_score == 0 || ip == NULL || ip[0] == 0)
+	if (s->ban_db == NULL || GETCONFIG(s)->max_ban_score == 0 || ip == NULL || ip[0] == 0)
 		return 0;
 
 	if (strchr(ip, ':') != 0) {
-		ret = inet_pton(AF_INET6, ip, t.ip.ip);
-		t.ip.size = 16;
+		ret = inet_pton(AF_INET6, ip, t.ip);
+		t.size = 16;
 	} else {
-		ret = inet_pton(AF_INET, ip, t.ip.ip);
-		t.ip.size = 4;
+		ret = inet_pton(AF_INET, ip, t.ip);
+		t.size = 4;
 	}
 	if (ret != 1) {
 		mslog(s, NULL, LOG_INFO,
@@ -205,16 +552,17 @@ int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score)
 		return 0;
 	}
 
-	return add_ip_to_ban_list(s, t.ip.ip, t.ip.size, score);
+	return add_ip_to_ban_list(s, t.ip, t.size, score, 1);
 }
 
-/* returns non-zero if there is an IP removed */
+/* Resets the entries which cover the address; returns non-zero if there
+ * is one */
 int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 {
-	struct htable *db = s->ban_db;
-	struct ban_entry_st *e;
-	ban_entry_st t;
+	ban_db_st *db = s->ban_db;
+	ban_entry_st *entries[MAX_BAN_MATCHES];
 	char txt_ip[MAX_IP_STR];
+	unsigned i, n;
 
 	if (db == NULL || ip == NULL || size == 0)
 		return 0;
@@ -225,18 +573,17 @@ int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 				      "unbanning IP '%s'", txt_ip);
 		}
 
-		t.ip.size = size;
-		memcpy(&t.ip.ip, ip, size);
-
-		/* In IPv6 treat a /64 as a single address */
-		massage_ipv6_address(&t);
+		if (s->kv != NULL)
+			kv_store_del(s->kv, "ban", ip, size);
 
-		e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
-		if (e != NULL) { /* new entry */
-			e->score = 0;
-			e->expires = 0;
-			return 1;
+		n = trie_match(*ROOT(db, size), ip, BAN_HOST_PREFIX(size), entries, MAX_BAN_MATCHES);
+		for (i = 0; i < n; i++) {
+			entries[i]->score = 0;
+			entries[i]->expires = 0;
+			entries[i]->bans = 0;
+			update_entry(s, entries[i]);
 		}
+		return n > 0;
 	}
 
 	return 0;
@@ -244,10 +591,11 @@ int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size)
 
 unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_size)
 {
-	struct htable *db = s->ban_db;
+	ban_db_st *db = s->ban_db;
 	time_t now;
-	ban_entry_st t, *e;
-	unsigned in_size;
+	ban_entry_st *entries[MAX_BAN_MATCHES];
+	inaddr_st t;
+	unsigned in_size, i, n;
 	char txt[MAX_IP_STR];
 
 	if (db == NULL || GETCONFIG(s)->max_ban_score == 0)
@@ -259,22 +607,23 @@ unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, sockl
 		return 0;
 	}
 
-	memcpy(t.ip.ip, SA_IN_P_GENERIC(addr, addr_size), SA_IN_SIZE(addr_size));
-	t.ip.size = SA_IN_SIZE(addr_size);
+	memcpy(t.ip, SA_IN_P_GENERIC(addr, addr_size), in_size);
+	t.size = in_size;
 
-	/* In IPv6 treat a /64 as a single address */
-	massage_ipv6_address(&t);
+	/* add its current connection points; these are not added up over
+	 * the prefix, as those of legitimate clients sharing it would */
+	add_ip_to_ban_list(s, t.ip, t.size, GETCONFIG(s)->ban_points_connect, 0);
 
-	/* add its current connection points */
-	add_ip_to_ban_list(s, t.ip.ip, t.ip.size, GETCONFIG(s)->ban_points_connect);
+	/* the entries expire as they are due */
+	cleanup_banned_entries(s);
 
 	now = time(0);
-	e = htable_get(db, rehash(&t, NULL), ban_entry_cmp, &t);
-	if (e != NULL) {
-		if (now > e->expires)
-			return 0;
+	n = trie_match(*ROOT(db, in_size), t.ip, BAN_HOST_PREFIX(in_size), entries, MAX_BAN_MATCHES);
+	for (i = 0; i < n; i++) {
+		if (now > entries[i]->expires)
+			continue;
 
-		if (e->score >= GETCONFIG(s)->max_ban_score) {
+		if (entries[i]->score >= ban_entry_max_score(s, entries[i])) {
 		    	mslog(s, NULL, LOG_INFO, "rejected connection from banned IP: %s", human_addr2((struct sockaddr*)addr, addr_size, txt, sizeof(txt), 0));
 			return 1;
 		}
@@ -284,22 +633,10 @@ unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, sockl
 
 void cleanup_banned_entries(main_server_st *s)
 {
-	struct htable *db = s->ban_db;
-	ban_entry_st *t;
-	struct htable_iter iter;
-	time_t now = time(0);
+	ban_db_st *db = s->ban_db;
 
 	if (db == NULL)
 		return;
 
-	t = htable_first(db, &iter);
-	while (t != NULL) {
-		if (now >= t->expires && now > t->last_reset + GETCONFIG(s)->ban_reset_time) {
-			htable_delval(db, &iter);
-			talloc_free(t);
-		}
-		t = htable_next(db, &iter);
-
-	}
+	timer_wheel_run(&db->timers, time(0));
 }
-
@@ -22,24 +22,40 @@
 # define MAIN_BAN_H
 
 # include "main.h"
+# include <timer-wheel.h>
 
 typedef struct inaddr_st {
 	uint8_t ip[16];
 	unsigned size; /* 4 or 16 */
 } inaddr_st;
 
+/* the length of the scored addresses; in IPv6 a /64 is a single address */
+#define BAN_HOST_PREFIX(size) ((size) == 16 ? 64 : 32)
+
+/* The maximum ban time is min-reauth-time times 2^MAX_BAN_ESCALATION */
+#define MAX_BAN_ESCALATION 6
+
 typedef struct ban_entry_st {
-	inaddr_st ip;
+	inaddr_st ip; /* the prefix, with the bits after it cleared */
+	unsigned prefix; /* its length in bits */
 	unsigned score;
+	unsigned bans; /* the times it was banned while in the database */
 
 	time_t last_reset; /* the time its score counting started */
 	time_t expires; /* the time after the client is allowed to login */
+
+	struct ban_node_st *node; /* its node in the prefix trie */
+	wheel_timer_st timer; /* armed at the time it is removed */
 } ban_entry_st;
 
+typedef int (*ban_entry_func)(void *priv, const ban_entry_st *e);
+
 void cleanup_banned_entries(main_server_st *s);
 unsigned check_if_banned(main_server_st *s, struct sockaddr_storage *addr, socklen_t addr_size);
 int add_str_ip_to_ban_list(main_server_st *s, const char *ip, unsigned score);
 int remove_ip_from_ban_list(main_server_st *s, const uint8_t *ip, unsigned size);
+unsigned ban_entry_max_score(main_server_st *s, const ban_entry_st *e);
+int main_ban_db_iterate(main_server_st *s, ban_entry_func func, void *priv);
 unsigned main_ban_db_elems(main_server_st *s);
 void main_ban_db_deinit(main_server_st *s);
 void *main_ban_db_init(main_server_st *s);
@@ -35,6 +35,7 @@
 #include <system.h>
 #include <main-ctl.h>
 #include <main-ban.h>
+#include <proc-search.h>
 #include <ccan/container_of/container_of.h>
 
 #include <ctl.pb-c.h>
@@ -173,6 +174,11 @@ static void method_status(method_ctx *ctx, int cfd, uint8_t * msg,
 			  unsigned msg_size)
 {
 	StatusRep rep = STATUS_REP__INIT;
+	struct ip_pool_stats_st pool_st;
+	AuthBackendStatsMsg *backends;
+	SetupLatencyMsg *latency;
+	SessionTelemetryMsg *telemetry;
+	unsigned i;
 	int ret;
 
 	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: status");
@@ -204,6 +210,89 @@ static void method_status(method_ctx *ctx, int cfd, uint8_t * msg,
 	rep.total_auth_failures = ctx->s->stats.total_auth_failures;
 	rep.total_sessions_closed = ctx->s->stats.total_sessions_closed;
 
+	rep.pending_clients = ctx->s->stats.pending_clients;
+	rep.has_pending_clients = 1;
+	rep.queued_clients = ctx->s->admission_queue.total;
+	rep.has_queued_clients = 1;
+	rep.admission_drops = ctx->s->stats.admission_drops;
+	rep.has_admission_drops = 1;
+
+	ip_pool_stats(&ctx->s->ip_leases, &pool_st);
+	rep.avg_lease_usecs = ctx->s->stats.avg_lease_usecs;
+	rep.has_avg_lease_usecs = 1;
+	rep.max_lease_usecs = ctx->s->stats.max_lease_usecs;
+	rep.has_max_lease_usecs = 1;
+	rep.ip_pool_size = pool_st.size;
+	rep.has_ip_pool_size = 1;
+	rep.ip_pool_used = pool_st.used;
+	rep.has_ip_pool_used = 1;
+	rep.ip_pool_fragments = pool_st.fragments;
+	rep.has_ip_pool_fragments = 1;
+
+	if (ctx->s->stats.auth_backends_size > 0) {
+		rep.auth_backends = talloc_array(ctx->pool, AuthBackendStatsMsg*, ctx->s->stats.auth_backends_size);
+		backends = talloc_array(ctx->pool, AuthBackendStatsMsg, ctx->s->stats.auth_backends_size);
+		if (rep.auth_backends != NULL && backends != NULL) {
+			for (i = 0; i < ctx->s->stats.auth_backends_size; i++) {
+				struct auth_backend_stats_st *st = &ctx->s->stats.auth_backends[i];
+
+				auth_backend_stats_msg__init(&backends[i]);
+				backends[i].name = st->name;
+				backends[i].max_running = st->max_running;
+				backends[i].running = st->running;
+				backends[i].queued = st->queued;
+				backends[i].max_queued = st->max_queued;
+				backends[i].max_wait_ms = st->max_wait_ms;
+				backends[i].completed = st->completed;
+				rep.auth_backends[i] = &backends[i];
+			}
+			rep.n_auth_backends = ctx->s->stats.auth_backends_size;
+		}
+	}
+
+	rep.setup_latency = talloc_array(ctx->pool, SetupLatencyMsg*, SETUP_PHASES);
+	latency = talloc_array(ctx->pool, SetupLatencyMsg, SETUP_PHASES);
+	if (rep.setup_latency != NULL && latency != NULL) {
+		for (i = 0; i < SETUP_PHASES; i++) {
+			latency_hist_st *h = &ctx->s->stats.setup_latency[i];
+
+			if (h->count == 0)
+				continue;
+
+			setup_latency_msg__init(&latency[i]);
+			latency[i].phase = (char*)setup_phase_to_str(i);
+			latency[i].count = h->count;
+			latency[i].median = latency_hist_percentile(h, 50);
+			latency[i].p90 = latency_hist_percentile(h, 90);
+			latency[i].p99 = latency_hist_percentile(h, 99);
+			latency[i].max = h->max;
+			rep.setup_latency[rep.n_setup_latency++] = &latency[i];
+		}
+	}
+
+	telemetry = talloc(ctx->pool, SessionTelemetryMsg);
+	if (telemetry != NULL) {
+		session_telemetry_msg__init(telemetry);
+		telemetry_to_msg(&ctx->s->stats.telemetry, telemetry);
+		rep.telemetry = telemetry;
+	}
+
+	if (ctx->s->stats.dpd_rtt.count > 0) {
+		rep.dpd_rtt_median = latency_hist_percentile(&ctx->s->stats.dpd_rtt, 50);
+		rep.has_dpd_rtt_median = 1;
+		rep.dpd_rtt_p99 = latency_hist_percentile(&ctx->s->stats.dpd_rtt, 99);
+		rep.has_dpd_rtt_p99 = 1;
+	}
+
+	if (ctx->s->stats.acct_spool) {
+		rep.acct_spool_records = ctx->s->stats.acct_spool_records;
+		rep.has_acct_spool_records = 1;
+		rep.acct_spool_bytes = ctx->s->stats.acct_spool_bytes;
+		rep.has_acct_spool_bytes = 1;
+		rep.acct_spool_lag = ctx->s->stats.acct_spool_lag;
+		rep.has_acct_spool_lag = 1;
+	}
+
 	ret = send_msg(ctx->pool, cfd, CTL_CMD_STATUS_REP, &rep,
 		       (pack_size_func) status_rep__get_packed_size,
 		       (pack_func) status_rep__pack);
@@ -261,7 +350,7 @@ static void method_stop(method_ctx *ctx, int cfd, uint8_t * msg,
 #define IPBUF_SIZE 64
 static int append_user_info(method_ctx *ctx,
 			    UserListRep * list,
-			    struct proc_st *ctmp)
+			    struct proc_st *ctmp, unsigned fields)
 {
 	uint32_t tmp;
 	char *ipbuf;
@@ -377,23 +466,44 @@ static int append_user_info(method_ctx *ctx,
 
 	rep->status = ctmp->status;
 
-	rep->tls_ciphersuite = ctmp->tls_ciphersuite;
-	rep->dtls_ciphersuite = ctmp->dtls_ciphersuite;
-
 	calc_safe_id(ctmp->sid, sizeof(ctmp->sid), safe_id, SAFE_ID_SIZE);
 	rep->safe_id.data = (unsigned char*)safe_id;
 	rep->safe_id.len = SAFE_ID_SIZE;
 
-	rep->cstp_compr = ctmp->cstp_compr;
-	rep->dtls_compr = ctmp->dtls_compr;
 	if (ctmp->mtu > 0) {
 		rep->mtu = ctmp->mtu;
 		rep->has_mtu = 1;
 	}
 
+	proc_get_traffic(ctx->s, ctmp, &rep->bytes_in, &rep->bytes_out,
+			 &rep->rx_rate, &rep->tx_rate);
+	rep->has_bytes_in = rep->has_bytes_out = 1;
+	rep->has_rx_rate = rep->has_tx_rate = 1;
+
+	if (ctmp->has_telemetry) {
+		SessionTelemetryMsg *telemetry = talloc(ctx->pool, SessionTelemetryMsg);
+
+		if (telemetry != NULL) {
+			session_telemetry_msg__init(telemetry);
+			telemetry_to_msg(&ctmp->telemetry, telemetry);
+			rep->telemetry = telemetry;
+		}
+	}
+
+	if (fields & CTL_USER_INFO_TLS) {
+		rep->tls_ciphersuite = ctmp->tls_ciphersuite;
+		rep->dtls_ciphersuite = ctmp->dtls_ciphersuite;
+		rep->cstp_compr = ctmp->cstp_compr;
+		rep->dtls_compr = ctmp->dtls_compr;
+	}
+
 	if (ctmp->config) {
 		rep->restrict_to_routes = ctmp->config->restrict_user_to_routes;
+		rep->dpd = ctmp->config->dpd;
+		rep->keepalive = ctmp->config->keepalive;
+	}
 
+	if (ctmp->config && (fields & CTL_USER_INFO_CONFIG)) {
 		tmp = ctmp->config->rx_per_sec;
 		tmp *= 1000;
 		rep->rx_per_sec = tmp;
@@ -402,9 +512,6 @@ static int append_user_info(method_ctx *ctx,
 		tmp *= 1000;
 		rep->tx_per_sec = tmp;
 
-		rep->dpd = ctmp->config->dpd;
-
-		rep->keepalive = ctmp->config->keepalive;
 		if (ctmp->vhost) {
 			rep->domains = ctmp->vhost->perm_config.config->split_dns;
 			rep->n_domains = ctmp->vhost->perm_config.config->split_dns_size;
@@ -432,22 +539,118 @@ static int append_user_info(method_ctx *ctx,
 	return 0;
 }
 
+static unsigned addr_in_prefix(const struct sockaddr_storage *addr, socklen_t addr_len,
+			       const ProtobufCBinaryData *ip, unsigned prefix)
+{
+	const uint8_t *p;
+	unsigned bytes = prefix / 8, bits = prefix % 8;
+
+	if (addr_len == 0 || SA_IN_SIZE(addr_len) != ip->len)
+		return 0;
+
+	p = SA_IN_P_GENERIC(addr, addr_len);
+	if (memcmp(p, ip->data, bytes) != 0)
+		return 0;
+	if (bits != 0 && ((p[bytes] ^ ip->data[bytes]) & (0xff << (8 - bits))) != 0)
+		return 0;
+
+	return 1;
+}
+
+static unsigned match_user(main_server_st *s, const UserListReq *req, struct proc_st *ctmp)
+{
+	uint64_t bytes_in, bytes_out, rx, tx;
+
+	if (req->username != NULL && strcmp(ctmp->username, req->username) != 0)
+		return 0;
+
+	if (req->groupname != NULL && strcmp(ctmp->groupname, req->groupname) != 0)
+		return 0;
+
+	if (req->vhost != NULL && strcmp((VHOSTNAME(ctmp->vhost)), req->vhost) != 0)
+		return 0;
+
+	if (req->has_ip &&
+	    !addr_in_prefix(&ctmp->remote_addr, ctmp->remote_addr_len, &req->ip, req->ip_prefix) &&
+	    !(ctmp->ipv4 && addr_in_prefix(&ctmp->ipv4->rip, ctmp->ipv4->rip_len, &req->ip, req->ip_prefix)) &&
+	    !(ctmp->ipv6 && addr_in_prefix(&ctmp->ipv6->rip, ctmp->ipv6->rip_len, &req->ip, req->ip_prefix)))
+		return 0;
+
+	if (req->has_min_traffic) {
+		proc_get_traffic(s, ctmp, &bytes_in, &bytes_out, &rx, &tx);
+		if (bytes_in + bytes_out < req->min_traffic)
+			return 0;
+	}
+
+	return 1;
+}
+
 static void method_list_users(method_ctx *ctx, int cfd, uint8_t * msg,
 			      unsigned msg_size)
 {
+	UserListReq *req;
 	UserListRep rep = USER_LIST_REP__INIT;
 	struct proc_st *ctmp = NULL;
+	struct list_node *head, *n;
+	unsigned fields = CTL_USER_INFO_ALL;
+	uint64_t last_seq = 0;
 	int ret;
 
 	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: list-users");
 
-	list_for_each(&ctx->s->proc_list.head, ctmp, list) {
-		ret = append_user_info(ctx, &rep, ctmp);
+	req = user_list_req__unpack(NULL, msg_size, msg);
+	if (req == NULL) {
+		mslog(ctx->s, NULL, LOG_ERR,
+		      "error parsing list-users request");
+		return;
+	}
+
+	if (req->has_fields)
+		fields = req->fields;
+
+	/* the whole address unless a prefix is given */
+	if (req->has_ip && !req->has_ip_prefix)
+		req->ip_prefix = req->ip.len * 8;
+
+	if (req->has_ip && ((req->ip.len != 4 && req->ip.len != 16) || req->ip_prefix > req->ip.len * 8)) {
+		mslog(ctx->s, NULL, LOG_ERR,
+		      "invalid IP prefix in list-users request");
+		goto error;
+	}
+
+	/* the list is ordered from the most recent session, and a page
+	 * continues from the first one older than the cursor */
+	head = &ctx->s->proc_list.head.n;
+	n = head->next;
+	if (req->cursor != 0) {
+		ctmp = proc_search_seq(ctx->s, req->cursor);
+		if (ctmp != NULL) {
+			n = ctmp->list.next;
+		} else { /* the session at the cursor is gone */
+			while (n != head && list_entry(n, struct proc_st, list)->seq >= req->cursor)
+				n = n->next;
+		}
+	}
+
+	for (; n != head; n = n->next) {
+		ctmp = list_entry(n, struct proc_st, list);
+
+		if (match_user(ctx->s, req, ctmp) == 0)
+			continue;
+
+		if (req->max_entries != 0 && rep.n_user >= req->max_entries) {
+			rep.next_cursor = last_seq;
+			rep.has_next_cursor = 1;
+			break;
+		}
+
+		ret = append_user_info(ctx, &rep, ctmp, fields);
 		if (ret < 0) {
 			mslog(ctx->s, NULL, LOG_ERR,
 			      "error appending user info to reply");
 			goto error;
 		}
+		last_seq = ctmp->seq;
 	}
 
 	ret = send_msg(ctx->pool, cfd, CTL_CMD_LIST_REP, &rep,
@@ -458,6 +661,7 @@ static void method_list_users(method_ctx *ctx, int cfd, uint8_t * msg,
 	}
 
  error:
+	user_list_req__free_unpacked(req, NULL);
 	return;
 }
 
@@ -476,10 +680,16 @@ static void method_top(method_ctx *ctx, int cfd, uint8_t * msg,
 	method_list_users(ctx, cfd, msg, msg_size);
 }
 
-static int append_ban_info(method_ctx *ctx,
-			   BanListRep *list,
-			   struct ban_entry_st *e)
+struct ban_list_st {
+	method_ctx *ctx;
+	BanListRep *list;
+};
+
+static int append_ban_info(void *priv, const struct ban_entry_st *e)
 {
+	struct ban_list_st *b = priv;
+	method_ctx *ctx = b->ctx;
+	BanListRep *list = b->list;
 	BanInfoRep *rep;
 	main_server_st *s = ctx->s;
 
@@ -495,11 +705,15 @@ static int append_ban_info(method_ctx *ctx,
 
 	ban_info_rep__init(rep);
 
-	rep->ip.data = e->ip.ip;
+	rep->ip.data = (void *)e->ip.ip;
 	rep->ip.len = e->ip.size;
 	rep->score = e->score;
+	if (e->prefix < BAN_HOST_PREFIX(e->ip.size)) {
+		rep->prefix = e->prefix;
+		rep->has_prefix = 1;
+	}
 
-	if (GETCONFIG(s)->max_ban_score > 0 && e->score >= GETCONFIG(s)->max_ban_score) {
+	if (GETCONFIG(s)->max_ban_score > 0 && e->score >= ban_entry_max_score(s, e)) {
 		rep->expires = e->expires;
 		rep->has_expires = 1;
 	}
@@ -511,22 +725,16 @@ static void method_list_banned(method_ctx *ctx, int cfd, uint8_t * msg,
 			      unsigned msg_size)
 {
 	BanListRep rep = BAN_LIST_REP__INIT;
-	struct ban_entry_st *e = NULL;
-	struct htable *db = ctx->s->ban_db;
+	struct ban_list_st b = { ctx, &rep };
 	int ret;
-	struct htable_iter iter;
 
 	mslog(ctx->s, NULL, LOG_DEBUG, "ctl: list-banned-ips");
 
-	e = htable_first(db, &iter);
-	while (e != NULL) {
-		ret = append_ban_info(ctx, &rep, e);
-		if (ret < 0) {
-			mslog(ctx->s, NULL, LOG_ERR,
-			      "error appending ban info to reply");
-			goto error;
-		}
-		e = htable_next(db, &iter);
+	ret = main_ban_db_iterate(ctx->s, append_ban_info, &b);
+	if (ret < 0) {
+		mslog(ctx->s, NULL, LOG_ERR,
+		      "error appending ban info to reply");
+		goto error;
 	}
 
 	ret = send_msg(ctx->pool, cfd, CTL_CMD_LIST_BANNED_REP, &rep,
@@ -585,7 +793,7 @@ static void single_info_common(method_ctx *ctx, int cfd, uint8_t * msg,
 			}
 		}
 
-		ret = append_user_info(ctx, &rep, ctmp);
+		ret = append_user_info(ctx, &rep, ctmp, CTL_USER_INFO_ALL);
 		if (ret < 0) {
 			mslog(ctx->s, NULL, LOG_ERR,
 			      "error appending user info to reply");
@@ -708,11 +916,10 @@ static void method_disconnect_user_name(method_ctx *ctx,
 	}
 
 	/* got the name. Try to disconnect */
-	list_for_each_safe(&ctx->s->proc_list.head, ctmp, cpos, list) {
-		if (strcmp(ctmp->username, req->username) == 0) {
-			terminate_proc(ctx->s, ctmp);
-			rep.status = 1;
-		}
+	for (ctmp = proc_search_user(ctx->s, req->username); ctmp != NULL; ctmp = cpos) {
+		cpos = proc_search_user_next(ctx->s, ctmp);
+		terminate_proc(ctx->s, ctmp);
+		rep.status = 1;
 	}
 
 	username_req__free_unpacked(req, NULL);
@@ -906,7 +1113,7 @@ void ctl_handler_notify (main_server_st* s, struct proc_st *proc, unsigned conne
 		rep.discon_reason_txt = (char*)discon_reason_to_str(proc->discon_reason);
 	}
 
-	ret = append_user_info(&ctx, &list, proc);
+	ret = append_user_info(&ctx, &list, proc, CTL_USER_INFO_ALL);
 	if (ret < 0) {
 		mslog(s, NULL, LOG_ERR,
 		      "error appending user info to reply");
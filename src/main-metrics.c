@@ -0,0 +1,989 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The metrics of the server in the OpenMetrics text format.
+ *
+ * They are served by main over HTTP, on a unix socket and/or a TCP port
+ * of the loopback interface. The statistics of main are rendered along
+ * with the sessions of each virtual host and group, which are counted
+ * as they open and close, so that a scrape does not visit the sessions.
+ * The reply is rendered a buffer at a time as the socket can be written
+ * to, so that a slow or a large scrape does not stall the main loop.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <common.h>
+#include <syslog.h>
+#include <vpn.h>
+#include <main.h>
+#include <main-ban.h>
+#include <main-metrics.h>
+#include <ip-lease.h>
+#include <cloexec.h>
+#include <vhost.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+#include <ccan/list/list.h>
+#include <ccan/container_of/container_of.h>
+
+/* the labels counted separately; the sessions of any other are counted
+ * together */
+#define MAX_METRICS_LABELS 1024
+#define OTHER_LABEL "(other)"
+
+#define MAX_METRICS_CONNS 8
+#define METRICS_TIMEOUT 10 /* seconds to complete a scrape */
+#define MAX_METRICS_REQ 1024
+#define METRICS_BUF_SIZE 16384
+/* the space left in the buffer for rendering a step; a step renders
+ * at most a family header and a sample */
+#define MAX_METRICS_LINE 512
+
+enum {
+	LISTEN_UNIX,
+	LISTEN_TCP,
+	LISTEN_MAX
+};
+
+struct metrics_st {
+	int fd[LISTEN_MAX]; /* -1 if not used */
+	ev_io io[LISTEN_MAX];
+
+	struct htable labels; /* of metrics_label_st, by vhost and group */
+	struct list_head label_list; /* in the order they were added */
+	unsigned nlabels;
+	metrics_label_st *other;
+
+	uint64_t bytes_in; /* of the closed sessions */
+	uint64_t bytes_out;
+
+	struct list_head conns; /* of metrics_conn_st */
+	unsigned nconns;
+
+	main_server_st *s;
+};
+
+#define LABEL_FAMILIES 4
+#define BACKEND_FAMILIES 4
+/* the header and a sample per module, of each backend family */
+#define BACKEND_STEPS (BACKEND_FAMILIES * (MAX_AUTH_BACKEND_STATS + 1))
+
+/* the bucket bounds of the setup histograms are the powers of two of
+ * microseconds, from 128us to about 67s */
+#define SETUP_MIN_BOUND 7
+#define SETUP_MAX_BOUND 26
+#define SETUP_BOUNDS (SETUP_MAX_BOUND - SETUP_MIN_BOUND + 1)
+#define SETUP_SAMPLES (SETUP_BOUNDS + 3) /* with +Inf, count and sum */
+#define SETUP_FAMILY "ocserv_session_setup_seconds"
+
+enum {
+	SECTION_HEADER,
+	SECTION_GLOBAL, /* a family at a time */
+	SECTION_BACKENDS, /* a sample at a time */
+	SECTION_TELEMETRY, /* a family at a time */
+	SECTION_SETUP, /* a sample at a time */
+	SECTION_LABELS, /* one per label_families entry */
+	SECTION_EOF = SECTION_LABELS + LABEL_FAMILIES,
+	SECTION_DONE
+};
+
+typedef struct metrics_conn_st {
+	struct list_node list;
+	struct metrics_st *m;
+
+	int fd;
+	ev_io io;
+	ev_timer timer;
+
+	char req[MAX_METRICS_REQ];
+	unsigned req_size;
+
+	unsigned section; /* the next one to render */
+	unsigned started; /* whether the family of the section is */
+	metrics_label_st *label; /* the next one of the section */
+	unsigned sample; /* the next step of the section */
+
+	char buf[METRICS_BUF_SIZE];
+	unsigned overflow; /* whether a step did not fit in buf */
+	size_t len;
+	size_t pos; /* what is written from buf */
+} metrics_conn_st;
+
+typedef struct label_family_st {
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t offset; /* of the value in metrics_label_st */
+} label_family_st;
+
+static const label_family_st label_families[LABEL_FAMILIES] = {
+	{"ocserv_group_sessions", "gauge",
+	 "The open sessions of the virtual host and group.",
+	 offsetof(metrics_label_st, sessions)},
+	{"ocserv_group_sessions_opened", "counter",
+	 "The sessions opened in the virtual host and group.",
+	 offsetof(metrics_label_st, sessions_opened)},
+	{"ocserv_group_received_bytes", "counter",
+	 "The bytes received from the closed sessions of the virtual host and group.",
+	 offsetof(metrics_label_st, bytes_in)},
+	{"ocserv_group_sent_bytes", "counter",
+	 "The bytes sent to the closed sessions of the virtual host and group.",
+	 offsetof(metrics_label_st, bytes_out)},
+};
+
+static size_t rehash_label(const void *_p, void *unused)
+{
+	const metrics_label_st *l = _p;
+
+	return hash_any(l->group, strlen(l->group),
+			hash_any(l->vhost, strlen(l->vhost), 0));
+}
+
+struct find_label_st {
+	const char *vhost;
+	const char *group;
+};
+
+static bool label_cmp(const void *_c1, void *_c2)
+{
+	const metrics_label_st *c1 = _c1;
+	struct find_label_st *c2 = _c2;
+
+	return strcmp(c1->vhost, c2->vhost) == 0 && strcmp(c1->group, c2->group) == 0;
+}
+
+static metrics_label_st *new_label(struct metrics_st *m, const char *vhost, const char *group)
+{
+	metrics_label_st *l;
+
+	l = talloc_zero(m, metrics_label_st);
+	if (l == NULL)
+		return NULL;
+
+	strlcpy(l->vhost, vhost, sizeof(l->vhost));
+	strlcpy(l->group, group, sizeof(l->group));
+
+	list_add_tail(&m->label_list, &l->list);
+	m->nlabels++;
+
+	return l;
+}
+
+static metrics_label_st *get_label(struct metrics_st *m, const char *vhost, const char *group)
+{
+	struct find_label_st fl;
+	metrics_label_st *l;
+
+	fl.vhost = vhost;
+	fl.group = group;
+
+	l = htable_get(&m->labels, hash_any(group, strlen(group),
+				hash_any(vhost, strlen(vhost), 0)),
+		       label_cmp, &fl);
+	if (l != NULL)
+		return l;
+
+	if (m->nlabels >= MAX_METRICS_LABELS) {
+		if (m->other == NULL)
+			m->other = new_label(m, OTHER_LABEL, OTHER_LABEL);
+		return m->other;
+	}
+
+	l = new_label(m, vhost, group);
+	if (l == NULL)
+		return NULL;
+
+	if (htable_add(&m->labels, rehash_label(l, NULL), l) == 0) {
+		list_del(&l->list);
+		m->nlabels--;
+		talloc_free(l);
+		return NULL;
+	}
+
+	return l;
+}
+
+void metrics_session_open(main_server_st *s, struct proc_st *proc)
+{
+	struct metrics_st *m = s->metrics;
+	metrics_label_st *l;
+
+	if (m == NULL || proc->metrics_label != NULL)
+		return;
+
+	l = get_label(m, (VHOSTNAME(proc->vhost)), proc->groupname);
+	if (l == NULL)
+		return;
+
+	l->sessions++;
+	l->sessions_opened++;
+	proc->metrics_label = l;
+}
+
+void metrics_session_close(main_server_st *s, struct proc_st *proc)
+{
+	struct metrics_st *m = s->metrics;
+	metrics_label_st *l = proc->metrics_label;
+
+	if (m == NULL || l == NULL)
+		return;
+
+	l->sessions--;
+	l->bytes_in += proc->bytes_in;
+	l->bytes_out += proc->bytes_out;
+	m->bytes_in += proc->bytes_in;
+	m->bytes_out += proc->bytes_out;
+	proc->metrics_label = NULL;
+}
+
+static void close_conn(metrics_conn_st *c)
+{
+	ev_io_stop(loop, &c->io);
+	ev_timer_stop(loop, &c->timer);
+	close(c->fd);
+	list_del(&c->list);
+	c->m->nconns--;
+	talloc_free(c);
+}
+
+static void out(metrics_conn_st *c, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(c->buf + c->len, sizeof(c->buf) - c->len, fmt, args);
+	va_end(args);
+
+	if (ret < 0 || (size_t)ret >= sizeof(c->buf) - c->len) {
+		c->overflow = 1;
+		return;
+	}
+
+	c->len += ret;
+}
+
+static void family(metrics_conn_st *c, const char *name, const char *type, const char *help)
+{
+	out(c, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void gauge(metrics_conn_st *c, const char *name, const char *help, uint64_t value)
+{
+	family(c, name, "gauge", help);
+	out(c, "%s %"PRIu64"\n", name, value);
+}
+
+static void counter(metrics_conn_st *c, const char *name, const char *help, uint64_t value)
+{
+	family(c, name, "counter", help);
+	out(c, "%s_total %"PRIu64"\n", name, value);
+}
+
+/* Copies the label value with its backslashes, quotes and newlines
+ * escaped */
+static const char *escape(const char *str, char *dst, size_t dst_size)
+{
+	size_t i = 0;
+
+	for (; *str != 0 && i + 2 < dst_size; str++) {
+		if (*str == '\\' || *str == '"') {
+			dst[i++] = '\\';
+			dst[i++] = *str;
+		} else if (*str == '\n') {
+			dst[i++] = '\\';
+			dst[i++] = 'n';
+		} else {
+			dst[i++] = *str;
+		}
+	}
+	dst[i] = 0;
+
+	return dst;
+}
+
+/* the open sessions, from the counters of their workers */
+static void open_counters(main_server_st *s, uint64_t *bytes_in, uint64_t *bytes_out,
+			  uint64_t *rx_rate, uint64_t *tx_rate)
+{
+	struct proc_st *ctmp;
+	session_counters_st *sc;
+
+	/* only the slots in use are read, as each is a page of its own */
+	*bytes_in = *bytes_out = *rx_rate = *tx_rate = 0;
+	list_for_each(&s->proc_list.head, ctmp, list) {
+		sc = session_counters_get(&s->counters, ctmp->counters_slot);
+		if (sc == NULL)
+			continue;
+		*bytes_in += COUNTER_LOAD(&sc->c.bytes_in);
+		*bytes_out += COUNTER_LOAD(&sc->c.bytes_out);
+		*rx_rate += COUNTER_LOAD(&sc->c.rx_per_sec);
+		*tx_rate += COUNTER_LOAD(&sc->c.tx_per_sec);
+	}
+}
+
+/* Renders a family of the global section; returns 0 once there are
+ * no more steps */
+static unsigned render_global(metrics_conn_st *c, unsigned step)
+{
+	main_server_st *s = c->m->s;
+	struct main_stats_st *st = &s->stats;
+	struct ip_pool_stats_st pool_st;
+	uint64_t queued = 0;
+	uint64_t open_in, open_out, rx_rate, tx_rate;
+	unsigned i;
+
+	switch (step) {
+	case 0:
+		gauge(c, "ocserv_start_time_seconds", "The time the server was started.", st->start_time);
+		break;
+	case 1:
+		gauge(c, "ocserv_sessions", "The connected clients.", st->active_clients);
+		break;
+	case 2:
+		gauge(c, "ocserv_pending_clients", "The workers which have not presented a cookie yet.", st->pending_clients);
+		break;
+	case 3:
+		gauge(c, "ocserv_queued_clients", "The connections waiting for admission.", s->admission_queue.total);
+		break;
+	case 4:
+		counter(c, "ocserv_admission_drops", "The connections dropped by admission control.", st->admission_drops);
+		break;
+	case 5:
+		gauge(c, "ocserv_secmod_client_entries", "The client entries of sec-mod.", st->secmod_client_entries);
+		break;
+	case 6:
+		gauge(c, "ocserv_tls_sessions", "The stored TLS sessions.", st->tlsdb_entries);
+		break;
+	case 7:
+		gauge(c, "ocserv_ban_entries", "The IP addresses and prefixes with a score or banned.", main_ban_db_elems(s));
+		break;
+	case 8:
+		counter(c, "ocserv_bans", "The IP addresses and prefixes banned.", st->total_bans);
+		break;
+	case 9:
+		counter(c, "ocserv_auth_failures", "The authentication failures.", st->total_auth_failures);
+		break;
+	case 10:
+		gauge(c, "ocserv_auth_time_avg_seconds", "The average time to authenticate since the statistics reset.", st->avg_auth_time);
+		break;
+	case 11:
+		gauge(c, "ocserv_auth_time_max_seconds", "The maximum time to authenticate since the statistics reset.", st->max_auth_time);
+		break;
+	case 12:
+		counter(c, "ocserv_sessions_closed", "The sessions closed.", st->total_sessions_closed);
+		break;
+	case 13:
+		counter(c, "ocserv_session_timeouts", "The sessions closed on timeout since the statistics reset.", st->session_timeouts);
+		break;
+	case 14:
+		counter(c, "ocserv_session_idle_timeouts", "The sessions closed on idle timeout since the statistics reset.", st->session_idle_timeouts);
+		break;
+	case 15:
+		counter(c, "ocserv_session_errors", "The sessions closed on error since the statistics reset.", st->session_errors);
+		break;
+	case 16:
+		gauge(c, "ocserv_session_duration_avg_seconds", "The average duration of the sessions closed since the statistics reset.", (uint64_t)st->avg_session_mins * 60);
+		break;
+	case 17:
+		gauge(c, "ocserv_session_duration_max_seconds", "The maximum duration of the sessions closed since the statistics reset.", (uint64_t)st->max_session_mins * 60);
+		break;
+	case 18:
+		counter(c, "ocserv_received_bytes", "The bytes received from the closed sessions.", c->m->bytes_in);
+		break;
+	case 19:
+		counter(c, "ocserv_sent_bytes", "The bytes sent to the closed sessions.", c->m->bytes_out);
+		break;
+	case 20:
+		open_counters(s, &open_in, &open_out, &rx_rate, &tx_rate);
+		gauge(c, "ocserv_sessions_received_bytes", "The bytes received from the open sessions.", open_in);
+		break;
+	case 21:
+		open_counters(s, &open_in, &open_out, &rx_rate, &tx_rate);
+		gauge(c, "ocserv_sessions_sent_bytes", "The bytes sent to the open sessions.", open_out);
+		break;
+	case 22:
+		open_counters(s, &open_in, &open_out, &rx_rate, &tx_rate);
+		gauge(c, "ocserv_sessions_received_bytes_per_second", "The rate of the traffic received from the open sessions.", rx_rate);
+		break;
+	case 23:
+		open_counters(s, &open_in, &open_out, &rx_rate, &tx_rate);
+		gauge(c, "ocserv_sessions_sent_bytes_per_second", "The rate of the traffic sent to the open sessions.", tx_rate);
+		break;
+	case 24:
+		gauge(c, "ocserv_mtu_min_bytes", "The minimum MTU of the sessions closed since the statistics reset.", st->min_mtu);
+		break;
+	case 25:
+		gauge(c, "ocserv_mtu_max_bytes", "The maximum MTU of the sessions closed since the statistics reset.", st->max_mtu);
+		break;
+	case 26:
+		ip_pool_stats(&s->ip_leases, &pool_st);
+		gauge(c, "ocserv_ip_pool_size", "The addresses of the IP pools.", pool_st.size);
+		break;
+	case 27:
+		ip_pool_stats(&s->ip_leases, &pool_st);
+		gauge(c, "ocserv_ip_pool_used", "The leased addresses of the IP pools.", pool_st.used);
+		break;
+	case 28:
+		ip_pool_stats(&s->ip_leases, &pool_st);
+		gauge(c, "ocserv_ip_pool_fragments", "The ranges of free addresses of the IP pools.", pool_st.fragments);
+		break;
+	case 29:
+		counter(c, "ocserv_ip_leases", "The IP leases allocated.", st->ip_leases);
+		break;
+	case 30:
+		family(c, "ocserv_ip_lease_time_avg_seconds", "gauge", "The average time to allocate an IP lease.");
+		out(c, "ocserv_ip_lease_time_avg_seconds %u.%06u\n",
+		    st->avg_lease_usecs / 1000000, st->avg_lease_usecs % 1000000);
+		break;
+	case 31:
+		for (i = 0; i < st->auth_backends_size; i++)
+			queued += st->auth_backends[i].queued;
+		gauge(c, "ocserv_secmod_queued_requests", "The authentication requests queued in sec-mod.", queued);
+		break;
+	case 32:
+		if (st->acct_spool)
+			gauge(c, "ocserv_acct_spool_records", "The accounting records spooled.", st->acct_spool_records);
+		break;
+	case 33:
+		if (st->acct_spool)
+			gauge(c, "ocserv_acct_spool_bytes", "The size of the accounting spool.", st->acct_spool_bytes);
+		break;
+	case 34:
+		if (st->acct_spool)
+			gauge(c, "ocserv_acct_spool_lag_seconds", "The age of the oldest spooled accounting record.", st->acct_spool_lag);
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Renders the header of a family of the authentication modules at
+ * idx 0, and the sample of a module otherwise */
+static void render_backend(metrics_conn_st *c, unsigned f, unsigned idx)
+{
+	struct main_stats_st *st = &c->m->s->stats;
+	const struct auth_backend_stats_st *b;
+	char tmp[MAX_AUTH_BACKEND_NAME * 2];
+	const char *name;
+	uint64_t value;
+
+	if (st->auth_backends_size == 0 || idx > st->auth_backends_size)
+		return;
+
+	switch (f) {
+	case 0:
+		name = "ocserv_auth_backend_running";
+		if (idx == 0)
+			family(c, name, "gauge", "The requests run by the authentication module.");
+		break;
+	case 1:
+		name = "ocserv_auth_backend_max_running";
+		if (idx == 0)
+			family(c, name, "gauge", "The requests the authentication module may run at once.");
+		break;
+	case 2:
+		name = "ocserv_auth_backend_queued";
+		if (idx == 0)
+			family(c, name, "gauge", "The requests queued for the authentication module.");
+		break;
+	default:
+		name = "ocserv_auth_backend_completed";
+		if (idx == 0)
+			family(c, name, "counter", "The requests completed by the authentication module.");
+		break;
+	}
+
+	if (idx == 0)
+		return;
+
+	b = &st->auth_backends[idx - 1];
+	switch (f) {
+	case 0:
+		value = b->running;
+		break;
+	case 1:
+		value = b->max_running;
+		break;
+	case 2:
+		value = b->queued;
+		break;
+	default:
+		value = b->completed;
+		break;
+	}
+
+	out(c, "%s%s{backend=\"%s\"} %"PRIu64"\n", name, f == 3 ? "_total" : "",
+	    escape(b->name, tmp, sizeof(tmp)), value);
+}
+
+/* Renders a family of the data-plane events reported by the workers;
+ * returns 0 once there are no more steps */
+static unsigned render_telemetry(metrics_conn_st *c, unsigned step)
+{
+	struct main_stats_st *st = &c->m->s->stats;
+	const session_telemetry_st *t = &st->telemetry;
+	uint64_t usecs;
+
+	switch (step) {
+	case 0:
+		counter(c, "ocserv_policed_received_packets", "The packets from the clients dropped by the bandwidth limits.", t->rx_policed);
+		break;
+	case 1:
+		counter(c, "ocserv_policed_sent_packets", "The packets to the clients dropped by the bandwidth limits.", t->tx_policed);
+		break;
+	case 2:
+		counter(c, "ocserv_compression_input_bytes", "The bytes given to compression.", t->comp_in);
+		break;
+	case 3:
+		counter(c, "ocserv_compression_output_bytes", "The bytes sent for the ones given to compression.", t->comp_out);
+		break;
+	case 4:
+		counter(c, "ocserv_mtu_decreases", "The decreases of the MTU on packets too large for the path.", t->mtu_decreases);
+		break;
+	case 5:
+		counter(c, "ocserv_mtu_increases", "The increases of the MTU.", t->mtu_increases);
+		break;
+	case 6:
+		counter(c, "ocserv_switches_to_tls", "The switches of the data from DTLS to TLS.", t->to_tls);
+		break;
+	case 7:
+		counter(c, "ocserv_switches_to_dtls", "The switches of the data from TLS to DTLS.", t->to_dtls);
+		break;
+	case 8:
+		counter(c, "ocserv_empty_reads", "The reads of the workers which found nothing.", t->eagain);
+		break;
+	case 9:
+		if (st->dpd_rtt.count > 0) {
+			usecs = latency_hist_percentile(&st->dpd_rtt, 50);
+			family(c, "ocserv_dpd_rtt_median_seconds", "gauge", "The median round trip of DPD, with the samples of each worker report counted at their mean.");
+			out(c, "ocserv_dpd_rtt_median_seconds %u.%06u\n",
+			    (unsigned)(usecs / 1000000), (unsigned)(usecs % 1000000));
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+static void render_setup_sample(metrics_conn_st *c, unsigned phase, unsigned idx)
+{
+	const latency_hist_st *h = &c->m->s->stats.setup_latency[phase];
+	const char *name = setup_phase_to_str(phase);
+	uint64_t bound;
+
+	if (idx < SETUP_BOUNDS) {
+		bound = (uint64_t)1 << (SETUP_MIN_BOUND + idx);
+		out(c, SETUP_FAMILY"_bucket{phase=\"%s\",le=\"%u.%06u\"} %"PRIu64"\n", name,
+		    (unsigned)(bound / 1000000), (unsigned)(bound % 1000000),
+		    latency_hist_count_below(h, bound));
+	} else if (idx == SETUP_BOUNDS) {
+		out(c, SETUP_FAMILY"_bucket{phase=\"%s\",le=\"+Inf\"} %"PRIu64"\n", name, h->count);
+	} else if (idx == SETUP_BOUNDS + 1) {
+		out(c, SETUP_FAMILY"_count{phase=\"%s\"} %"PRIu64"\n", name, h->count);
+	} else {
+		out(c, SETUP_FAMILY"_sum{phase=\"%s\"} %"PRIu64".%06u\n", name,
+		    h->sum / 1000000, (unsigned)(h->sum % 1000000));
+	}
+}
+
+static metrics_label_st *next_label(struct metrics_st *m, metrics_label_st *l)
+{
+	if (l->list.next == &m->label_list.n)
+		return NULL;
+
+	return container_of(l->list.next, metrics_label_st, list);
+}
+
+/* Renders the next parts of the reply to the buffer; returns -1 if
+ * a step did not fit */
+static int render(metrics_conn_st *c)
+{
+	struct metrics_st *m = c->m;
+	const label_family_st *f;
+	char vhost[MAX_HOSTNAME_SIZE * 2];
+	char group[MAX_GROUPNAME_SIZE * 2];
+
+	c->len = c->pos = 0;
+
+	while (c->section != SECTION_DONE && c->len + MAX_METRICS_LINE <= sizeof(c->buf)) {
+		switch (c->section) {
+		case SECTION_HEADER:
+			if (strncmp(c->req, "GET ", 4) != 0) {
+				out(c, "HTTP/1.0 405 Method Not Allowed\r\n"
+				       "Allow: GET\r\n"
+				       "Connection: close\r\n\r\n");
+				c->section = SECTION_DONE;
+				break;
+			}
+
+			out(c, "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			       "Connection: close\r\n\r\n");
+			c->section++;
+			break;
+		case SECTION_GLOBAL:
+			if (render_global(c, c->sample) == 0) {
+				c->section++;
+				c->sample = 0;
+			} else {
+				c->sample++;
+			}
+			break;
+		case SECTION_BACKENDS:
+			if (c->sample == BACKEND_STEPS) {
+				c->section++;
+				c->sample = 0;
+			} else {
+				render_backend(c, c->sample / (MAX_AUTH_BACKEND_STATS + 1),
+					       c->sample % (MAX_AUTH_BACKEND_STATS + 1));
+				c->sample++;
+			}
+			break;
+		case SECTION_TELEMETRY:
+			if (render_telemetry(c, c->sample) == 0) {
+				c->section++;
+				c->sample = 0;
+			} else {
+				c->sample++;
+			}
+			break;
+		case SECTION_SETUP:
+			if (!c->started) {
+				family(c, SETUP_FAMILY, "histogram", "The time taken by the phases of the session setup.");
+				c->sample = 0;
+				c->started = 1;
+			} else if (c->sample == SETUP_PHASES * SETUP_SAMPLES) {
+				c->section++;
+				c->started = 0;
+			} else {
+				render_setup_sample(c, c->sample / SETUP_SAMPLES, c->sample % SETUP_SAMPLES);
+				c->sample++;
+			}
+			break;
+		case SECTION_EOF:
+			out(c, "# EOF\n");
+			c->section++;
+			break;
+		default:
+			f = &label_families[c->section - SECTION_LABELS];
+
+			if (!c->started) {
+				family(c, f->name, f->type, f->help);
+				c->label = list_top(&m->label_list, metrics_label_st, list);
+				c->started = 1;
+			} else if (c->label == NULL) {
+				c->section++;
+				c->started = 0;
+			} else {
+				out(c, "%s%s{vhost=\"%s\",group=\"%s\"} %"PRIu64"\n",
+				    f->name, strcmp(f->type, "counter") == 0 ? "_total" : "",
+				    escape(c->label->vhost, vhost, sizeof(vhost)),
+				    escape(c->label->group, group, sizeof(group)),
+				    *(uint64_t *)((uint8_t *)c->label + f->offset));
+				c->label = next_label(m, c->label);
+			}
+			break;
+		}
+
+		if (c->overflow)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void conn_write_cb(EV_P_ ev_io *w, int revents)
+{
+	metrics_conn_st *c = container_of(w, metrics_conn_st, io);
+	ssize_t ret;
+
+	if (c->pos == c->len) {
+		if (c->section == SECTION_DONE) {
+			close_conn(c);
+			return;
+		}
+		if (render(c) < 0) {
+			/* a truncated exposition would be taken as complete */
+			mslog(c->m->s, NULL, LOG_ERR, "metrics reply does not fit in the buffer; closing the connection");
+			close_conn(c);
+			return;
+		}
+	}
+
+	ret = write(c->fd, c->buf + c->pos, c->len - c->pos);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		close_conn(c);
+		return;
+	}
+
+	c->pos += ret;
+}
+
+static void conn_read_cb(EV_P_ ev_io *w, int revents)
+{
+	metrics_conn_st *c = container_of(w, metrics_conn_st, io);
+	ssize_t ret;
+
+	ret = read(c->fd, c->req + c->req_size, sizeof(c->req) - 1 - c->req_size);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		close_conn(c);
+		return;
+	}
+
+	if (ret == 0) {
+		close_conn(c);
+		return;
+	}
+
+	c->req_size += ret;
+	c->req[c->req_size] = 0;
+
+	/* the headers are not needed */
+	if (strstr(c->req, "\r\n\r\n") == NULL && strstr(c->req, "\n\n") == NULL &&
+	    c->req_size < sizeof(c->req) - 1)
+		return;
+
+	ev_io_stop(EV_A_ &c->io);
+	ev_io_init(&c->io, conn_write_cb, c->fd, EV_WRITE);
+	ev_io_start(EV_A_ &c->io);
+}
+
+static void conn_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+	metrics_conn_st *c = container_of(w, metrics_conn_st, timer);
+
+	close_conn(c);
+}
+
+static void accept_cb(EV_P_ ev_io *w, int revents)
+{
+	struct metrics_st *m = w->data;
+	metrics_conn_st *c;
+	int fd, e;
+
+	fd = accept(w->fd, NULL, NULL);
+	if (fd == -1) {
+		e = errno;
+		if (e != EAGAIN && e != EINTR)
+			mslog(m->s, NULL, LOG_ERR, "error accepting metrics connection: %s", strerror(e));
+		return;
+	}
+
+	if (m->nconns >= MAX_METRICS_CONNS) {
+		mslog(m->s, NULL, LOG_INFO, "too many metrics connections; dropping one");
+		close(fd);
+		return;
+	}
+
+	c = talloc_zero(m, metrics_conn_st);
+	if (c == NULL) {
+		close(fd);
+		return;
+	}
+
+	set_cloexec_flag(fd, 1);
+	set_non_block(fd);
+
+	c->m = m;
+	c->fd = fd;
+	list_add_tail(&m->conns, &c->list);
+	m->nconns++;
+
+	ev_io_init(&c->io, conn_read_cb, fd, EV_READ);
+	ev_io_start(EV_A_ &c->io);
+	ev_timer_init(&c->timer, conn_timer_cb, METRICS_TIMEOUT, 0);
+	ev_timer_start(EV_A_ &c->timer);
+}
+
+static int listen_unix(main_server_st *s, const char *file)
+{
+	struct sockaddr_un sa;
+	int sd, ret, e;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strlcpy(sa.sun_path, file, sizeof(sa.sun_path));
+	remove(file);
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not create socket '%s': %s", file, strerror(e));
+		return -1;
+	}
+
+	ret = bind(sd, (struct sockaddr *)&sa, SUN_LEN(&sa));
+	if (ret == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not bind socket '%s': %s", file, strerror(e));
+		close(sd);
+		return -1;
+	}
+
+	ret = chown(file, GETPCONFIG(s)->uid, GETPCONFIG(s)->gid);
+	if (ret == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not chown socket '%s': %s", file, strerror(e));
+	}
+
+	return sd;
+}
+
+/* the metrics are only served on the loopback interface */
+static int listen_tcp(main_server_st *s, unsigned port)
+{
+	struct sockaddr_in sa;
+	int sd, ret, e, y = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sd == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not create metrics socket: %s", strerror(e));
+		return -1;
+	}
+
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (const void *)&y, sizeof(y));
+
+	ret = bind(sd, (struct sockaddr *)&sa, sizeof(sa));
+	if (ret == -1) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "could not bind metrics port %u: %s", port, strerror(e));
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+/* Creates the sockets the metrics are served on, and starts listening
+ * on them. */
+int metrics_init(main_server_st *s)
+{
+	struct metrics_st *m;
+	unsigned i;
+	int ret, e;
+
+	if (GETPCONFIG(s)->metrics_socket_file == NULL && GETPCONFIG(s)->metrics_port == 0)
+		return 0;
+
+	m = talloc_zero(s, struct metrics_st);
+	if (m == NULL)
+		return -1;
+
+	m->s = s;
+	htable_init(&m->labels, rehash_label, NULL);
+	list_head_init(&m->label_list);
+	list_head_init(&m->conns);
+	m->fd[LISTEN_UNIX] = m->fd[LISTEN_TCP] = -1;
+	s->metrics = m;
+
+	if (GETPCONFIG(s)->metrics_socket_file != NULL) {
+		mslog(s, NULL, LOG_DEBUG, "initializing metrics unix socket: %s", GETPCONFIG(s)->metrics_socket_file);
+		m->fd[LISTEN_UNIX] = listen_unix(s, GETPCONFIG(s)->metrics_socket_file);
+		if (m->fd[LISTEN_UNIX] == -1)
+			goto fail;
+	}
+
+	if (GETPCONFIG(s)->metrics_port != 0) {
+		mslog(s, NULL, LOG_DEBUG, "initializing metrics on port %u", GETPCONFIG(s)->metrics_port);
+		m->fd[LISTEN_TCP] = listen_tcp(s, GETPCONFIG(s)->metrics_port);
+		if (m->fd[LISTEN_TCP] == -1)
+			goto fail;
+	}
+
+	for (i = 0; i < LISTEN_MAX; i++) {
+		if (m->fd[i] == -1)
+			continue;
+
+		ret = listen(m->fd[i], 16);
+		if (ret == -1) {
+			e = errno;
+			mslog(s, NULL, LOG_ERR, "could not listen to metrics socket: %s", strerror(e));
+			goto fail;
+		}
+
+		set_cloexec_flag(m->fd[i], 1);
+		set_non_block(m->fd[i]);
+
+		ev_io_init(&m->io[i], accept_cb, m->fd[i], EV_READ);
+		m->io[i].data = m;
+		ev_io_start(loop, &m->io[i]);
+	}
+
+	return 0;
+ fail:
+	metrics_deinit(s);
+	return -1;
+}
+
+/* Closes the sockets and the connections. Used on exit and in the
+ * forked children. */
+void metrics_deinit(main_server_st *s)
+{
+	struct metrics_st *m = s->metrics;
+	metrics_conn_st *c = NULL, *cpos;
+	unsigned i;
+
+	if (m == NULL)
+		return;
+
+	list_for_each_safe(&m->conns, c, cpos, list) {
+		close_conn(c);
+	}
+
+	for (i = 0; i < LISTEN_MAX; i++) {
+		if (m->fd[i] == -1)
+			continue;
+		ev_io_stop(loop, &m->io[i]);
+		close(m->fd[i]);
+	}
+
+	htable_clear(&m->labels);
+	talloc_free(m);
+	s->metrics = NULL;
+}
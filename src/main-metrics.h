@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MAIN_METRICS_H
+# define MAIN_METRICS_H
+
+# include "main.h"
+
+/* The sessions of a virtual host and group. The entries are never removed,
+ * as they hold counters. */
+typedef struct metrics_label_st {
+	struct list_node list;
+
+	char vhost[MAX_HOSTNAME_SIZE];
+	char group[MAX_GROUPNAME_SIZE];
+
+	uint64_t sessions; /* the open ones */
+	uint64_t sessions_opened;
+	uint64_t bytes_in; /* of the closed sessions */
+	uint64_t bytes_out;
+} metrics_label_st;
+
+int metrics_init(main_server_st *s);
+void metrics_deinit(main_server_st *s);
+void metrics_session_open(main_server_st *s, struct proc_st *proc);
+void metrics_session_close(main_server_st *s, struct proc_st *proc);
+
+#endif
@@ -44,6 +44,7 @@
 #include <sec-mod.h>
 #include <route-add.h>
 #include <ip-lease.h>
+#include <icmp-ping.h>
 #include <proc-search.h>
 #include <ipc.pb-c.h>
 #include <script-list.h>
@@ -58,6 +59,8 @@
 #include <tun.h>
 #include <main.h>
 #include <main-ban.h>
+#include <main-admission.h>
+#include <main-metrics.h>
 #include <ccan/list/list.h>
 
 struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
@@ -83,6 +86,12 @@ struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
 	memcpy(&ctmp->our_addr, our_addr, our_addr_len);
 	ctmp->our_addr_len = our_addr_len;
 
+	ctmp->counters_slot = -1;
+	ctmp->seq = ++s->proc_list.last_seq;
+	if (proc_table_add_seq(s, ctmp) < 0) {
+		talloc_free(ctmp);
+		return NULL;
+	}
 	list_add(&s->proc_list.head, &(ctmp->list));
 
 	/* initially we put into the "default" vhost cgroup. We
@@ -94,17 +103,63 @@ struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
 	return ctmp;
 }
 
+/* A slot of the counters waiting for its worker to exit */
+struct counters_release_st {
+	ev_child ev_child;
+	int slot;
+};
+
+static void counters_release_cb(struct ev_loop *loop, ev_child *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+	struct counters_release_st *r = container_of(w, struct counters_release_st, ev_child);
+
+	ev_child_stop(loop, w);
+	session_counters_free(&s->counters, r->slot);
+	talloc_free(r);
+}
+
+/* The worker writes to its slot of the counters until it exits, so
+ * unless it is reaped the slot is freed once it is. */
+static void release_counters(main_server_st *s, struct proc_st *proc, unsigned reaped)
+{
+	struct counters_release_st *r;
+
+	if (proc->counters_slot < 0)
+		return;
+
+	if (!reaped && proc->pid > 0) {
+		r = talloc_zero(s, struct counters_release_st);
+		if (r != NULL) {
+			r->slot = proc->counters_slot;
+			ev_child_init(&r->ev_child, counters_release_cb, proc->pid, 0);
+			ev_child_start(loop, &r->ev_child);
+			proc->counters_slot = -1;
+			return;
+		}
+	}
+
+	session_counters_free(&s->counters, proc->counters_slot);
+	proc->counters_slot = -1;
+}
+
 /* k: whether to kill the process
  */
 void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 {
 	pid_t pid;
+	unsigned reaped;
+
+	/* the watcher is stopped once the worker is reaped */
+	reaped = !ev_is_active(&proc->ev_child) || proc->ev_child.rpid != 0;
 
 	ev_io_stop(EV_A_ &proc->io);
 	ev_child_stop(EV_A_ &proc->ev_child);
 
 	list_del(&proc->list);
 	s->stats.active_clients--;
+	admission_release(s, proc);
+	icmp_probe_cancel(s, proc);
 
 	if ((flags&RPROC_KILL) && proc->pid != -1 && proc->pid != 0)
 		kill(proc->pid, SIGTERM);
@@ -116,12 +171,13 @@ void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 			exit(1);
 		}
 	}
+	metrics_session_close(s, proc);
 
 	mslog(s, proc, LOG_INFO, "user disconnected (reason: %s, rx: %"PRIu64", tx: %"PRIu64")",
 		discon_reason_to_str(proc->discon_reason), proc->bytes_in, proc->bytes_out);
 
 	pid = remove_from_script_list(s, proc);
-	if (proc->status == PS_AUTH_COMPLETED || pid > 0) {
+	if (proc->status == PS_AUTH_COMPLETED || pid >= 0) {
 		if (pid > 0) {
 			int wstatus;
 			/* we were called during the connect script being run.
@@ -133,6 +189,10 @@ void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 			 }
 		} else { /* pid > 0 or status == PS_AUTH_COMPLETED are mutually exclusive
 		          * since PS_AUTH_COMPLETED is set only after a successful script run.
+		          * When pid is zero the connect script is still queued in the
+		          * hook runner; that runs the scripts of a session in order so
+		          * the disconnect script is executed after it, and only if it
+		          * succeeded.
 		          */
 			user_disconnected(s, proc);
 		}
@@ -155,7 +215,36 @@ void remove_proc(main_server_st * s, struct proc_st *proc, unsigned flags)
 		(*proc->config_usage_count)--;
 	}
 
+	release_counters(s, proc, reaped);
+
 	safe_memset(proc->sid, 0, sizeof(proc->sid));
 	talloc_free(proc);
 }
 
+/* Reads the traffic of the session from the counters of its worker; the
+ * rates are only known from them. */
+void proc_get_traffic(main_server_st *s, struct proc_st *proc,
+		      uint64_t *bytes_in, uint64_t *bytes_out,
+		      uint64_t *rx_per_sec, uint64_t *tx_per_sec)
+{
+	session_counters_st *sc = session_counters_get(&s->counters, proc->counters_slot);
+	uint64_t v;
+
+	*bytes_in = proc->bytes_in;
+	*bytes_out = proc->bytes_out;
+	*rx_per_sec = *tx_per_sec = 0;
+
+	if (sc == NULL)
+		return;
+
+	/* once the session is closed the stats of sec-mod are as recent */
+	v = COUNTER_LOAD(&sc->c.bytes_in);
+	if (v > *bytes_in)
+		*bytes_in = v;
+	v = COUNTER_LOAD(&sc->c.bytes_out);
+	if (v > *bytes_out)
+		*bytes_out = v;
+	*rx_per_sec = COUNTER_LOAD(&sc->c.rx_per_sec);
+	*tx_per_sec = COUNTER_LOAD(&sc->c.tx_per_sec);
+}
+
@@ -44,6 +44,7 @@
 #include <route-add.h>
 #include <ipc.pb-c.h>
 #include <script-list.h>
+#include <proc-search.h>
 #include <cloexec.h>
 
 #include <vpn.h>
@@ -66,6 +67,26 @@ static void update_auth_failures(main_server_st * s, uint64_t auth_failures)
 	s->stats.total_auth_failures += auth_failures;
 }
 
+static void update_auth_backend_stats(main_server_st *s, const SecmStatsMsg *smsg)
+{
+	struct auth_backend_stats_st *st;
+	unsigned i;
+
+	s->stats.auth_backends_size = 0;
+	for (i = 0; i < smsg->n_auth_backends && i < MAX_AUTH_BACKEND_STATS; i++) {
+		st = &s->stats.auth_backends[i];
+
+		strlcpy(st->name, smsg->auth_backends[i]->name, sizeof(st->name));
+		st->max_running = smsg->auth_backends[i]->max_running;
+		st->running = smsg->auth_backends[i]->running;
+		st->queued = smsg->auth_backends[i]->queued;
+		st->max_queued = smsg->auth_backends[i]->max_queued;
+		st->max_wait_ms = smsg->auth_backends[i]->max_wait_ms;
+		st->completed = smsg->auth_backends[i]->completed;
+		s->stats.auth_backends_size++;
+	}
+}
+
 int handle_sec_mod_commands(main_server_st * s)
 {
 	struct iovec iov[3];
@@ -189,6 +210,12 @@ int handle_sec_mod_commands(main_server_st * s)
 			s->stats.max_auth_time = smsg->secmod_max_auth_time;
 			s->stats.avg_auth_time = smsg->secmod_avg_auth_time;
 			update_auth_failures(s, smsg->secmod_auth_failures);
+			update_auth_backend_stats(s, smsg);
+
+			s->stats.acct_spool = smsg->has_acct_spool_records;
+			s->stats.acct_spool_records = smsg->acct_spool_records;
+			s->stats.acct_spool_bytes = smsg->acct_spool_bytes;
+			s->stats.acct_spool_lag = smsg->acct_spool_lag;
 
 		}
 
@@ -448,7 +475,8 @@ int session_open(main_server_st *s, struct proc_st *proc, const uint8_t *cookie,
 	char str_ipv6[MAX_IP_STR];
 	char str_ip[MAX_IP_STR];
 
-	if (cookie == NULL || cookie_size != SID_SIZE)
+	/* the sid, or a sealed cookie which only sec-mod can open */
+	if (cookie == NULL || cookie_size < SID_SIZE || cookie_size > MAX_COOKIE_SIZE)
 		return -1;
 
 	ireq.sid.data = (void*)cookie;
@@ -497,6 +525,17 @@ int session_open(main_server_st *s, struct proc_st *proc, const uint8_t *cookie,
 	}
 	strlcpy(proc->username, msg->username, sizeof(proc->username));
 
+	if (proc_table_update_user(s, proc) < 0) {
+		mslog(s, proc, LOG_ERR, "failed to add the session to those of its user");
+		return -1;
+	}
+
+	if (msg->sid.len != sizeof(proc->sid)) {
+		mslog(s, proc, LOG_INFO, "received invalid sid in session reply");
+		return -1;
+	}
+	memcpy(proc->sid, msg->sid.data, sizeof(proc->sid));
+
 	/* override the group name in order to load the correct configuration in
 	 * case his group is specified in the certificate */
 	if (msg->groupname)
@@ -562,6 +601,7 @@ static void reset_stats(main_server_st *s, time_t now)
 	s->stats.kbytes_out = 0;
 	s->stats.max_session_mins = 0;
 	s->stats.max_auth_time = 0;
+	s->stats.max_lease_usecs = 0;
 }
 
 static void update_main_stats(main_server_st * s, struct proc_st *proc)
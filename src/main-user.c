@@ -45,6 +45,10 @@
 #include <main-ctl.h>
 #include <ip-lease.h>
 #include <script-list.h>
+#include <hook-runner.h>
+#include <cloexec.h>
+#include <system.h>
+#include "setproctitle.h"
 #include <ccan/list/list.h>
 
 #define OCSERV_FW_SCRIPT "/usr/bin/ocserv-fw"
@@ -53,7 +57,13 @@
 			ret = str_append_str(str, val); \
 			if (ret < 0) { \
 				mslog(s, proc, LOG_ERR, "could not append value to environment\n"); \
-				exit(1); \
+				goto fail; \
+			}
+
+#define EXPORT_ENV(env, name, val, what) \
+			if (env_add(env, name, val) < 0) { \
+				mslog(s, proc, LOG_ERR, "could not export %s\n", what); \
+				goto fail; \
 			}
 
 typedef enum script_type_t {
@@ -63,8 +73,33 @@ typedef enum script_type_t {
 } script_type_t;
 
 static const char *type_name[] = {"up", "host-update", "down"};
+static const char *reason_name[] = {"connect", "host-update", "disconnect"};
+
+/* The environment passed to the scripts, as NAME=value strings */
+typedef struct script_env_st {
+	void *pool;
+	char **vars;
+	unsigned size;
+} script_env_st;
 
-static void export_fw_info(main_server_st *s, struct proc_st* proc)
+static int env_add(script_env_st *env, const char *name, const char *val)
+{
+	char **vars;
+
+	vars = talloc_realloc(env->pool, env->vars, char *, env->size + 1);
+	if (vars == NULL)
+		return -1;
+	env->vars = vars;
+
+	env->vars[env->size] = talloc_asprintf(env->pool, "%s=%s", name, val);
+	if (env->vars[env->size] == NULL)
+		return -1;
+	env->size++;
+
+	return 0;
+}
+
+static int export_fw_info(main_server_st *s, struct proc_st* proc, script_env_st *env)
 {
 	str_st str4;
 	str_st str6;
@@ -93,20 +128,14 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_ROUTES4", (char*)str4.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(1);
-	}
+	if (str4.length > 0)
+		EXPORT_ENV(env, "OCSERV_ROUTES4", (char*)str4.data, "routes");
 
-	if (str6.length > 0 && setenv("OCSERV_ROUTES6", (char*)str6.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(1);
-	}
+	if (str6.length > 0)
+		EXPORT_ENV(env, "OCSERV_ROUTES6", (char*)str6.data, "routes");
 
-	if (str_common.length > 0 && setenv("OCSERV_ROUTES", (char*)str_common.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export routes\n");
-		exit(1);
-	}
+	if (str_common.length > 0)
+		EXPORT_ENV(env, "OCSERV_ROUTES", (char*)str_common.data, "routes");
 
 	/* export the No-routes */
 
@@ -128,26 +157,17 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_NO_ROUTES4", (char*)str4.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(1);
-	}
+	if (str4.length > 0)
+		EXPORT_ENV(env, "OCSERV_NO_ROUTES4", (char*)str4.data, "no-routes");
 
-	if (str6.length > 0 && setenv("OCSERV_NO_ROUTES6", (char*)str6.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(1);
-	}
+	if (str6.length > 0)
+		EXPORT_ENV(env, "OCSERV_NO_ROUTES6", (char*)str6.data, "no-routes");
 
-	if (str_common.length > 0 && setenv("OCSERV_NO_ROUTES", (char*)str_common.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export no-routes\n");
-		exit(1);
-	}
+	if (str_common.length > 0)
+		EXPORT_ENV(env, "OCSERV_NO_ROUTES", (char*)str_common.data, "no-routes");
 
 	if (proc->config->restrict_user_to_routes) {
-		if (setenv("OCSERV_RESTRICT_TO_ROUTES", "1", 1) == -1) {
-			mslog(s, proc, LOG_ERR, "could not export OCSERV_RESTRICT_TO_ROUTES\n");
-			exit(1);
-		}
+		EXPORT_ENV(env, "OCSERV_RESTRICT_TO_ROUTES", "1", "OCSERV_RESTRICT_TO_ROUTES");
 	}
 	/* export the DNS servers */
 
@@ -170,24 +190,14 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 		}
 	}
 
-	if (str4.length > 0 && setenv("OCSERV_DNS4", (char*)str4.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(1);
-	}
+	if (str4.length > 0)
+		EXPORT_ENV(env, "OCSERV_DNS4", (char*)str4.data, "DNS servers");
 
-	if (str6.length > 0 && setenv("OCSERV_DNS6", (char*)str6.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(1);
-	}
+	if (str6.length > 0)
+		EXPORT_ENV(env, "OCSERV_DNS6", (char*)str6.data, "DNS servers");
 
-	if (str_common.length > 0 && setenv("OCSERV_DNS", (char*)str_common.data, 1) == -1) {
-		mslog(s, proc, LOG_ERR, "could not export DNS servers\n");
-		exit(1);
-	}
-
-	str_clear(&str4);
-	str_clear(&str6);
-	str_clear(&str_common);
+	if (str_common.length > 0)
+		EXPORT_ENV(env, "OCSERV_DNS", (char*)str_common.data, "DNS servers");
 
 	/* export the ports to reject */
 
@@ -223,26 +233,278 @@ static void export_fw_info(main_server_st *s, struct proc_st* proc)
 
 			if (ret < 0) {
 				mslog(s, proc, LOG_ERR, "could not append value to environment\n");
-				exit(1);
+				goto fail;
 			}
 		}
 	}
 
 	if (str_common.length > 0) {
 		if (negate) {
-			if (setenv("OCSERV_DENY_PORTS", (char*)str_common.data, 1) == -1) {
-				mslog(s, proc, LOG_ERR, "could not export DENY_PORTS\n");
-				exit(1);
-			}
+			EXPORT_ENV(env, "OCSERV_DENY_PORTS", (char*)str_common.data, "DENY_PORTS");
 		} else {
-			if (setenv("OCSERV_ALLOW_PORTS", (char*)str_common.data, 1) == -1) {
-				mslog(s, proc, LOG_ERR, "could not export ALLOW_PORTS\n");
-				exit(1);
-			}
+			EXPORT_ENV(env, "OCSERV_ALLOW_PORTS", (char*)str_common.data, "ALLOW_PORTS");
 		}
 	}
 
+	ret = 0;
+	goto cleanup;
+ fail:
+	ret = -1;
+ cleanup:
+	str_clear(&str4);
+	str_clear(&str6);
 	str_clear(&str_common);
+	return ret;
+}
+
+/* Builds the environment of the script for the event */
+static int export_script_env(main_server_st *s, struct proc_st* proc, script_type_t type,
+			     const char *next_script, script_env_st *env)
+{
+	char real[64] = "";
+	char local[64] = "";
+	char remote[64] = "";
+	int ret;
+
+	snprintf(real, sizeof(real), "%u", (unsigned)proc->pid);
+	EXPORT_ENV(env, "ID", real, "ID");
+
+	if (proc->remote_addr_len > 0) {
+		if ((ret=getnameinfo((void*)&proc->remote_addr, proc->remote_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
+			mslog(s, proc, LOG_DEBUG, "cannot determine peer address: %s; script failed", gai_strerror(ret));
+			goto fail;
+		}
+		EXPORT_ENV(env, "IP_REAL", real, "IP_REAL");
+	}
+
+	if (proc->our_addr_len > 0) {
+		if ((ret=getnameinfo((void*)&proc->our_addr, proc->our_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
+			mslog(s, proc, LOG_DEBUG, "cannot determine our address: %s", gai_strerror(ret));
+		} else {
+			EXPORT_ENV(env, "IP_REAL_LOCAL", real, "IP_REAL_LOCAL");
+		}
+	}
+
+	if (proc->ipv4 != NULL || proc->ipv6 != NULL) {
+		if (proc->ipv4 && proc->ipv4->lip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv4->lip, proc->ipv4->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
+				goto fail;
+			}
+			EXPORT_ENV(env, "IP_LOCAL", local, "IP_LOCAL");
+		}
+
+		if (proc->ipv6 && proc->ipv6->lip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv6->lip, proc->ipv6->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
+				goto fail;
+			}
+			if (local[0] == 0)
+				EXPORT_ENV(env, "IP_LOCAL", local, "IP_LOCAL");
+			EXPORT_ENV(env, "IPV6_LOCAL", local, "IPV6_LOCAL");
+		}
+
+		if (proc->ipv4 && proc->ipv4->rip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv4->rip, proc->ipv4->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
+				goto fail;
+			}
+			EXPORT_ENV(env, "IP_REMOTE", remote, "IP_REMOTE");
+		}
+		if (proc->ipv6 && proc->ipv6->rip_len > 0) {
+			if (getnameinfo((void*)&proc->ipv6->rip, proc->ipv6->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
+				mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
+				goto fail;
+			}
+			if (remote[0] == 0)
+				EXPORT_ENV(env, "IP_REMOTE", remote, "IP_REMOTE");
+			EXPORT_ENV(env, "IPV6_REMOTE", remote, "IPV6_REMOTE");
+
+			snprintf(remote, sizeof(remote), "%u", proc->ipv6->prefix);
+			EXPORT_ENV(env, "IPV6_PREFIX", remote, "IPV6_PREFIX");
+		}
+	}
+
+	if (proc->vhost)
+		EXPORT_ENV(env, "VHOST", VHOSTNAME(proc->vhost), "VHOST");
+	EXPORT_ENV(env, "USERNAME", proc->username, "USERNAME");
+	EXPORT_ENV(env, "GROUPNAME", proc->groupname, "GROUPNAME");
+	EXPORT_ENV(env, "HOSTNAME", proc->hostname, "HOSTNAME");
+	EXPORT_ENV(env, "DEVICE", proc->tun_lease.name, "DEVICE");
+	EXPORT_ENV(env, "REASON", reason_name[type], "REASON");
+	if (type == SCRIPT_DISCONNECT) {
+		/* use remote as temp buffer */
+		snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_in);
+		EXPORT_ENV(env, "STATS_BYTES_IN", remote, "STATS_BYTES_IN");
+		snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_out);
+		EXPORT_ENV(env, "STATS_BYTES_OUT", remote, "STATS_BYTES_OUT");
+		if (proc->conn_time > 0) {
+			snprintf(remote, sizeof(remote), "%lu", (unsigned long)(time(0)-proc->conn_time));
+			EXPORT_ENV(env, "STATS_DURATION", remote, "STATS_DURATION");
+		}
+	}
+
+	/* export DNS and route info */
+	ret = export_fw_info(s, proc, env);
+	if (ret < 0)
+		goto fail;
+
+	if (next_script)
+		EXPORT_ENV(env, "OCSERV_NEXT_SCRIPT", next_script, "OCSERV_NEXT_SCRIPT");
+
+	return 0;
+ fail:
+	return -1;
+}
+
+/* Passes the event to the hook runner process. For the connect
+ * script the exit status is received by handle_hook_runner_commands().
+ */
+static
+int send_to_hook_runner(main_server_st *s, struct proc_st* proc, script_type_t type,
+			const char *script, script_env_st *env)
+{
+	HookRunMsg msg = HOOK_RUN_MSG__INIT;
+	int ret;
+
+	if (type == SCRIPT_CONNECT && script != NULL) {
+		if (++s->hook_id == 0)
+			++s->hook_id;
+		msg.id = s->hook_id;
+	}
+
+	msg.script = (char*)script;
+	msg.reason = (char*)reason_name[type];
+	msg.session = proc->pid;
+	msg.env = env->vars;
+	msg.n_env = env->size;
+
+	if (script)
+		mslog(s, proc, LOG_DEBUG, "queueing script %s %s", type_name[type], script);
+
+	ret = send_msg(proc, s->hook_fd, CMD_HOOK_RUN, &msg,
+		       (pack_size_func) hook_run_msg__get_packed_size,
+		       (pack_func) hook_run_msg__pack);
+	if (ret < 0) {
+		mslog(s, proc, LOG_ERR, "could not send script to hook runner");
+		return -1;
+	}
+
+	if (msg.id != 0) {
+		add_to_script_list(s, 0, msg.id, proc);
+		return ERR_WAIT_FOR_SCRIPT;
+	}
+	return 0;
+}
+
+int run_hook_runner(main_server_st *s)
+{
+	int fd[2], ret, e;
+	pid_t pid;
+
+	if (!GETPCONFIG(s)->hook_runner)
+		return -1;
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fd);
+	if (ret < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "error creating hook runner socket: %s", strerror(e));
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {		/* child */
+		unsigned max_running = GETPCONFIG(s)->max_concurrent_hooks;
+		const char *event_socket = GETPCONFIG(s)->event_socket_file;
+
+		close(s->sec_mod_fd);
+		close(s->sec_mod_fd_sync);
+		clear_lists(s);
+		kill_on_parent_kill(SIGTERM);
+
+		setproctitle(PACKAGE_NAME "-hooks");
+		close(fd[1]);
+		set_cloexec_flag (fd[0], 1);
+		hook_runner_server(fd[0], max_running, event_socket);
+		exit(0);
+	} else if (pid > 0) {	/* parent */
+		close(fd[0]);
+		s->hook_pid = pid;
+		set_cloexec_flag (fd[1], 1);
+		return fd[1];
+	} else {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "error in fork(): %s", strerror(e));
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+}
+
+/* Fails the connect scripts which were queued in a hook runner which
+ * is no longer present. */
+static void fail_queued_scripts(main_server_st *s)
+{
+	struct script_wait_st *stmp, *spos;
+
+	list_for_each_safe(&s->script_list.head, stmp, spos, list) {
+		if (stmp->pid != 0)
+			continue;
+
+		list_del(&stmp->list);
+		if (handle_script_exit(s, stmp->proc, 1) < 0) {
+			/* takes care of free */
+			remove_proc(s, stmp->proc, RPROC_KILL);
+		} else {
+			talloc_free(stmp);
+		}
+	}
+}
+
+int handle_hook_runner_commands(main_server_st *s)
+{
+	struct script_wait_st *stmp, *spos;
+	HookResultMsg *msg = NULL;
+	void *pool;
+	int ret;
+
+	pool = talloc_new(s);
+	if (pool == NULL)
+		return ERR_MEM;
+
+	ret = recv_msg(pool, s->hook_fd, CMD_HOOK_RESULT,
+		       (void *)&msg,
+		       (unpack_func) hook_result_msg__unpack,
+		       MAIN_SEC_MOD_TIMEOUT);
+	if (ret < 0) {
+		mslog(s, NULL, LOG_ERR, "error receiving message from hook runner; scripts will be run by main");
+		ev_io_stop(loop, &hook_watcher);
+		close(s->hook_fd);
+		s->hook_fd = -1;
+		fail_queued_scripts(s);
+		talloc_free(pool);
+		return ret;
+	}
+
+	list_for_each_safe(&s->script_list.head, stmp, spos, list) {
+		if (stmp->pid != 0 || stmp->id != msg->id)
+			continue;
+
+		mslog(s, stmp->proc, LOG_DEBUG, "connect-script exit status: %u", msg->status);
+		list_del(&stmp->list);
+
+		ret = handle_script_exit(s, stmp->proc, msg->status);
+		if (ret < 0) {
+			/* takes care of free */
+			remove_proc(s, stmp->proc, RPROC_KILL);
+		} else {
+			talloc_free(stmp);
+		}
+		break;
+	}
+
+	talloc_free(pool);
+	return 0;
 }
 
 static
@@ -250,7 +512,9 @@ int call_script(main_server_st *s, struct proc_st* proc, script_type_t type)
 {
 pid_t pid;
 int ret;
+unsigned i;
 const char* script, *next_script = NULL;
+script_env_st env;
 
 	if (type == SCRIPT_CONNECT)
 		script = GETCONFIG(s)->connect_script;
@@ -266,101 +530,32 @@ const char* script, *next_script = NULL;
 		}
 	}
 
-	if (script == NULL)
+	/* when there are event subscribers, all events go to the hook runner */
+	if (script == NULL && (s->hook_fd == -1 || !GETPCONFIG(s)->event_socket_file))
 		return 0;
 
-	pid = fork();
-	if (pid == 0) {
-		char real[64] = "";
-		char local[64] = "";
-		char remote[64] = "";
-
-		sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
-
-		snprintf(real, sizeof(real), "%u", (unsigned)proc->pid);
-		setenv("ID", real, 1);
-
-		if (proc->remote_addr_len > 0) {
-			if ((ret=getnameinfo((void*)&proc->remote_addr, proc->remote_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
-				mslog(s, proc, LOG_DEBUG, "cannot determine peer address: %s; script failed", gai_strerror(ret));
-				exit(1);
-			}
-			setenv("IP_REAL", real, 1);
-		}
-
-		if (proc->our_addr_len > 0) {
-			if ((ret=getnameinfo((void*)&proc->our_addr, proc->our_addr_len, real, sizeof(real), NULL, 0, NI_NUMERICHOST)) != 0) {
-				mslog(s, proc, LOG_DEBUG, "cannot determine our address: %s", gai_strerror(ret));
-			} else {
-				setenv("IP_REAL_LOCAL", real, 1);
-			}
-		}
-
-		if (proc->ipv4 != NULL || proc->ipv6 != NULL) {
-			if (proc->ipv4 && proc->ipv4->lip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv4->lip, proc->ipv4->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
-					exit(1);
-				}
-				setenv("IP_LOCAL", local, 1);
-			}
+	memset(&env, 0, sizeof(env));
+	env.pool = talloc_new(proc);
+	if (env.pool == NULL)
+		return -1;
 
-			if (proc->ipv6 && proc->ipv6->lip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv6->lip, proc->ipv6->lip_len, local, sizeof(local), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
-					exit(1);
-				}
-				if (local[0] == 0)
-					setenv("IP_LOCAL", local, 1);
-				setenv("IPV6_LOCAL", local, 1);
-			}
+	ret = export_script_env(s, proc, type, next_script, &env);
+	if (ret < 0) {
+		ret = -1;
+		goto cleanup;
+	}
 
-			if (proc->ipv4 && proc->ipv4->rip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv4->rip, proc->ipv4->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN address; script failed");
-					exit(1);
-				}
-				setenv("IP_REMOTE", remote, 1);
-			}
-			if (proc->ipv6 && proc->ipv6->rip_len > 0) {
-				if (getnameinfo((void*)&proc->ipv6->rip, proc->ipv6->rip_len, remote, sizeof(remote), NULL, 0, NI_NUMERICHOST) != 0) {
-					mslog(s, proc, LOG_DEBUG, "cannot determine local VPN PtP address; script failed");
-					exit(1);
-				}
-				if (remote[0] == 0)
-					setenv("IP_REMOTE", remote, 1);
-				setenv("IPV6_REMOTE", remote, 1);
-
-				snprintf(remote, sizeof(remote), "%u", proc->ipv6->prefix);
-				setenv("IPV6_PREFIX", remote, 1);
-			}
-		}
+	if (s->hook_fd != -1) {
+		ret = send_to_hook_runner(s, proc, type, script, &env);
+		goto cleanup;
+	}
 
-		if (proc->vhost)
-			setenv("VHOST", VHOSTNAME(proc->vhost), 1);
-		setenv("USERNAME", proc->username, 1);
-		setenv("GROUPNAME", proc->groupname, 1);
-		setenv("HOSTNAME", proc->hostname, 1);
-		setenv("DEVICE", proc->tun_lease.name, 1);
-		if (type == SCRIPT_CONNECT) {
-			setenv("REASON", "connect", 1);
-		} else if (type == SCRIPT_HOST_UPDATE) {
-			setenv("REASON", "host-update", 1);
-		} else if (type == SCRIPT_DISCONNECT) {
-			/* use remote as temp buffer */
-			snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_in);
-			setenv("STATS_BYTES_IN", remote, 1);
-			snprintf(remote, sizeof(remote), "%lu", (unsigned long)proc->bytes_out);
-			setenv("STATS_BYTES_OUT", remote, 1);
-			if (proc->conn_time > 0) {
-				snprintf(remote, sizeof(remote), "%lu", (unsigned long)(time(0)-proc->conn_time));
-				setenv("STATS_DURATION", remote, 1);
-			}
-			setenv("REASON", "disconnect", 1);
-		}
+	pid = fork();
+	if (pid == 0) {
+		sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
 
-		/* export DNS and route info */
-		export_fw_info(s, proc);
+		for (i=0;i<env.size;i++)
+			putenv(env.vars[i]);
 
 		/* set stdout to be stderr to avoid confusing scripts - note we have stdout closed */
 		if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
@@ -369,7 +564,6 @@ const char* script, *next_script = NULL;
 		}
 
 		if (next_script) {
-			setenv("OCSERV_NEXT_SCRIPT", next_script, 1);
 			mslog(s, proc, LOG_DEBUG, "executing script %s %s (next: %s)", type_name[type], script, next_script);
 		} else
 			mslog(s, proc, LOG_DEBUG, "executing script %s %s", type_name[type], script);
@@ -383,18 +577,23 @@ const char* script, *next_script = NULL;
 		exit(77);
 	} else if (pid == -1) {
 		mslog(s, proc, LOG_ERR, "Could not fork()");
-		return -1;
+		ret = -1;
+		goto cleanup;
 	}
 	
 	if (type == SCRIPT_CONNECT) {
-		add_to_script_list(s, pid, proc);
-		return ERR_WAIT_FOR_SCRIPT;
+		add_to_script_list(s, pid, 0, proc);
+		ret = ERR_WAIT_FOR_SCRIPT;
 	} else {
 		/* we don't add a specific handler for SCRIPT_CONNECT and SCRIPT_HOST_UPDATE
 		 * childs. We rely on libev's child reaping of unwatched children.
 		 */
-		return 0;
+		ret = 0;
 	}
+
+ cleanup:
+	talloc_free(env.pool);
+	return ret;
 }
 
 static void
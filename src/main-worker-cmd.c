@@ -44,10 +44,12 @@
 #include <sec-mod.h>
 #include <route-add.h>
 #include <ip-lease.h>
+#include <icmp-ping.h>
 #include <proc-search.h>
 #include <ipc.pb-c.h>
 #include <script-list.h>
 #include <inttypes.h>
+#include <gettime.h>
 #include <ev.h>
 
 #ifdef HAVE_MALLOC_TRIM
@@ -58,8 +60,38 @@
 #include <tun.h>
 #include <main.h>
 #include <main-ban.h>
+#include <main-admission.h>
 #include <ccan/list/list.h>
 
+static const char *setup_phase_names[SETUP_PHASES] = {
+	[SETUP_QUEUE] = "queue",
+	[SETUP_FORK] = "fork",
+	[SETUP_TLS_HANDSHAKE] = "tls-handshake",
+	[SETUP_AUTH_QUEUE] = "auth-queue",
+	[SETUP_AUTH] = "auth",
+	[SETUP_COOKIE] = "cookie",
+	[SETUP_SESSION_OPEN] = "session-open",
+	[SETUP_TUN] = "tun",
+	[SETUP_CONNECT_SCRIPT] = "connect-script",
+	[SETUP_CSTP_CONNECT] = "cstp-connect",
+	[SETUP_DTLS] = "dtls",
+};
+
+const char *setup_phase_to_str(unsigned phase)
+{
+	if (phase >= SETUP_PHASES)
+		return "unknown";
+	return setup_phase_names[phase];
+}
+
+void record_setup_time(main_server_st *s, unsigned phase, uint64_t usecs)
+{
+	if (phase >= SETUP_PHASES)
+		return;
+
+	latency_hist_add(&s->stats.setup_latency[phase], usecs);
+}
+
 int set_tun_mtu(main_server_st * s, struct proc_st *proc, unsigned mtu)
 {
 	int fd, ret, e;
@@ -98,8 +130,15 @@ int set_tun_mtu(main_server_st * s, struct proc_st *proc, unsigned mtu)
 
 int handle_script_exit(main_server_st *s, struct proc_st *proc, int code)
 {
+	struct timespec start, now;
 	int ret;
 
+	if (proc->script_start.tv_sec != 0) {
+		gettime_mono(&now);
+		record_setup_time(s, SETUP_CONNECT_SCRIPT, timespec_sub_us(&now, &proc->script_start));
+		proc->script_start.tv_sec = 0;
+	}
+
 	if (code == 0) {
 		ret = send_cookie_auth_reply(s, proc, AUTH__REP__OK);
 		if (ret < 0) {
@@ -109,6 +148,7 @@ int handle_script_exit(main_server_st *s, struct proc_st *proc, int code)
 			goto fail;
 		}
 
+		gettime_mono(&start);
 		ret = apply_iroutes(s, proc);
 		if (ret < 0) {
 			mslog(s, proc, LOG_ERR,
@@ -116,6 +156,8 @@ int handle_script_exit(main_server_st *s, struct proc_st *proc, int code)
 			ret = ERR_BAD_COMMAND;
 			goto fail;
 		}
+		gettime_mono(&now);
+		record_setup_time(s, SETUP_TUN, proc->tun_usecs + timespec_sub_us(&now, &start));
 
 		proc->status = PS_AUTH_COMPLETED;
 		mslog(s, proc, LOG_INFO, "user logged in");
@@ -146,7 +188,10 @@ int handle_script_exit(main_server_st *s, struct proc_st *proc, int code)
 	return ret;
 }
 
-/* This is the function after which proc is populated */
+/* This is the function after which proc is populated. The IP leases
+ * are obtained here and, if ping-leases is set, probed before the
+ * session setup continues in connect_user().
+ */
 static int accept_user(main_server_st * s, struct proc_st *proc, unsigned cmd)
 {
 	int ret;
@@ -161,11 +206,6 @@ static int accept_user(main_server_st * s, struct proc_st *proc, unsigned cmd)
 		return ret;
 	}
 
-	ret = open_tun(s, proc);
-	if (ret < 0) {
-		return -1;
-	}
-
 	if (proc->groupname[0] == 0)
 		group = "[unknown]";
 	else
@@ -182,15 +222,107 @@ static int accept_user(main_server_st * s, struct proc_st *proc, unsigned cmd)
 		return ERR_BAD_COMMAND;
 	}
 
+	ret = get_ip_leases(s, proc);
+	if (ret < 0)
+		return ret;
+
+	return icmp_probe_leases(s, proc);
+}
+
+/* Continues the session setup once its device is set */
+static int tun_connected(main_server_st * s, struct proc_st *proc)
+{
+	struct timespec now;
+	int ret;
+
+	gettime_mono(&now);
+	proc->tun_usecs = timespec_sub_us(&now, &proc->tun_start);
+
 	/* do scripts and utmp */
 	ret = user_connected(s, proc);
 	if (ret < 0 && ret != ERR_WAIT_FOR_SCRIPT) {
 		mslog(s, proc, LOG_INFO, "user disconnected due to script");
 	}
 
+	if (ret == ERR_WAIT_FOR_SCRIPT)
+		gettime_mono(&proc->script_start);
+
+	return ret;
+}
+
+static int connect_user(main_server_st * s, struct proc_st *proc)
+{
+	int ret;
+
+	gettime_mono(&proc->tun_start);
+	ret = open_tun(s, proc);
+	if (ret == ERR_WAIT_FOR_NETLINK)
+		return ret;
+	if (ret < 0)
+		return -1;
+
+	return tun_connected(s, proc);
+}
+
+/* Notifies the worker unless we wait for the connect script, the
+ * lease probes or the device setup */
+static int finish_cookie_auth(main_server_st *s, struct proc_st *proc, int ret)
+{
+	if (ret == ERR_WAIT_FOR_SCRIPT || ret == ERR_WAIT_FOR_PROBE ||
+	    ret == ERR_WAIT_FOR_NETLINK) {
+		/* we will wait for script termination to send our reply.
+		 * The notification of peer will be done in handle_script_exit().
+		 */
+		ret = 0;
+	} else {
+		/* no script was called. Handle it as a successful script call. */
+		ret = handle_script_exit(s, proc, ret);
+		if (ret < 0)
+			proc->status = PS_AUTH_FAILED;
+	}
+
 	return ret;
 }
 
+/* Called once the probes started by accept_user() are complete.
+ *
+ * @result: zero if the leases are usable or a negative error code
+ */
+int handle_leases_probed(main_server_st *s, struct proc_st *proc, int result)
+{
+	int ret = result;
+
+	if (ret == 0)
+		ret = connect_user(s, proc);
+
+	if (ret < 0)
+		proc->status = PS_AUTH_FAILED;
+	else
+		proc->status = PS_AUTH_COMPLETED;
+
+	return finish_cookie_auth(s, proc, ret);
+}
+
+/* Called once the addresses of the device set by open_tun() are
+ * acknowledged.
+ *
+ * @result: zero if the device is set or a negative error code
+ */
+int handle_tun_set(main_server_st *s, struct proc_st *proc, int result)
+{
+	int ret = result;
+
+	if (ret == 0)
+		ret = tun_connected(s, proc);
+
+	if (ret < 0)
+		proc->status = PS_AUTH_FAILED;
+	else
+		proc->status = PS_AUTH_COMPLETED;
+
+	return finish_cookie_auth(s, proc, ret);
+}
+
 /* Performs the required steps based on the result from the 
  * authentication function (e.g. handle_auth_init).
  *
@@ -204,6 +336,8 @@ static int handle_cookie_auth_res(main_server_st *s, struct proc_st *proc,
 
 	if (result == 0) {
 		ret = accept_user(s, proc, cmd);
+		if (ret == 0)
+			ret = connect_user(s, proc);
 		if (ret < 0) {
 			proc->status = PS_AUTH_FAILED;
 			goto finished;
@@ -219,19 +353,7 @@ static int handle_cookie_auth_res(main_server_st *s, struct proc_st *proc,
 	}
 
  finished:
-	if (ret == ERR_WAIT_FOR_SCRIPT) {
-		/* we will wait for script termination to send our reply.
-		 * The notification of peer will be done in handle_script_exit().
-		 */
-		ret = 0;
-	} else {
-		/* no script was called. Handle it as a successful script call. */
-		ret = handle_script_exit(s, proc, ret);
-		if (ret < 0)
-			proc->status = PS_AUTH_FAILED;
-	}
-
-	return ret;
+	return finish_cookie_auth(s, proc, ret);
 }
 
 int handle_worker_commands(main_server_st * s, struct proc_st *proc)
@@ -396,6 +518,56 @@ int handle_worker_commands(main_server_st * s, struct proc_st *proc)
 			session_info_msg__free_unpacked(tmsg, &pa);
 		}
 
+		break;
+	case CMD_SETUP_TIME:{
+			SetupTimeMsg *tmsg;
+			unsigned i;
+
+			tmsg = setup_time_msg__unpack(&pa, raw_len, raw);
+			if (tmsg == NULL) {
+				mslog(s, proc, LOG_ERR, "error unpacking setup time data");
+				ret = ERR_BAD_COMMAND;
+				goto cleanup;
+			}
+
+			for (i = 0; i < tmsg->n_phase && i < tmsg->n_usecs; i++) {
+				if (SETUP_WORKER_PHASE(tmsg->phase[i]))
+					record_setup_time(s, tmsg->phase[i], tmsg->usecs[i]);
+			}
+
+			setup_time_msg__free_unpacked(tmsg, &pa);
+		}
+
+		break;
+	case CMD_SESSION_TELEMETRY:{
+			SessionTelemetryMsg *tmsg;
+			session_telemetry_st cur;
+
+			tmsg = session_telemetry_msg__unpack(&pa, raw_len, raw);
+			if (tmsg == NULL) {
+				mslog(s, proc, LOG_ERR, "error unpacking session telemetry");
+				ret = ERR_BAD_COMMAND;
+				goto cleanup;
+			}
+
+			telemetry_from_msg(&cur, tmsg);
+			session_telemetry_msg__free_unpacked(tmsg, &pa);
+
+			/* the samples since the last report are known by their
+			 * sum; each is counted as their mean */
+			if (cur.rtt_samples > proc->telemetry.rtt_samples &&
+			    cur.rtt_sum_usecs >= proc->telemetry.rtt_sum_usecs) {
+				uint64_t n = cur.rtt_samples - proc->telemetry.rtt_samples;
+
+				latency_hist_add_n(&s->stats.dpd_rtt,
+						   (cur.rtt_sum_usecs - proc->telemetry.rtt_sum_usecs) / n, n);
+			}
+
+			telemetry_add_change(&s->stats.telemetry, &proc->telemetry, &cur);
+			proc->telemetry = cur;
+			proc->has_telemetry = 1;
+		}
+
 		break;
 	case AUTH_COOKIE_REQ:
 		if (proc->status != PS_AUTH_INACTIVE) {
@@ -405,6 +577,10 @@ int handle_worker_commands(main_server_st * s, struct proc_st *proc)
 			goto cleanup;
 		}
 
+		/* the worker completed the handshake and any authentication;
+		 * its slot can be given to a queued connection */
+		admission_release(s, proc);
+
 		auth_cookie_req =
 		    auth_cookie_request_msg__unpack(&pa, raw_len, raw);
 		if (auth_cookie_req == NULL) {
@@ -55,12 +55,19 @@
 #include <main.h>
 #include <main-ctl.h>
 #include <main-ban.h>
+#include <main-admission.h>
+#include <main-metrics.h>
 #include <route-add.h>
+#include <route-netlink.h>
 #include <worker.h>
 #include <proc-search.h>
 #include <tun.h>
 #include <grp.h>
 #include <ip-lease.h>
+#include <icmp-ping.h>
+#include <gettime.h>
+#include <tracepoints.h>
+#include <sealed-cookie.h>
 #include <ccan/list/list.h>
 
 #ifdef HAVE_GSSAPI
@@ -81,8 +88,14 @@ struct ev_loop *loop = NULL;
 
 /* EV watchers */
 ev_io ctl_watcher;
+ev_io nl_watcher;
+ev_io hook_watcher;
 ev_io sec_mod_watcher;
 ev_timer maintainance_watcher;
+ev_io kv_watcher;
+ev_timer kv_timer_watcher;
+ev_idle admission_watcher;
+ev_idle tun_pool_watcher;
 ev_signal term_sig_watcher;
 ev_signal int_sig_watcher;
 ev_signal reload_sig_watcher;
@@ -628,14 +641,32 @@ void clear_lists(main_server_st *s)
 	ip_lease_deinit(&s->ip_leases);
 	proc_table_deinit(s);
 	ctl_handler_deinit(s);
+	metrics_deinit(s);
 	main_ban_db_deinit(s);
+	talloc_free(s->kv);
+	s->kv = NULL;
+	admission_queue_deinit(s);
+	tun_pool_deinit(s);
+	nl_route_deinit(s);
+	icmp_ping_deinit(s);
+
+	if (s->hook_fd >= 0) {
+		close(s->hook_fd);
+		s->hook_fd = -1;
+	}
 
 	/* clear libev state */
 	if (loop) {
 		ev_io_stop (loop, &ctl_watcher);
+		ev_io_stop (loop, &nl_watcher);
+		ev_io_stop (loop, &hook_watcher);
 		ev_io_stop (loop, &sec_mod_watcher);
 		ev_child_stop (loop, &child_watcher);
 		ev_timer_stop(loop, &maintainance_watcher);
+		ev_io_stop (loop, &kv_watcher);
+		ev_timer_stop(loop, &kv_timer_watcher);
+		ev_idle_stop(loop, &admission_watcher);
+		ev_idle_stop(loop, &tun_pool_watcher);
 		/* free memory and descriptors by the event loop */
 		ev_loop_destroy (loop);
 	}
@@ -774,6 +805,8 @@ int match_ip_only = 0;
 time_t now;
 int sfd = -1;
 
+	TRACE0(udp_forward_start);
+
 	/* first receive from the correct client and connect socket */
 	cli_addr_size = sizeof(cli_addr);
 	our_addr_size = sizeof(our_addr);
@@ -783,6 +816,7 @@ int sfd = -1;
 			  GETPCONFIG(s)->udp_port);
 	if (ret < 0) {
 		mslog(s, NULL, LOG_INFO, "error receiving in UDP socket");
+		TRACE1(udp_forward_done, -1);
 		return -1;
 	}
 	buffer_size = ret;
@@ -907,6 +941,8 @@ fail:
 	if (sfd != -1)
 		close(sfd);
 
+	/* the worker the socket was for, if any */
+	TRACE1(udp_forward_done, proc_to_send ? proc_to_send->pid : 0);
 	return 0;
 
 }
@@ -999,6 +1035,7 @@ static void kill_children(main_server_st* s)
 			remove_proc(s, ctmp, RPROC_KILL|RPROC_QUIT);
 		}
 	}
+	tun_pool_drain(s);
 	kill(s->sec_mod_pid, SIGTERM);
 }
 
@@ -1034,6 +1071,11 @@ static void reload_sig_watcher_cb(struct ev_loop *loop, ev_signal *w, int revent
 	 * used key. */
 	ms_sleep(1500);
 	reload_cfg_file(s->config_pool, s->vconfig, 1);
+
+	/* the device name or owner may have changed */
+	tun_pool_drain(s);
+	if (tun_pool_adjust(s))
+		ev_idle_start(loop, &tun_pool_watcher);
 }
 
 static void cmd_watcher_cb (EV_P_ ev_io *w, int revents)
@@ -1049,16 +1091,143 @@ static void cmd_watcher_cb (EV_P_ ev_io *w, int revents)
 	}
 }
 
-static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
+/* Forks a worker process to handle the connection in @fd. The peer
+ * and local addresses are expected to be set in s->ws. The descriptor
+ * is always closed on return.
+ */
+void spawn_worker(main_server_st *s, int fd, int stype)
 {
-	main_server_st *s = ev_userdata(loop);
-	struct listener_st *ltmp = (struct listener_st *)w;
 	struct proc_st *ctmp = NULL;
 	struct worker_st *ws = s->ws;
-	int fd, ret;
+	int ret;
 	int cmd_fd[2];
+	int slot;
 	pid_t pid;
 
+	/* when connections are waiting for a slot, new logins are
+	 * turned away by the worker, and only cookie reconnects are served */
+	ws->overloaded = (s->admission_queue.total > 0)?1:0;
+
+	/* Create a command socket */
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, cmd_fd);
+	if (ret < 0) {
+		mslog(s, NULL, LOG_ERR, "error creating command socket");
+		close(fd);
+		return;
+	}
+
+	/* without a slot the traffic is known from the stats sent to sec-mod */
+	slot = session_counters_alloc(&s->counters);
+	ws->counters = session_counters_get(&s->counters, slot);
+
+	gettime_mono(&ws->spawn_time);
+
+	TRACE1(worker_fork_start, fd);
+	pid = fork();
+	if (pid == 0) {	/* child */
+		/* close any open descriptors, and erase
+		 * sensitive data before running the worker
+		 */
+		sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
+		close(cmd_fd[0]);
+		session_counters_isolate(&s->counters, slot);
+		clear_lists(s);
+		if (s->top_fd != -1) close(s->top_fd);
+		close(s->sec_mod_fd);
+		close(s->sec_mod_fd_sync);
+		/* the worker uses its own connection to sec-mod */
+		secmod_client_close();
+
+		setproctitle(PACKAGE_NAME"-worker");
+		kill_on_parent_kill(SIGTERM);
+
+		/* write sec-mod's address */
+		memcpy(&ws->secmod_addr, &s->secmod_addr, s->secmod_addr_len);
+		ws->secmod_addr_len = s->secmod_addr_len;
+		secmod_client_init(&ws->secmod_addr, ws->secmod_addr_len);
+
+		ws->main_pool = s->main_pool;
+
+		ws->vconfig = s->vconfig;
+
+		ws->cmd_fd = cmd_fd[1];
+		ws->tun_fd = -1;
+		ws->dtls_tptr.fd = -1;
+		ws->conn_fd = fd;
+		ws->conn_type = stype;
+		ws->ticket_key = s->ticket_key;
+		ws->prev_ticket_key = s->prev_ticket_key;
+
+		/* Drop privileges after this point */
+		drop_privileges(s);
+
+		/* creds and config are not allocated
+		 * under s.
+		 */
+		talloc_free(s);
+#ifdef HAVE_MALLOC_TRIM
+		/* try to return all the pages we've freed to
+		 * the operating system, to prevent the child from
+		 * accessing them. That's totally unreliable, so
+		 * sensitive data have to be overwritten anyway. */
+		malloc_trim(0);
+#endif
+		vpn_server(ws);
+		exit(0);
+	} else if (pid == -1) {
+fork_failed:
+		mslog(s, NULL, LOG_ERR, "fork failed");
+		close(cmd_fd[0]);
+		session_counters_free(&s->counters, slot);
+	} else { /* parent */
+		TRACE1(worker_fork_done, pid);
+
+		/* add_proc */
+		ctmp = new_proc(s, pid, cmd_fd[0], 
+				&ws->remote_addr, ws->remote_addr_len,
+				&ws->our_addr, ws->our_addr_len,
+				ws->sid, sizeof(ws->sid));
+		if (ctmp == NULL) {
+			kill(pid, SIGTERM);
+			goto fork_failed;
+		}
+		ctmp->counters_slot = slot;
+
+		ev_io_init(&ctmp->io, cmd_watcher_cb, cmd_fd[0], EV_READ);
+		ev_io_start(loop, &ctmp->io);
+
+		ev_child_init(&ctmp->ev_child, worker_child_watcher_cb, pid, 0);
+		ev_child_start(loop, &ctmp->ev_child);
+
+		admission_track(s, ctmp);
+	}
+	close(cmd_fd[1]);
+	close(fd);
+}
+
+static void admission_watcher_cb(EV_P_ ev_idle *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	admission_dispatch(s);
+	ev_idle_stop(loop, w);
+}
+
+static void tun_pool_watcher_cb(EV_P_ ev_idle *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	if (tun_pool_refill(s) == 0)
+		ev_idle_stop(loop, w);
+}
+
+static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+	struct listener_st *ltmp = (struct listener_st *)w;
+	struct worker_st *ws = s->ws;
+	int fd;
+
 	if (ltmp->sock_type == SOCK_TYPE_TCP || ltmp->sock_type == SOCK_TYPE_UNIX) {
 		/* connection on TCP port */
 		int stype = ltmp->sock_type;
@@ -1070,6 +1239,7 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 			       "error in accept(): %s", strerror(errno));
 			return;
 		}
+		TRACE1(accept, fd);
 		set_cloexec_flag (fd, 1);
 #ifndef __linux__
 		/* OpenBSD sets the non-blocking flag if accept's fd is non-blocking */
@@ -1100,82 +1270,12 @@ static void listen_watcher_cb (EV_P_ ev_io *w, int revents)
 			}
 		}
 
-		/* Create a command socket */
-		ret = socketpair(AF_UNIX, SOCK_STREAM, 0, cmd_fd);
-		if (ret < 0) {
-			mslog(s, NULL, LOG_ERR, "error creating command socket");
-			close(fd);
+		if (admission_must_queue(s)) {
+			admission_enqueue(s, fd, stype);
 			return;
 		}
 
-		pid = fork();
-		if (pid == 0) {	/* child */
-			/* close any open descriptors, and erase
-			 * sensitive data before running the worker
-			 */
-			sigprocmask(SIG_SETMASK, &sig_default_set, NULL);
-			close(cmd_fd[0]);
-			clear_lists(s);
-			if (s->top_fd != -1) close(s->top_fd);
-			close(s->sec_mod_fd);
-			close(s->sec_mod_fd_sync);
-
-			setproctitle(PACKAGE_NAME"-worker");
-			kill_on_parent_kill(SIGTERM);
-
-			/* write sec-mod's address */
-			memcpy(&ws->secmod_addr, &s->secmod_addr, s->secmod_addr_len);
-			ws->secmod_addr_len = s->secmod_addr_len;
-
-			ws->main_pool = s->main_pool;
-
-			ws->vconfig = s->vconfig;
-
-			ws->cmd_fd = cmd_fd[1];
-			ws->tun_fd = -1;
-			ws->dtls_tptr.fd = -1;
-			ws->conn_fd = fd;
-			ws->conn_type = stype;
-
-			/* Drop privileges after this point */
-			drop_privileges(s);
-
-			/* creds and config are not allocated
-			 * under s.
-			 */
-			talloc_free(s);
-#ifdef HAVE_MALLOC_TRIM
-			/* try to return all the pages we've freed to
-			 * the operating system, to prevent the child from
-			 * accessing them. That's totally unreliable, so
-			 * sensitive data have to be overwritten anyway. */
-			malloc_trim(0);
-#endif
-			vpn_server(ws);
-			exit(0);
-		} else if (pid == -1) {
-fork_failed:
-			mslog(s, NULL, LOG_ERR, "fork failed");
-			close(cmd_fd[0]);
-		} else { /* parent */
-			/* add_proc */
-			ctmp = new_proc(s, pid, cmd_fd[0], 
-					&ws->remote_addr, ws->remote_addr_len,
-					&ws->our_addr, ws->our_addr_len,
-					ws->sid, sizeof(ws->sid));
-			if (ctmp == NULL) {
-				kill(pid, SIGTERM);
-				goto fork_failed;
-			}
-
-			ev_io_init(&ctmp->io, cmd_watcher_cb, cmd_fd[0], EV_READ);
-			ev_io_start(loop, &ctmp->io);
-
-			ev_child_init(&ctmp->ev_child, worker_child_watcher_cb, pid, 0);
-			ev_child_start(loop, &ctmp->ev_child);
-		}
-		close(cmd_fd[1]);
-		close(fd);
+		spawn_worker(s, fd, stype);
 	} else if (ltmp->sock_type == SOCK_TYPE_UDP) {
 		/* connection on UDP port */
 		forward_udp_to_owner(s, ltmp);
@@ -1198,6 +1298,20 @@ static void sec_mod_watcher_cb (EV_P_ ev_io *w, int revents)
 	}
 }
 
+static void nl_watcher_cb (EV_P_ ev_io *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	nl_route_process(s);
+}
+
+static void hook_watcher_cb (EV_P_ ev_io *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	handle_hook_runner_commands(s);
+}
+
 static void ctl_watcher_cb (EV_P_ ev_io *w, int revents)
 {
 	main_server_st *s = ev_userdata(loop);
@@ -1205,6 +1319,93 @@ static void ctl_watcher_cb (EV_P_ ev_io *w, int revents)
 	ctl_handler_run_pending(s, w);
 }
 
+static void kv_watcher_cb (EV_P_ ev_io *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	kv_store_process(s->kv);
+}
+
+/* expires the requests to the shared state which are not answered */
+static void kv_timer_watcher_cb(EV_P_ ev_timer *w, int revents)
+{
+	main_server_st *s = ev_userdata(loop);
+
+	kv_store_process(s->kv);
+}
+
+static void kv_update(void *priv, int fd, unsigned events)
+{
+	ev_io_stop(loop, &kv_watcher);
+	if (fd == -1)
+		return;
+
+	ev_io_set(&kv_watcher, fd, EV_READ | ((events & POLLOUT) ? EV_WRITE : 0));
+	ev_io_start(loop, &kv_watcher);
+}
+
+/* The shared state is sealed with a key derived from the secret of the
+ * sealed cookies, as sec-mod does */
+static int set_kv_key(main_server_st *s)
+{
+	const char *file = GETPCONFIG(s)->sealed_cookie_key_file;
+	gnutls_datum_t data;
+	cookie_key_st key;
+	int ret;
+
+	if (file == NULL)
+		return -1;
+
+	ret = gnutls_load_file(file, &data);
+	if (ret < 0) {
+		mslog(s, NULL, LOG_ERR, "error loading file '%s'", file);
+		return -1;
+	}
+
+	ret = cookie_key_init(&key, data.data, data.size, SEALED_COOKIE_DEFAULT_LIFETIME);
+	safe_memset(data.data, 0, data.size);
+	gnutls_free(data.data);
+	if (ret >= 0)
+		ret = kv_store_set_key(s->kv, key.secret);
+	safe_memset(&key, 0, sizeof(key));
+
+	return ret < 0 ? -1 : 0;
+}
+
+/* The TLS sessions are resumed using tickets encrypted with a key which
+ * the workers inherit; it is replaced periodically, so that a key which
+ * leaks from a worker is of limited use. The replaced key is kept for
+ * one more period so that the workers accept its tickets, but they
+ * issue tickets only with the current key. */
+static void rotate_ticket_key(main_server_st *s, time_t now)
+{
+	gnutls_datum_t key;
+	int ret;
+
+	if (GETPCONFIG(s)->tls_session_tickets == 0)
+		return;
+
+	if (s->ticket_key.data != NULL && now - s->ticket_key_time < TICKET_KEY_ROTATION_TIME)
+		return;
+
+	ret = gnutls_session_ticket_key_generate(&key);
+	if (ret < 0) {
+		mslog(s, NULL, LOG_ERR, "error generating the session ticket key: %s",
+		      gnutls_strerror(ret));
+		return;
+	}
+
+	if (s->prev_ticket_key.data != NULL) {
+		safe_memset(s->prev_ticket_key.data, 0, s->prev_ticket_key.size);
+		gnutls_free(s->prev_ticket_key.data);
+	}
+
+	s->prev_ticket_key = s->ticket_key;
+	s->ticket_key = key;
+	s->ticket_key_time = now;
+	mslog(s, NULL, LOG_DEBUG, "generated a new session ticket key");
+}
+
 static void maintainance_watcher_cb(EV_P_ ev_timer *w, int revents)
 {
 	main_server_st *s = ev_userdata(loop);
@@ -1214,6 +1415,11 @@ static void maintainance_watcher_cb(EV_P_ ev_timer *w, int revents)
 	mslog(s, NULL, LOG_DEBUG, "performing maintenance (banned IPs: %d)", main_ban_db_elems(s));
 	cleanup_banned_entries(s);
 	clear_old_configs(s->vconfig);
+	rotate_ticket_key(s, time(0));
+
+	/* the pool shrinks when idle */
+	if (tun_pool_adjust(s))
+		ev_idle_start(loop, &tun_pool_watcher);
 
 	list_for_each_rev(s->vconfig, vhost, list) {
 		tls_reload_crl(s->config_pool, vhost, 0);
@@ -1268,9 +1474,13 @@ int main(int argc, char** argv)
 	s->stats.start_time = s->stats.last_reset = time(0);
 	s->top_fd = -1;
 	s->ctl_fd = -1;
+	s->nl_fd = -1;
+	s->hook_fd = -1;
 
 	list_head_init(&s->proc_list.head);
 	list_head_init(&s->script_list.head);
+	admission_queue_init(s);
+	tun_pool_init(s);
 	ip_lease_init(&s->ip_leases);
 	proc_table_init(s);
 	main_ban_db_init(s);
@@ -1337,12 +1547,22 @@ int main(int argc, char** argv)
 	write_pid_file();
 
 	s->sec_mod_fd = run_sec_mod(s, &s->sec_mod_fd_sync);
+	s->hook_fd = run_hook_runner(s);
 	ret = ctl_handler_init(s);
 	if (ret < 0) {
 		mslog(s, NULL, LOG_ERR, "Cannot create command handler");
 		exit(1);
 	}
 
+	nl_route_init(s);
+
+	/* the workers are not forked unless there are fewer than max-clients */
+	if (session_counters_init(s, &s->counters,
+				  GETCONFIG(s)->max_clients > 0 ? GETCONFIG(s)->max_clients : DEFAULT_SESSION_COUNTERS) < 0) {
+		mslog(s, NULL, LOG_ERR, "could not allocate the session counters");
+		exit(1);
+	}
+
 	loop = EV_DEFAULT;
 	if (loop == NULL) {
 		mslog(s, NULL, LOG_ERR, "could not initialise libev");
@@ -1425,13 +1645,53 @@ int main(int argc, char** argv)
 	ev_io_start (loop, &ctl_watcher);
 	ev_io_start (loop, &sec_mod_watcher);
 
+	if (s->nl_fd >= 0) {
+		ev_io_init(&nl_watcher, nl_watcher_cb, s->nl_fd, EV_READ);
+		ev_io_start (loop, &nl_watcher);
+	}
+
+	if (s->hook_fd >= 0) {
+		ev_io_init(&hook_watcher, hook_watcher_cb, s->hook_fd, EV_READ);
+		ev_io_start (loop, &hook_watcher);
+	}
+
+	if (metrics_init(s) < 0) {
+		mslog(s, NULL, LOG_ERR, "Cannot serve the metrics");
+		exit(1);
+	}
+
 	ev_child_init(&child_watcher, sec_mod_child_watcher_cb, s->sec_mod_pid, 0);
 	ev_child_start (loop, &child_watcher);
 
+	rotate_ticket_key(s, time(0));
+
+	if (GETPCONFIG(s)->shared_state_server) {
+		s->kv = kv_store_new(s, GETPCONFIG(s)->shared_state_server,
+				     KV_DEFAULT_TIMEOUT_MS, KV_DEFAULT_CACHE_SECS);
+		if (s->kv == NULL || set_kv_key(s) < 0) {
+			mslog(s, NULL, LOG_ERR, "could not use the shared state server '%s'",
+			      GETPCONFIG(s)->shared_state_server);
+			exit(1);
+		}
+
+		ev_init(&kv_watcher, kv_watcher_cb);
+		kv_store_set_update_func(s->kv, kv_update, s);
+
+		ev_init(&kv_timer_watcher, kv_timer_watcher_cb);
+		ev_timer_set(&kv_timer_watcher, 1, 1);
+		ev_timer_start(loop, &kv_timer_watcher);
+	}
+
 	ev_init(&maintainance_watcher, maintainance_watcher_cb);
 	ev_timer_set(&maintainance_watcher, MAIN_MAINTAINANCE_TIME, MAIN_MAINTAINANCE_TIME);
 	ev_timer_start(loop, &maintainance_watcher);
 
+	ev_idle_init(&admission_watcher, admission_watcher_cb);
+
+	ev_idle_init(&tun_pool_watcher, tun_pool_watcher_cb);
+	if (tun_pool_adjust(s))
+		ev_idle_start(loop, &tun_pool_watcher);
+
 	/* Main server loop */
 	ev_run (loop, 0);
 
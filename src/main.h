@@ -35,6 +35,10 @@
 #include <ev.h>
 
 #include "vhost.h"
+#include "kv-store.h"
+#include "session-counters.h"
+#include "latency-hist.h"
+#include "session-telemetry.h"
 
 #if defined(__FreeBSD__) || defined(__OpenBSD__)
 # include <limits.h>
@@ -48,9 +52,18 @@ extern char **saved_argv;
 
 extern struct ev_loop *loop;
 extern ev_timer maintainance_watcher;
+extern ev_idle admission_watcher;
+extern ev_idle tun_pool_watcher;
+extern ev_io nl_watcher;
+extern ev_io hook_watcher;
 
 #define MAIN_MAINTAINANCE_TIME (900)
 
+/* The session ticket key is replaced on the first maintenance after
+ * that time; the tickets of the previous key are accepted until the
+ * next replacement */
+#define TICKET_KEY_ROTATION_TIME (3600)
+
 int cmd_parser (void *pool, int argc, char **argv, struct list_head *head);
 
 struct listener_st {
@@ -77,6 +90,7 @@ struct script_wait_st {
 	struct list_node list;
 
 	pid_t pid;
+	uint32_t id; /* request id when run by the hook runner */
 	struct proc_st* proc;
 };
 
@@ -93,6 +107,7 @@ typedef struct proc_st {
 	time_t udp_fd_receive_time; /* when the corresponding process has received a UDP fd */
 	
 	time_t conn_time; /* the time the user connected */
+	uint64_t seq; /* the order it was created in; the cursor of the user lists */
 
 	/* the tun lease this process has */
 	struct tun_lease_st tun_lease;
@@ -100,6 +115,11 @@ typedef struct proc_st {
 	struct ip_lease_st *ipv6;
 	unsigned leases_in_use; /* someone else got our IP leases */
 
+	/* the outstanding ping-leases probes of our leases */
+	unsigned pending_probes;
+	unsigned probe_rounds; /* number of leases found in use */
+	int probe_error;
+
 	struct sockaddr_storage remote_addr; /* peer address (CSTP) */
 	socklen_t remote_addr_len;
 	/* It can happen that the peer's DTLS stream comes through a different
@@ -125,6 +145,9 @@ typedef struct proc_st {
 	/* The following are set by the worker process (or by a stored cookie) */
 	char username[MAX_USERNAME_SIZE]; /* the owner */
 	char groupname[MAX_GROUPNAME_SIZE]; /* the owner's group */
+	/* the sessions of the owner; set once the session is opened */
+	struct proc_user_st *user;
+	struct list_node user_list;
 	char hostname[MAX_HOSTNAME_SIZE]; /* the requested hostname */
 
 	/* the following are copied here from the worker process for reporting
@@ -143,6 +166,7 @@ typedef struct proc_st {
 	uint8_t ipv4_seed[4];
 
 	unsigned status; /* PS_AUTH_ */
+	unsigned pending; /* counted in stats.pending_clients until a cookie is presented */
 
 	/* these are filled in after the worker process dies, using the
 	 * Cli stats message. */
@@ -151,6 +175,7 @@ typedef struct proc_st {
 	uint32_t discon_reason; /* filled on session close */
 	
 	unsigned applied_iroutes; /* whether the iroutes in the config have been successfully applied */
+	struct nl_req_st *nl_req; /* the netlink requests waiting for their acknowledgements */
 
 	/* The following we rely on talloc for deallocation */
 	GroupCfgSt *config; /* custom user/group config */
@@ -158,29 +183,62 @@ typedef struct proc_st {
 	/* pointer to perm_cfg - set after we know the virtual host. As
 	 * vhosts never get deleted, this pointer is always valid */
 	vhost_cfg_st *vhost;
+
+	struct metrics_label_st *metrics_label; /* where it is counted; NULL if not */
+	int counters_slot; /* its traffic counters in s->counters; -1 if none */
+
+	uint64_t tun_usecs; /* the time to set up its device, before the routes */
+	struct timespec tun_start;
+	struct timespec script_start; /* zero unless we wait for the connect script */
+
+	session_telemetry_st telemetry; /* as last reported by the worker */
+	unsigned has_telemetry;
 } proc_st;
 
 struct ip_lease_db_st {
 	struct htable ht;
+	struct list_head pools; /* of ip_pool_st */
 };
 
 struct proc_list_st {
-	struct list_head head;
+	struct list_head head; /* from the most recent */
 	unsigned int total;
+	uint64_t last_seq;
 };
 
 struct script_list_st {
 	struct list_head head;
 };
 
+struct admission_queue_st {
+	struct list_head head;
+	unsigned int total;
+};
+
 struct proc_hash_db_st {
 	struct htable *db_ip;
 	struct htable *db_dtls_ip;
 	struct htable *db_dtls_id;
 	struct htable *db_sid;
+	struct htable *db_user; /* of proc_user_st */
+	struct htable *db_seq; /* all the sessions, by their seq */
 	unsigned total;
 };
 
+#define MAX_AUTH_BACKEND_STATS 8
+#define MAX_AUTH_BACKEND_NAME 16
+
+/* The state of an authentication module called by the sec-mod threads */
+struct auth_backend_stats_st {
+	char name[MAX_AUTH_BACKEND_NAME];
+	unsigned max_running;
+	unsigned running;
+	unsigned queued;
+	unsigned max_queued;
+	uint32_t max_wait_ms;
+	uint64_t completed;
+};
+
 struct main_stats_st {
 	uint64_t session_timeouts; /* sessions with timeout */
 	uint64_t session_idle_timeouts; /* sessions with idle timeout */
@@ -192,6 +250,12 @@ struct main_stats_st {
 	unsigned max_mtu;
 
 	unsigned active_clients;
+	unsigned pending_clients; /* workers which have not presented a cookie yet */
+	uint64_t admission_drops; /* connections dropped by admission control */
+
+	uint64_t ip_leases; /* IP lease allocations since start time */
+	uint32_t avg_lease_usecs; /* in microseconds */
+	uint32_t max_lease_usecs;
 	/* updated on the cli_stats_msg from sec-mod. 
 	 * Holds the number of entries in secmod list of users */
 	unsigned secmod_client_entries;
@@ -208,6 +272,22 @@ struct main_stats_st {
 	/* These are counted since start time */
 	uint64_t total_auth_failures; /* authentication failures since start_time */
 	uint64_t total_sessions_closed; /* sessions closed since start_time */
+	uint64_t total_bans; /* addresses banned since start_time */
+
+	/* as last reported by sec-mod */
+	struct auth_backend_stats_st auth_backends[MAX_AUTH_BACKEND_STATS];
+	unsigned auth_backends_size;
+	unsigned acct_spool; /* whether the following are set */
+	unsigned acct_spool_records;
+	uint64_t acct_spool_bytes;
+	unsigned acct_spool_lag;
+
+	/* the durations of the phases of the session setup since start_time */
+	latency_hist_st setup_latency[SETUP_PHASES];
+
+	/* the data-plane events of all the sessions since start_time */
+	session_telemetry_st telemetry;
+	latency_hist_st dpd_rtt;
 };
 
 typedef struct main_server_st {
@@ -216,11 +296,16 @@ typedef struct main_server_st {
 
 	struct ip_lease_db_st ip_leases;
 
-	struct htable *ban_db;
+	struct ban_db_st *ban_db;
+	kv_store_st *kv; /* the state shared with the cluster; NULL if not used */
+	struct metrics_st *metrics; /* NULL if not used */
+	session_counters_table_st counters; /* written by the workers */
 
 	struct listen_list_st listen_list;
 	struct proc_list_st proc_list;
 	struct script_list_st script_list;
+	struct admission_queue_st admission_queue;
+	struct tun_pool_st tun_pool;
 	/* maps DTLS session IDs to proc entries */
 	struct proc_hash_db_st proc_table;
 	
@@ -238,9 +323,24 @@ typedef struct main_server_st {
 	/* This one is on worker pool */
 	struct worker_st *ws;
 
+	/* the key of the TLS session tickets, inherited by the workers */
+	gnutls_datum_t ticket_key;
+	gnutls_datum_t prev_ticket_key; /* accepted until the next rotation */
+	time_t ticket_key_time;
+
 	int top_fd;
 	int ctl_fd;
 
+	int nl_fd; /* rtnetlink socket; -1 if not available */
+	uint32_t nl_seq;
+	struct htable *nl_acks; /* of nl_ack_st, by seq; the requests waiting for their acknowledgement */
+
+	struct icmp_ping_st *ping; /* the ping-leases prober; NULL until used */
+
+	int hook_fd; /* hook runner socket; -1 if scripts are forked by main */
+	pid_t hook_pid;
+	uint32_t hook_id;
+
 	int sec_mod_fd; /* messages are sent and received async */
 	int sec_mod_fd_sync; /* messages are send in a sync order (ping-pong). Only main sends. */
 	void *main_pool; /* talloc main pool */
@@ -251,9 +351,11 @@ typedef struct main_server_st {
 } main_server_st;
 
 void clear_lists(main_server_st *s);
+void spawn_worker(main_server_st *s, int fd, int stype);
 
 int handle_worker_commands(main_server_st *s, struct proc_st* cur);
 int handle_sec_mod_commands(main_server_st *s);
+int handle_hook_runner_commands(main_server_st *s);
 
 int user_connected(main_server_st *s, struct proc_st* cur);
 void user_hostname_update(main_server_st *s, struct proc_st* cur);
@@ -261,6 +363,10 @@ void user_disconnected(main_server_st *s, struct proc_st* cur);
 
 int send_udp_fd(main_server_st* s, struct proc_st * proc, int fd);
 
+void proc_get_traffic(main_server_st *s, struct proc_st *proc,
+		      uint64_t *bytes_in, uint64_t *bytes_out,
+		      uint64_t *rx_per_sec, uint64_t *tx_per_sec);
+
 int session_open(main_server_st * s, struct proc_st *proc, const uint8_t *cookie, unsigned cookie_size);
 int session_close(main_server_st * s, struct proc_st *proc);
 
@@ -292,6 +398,14 @@ void  mslog_hex(const main_server_st * s, const struct proc_st* proc,
 int open_tun(main_server_st* s, struct proc_st* proc);
 void close_tun(main_server_st* s, struct proc_st* proc);
 void reset_tun(struct proc_st* proc);
+int create_tun(main_server_st* s, struct tun_lease_st *lease);
+void destroy_tun(main_server_st* s, struct tun_lease_st *lease);
+int tun_pool_get(main_server_st* s, struct tun_lease_st *lease);
+void tun_pool_init(main_server_st* s);
+void tun_pool_deinit(main_server_st* s);
+void tun_pool_drain(main_server_st* s);
+unsigned tun_pool_adjust(main_server_st* s);
+unsigned tun_pool_refill(main_server_st* s);
 int set_tun_mtu(main_server_st* s, struct proc_st * proc, unsigned mtu);
 
 int send_cookie_auth_reply(main_server_st* s, struct proc_st* proc,
@@ -302,8 +416,14 @@ int handle_auth_cookie_req(main_server_st* s, struct proc_st* proc,
 
 int check_multiple_users(main_server_st *s, struct proc_st* proc);
 int handle_script_exit(main_server_st *s, struct proc_st* proc, int code);
+int handle_leases_probed(main_server_st *s, struct proc_st *proc, int result);
+int handle_tun_set(main_server_st *s, struct proc_st *proc, int result);
+
+const char *setup_phase_to_str(unsigned phase);
+void record_setup_time(main_server_st *s, unsigned phase, uint64_t usecs);
 
 int run_sec_mod(main_server_st * s, int *sync_fd);
+int run_hook_runner(main_server_st * s);
 
 struct proc_st *new_proc(main_server_st * s, pid_t pid, int cmd_fd,
 			struct sockaddr_storage *remote_addr, socklen_t remote_addr_len,
@@ -29,4 +29,10 @@ enum {
 	CTL_CMD_LIST_COOKIES_REP
 };
 
+/* The parts of user_info_rep which are filled in a user list, besides
+ * the identity, the addresses and the status of the session */
+#define CTL_USER_INFO_TLS 1 /* the ciphersuites and compression methods */
+#define CTL_USER_INFO_CONFIG (1<<1) /* the DNS, routes and other settings */
+#define CTL_USER_INFO_ALL (CTL_USER_INFO_TLS|CTL_USER_INFO_CONFIG)
+
 #endif
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <signal.h>
 #include <c-ctype.h>
@@ -47,6 +48,7 @@
 #include <assert.h>
 #include "hex.h"
 #include "geoip.h"
+#include "session-telemetry.h"
 #include <vpn.h>
 #include <base64-helper.h>
 
@@ -57,6 +59,9 @@
 static
 int common_info_cmd(UserListRep *args, FILE *out, cmd_params_st *params);
 static
+int print_user_infos(UserListRep *args, FILE *out, cmd_params_st *params,
+		     unsigned have_more, unsigned *printed);
+static
 int session_info_cmd(void *ctx, SecmListCookiesReplyMsg * args, FILE *out,
 		    cmd_params_st *params,
 		    const char *lsid, unsigned all);
@@ -197,6 +202,77 @@ error:
 
 }
 
+static const char *usecs2str(char *buf, size_t size, uint64_t usecs)
+{
+	if (usecs < 1000)
+		snprintf(buf, size, "%u us", (unsigned)usecs);
+	else if (usecs < 1000000)
+		snprintf(buf, size, "%.1f ms", usecs / 1000.0);
+	else
+		snprintf(buf, size, "%.2f s", usecs / 1000000.0);
+	return buf;
+}
+
+static void print_size_classes(FILE *out, cmd_params_st *params, const char *name,
+			       const uint64_t *sizes, size_t n_sizes)
+{
+	char buf[256];
+	unsigned i, len = 0;
+
+	buf[0] = 0;
+	for (i = 0; i < n_sizes && i < TELEMETRY_SIZE_CLASSES && len < sizeof(buf); i++) {
+		if (i < TELEMETRY_SIZE_CLASSES - 1)
+			len += snprintf(buf + len, sizeof(buf) - len, "%s<=%u: %"PRIu64,
+					i > 0 ? ", " : "", TELEMETRY_SIZE_BOUND(i), sizes[i]);
+		else
+			len += snprintf(buf + len, sizeof(buf) - len, ", >%u: %"PRIu64,
+					TELEMETRY_SIZE_BOUND(i - 1), sizes[i]);
+	}
+
+	print_single_value(out, params, name, buf, 1);
+}
+
+/* Prints the data-plane events of a session or of the server */
+static void print_telemetry(FILE *out, cmd_params_st *params, SessionTelemetryMsg *t)
+{
+	char buf[128];
+	char t1[16], t2[16];
+
+	if (t->rtt_samples > 0) {
+		snprintf(buf, sizeof(buf), "%s (min %s, %"PRIu64" samples)",
+			 usecs2str(t1, sizeof(t1), t->rtt_usecs),
+			 usecs2str(t2, sizeof(t2), t->min_rtt_usecs), t->rtt_samples);
+		print_single_value(out, params, "DPD RTT", buf, 1);
+	}
+
+	print_size_classes(out, params, "Packet sizes RX", t->rx_sizes, t->n_rx_sizes);
+	print_size_classes(out, params, "Packet sizes TX", t->tx_sizes, t->n_tx_sizes);
+
+	snprintf(buf, sizeof(buf), "RX %"PRIu64", TX %"PRIu64, t->rx_policed, t->tx_policed);
+	print_single_value(out, params, "Policed packets", buf, 1);
+
+	if (t->comp_in > 0) {
+		char b1[32], b2[32];
+
+		bytes2human(t->comp_in, b1, sizeof(b1), NULL);
+		bytes2human(t->comp_out, b2, sizeof(b2), NULL);
+		snprintf(buf, sizeof(buf), "%s to %s (%.1f%%)", b1, b2,
+			 t->comp_out * 100.0 / t->comp_in);
+		print_single_value(out, params, "Compression", buf, 1);
+	}
+
+	snprintf(buf, sizeof(buf), "%u decreases, %u increases",
+		 (unsigned)t->mtu_decreases, (unsigned)t->mtu_increases);
+	print_single_value(out, params, "MTU changes", buf, 1);
+
+	snprintf(buf, sizeof(buf), "%u to TLS, %u to DTLS",
+		 (unsigned)t->to_tls, (unsigned)t->to_dtls);
+	print_single_value(out, params, "Channel switches", buf, 1);
+
+	snprintf(buf, sizeof(buf), "%"PRIu64, t->eagain);
+	print_single_value(out, params, "Empty reads", buf, 1);
+}
+
 int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
 {
 	int ret;
@@ -206,6 +282,7 @@ int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 	char buf[MAX_TMPSTR_SIZE];
 	time_t t;
 	struct tm *tm;
+	unsigned i;
 	PROTOBUF_ALLOCATOR(pa, ctx);
 
 	init_reply(&raw);
@@ -246,6 +323,25 @@ int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 		print_single_value_int(stdout, params, "Total sessions", rep->total_sessions_closed, 1);
 		print_single_value_int(stdout, params, "Total authentication failures", rep->total_auth_failures, 1);
 		print_single_value_int(stdout, params, "IPs in ban list", rep->banned_ips, 1);
+		if (rep->has_pending_clients)
+			print_single_value_int(stdout, params, "Pending sessions", rep->pending_clients, 1);
+		if (rep->has_queued_clients)
+			print_single_value_int(stdout, params, "Queued connections", rep->queued_clients, 1);
+		if (rep->has_admission_drops)
+			print_single_value_int(stdout, params, "Dropped connections", rep->admission_drops, 1);
+		if (rep->has_ip_pool_size && rep->ip_pool_size > 0) {
+			snprintf(buf, sizeof(buf), "%u/%u", (unsigned)rep->ip_pool_used, (unsigned)rep->ip_pool_size);
+			print_single_value(stdout, params, "IP pool usage", buf, 1);
+		}
+		if (rep->has_ip_pool_fragments && rep->ip_pool_size > 0)
+			print_single_value_int(stdout, params, "IP pool free fragments", rep->ip_pool_fragments, 1);
+		if (rep->has_acct_spool_records) {
+			print_single_value_int(stdout, params, "Accounting spool records", rep->acct_spool_records, 1);
+			bytes2human(rep->acct_spool_bytes, buf, sizeof(buf), "");
+			print_single_value(stdout, params, "Accounting spool size", buf, 1);
+			print_time_ival7(buf, rep->acct_spool_lag, 0);
+			print_single_value(stdout, params, "Accounting spool lag", buf, 1);
+		}
 		if (params && params->debug) {
 			print_single_value_int(stdout, params, "Sec-mod client entries", rep->secmod_client_entries, 1);
 			print_single_value_int(stdout, params, "TLS DB entries", rep->stored_tls_sessions, 1);
@@ -282,6 +378,60 @@ int handle_status_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *para
 		print_time_ival7(buf, rep->max_session_mins*60, 0);
 		print_single_value(stdout, params, "Max session time", buf, 1);
 
+		if (rep->has_avg_lease_usecs) {
+			snprintf(buf, sizeof(buf), "%u us", (unsigned)rep->avg_lease_usecs);
+			print_single_value(stdout, params, "Average IP lease time", buf, 1);
+		}
+		if (rep->has_max_lease_usecs) {
+			snprintf(buf, sizeof(buf), "%u us", (unsigned)rep->max_lease_usecs);
+			print_single_value(stdout, params, "Max IP lease time", buf, 1);
+		}
+
+		for (i = 0; i < rep->n_auth_backends; i++) {
+			char name[64];
+			char val[128];
+
+			snprintf(name, sizeof(name), "Sec-mod backend '%s'", rep->auth_backends[i]->name);
+			snprintf(val, sizeof(val), "%u/%u running, %u queued (max %u, %u ms)",
+				 (unsigned)rep->auth_backends[i]->running,
+				 (unsigned)rep->auth_backends[i]->max_running,
+				 (unsigned)rep->auth_backends[i]->queued,
+				 (unsigned)rep->auth_backends[i]->max_queued,
+				 (unsigned)rep->auth_backends[i]->max_wait_ms);
+			print_single_value(stdout, params, name, val, 1);
+		}
+
+		for (i = 0; i < rep->n_setup_latency; i++) {
+			SetupLatencyMsg *l = rep->setup_latency[i];
+			char name[64];
+			char val[128];
+			char t1[16], t2[16], t3[16], t4[16];
+
+			snprintf(name, sizeof(name), "Setup time '%s'", l->phase);
+			snprintf(val, sizeof(val), "%s median, %s 90th, %s 99th, %s max (%"PRIu64")",
+				 usecs2str(t1, sizeof(t1), l->median),
+				 usecs2str(t2, sizeof(t2), l->p90),
+				 usecs2str(t3, sizeof(t3), l->p99),
+				 usecs2str(t4, sizeof(t4), l->max), l->count);
+			print_single_value(stdout, params, name, val, 1);
+		}
+
+		if (rep->has_dpd_rtt_median && rep->has_dpd_rtt_p99) {
+			char val[64];
+			char t1[16], t2[16];
+
+			snprintf(val, sizeof(val), "%s median, %s 99th",
+				 usecs2str(t1, sizeof(t1), rep->dpd_rtt_median),
+				 usecs2str(t2, sizeof(t2), rep->dpd_rtt_p99));
+			print_single_value(stdout, params, "DPD RTT", val, 1);
+		}
+
+		if (rep->telemetry) {
+			/* the last RTT of the server is meaningless */
+			rep->telemetry->rtt_samples = 0;
+			print_telemetry(stdout, params, rep->telemetry);
+		}
+
 		bytes2human(rep->kbytes_in*1000, buf, sizeof(buf), "");
 		print_single_value(stdout, params, "RX", buf, 1);
 		bytes2human(rep->kbytes_out*1000, buf, sizeof(buf), "");
@@ -399,6 +549,7 @@ int handle_unban_ip_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *pa
 	UnbanReq req = UNBAN_REQ__INIT;
 	int af;
 	unsigned char tmp[16];
+	char ip[MAX_IP_STR+4];
 	PROTOBUF_ALLOCATOR(pa, ctx);
 
 	if (arg == NULL || need_help(arg)) {
@@ -408,6 +559,11 @@ int handle_unban_ip_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *pa
 	
 	init_reply(&raw);
 
+	/* a prefix, as listed, unbans the addresses it covers */
+	strlcpy(ip, arg, sizeof(ip));
+	if (strchr(ip, '/') != NULL)
+		*strchr(ip, '/') = 0;
+
 	/* convert the IP to the simplest form */
 	if (strchr(arg, ':') != 0) {
 		af = AF_INET6;
@@ -415,7 +571,7 @@ int handle_unban_ip_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *pa
 		af = AF_INET;
 	}
 
-	ret = inet_pton(af, arg, tmp);
+	ret = inet_pton(af, ip, tmp);
 	if (ret == 1) {
 		req.ip.data = tmp;
 		if (af == AF_INET)
@@ -584,7 +740,9 @@ static const char *get_ip(const char *ip1, const char *ip2)
 		return ip2;
 }
 
-void common_user_list(struct unix_ctx *ctx, UserListRep *rep, FILE *out, cmd_params_st *params)
+/* Prints a line for each user of the list, and the header on @header */
+static
+void print_user_lines(struct unix_ctx *ctx, UserListRep *rep, FILE *out, unsigned header)
 {
 	unsigned i;
 	const char *vpn_ip, *username;
@@ -594,9 +752,7 @@ void common_user_list(struct unix_ctx *ctx, UserListRep *rep, FILE *out, cmd_par
 	struct tm *tm;
 	char str_since[64];
 
-	if (HAVE_JSON(params)) {
-		common_info_cmd(rep, out, params);
-	} else for (i=0;i<rep->n_user;i++) {
+	for (i=0;i<rep->n_user;i++) {
 		username = rep->user[i]->username;
 		if (username == NULL || username[0] == 0)
 			username = NO_USER;
@@ -604,7 +760,7 @@ void common_user_list(struct unix_ctx *ctx, UserListRep *rep, FILE *out, cmd_par
 		vpn_ip = get_ip(rep->user[i]->local_ip, rep->user[i]->local_ip6);
 
 		/* add header */
-		if (i == 0) {
+		if (i == 0 && header) {
 			fprintf(out, "%8s %8s %8s %14s %14s %6s %7s %14s %9s\n",
 				"id", "user", "vhost", "ip", "vpn-ip", "device",
 				"since", "dtls-cipher", "status");
@@ -627,30 +783,173 @@ void common_user_list(struct unix_ctx *ctx, UserListRep *rep, FILE *out, cmd_par
 	}
 }
 
+void common_user_list(struct unix_ctx *ctx, UserListRep *rep, FILE *out, cmd_params_st *params)
+{
+	if (HAVE_JSON(params)) {
+		common_info_cmd(rep, out, params);
+	} else {
+		print_user_lines(ctx, rep, out, 1);
+	}
+}
+
+/* Parses the filters of 'show users', given as pairs of a keyword and a
+ * value, to @req. The strings of @req are allocated under @pool and the
+ * address is stored at @ip. */
+static
+int parse_user_filters(void *pool, const char *arg, UserListReq *req, uint8_t ip[16])
+{
+	char *str, *p, *key, *val, *prefix;
+	char *saveptr = NULL;
+	int af;
+
+	if (arg == NULL)
+		return 0;
+
+	str = talloc_strdup(pool, arg);
+	if (str == NULL)
+		return -1;
+
+	for (p = str;; p = NULL) {
+		key = strtok_r(p, " \t", &saveptr);
+		if (key == NULL)
+			break;
+
+		val = strtok_r(NULL, " \t", &saveptr);
+		if (val == NULL) {
+			fprintf(stderr, "missing value for '%s'\n", key);
+			return -1;
+		}
+
+		if (strcmp(key, "user") == 0) {
+			req->username = val;
+		} else if (strcmp(key, "group") == 0) {
+			req->groupname = val;
+		} else if (strcmp(key, "vhost") == 0) {
+			req->vhost = val;
+		} else if (strcmp(key, "ip") == 0) {
+			prefix = strchr(val, '/');
+			if (prefix != NULL)
+				*prefix++ = 0;
+
+			if (strchr(val, ':') != 0) {
+				af = AF_INET6;
+				req->ip.len = 16;
+			} else {
+				af = AF_INET;
+				req->ip.len = 4;
+			}
+
+			if (inet_pton(af, val, ip) != 1) {
+				fprintf(stderr, "Cannot parse IP: %s\n", val);
+				return -1;
+			}
+			req->ip.data = ip;
+			req->has_ip = 1;
+
+			if (prefix != NULL) {
+				req->ip_prefix = atoi(prefix);
+				req->has_ip_prefix = 1;
+				if (req->ip_prefix > req->ip.len * 8) {
+					fprintf(stderr, "Invalid prefix: %s\n", prefix);
+					return -1;
+				}
+			}
+		} else if (strcmp(key, "min-traffic") == 0) {
+			req->min_traffic = strtoull(val, NULL, 10);
+			req->has_min_traffic = 1;
+		} else {
+			fprintf(stderr, "unknown filter '%s'\n", key);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* the users requested at once; the list is printed as each page is received */
+#define USER_LIST_PAGE_SIZE 256
+
 int handle_list_users_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *params)
 {
 	int ret;
 	struct cmd_reply_st raw;
-	UserListRep *rep = NULL;
+	UserListReq req = USER_LIST_REQ__INIT;
+	UserListRep *rep = NULL, *prev = NULL;
+	uint8_t ip[16];
+	unsigned printed = 0;
 	FILE *out;
 	PROTOBUF_ALLOCATOR(pa, ctx);
 
+	if (arg != NULL && arg[0] == '?') {
+		check_cmd_help(rl_line_buffer);
+		return 1;
+	}
+
+	if (parse_user_filters(ctx, arg, &req, ip) < 0)
+		return 1;
+
 	init_reply(&raw);
 
 	entries_clear();
 
 	out = pager_start(params);
 
-	ret = send_cmd(ctx, CTL_CMD_LIST, NULL, NULL, NULL, &raw);
-	if (ret < 0) {
-		goto error;
-	}
+	req.max_entries = USER_LIST_PAGE_SIZE;
+	req.has_max_entries = 1;
+	/* the TLS information is shown in the line of each user */
+	req.fields = HAVE_JSON(params) ? CTL_USER_INFO_ALL : CTL_USER_INFO_TLS;
+	req.has_fields = 1;
 
-	rep = user_list_rep__unpack(&pa, raw.data_size, raw.data);
-	if (rep == NULL)
-		goto error;
+	print_array_block(out, params);
+
+	do {
+		/* the server closes the connection after each reply */
+		if (req.has_cursor) {
+			conn_posthandle(ctx);
+			if (conn_prehandle(ctx) < 0)
+				goto error;
+		}
+
+		ret = send_cmd(ctx, CTL_CMD_LIST, &req,
+			(pack_size_func)user_list_req__get_packed_size,
+			(pack_func)user_list_req__pack, &raw);
+		if (ret < 0) {
+			goto error;
+		}
+
+		rep = user_list_rep__unpack(&pa, raw.data_size, raw.data);
+		if (rep == NULL)
+			goto error;
+
+		free_reply(&raw);
+		init_reply(&raw);
 
-	common_user_list(ctx, rep, out, params);
+		req.cursor = rep->next_cursor;
+		req.has_cursor = rep->has_next_cursor;
+
+		if (HAVE_JSON(params)) {
+			/* the last entry of a page is only known to be followed
+			 * by another once the next page is received */
+			if (prev != NULL) {
+				if (print_user_infos(prev, out, params, rep->n_user > 0, &printed) < 0)
+					goto error;
+				user_list_rep__free_unpacked(prev, &pa);
+			}
+			prev = rep;
+		} else {
+			print_user_lines(ctx, rep, out, printed == 0);
+			printed += rep->n_user;
+			user_list_rep__free_unpacked(rep, &pa);
+		}
+		rep = NULL;
+	} while (req.has_cursor);
+
+	if (prev != NULL) {
+		if (print_user_infos(prev, out, params, 0, &printed) < 0)
+			goto error;
+	}
+
+	print_end_array_block(out, params);
 
 	ret = 0;
 	goto cleanup;
@@ -662,6 +961,8 @@ int handle_list_users_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st *
  cleanup:
 	if (rep != NULL)
 		user_list_rep__free_unpacked(rep, &pa);
+	if (prev != NULL)
+		user_list_rep__free_unpacked(prev, &pa);
 
 	free_reply(&raw);
 	pager_stop(out);
@@ -930,7 +1231,7 @@ int handle_list_banned_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st
 	struct tm *tm;
 	time_t t;
 	PROTOBUF_ALLOCATOR(pa, ctx);
-	char txt_ip[MAX_IP_STR];
+	char txt_ip[MAX_IP_STR+4];
 	const char *tmp_str;
 
 	init_reply(&raw);
@@ -960,6 +1261,9 @@ int handle_list_banned_cmd(struct unix_ctx *ctx, const char *arg, cmd_params_st
 			tmp_str = inet_ntop(AF_INET, rep->info[i]->ip.data, txt_ip, sizeof(txt_ip));
 		if (tmp_str == NULL)
 			strlcpy(txt_ip, "(unknown)", sizeof(txt_ip));
+		else if (rep->info[i]->has_prefix)
+			snprintf(txt_ip + strlen(txt_ip), sizeof(txt_ip) - strlen(txt_ip),
+				 "/%u", (unsigned)rep->info[i]->prefix);
 
 		/* add header */
 		if (points == 0) {
@@ -1045,8 +1349,41 @@ static char *int2str(char tmpbuf[MAX_TMPSTR_SIZE], int i)
 	return tmpbuf;
 }
 
+/* Prints the traffic as counted by the worker of the session, in the
+ * format of print_iface_stats() */
+static void print_traffic_stats(UserInfoRep *u, FILE *out, cmd_params_st *params)
+{
+	char buf1[32], buf2[32];
+	time_t diff = time(0) - u->conn_time;
+
+	if (diff < 1)
+		diff = 1;
+
+	bytes2human(u->bytes_in, buf1, sizeof(buf1), NULL);
+	bytes2human(u->bytes_out, buf2, sizeof(buf2), NULL);
+	if (HAVE_JSON(params)) {
+		fprintf(out, "    \"RX\":  \"%"PRIu64"\",\n    \"TX\":  \"%"PRIu64"\",\n", u->bytes_in, u->bytes_out);
+		fprintf(out, "    \"_RX\":  \"%s\",\n    \"_TX\":  \"%s\",\n", buf1, buf2);
+	} else
+		fprintf(out, "\tRX: %"PRIu64" (%s)   TX: %"PRIu64" (%s)\n", u->bytes_in, buf1, u->bytes_out, buf2);
+
+	bytes2human(u->bytes_in / diff, buf1, sizeof(buf1), "/sec");
+	bytes2human(u->bytes_out / diff, buf2, sizeof(buf2), "/sec");
+	if (HAVE_JSON(params))
+		fprintf(out, "    \"Average RX\":  \"%s\",\n    \"Average TX\":  \"%s\",\n", buf1, buf2);
+	else
+		fprintf(out, "\tAverage bandwidth RX: %s  TX: %s\n", buf1, buf2);
+
+	bytes2human(u->rx_rate, buf1, sizeof(buf1), "/sec");
+	bytes2human(u->tx_rate, buf2, sizeof(buf2), "/sec");
+	if (HAVE_JSON(params))
+		fprintf(out, "    \"Current RX\":  \"%s\",\n    \"Current TX\":  \"%s\",\n", buf1, buf2);
+	else
+		fprintf(out, "\tCurrent bandwidth RX: %s  TX: %s\n", buf1, buf2);
+}
+
 static
-int common_info_cmd(UserListRep * args, FILE *out, cmd_params_st *params)
+int print_user_info(UserInfoRep *u, FILE *out, cmd_params_st *params, unsigned have_more)
 {
 	char *username = "";
 	char *groupname = "";
@@ -1055,146 +1392,176 @@ int common_info_cmd(UserListRep * args, FILE *out, cmd_params_st *params)
 	char tmpbuf2[MAX_TMPSTR_SIZE];
 	struct tm *tm;
 	time_t t;
-	unsigned at_least_one = 0;
-	int ret = 1, r;
-	unsigned i;
-	unsigned init_pager = 0;
+	int r;
 
-	if (out == NULL) {
-		out = pager_start(params);
-		init_pager = 1;
-	}
+	print_start_block(out, params);
 
-	if (HAVE_JSON(params))
-		fprintf(out, "[\n");
+	print_single_value_int(out, params, "ID", u->id, 1);
 
-	for (i=0;i<args->n_user;i++) {
-		if (at_least_one > 0)
-			fprintf(out, "\n");
+	t = u->conn_time;
+	tm = localtime(&t);
+	strftime(str_since, sizeof(str_since), DATE_TIME_FMT, tm);
 
-		print_start_block(out, params);
+	username = u->username;
+	if (username == NULL || username[0] == 0)
+		username = NO_USER;
 
-		print_single_value_int(out, params, "ID", args->user[i]->id, 1);
 
-		t = args->user[i]->conn_time;
-		tm = localtime(&t);
-		strftime(str_since, sizeof(str_since), DATE_TIME_FMT, tm);
+	groupname = u->groupname;
+	if (groupname == NULL || groupname[0] == 0)
+		groupname = NO_GROUP;
 
-		username = args->user[i]->username;
-		if (username == NULL || username[0] == 0)
-			username = NO_USER;
+	print_pair_value(out, params, "Username", username, "Groupname", groupname, 1);
 
+	print_single_value(out, params, "State", ps_status_to_str(u->status, 0), 1);
+	print_single_value(out, params, "vhost", u->vhost, 1);
+	if (u->has_mtu != 0)
+		print_pair_value(out, params, "Device", u->tun, "MTU", int2str(tmpbuf, u->mtu), 1);
+	else
+		print_single_value(out, params, "Device", u->tun, 1);
+	print_pair_value(out, params, "Remote IP", u->ip, "Location", geo_lookup(u->ip, tmpbuf, sizeof(tmpbuf)), 1);
+	print_single_value(out, params, "Local Device IP", u->local_dev_ip, 1);
 
-		groupname = args->user[i]->groupname;
-		if (groupname == NULL || groupname[0] == 0)
-			groupname = NO_GROUP;
+	if (u->local_ip != NULL && u->local_ip[0] != 0 &&
+	    u->remote_ip != NULL && u->remote_ip[0] != 0) {
+		print_pair_value(out, params, "IPv4", u->local_ip, "P-t-P IPv4", u->remote_ip, 1);
+	}
+	if (u->local_ip6 != NULL && u->local_ip6[0] != 0 &&
+	    u->remote_ip6 != NULL && u->remote_ip6[0] != 0) {
+		print_pair_value(out, params, "IPv6", u->local_ip6, "P-t-P IPv6", u->remote_ip6, 1);
+	}
 
-		print_pair_value(out, params, "Username", username, "Groupname", groupname, 1);
+	print_single_value(out, params, "User-Agent", u->user_agent, 1);
 
-		print_single_value(out, params, "State", ps_status_to_str(args->user[i]->status, 0), 1);
-		print_single_value(out, params, "vhost", args->user[i]->vhost, 1);
-		if (args->user[i]->has_mtu != 0)
-			print_pair_value(out, params, "Device", args->user[i]->tun, "MTU", int2str(tmpbuf, args->user[i]->mtu), 1);
-		else
-			print_single_value(out, params, "Device", args->user[i]->tun, 1);
-		print_pair_value(out, params, "Remote IP", args->user[i]->ip, "Location", geo_lookup(args->user[i]->ip, tmpbuf, sizeof(tmpbuf)), 1);
-		print_single_value(out, params, "Local Device IP", args->user[i]->local_dev_ip, 1);
+	if (u->rx_per_sec > 0 || u->tx_per_sec > 0) {
+		/* print limits */
+		char buf1[32];
+		char buf2[32];
 
-		if (args->user[i]->local_ip != NULL && args->user[i]->local_ip[0] != 0 &&
-		    args->user[i]->remote_ip != NULL && args->user[i]->remote_ip[0] != 0) {
-			print_pair_value(out, params, "IPv4", args->user[i]->local_ip, "P-t-P IPv4", args->user[i]->remote_ip, 1);
-		}
-		if (args->user[i]->local_ip6 != NULL && args->user[i]->local_ip6[0] != 0 &&
-		    args->user[i]->remote_ip6 != NULL && args->user[i]->remote_ip6[0] != 0) {
-			print_pair_value(out, params, "IPv6", args->user[i]->local_ip6, "P-t-P IPv6", args->user[i]->remote_ip6, 1);
+		if (u->rx_per_sec > 0 && u->tx_per_sec > 0) {
+			bytes2human(u->rx_per_sec, buf1, sizeof(buf1), "/sec");
+			bytes2human(u->tx_per_sec, buf2, sizeof(buf2), "/sec");
+
+			print_pair_value(out, params, "Limit RX", buf1, "TX", buf2, 1);
+		} else if (u->tx_per_sec > 0) {
+			bytes2human(u->tx_per_sec, buf1, sizeof(buf1), "/sec");
+			print_single_value(out, params, "Limit TX", buf1, 1);
+		} else if (u->rx_per_sec > 0) {
+			bytes2human(u->rx_per_sec, buf1, sizeof(buf1), "/sec");
+			print_single_value(out, params, "Limit RX", buf1, 1);
 		}
+	}
 
-		print_single_value(out, params, "User-Agent", args->user[i]->user_agent, 1);
+	if (u->has_bytes_in)
+		print_traffic_stats(u, out, params);
+	else
+		print_iface_stats(u->tun, u->conn_time, out, params, 1);
 
-		if (args->user[i]->rx_per_sec > 0 || args->user[i]->tx_per_sec > 0) {
-			/* print limits */
-			char buf1[32];
-			char buf2[32];
+	if (u->telemetry)
+		print_telemetry(out, params, u->telemetry);
 
-			if (args->user[i]->rx_per_sec > 0 && args->user[i]->tx_per_sec > 0) {
-				bytes2human(args->user[i]->rx_per_sec, buf1, sizeof(buf1), "/sec");
-				bytes2human(args->user[i]->tx_per_sec, buf2, sizeof(buf2), "/sec");
+	print_pair_value(out, params, "DPD", int2str(tmpbuf, u->dpd), "KeepAlive", int2str(tmpbuf2, u->keepalive), 1);
 
-				print_pair_value(out, params, "Limit RX", buf1, "TX", buf2, 1);
-			} else if (args->user[i]->tx_per_sec > 0) {
-				bytes2human(args->user[i]->tx_per_sec, buf1, sizeof(buf1), "/sec");
-				print_single_value(out, params, "Limit TX", buf1, 1);
-			} else if (args->user[i]->rx_per_sec > 0) {
-				bytes2human(args->user[i]->rx_per_sec, buf1, sizeof(buf1), "/sec");
-				print_single_value(out, params, "Limit RX", buf1, 1);
-			}
-		}
+	print_single_value(out, params, "Hostname", u->hostname, 1);
 
-		print_iface_stats(args->user[i]->tun, args->user[i]->conn_time, out, params, 1);
+	print_time_ival7(tmpbuf, time(0), t);
+	print_single_value_ex(out, params, "Connected at", str_since, tmpbuf, 1);
 
-		print_pair_value(out, params, "DPD", int2str(tmpbuf, args->user[i]->dpd), "KeepAlive", int2str(tmpbuf2, args->user[i]->keepalive), 1);
+	if (HAVE_JSON(params)) {
+		print_single_value(out, params, "Full session", shorten(u->safe_id.data, u->safe_id.len, 0), 1);
+#ifdef OCSERV_0_11_6_COMPAT
+		/* compat with previous versions */
+		print_single_value(out, params, "Raw cookie", shorten(u->safe_id.data, u->safe_id.len, 0), 1);
+		print_single_value(out, params, "Cookie", shorten(u->safe_id.data, u->safe_id.len, 1), 1);
+#endif
+	}
+	print_single_value(out, params, "Session", shorten(u->safe_id.data, u->safe_id.len, 1), 1);
 
-		print_single_value(out, params, "Hostname", args->user[i]->hostname, 1);
+	print_single_value(out, params, "TLS ciphersuite", u->tls_ciphersuite, 1);
+	print_single_value(out, params, "DTLS cipher", u->dtls_ciphersuite, 1);
+	print_pair_value(out, params, "CSTP compression", u->cstp_compr, "DTLS compression", u->dtls_compr, 1);
 
-		print_time_ival7(tmpbuf, time(0), t);
-		print_single_value_ex(out, params, "Connected at", str_since, tmpbuf, 1);
+	print_separator(out, params);
+	/* user network info */
+	if (print_list_entries(out, params, "DNS", u->dns, u->n_dns, 1) < 0)
+		goto error_parse;
 
-		if (HAVE_JSON(params)) {
-			print_single_value(out, params, "Full session", shorten(args->user[i]->safe_id.data, args->user[i]->safe_id.len, 0), 1);
-#ifdef OCSERV_0_11_6_COMPAT
-			/* compat with previous versions */
-			print_single_value(out, params, "Raw cookie", shorten(args->user[i]->safe_id.data, args->user[i]->safe_id.len, 0), 1);
-			print_single_value(out, params, "Cookie", shorten(args->user[i]->safe_id.data, args->user[i]->safe_id.len, 1), 1);
-#endif
-		}
-		print_single_value(out, params, "Session", shorten(args->user[i]->safe_id.data, args->user[i]->safe_id.len, 1), 1);
+	if (print_list_entries(out, params, "NBNS", u->nbns, u->n_nbns, 1) < 0)
+		goto error_parse;
 
-		print_single_value(out, params, "TLS ciphersuite", args->user[i]->tls_ciphersuite, 1);
-		print_single_value(out, params, "DTLS cipher", args->user[i]->dtls_ciphersuite, 1);
-		print_pair_value(out, params, "CSTP compression", args->user[i]->cstp_compr, "DTLS compression", args->user[i]->dtls_compr, 1);
+	if (print_list_entries(out, params, "Split-DNS-Domains", u->domains, u->n_domains, 1) < 0)
+		goto error_parse;
 
-		print_separator(out, params);
-		/* user network info */
-		if (print_list_entries(out, params, "DNS", args->user[i]->dns, args->user[i]->n_dns, 1) < 0)
-			goto error_parse;
+	if ((r = print_list_entries(out, params, "Routes", u->routes, u->n_routes, 1)) < 0)
+		goto error_parse;
+	if (r == 0) {
+		print_single_value(out, params, "Routes", "defaultroute", 1);
+	}
 
-		if (print_list_entries(out, params, "NBNS", args->user[i]->nbns, args->user[i]->n_nbns, 1) < 0)
-			goto error_parse;
+	if ((r = print_list_entries(out, params, "No-routes", u->no_routes, u->n_no_routes, 1)) < 0)
+		goto error_parse;
 
-		if (print_list_entries(out, params, "Split-DNS-Domains", args->user[i]->domains, args->user[i]->n_domains, 1) < 0)
-			goto error_parse;
+	if (print_list_entries(out, params, "iRoutes", u->iroutes, u->n_iroutes, 1) < 0)
+		goto error_parse;
 
-		if ((r = print_list_entries(out, params, "Routes", args->user[i]->routes, args->user[i]->n_routes, 1)) < 0)
-			goto error_parse;
-		if (r == 0) {
-			print_single_value(out, params, "Routes", "defaultroute", 1);
-		}
+	print_single_value(out, params, "Restricted to routes", u->restrict_to_routes?"True":"False", 1);
 
-		if ((r = print_list_entries(out, params, "No-routes", args->user[i]->no_routes, args->user[i]->n_no_routes, 1)) < 0)
-			goto error_parse;
+	if (print_fwport_entries(out, params, "Restricted to ports", u->fw_ports, u->n_fw_ports, 0) < 0)
+		goto error_parse;
 
-		if (print_list_entries(out, params, "iRoutes", args->user[i]->iroutes, args->user[i]->n_iroutes, 1) < 0)
-			goto error_parse;
+	print_end_block(out, params, have_more);
 
-		print_single_value(out, params, "Restricted to routes", args->user[i]->restrict_to_routes?"True":"False", 1);
+	return 0;
 
-		if (print_fwport_entries(out, params, "Restricted to ports", args->user[i]->fw_ports, args->user[i]->n_fw_ports, 0) < 0)
-			goto error_parse;
+ error_parse:
+	fprintf(stderr, "%s: message parsing error\n", __func__);
+	return -1;
+}
 
-		print_end_block(out, params, i<(args->n_user-1)?1:0);
+/* Prints the users of the list; @printed is the number of the ones
+ * already printed, and @have_more is set if more follow the list */
+static
+int print_user_infos(UserListRep *args, FILE *out, cmd_params_st *params,
+		     unsigned have_more, unsigned *printed)
+{
+	unsigned i;
 
-		at_least_one = 1;
+	for (i=0;i<args->n_user;i++) {
+		if (*printed > 0)
+			fprintf(out, "\n");
+
+		if (print_user_info(args->user[i], out, params, (i<(args->n_user-1) || have_more)?1:0) < 0)
+			return -1;
+
+		(*printed)++;
+	}
+
+	return 0;
+}
+
+static
+int common_info_cmd(UserListRep * args, FILE *out, cmd_params_st *params)
+{
+	unsigned at_least_one = 0;
+	int ret = 1;
+	unsigned init_pager = 0;
+
+	if (out == NULL) {
+		out = pager_start(params);
+		init_pager = 1;
 	}
 
+	if (HAVE_JSON(params))
+		fprintf(out, "[\n");
+
+	if (print_user_infos(args, out, params, 0, &at_least_one) < 0)
+		goto cleanup;
+
 	if (HAVE_JSON(params))
 		fprintf(out, "]\n");
 
 	ret = 0;
-	goto cleanup;
 
- error_parse:
-	fprintf(stderr, "%s: message parsing error\n", __func__);
-	goto cleanup;
  cleanup:
 	if (at_least_one == 0) {
 		if (NO_JSON(params))
@@ -38,6 +38,13 @@ struct find_sid_st {
 	const uint8_t *sid;
 };
 
+/* The sessions of a user */
+struct proc_user_st {
+	char username[MAX_USERNAME_SIZE];
+	struct list_head procs; /* of proc_st */
+	unsigned count;
+};
+
 
 static size_t rehash_ip(const void* _p, void* unused)
 {
@@ -71,16 +78,34 @@ const struct proc_st * proc = _p;
 	return hash_any(proc->sid, sizeof(proc->sid), 0);
 }
 
+static size_t rehash_seq(const void* _p, void* unused)
+{
+const struct proc_st * proc = _p;
+
+	return hash_any(&proc->seq, sizeof(proc->seq), 0);
+}
+
+static size_t rehash_user(const void* _p, void* unused)
+{
+const struct proc_user_st * user = _p;
+
+	return hash_any(user->username, strlen(user->username), 0);
+}
+
 void proc_table_init(main_server_st *s)
 {
 	s->proc_table.db_ip = talloc(s, struct htable);
 	s->proc_table.db_dtls_ip = talloc(s, struct htable);
 	s->proc_table.db_dtls_id = talloc(s, struct htable);
 	s->proc_table.db_sid = talloc(s, struct htable);
+	s->proc_table.db_user = talloc(s, struct htable);
+	s->proc_table.db_seq = talloc(s, struct htable);
 	htable_init(s->proc_table.db_ip, rehash_ip, NULL);
 	htable_init(s->proc_table.db_dtls_ip, rehash_dtls_ip, NULL);
 	htable_init(s->proc_table.db_dtls_id, rehash_dtls_id, NULL);
 	htable_init(s->proc_table.db_sid, rehash_sid, NULL);
+	htable_init(s->proc_table.db_user, rehash_user, NULL);
+	htable_init(s->proc_table.db_seq, rehash_seq, NULL);
 	s->proc_table.total = 0;
 }
 
@@ -90,10 +115,22 @@ void proc_table_deinit(main_server_st *s)
 	htable_clear(s->proc_table.db_dtls_ip);
 	htable_clear(s->proc_table.db_dtls_id);
 	htable_clear(s->proc_table.db_sid);
+	htable_clear(s->proc_table.db_user);
+	htable_clear(s->proc_table.db_seq);
 	talloc_free(s->proc_table.db_ip);
 	talloc_free(s->proc_table.db_dtls_ip);
 	talloc_free(s->proc_table.db_dtls_id);
 	talloc_free(s->proc_table.db_sid);
+	talloc_free(s->proc_table.db_user); /* and the entries */
+	talloc_free(s->proc_table.db_seq);
+}
+
+/* Adds a new session, before it is authenticated, to the seq table */
+int proc_table_add_seq(main_server_st *s, struct proc_st *proc)
+{
+	if (htable_add(s->proc_table.db_seq, rehash_seq(proc, NULL), proc) == 0)
+		return -1;
+	return 0;
 }
 
 /* Adds the IP of the CSTP channel into the IPs hash table and
@@ -176,6 +213,71 @@ int proc_table_update_dtls_ip(main_server_st *s, struct proc_st *proc, struct so
 	return 0;
 }
 
+static bool user_cmp(const void* _c1, void* _c2)
+{
+const struct proc_user_st* c1 = _c1;
+const char *username = _c2;
+
+	return strcmp(c1->username, username) == 0;
+}
+
+static struct proc_user_st *find_user(main_server_st *s, const char *username)
+{
+	return htable_get(s->proc_table.db_user, hash_any(username, strlen(username), 0),
+			  user_cmp, (void*)username);
+}
+
+static void del_user_proc(main_server_st *s, struct proc_st *proc)
+{
+	struct proc_user_st *user = proc->user;
+
+	if (user == NULL)
+		return;
+
+	list_del(&proc->user_list);
+	proc->user = NULL;
+
+	if (--user->count == 0) {
+		htable_del(s->proc_table.db_user, rehash_user(user, NULL), user);
+		talloc_free(user);
+	}
+}
+
+/* Adds the session to the sessions of its user. That is done once its
+ * username is known, and before it is added to the other tables.
+ */
+int proc_table_update_user(main_server_st *s, struct proc_st *proc)
+{
+	struct proc_user_st *user;
+
+	del_user_proc(s, proc);
+
+	if (proc->username[0] == 0)
+		return 0;
+
+	user = find_user(s, proc->username);
+	if (user == NULL) {
+		user = talloc(s->proc_table.db_user, struct proc_user_st);
+		if (user == NULL)
+			return -1;
+
+		strlcpy(user->username, proc->username, sizeof(user->username));
+		list_head_init(&user->procs);
+		user->count = 0;
+
+		if (htable_add(s->proc_table.db_user, rehash_user(user, NULL), user) == 0) {
+			talloc_free(user);
+			return -1;
+		}
+	}
+
+	list_add_tail(&user->procs, &proc->user_list);
+	user->count++;
+	proc->user = user;
+
+	return 0;
+}
+
 void proc_table_del(main_server_st *s, struct proc_st *proc)
 {
 	if (proc->dtls_remote_addr_len > 0)
@@ -184,6 +286,8 @@ void proc_table_del(main_server_st *s, struct proc_st *proc)
 	htable_del(s->proc_table.db_ip, rehash_ip(proc, NULL), proc);
 	htable_del(s->proc_table.db_dtls_id, rehash_dtls_id(proc, NULL), proc);
 	htable_del(s->proc_table.db_sid, rehash_sid(proc, NULL), proc);
+	htable_del(s->proc_table.db_seq, rehash_seq(proc, NULL), proc);
+	del_user_proc(s, proc);
 }
 
 static bool local_ip_cmp(const void* _c1, void* _c2)
@@ -295,3 +399,46 @@ struct proc_st *proc_search_sid(struct main_server_st *s,
 	return htable_get(s->proc_table.db_sid, hash_any(sid, SID_SIZE, 0), sid_cmp, &fsid);
 }
 
+static bool seq_cmp(const void* _c1, void* _c2)
+{
+const struct proc_st* c1 = _c1;
+const uint64_t *seq = _c2;
+
+	return c1->seq == *seq;
+}
+
+struct proc_st *proc_search_seq(struct main_server_st *s, uint64_t seq)
+{
+	return htable_get(s->proc_table.db_seq, hash_any(&seq, sizeof(seq), 0), seq_cmp, &seq);
+}
+
+/* Returns the first session of the user, or NULL */
+struct proc_st *proc_search_user(struct main_server_st *s, const char *username)
+{
+	struct proc_user_st *user = find_user(s, username);
+
+	if (user == NULL)
+		return NULL;
+
+	return list_top(&user->procs, struct proc_st, user_list);
+}
+
+/* Returns the session of the same user following @proc, or NULL. It is
+ * to be called before @proc is removed. */
+struct proc_st *proc_search_user_next(struct main_server_st *s, struct proc_st *proc)
+{
+	if (proc->user == NULL || proc->user_list.next == &proc->user->procs.n)
+		return NULL;
+
+	return container_of(proc->user_list.next, struct proc_st, user_list);
+}
+
+unsigned proc_count_user(struct main_server_st *s, const char *username)
+{
+	struct proc_user_st *user = find_user(s, username);
+
+	if (user == NULL)
+		return 0;
+
+	return user->count;
+}
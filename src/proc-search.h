@@ -33,11 +33,17 @@ struct proc_st *proc_search_single_ip(struct main_server_st *s,
 struct proc_st *proc_search_dtls_id(struct main_server_st *s, const uint8_t *id, unsigned id_size);
 struct proc_st *proc_search_sid(struct main_server_st *s,
 			        const uint8_t id[SID_SIZE]);
+struct proc_st *proc_search_seq(struct main_server_st *s, uint64_t seq);
+struct proc_st *proc_search_user(struct main_server_st *s, const char *username);
+struct proc_st *proc_search_user_next(struct main_server_st *s, struct proc_st *proc);
+unsigned proc_count_user(struct main_server_st *s, const char *username);
 
 void proc_table_init(main_server_st *s);
 void proc_table_deinit(main_server_st *s);
 int proc_table_add(main_server_st *s, struct proc_st *proc);
+int proc_table_add_seq(main_server_st *s, struct proc_st *proc);
 void proc_table_del(main_server_st *s, struct proc_st *proc);
+int proc_table_update_user(main_server_st *s, struct proc_st *proc);
 int proc_table_update_ip(main_server_st *s, struct proc_st *proc, struct sockaddr_storage *addr, unsigned addr_size);
 int proc_table_update_dtls_ip(main_server_st *s, struct proc_st *proc, struct sockaddr_storage *addr, unsigned addr_size);
 
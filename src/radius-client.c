@@ -0,0 +1,927 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <talloc.h>
+#include <nettle/md5.h>
+#include <nettle/hmac.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <cloexec.h>
+#include <common.h>
+#include <gettime.h>
+#include <radius-client.h>
+
+#define HEADER_SIZE 20
+#define AUTH_OFFSET 4
+#define MAX_IDS 256
+
+typedef struct rad_server_st {
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char *secret;
+	unsigned secret_len;
+	int fd;
+
+	rad_req_st *inflight[MAX_IDS];
+	unsigned outstanding;
+	unsigned next_id;
+
+	unsigned score;
+	unsigned dead;
+	uint64_t dead_until;
+
+	unsigned long requests;
+	unsigned long timeouts;
+} rad_server_st;
+
+struct rad_client_st {
+	struct list_node list;
+
+	rad_server_st servers[RAD_MAX_SERVERS];
+	unsigned servers_size;
+
+	unsigned timeout_ms;
+	unsigned retries;
+	unsigned dead_secs;
+	/* whether the Access-Accept and Access-Reject replies may lack a
+	 * Message-Authenticator */
+	unsigned no_msg_auth;
+
+	/* the rate limit; a token is needed for each new request */
+	unsigned max_rate;
+	unsigned tokens;
+	uint64_t last_refill;
+
+	struct list_head queue;
+	unsigned queued;
+
+	/* the completed requests, whose done() is pending */
+	struct list_head done;
+};
+
+struct rad_req_st {
+	struct list_node list;
+	rad_client_st *c;
+
+	unsigned code;
+	uint8_t attrs[RAD_MAX_PACKET_SIZE];
+	unsigned attrs_size;
+	char password[RAD_MAX_PASSWORD_SIZE];
+	unsigned password_len;
+
+	rad_done_func done;
+	void *priv;
+
+	/* the current transmission */
+	int server;
+	unsigned id;
+	uint8_t packet[RAD_MAX_PACKET_SIZE];
+	unsigned packet_size;
+	unsigned tries;
+	unsigned tried; /* a bit for each server that failed */
+	unsigned sent; /* whether the token was taken */
+	uint64_t deadline;
+
+	/* the result */
+	unsigned finished;
+	unsigned waiting; /* completed by its caller rather than the client */
+	int status;
+	uint8_t *reply;
+	unsigned reply_size;
+};
+
+static LIST_HEAD(rad_clients);
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	gettime_mono(&ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int client_destructor(rad_client_st *c)
+{
+	unsigned i;
+
+	list_del(&c->list);
+	for (i = 0; i < c->servers_size; i++) {
+		if (c->servers[i].fd != -1)
+			close(c->servers[i].fd);
+	}
+	/* the requests are released with the client, without completion */
+	return 0;
+}
+
+rad_client_st *rad_client_new(void *pool, unsigned timeout_ms, unsigned retries,
+			      unsigned dead_secs, unsigned max_rate)
+{
+	rad_client_st *c;
+
+	c = talloc_zero(pool, rad_client_st);
+	if (c == NULL)
+		return NULL;
+
+	c->timeout_ms = timeout_ms;
+	c->retries = retries;
+	c->dead_secs = dead_secs;
+	c->max_rate = max_rate;
+	c->tokens = max_rate;
+	c->last_refill = now_ms();
+	list_head_init(&c->queue);
+	list_head_init(&c->done);
+
+	list_add_tail(&rad_clients, &c->list);
+	talloc_set_destructor(c, client_destructor);
+
+	return c;
+}
+
+void rad_client_allow_no_msg_auth(rad_client_st *c, unsigned allow)
+{
+	c->no_msg_auth = allow;
+}
+
+int rad_client_add_server(rad_client_st *c, const char *host, unsigned port,
+			  unsigned default_port, const char *secret)
+{
+	struct addrinfo hints, *res = NULL;
+	rad_server_st *s;
+	char service[8];
+	int ret, e;
+
+	if (c->servers_size >= RAD_MAX_SERVERS) {
+		syslog(LOG_ERR, "radius: too many servers; ignoring %s", host);
+		return -1;
+	}
+
+	s = &c->servers[c->servers_size];
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+
+	snprintf(service, sizeof(service), "%u", port ? port : default_port);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+
+	ret = getaddrinfo(host, service, &hints, &res);
+	if (ret != 0) {
+		syslog(LOG_ERR, "radius: cannot resolve %s: %s", host, gai_strerror(ret));
+		return -1;
+	}
+
+	s->fd = socket(res->ai_family, SOCK_DGRAM, 0);
+	if (s->fd == -1) {
+		e = errno;
+		syslog(LOG_ERR, "radius: cannot create socket: %s", strerror(e));
+		goto fail;
+	}
+	set_cloexec_flag(s->fd, 1);
+	set_non_block(s->fd);
+
+	/* only replies from the server are received */
+	if (connect(s->fd, res->ai_addr, res->ai_addrlen) == -1) {
+		e = errno;
+		syslog(LOG_ERR, "radius: cannot connect to %s: %s", host, strerror(e));
+		goto fail;
+	}
+
+	memcpy(&s->addr, res->ai_addr, res->ai_addrlen);
+	s->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	res = NULL;
+
+	s->name = talloc_asprintf(c, "%s:%s", host, service);
+	s->secret = talloc_strdup(c, secret);
+	if (s->name == NULL || s->secret == NULL)
+		goto fail;
+	s->secret_len = strlen(secret);
+	s->score = 100;
+
+	c->servers_size++;
+	return 0;
+
+ fail:
+	if (res != NULL)
+		freeaddrinfo(res);
+	if (s->fd != -1)
+		close(s->fd);
+	s->fd = -1;
+	return -1;
+}
+
+unsigned rad_client_servers(rad_client_st *c)
+{
+	return c->servers_size;
+}
+
+void rad_client_server_stats(rad_client_st *c, unsigned idx, rad_server_stats_st *st)
+{
+	rad_server_st *s = &c->servers[idx];
+
+	st->name = s->name;
+	st->score = s->score;
+	st->dead = s->dead;
+	st->outstanding = s->outstanding;
+	st->requests = s->requests;
+	st->timeouts = s->timeouts;
+}
+
+unsigned rad_client_queued(rad_client_st *c)
+{
+	return c->queued;
+}
+
+static int req_destructor(rad_req_st *r)
+{
+	safe_memset(r->password, 0, sizeof(r->password));
+	safe_memset(r->packet, 0, r->packet_size);
+	return 0;
+}
+
+rad_req_st *rad_req_new(rad_client_st *c, unsigned code)
+{
+	rad_req_st *r;
+
+	r = talloc_zero(c, rad_req_st);
+	if (r == NULL)
+		return NULL;
+
+	r->c = c;
+	r->code = code;
+	r->server = -1;
+	talloc_set_destructor(r, req_destructor);
+
+	return r;
+}
+
+int rad_req_add(rad_req_st *r, unsigned type, const void *data, unsigned len)
+{
+	/* the room for the password and the message authenticator */
+	if (len > 253 || r->attrs_size + len + 2 + 2*(2+RAD_MAX_PASSWORD_SIZE) >
+	    RAD_MAX_PACKET_SIZE - HEADER_SIZE)
+		return -1;
+
+	r->attrs[r->attrs_size++] = type;
+	r->attrs[r->attrs_size++] = len + 2;
+	memcpy(&r->attrs[r->attrs_size], data, len);
+	r->attrs_size += len;
+
+	return 0;
+}
+
+int rad_req_add_raw(rad_req_st *r, const void *attrs, unsigned size)
+{
+	if (r->attrs_size + size + 2*(2+RAD_MAX_PASSWORD_SIZE) >
+	    RAD_MAX_PACKET_SIZE - HEADER_SIZE)
+		return -1;
+
+	memcpy(&r->attrs[r->attrs_size], attrs, size);
+	r->attrs_size += size;
+
+	return 0;
+}
+
+const uint8_t *rad_req_attrs(rad_req_st *r, unsigned *size)
+{
+	*size = r->attrs_size;
+	return r->attrs;
+}
+
+int rad_req_add_str(rad_req_st *r, unsigned type, const char *str)
+{
+	return rad_req_add(r, type, str, strlen(str));
+}
+
+int rad_req_add_int(rad_req_st *r, unsigned type, uint32_t v)
+{
+	v = htonl(v);
+	return rad_req_add(r, type, &v, sizeof(v));
+}
+
+int rad_req_add_vendor(rad_req_st *r, unsigned vendor, unsigned type,
+		       const void *data, unsigned len)
+{
+	uint8_t vsa[255];
+
+	if (len > 247)
+		return -1;
+
+	vsa[0] = 0;
+	vsa[1] = (vendor >> 16) & 0xff;
+	vsa[2] = (vendor >> 8) & 0xff;
+	vsa[3] = vendor & 0xff;
+	vsa[4] = type;
+	vsa[5] = len + 2;
+	memcpy(&vsa[6], data, len);
+
+	return rad_req_add(r, RAD_ATTR_VENDOR_SPECIFIC, vsa, len + 6);
+}
+
+int rad_req_set_password(rad_req_st *r, const char *pass, unsigned pass_len)
+{
+	if (pass_len > RAD_MAX_PASSWORD_SIZE)
+		return -1;
+
+	memcpy(r->password, pass, pass_len);
+	r->password_len = pass_len;
+	return 0;
+}
+
+/* RFC2865 section 5.2 */
+static void hide_password(rad_req_st *r, rad_server_st *s, uint8_t *out, unsigned *out_len)
+{
+	struct md5_ctx ctx;
+	uint8_t digest[MD5_DIGEST_SIZE];
+	const uint8_t *prev = &r->packet[AUTH_OFFSET];
+	unsigned len, i, j;
+
+	len = (r->password_len + 15) & ~15;
+	if (len == 0)
+		len = 16;
+
+	memset(out, 0, len);
+	memcpy(out, r->password, r->password_len);
+
+	for (i = 0; i < len; i += 16) {
+		md5_init(&ctx);
+		md5_update(&ctx, s->secret_len, (uint8_t *)s->secret);
+		md5_update(&ctx, 16, prev);
+		md5_digest(&ctx, sizeof(digest), digest);
+
+		for (j = 0; j < 16; j++)
+			out[i + j] ^= digest[j];
+		prev = &out[i];
+	}
+
+	*out_len = len;
+}
+
+static void append_attr(rad_req_st *r, unsigned type, const uint8_t *data, unsigned len)
+{
+	r->packet[r->packet_size++] = type;
+	r->packet[r->packet_size++] = len + 2;
+	memcpy(&r->packet[r->packet_size], data, len);
+	r->packet_size += len;
+}
+
+/* Builds the packet for the server; the request authenticator and the
+ * hidden password depend on its secret */
+static int build_packet(rad_req_st *r, rad_server_st *s)
+{
+	struct md5_ctx ctx;
+	struct hmac_md5_ctx hctx;
+	uint8_t buf[RAD_MAX_PASSWORD_SIZE];
+	unsigned len, ma_offset = 0;
+	uint16_t l16;
+
+	r->packet[0] = r->code;
+	r->packet[1] = r->id;
+	r->packet_size = HEADER_SIZE;
+	memcpy(&r->packet[HEADER_SIZE], r->attrs, r->attrs_size);
+	r->packet_size += r->attrs_size;
+
+	if (r->code == RAD_CODE_ACCESS_REQUEST) {
+		if (gnutls_rnd(GNUTLS_RND_NONCE, &r->packet[AUTH_OFFSET], 16) < 0)
+			return -1;
+
+		if (r->password_len > 0) {
+			hide_password(r, s, buf, &len);
+			append_attr(r, RAD_ATTR_USER_PASSWORD, buf, len);
+			safe_memset(buf, 0, sizeof(buf));
+		}
+
+		/* RFC3579; protects the request from forgery */
+		memset(buf, 0, 16);
+		ma_offset = r->packet_size + 2;
+		append_attr(r, RAD_ATTR_MESSAGE_AUTHENTICATOR, buf, 16);
+	} else {
+		memset(&r->packet[AUTH_OFFSET], 0, 16);
+	}
+
+	l16 = htons(r->packet_size);
+	memcpy(&r->packet[2], &l16, 2);
+
+	if (ma_offset != 0) {
+		hmac_md5_set_key(&hctx, s->secret_len, (uint8_t *)s->secret);
+		hmac_md5_update(&hctx, r->packet_size, r->packet);
+		hmac_md5_digest(&hctx, 16, &r->packet[ma_offset]);
+	}
+
+	/* RFC2866 section 3 */
+	if (r->code != RAD_CODE_ACCESS_REQUEST) {
+		md5_init(&ctx);
+		md5_update(&ctx, r->packet_size, r->packet);
+		md5_update(&ctx, s->secret_len, (uint8_t *)s->secret);
+		md5_digest(&ctx, 16, &r->packet[AUTH_OFFSET]);
+	}
+
+	return 0;
+}
+
+static void update_score(rad_client_st *c, rad_server_st *s, unsigned ok, uint64_t now)
+{
+	if (ok) {
+		s->score = (s->score + 100) / 2;
+		return;
+	}
+
+	s->timeouts++;
+	s->score /= 2;
+
+	if (s->score < RAD_DEAD_SCORE && c->dead_secs > 0 && !s->dead) {
+		syslog(LOG_NOTICE, "radius: server %s is not responding; skipping it for %u secs",
+		       s->name, c->dead_secs);
+		s->dead = 1;
+		s->dead_until = now + c->dead_secs * 1000;
+	}
+}
+
+/* Returns the first usable server not tried by the request; when all are
+ * dead the one to be revived first is returned. */
+static int select_server(rad_client_st *c, unsigned tried, uint64_t now)
+{
+	rad_server_st *s;
+	int best = -1;
+	unsigned i;
+
+	for (i = 0; i < c->servers_size; i++) {
+		s = &c->servers[i];
+
+		if ((tried & (1 << i)) || s->outstanding >= MAX_IDS)
+			continue;
+
+		if (s->dead && now >= s->dead_until) {
+			syslog(LOG_INFO, "radius: retrying server %s", s->name);
+			s->dead = 0;
+			s->score = RAD_PROBE_SCORE;
+		}
+
+		if (!s->dead)
+			return i;
+
+		if (best == -1 || s->dead_until < c->servers[best].dead_until)
+			best = i;
+	}
+
+	return best;
+}
+
+static void complete(rad_req_st *r, int status)
+{
+	r->status = status;
+	r->finished = 1;
+
+	if (!r->waiting)
+		list_add_tail(&r->c->done, &r->list);
+}
+
+static void transmit(rad_req_st *r, uint64_t now)
+{
+	rad_server_st *s = &r->c->servers[r->server];
+	int ret;
+
+	r->deadline = now + r->c->timeout_ms;
+
+	ret = send(s->fd, r->packet, r->packet_size, 0);
+	if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		int e = errno;
+		/* handled as a lost packet */
+		syslog(LOG_DEBUG, "radius: error sending to %s: %s", s->name, strerror(e));
+	}
+}
+
+/* Sends the request to the server with a new identifier */
+static int start(rad_req_st *r, int server, uint64_t now)
+{
+	rad_server_st *s = &r->c->servers[server];
+	unsigned i, id;
+
+	for (i = 0; i < MAX_IDS; i++) {
+		id = (s->next_id + i) % MAX_IDS;
+		if (s->inflight[id] == NULL)
+			break;
+	}
+	if (i == MAX_IDS)
+		return -1;
+	s->next_id = (id + 1) % MAX_IDS;
+
+	r->server = server;
+	r->id = id;
+	r->tries = 0;
+
+	if (build_packet(r, s) < 0)
+		return -1;
+
+	s->inflight[id] = r;
+	s->outstanding++;
+	s->requests++;
+
+	transmit(r, now);
+	return 0;
+}
+
+static void refill_tokens(rad_client_st *c, uint64_t now)
+{
+	uint64_t add;
+
+	if (c->max_rate == 0)
+		return;
+
+	add = (now - c->last_refill) * c->max_rate / 1000;
+	if (add > 0) {
+		c->tokens = (c->tokens + add > c->max_rate) ? c->max_rate : c->tokens + add;
+		c->last_refill = now;
+	}
+}
+
+static void start_queued(rad_client_st *c, uint64_t now)
+{
+	rad_req_st *r;
+	int server;
+
+	refill_tokens(c, now);
+
+	while ((r = list_top(&c->queue, rad_req_st, list)) != NULL) {
+		if (c->max_rate && !r->sent && c->tokens == 0)
+			break;
+
+		server = select_server(c, r->tried, now);
+		if (server == -1) /* all busy; wait for a reply */
+			break;
+
+		list_del(&r->list);
+		c->queued--;
+
+		if (!r->sent) {
+			r->sent = 1;
+			if (c->max_rate)
+				c->tokens--;
+		}
+
+		if (start(r, server, now) < 0)
+			complete(r, RAD_ERR_SEND);
+	}
+}
+
+static void release_id(rad_req_st *r)
+{
+	rad_server_st *s = &r->c->servers[r->server];
+
+	s->inflight[r->id] = NULL;
+	s->outstanding--;
+}
+
+static void check_timeouts(rad_client_st *c, uint64_t now)
+{
+	rad_server_st *s;
+	rad_req_st *r;
+	unsigned i, id, n;
+
+	for (i = 0; i < c->servers_size; i++) {
+		s = &c->servers[i];
+
+		for (id = 0, n = 0; id < MAX_IDS && n < s->outstanding; id++) {
+			r = s->inflight[id];
+			if (r == NULL)
+				continue;
+			n++;
+
+			if (now < r->deadline)
+				continue;
+
+			update_score(c, s, 0, now);
+
+			if (r->tries < c->retries) {
+				r->tries++;
+				transmit(r, now);
+				continue;
+			}
+
+			release_id(r);
+			n--;
+
+			r->tried |= 1 << i;
+			if (r->tried == (1U << c->servers_size) - 1) {
+				complete(r, RAD_ERR_TIMEOUT);
+				continue;
+			}
+
+			/* fail over to the next server */
+			list_add(&c->queue, &r->list);
+			c->queued++;
+		}
+	}
+}
+
+static int verify_reply(rad_req_st *r, rad_server_st *s, uint8_t *pkt, unsigned len)
+{
+	struct md5_ctx ctx;
+	struct hmac_md5_ctx hctx;
+	uint8_t auth[16], digest[16], mac[16];
+	unsigned pos, alen, found = 0;
+
+	memcpy(auth, &pkt[AUTH_OFFSET], 16);
+
+	/* RFC2865 section 3, Response Authenticator */
+	md5_init(&ctx);
+	md5_update(&ctx, AUTH_OFFSET, pkt);
+	md5_update(&ctx, 16, &r->packet[AUTH_OFFSET]);
+	md5_update(&ctx, len - HEADER_SIZE, &pkt[HEADER_SIZE]);
+	md5_update(&ctx, s->secret_len, (uint8_t *)s->secret);
+	md5_digest(&ctx, 16, digest);
+
+	if (memcmp(digest, auth, 16) != 0)
+		return -1;
+
+	for (pos = HEADER_SIZE; pos + 2 <= len; pos += alen) {
+		alen = pkt[pos + 1];
+		if (alen < 2 || pos + alen > len)
+			return -1;
+
+		if (pkt[pos] == RAD_ATTR_MESSAGE_AUTHENTICATOR) {
+			if (alen != 18)
+				return -1;
+
+			/* calculated with the request authenticator and a
+			 * zero attribute value */
+			memcpy(mac, &pkt[pos + 2], 16);
+			memset(&pkt[pos + 2], 0, 16);
+			memcpy(&pkt[AUTH_OFFSET], &r->packet[AUTH_OFFSET], 16);
+
+			hmac_md5_set_key(&hctx, s->secret_len, (uint8_t *)s->secret);
+			hmac_md5_update(&hctx, len, pkt);
+			hmac_md5_digest(&hctx, 16, digest);
+
+			memcpy(&pkt[pos + 2], mac, 16);
+			memcpy(&pkt[AUTH_OFFSET], auth, 16);
+
+			if (memcmp(digest, mac, 16) != 0)
+				return -1;
+			found = 1;
+		}
+	}
+
+	/* without it the Response Authenticator alone can be forged
+	 * by an attacker on the path (Blast-RADIUS) */
+	if (!found && !r->c->no_msg_auth &&
+	    (pkt[0] == RAD_CODE_ACCESS_ACCEPT || pkt[0] == RAD_CODE_ACCESS_REJECT)) {
+		syslog(LOG_WARNING, "radius: reply from %s has no Message-Authenticator", s->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static unsigned expected_code(rad_req_st *r, unsigned code)
+{
+	if (r->code == RAD_CODE_ACCESS_REQUEST)
+		return code == RAD_CODE_ACCESS_ACCEPT || code == RAD_CODE_ACCESS_REJECT ||
+		       code == RAD_CODE_ACCESS_CHALLENGE;
+	return code == RAD_CODE_ACCOUNTING_RESPONSE;
+}
+
+static void receive(rad_client_st *c, uint64_t now)
+{
+	uint8_t pkt[RAD_MAX_PACKET_SIZE];
+	rad_server_st *s;
+	rad_req_st *r;
+	unsigned i, len;
+	uint16_t l16;
+	ssize_t ret;
+
+	for (i = 0; i < c->servers_size; i++) {
+		s = &c->servers[i];
+
+		for (;;) {
+			ret = recv(s->fd, pkt, sizeof(pkt), 0);
+			if (ret == -1 && errno == EINTR)
+				continue;
+			if (ret < 0)
+				break;
+
+			if (ret < HEADER_SIZE)
+				continue;
+
+			memcpy(&l16, &pkt[2], 2);
+			len = ntohs(l16);
+			if (len < HEADER_SIZE || len > ret)
+				continue;
+
+			r = s->inflight[pkt[1]];
+			if (r == NULL || !expected_code(r, pkt[0]) ||
+			    verify_reply(r, s, pkt, len) < 0) {
+				syslog(LOG_DEBUG, "radius: ignoring invalid or unexpected reply from %s", s->name);
+				continue;
+			}
+
+			update_score(c, s, 1, now);
+			release_id(r);
+
+			r->reply = talloc_memdup(r, pkt, len);
+			if (r->reply == NULL) {
+				complete(r, RAD_ERR_SEND);
+				continue;
+			}
+			r->reply_size = len;
+
+			complete(r, RAD_OK);
+		}
+	}
+}
+
+static void run_client(rad_client_st *c)
+{
+	uint64_t now = now_ms();
+
+	receive(c, now);
+	check_timeouts(c, now);
+	start_queued(c, now);
+}
+
+static void call_done(rad_req_st *r)
+{
+	rad_reply_st reply;
+
+	if (r->done != NULL) {
+		if (r->status == RAD_OK) {
+			reply.code = r->reply[0];
+			reply.data = r->reply;
+			reply.size = r->reply_size;
+			r->done(r->priv, RAD_OK, &reply);
+		} else {
+			r->done(r->priv, r->status, NULL);
+		}
+	}
+}
+
+int rad_req_send(rad_req_st *r, rad_done_func done, void *priv)
+{
+	rad_client_st *c = r->c;
+
+	if (c->queued >= RAD_MAX_QUEUED || c->servers_size == 0) {
+		talloc_free(r);
+		return RAD_ERR_BUSY;
+	}
+
+	r->done = done;
+	r->priv = priv;
+
+	list_add_tail(&c->queue, &r->list);
+	c->queued++;
+
+	start_queued(c, now_ms());
+	return 0;
+}
+
+static int client_timeout(rad_client_st *c, unsigned ignore_done)
+{
+	rad_server_st *s;
+	rad_req_st *r;
+	uint64_t now = now_ms(), next = UINT64_MAX;
+	unsigned i, id;
+
+	if (!ignore_done && !list_empty(&c->done))
+		return 0;
+
+	for (i = 0; i < c->servers_size; i++) {
+		s = &c->servers[i];
+		if (s->outstanding == 0)
+			continue;
+
+		for (id = 0; id < MAX_IDS; id++) {
+			r = s->inflight[id];
+			if (r != NULL && r->deadline < next)
+				next = r->deadline;
+		}
+	}
+
+	/* waiting for a token */
+	if (c->max_rate && !list_empty(&c->queue) && c->tokens == 0) {
+		if (c->last_refill + 1000 / c->max_rate + 1 < next)
+			next = c->last_refill + 1000 / c->max_rate + 1;
+	}
+
+	if (next == UINT64_MAX)
+		return -1;
+	if (next <= now)
+		return 0;
+	return next - now;
+}
+
+int rad_reply_next(const rad_reply_st *reply, rad_attr_st *a)
+{
+	unsigned pos, len;
+	const uint8_t *p;
+
+	if (a->pos == 0)
+		a->pos = HEADER_SIZE;
+
+	pos = a->pos;
+	if (pos + 2 > reply->size)
+		return 0;
+
+	p = &reply->data[pos];
+	len = p[1];
+	if (len < 2 || pos + len > reply->size)
+		return 0;
+
+	a->pos += len;
+	a->vendor = 0;
+	a->type = p[0];
+	a->data = &p[2];
+	a->len = len - 2;
+
+	if (a->type == RAD_ATTR_VENDOR_SPECIFIC && a->len >= 6 &&
+	    p[7] >= 2 && p[7] <= a->len - 4) {
+		a->vendor = ((unsigned)p[3] << 16) | ((unsigned)p[4] << 8) | p[5];
+		a->type = p[6];
+		a->data = &p[8];
+		a->len = p[7] - 2;
+	}
+
+	return 1;
+}
+
+unsigned rad_clients_pollfd_size(void)
+{
+	rad_client_st *c;
+	unsigned n = 0;
+
+	list_for_each(&rad_clients, c, list) {
+		n += c->servers_size;
+	}
+
+	return n;
+}
+
+unsigned rad_clients_fill_pollfd(struct pollfd *pfd)
+{
+	rad_client_st *c;
+	unsigned i, n = 0;
+
+	list_for_each(&rad_clients, c, list) {
+		for (i = 0; i < c->servers_size; i++) {
+			pfd[n].fd = c->servers[i].fd;
+			pfd[n].events = POLLIN;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+int rad_clients_timeout(void)
+{
+	rad_client_st *c;
+	int t, ret = -1;
+
+	list_for_each(&rad_clients, c, list) {
+		t = client_timeout(c, 0);
+		if (t != -1 && (ret == -1 || t < ret))
+			ret = t;
+	}
+
+	return ret;
+}
+
+void rad_clients_process(void)
+{
+	rad_client_st *c;
+	rad_req_st *r;
+
+	list_for_each(&rad_clients, c, list) {
+		run_client(c);
+
+		while ((r = list_top(&c->done, rad_req_st, list)) != NULL) {
+			list_del(&r->list);
+			call_done(r);
+			talloc_free(r);
+		}
+	}
+}
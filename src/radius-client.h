@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RADIUS_CLIENT_H
+# define RADIUS_CLIENT_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <ccan/list/list.h>
+
+/* A non-blocking radius client (RFC2865, RFC2866), driven by the event
+ * loop of sec-mod. Each server is served by a single UDP socket, so up
+ * to 256 requests may be outstanding per server, matched to their replies
+ * by the identifier. The requests exceeding the rate limit, or finding
+ * all the servers busy, are queued.
+ *
+ * The server in use is the first of the configured ones which is not
+ * considered dead. Each server has a health score, which is an average
+ * of the outcome of its recent requests (100 for a reply, 0 for a
+ * timeout). A server whose score drops below RAD_DEAD_SCORE is skipped
+ * for the configured dead time, and is then retried with RAD_PROBE_SCORE.
+ */
+
+#define RAD_CODE_ACCESS_REQUEST 1
+#define RAD_CODE_ACCESS_ACCEPT 2
+#define RAD_CODE_ACCESS_REJECT 3
+#define RAD_CODE_ACCOUNTING_REQUEST 4
+#define RAD_CODE_ACCOUNTING_RESPONSE 5
+#define RAD_CODE_ACCESS_CHALLENGE 11
+
+#define RAD_ATTR_USER_NAME 1
+#define RAD_ATTR_USER_PASSWORD 2
+#define RAD_ATTR_NAS_IP_ADDRESS 4
+#define RAD_ATTR_NAS_PORT 5
+#define RAD_ATTR_REPLY_MESSAGE 18
+#define RAD_ATTR_VENDOR_SPECIFIC 26
+#define RAD_ATTR_NAS_IDENTIFIER 32
+#define RAD_ATTR_MESSAGE_AUTHENTICATOR 80
+#define RAD_ATTR_NAS_IPV6_ADDRESS 95
+
+#define RAD_MAX_PACKET_SIZE 4096
+#define RAD_MAX_PASSWORD_SIZE 128
+#define RAD_MAX_SERVERS 8
+
+/* the requests queued over the outstanding ones */
+#define RAD_MAX_QUEUED 4096
+
+#define RAD_DEAD_SCORE 30
+#define RAD_PROBE_SCORE 50
+
+/* the status passed to the completion function */
+#define RAD_OK 0
+#define RAD_ERR_TIMEOUT -1
+#define RAD_ERR_SEND -2
+#define RAD_ERR_BUSY -3
+#define RAD_ERR_CANCELLED -4
+
+typedef struct rad_client_st rad_client_st;
+typedef struct rad_req_st rad_req_st;
+
+typedef struct rad_reply_st {
+	unsigned code;
+	const uint8_t *data; /* the packet */
+	unsigned size;
+} rad_reply_st;
+
+/* An attribute of a reply; a vendor-specific attribute is returned with
+ * the vendor id and type of its first sub-attribute. */
+typedef struct rad_attr_st {
+	unsigned vendor;
+	unsigned type;
+	const uint8_t *data;
+	unsigned len;
+
+	unsigned pos; /* iterator position */
+} rad_attr_st;
+
+/* Called from rad_clients_process(); reply is set on RAD_OK and is only
+ * valid during the call. */
+typedef void (*rad_done_func)(void *priv, int status, const rad_reply_st *reply);
+
+typedef struct rad_server_stats_st {
+	const char *name;
+	unsigned score;
+	unsigned dead; /* whether it is skipped */
+	unsigned outstanding;
+	unsigned long requests;
+	unsigned long timeouts;
+} rad_server_stats_st;
+
+/* @timeout_ms: the time to wait for each reply
+ * @retries: the retransmissions to each server before failing over
+ * @dead_secs: the time a server with a low score is skipped
+ * @max_rate: the maximum new requests per second; zero for no limit
+ */
+rad_client_st *rad_client_new(void *pool, unsigned timeout_ms, unsigned retries,
+			      unsigned dead_secs, unsigned max_rate);
+
+/* Accepts the Access-Accept and Access-Reject replies which have no
+ * Message-Authenticator, for servers which do not send it. */
+void rad_client_allow_no_msg_auth(rad_client_st *c, unsigned allow);
+
+/* Adds a server; the order is the order of preference. @port may be
+ * zero for the default of the client's requests. */
+int rad_client_add_server(rad_client_st *c, const char *host, unsigned port,
+			  unsigned default_port, const char *secret);
+
+unsigned rad_client_servers(rad_client_st *c);
+void rad_client_server_stats(rad_client_st *c, unsigned idx, rad_server_stats_st *st);
+unsigned rad_client_queued(rad_client_st *c);
+
+rad_req_st *rad_req_new(rad_client_st *c, unsigned code);
+int rad_req_add(rad_req_st *r, unsigned type, const void *data, unsigned len);
+int rad_req_add_str(rad_req_st *r, unsigned type, const char *str);
+int rad_req_add_int(rad_req_st *r, unsigned type, uint32_t v);
+int rad_req_add_vendor(rad_req_st *r, unsigned vendor, unsigned type,
+		       const void *data, unsigned len);
+/* The attributes added so far, in their wire format; they can be stored,
+ * and added to another request with rad_req_add_raw(). */
+const uint8_t *rad_req_attrs(rad_req_st *r, unsigned *size);
+int rad_req_add_raw(rad_req_st *r, const void *attrs, unsigned size);
+/* The password is hidden with each server's secret when sent */
+int rad_req_set_password(rad_req_st *r, const char *pass, unsigned pass_len);
+
+/* Submits the request, and releases it once done() is called. On failure
+ * a negative status is returned, done() is not called and the request
+ * is released. */
+int rad_req_send(rad_req_st *r, rad_done_func done, void *priv);
+
+/* Iterates over the attributes of a reply; @a must be zeroed before the
+ * first call. Returns zero when no more attributes are present. */
+int rad_reply_next(const rad_reply_st *reply, rad_attr_st *a);
+
+/* The clients of the process, driven by its event loop */
+unsigned rad_clients_pollfd_size(void);
+unsigned rad_clients_fill_pollfd(struct pollfd *pfd);
+/* Returns the milliseconds until the next retransmission, or -1 */
+int rad_clients_timeout(void);
+/* Receives the replies, retransmits, sends the queued requests and
+ * calls the completion functions */
+void rad_clients_process(void);
+
+#endif
@@ -30,6 +30,7 @@
 #include <sys/wait.h>
 
 #include <route-add.h>
+#include <route-netlink.h>
 #include <main.h>
 #include <str.h>
 #include <common.h>
@@ -155,6 +156,15 @@ int route_del(struct main_server_st* s, proc_st *proc, const char* route, const
 	return route_adddel(s, proc, GETCONFIG(s)->route_del_cmd, route, dev);
 }
 
+/* Whether the routes are programmed using rtnetlink rather than
+ * the route-add-cmd and route-del-cmd scripts.
+ */
+static unsigned use_netlink(struct main_server_st* s)
+{
+	return (s->nl_fd >= 0 && GETCONFIG(s)->route_add_cmd == NULL &&
+		GETCONFIG(s)->route_del_cmd == NULL);
+}
+
 /* Executes the commands required to apply all the configured routes 
  * for this client locally.
  */
@@ -166,6 +176,14 @@ int ret;
 	if (proc->config->n_iroutes == 0)
 		return 0;
 
+	if (use_netlink(s)) {
+		ret = nl_apply_iroutes(s, proc);
+		if (ret < 0)
+			return -1;
+		proc->applied_iroutes = 1;
+		return 0;
+	}
+
 	for (i=0;i<proc->config->n_iroutes;i++) {
 		ret = route_add(s, proc, proc->config->iroutes[i], proc->tun_lease.name);
 		if (ret < 0)
@@ -191,6 +209,12 @@ unsigned i;
 	if (proc->config == NULL || proc->config->n_iroutes == 0 || proc->applied_iroutes == 0)
 		return;
 
+	if (use_netlink(s)) {
+		nl_remove_iroutes(s, proc);
+		proc->applied_iroutes = 0;
+		return;
+	}
+
 	for (i=0;i<proc->config->n_iroutes;i++) {
 		route_del(s, proc, proc->config->iroutes[i], proc->tun_lease.name);
 	}
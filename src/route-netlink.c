@@ -0,0 +1,711 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Programs the tun device addresses and the iroutes of a session using
+ * rtnetlink. All the messages required for a session are batched into
+ * a single sendmsg(). The acknowledgements are read from the event loop
+ * and matched to their request by sequence number; the session setup
+ * continues in handle_tun_set() once the address setup is acknowledged,
+ * and a failed iroute terminates the session.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <vpn.h>
+#include <main.h>
+#include <ip-lease.h>
+#include <ip-util.h>
+#include <route-netlink.h>
+#include <ccan/hash/hash.h>
+#include <ccan/htable/htable.h>
+#include <ccan/container_of/container_of.h>
+
+#ifdef __linux__
+
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* the time to wait for the kernel's acknowledgements in seconds */
+#define NL_ACK_TIMEOUT 2.0
+
+#define NL_MAX_ADDR_MSGS 4
+
+enum {
+	NL_REQ_ADDR,
+	NL_REQ_IROUTES
+};
+
+struct nl_req_st;
+
+typedef struct nl_ack_st {
+	uint32_t seq;
+	struct nl_req_st *req;
+} nl_ack_st;
+
+/* A batch waiting for its acknowledgements; allocated under the proc
+ * and registered in s->nl_acks by the sequence number of each of its
+ * messages. */
+typedef struct nl_req_st {
+	main_server_st *s;
+	struct proc_st *proc;
+	unsigned type;
+
+	nl_ack_st *acks;
+	unsigned msgs;
+	unsigned pending;
+
+	/* NL_REQ_ADDR */
+	ev_timer timer;
+	int errors[NL_MAX_ADDR_MSGS];
+	int v4, link, v6;
+} nl_req_st;
+
+typedef struct nl_batch_st {
+	uint8_t *data;
+	size_t length;
+	size_t max_length;
+
+	uint32_t first_seq;
+	unsigned msgs;
+} nl_batch_st;
+
+static int nl_batch_init(void *pool, nl_batch_st *b, unsigned msgs)
+{
+	memset(b, 0, sizeof(*b));
+
+	/* enough for a route or address message with two IPv6 addresses */
+	b->max_length = msgs * NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct rtmsg)) + 4 * RTA_SPACE(16));
+	b->data = talloc_zero_size(pool, b->max_length);
+	if (b->data == NULL)
+		return -1;
+	return 0;
+}
+
+static struct nlmsghdr *nl_batch_add(main_server_st *s, nl_batch_st *b,
+				     unsigned type, unsigned flags,
+				     const void *payload, size_t payload_size)
+{
+	struct nlmsghdr *nlh;
+
+	if (b->length + NLMSG_SPACE(payload_size) > b->max_length)
+		return NULL;
+
+	nlh = (struct nlmsghdr *)(b->data + b->length);
+	nlh->nlmsg_len = NLMSG_LENGTH(payload_size);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = ++s->nl_seq;
+	if (nlh->nlmsg_seq == 0) /* 0 is reserved for "none" */
+		nlh->nlmsg_seq = ++s->nl_seq;
+	memcpy(NLMSG_DATA(nlh), payload, payload_size);
+
+	if (b->msgs == 0)
+		b->first_seq = nlh->nlmsg_seq;
+	b->msgs++;
+
+	return nlh;
+}
+
+static int nl_add_attr(nl_batch_st *b, struct nlmsghdr *nlh, unsigned type,
+		       const void *data, size_t size)
+{
+	struct rtattr *rta;
+
+	if (b->length + NLMSG_ALIGN(nlh->nlmsg_len) + RTA_SPACE(size) > b->max_length)
+		return -1;
+
+	rta = (struct rtattr *)(((uint8_t *)nlh) + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(size);
+	memcpy(RTA_DATA(rta), data, size);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_SPACE(size);
+
+	return 0;
+}
+
+/* must be called once all the attributes of the message are added */
+static void nl_batch_close(nl_batch_st *b, struct nlmsghdr *nlh)
+{
+	b->length += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static int nl_batch_send(main_server_st *s, nl_batch_st *b)
+{
+	struct sockaddr_nl sa;
+	struct iovec iov;
+	struct msghdr msg;
+	int ret, e;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	iov.iov_base = b->data;
+	iov.iov_len = b->length;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &sa;
+	msg.msg_namelen = sizeof(sa);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	ret = sendmsg(s->nl_fd, &msg, 0);
+	if (ret < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_ERR, "netlink: sendmsg: %s", strerror(e));
+		return -1;
+	}
+
+	return 0;
+}
+
+static size_t rehash_ack(const void *_p, void *unused)
+{
+	const nl_ack_st *ack = _p;
+
+	return hash_any(&ack->seq, sizeof(ack->seq), 0);
+}
+
+static bool ack_cmp(const void *_p, void *_seq)
+{
+	const nl_ack_st *ack = _p;
+
+	return ack->seq == *(uint32_t *)_seq;
+}
+
+static void nl_timer_cb(EV_P_ ev_timer *w, int revents);
+
+static int nl_req_destructor(nl_req_st *req)
+{
+	unsigned i;
+
+	for (i = 0; i < req->msgs; i++)
+		if (req->acks[i].seq != 0)
+			htable_del(req->s->nl_acks, rehash_ack(&req->acks[i], NULL), &req->acks[i]);
+
+	if (req->type == NL_REQ_ADDR)
+		ev_timer_stop(loop, &req->timer);
+
+	if (req->proc->nl_req == req)
+		req->proc->nl_req = NULL;
+
+	return 0;
+}
+
+/* Registers the messages of @b to be waited for by the proc */
+static nl_req_st *nl_req_new(main_server_st *s, struct proc_st *proc,
+			     unsigned type, nl_batch_st *b)
+{
+	nl_req_st *req;
+	unsigned i;
+
+	req = talloc_zero(proc, nl_req_st);
+	if (req == NULL)
+		return NULL;
+
+	req->acks = talloc_array(req, nl_ack_st, b->msgs);
+	if (req->acks == NULL) {
+		talloc_free(req);
+		return NULL;
+	}
+
+	req->s = s;
+	req->proc = proc;
+	req->type = type;
+	if (type == NL_REQ_ADDR)
+		ev_timer_init(&req->timer, nl_timer_cb, NL_ACK_TIMEOUT, 0);
+	talloc_set_destructor(req, nl_req_destructor);
+
+	for (i = 0; i < b->msgs; i++) {
+		/* nl_batch_add() skips the 0 sequence number on wrap */
+		req->acks[i].seq = b->first_seq + i;
+		if (req->acks[i].seq < b->first_seq)
+			req->acks[i].seq++;
+		req->acks[i].req = req;
+		if (htable_add(s->nl_acks, rehash_ack(&req->acks[i], NULL), &req->acks[i]) == 0) {
+			talloc_free(req);
+			return NULL;
+		}
+		req->msgs++;
+	}
+	req->pending = req->msgs;
+
+	/* a proc has a single request in flight; the address setup
+	 * completes before the iroutes are applied */
+	talloc_free(proc->nl_req);
+	proc->nl_req = req;
+
+	return req;
+}
+
+/* Evaluates the acknowledgements of the address setup. It has the
+ * same semantics as the ioctl() based set_network_info(); a failure
+ * to set the IPv6 address only drops the IPv6 lease. */
+static int nl_addr_result(main_server_st *s, struct proc_st *proc, nl_req_st *req)
+{
+	int *errors = req->errors;
+
+	if (req->v4 != -1 && errors[req->v4] != 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Error setting IPv4: %s\n",
+		      proc->tun_lease.name, strerror(-errors[req->v4]));
+		return -1;
+	}
+
+	if (errors[req->link] != 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not bring up interface: %s\n",
+		      proc->tun_lease.name, strerror(-errors[req->link]));
+		return -1;
+	}
+
+	if (req->v6 != -1 && (errors[req->v6] != 0 || errors[req->v6 + 1] != 0)) {
+		mslog(s, NULL, LOG_ERR, "%s: Error setting IPv6: %s\n",
+		      proc->tun_lease.name,
+		      strerror(-(errors[req->v6]?errors[req->v6]:errors[req->v6 + 1])));
+		remove_ip_lease(s, proc->ipv6);
+		proc->ipv6 = NULL;
+	}
+
+	if (proc->ipv6 == 0 && proc->ipv4 == 0) {
+		mslog(s, NULL, LOG_ERR, "%s: Could not set any IP.\n",
+		      proc->tun_lease.name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Releases @req and continues the session setup with @result */
+static void nl_addr_done(main_server_st *s, nl_req_st *req, int result)
+{
+	struct proc_st *proc = req->proc;
+
+	talloc_free(req);
+
+	if (handle_tun_set(s, proc, result) < 0)
+		remove_proc(s, proc, RPROC_KILL);
+}
+
+static void nl_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+	nl_req_st *req = container_of(w, nl_req_st, timer);
+
+	mslog(req->s, req->proc, LOG_ERR, "netlink: timeout waiting for the kernel's reply");
+	nl_addr_done(req->s, req, -1);
+}
+
+static void nl_handle_ack(main_server_st *s, uint32_t seq, int error)
+{
+	nl_ack_st *ack;
+	nl_req_st *req;
+	struct proc_st *proc;
+	unsigned idx;
+
+	ack = htable_get(s->nl_acks, hash_any(&seq, sizeof(seq), 0), ack_cmp, &seq);
+	if (ack == NULL) {
+		/* route removals; the routes may have been removed with the device */
+		if (error != 0)
+			mslog(s, NULL, LOG_DEBUG, "netlink: request %u failed: %s",
+			      (unsigned)seq, strerror(-error));
+		return;
+	}
+
+	req = ack->req;
+	proc = req->proc;
+	idx = ack - req->acks;
+
+	htable_del(s->nl_acks, rehash_ack(ack, NULL), ack);
+	ack->seq = 0;
+	req->pending--;
+
+	if (req->type == NL_REQ_IROUTES) {
+		if (error != 0) {
+			mslog(s, proc, LOG_ERR, "could not apply route %s for user: %s; terminating session",
+			      proc->config->iroutes[idx], strerror(-error));
+			talloc_free(req);
+			terminate_proc(s, proc);
+		} else if (req->pending == 0) {
+			talloc_free(req);
+		}
+		return;
+	}
+
+	req->errors[idx] = error;
+	if (req->pending == 0)
+		nl_addr_done(s, req, nl_addr_result(s, proc, req));
+}
+
+/* Reads the available acknowledgements */
+static void nl_read_acks(main_server_st *s)
+{
+	uint8_t buf[8192];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	int ret, e;
+
+	for (;;) {
+		ret = recv(s->nl_fd, buf, sizeof(buf), 0);
+		if (ret < 0) {
+			e = errno;
+			if (e == EINTR)
+				continue;
+			if (e != EAGAIN)
+				mslog(s, NULL, LOG_ERR, "netlink: recv: %s", strerror(e));
+			return;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (unsigned)ret); nlh = NLMSG_NEXT(nlh, ret)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			err = NLMSG_DATA(nlh);
+			nl_handle_ack(s, nlh->nlmsg_seq, err->error);
+		}
+	}
+}
+
+int nl_route_init(main_server_st *s)
+{
+	struct sockaddr_nl sa;
+	int fd, e;
+
+	s->nl_fd = -1;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (fd < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_INFO, "could not open rtnetlink socket: %s; falling back to ioctl()",
+		      strerror(e));
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		e = errno;
+		mslog(s, NULL, LOG_INFO, "could not bind rtnetlink socket: %s; falling back to ioctl()",
+		      strerror(e));
+		close(fd);
+		return -1;
+	}
+
+	s->nl_acks = talloc(s, struct htable);
+	if (s->nl_acks == NULL) {
+		close(fd);
+		return -1;
+	}
+	htable_init(s->nl_acks, rehash_ack, NULL);
+
+	s->nl_fd = fd;
+	return 0;
+}
+
+void nl_route_deinit(main_server_st *s)
+{
+	if (s->nl_fd >= 0)
+		close(s->nl_fd);
+	s->nl_fd = -1;
+
+	if (s->nl_acks) {
+		htable_clear(s->nl_acks);
+		talloc_free(s->nl_acks);
+		s->nl_acks = NULL;
+	}
+}
+
+void nl_route_process(main_server_st *s)
+{
+	nl_read_acks(s);
+}
+
+static struct nlmsghdr *add_addr_msg(main_server_st *s, nl_batch_st *b, unsigned idx,
+				     int family, unsigned prefix,
+				     const void *local, const void *peer)
+{
+	struct ifaddrmsg ifa;
+	struct nlmsghdr *nlh;
+	unsigned size = (family == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+	memset(&ifa, 0, sizeof(ifa));
+	ifa.ifa_family = family;
+	ifa.ifa_prefixlen = prefix;
+	ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa.ifa_index = idx;
+
+	nlh = nl_batch_add(s, b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa));
+	if (nlh == NULL)
+		return NULL;
+
+	if (nl_add_attr(b, nlh, IFA_LOCAL, local, size) < 0 ||
+	    nl_add_attr(b, nlh, IFA_ADDRESS, peer, size) < 0)
+		return NULL;
+
+	nl_batch_close(b, nlh);
+	return nlh;
+}
+
+static struct nlmsghdr *add_route_msg(main_server_st *s, nl_batch_st *b, unsigned type,
+				      unsigned idx, int family, unsigned prefix,
+				      const void *dst, uint32_t metric)
+{
+	struct rtmsg rtm;
+	struct nlmsghdr *nlh;
+	unsigned size = (family == AF_INET) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	uint32_t oif = idx;
+
+	memset(&rtm, 0, sizeof(rtm));
+	rtm.rtm_family = family;
+	rtm.rtm_dst_len = prefix;
+	rtm.rtm_table = RT_TABLE_MAIN;
+	rtm.rtm_protocol = RTPROT_BOOT;
+	rtm.rtm_scope = RT_SCOPE_LINK;
+	rtm.rtm_type = RTN_UNICAST;
+
+	nlh = nl_batch_add(s, b, type,
+			   (type == RTM_NEWROUTE) ? (NLM_F_CREATE | NLM_F_EXCL) : 0,
+			   &rtm, sizeof(rtm));
+	if (nlh == NULL)
+		return NULL;
+
+	if (nl_add_attr(b, nlh, RTA_DST, dst, size) < 0 ||
+	    nl_add_attr(b, nlh, RTA_OIF, &oif, sizeof(oif)) < 0)
+		return NULL;
+
+	if (metric && nl_add_attr(b, nlh, RTA_PRIORITY, &metric, sizeof(metric)) < 0)
+		return NULL;
+
+	nl_batch_close(b, nlh);
+	return nlh;
+}
+
+/* Assigns the lease addresses to the tun device and brings it up. The
+ * acknowledgements are read from the event loop, and the session setup
+ * continues in handle_tun_set().
+ *
+ * Returns ERR_WAIT_FOR_NETLINK when the requests are sent, or a
+ * negative error code.
+ */
+int nl_set_network_info(main_server_st *s, struct proc_st *proc)
+{
+	nl_batch_st b;
+	nl_req_st *req;
+	struct ifinfomsg ifi;
+	struct nlmsghdr *nlh;
+	unsigned idx;
+	int v4 = -1, link = -1, v6 = -1;
+	int ret = -1;
+
+	idx = if_nametoindex(proc->tun_lease.name);
+	if (idx == 0) {
+		mslog(s, NULL, LOG_ERR, "%s: could not find interface index",
+		      proc->tun_lease.name);
+		return -1;
+	}
+
+	if (nl_batch_init(proc, &b, NL_MAX_ADDR_MSGS) < 0)
+		return -1;
+
+	if (proc->ipv4 && proc->ipv4->lip_len > 0 && proc->ipv4->rip_len > 0) {
+		nlh = add_addr_msg(s, &b, idx, AF_INET, 32,
+				   SA_IN_P(&proc->ipv4->lip), SA_IN_P(&proc->ipv4->rip));
+		if (nlh == NULL)
+			goto cleanup;
+		v4 = b.msgs - 1;
+	}
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = idx;
+	ifi.ifi_flags = IFF_UP;
+	ifi.ifi_change = IFF_UP;
+
+	nlh = nl_batch_add(s, &b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+	if (nlh == NULL)
+		goto cleanup;
+	nl_batch_close(&b, nlh);
+	link = b.msgs - 1;
+
+	if (proc->ipv6 && proc->ipv6->lip_len > 0 && proc->ipv6->rip_len > 0) {
+		nlh = add_addr_msg(s, &b, idx, AF_INET6, 128,
+				   SA_IN6_P(&proc->ipv6->lip), SA_IN6_P(&proc->ipv6->lip));
+		if (nlh == NULL)
+			goto cleanup;
+		v6 = b.msgs - 1;
+
+		/* route to our remote address */
+		nlh = add_route_msg(s, &b, RTM_NEWROUTE, idx, AF_INET6, proc->ipv6->prefix,
+				    SA_IN6_P(&proc->ipv6->rip), 1);
+		if (nlh == NULL)
+			goto cleanup;
+	}
+
+	req = nl_req_new(s, proc, NL_REQ_ADDR, &b);
+	if (req == NULL)
+		goto cleanup;
+	req->v4 = v4;
+	req->link = link;
+	req->v6 = v6;
+
+	if (nl_batch_send(s, &b) < 0) {
+		talloc_free(req);
+		goto cleanup;
+	}
+
+	ev_timer_start(loop, &req->timer);
+
+	ret = ERR_WAIT_FOR_NETLINK;
+ cleanup:
+	talloc_free(b.data);
+	return ret;
+}
+
+/* Parses a route in the iroute format into an address and prefix */
+static int parse_route(void *pool, const char *route, int *family, void *addr, unsigned *prefix)
+{
+	char *cidr, *p;
+	int ret = -1;
+
+	cidr = ipv4_route_to_cidr(pool, route);
+	if (cidr == NULL)
+		return -1;
+
+	p = strchr(cidr, '/');
+	if (p == NULL)
+		goto cleanup;
+	*p = 0;
+	p++;
+
+	*family = strchr(cidr, ':') ? AF_INET6 : AF_INET;
+	if (inet_pton(*family, cidr, addr) != 1)
+		goto cleanup;
+
+	*prefix = atoi(p);
+	if (*prefix > ((*family == AF_INET) ? 32 : 128))
+		goto cleanup;
+
+	ret = 0;
+ cleanup:
+	talloc_free(cidr);
+	return ret;
+}
+
+static int nl_iroutes(main_server_st *s, struct proc_st *proc, unsigned type)
+{
+	nl_batch_st b;
+	nl_req_st *req = NULL;
+	struct nlmsghdr *nlh;
+	struct in6_addr addr;
+	unsigned idx, i, prefix;
+	int family, ret = -1;
+
+	idx = if_nametoindex(proc->tun_lease.name);
+	if (idx == 0) {
+		mslog(s, proc, LOG_ERR, "%s: could not find interface index",
+		      proc->tun_lease.name);
+		return -1;
+	}
+
+	if (nl_batch_init(proc, &b, proc->config->n_iroutes) < 0)
+		return -1;
+
+	for (i = 0; i < proc->config->n_iroutes; i++) {
+		if (parse_route(proc, proc->config->iroutes[i], &family, &addr, &prefix) < 0) {
+			mslog(s, proc, LOG_ERR, "cannot parse route %s", proc->config->iroutes[i]);
+			goto cleanup;
+		}
+
+		nlh = add_route_msg(s, &b, type, idx, family, prefix, &addr, 0);
+		if (nlh == NULL)
+			goto cleanup;
+	}
+
+	/* the removals are not waited for; a failure is only logged */
+	if (type == RTM_NEWROUTE) {
+		req = nl_req_new(s, proc, NL_REQ_IROUTES, &b);
+		if (req == NULL)
+			goto cleanup;
+	}
+
+	if (nl_batch_send(s, &b) < 0) {
+		talloc_free(req);
+		goto cleanup;
+	}
+
+	ret = 0;
+ cleanup:
+	talloc_free(b.data);
+	return ret;
+}
+
+/* Sends the requests for all the routes of the session; the
+ * acknowledgements are handled by nl_route_process() */
+int nl_apply_iroutes(main_server_st *s, struct proc_st *proc)
+{
+	return nl_iroutes(s, proc, RTM_NEWROUTE);
+}
+
+void nl_remove_iroutes(main_server_st *s, struct proc_st *proc)
+{
+	nl_iroutes(s, proc, RTM_DELROUTE);
+}
+
+#else
+
+int nl_route_init(main_server_st *s)
+{
+	s->nl_fd = -1;
+	return -1;
+}
+
+void nl_route_deinit(main_server_st *s)
+{
+	return;
+}
+
+void nl_route_process(main_server_st *s)
+{
+	return;
+}
+
+int nl_set_network_info(main_server_st *s, struct proc_st *proc)
+{
+	return -1;
+}
+
+int nl_apply_iroutes(main_server_st *s, struct proc_st *proc)
+{
+	return -1;
+}
+
+void nl_remove_iroutes(main_server_st *s, struct proc_st *proc)
+{
+	return;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROUTE_NETLINK_H
+# define ROUTE_NETLINK_H
+
+#include <vpn.h>
+#include <main.h>
+
+/* In-process address and route programming over rtnetlink. When
+ * the socket is not available (s->nl_fd == -1) the callers fall back
+ * to ioctl() and the route-add-cmd scripts. */
+int nl_route_init(main_server_st *s);
+void nl_route_deinit(main_server_st *s);
+void nl_route_process(main_server_st *s);
+
+int nl_set_network_info(main_server_st *s, struct proc_st *proc);
+int nl_apply_iroutes(main_server_st *s, struct proc_st *proc);
+void nl_remove_iroutes(main_server_st *s, struct proc_st *proc);
+
+#endif
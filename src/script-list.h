@@ -29,7 +29,7 @@
 void script_child_watcher_cb(struct ev_loop *loop, ev_child *w, int revents);
 
 inline static
-void add_to_script_list(main_server_st* s, pid_t pid, struct proc_st* proc)
+void add_to_script_list(main_server_st* s, pid_t pid, uint32_t id, struct proc_st* proc)
 {
 struct script_wait_st *stmp;
 
@@ -39,15 +39,20 @@ struct script_wait_st *stmp;
 	
 	stmp->proc = proc;
 	stmp->pid = pid;
+	stmp->id = id;
 
-	ev_child_init(&stmp->ev_child, script_child_watcher_cb, pid, 0);
-	ev_child_start(loop, &stmp->ev_child);
+	/* scripts run by the hook runner are reported by their id */
+	if (pid > 0) {
+		ev_child_init(&stmp->ev_child, script_child_watcher_cb, pid, 0);
+		ev_child_start(loop, &stmp->ev_child);
+	}
 
 	list_add(&s->script_list.head, &(stmp->list));
 }
 
 /* Removes the tracked connect script, and kills it. It returns the pid
- * of the removed script or -1.
+ * of the removed script, zero if the script is run by the hook runner,
+ * or -1.
  */
 inline static pid_t remove_from_script_list(main_server_st* s, struct proc_st* proc)
 {
@@ -60,6 +65,8 @@ inline static pid_t remove_from_script_list(main_server_st* s, struct proc_st* p
 			if (stmp->pid > 0) {
 				kill(stmp->pid, SIGTERM);
 				ret = stmp->pid;
+			} else {
+				ret = 0;
 			}
 			talloc_free(stmp);
 			break;
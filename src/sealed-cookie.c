@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#include <common.h>
+#include "sealed-cookie.h"
+
+/* The cookie is:
+ *   version (1) | period (4) | nonce (12) | encrypted fields | tag (16)
+ * where the header is authenticated along with the fields. The fields are
+ *   sid (32) | created (8) | expires (8) | auth type (4) | tls auth ok (1)
+ * followed by the strings, each preceded by its length (1). The fields
+ * alone are the encoding used by cookie_encode().
+ */
+#define COOKIE_VERSION 1
+#define NONCE_SIZE 12
+#define TAG_SIZE 16
+#define HEADER_SIZE (1 + 4 + NONCE_SIZE)
+
+#define KEY_LABEL "ocserv cookie key"
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	put_u32(p, v >> 32);
+	put_u32(p + 4, v);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+int cookie_key_init(cookie_key_st *key, const void *data, unsigned data_size,
+		    unsigned lifetime)
+{
+	if (data_size < 16 || lifetime == 0)
+		return -1;
+
+	if (gnutls_hash_fast(GNUTLS_DIG_SHA256, data, data_size, key->secret) < 0)
+		return -1;
+
+	key->lifetime = lifetime;
+	return 0;
+}
+
+/* The key of a period is HMAC(secret, label | period) */
+static int period_key(const cookie_key_st *key, uint32_t period, uint8_t out[32])
+{
+	uint8_t in[sizeof(KEY_LABEL)-1 + 4];
+
+	memcpy(in, KEY_LABEL, sizeof(KEY_LABEL)-1);
+	put_u32(in + sizeof(KEY_LABEL)-1, period);
+
+	if (gnutls_hmac_fast(GNUTLS_MAC_SHA256, key->secret, sizeof(key->secret),
+			     in, sizeof(in), out) < 0)
+		return -1;
+	return 0;
+}
+
+/* Encrypts or decrypts @size bytes of @data in place, and writes the tag
+ * over the header and the data in @tag */
+static int crypt_fields(const cookie_key_st *key, const uint8_t *header,
+			uint8_t *data, unsigned size, unsigned encrypt,
+			uint8_t tag[TAG_SIZE])
+{
+	gnutls_cipher_hd_t h;
+	uint8_t kdata[32];
+	gnutls_datum_t k = {kdata, sizeof(kdata)};
+	gnutls_datum_t iv = {(void*)(header + 5), NONCE_SIZE};
+	int ret;
+
+	if (period_key(key, get_u32(header + 1), kdata) < 0)
+		return -1;
+
+	ret = gnutls_cipher_init(&h, GNUTLS_CIPHER_AES_256_GCM, &k, &iv);
+	safe_memset(kdata, 0, sizeof(kdata));
+	if (ret < 0)
+		return -1;
+
+	ret = gnutls_cipher_add_auth(h, header, HEADER_SIZE);
+	if (ret >= 0) {
+		if (encrypt)
+			ret = gnutls_cipher_encrypt(h, data, size);
+		else
+			ret = gnutls_cipher_decrypt(h, data, size);
+	}
+	if (ret >= 0)
+		ret = gnutls_cipher_tag(h, tag, TAG_SIZE);
+
+	gnutls_cipher_deinit(h);
+	return ret < 0 ? -1 : 0;
+}
+
+static uint8_t *put_str(uint8_t *p, const uint8_t *end, const char *str)
+{
+	unsigned len = strlen(str);
+
+	if (len > 255 || p + 1 + len > end)
+		return NULL;
+
+	*p++ = len;
+	memcpy(p, str, len);
+	return p + len;
+}
+
+static const uint8_t *get_str(const uint8_t *p, const uint8_t *end, char *str, unsigned str_size)
+{
+	unsigned len;
+
+	if (p >= end)
+		return NULL;
+	len = *p++;
+	if (len >= str_size || p + len > end)
+		return NULL;
+
+	memcpy(str, p, len);
+	str[len] = 0;
+	return p + len;
+}
+
+int cookie_encode(const sealed_cookie_st *c, uint8_t *out, unsigned *out_size)
+{
+	uint8_t *p = out, *end = out + *out_size;
+
+	if (p + SID_SIZE + 21 > end)
+		return -1;
+
+	memcpy(p, c->sid, SID_SIZE);
+	p += SID_SIZE;
+	put_u64(p, c->created);
+	p += 8;
+	put_u64(p, c->expires);
+	p += 8;
+	put_u32(p, c->auth_type);
+	p += 4;
+	*p++ = c->tls_auth_ok ? 1 : 0;
+
+	if ((p = put_str(p, end, c->username)) == NULL ||
+	    (p = put_str(p, end, c->groupname)) == NULL ||
+	    (p = put_str(p, end, c->vhost)) == NULL ||
+	    (p = put_str(p, end, c->remote_ip)) == NULL ||
+	    (p = put_str(p, end, c->our_ip)) == NULL ||
+	    (p = put_str(p, end, c->user_agent)) == NULL)
+		return -1;
+
+	*out_size = p - out;
+	return 0;
+}
+
+int cookie_decode(const uint8_t *data, unsigned data_size, sealed_cookie_st *c)
+{
+	const uint8_t *p = data, *end = data + data_size;
+
+	if (data_size < SID_SIZE + 21)
+		return -1;
+
+	memset(c, 0, sizeof(*c));
+	memcpy(c->sid, p, SID_SIZE);
+	p += SID_SIZE;
+	c->created = get_u64(p);
+	p += 8;
+	c->expires = get_u64(p);
+	p += 8;
+	c->auth_type = get_u32(p);
+	p += 4;
+	c->tls_auth_ok = *p++;
+
+	if ((p = get_str(p, end, c->username, sizeof(c->username))) == NULL ||
+	    (p = get_str(p, end, c->groupname, sizeof(c->groupname))) == NULL ||
+	    (p = get_str(p, end, c->vhost, sizeof(c->vhost))) == NULL ||
+	    (p = get_str(p, end, c->remote_ip, sizeof(c->remote_ip))) == NULL ||
+	    (p = get_str(p, end, c->our_ip, sizeof(c->our_ip))) == NULL ||
+	    (p = get_str(p, end, c->user_agent, sizeof(c->user_agent))) == NULL)
+		return -1;
+
+	return 0;
+}
+
+int cookie_seal(const cookie_key_st *key, sealed_cookie_st *c,
+		uint8_t *out, unsigned *out_size)
+{
+	unsigned size;
+
+	if (*out_size > MAX_COOKIE_SIZE)
+		*out_size = MAX_COOKIE_SIZE;
+	if (*out_size < HEADER_SIZE + TAG_SIZE)
+		return -1;
+
+	c->expires = c->created + key->lifetime;
+
+	out[0] = COOKIE_VERSION;
+	put_u32(out + 1, c->created / key->lifetime);
+	if (gnutls_rnd(GNUTLS_RND_NONCE, out + 5, NONCE_SIZE) < 0)
+		return -1;
+
+	size = *out_size - HEADER_SIZE - TAG_SIZE;
+	if (cookie_encode(c, out + HEADER_SIZE, &size) < 0)
+		return -1;
+
+	if (crypt_fields(key, out, out + HEADER_SIZE, size, 1, out + HEADER_SIZE + size) < 0)
+		return -1;
+
+	*out_size = HEADER_SIZE + size + TAG_SIZE;
+	return 0;
+}
+
+int cookie_open(const cookie_key_st *key, time_t now,
+		const uint8_t *data, unsigned data_size, sealed_cookie_st *c)
+{
+	uint8_t buf[MAX_COOKIE_SIZE];
+	uint8_t tag[TAG_SIZE];
+	uint32_t period, cur;
+	unsigned size, i, diff;
+	int ret = -1;
+
+	if (data_size < HEADER_SIZE + SID_SIZE + 21 + TAG_SIZE ||
+	    data_size > sizeof(buf) || data[0] != COOKIE_VERSION)
+		return -1;
+
+	/* only the keys of the current and the previous period are used */
+	period = get_u32(data + 1);
+	cur = now / key->lifetime;
+	if (period != cur && period + 1 != cur)
+		return -1;
+
+	size = data_size - HEADER_SIZE - TAG_SIZE;
+	memcpy(buf, data + HEADER_SIZE, size);
+
+	if (crypt_fields(key, data, buf, size, 0, tag) < 0)
+		goto fail;
+
+	for (i = diff = 0; i < TAG_SIZE; i++)
+		diff |= tag[i] ^ data[data_size - TAG_SIZE + i];
+	if (diff != 0)
+		goto fail;
+
+	if (cookie_decode(buf, size, c) < 0)
+		goto fail;
+
+	if (now >= c->expires)
+		goto fail;
+
+	ret = 0;
+ fail:
+	safe_memset(buf, 0, sizeof(buf));
+	return ret;
+}
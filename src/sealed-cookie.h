@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SEALED_COOKIE_H
+# define SEALED_COOKIE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <vpn.h>
+
+/* Cookies which carry the session they were issued for, encrypted and
+ * authenticated with AES-256-GCM. The key is derived from a secret for
+ * each period of the cookie lifetime, so that servers sharing the secret
+ * accept each other's cookies, and the keys rotate without coordination.
+ * A cookie is accepted by the key of its period and of the following one.
+ */
+
+#define SEALED_COOKIE_DEFAULT_LIFETIME (24*60*60)
+
+typedef struct cookie_key_st {
+	uint8_t secret[32];
+	unsigned lifetime;
+} cookie_key_st;
+
+typedef struct sealed_cookie_st {
+	uint8_t sid[SID_SIZE];
+	time_t created;
+	time_t expires; /* set by cookie_seal() */
+	unsigned auth_type;
+	unsigned tls_auth_ok;
+	char username[MAX_USERNAME_SIZE*2];
+	char groupname[MAX_GROUPNAME_SIZE];
+	char vhost[MAX_HOSTNAME_SIZE];
+	char remote_ip[MAX_IP_STR];
+	char our_ip[MAX_IP_STR];
+	char user_agent[MAX_AGENT_NAME];
+} sealed_cookie_st;
+
+/* Sets the key from the contents of a secret file */
+int cookie_key_init(cookie_key_st *key, const void *data, unsigned data_size,
+		    unsigned lifetime);
+
+/* Writes the cookie of @c, of up to MAX_COOKIE_SIZE bytes, in @out */
+int cookie_seal(const cookie_key_st *key, sealed_cookie_st *c,
+		uint8_t *out, unsigned *out_size);
+
+/* Returns 0 if @data is a cookie sealed by @key which did not expire */
+int cookie_open(const cookie_key_st *key, time_t now,
+		const uint8_t *data, unsigned data_size, sealed_cookie_st *c);
+
+/* The fields of the cookie in the clear, as kept in the shared state store */
+int cookie_encode(const sealed_cookie_st *c, uint8_t *out, unsigned *out_size);
+int cookie_decode(const uint8_t *data, unsigned data_size, sealed_cookie_st *c);
+
+#endif
@@ -52,7 +52,9 @@
 #include <base64-helper.h>
 #include <sec-mod-sup-config.h>
 #include <sec-mod-acct.h>
+#include <sec-mod-threads.h>
 #include <c-strcase.h>
+#include <gettime.h>
 
 #ifdef HAVE_GSSAPI
 # include <gssapi/gssapi.h>
@@ -78,6 +80,31 @@ void sec_auth_init(struct vhost_cfg_st *vhost)
 		vhost->perm_config.acct.amod->vhost_init(&vhost->perm_config.acct.acct_ctx, pool, vhost->perm_config.acct.additional);
 }
 
+/* The module calls of an auth init or cont request. These may block
+ * (e.g., on a radius server) and are run by the sec-mod threads when
+ * these are enabled. The calls only use the fields below; the module
+ * state is copied from the entry, and while a thread runs it, it is
+ * moved under the call's own talloc root (talloc is not thread safe). */
+typedef struct auth_call_st {
+	sec_job_st job;
+	sec_mod_st *sec;
+	client_entry_st *e;
+	worker_req_st req; /* the worker request to reply to */
+
+	const struct auth_mod_st *module;
+	void *auth_ctx; /* the entry's module state */
+	void *vhost_auth_ctx;
+
+	void *pool; /* the module allocates from it */
+	struct timespec start; /* of a call not queued to the threads */
+	common_auth_init_st st; /* for auth init */
+	char *password; /* for auth cont */
+
+	int result;
+	int msg_result;
+	passwd_msg_st pst;
+} auth_call_st;
+
 /* returns a negative number if we have reached the score for this client.
  */
 static
@@ -133,10 +160,34 @@ static void update_auth_time_stats(sec_mod_st * sec, time_t secs)
 	sec->avg_auth_time = (sec->avg_auth_time*(sec->total_authentications-1)+secs) / sec->total_authentications;
 }
 
+/* Seals the session of @e in the cookie sent to the client, so that it can
+ * be restored once its entry is gone */
+static int seal_client_entry(sec_mod_st *sec, client_entry_st *e,
+			     uint8_t *cookie, unsigned *cookie_size)
+{
+	sealed_cookie_st c;
+	int ret;
+
+	client_entry_to_cookie(e, &c);
+	c.created = time(0);
+
+	ret = cookie_seal(sec->cookie_key, &c, cookie, cookie_size);
+	if (ret < 0) {
+		seclog(sec, LOG_ERR, "could not seal the cookie of user '%s' "SESSION_STR,
+		       e->acct_info.username, e->acct_info.safe_id);
+		return ret;
+	}
+
+	e->cookie_exptime = c.expires;
+	return 0;
+}
+
 static
-int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTHREP r)
+int send_sec_auth_reply(worker_req_st *req, sec_mod_st * sec, client_entry_st * entry, AUTHREP r)
 {
 	SecAuthReplyMsg msg = SEC_AUTH_REPLY_MSG__INIT;
+	uint8_t cookie[MAX_COOKIE_SIZE];
+	unsigned cookie_size = sizeof(cookie);
 	int ret;
 
 	if (r == AUTH__REP__OK) {
@@ -156,11 +207,28 @@ int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTH
 		msg.sid.data = entry->sid;
 		msg.sid.len = sizeof(entry->sid);
 
+		if (sec->cookie_key != NULL) {
+			if (seal_client_entry(sec, entry, cookie, &cookie_size) < 0)
+				return -1;
+			msg.has_cookie = 1;
+			msg.cookie.data = cookie;
+			msg.cookie.len = cookie_size;
+		}
+
+		share_client_entry(sec, entry);
+
 		msg.has_dtls_session_id = 1;
 		msg.dtls_session_id.data = entry->dtls_session_id;
 		msg.dtls_session_id.len = sizeof(entry->dtls_session_id);
 
-		ret = send_msg(entry, cfd, CMD_SEC_AUTH_REPLY,
+		if (entry->auth_calls > 0) {
+			msg.has_auth_queue_usecs = 1;
+			msg.auth_queue_usecs = entry->auth_queue_usecs;
+			msg.has_auth_backend_usecs = 1;
+			msg.auth_backend_usecs = entry->auth_backend_usecs;
+		}
+
+		ret = send_worker_reply(entry, req, CMD_SEC_AUTH_REPLY,
 			       &msg,
 			       (pack_size_func)
 			       sec_auth_reply_msg__get_packed_size,
@@ -170,7 +238,7 @@ int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTH
 
 		msg.reply = AUTH__REP__FAILED;
 
-		ret = send_msg(entry, cfd, CMD_SEC_AUTH_REPLY,
+		ret = send_worker_reply(entry, req, CMD_SEC_AUTH_REPLY,
 			       &msg,
 			       (pack_size_func)
 			       sec_auth_reply_msg__get_packed_size,
@@ -190,7 +258,7 @@ int send_sec_auth_reply(int cfd, sec_mod_st * sec, client_entry_st * entry, AUTH
 }
 
 static
-int send_sec_auth_reply_msg(int cfd, sec_mod_st * sec, client_entry_st * e)
+int send_sec_auth_reply_msg(worker_req_st *req, sec_mod_st * sec, client_entry_st * e)
 {
 	SecAuthReplyMsg msg = SEC_AUTH_REPLY_MSG__INIT;
 	int ret;
@@ -206,7 +274,7 @@ int send_sec_auth_reply_msg(int cfd, sec_mod_st * sec, client_entry_st * e)
 	msg.sid.data = e->sid;
 	msg.sid.len = sizeof(e->sid);
 
-	ret = send_msg(e, cfd, CMD_SEC_AUTH_REPLY, &msg,
+	ret = send_worker_reply(e, req, CMD_SEC_AUTH_REPLY, &msg,
 		       (pack_size_func) sec_auth_reply_msg__get_packed_size,
 		       (pack_func) sec_auth_reply_msg__pack);
 	if (ret < 0) {
@@ -320,25 +388,23 @@ int check_group(sec_mod_st * sec, client_entry_st * e)
 /* Performs the required steps based on the result from the 
  * authentication function (e.g. handle_auth_init).
  *
- * @cmd: the command received
  * @result: the auth result
+ * @c: the module call which produced the result, if any
  */
 static
-int handle_sec_auth_res(int cfd, sec_mod_st * sec, client_entry_st * e, int result)
+int handle_sec_auth_res(worker_req_st *req, sec_mod_st * sec, client_entry_st * e, int result,
+			const auth_call_st *c)
 {
 	int ret;
-	passwd_msg_st pst;
 
-	if ((result == ERR_AUTH_CONTINUE || result == 0) && e->module) {
-		memset(&pst, 0, sizeof(pst));
-		ret = e->module->auth_msg(e->auth_ctx, e, &pst);
-		if (ret < 0) {
+	if ((result == ERR_AUTH_CONTINUE || result == 0) && c != NULL) {
+		if (c->msg_result < 0) {
 			e->status = PS_AUTH_FAILED;
 			seclog(sec, LOG_ERR, "error getting auth msg");
-			return ret;
+			return c->msg_result;
 		}
-		e->msg_str = pst.msg_str;
-		e->passwd_counter = pst.counter;
+		e->msg_str = c->pst.msg_str;
+		e->passwd_counter = c->pst.counter;
 	}
 
 	if (result == ERR_AUTH_CONTINUE) {
@@ -347,7 +413,7 @@ int handle_sec_auth_res(int cfd, sec_mod_st * sec, client_entry_st * e, int resu
 			sec_mod_add_score_to_ip(sec, e, e->acct_info.remote_ip, e->vhost->perm_config.config->ban_points_wrong_password);
 		}
 
-		ret = send_sec_auth_reply_msg(cfd, sec, e);
+		ret = send_sec_auth_reply_msg(req, sec, e);
 		if (ret < 0) {
 			e->status = PS_AUTH_FAILED;
 			seclog(sec, LOG_ERR, "could not send reply auth cmd.");
@@ -373,7 +439,7 @@ int handle_sec_auth_res(int cfd, sec_mod_st * sec, client_entry_st * e, int resu
 					     sizeof(e->acct_info.username));
 		}
 
-		ret = send_sec_auth_reply(cfd, sec, e, AUTH__REP__OK);
+		ret = send_sec_auth_reply(req, sec, e, AUTH__REP__OK);
 		if (ret < 0) {
 			e->status = PS_AUTH_FAILED;
 			seclog(sec, LOG_ERR, "could not send reply auth cmd.");
@@ -386,7 +452,7 @@ int handle_sec_auth_res(int cfd, sec_mod_st * sec, client_entry_st * e, int resu
 
 		sec_mod_add_score_to_ip(sec, e, e->acct_info.remote_ip, e->vhost->perm_config.config->ban_points_wrong_password);
 
-		ret = send_sec_auth_reply(cfd, sec, e, AUTH__REP__FAILED);
+		ret = send_sec_auth_reply(req, sec, e, AUTH__REP__FAILED);
 		if (ret < 0) {
 			seclog(sec, LOG_ERR, "could not send reply auth cmd.");
 			return ret;
@@ -436,23 +502,192 @@ int send_failed_session_open_reply(sec_mod_st *sec, int fd)
 	return ret;
 }
 
-int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenMsg *req)
+static int set_module(sec_mod_st * sec, vhost_cfg_st *vhost, client_entry_st *e, unsigned auth_type);
+
+/* Restores the entry of a session issued by this or another server. The
+ * entries of the invalidated sessions are not restored. */
+static client_entry_st *restore_client_entry(sec_mod_st *sec, const sealed_cookie_st *c,
+					     const char *from)
 {
 	client_entry_st *e;
-	void *lpool;
+	vhost_cfg_st *vhost;
+
+	if (client_sid_is_revoked(sec, c->sid)) {
+		seclog(sec, LOG_INFO, "session open with invalidated cookie of user '%s'", c->username);
+		return NULL;
+	}
+
+	/* the default vhost has no name */
+	vhost = find_vhost(sec->vconfig, c->vhost[0] != 0 ? c->vhost : NULL);
+	if (c->vhost[0] != 0 && vhost->name == NULL) {
+		seclog(sec, LOG_INFO, "session open with cookie of unknown vhost '%s'", c->vhost);
+		return NULL;
+	}
+
+	/* the radius configuration of the session (Session-Timeout,
+	 * Framed-IP-Address, routes) is kept in the auth module's state,
+	 * which the cookie does not carry */
+	if (vhost->perm_config.sup_config_type == SUP_CONFIG_RADIUS) {
+		seclog(sec, LOG_INFO, "%ssession of user '%s' cannot be restored with radius groupconfig",
+		       PREFIX_VHOST(vhost), c->username);
+		return NULL;
+	}
+
+	e = new_client_entry_from_cookie(sec, vhost, c);
+	if (e == NULL)
+		return NULL;
+
+	if (set_module(sec, vhost, e, c->auth_type) < 0) {
+		seclog(sec, LOG_INFO, "session open with cookie of unavailable auth method");
+		del_client_entry(sec, e);
+		return NULL;
+	}
+
+	seclog(sec, LOG_INFO, "%srestored session of user '%s' "SESSION_STR" from %s",
+	       PREFIX_VHOST(vhost), e->acct_info.username, e->acct_info.safe_id, from);
+	return e;
+}
+
+/* Finds the entry of a sealed cookie, restoring it if it is not in the
+ * database (e.g., after a restart, or if issued by another server sharing
+ * the key). */
+static client_entry_st *find_sealed_client_entry(sec_mod_st *sec, const uint8_t *cookie,
+						 unsigned cookie_size)
+{
+	sealed_cookie_st c;
+	client_entry_st *e;
+	time_t now = time(0);
+
+	if (sec->cookie_key == NULL ||
+	    cookie_open(sec->cookie_key, now, cookie, cookie_size, &c) < 0) {
+		seclog(sec, LOG_INFO, "session open but with invalid or expired cookie");
+		return NULL;
+	}
+
+	e = find_client_entry(sec, c.sid);
+	if (e != NULL) {
+		/* the cookie outlives the entry's expiration */
+		if (e->status == PS_AUTH_COMPLETED && e->in_use == 0 &&
+		    IS_CLIENT_ENTRY_EXPIRED(sec, e, now)) {
+			e->exptime = now + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
+			arm_client_entry(sec, e);
+		}
+		return e;
+	}
+
+	return restore_client_entry(sec, &c, "its cookie");
+}
+
+/* Restores the entry of a session ID from its value in the shared state.
+ * The store only returns the values sealed with the cluster key, i.e.,
+ * written by a server of the cluster. */
+static client_entry_st *restore_shared_client_entry(sec_mod_st *sec, const uint8_t sid[SID_SIZE],
+						    const kv_value_st *value)
+{
+	sealed_cookie_st c;
+
+	if (cookie_decode(value->data, value->size, &c) < 0 ||
+	    memcmp(c.sid, sid, SID_SIZE) != 0) {
+		seclog(sec, LOG_INFO, "invalid session in the shared state");
+		return NULL;
+	}
+
+	return restore_client_entry(sec, &c, "the shared state");
+}
+
+/* A session looked up in the shared state for a worker */
+typedef struct session_fetch_st {
+	sec_mod_st *sec;
+	worker_req_st req;
+	uint8_t sid[SID_SIZE];
+} session_fetch_st;
+
+static void session_fetch_done(void *priv, int status, const kv_value_st *value)
+{
+	session_fetch_st *f = priv;
 	int ret;
-	SecmSessionReplyMsg rep = SECM_SESSION_REPLY_MSG__INIT;
-	GroupCfgSt _cfg = GROUP_CFG_ST__INIT;
 
-	rep.config = &_cfg;
+	/* the session may have been restored meanwhile */
+	if (status == KV_OK && find_client_entry(f->sec, f->sid) == NULL)
+		restore_shared_client_entry(f->sec, f->sid, value);
 
-	if (req->sid.len != SID_SIZE) {
+	ret = send_worker_reply(f, &f->req, CMD_SEC_SESSION_FETCH, NULL, NULL, NULL);
+	if (ret < 0) {
+		seclog(f->sec, LOG_ERR, "could not send reply cmd %d.", CMD_SEC_SESSION_FETCH);
+		worker_chan_close(f->sec, f->req.chan);
+	}
+
+	worker_req_release(&f->req, ret);
+	talloc_free(f);
+}
+
+/* Restores a session issued by another server of the cluster from the
+ * shared state, before the worker presents its ID to main; main only
+ * looks up the local entries, so that it never waits for the store.
+ * Returns ERR_WAIT_FOR_STATE if the reply is sent once the value is
+ * received. */
+int handle_sec_session_fetch(worker_req_st *wreq, sec_mod_st *sec, const SecSessionFetchMsg *req)
+{
+	session_fetch_st *f;
+	kv_value_st value;
+	int ret;
+
+	if (sec->kv == NULL || req->sid.len != SID_SIZE ||
+	    find_client_entry(sec, req->sid.data) != NULL)
+		return 0;
+
+	f = talloc_zero(sec, session_fetch_st);
+	if (f == NULL)
+		return 0;
+
+	f->sec = sec;
+	f->req = *wreq;
+	memcpy(f->sid, req->sid.data, SID_SIZE);
+
+	ret = kv_store_get(sec->kv, "sid", f->sid, SID_SIZE, &value, session_fetch_done, f);
+	if (ret == 0) {
+		worker_req_hold(&f->req);
+		return ERR_WAIT_FOR_STATE;
+	}
+
+	/* the value is valid until the next call to the store */
+	if (ret == 1)
+		restore_shared_client_entry(sec, f->sid, &value);
+
+	talloc_free(f);
+	return 0;
+}
+
+static int session_open_reply(sec_mod_st *sec, int fd, client_entry_st *e,
+			      const char *ipv4, const char *ipv6);
+
+int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenMsg *req)
+{
+	client_entry_st *e;
+
+	if (req->sid.len == SID_SIZE) {
+		e = find_client_entry(sec, req->sid.data);
+	} else if (req->sid.len > SID_SIZE && req->sid.len <= MAX_COOKIE_SIZE) {
+		e = find_sealed_client_entry(sec, req->sid.data, req->sid.len);
+	} else {
 		seclog(sec, LOG_ERR, "auth session open but with illegal sid size (%d)!",
 		       (int)req->sid.len);
 		return send_failed_session_open_reply(sec, fd);
 	}
 
-	e = find_client_entry(sec, req->sid.data);
+	return session_open_reply(sec, fd, e, req->ipv4, req->ipv6);
+}
+
+static int session_open_reply(sec_mod_st *sec, int fd, client_entry_st *e,
+			      const char *ipv4, const char *ipv6)
+{
+	void *lpool;
+	int ret;
+	SecmSessionReplyMsg rep = SECM_SESSION_REPLY_MSG__INIT;
+	GroupCfgSt _cfg = GROUP_CFG_ST__INIT;
+
+	rep.config = &_cfg;
+
 	if (e == NULL) {
 		seclog(sec, LOG_INFO, "session open but with non-existing SID!");
 		return send_failed_session_open_reply(sec, fd);
@@ -469,13 +704,13 @@ int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenM
 		return send_failed_session_open_reply(sec, fd);
 	}
 
-	if (req->ipv4)
-		strlcpy(e->acct_info.ipv4, req->ipv4, sizeof(e->acct_info.ipv4));
-	if (req->ipv6)
-		strlcpy(e->acct_info.ipv6, req->ipv6, sizeof(e->acct_info.ipv6));
+	if (ipv4)
+		strlcpy(e->acct_info.ipv4, ipv4, sizeof(e->acct_info.ipv4));
+	if (ipv6)
+		strlcpy(e->acct_info.ipv6, ipv6, sizeof(e->acct_info.ipv6));
 
 	if (e->vhost->perm_config.acct.amod != NULL && e->vhost->perm_config.acct.amod->open_session != NULL && e->session_is_open == 0) {
-		ret = e->vhost->perm_config.acct.amod->open_session(e->vhost_acct_ctx, e->auth_type, &e->acct_info, req->sid.data, req->sid.len);
+		ret = e->vhost->perm_config.acct.amod->open_session(e->vhost_acct_ctx, e->auth_type, &e->acct_info, e->sid, sizeof(e->sid));
 		if (ret < 0) {
 			e->status = PS_AUTH_FAILED;
 			seclog(sec, LOG_INFO, "denied session for user '%s' "SESSION_STR, e->acct_info.username, e->acct_info.safe_id);
@@ -531,6 +766,7 @@ int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenM
 	/* refresh cookie validity */
 	e->exptime = time(0) + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
 	e->in_use++;
+	share_client_entry(sec, e);
 
 	return 0;
 }
@@ -671,9 +907,192 @@ int handle_sec_auth_stats_cmd(sec_mod_st * sec, const CliStatsMsg * req, pid_t p
 	return 0;
 }
 
-int handle_sec_auth_cont(int cfd, sec_mod_st * sec, const SecAuthContMsg * req)
+/* The module calls must not access the entry; they may run in an
+ * auth thread */
+static void call_module_msg(auth_call_st *c)
+{
+	if (c->result == ERR_AUTH_CONTINUE || c->result == 0) {
+		memset(&c->pst, 0, sizeof(c->pst));
+		c->msg_result = c->module->auth_msg(c->auth_ctx, c->pool, &c->pst);
+	}
+}
+
+/* Adds the time the module call took to the entry; @queued is NULL for
+ * calls which were not queued to the threads */
+static void time_module_call(auth_call_st *c, struct timespec *queued,
+			     struct timespec *started)
+{
+	struct timespec now;
+
+	gettime_mono(&now);
+	if (queued != NULL)
+		c->e->auth_queue_usecs += timespec_sub_us(started, queued);
+	c->e->auth_backend_usecs += timespec_sub_us(&now, started);
+	c->e->auth_calls++;
+}
+
+static void call_module(auth_call_st *c)
+{
+	if (c->password == NULL) {
+		c->result =
+		    c->module->auth_init(&c->auth_ctx, c->pool, c->vhost_auth_ctx, &c->st);
+	} else {
+		c->result =
+		    c->module->auth_pass(c->auth_ctx, c->password,
+				      strlen(c->password));
+	}
+
+	call_module_msg(c);
+}
+
+static int finish_auth_init(sec_mod_st *sec, auth_call_st *c, client_entry_st *e,
+			    worker_req_st *req, int result);
+static int finish_auth_cont(auth_call_st *c, int result);
+
+static void auth_call_work(sec_job_st *job)
+{
+	call_module(container_of(job, auth_call_st, job));
+}
+
+static void auth_call_done(sec_job_st *job)
+{
+	auth_call_st *c = container_of(job, auth_call_st, job);
+	worker_req_st req = c->req;
+	int ret;
+
+	time_module_call(c, &job->queued, &job->started);
+
+	/* the module state is from now on owned by the entry */
+	talloc_steal(c->e, c->pool);
+	c->e->auth_ctx = c->auth_ctx;
+	c->e->auth_pending = 0;
+	arm_client_entry(c->sec, c->e);
+
+	if (c->password == NULL)
+		ret = finish_auth_init(c->sec, c, c->e, &req, c->result);
+	else
+		ret = finish_auth_cont(c, c->result);
+
+	worker_req_release(&req, ret);
+}
+
+static void auth_async_done(void *priv, int result)
+{
+	auth_call_st *c = priv;
+	worker_req_st req = c->req;
+	int ret;
+
+	c->e->auth_pending = 0;
+	arm_client_entry(c->sec, c->e);
+	c->result = result;
+	call_module_msg(c);
+	time_module_call(c, NULL, &c->start);
+
+	ret = finish_auth_cont(c, c->result);
+
+	worker_req_release(&req, ret);
+}
+
+static auth_call_st *new_auth_call(sec_mod_st *sec, client_entry_st *e, worker_req_st *req)
+{
+	auth_call_st *c;
+
+	c = talloc_zero(sec, auth_call_st);
+	if (c == NULL)
+		return NULL;
+
+	c->sec = sec;
+	c->e = e;
+	c->req = *req;
+	c->module = e->module;
+	c->auth_ctx = e->auth_ctx;
+	c->vhost_auth_ctx = e->vhost_auth_ctx;
+	return c;
+}
+
+/* Calls the module, either directly or by queuing the call to the
+ * auth threads. In the latter case ERR_WAIT_FOR_AUTH is returned and
+ * the request is completed in auth_call_done(). The modules which
+ * verify passwords asynchronously are not run by the threads; their
+ * pending requests are completed in auth_async_done(). */
+static int run_auth_call(sec_mod_st *sec, auth_call_st *c)
+{
+	client_entry_st *e = c->e;
+	sec_backend_st *b;
+
+	if (c->password != NULL && e->module->auth_pass_async != NULL) {
+		c->pool = e;
+		gettime_mono(&c->start);
+		c->result = c->module->auth_pass_async(c->auth_ctx, c->password,
+						       strlen(c->password),
+						       auth_async_done, c);
+		if (c->result == ERR_WAIT_FOR_AUTH) {
+			e->auth_pending = 1;
+			worker_req_hold(&c->req);
+			return ERR_WAIT_FOR_AUTH;
+		}
+
+		call_module_msg(c);
+		time_module_call(c, NULL, &c->start);
+		return c->result;
+	}
+
+	if (sec->threads != NULL) {
+		b = sec_threads_backend(sec->threads, e->module, e->module->name,
+					e->module->max_concurrency);
+		/* the job's own root; moved under the entry in auth_call_done() */
+		c->pool = talloc_new(NULL);
+		if (b != NULL && c->pool != NULL) {
+			if (c->auth_ctx != NULL)
+				talloc_steal(c->pool, c->auth_ctx);
+
+			c->job.work = auth_call_work;
+			c->job.done = auth_call_done;
+			c->job.data = c;
+
+			if (sec_threads_submit(sec->threads, b, &c->job) == 0) {
+				e->auth_pending = 1;
+				worker_req_hold(&c->req);
+				return ERR_WAIT_FOR_AUTH;
+			}
+			seclog(sec, LOG_WARNING, "too many queued authentications; calling '%s' directly",
+			       e->module->name);
+			if (c->auth_ctx != NULL)
+				talloc_steal(e, c->auth_ctx);
+		}
+		talloc_free(c->pool);
+	}
+
+	c->pool = e;
+	gettime_mono(&c->start);
+	call_module(c);
+	time_module_call(c, NULL, &c->start);
+	e->auth_ctx = c->auth_ctx;
+	return c->result;
+}
+
+static int finish_auth_cont(auth_call_st *c, int result)
+{
+	client_entry_st *e = c->e;
+	int ret;
+
+	if (result < 0 && result != ERR_AUTH_CONTINUE) {
+		seclog(c->sec, LOG_DEBUG,
+		       "error in password given in auth cont for user '%s' "SESSION_STR,
+		       e->acct_info.username, e->acct_info.safe_id);
+	}
+
+	ret = handle_sec_auth_res(&c->req, c->sec, e, result, c);
+
+	safe_memset(c->password, 0, strlen(c->password));
+	talloc_free(c);
+	return ret;
+}
+
+int handle_sec_auth_cont(worker_req_st *wreq, sec_mod_st * sec, const SecAuthContMsg * req)
 {
 	client_entry_st *e;
+	auth_call_st *c;
 	int ret;
 
 	if (req->sid.len != SID_SIZE) {
@@ -688,6 +1107,12 @@ int handle_sec_auth_cont(int cfd, sec_mod_st * sec, const SecAuthContMsg * req)
 		return -1;
 	}
 
+	if (e->auth_pending) {
+		seclog(sec, LOG_ERR, "auth cont received for %s "SESSION_STR" while its previous request is in progress!",
+		       e->acct_info.username, e->acct_info.safe_id);
+		return -1;
+	}
+
 	if (e->status != PS_AUTH_INIT && e->status != PS_AUTH_CONT) {
 		seclog(sec, LOG_ERR, "auth cont received for %s "SESSION_STR" but we are on state %u!",
 		       e->acct_info.username, e->acct_info.safe_id, e->status);
@@ -710,22 +1135,29 @@ int handle_sec_auth_cont(int cfd, sec_mod_st * sec, const SecAuthContMsg * req)
 		goto cleanup;
 	}
 
-	e->status = PS_AUTH_CONT;
+	c = new_auth_call(sec, e, wreq);
+	if (c == NULL) {
+		ret = -1;
+		goto cleanup;
+	}
 
-	ret =
-	    e->module->auth_pass(e->auth_ctx, req->password,
-			      strlen(req->password));
-	if (ret < 0) {
-		if (ret != ERR_AUTH_CONTINUE) {
-			seclog(sec, LOG_DEBUG,
-			       "error in password given in auth cont for user '%s' "SESSION_STR,
-			       e->acct_info.username, e->acct_info.safe_id);
-		}
+	c->password = talloc_strdup(c, req->password);
+	if (c->password == NULL) {
+		talloc_free(c);
+		ret = -1;
 		goto cleanup;
 	}
 
+	e->status = PS_AUTH_CONT;
+
+	ret = run_auth_call(sec, c);
+	if (ret == ERR_WAIT_FOR_AUTH)
+		return ret;
+
+	return finish_auth_cont(c, ret);
+
  cleanup:
-	return handle_sec_auth_res(cfd, sec, e, ret);
+	return handle_sec_auth_res(wreq, sec, e, ret, NULL);
 }
 
 static
@@ -753,12 +1185,31 @@ int set_module(sec_mod_st * sec, vhost_cfg_st *vhost, client_entry_st *e, unsign
 	return -1;
 }
 
-int handle_sec_auth_init(int cfd, sec_mod_st *sec, const SecAuthInitMsg *req, pid_t pid)
+/* @c: the module call, or NULL if the module was not called */
+static int finish_auth_init(sec_mod_st *sec, auth_call_st *c, client_entry_st *e,
+			    worker_req_st *req, int result)
 {
+	int ret;
+
+	if (result == 0 || result == ERR_AUTH_CONTINUE) {
+		e->status = PS_AUTH_INIT;
+		seclog(sec, LOG_DEBUG, "auth init %sfor user '%s' "SESSION_STR" of group: '%s' from '%s'",
+		       e->tls_auth_ok?"(with cert) ":"",
+		       e->acct_info.username, e->acct_info.safe_id, e->acct_info.groupname, e->acct_info.remote_ip);
+	}
+
+	ret = handle_sec_auth_res(req, sec, e, result, c);
+	talloc_free(c);
+	return ret;
+}
+
+int handle_sec_auth_init(worker_req_st *wreq, sec_mod_st *sec, const SecAuthInitMsg *req)
+{
+	pid_t pid = wreq->chan->pid;
 	int ret = -1;
 	client_entry_st *e;
+	auth_call_st *c = NULL;
 	unsigned i;
-	unsigned need_continue = 0;
 	vhost_cfg_st *vhost;
 
 	vhost = find_vhost(sec->vconfig, req->vhost);
@@ -775,24 +1226,6 @@ int handle_sec_auth_init(int cfd, sec_mod_st *sec, const SecAuthInitMsg *req, pi
 		goto cleanup;
 	}
 
-	if (e->module) {
-		common_auth_init_st st;
-
-		st.username = req->user_name;
-		st.ip = req->ip;
-		st.our_ip = req->our_ip;
-		st.user_agent = req->user_agent;
-		st.id = pid;
-
-		ret =
-		    e->module->auth_init(&e->auth_ctx, e, e->vhost_auth_ctx, &st);
-		if (ret == ERR_AUTH_CONTINUE) {
-			need_continue = 1;
-		} else if (ret < 0) {
-			goto cleanup;
-		}
-	}
-
 	e->tls_auth_ok = req->tls_auth_ok;
 
 	if (req->user_agent != NULL)
@@ -823,19 +1256,30 @@ int handle_sec_auth_init(int cfd, sec_mod_st *sec, const SecAuthInitMsg *req, pi
 		}
 	}
 
-	e->status = PS_AUTH_INIT;
-	seclog(sec, LOG_DEBUG, "auth init %sfor user '%s' "SESSION_STR" of group: '%s' from '%s'", 
-	       req->tls_auth_ok?"(with cert) ":"",
-	       e->acct_info.username, e->acct_info.safe_id, e->acct_info.groupname, req->ip);
+	if (e->module) {
+		c = new_auth_call(sec, e, wreq);
+		if (c == NULL) {
+			ret = -1;
+			goto cleanup;
+		}
+
+		/* the request is released before a queued call runs */
+		c->st.username = talloc_strdup(c, req->user_name);
+		c->st.ip = talloc_strdup(c, req->ip);
+		c->st.our_ip = talloc_strdup(c, req->our_ip);
+		c->st.user_agent = talloc_strdup(c, req->user_agent);
+		c->st.id = pid;
 
-	if (need_continue != 0) {
-		ret = ERR_AUTH_CONTINUE;
-		goto cleanup;
+		ret = run_auth_call(sec, c);
+		if (ret == ERR_WAIT_FOR_AUTH)
+			return ret;
+
+		return finish_auth_init(sec, c, e, wreq, ret);
 	}
 
 	ret = 0;
  cleanup:
-	return handle_sec_auth_res(cfd, sec, e, ret);
+	return finish_auth_init(sec, NULL, e, wreq, ret);
 }
 
 void sec_auth_user_deinit(sec_mod_st *sec, client_entry_st *e)
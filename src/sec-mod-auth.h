@@ -32,13 +32,26 @@ typedef struct passwd_msg_st {
 } passwd_msg_st;
 
 typedef struct auth_mod_st {
+	const char *name;
 	unsigned int type;
 	unsigned int allows_retries; /* whether the module allows retries of the same password */
+	/* the maximum number of sessions for which the module may be
+	 * called in parallel by the sec-mod threads; zero for no limit.
+	 * When called by a thread, auth_init, auth_pass and auth_msg may
+	 * only allocate from their ctx and pool; these are under a talloc
+	 * root of the call, and the vctx is to be treated as read-only. */
+	unsigned int max_concurrency;
 	void (*vhost_init)(void **vctx, void *pool, void* additional);
 	void (*vhost_deinit)(void *vctx);
 	int (*auth_init)(void **ctx, void *pool, void *vctx, const common_auth_init_st *);
 	int (*auth_msg)(void* ctx, void *pool, passwd_msg_st *);
 	int (*auth_pass)(void* ctx, const char* pass, unsigned pass_len);
+	/* optional; verifies the password without blocking, and is used
+	 * instead of auth_pass, which may then be NULL. It returns
+	 * ERR_WAIT_FOR_AUTH and calls done() with the result once it is
+	 * available, or returns the result directly. */
+	int (*auth_pass_async)(void* ctx, const char* pass, unsigned pass_len,
+			       void (*done)(void *priv, int result), void *priv);
 	int (*auth_group)(void* ctx, const char *suggested, char *groupname, int groupname_size);
 	int (*auth_user)(void* ctx, char *groupname, int groupname_size);
 
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <talloc.h>
+#include <main.h>
+#include <sec-mod.h>
+#include <tracepoints.h>
+
+static int chan_destructor(worker_chan_st *chan)
+{
+	if (chan->fd != -1)
+		close(chan->fd);
+	return 0;
+}
+
+/* Makes room in sec->pfd for the fixed descriptors, the worker
+ * connections and extra more entries. The array only grows. */
+int sec_pollfd_reserve(sec_mod_st *sec, unsigned extra)
+{
+	unsigned need = SEC_POLL_CHANS + sec->worker_chans_size + extra;
+	unsigned max;
+	struct pollfd *pfd;
+	worker_chan_st **chans;
+
+	if (need <= sec->pfd_max)
+		return 0;
+
+	max = MAX(need, sec->pfd_max * 2);
+	max = MAX(max, 64);
+
+	pfd = talloc_realloc(sec, sec->pfd, struct pollfd, max);
+	if (pfd == NULL)
+		return -1;
+	sec->pfd = pfd;
+
+	chans = talloc_realloc(sec, sec->pfd_chans, worker_chan_st *, max);
+	if (chans == NULL)
+		return -1;
+	sec->pfd_chans = chans;
+
+	memset(&sec->pfd[sec->pfd_max], 0, (max - sec->pfd_max) * sizeof(sec->pfd[0]));
+	memset(&sec->pfd_chans[sec->pfd_max], 0, (max - sec->pfd_max) * sizeof(sec->pfd_chans[0]));
+	sec->pfd_max = max;
+
+	return 0;
+}
+
+worker_chan_st *worker_chan_new(sec_mod_st *sec, int fd, pid_t pid)
+{
+	worker_chan_st *chan;
+
+	if (sec_pollfd_reserve(sec, 1) < 0)
+		return NULL;
+
+	chan = talloc_zero(sec, worker_chan_st);
+	if (chan == NULL)
+		return NULL;
+
+	chan->fd = fd;
+	chan->pid = pid;
+	talloc_set_destructor(chan, chan_destructor);
+
+	chan->idx = SEC_POLL_CHANS + sec->worker_chans_size++;
+	sec->pfd[chan->idx].fd = fd;
+	sec->pfd[chan->idx].events = POLLIN;
+	sec->pfd[chan->idx].revents = 0;
+	sec->pfd_chans[chan->idx] = chan;
+
+	return chan;
+}
+
+void worker_chan_close(sec_mod_st *sec, worker_chan_st *chan)
+{
+	unsigned last;
+
+	if (chan->closed)
+		return;
+
+	/* the last connection takes the place of the closed one */
+	last = SEC_POLL_CHANS + --sec->worker_chans_size;
+	if (chan->idx != last) {
+		sec->pfd[chan->idx] = sec->pfd[last];
+		sec->pfd_chans[chan->idx] = sec->pfd_chans[last];
+		sec->pfd_chans[chan->idx]->idx = chan->idx;
+	}
+	sec->pfd_chans[last] = NULL;
+
+	close(chan->fd);
+	chan->fd = -1;
+	chan->closed = 1;
+
+	if (chan->pending == 0)
+		talloc_free(chan);
+}
+
+void worker_req_hold(worker_req_st *req)
+{
+	req->chan->pending++;
+}
+
+/* Called once the reply of a deferred request is sent, with the result
+ * of the request */
+void worker_req_release(worker_req_st *req, int result)
+{
+	worker_chan_st *chan = req->chan;
+
+	TRACE3(sec_request_done, req->cmd, result, WORKER_REQ_TRACE_ID(req));
+
+	chan->pending--;
+	if (chan->closed && chan->pending == 0)
+		talloc_free(chan);
+
+	req->chan = NULL;
+}
+
+int send_worker_reply(void *pool, const worker_req_st *req, uint8_t cmd,
+		      const void *msg, pack_size_func get_size, pack_func pack)
+{
+	/* the worker is gone, or does not expect a reply */
+	if (req->chan->closed || req->id == 0)
+		return 0;
+
+	return send_msg_id(pool, req->chan->fd, cmd, req->id, msg, get_size, pack);
+}
@@ -54,13 +54,38 @@ static size_t rehash(const void *_e, void *unused)
 	return hash_any(e->sid, sizeof(e->sid), 0);
 }
 
+/* The SIDs of the sealed cookies which were invalidated before they
+ * expire */
+typedef struct revoked_sid_st {
+	uint8_t sid[SID_SIZE];
+	time_t exptime;
+	wheel_timer_st timer;
+} revoked_sid_st;
+
+static size_t revoked_rehash(const void *_e, void *unused)
+{
+	const revoked_sid_st *e = _e;
+
+	return hash_any(e->sid, sizeof(e->sid), 0);
+}
+
+static void client_entry_expired(void *priv, wheel_timer_st *t);
+static void revoked_sid_expired(void *priv, wheel_timer_st *t);
+
 void *sec_mod_client_db_init(sec_mod_st *sec)
 {
 	struct htable *db = talloc(sec, struct htable);
 	if (db == NULL)
 		return NULL;
 
+	sec->revoked_db = talloc(sec, struct htable);
+	if (sec->revoked_db == NULL) {
+		talloc_free(db);
+		return NULL;
+	}
+
 	htable_init(db, rehash, NULL);
+	htable_init(sec->revoked_db, revoked_rehash, NULL);
 	sec->client_db = db;
 
 	return db;
@@ -72,6 +97,9 @@ struct htable *db = sec->client_db;
 
 	htable_clear(db);
 	talloc_free(db);
+
+	htable_clear(sec->revoked_db);
+	talloc_free(sec->revoked_db);
 }
 
 /* The number of elements */
@@ -130,6 +158,9 @@ client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, c
 		goto fail;
 	}
 
+	wheel_timer_init(&e->timer, client_entry_expired);
+	arm_client_entry(sec, e);
+
 	return e;
 
  fail:
@@ -137,6 +168,94 @@ client_entry_st *new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *vhost, c
 	return NULL;
 }
 
+/* Restores the entry of a sealed cookie which is not in the database */
+client_entry_st *new_client_entry_from_cookie(sec_mod_st *sec, struct vhost_cfg_st *vhost,
+					      const sealed_cookie_st *c)
+{
+	struct htable *db = sec->client_db;
+	client_entry_st *e;
+
+	e = talloc_zero(db, client_entry_st);
+	if (e == NULL) {
+		return NULL;
+	}
+
+	memcpy(e->sid, c->sid, sizeof(e->sid));
+	calc_safe_id(e->sid, SID_SIZE, (char *)e->acct_info.safe_id, sizeof(e->acct_info.safe_id));
+
+	strlcpy(e->acct_info.username, c->username, sizeof(e->acct_info.username));
+	strlcpy(e->acct_info.groupname, c->groupname, sizeof(e->acct_info.groupname));
+	strlcpy(e->acct_info.remote_ip, c->remote_ip, sizeof(e->acct_info.remote_ip));
+	strlcpy(e->acct_info.our_ip, c->our_ip, sizeof(e->acct_info.our_ip));
+	strlcpy(e->acct_info.user_agent, c->user_agent, sizeof(e->acct_info.user_agent));
+	e->tls_auth_ok = c->tls_auth_ok;
+	e->vhost = vhost;
+
+	e->status = PS_AUTH_COMPLETED;
+	e->created = c->created;
+	e->cookie_exptime = c->expires;
+	e->exptime = time(0) + vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
+
+	if (htable_add(db, rehash(e, NULL), e) == 0) {
+		seclog(sec, LOG_ERR,
+		       "could not add client entry to hash table");
+		talloc_free(e);
+		return NULL;
+	}
+
+	wheel_timer_init(&e->timer, client_entry_expired);
+	arm_client_entry(sec, e);
+
+	return e;
+}
+
+void client_entry_to_cookie(const client_entry_st *e, sealed_cookie_st *c)
+{
+	memset(c, 0, sizeof(*c));
+	memcpy(c->sid, e->sid, sizeof(c->sid));
+	c->created = e->created;
+	c->expires = e->cookie_exptime;
+	c->auth_type = e->auth_type;
+	c->tls_auth_ok = e->tls_auth_ok;
+	strlcpy(c->username, e->acct_info.username, sizeof(c->username));
+	strlcpy(c->groupname, e->acct_info.groupname, sizeof(c->groupname));
+	if (e->vhost->name != NULL)
+		strlcpy(c->vhost, e->vhost->name, sizeof(c->vhost));
+	strlcpy(c->remote_ip, e->acct_info.remote_ip, sizeof(c->remote_ip));
+	strlcpy(c->our_ip, e->acct_info.our_ip, sizeof(c->our_ip));
+	strlcpy(c->user_agent, e->acct_info.user_agent, sizeof(c->user_agent));
+}
+
+/* Writes the entry through to the shared state, so that the other servers
+ * of the cluster can restore it from its session ID; the store seals it
+ * with the cluster key. The entries in use are kept there for
+ * SHARED_SESSION_TTL, the others until they expire. */
+void share_client_entry(sec_mod_st *sec, client_entry_st *e)
+{
+	sealed_cookie_st c;
+	uint8_t data[MAX_COOKIE_SIZE];
+	unsigned size = sizeof(data);
+	time_t now;
+	unsigned ttl;
+
+	if (sec->kv == NULL)
+		return;
+
+	now = time(0);
+	if (e->in_use > 0)
+		ttl = SHARED_SESSION_TTL;
+	else if (e->exptime > now)
+		ttl = e->exptime - now;
+	else
+		return;
+
+	client_entry_to_cookie(e, &c);
+	if (cookie_encode(&c, data, &size) < 0)
+		return;
+
+	kv_store_set(sec->kv, "sid", e->sid, sizeof(e->sid), data, size, ttl);
+}
+
 static bool client_entry_cmp(const void *_c1, void *_c2)
 {
 	const struct client_entry_st *c1 = _c1;
@@ -157,28 +276,218 @@ client_entry_st *find_client_entry(sec_mod_st *sec, uint8_t sid[SID_SIZE])
 	return htable_get(db, rehash(&t, NULL), client_entry_cmp, &t);
 }
 
+static bool revoked_sid_cmp(const void *_c1, void *_c2)
+{
+	const revoked_sid_st *c1 = _c1;
+	const uint8_t *sid = _c2;
+
+	return memcmp(c1->sid, sid, SID_SIZE) == 0;
+}
+
+unsigned client_sid_is_revoked(sec_mod_st *sec, const uint8_t sid[SID_SIZE])
+{
+	return htable_get(sec->revoked_db, hash_any(sid, SID_SIZE, 0),
+			  revoked_sid_cmp, (void*)sid) != NULL;
+}
+
+static revoked_sid_st *add_revoked_sid(sec_mod_st *sec, const uint8_t sid[SID_SIZE],
+				       time_t exptime)
+{
+	revoked_sid_st *r;
+
+	r = talloc(sec->revoked_db, revoked_sid_st);
+	if (r == NULL)
+		return NULL;
+
+	memcpy(r->sid, sid, sizeof(r->sid));
+	r->exptime = exptime;
+
+	if (htable_add(sec->revoked_db, revoked_rehash(r, NULL), r) == 0) {
+		talloc_free(r);
+		return NULL;
+	}
+
+	wheel_timer_init(&r->timer, revoked_sid_expired);
+	timer_wheel_add(&sec->timers, &r->timer, r->exptime);
+	return r;
+}
+
+/* The records of the revocation file: the SID followed by its
+ * expiration as a 64-bit big endian number */
+#define REVOKED_REC_SIZE (SID_SIZE + 8)
+
+static void encode_revoked_sid(const revoked_sid_st *r, uint8_t rec[REVOKED_REC_SIZE])
+{
+	uint64_t t = r->exptime;
+	unsigned i;
+
+	memcpy(rec, r->sid, SID_SIZE);
+	for (i = 0; i < 8; i++)
+		rec[SID_SIZE + i] = t >> (56 - 8*i);
+}
+
+static int write_revoked_sid(int fd, const revoked_sid_st *r)
+{
+	uint8_t rec[REVOKED_REC_SIZE];
+
+	encode_revoked_sid(r, rec);
+	return force_write(fd, rec, sizeof(rec)) == sizeof(rec) ? 0 : -1;
+}
+
+/* Loads the revoked SIDs of the sealed cookies which did not expire,
+ * and keeps the file open to append the new ones. */
+int sec_mod_revoked_open(sec_mod_st *sec, const char *file)
+{
+	uint8_t rec[REVOKED_REC_SIZE];
+	time_t now = time(0);
+	uint64_t t;
+	unsigned i, n = 0;
+	off_t off = 0;
+	int fd;
+
+	sec->revoked_fd = -1;
+	if (file == NULL)
+		return 0;
+
+	fd = open(file, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+	if (fd == -1) {
+		int e = errno;
+		seclog(sec, LOG_ERR, "cannot open the revocation file '%s': %s",
+		       file, strerror(e));
+		return -1;
+	}
+
+	while (force_read(fd, rec, sizeof(rec)) == sizeof(rec)) {
+		off += sizeof(rec);
+		for (t = 0, i = 0; i < 8; i++)
+			t = (t << 8) | rec[SID_SIZE + i];
+
+		if ((time_t)t <= now || client_sid_is_revoked(sec, rec)) {
+			sec->revoked_expired++;
+			continue;
+		}
+
+		if (add_revoked_sid(sec, rec, t) != NULL)
+			n++;
+	}
+
+	/* a record cut by a crash would misalign the following ones */
+	if (ftruncate(fd, off) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	sec->revoked_fd = fd;
+	seclog(sec, LOG_DEBUG, "loaded %u revoked cookies from '%s'", n, file);
+	return 0;
+}
+
+/* Rewrites the revocation file without the expired records */
+void sec_mod_revoked_compact(sec_mod_st *sec, const char *file)
+{
+	struct htable_iter iter;
+	revoked_sid_st *r;
+	char *tmpfile;
+	int fd;
+
+	if (sec->revoked_fd == -1 || sec->revoked_expired == 0)
+		return;
+
+	tmpfile = talloc_asprintf(sec, "%s.tmp", file);
+	if (tmpfile == NULL)
+		return;
+
+	fd = open(tmpfile, O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0600);
+	if (fd == -1)
+		goto fail;
+
+	r = htable_first(sec->revoked_db, &iter);
+	while (r != NULL) {
+		if (write_revoked_sid(fd, r) < 0)
+			goto fail;
+		r = htable_next(sec->revoked_db, &iter);
+	}
+
+	if (fdatasync(fd) < 0 || rename(tmpfile, file) < 0)
+		goto fail;
+
+	close(sec->revoked_fd);
+	sec->revoked_fd = fd;
+	sec->revoked_expired = 0;
+	talloc_free(tmpfile);
+	return;
+ fail:
+	seclog(sec, LOG_ERR, "cannot rewrite the revocation file '%s'", file);
+	if (fd != -1) {
+		close(fd);
+		unlink(tmpfile);
+	}
+	talloc_free(tmpfile);
+}
+
+/* Prevents the sealed cookie of the entry from restoring it */
+static void revoke_client_entry(sec_mod_st *sec, client_entry_st *e)
+{
+	revoked_sid_st *r;
+
+	if (e->cookie_exptime <= time(0) || client_sid_is_revoked(sec, e->sid))
+		return;
+
+	r = add_revoked_sid(sec, e->sid, e->cookie_exptime);
+	if (r == NULL)
+		return;
+
+	if (sec->revoked_fd != -1 && write_revoked_sid(sec->revoked_fd, r) < 0)
+		seclog(sec, LOG_ERR, "cannot write to the revocation file");
+}
+
+static void revoked_sid_expired(void *priv, wheel_timer_st *t)
+{
+	sec_mod_st *sec = priv;
+	revoked_sid_st *r = container_of(t, revoked_sid_st, timer);
+
+	htable_del(sec->revoked_db, revoked_rehash(r, NULL), r);
+	talloc_free(r);
+	if (sec->revoked_fd != -1)
+		sec->revoked_expired++;
+}
+
 static void clean_entry(sec_mod_st *sec, client_entry_st * e)
 {
+	timer_wheel_del(&sec->timers, &e->timer);
 	sec_auth_user_deinit(sec, e);
 	talloc_free(e->msg_str);
 	talloc_free(e);
 }
 
-void cleanup_client_entries(sec_mod_st *sec)
+/* Arms the expiration of the entry; the entries which are in use when it
+ * is due are armed again by expire_client_entry(), and the ones with a
+ * pending module call once it completes. */
+void arm_client_entry(sec_mod_st *sec, client_entry_st *e)
 {
-	struct htable *db = sec->client_db;
-	client_entry_st *t;
-	struct htable_iter iter;
-	time_t now = time(0);
+	if (e->exptime == -1)
+		timer_wheel_del(&sec->timers, &e->timer);
+	else
+		timer_wheel_add(&sec->timers, &e->timer, e->exptime);
+}
 
-	t = htable_first(db, &iter);
-	while (t != NULL) {
-		if IS_CLIENT_ENTRY_EXPIRED_FULL(sec, t, now, 1) {
-			htable_delval(db, &iter);
-			clean_entry(sec, t);
-		}
-		t = htable_next(db, &iter);
+static void client_entry_expired(void *priv, wheel_timer_st *t)
+{
+	sec_mod_st *sec = priv;
+	client_entry_st *e = container_of(t, client_entry_st, timer);
+	time_t now = time(0);
 
+	if IS_CLIENT_ENTRY_EXPIRED_FULL(sec, e, now, 1) {
+		/* the user logged out */
+		if (e->discon_reason == REASON_USER_DISCONNECT &&
+		    e->vhost->perm_config.config->persistent_cookies == 0)
+			revoke_client_entry(sec, e);
+
+		htable_del(sec->client_db, rehash(e, NULL), e);
+		clean_entry(sec, e);
+	} else if (e->in_use == 0 && e->auth_pending == 0) {
+		/* its expiration was extended */
+		arm_client_entry(sec, e);
 	}
 }
 
@@ -186,6 +495,10 @@ void del_client_entry(sec_mod_st *sec, client_entry_st * e)
 {
 	struct htable *db = sec->client_db;
 
+	revoke_client_entry(sec, e);
+	if (sec->kv != NULL)
+		kv_store_del(sec->kv, "sid", e->sid, sizeof(e->sid));
+
 	htable_del(db, rehash(e, NULL), e);
 	clean_entry(sec, e);
 }
@@ -215,6 +528,8 @@ void expire_client_entry(sec_mod_st *sec, client_entry_st * e)
 			} else {
 				e->exptime = now + e->vhost->perm_config.config->cookie_timeout + AUTH_SLACK_TIME;
 			}
+			arm_client_entry(sec, e);
+			share_client_entry(sec, e);
 			seclog(sec, LOG_INFO, "temporarily closing session for %s "SESSION_STR, e->acct_info.username, e->acct_info.safe_id);
 		}
 	}
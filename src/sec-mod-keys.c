@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <talloc.h>
+#include <defs.h>
+#include <sec-mod-keys.h>
+
+int sec_key_op(gnutls_privkey_t key, unsigned cmd, unsigned sig,
+	       const gnutls_datum_t *data, gnutls_datum_t *out)
+{
+	switch (cmd) {
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+	case CMD_SEC_SIGN_DATA:
+		return gnutls_privkey_sign_data2(key, sig, 0, data, out);
+	case CMD_SEC_SIGN_HASH:
+		return gnutls_privkey_sign_hash2(key, sig, 0, data, out);
+#endif
+	case CMD_SEC_DECRYPT:
+		return gnutls_privkey_decrypt_data(key, 0, data, out);
+	case CMD_SEC_SIGN:
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+		return gnutls_privkey_sign_hash(key, 0,
+						GNUTLS_PRIVKEY_SIGN_FLAG_TLS1_RSA,
+						data, out);
+#else
+		return gnutls_privkey_sign_raw_data(key, 0, data, out);
+#endif
+	default:
+		return GNUTLS_E_INVALID_REQUEST;
+	}
+}
+
+static void key_op_work(sec_job_st *job)
+{
+	key_op_st *op = (key_op_st *)job;
+
+	op->ret = sec_key_op(op->key, op->cmd, op->sig, &op->data, &op->out);
+}
+
+static int key_op_destructor(key_op_st *op)
+{
+	gnutls_free(op->out.data);
+	return 0;
+}
+
+key_op_st *key_op_new(void *pool, gnutls_privkey_t key, unsigned cmd,
+		      unsigned sig, const gnutls_datum_t *data)
+{
+	key_op_st *op;
+
+	op = talloc_zero(pool, key_op_st);
+	if (op == NULL)
+		return NULL;
+
+	op->data.data = talloc_memdup(op, data->data, data->size);
+	if (op->data.data == NULL && data->size > 0) {
+		talloc_free(op);
+		return NULL;
+	}
+	op->data.size = data->size;
+
+	op->key = key;
+	op->cmd = cmd;
+	op->sig = sig;
+	op->job.work = key_op_work;
+	talloc_set_destructor(op, key_op_destructor);
+
+	return op;
+}
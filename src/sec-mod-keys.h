@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SEC_MOD_KEYS_H
+# define SEC_MOD_KEYS_H
+
+#include <gnutls/gnutls.h>
+#include <gnutls/abstract.h>
+#include <sec-mod-threads.h>
+
+/* A private key operation requested by a worker, run by the key
+ * threads. The data are copied, as the request buffer is released
+ * before the operation completes. */
+typedef struct key_op_st {
+	sec_job_st job;
+
+	void *priv; /* the request to reply to; set by the caller */
+	unsigned cmd;
+	unsigned sig;
+	gnutls_privkey_t key;
+	gnutls_datum_t data;
+
+	/* set by the thread */
+	gnutls_datum_t out;
+	int ret;
+} key_op_st;
+
+/* Performs the operation identified by cmd (CMD_SEC_SIGN, CMD_SEC_DECRYPT,
+ * CMD_SEC_SIGN_DATA or CMD_SEC_SIGN_HASH); the output must be released
+ * with gnutls_free(). Returns a negative gnutls error code on failure. */
+int sec_key_op(gnutls_privkey_t key, unsigned cmd, unsigned sig,
+	       const gnutls_datum_t *data, gnutls_datum_t *out);
+
+/* Allocates an operation whose work() calls sec_key_op(); the caller
+ * sets job.done and job.data. The output is released with the
+ * operation. */
+key_op_st *key_op_new(void *pool, gnutls_privkey_t key, unsigned cmd,
+		      unsigned sig, const gnutls_datum_t *data);
+
+#endif
@@ -39,6 +39,156 @@
 #include <ip-util.h>
 #include <tlslib.h>
 
+/* The sessions are written through to the state shared by the cluster,
+ * where they are kept, sealed with the cluster key, as:
+ *   vhost length (1) | vhost | address length (1) | address | session data
+ * and looked up when they are not found locally.
+ */
+static void share_tls_session(sec_mod_st *sec, const SessionResumeStoreReqMsg *req)
+{
+	uint8_t data[2 + MAX_HOSTNAME_SIZE + sizeof(struct sockaddr_storage) + MAX_SESSION_DATA_SIZE];
+	unsigned vhost_len = req->vhost ? strlen(req->vhost) : 0;
+	uint8_t *p = data;
+
+	if (sec->kv == NULL)
+		return;
+
+	if (vhost_len >= MAX_HOSTNAME_SIZE || req->cli_addr.len > sizeof(struct sockaddr_storage))
+		return;
+
+	*p++ = vhost_len;
+	memcpy(p, req->vhost, vhost_len);
+	p += vhost_len;
+	*p++ = req->cli_addr.len;
+	memcpy(p, req->cli_addr.data, req->cli_addr.len);
+	p += req->cli_addr.len;
+	memcpy(p, req->session_data.data, req->session_data.len);
+	p += req->session_data.len;
+
+	kv_store_set(sec->kv, "tls", req->session_id.data, req->session_id.len,
+		     data, p - data, TLS_SESSION_EXPIRATION_TIME(GETCONFIG(sec)));
+	safe_memset(data, 0, sizeof(data));
+}
+
+/* Sets the session of the shared state in the reply, if it was established
+ * by the same client address on the same vhost */
+static void reply_shared_tls_session(const char *vhost, const uint8_t *cli_addr, unsigned cli_addr_len,
+				     const kv_value_st *value, SessionResumeReplyMsg *rep)
+{
+	const uint8_t *p = value->data, *end = value->data + value->size;
+	struct sockaddr_storage addr;
+	unsigned len;
+
+	if (p >= end)
+		return;
+	len = *p++;
+	if (p + len >= end || len != (vhost ? strlen(vhost) : 0) ||
+	    (len > 0 && c_strncasecmp((const char *)p, vhost, len) != 0))
+		return;
+	p += len;
+
+	len = *p++;
+	if (p + len > end || len != cli_addr_len || len > sizeof(addr))
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	memcpy(&addr, p, len);
+	if (ip_cmp((struct sockaddr_storage *)cli_addr, &addr) != 0)
+		return;
+	p += len;
+
+	rep->reply = SESSION_RESUME_REPLY_MSG__RESUME__REP__OK;
+	rep->has_session_data = 1;
+	rep->session_data.data = (void *)p;
+	rep->session_data.len = end - p;
+}
+
+typedef struct resume_fetch_st {
+	sec_mod_st *sec;
+	worker_req_st req;
+	char *vhost;
+	uint8_t *cli_addr;
+	unsigned cli_addr_len;
+} resume_fetch_st;
+
+static void resume_fetch_done(void *priv, int status, const kv_value_st *value)
+{
+	resume_fetch_st *f = priv;
+	SessionResumeReplyMsg rep = SESSION_RESUME_REPLY_MSG__INIT;
+	int ret;
+
+	rep.reply = SESSION_RESUME_REPLY_MSG__RESUME__REP__FAILED;
+	if (status == KV_OK)
+		reply_shared_tls_session(f->vhost, f->cli_addr, f->cli_addr_len, value, &rep);
+
+	if (rep.reply == SESSION_RESUME_REPLY_MSG__RESUME__REP__OK)
+		seclog(f->sec, LOG_DEBUG, "TLS session DB resuming from the shared state");
+
+	ret = send_worker_reply(f, &f->req, RESUME_FETCH_REP, &rep,
+				(pack_size_func) session_resume_reply_msg__get_packed_size,
+				(pack_func) session_resume_reply_msg__pack);
+	if (ret < 0) {
+		seclog(f->sec, LOG_ERR, "could not send reply cmd %d.", RESUME_FETCH_REP);
+		worker_chan_close(f->sec, f->req.chan);
+	}
+
+	worker_req_release(&f->req, ret);
+	talloc_free(f);
+}
+
+/* Looks up a session which is not found locally in the shared state */
+static int fetch_shared_tls_session(sec_mod_st *sec, const worker_req_st *wreq,
+				    const SessionResumeFetchMsg *req,
+				    SessionResumeReplyMsg *rep)
+{
+	resume_fetch_st *f;
+	kv_value_st value;
+	int ret;
+
+	f = talloc_zero(sec, resume_fetch_st);
+	if (f == NULL)
+		return 0;
+
+	f->sec = sec;
+	f->req = *wreq;
+	if (req->vhost)
+		f->vhost = talloc_strdup(f, req->vhost);
+	f->cli_addr = talloc_memdup(f, req->cli_addr.data, req->cli_addr.len);
+	f->cli_addr_len = req->cli_addr.len;
+	if (f->cli_addr == NULL || (req->vhost && f->vhost == NULL)) {
+		talloc_free(f);
+		return 0;
+	}
+
+	ret = kv_store_get(sec->kv, "tls", req->session_id.data, req->session_id.len,
+			   &value, resume_fetch_done, f);
+	if (ret == 0) {
+		worker_req_hold(&f->req);
+		return ERR_WAIT_FOR_STATE;
+	}
+
+	/* the value is valid until the next call to the store */
+	if (ret == 1)
+		reply_shared_tls_session(req->vhost, req->cli_addr.data, req->cli_addr.len,
+					 &value, rep);
+
+	talloc_free(f);
+	return 0;
+}
+
+static void tls_session_expired(void *priv, wheel_timer_st *t)
+{
+	sec_mod_st *sec = priv;
+	tls_cache_st *cache = container_of(t, tls_cache_st, timer);
+
+	htable_del(sec->tls_db.ht, hash_any(cache->session_id, cache->session_id_size, 0), cache);
+	cache->session_id_size = 0;
+
+	safe_memset(cache->session_data, 0, cache->session_data_size);
+	talloc_free(cache);
+	sec->tls_db.entries--;
+}
+
 int handle_resume_delete_req(sec_mod_st *sec,
 			     const SessionResumeFetchMsg *req)
 {
@@ -58,18 +208,22 @@ int handle_resume_delete_req(sec_mod_st *sec,
 			cache->session_id_size = 0;
 
 			htable_delval(sec->tls_db.ht, &iter);
+			timer_wheel_del(&sec->timers, &cache->timer);
 			talloc_free(cache);
 			sec->tls_db.entries--;
-			return 0;
+			break;
 		}
 
 		cache = htable_nextval(sec->tls_db.ht, &iter, key);
 	}
 
+	if (sec->kv != NULL)
+		kv_store_del(sec->kv, "tls", req->session_id.data, req->session_id.len);
+
 	return 0;
 }
 
-int handle_resume_fetch_req(sec_mod_st *sec,
+int handle_resume_fetch_req(sec_mod_st *sec, const worker_req_st *wreq,
 			    const SessionResumeFetchMsg *req,
 			    SessionResumeReplyMsg *rep)
 {
@@ -116,6 +270,9 @@ int handle_resume_fetch_req(sec_mod_st *sec,
 		cache = htable_nextval(sec->tls_db.ht, &iter, key);
 	}
 
+	if (sec->kv != NULL && req->cli_addr.len > 0)
+		return fetch_shared_tls_session(sec, wreq, req, rep);
+
 	return 0;
 
 }
@@ -124,6 +281,7 @@ int handle_resume_store_req(sec_mod_st *sec,
 			    const SessionResumeStoreReqMsg *req)
 {
 	tls_cache_st *cache;
+	gnutls_datum_t d;
 	size_t key;
 	unsigned int max;
 
@@ -168,41 +326,18 @@ int handle_resume_store_req(sec_mod_st *sec,
 	htable_add(sec->tls_db.ht, key, cache);
 	sec->tls_db.entries++;
 
+	d.data = (void *)cache->session_data;
+	d.size = cache->session_data_size;
+
+	wheel_timer_init(&cache->timer, tls_session_expired);
+	timer_wheel_add(&sec->timers, &cache->timer,
+			gnutls_db_check_entry_time(&d) + TLS_SESSION_EXPIRATION_TIME(GETCONFIG(sec)) + 1);
+
+	share_tls_session(sec, req);
+
 	seclog_hex(sec, LOG_DEBUG, "TLS session DB storing",
 				req->session_id.data,
 				req->session_id.len, 0);
 
 	return 0;
 }
-
-void expire_tls_sessions(sec_mod_st *sec)
-{
-	tls_cache_st *cache;
-	struct htable_iter iter;
-	time_t now, exp;
-
-	now = time(0);
-
-	cache = htable_first(sec->tls_db.ht, &iter);
-	while (cache != NULL) {
-		gnutls_datum_t d;
-
-		d.data = (void *)cache->session_data;
-		d.size = cache->session_data_size;
-
-		exp = gnutls_db_check_entry_time(&d);
-
-		if (now - exp > TLS_SESSION_EXPIRATION_TIME(GETCONFIG(sec))) {
-			cache->session_id_size = 0;
-
-			htable_delval(sec->tls_db.ht, &iter);
-
-			safe_memset(cache->session_data, 0, cache->session_data_size);
-			talloc_free(cache);
-			sec->tls_db.entries--;
-		}
-		cache = htable_next(sec->tls_db.ht, &iter);
-	}
-
-	return;
-}
@@ -26,13 +26,13 @@
 int handle_resume_delete_req(sec_mod_st* sec,
   			   const SessionResumeFetchMsg * req);
 
-int handle_resume_fetch_req(sec_mod_st* sec,
+/* Returns ERR_WAIT_FOR_STATE if the session is looked up in the shared
+ * state, in which case the reply to @wreq is sent once it is found. */
+int handle_resume_fetch_req(sec_mod_st* sec, const worker_req_st *wreq,
   			   const SessionResumeFetchMsg * req, 
   			   SessionResumeReplyMsg* rep);
 
 int handle_resume_store_req(sec_mod_st* sec,
   			   const SessionResumeStoreReqMsg *);
 
-void expire_tls_sessions(sec_mod_st *sec);
-
 #endif
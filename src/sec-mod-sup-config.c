@@ -34,6 +34,9 @@ void sup_config_init(sec_mod_st *sec)
 {
 	vhost_cfg_st *vhost = NULL;
 
+	/* the files may have been modified along with the configuration */
+	file_sup_config_reset();
+
 	list_for_each(sec->vconfig, vhost, list) {
 		if (vhost->perm_config.sup_config_type == SUP_CONFIG_FILE) {
 			seclog(sec, LOG_INFO, "%sreading supplemental config from files", PREFIX_VHOST(vhost));
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <talloc.h>
+#include <sec-mod-threads.h>
+#include <gettime.h>
+
+static void *thread_main(void *arg)
+{
+	sec_threads_st *t = arg;
+	sec_job_st *job;
+	ssize_t ret;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (t->stop == 0 && list_empty(&t->ready))
+			pthread_cond_wait(&t->cond, &t->lock);
+
+		if (t->stop)
+			break;
+
+		job = list_top(&t->ready, sec_job_st, list);
+		list_del(&job->list);
+		pthread_mutex_unlock(&t->lock);
+
+		gettime_mono(&job->started);
+		job->work(job);
+
+		pthread_mutex_lock(&t->lock);
+		list_add_tail(&t->done, &job->list);
+
+		/* the pipe is non-blocking; if it is full the sec-mod
+		 * thread has a wake-up pending anyway */
+		do {
+			ret = write(t->notify_fd[1], "", 1);
+		} while (ret == -1 && errno == EINTR);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return NULL;
+}
+
+static int set_nonblock_cloexec(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+		return -1;
+
+	return 0;
+}
+
+static int threads_destructor(sec_threads_st *t)
+{
+	sec_threads_stop(t);
+
+	close(t->notify_fd[0]);
+	close(t->notify_fd[1]);
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->lock);
+
+	return 0;
+}
+
+sec_threads_st *sec_threads_new(void *pool, unsigned nthreads)
+{
+	sec_threads_st *t;
+	sigset_t set, old;
+	unsigned i;
+
+	if (nthreads == 0)
+		return NULL;
+
+	t = talloc_zero(pool, sec_threads_st);
+	if (t == NULL)
+		return NULL;
+
+	list_head_init(&t->ready);
+	list_head_init(&t->done);
+	list_head_init(&t->backends);
+
+	t->threads = talloc_array(t, pthread_t, nthreads);
+	if (t->threads == NULL)
+		goto fail;
+
+	if (pipe(t->notify_fd) == -1)
+		goto fail;
+
+	if (set_nonblock_cloexec(t->notify_fd[0]) < 0 ||
+	    set_nonblock_cloexec(t->notify_fd[1]) < 0) {
+		close(t->notify_fd[0]);
+		close(t->notify_fd[1]);
+		goto fail;
+	}
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	talloc_set_destructor(t, threads_destructor);
+
+	/* signals are handled by the sec-mod thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&t->threads[i], NULL, thread_main, t) != 0)
+			break;
+		t->nthreads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (t->nthreads == 0)
+		goto fail;
+
+	return t;
+ fail:
+	talloc_free(t);
+	return NULL;
+}
+
+void sec_threads_stop(sec_threads_st *t)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&t->lock);
+	t->stop = 1;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+
+	for (i = 0; i < t->nthreads; i++)
+		pthread_join(t->threads[i], NULL);
+	t->nthreads = 0;
+}
+
+sec_backend_st *sec_threads_backend(sec_threads_st *t, const void *key,
+				    const char *name, unsigned limit)
+{
+	sec_backend_st *b;
+
+	list_for_each(&t->backends, b, list) {
+		if (b->key == key)
+			return b;
+	}
+
+	b = talloc_zero(t, sec_backend_st);
+	if (b == NULL)
+		return NULL;
+
+	b->key = key;
+	b->name = name;
+	if (limit == 0 || limit > t->nthreads)
+		limit = t->nthreads;
+	b->limit = limit;
+	list_head_init(&b->waiting);
+
+	list_add_tail(&t->backends, &b->list);
+	return b;
+}
+
+/* moves the job to the list the threads pick from */
+static void start_job(sec_threads_st *t, sec_job_st *job)
+{
+	job->backend->running++;
+
+	pthread_mutex_lock(&t->lock);
+	list_add_tail(&t->ready, &job->list);
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+}
+
+int sec_threads_submit(sec_threads_st *t, sec_backend_st *b, sec_job_st *job)
+{
+	job->backend = b;
+	gettime_mono(&job->queued);
+
+	if (b->running < b->limit) {
+		start_job(t, job);
+		return 0;
+	}
+
+	if (t->total_queued >= MAX_QUEUED_AUTH_JOBS)
+		return -1;
+
+	list_add_tail(&b->waiting, &job->list);
+	b->queued++;
+	t->total_queued++;
+	if (b->queued > b->max_queued)
+		b->max_queued = b->queued;
+
+	return 0;
+}
+
+unsigned sec_threads_complete(sec_threads_st *t)
+{
+	struct list_head completed;
+	sec_backend_st *b;
+	sec_job_st *job, *next;
+	char buf[64];
+	unsigned wait_ms, count = 0;
+
+	while (read(t->notify_fd[0], buf, sizeof(buf)) > 0)
+		;
+
+	list_head_init(&completed);
+
+	pthread_mutex_lock(&t->lock);
+	while ((job = list_top(&t->done, sec_job_st, list)) != NULL) {
+		list_del(&job->list);
+		list_add_tail(&completed, &job->list);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	while ((job = list_top(&completed, sec_job_st, list)) != NULL) {
+		list_del(&job->list);
+		b = job->backend;
+
+		b->running--;
+		b->completed++;
+		wait_ms = timespec_sub_ms(&job->started, &job->queued);
+		if (wait_ms > b->max_wait_ms)
+			b->max_wait_ms = wait_ms;
+
+		next = list_top(&b->waiting, sec_job_st, list);
+		if (next != NULL) {
+			list_del(&next->list);
+			b->queued--;
+			t->total_queued--;
+			start_job(t, next);
+		}
+
+		/* may free the job or submit new ones */
+		job->done(job);
+		count++;
+	}
+
+	return count;
+}
+
+static unsigned pending_jobs(sec_threads_st *t)
+{
+	sec_backend_st *b;
+	unsigned n = 0;
+
+	list_for_each(&t->backends, b, list)
+		n += b->running + b->queued;
+
+	return n;
+}
+
+void sec_threads_drain(sec_threads_st *t)
+{
+	struct pollfd pfd;
+
+	pfd.fd = t->notify_fd[0];
+	pfd.events = POLLIN;
+
+	while (pending_jobs(t) > 0) {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+			break;
+		sec_threads_complete(t);
+	}
+}
+
+void sec_threads_reset_stats(sec_threads_st *t)
+{
+	sec_backend_st *b;
+
+	list_for_each(&t->backends, b, list) {
+		b->max_queued = b->queued;
+		b->max_wait_ms = 0;
+	}
+}
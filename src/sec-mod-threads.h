@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SEC_MOD_THREADS_H
+# define SEC_MOD_THREADS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <ccan/list/list.h>
+
+/* Maximum number of jobs waiting for a backend slot */
+#define MAX_QUEUED_AUTH_JOBS 1024
+
+/* A backend serializes the calls to a module; at most limit of its
+ * jobs run at a time and the rest wait in its queue. It is only
+ * accessed by the sec-mod thread. */
+typedef struct sec_backend_st {
+	struct list_node list;
+	const void *key;
+	const char *name;
+
+	unsigned limit;
+	unsigned running;
+	unsigned queued;
+	struct list_head waiting;
+
+	/* statistics */
+	unsigned max_queued; /* since the last reset */
+	uint32_t max_wait_ms; /* since the last reset */
+	uint64_t completed;
+} sec_backend_st;
+
+typedef struct sec_job_st {
+	struct list_node list;
+	sec_backend_st *backend;
+
+	/* called in a pool thread; it must not touch any state shared
+	 * with the sec-mod thread */
+	void (*work)(struct sec_job_st *job);
+	/* called in the sec-mod thread when work() completes */
+	void (*done)(struct sec_job_st *job);
+	void *data;
+
+	struct timespec queued;
+	struct timespec started;
+} sec_job_st;
+
+typedef struct sec_threads_st {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head ready; /* jobs which may be picked by a thread */
+	struct list_head done; /* completed jobs */
+	unsigned stop;
+
+	/* the threads write a byte to it when they complete a job */
+	int notify_fd[2];
+
+	pthread_t *threads;
+	unsigned nthreads;
+
+	struct list_head backends;
+	unsigned total_queued;
+} sec_threads_st;
+
+sec_threads_st *sec_threads_new(void *pool, unsigned nthreads);
+
+/* Waits for the running jobs and terminates the threads. The queued
+ * jobs are not run. */
+void sec_threads_stop(sec_threads_st *t);
+
+/* Returns the backend identified by key, creating it on first use. A
+ * zero limit, or one larger than the number of threads, allows the
+ * backend to use all threads. */
+sec_backend_st *sec_threads_backend(sec_threads_st *t, const void *key,
+				    const char *name, unsigned limit);
+
+/* Returns zero if the job was queued, or -1 if the queue is full */
+int sec_threads_submit(sec_threads_st *t, sec_backend_st *b, sec_job_st *job);
+
+/* Calls done() for every completed job; to be called when notify_fd[0]
+ * becomes readable. Returns the number of completed jobs. */
+unsigned sec_threads_complete(sec_threads_st *t);
+
+/* Completes every running and queued job, blocking the caller until
+ * they are done. */
+void sec_threads_drain(sec_threads_st *t);
+
+void sec_threads_reset_stats(sec_threads_st *t);
+
+#endif
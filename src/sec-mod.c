@@ -24,7 +24,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <sys/resource.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -42,6 +43,11 @@
 #include <ipc.pb-c.h>
 #include <sec-mod-sup-config.h>
 #include <sec-mod-resume.h>
+#include <sec-mod-threads.h>
+#include <sec-mod-keys.h>
+#include <radius-client.h>
+#include <acct-spool.h>
+#include <tracepoints.h>
 #include <cloexec.h>
 #include <assert.h>
 
@@ -174,7 +180,7 @@ int load_pins(struct perm_cfg_st *config, struct pin_st *s)
 	return 0;
 }
 
-static int handle_op(void *pool, int cfd, sec_mod_st * sec, uint8_t type, uint8_t * rep,
+static int handle_op(void *pool, const worker_req_st *req, sec_mod_st * sec, uint8_t type, uint8_t * rep,
 		     size_t rep_size)
 {
 	SecOpMsg msg = SEC_OP_MSG__INIT;
@@ -183,7 +189,7 @@ static int handle_op(void *pool, int cfd, sec_mod_st * sec, uint8_t type, uint8_
 	msg.data.data = rep;
 	msg.data.len = rep_size;
 
-	ret = send_msg(pool, cfd, type, &msg,
+	ret = send_worker_reply(pool, req, type, &msg,
 		       (pack_size_func) sec_op_msg__get_packed_size,
 		       (pack_func) sec_op_msg__pack);
 	if (ret < 0) {
@@ -193,8 +199,64 @@ static int handle_op(void *pool, int cfd, sec_mod_st * sec, uint8_t type, uint8_
 	return 0;
 }
 
+static void key_op_done(sec_job_st *job)
+{
+	key_op_st *op = (key_op_st *)job;
+	worker_req_st *req = op->priv;
+	sec_mod_st *sec = job->data;
+
+	if (op->ret < 0) {
+		seclog(sec, LOG_INFO, "error in crypto operation: %s",
+		       gnutls_strerror(op->ret));
+		/* the worker does not wait for a reply that never comes */
+		worker_chan_close(sec, req->chan);
+	} else {
+		handle_op(op, req, sec, op->cmd, op->out.data, op->out.size);
+	}
+
+	worker_req_release(req, op->ret < 0 ? op->ret : 0);
+	talloc_free(op);
+}
+
+/* Queues the operation to the key threads; returns ERR_WAIT_FOR_KEY
+ * if queued, in which case the reply is sent by key_op_done(). */
+static int queue_key_op(sec_mod_st *sec, worker_req_st *wreq, gnutls_privkey_t key,
+			unsigned cmd, unsigned sig, const gnutls_datum_t *data)
+{
+	key_op_st *op;
+	worker_req_st *req;
+
+	if (sec->key_threads == NULL)
+		return 0;
+
+	op = key_op_new(NULL, key, cmd, sig, data);
+	if (op == NULL)
+		return 0;
+
+	req = talloc(op, worker_req_st);
+	if (req == NULL) {
+		talloc_free(op);
+		return 0;
+	}
+	*req = *wreq;
+
+	op->priv = req;
+	op->job.done = key_op_done;
+	op->job.data = sec;
+
+	if (sec_threads_submit(sec->key_threads, sec->key_backend, &op->job) < 0) {
+		seclog(sec, LOG_WARNING, "too many queued key operations; performing '%s' directly",
+		       cmd_request_to_str(cmd));
+		talloc_free(op);
+		return 0;
+	}
+
+	worker_req_hold(req);
+	return ERR_WAIT_FOR_KEY;
+}
+
 static
-int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_request_t cmd,
+int process_worker_packet(void *pool, worker_req_st *req, sec_mod_st *sec, cmd_request_t cmd,
 		   uint8_t * buffer, size_t buffer_size)
 {
 	unsigned i;
@@ -236,7 +298,7 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 		pkm->pk = gnutls_privkey_get_pk_algorithm(vhost->key[i], &bits);
 		pkm->bits = bits;
 
-		ret = send_msg(pool, cfd, CMD_SEC_GET_PK, pkm,
+		ret = send_worker_reply(pool, req, CMD_SEC_GET_PK, pkm,
 			       (pack_size_func) sec_get_pk_msg__get_packed_size,
 			       (pack_func) sec_get_pk_msg__pack);
 
@@ -252,42 +314,6 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 
 	case CMD_SEC_SIGN_DATA:
 	case CMD_SEC_SIGN_HASH:
-		op = sec_op_msg__unpack(&pa, data.size, data.data);
-		if (op == NULL) {
-			seclog(sec, LOG_INFO, "error unpacking sec op\n");
-			return -1;
-		}
-
-		vhost = find_vhost(sec->vconfig, op->vhost);
-		assert(vhost != NULL);
-
-		i = op->key_idx;
-		if (op->has_key_idx == 0 || i >= vhost->key_size) {
-			seclog(sec, LOG_INFO,
-			       "%sreceived out-of-bounds key index (%d); have %d keys", PREFIX_VHOST(vhost), i, vhost->key_size);
-			return -1;
-		}
-
-		data.data = op->data.data;
-		data.size = op->data.len;
-
-		if (cmd == CMD_SEC_SIGN_DATA) {
-			ret = gnutls_privkey_sign_data2(vhost->key[i], op->sig, 0, &data, &out);
-		} else {
-			ret = gnutls_privkey_sign_hash2(vhost->key[i], op->sig, 0, &data, &out);
-		}
-		sec_op_msg__free_unpacked(op, &pa);
-
-		if (ret < 0) {
-			seclog(sec, LOG_INFO, "error in crypto operation: %s",
-			       gnutls_strerror(ret));
-			return -1;
-		}
-
-		ret = handle_op(pool, cfd, sec, cmd, out.data, out.size);
-		gnutls_free(out.data);
-
-		return ret;
 #endif
 	case CMD_SEC_SIGN:
 	case CMD_SEC_DECRYPT:
@@ -304,28 +330,20 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 		if (op->has_key_idx == 0 || i >= vhost->key_size) {
 			seclog(sec, LOG_INFO,
 			       "%sreceived out-of-bounds key index (%d); have %d keys", PREFIX_VHOST(vhost), i, vhost->key_size);
+			sec_op_msg__free_unpacked(op, &pa);
 			return -1;
 		}
 
 		data.data = op->data.data;
 		data.size = op->data.len;
 
-		if (cmd == CMD_SEC_DECRYPT) {
-			ret =
-			    gnutls_privkey_decrypt_data(vhost->key[i], 0, &data,
-							&out);
-		} else {
-#if GNUTLS_VERSION_NUMBER >= 0x030200
-			ret =
-			    gnutls_privkey_sign_hash(vhost->key[i], 0,
-						     GNUTLS_PRIVKEY_SIGN_FLAG_TLS1_RSA,
-						     &data, &out);
-#else
-			ret =
-			    gnutls_privkey_sign_raw_data(vhost->key[i], 0, &data,
-							 &out);
-#endif
+		ret = queue_key_op(sec, req, vhost->key[i], cmd, op->sig, &data);
+		if (ret == ERR_WAIT_FOR_KEY) {
+			sec_op_msg__free_unpacked(op, &pa);
+			return ret;
 		}
+
+		ret = sec_key_op(vhost->key[i], cmd, op->sig, &data, &out);
 		sec_op_msg__free_unpacked(op, &pa);
 
 		if (ret < 0) {
@@ -334,7 +352,7 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 			return -1;
 		}
 
-		ret = handle_op(pool, cfd, sec, cmd, out.data, out.size);
+		ret = handle_op(pool, req, sec, cmd, out.data, out.size);
 		gnutls_free(out.data);
 
 		return ret;
@@ -348,12 +366,35 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 				return -1;
 			}
 
-			ret = handle_sec_auth_stats_cmd(sec, tmsg, pid);
+			ret = handle_sec_auth_stats_cmd(sec, tmsg, req->chan->pid);
 			cli_stats_msg__free_unpacked(tmsg, &pa);
+
+			/* the worker waits for the reply on disconnection, to
+			 * verify the data have been accounted */
+			if (ret >= 0)
+				send_worker_reply(pool, req, CMD_SEC_CLI_STATS, NULL, NULL, NULL);
 			return ret;
 		}
 		break;
 
+	case CMD_SEC_SESSION_FETCH:{
+			SecSessionFetchMsg *fmsg;
+
+			fmsg = sec_session_fetch_msg__unpack(&pa, data.size, data.data);
+			if (fmsg == NULL) {
+				seclog(sec, LOG_ERR, "error unpacking data");
+				return -1;
+			}
+
+			ret = handle_sec_session_fetch(req, sec, fmsg);
+			sec_session_fetch_msg__free_unpacked(fmsg, &pa);
+
+			if (ret == ERR_WAIT_FOR_STATE)
+				return ret;
+
+			return send_worker_reply(pool, req, CMD_SEC_SESSION_FETCH, NULL, NULL, NULL);
+		}
+
 	case CMD_SEC_AUTH_INIT:{
 			SecAuthInitMsg *auth_init;
 
@@ -365,7 +406,7 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 				return -1;
 			}
 
-			ret = handle_sec_auth_init(cfd, sec, auth_init, pid);
+			ret = handle_sec_auth_init(req, sec, auth_init);
 			sec_auth_init_msg__free_unpacked(auth_init, &pa);
 			return ret;
 		}
@@ -380,7 +421,7 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 				return -1;
 			}
 
-			ret = handle_sec_auth_cont(cfd, sec, auth_cont);
+			ret = handle_sec_auth_cont(req, sec, auth_cont);
 			sec_auth_cont_msg__free_unpacked(auth_cont, &pa);
 			return ret;
 		}
@@ -448,10 +489,13 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 				return ERR_BAD_COMMAND;
 			}
 
-			ret = handle_resume_fetch_req(sec, fmsg, &msg);
+			ret = handle_resume_fetch_req(sec, req, fmsg, &msg);
 
 			session_resume_fetch_msg__free_unpacked(fmsg, &pa);
 
+			if (ret == ERR_WAIT_FOR_STATE)
+				return ret;
+
 			if (ret < 0) {
 				msg.reply =
 				    SESSION_RESUME_REPLY_MSG__RESUME__REP__FAILED;
@@ -463,7 +507,7 @@ int process_worker_packet(void *pool, int cfd, pid_t pid, sec_mod_st *sec, cmd_r
 			}
 
 			ret =
-			    send_msg(pool, cfd, RESUME_FETCH_REP, &msg,
+			    send_worker_reply(pool, req, RESUME_FETCH_REP, &msg,
 					       (pack_size_func)
 					       session_resume_reply_msg__get_packed_size,
 					       (pack_func)
@@ -577,11 +621,70 @@ static void handle_sigterm(int signo)
 	need_exit = 1;
 }
 
+static unsigned count_backends(sec_threads_st *t)
+{
+	sec_backend_st *b;
+	unsigned n = 0;
+
+	if (t == NULL)
+		return 0;
+
+	list_for_each(&t->backends, b, list)
+		n++;
+
+	return n;
+}
+
+static void append_backend_stats(sec_threads_st *t, AuthBackendStatsMsg *bmsg,
+				 SecmStatsMsg *msg)
+{
+	sec_backend_st *b;
+
+	if (t == NULL)
+		return;
+
+	list_for_each(&t->backends, b, list) {
+		auth_backend_stats_msg__init(bmsg);
+		bmsg->name = (char*)b->name;
+		bmsg->max_running = b->limit;
+		bmsg->running = b->running;
+		bmsg->queued = b->queued;
+		bmsg->max_queued = b->max_queued;
+		bmsg->max_wait_ms = b->max_wait_ms;
+		bmsg->completed = b->completed;
+
+		msg->auth_backends[msg->n_auth_backends++] = bmsg++;
+	}
+
+	sec_threads_reset_stats(t);
+}
+
+/* the auth modules and the private key operations */
+static void append_all_backend_stats(sec_mod_st *sec, void *pool, SecmStatsMsg *msg)
+{
+	AuthBackendStatsMsg *bmsg;
+	unsigned n;
+
+	n = count_backends(sec->threads) + count_backends(sec->key_threads);
+	if (n == 0)
+		return;
+
+	msg->auth_backends = talloc_array(pool, AuthBackendStatsMsg*, n);
+	bmsg = talloc_array(pool, AuthBackendStatsMsg, n);
+	if (msg->auth_backends == NULL || bmsg == NULL)
+		return;
+
+	append_backend_stats(sec->threads, bmsg, msg);
+	append_backend_stats(sec->key_threads, bmsg + msg->n_auth_backends, msg);
+}
+
 static void send_stats_to_main(sec_mod_st *sec)
 {
 	int ret;
 	time_t now = time(0);
 	SecmStatsMsg msg = SECM_STATS_MSG__INIT;
+	acct_spool_stats_st spool_st;
+	void *lpool;
 
 	if (GETPCONFIG(sec)->stats_reset_time != 0 &&
 	    now - sec->last_stats_reset > GETPCONFIG(sec)->stats_reset_time) {
@@ -603,9 +706,27 @@ static void send_stats_to_main(sec_mod_st *sec)
 	msg.secmod_client_entries = sec_mod_client_db_elems(sec);
 	msg.secmod_tlsdb_entries = sec->tls_db.entries;
 
-	ret = send_msg(sec, sec->cmd_fd, CMD_SECM_STATS, &msg,
+	lpool = talloc_new(sec);
+	if (lpool == NULL) {
+		seclog(sec, LOG_ERR, "error in memory allocation");
+		return;
+	}
+
+	append_all_backend_stats(sec, lpool, &msg);
+
+	if (acct_spools_stats(&spool_st) > 0) {
+		msg.acct_spool_records = spool_st.records;
+		msg.has_acct_spool_records = 1;
+		msg.acct_spool_bytes = spool_st.bytes;
+		msg.has_acct_spool_bytes = 1;
+		msg.acct_spool_lag = spool_st.lag;
+		msg.has_acct_spool_lag = 1;
+	}
+
+	ret = send_msg(lpool, sec->cmd_fd, CMD_SECM_STATS, &msg,
 			(pack_size_func) secm_stats_msg__get_packed_size,
 			(pack_func) secm_stats_msg__pack);
+	talloc_free(lpool);
 	if (ret < 0) {
 		seclog(sec, LOG_ERR, "error in sending statistics to main");
 		return;
@@ -621,6 +742,12 @@ static void check_other_work(sec_mod_st *sec)
 	if (need_exit) {
 		unsigned i;
 
+		/* wait for the module calls and key operations in progress */
+		if (sec->threads)
+			sec_threads_stop(sec->threads);
+		if (sec->key_threads)
+			sec_threads_stop(sec->key_threads);
+
 		list_for_each(sec->vconfig, vhost, list) {
 			for (i = 0; i < vhost->key_size; i++) {
 				gnutls_privkey_deinit(vhost->key[i]);
@@ -639,6 +766,9 @@ static void check_other_work(sec_mod_st *sec)
 	if (need_reload) {
 		seclog(sec, LOG_DEBUG, "reloading configuration");
 		reload_cfg_file(sec, sec->vconfig, 0);
+		/* the keys may be replaced; complete the operations using them */
+		if (sec->key_threads)
+			sec_threads_drain(sec->key_threads);
 		load_keys(sec, 0);
 
 		list_for_each(sec->vconfig, vhost, list) {
@@ -651,8 +781,9 @@ static void check_other_work(sec_mod_st *sec)
 
 	if (need_maintainance) {
 		seclog(sec, LOG_DEBUG, "performing maintenance");
-		cleanup_client_entries(sec);
-		expire_tls_sessions(sec);
+		/* the expired cookies, revoked SIDs and TLS sessions */
+		timer_wheel_run(&sec->timers, time(0));
+		sec_mod_revoked_compact(sec, GETPCONFIG(sec)->sealed_cookie_revocation_file);
 		send_stats_to_main(sec);
 		seclog(sec, LOG_DEBUG, "active sessions %d", 
 			sec_mod_client_db_elems(sec));
@@ -702,7 +833,9 @@ int serve_request_main(sec_mod_st *sec, int fd, uint8_t *buffer, unsigned buffer
 		goto leave;
 	}
 
+	TRACE2(sec_request_start, cmd, 0);
 	ret = process_packet_from_main(pool, fd, sec, cmd, buffer, ret);
+	TRACE3(sec_request_done, cmd, ret, 0);
 	if (ret < 0) {
 		seclog(sec, LOG_ERR, "error processing data for '%s' command (%d)", cmd_request_to_str(cmd), ret);
 	}
@@ -712,15 +845,18 @@ int serve_request_main(sec_mod_st *sec, int fd, uint8_t *buffer, unsigned buffer
 }
 
 static
-int serve_request_worker(sec_mod_st *sec, int cfd, pid_t pid, uint8_t *buffer, unsigned buffer_size)
+int serve_request_worker(sec_mod_st *sec, worker_chan_st *chan, uint8_t *buffer, unsigned buffer_size)
 {
 	int ret, e;
 	uint8_t cmd;
 	size_t length;
 	void *pool = buffer;
+	worker_req_st req;
+
+	req.chan = chan;
 
 	/* read request */
-	ret = recv_msg_headers(cfd, &cmd, MAX_WAIT_SECS);
+	ret = recv_msg_headers_id(chan->fd, &cmd, &req.id, MAX_WAIT_SECS);
 	if (ret < 0) {
 		seclog(sec, LOG_DEBUG, "error receiving msg head from worker");
 		goto leave;
@@ -735,7 +871,7 @@ int serve_request_worker(sec_mod_st *sec, int cfd, pid_t pid, uint8_t *buffer, u
 	}
 
 	/* read the body */
-	ret = force_read_timeout(cfd, buffer, length, MAX_WAIT_SECS);
+	ret = force_read_timeout(chan->fd, buffer, length, MAX_WAIT_SECS);
 	if (ret < 0) {
 		e = errno;
 		seclog(sec, LOG_INFO, "error receiving msg body: %s",
@@ -744,7 +880,16 @@ int serve_request_worker(sec_mod_st *sec, int cfd, pid_t pid, uint8_t *buffer, u
 		goto leave;
 	}
 
-	ret = process_worker_packet(pool, cfd, pid, sec, cmd, buffer, ret);
+	req.cmd = cmd;
+
+	TRACE2(sec_request_start, cmd, WORKER_REQ_TRACE_ID(&req));
+	ret = process_worker_packet(pool, &req, sec, cmd, buffer, ret);
+	/* the deferred requests are done in worker_req_release() */
+	if (ret == ERR_WAIT_FOR_AUTH || ret == ERR_WAIT_FOR_KEY ||
+	    ret == ERR_WAIT_FOR_STATE)
+		goto leave;
+
+	TRACE3(sec_request_done, cmd, ret, WORKER_REQ_TRACE_ID(&req));
 	if (ret < 0) {
 		seclog(sec, LOG_DEBUG, "error processing '%s' command (%d)", cmd_request_to_str(cmd), ret);
 	}
@@ -849,6 +994,93 @@ static int load_keys(sec_mod_st *sec, unsigned force)
 	return 0;
 }
 
+/* The private key operations are spread over a pool of threads, so that
+ * the handshake rate is not limited to a single CPU */
+static void start_key_threads(sec_mod_st *sec)
+{
+	unsigned n = GETPCONFIG(sec)->key_threads;
+	long cpus;
+
+	if (n == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = (cpus > 0) ? cpus : 1;
+	}
+	if (n > MAX_KEY_THREADS)
+		n = MAX_KEY_THREADS;
+
+	sec->key_threads = sec_threads_new(sec, n);
+	if (sec->key_threads != NULL)
+		sec->key_backend = sec_threads_backend(sec->key_threads, sec, "private-keys", 0);
+
+	if (sec->key_backend == NULL) {
+		seclog(sec, LOG_ERR, "could not start the key threads; the key operations will be performed directly");
+		talloc_free(sec->key_threads);
+		sec->key_threads = NULL;
+		return;
+	}
+
+	seclog(sec, LOG_DEBUG, "using %u threads for the private key operations", sec->key_threads->nthreads);
+}
+
+/* The key of the sealed cookies is derived from the contents of the
+ * file, which is shared by the servers that accept each other's cookies */
+static int load_cookie_key(sec_mod_st *sec)
+{
+	const char *file = GETPCONFIG(sec)->sealed_cookie_key_file;
+	gnutls_datum_t data;
+	int ret;
+
+	if (file == NULL)
+		return 0;
+
+	ret = gnutls_load_file(file, &data);
+	if (ret < 0) {
+		seclog(sec, LOG_ERR, "error loading file '%s'", file);
+		return -1;
+	}
+
+	sec->cookie_key = talloc(sec, cookie_key_st);
+	if (sec->cookie_key == NULL) {
+		gnutls_free(data.data);
+		return -1;
+	}
+
+	ret = cookie_key_init(sec->cookie_key, data.data, data.size,
+			      GETPCONFIG(sec)->sealed_cookie_lifetime);
+	safe_memset(data.data, 0, data.size);
+	gnutls_free(data.data);
+	if (ret < 0) {
+		seclog(sec, LOG_ERR, "the sealed cookie key file '%s' must contain at least 16 bytes", file);
+		return -1;
+	}
+
+	seclog(sec, LOG_DEBUG, "sealing the cookies with the key in '%s'", file);
+	return 0;
+}
+
+/* Each worker keeps its connection open for its lifetime; make sure
+ * that the open connections are not limited by the default limit */
+static void update_fd_limits(sec_mod_st *sec)
+{
+#ifdef RLIMIT_NOFILE
+	struct rlimit rl;
+	rlim_t max = MAX(4096, GETCONFIG(sec)->max_clients + 64);
+	int ret, e;
+
+	ret = getrlimit(RLIMIT_NOFILE, &rl);
+	if (ret < 0 || rl.rlim_cur >= max)
+		return;
+
+	rl.rlim_cur = MIN(max, rl.rlim_max);
+	ret = setrlimit(RLIMIT_NOFILE, &rl);
+	if (ret < 0) {
+		e = errno;
+		seclog(sec, LOG_INFO, "cannot update file limit(%u): %s",
+		       (unsigned)rl.rlim_cur, strerror(e));
+	}
+#endif
+}
+
 /* sec_mod_server:
  * @config: server configuration
  * @socket_file: the name of the socket
@@ -859,15 +1091,19 @@ static int load_keys(sec_mod_st *sec, unsigned force)
  * It creates the unix domain socket identified by @socket_file
  * and then accepts connections from the workers to it. Then 
  * it serves commands requested on the server's private key.
+ * A worker's connection is kept open, and it may have several
+ * requests outstanding; each reply carries the id of its request.
  *
  * When the operation is decrypt the provided data are
  * decrypted and sent back to worker. The sign operation
  * signs the provided data.
  *
- * The security module's reply to the worker has the
+ * The messages exchanged with the worker have the
  * following format:
- * byte[0-5]: length (uint32_t)
- * byte[5-total]: data (signature or decrypted data)
+ * byte[0]: command
+ * byte[1-4]: length (uint32_t)
+ * byte[5-8]: request id (uint32_t)
+ * byte[9-total]: data (e.g., signature or decrypted data)
  *
  * The reason for having this as a separate process
  * is to avoid any bug on the workers to leak the key.
@@ -883,7 +1119,7 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 {
 	struct sockaddr_un sa;
 	socklen_t sa_len;
-	int cfd, ret, e, n;
+	int cfd, ret, e;
 	unsigned buffer_size;
 	uid_t uid;
 	uint8_t *buffer;
@@ -891,12 +1127,13 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 	sec_mod_st *sec;
 	void *sec_mod_pool;
 	vhost_cfg_st *vhost = NULL;
-	fd_set rd_set;
+	struct pollfd *pfd;
+	unsigned pfd_size, chans_end, i;
+	int timeout_ms, n;
+	worker_chan_st *chan;
 	pid_t pid;
-#ifdef HAVE_PSELECT
+#ifdef HAVE_PPOLL
 	struct timespec ts;
-#else
-	struct timeval ts;
 #endif
 	sigset_t emptyset, blockset;
 
@@ -924,6 +1161,7 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 
 	sec->vconfig = vconfig;
 	sec->config_pool = config_pool;
+	timer_wheel_init(&sec->timers, time(0), sec);
 
 	tls_cache_init(sec, &sec->tls_db);
 	sup_config_init(sec);
@@ -994,7 +1232,36 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 		exit(1);
 	}
 
+	if (load_cookie_key(sec) < 0)
+		exit(1);
+
+	if (sec_mod_revoked_open(sec, sec->cookie_key ?
+				 GETPCONFIG(sec)->sealed_cookie_revocation_file : NULL) < 0)
+		exit(1);
+
+	if (GETPCONFIG(sec)->shared_state_server) {
+		sec->kv = kv_store_new(sec, GETPCONFIG(sec)->shared_state_server,
+				       KV_DEFAULT_TIMEOUT_MS, KV_DEFAULT_CACHE_SECS);
+		if (sec->kv == NULL || sec->cookie_key == NULL ||
+		    kv_store_set_key(sec->kv, sec->cookie_key->secret) < 0) {
+			seclog(sec, LOG_ERR, "could not use the shared state server '%s'",
+			       GETPCONFIG(sec)->shared_state_server);
+			exit(1);
+		}
+	}
+
 	sigprocmask(SIG_BLOCK, &blockset, &sig_default_set);
+
+	if (GETPCONFIG(sec)->auth_threads > 0) {
+		sec->threads = sec_threads_new(sec, GETPCONFIG(sec)->auth_threads);
+		if (sec->threads == NULL) {
+			seclog(sec, LOG_ERR, "could not start the auth threads; the auth modules will be called directly");
+		}
+	}
+
+	start_key_threads(sec);
+	update_fd_limits(sec);
+
 	alarm(MAINTAINANCE_TIME);
 	seclog(sec, LOG_INFO, "sec-mod initialized (socket: %s)", SOCKET_FILE);
 
@@ -1002,35 +1269,61 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 	for (;;) {
 		check_other_work(sec);
 
-		FD_ZERO(&rd_set);
-		n = 0;
-
-		FD_SET(cmd_fd, &rd_set);
-		n = MAX(n, cmd_fd);
-
-		FD_SET(cmd_fd_sync, &rd_set);
-		n = MAX(n, cmd_fd_sync);
-
-		FD_SET(sd, &rd_set);
-		n = MAX(n, sd);
-
-#ifdef HAVE_PSELECT
-		ts.tv_nsec = 0;
-		ts.tv_sec = 120;
-		ret = pselect(n + 1, &rd_set, NULL, NULL, &ts, &emptyset);
+		/* the fixed fds, followed by the worker connections, which
+		 * are kept in sec->pfd as they are added and removed, and
+		 * the radius client sockets */
+		if (sec_pollfd_reserve(sec, rad_clients_pollfd_size()) < 0) {
+			seclog(sec, LOG_ERR, "error in memory allocation");
+			exit(1);
+		}
+		pfd = sec->pfd;
+		chans_end = SEC_POLL_CHANS + sec->worker_chans_size;
+		pfd_size = chans_end + rad_clients_fill_pollfd(&pfd[chans_end]);
+
+		pfd[0].fd = cmd_fd;
+		pfd[1].fd = cmd_fd_sync;
+		pfd[2].fd = sd;
+		pfd[3].fd = sec->threads ? sec->threads->notify_fd[0] : -1;
+		pfd[4].fd = sec->key_threads ? sec->key_threads->notify_fd[0] : -1;
+		pfd[5].fd = sec->kv ? kv_store_fd(sec->kv) : -1;
+
+		for (i = 0; i < SEC_POLL_CHANS; i++)
+			pfd[i].events = POLLIN;
+		if (sec->kv)
+			pfd[5].events = kv_store_events(sec->kv);
+
+		timeout_ms = rad_clients_timeout();
+		n = acct_spools_timeout();
+		if (n >= 0 && (timeout_ms < 0 || n < timeout_ms))
+			timeout_ms = n;
+		n = sec->kv ? kv_store_timeout(sec->kv) : -1;
+		if (n >= 0 && (timeout_ms < 0 || n < timeout_ms))
+			timeout_ms = n;
+		if (timeout_ms < 0 || timeout_ms > 120*1000)
+			timeout_ms = 120*1000;
+
+#ifdef HAVE_PPOLL
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+		ret = ppoll(pfd, pfd_size, &ts, &emptyset);
 #else
-		ts.tv_usec = 0;
-		ts.tv_sec = 120;
 		sigprocmask(SIG_UNBLOCK, &blockset, NULL);
-		ret = select(n + 1, &rd_set, NULL, NULL, &ts);
+		ret = poll(pfd, pfd_size, timeout_ms);
 		sigprocmask(SIG_BLOCK, &blockset, NULL);
 #endif
-		if (ret == 0 || (ret == -1 && errno == EINTR))
+		if (ret == 0 || (ret == -1 && errno == EINTR)) {
+			/* retransmissions, accounting records and the
+			 * timeouts of the shared state */
+			rad_clients_process();
+			acct_spools_process();
+			if (sec->kv)
+				kv_store_process(sec->kv);
 			continue;
+		}
 
 		if (ret < 0) {
 			e = errno;
-			seclog(sec, LOG_ERR, "Error in pselect(): %s",
+			seclog(sec, LOG_ERR, "Error in poll(): %s",
 			       strerror(e));
 			exit(1);
 		}
@@ -1047,7 +1340,7 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 		/* we use two fds for communication with main. The synchronous is for
 		 * ping-pong communication which each request is answered immediated. The
 		 * async is for messages sent back and forth in no particular order */
-		if (FD_ISSET(cmd_fd_sync, &rd_set)) {
+		if (pfd[1].revents & (POLLIN|POLLHUP)) {
 			ret = serve_request_main(sec, cmd_fd_sync, buffer, buffer_size);
 			if (ret < 0 && ret == ERR_BAD_COMMAND) {
 				seclog(sec, LOG_ERR, "error processing sync command from main");
@@ -1055,15 +1348,55 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 			}
 		}
 
-		if (FD_ISSET(cmd_fd, &rd_set)) {
+		if (pfd[0].revents & (POLLIN|POLLHUP)) {
 			ret = serve_request_main(sec, cmd_fd, buffer, buffer_size);
 			if (ret < 0 && ret == ERR_BAD_COMMAND) {
 				seclog(sec, LOG_ERR, "error processing async command from main");
 				exit(1);
 			}
 		}
-		
-		if (FD_ISSET(sd, &rd_set)) {
+
+		/* a closed connection is replaced in pfd by the last one,
+		 * whose events are then checked at the same index; the new
+		 * ones, added below, are not polled yet */
+		i = SEC_POLL_CHANS;
+		while (i < SEC_POLL_CHANS + sec->worker_chans_size) {
+			chan = sec->pfd_chans[i];
+
+			if (pfd[i].revents & POLLIN) {
+				memset(buffer, 0, buffer_size);
+				ret = serve_request_worker(sec, chan, buffer, buffer_size);
+				/* a failed request terminates the connection, as
+				 * the worker no longer waits for its reply */
+				if (ret < 0 && ret != ERR_WAIT_FOR_AUTH && ret != ERR_WAIT_FOR_KEY &&
+				    ret != ERR_WAIT_FOR_STATE)
+					worker_chan_close(sec, chan);
+			} else if (pfd[i].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+				worker_chan_close(sec, chan);
+			}
+
+			if (sec->pfd_chans[i] == chan)
+				i++;
+		}
+
+		/* complete the requests whose module calls have finished; that
+		 * is done after the connections are served, as it may close
+		 * some of them */
+		if (pfd[3].revents & POLLIN) {
+			sec_threads_complete(sec->threads);
+		}
+
+		if (pfd[4].revents & POLLIN) {
+			sec_threads_complete(sec->key_threads);
+		}
+
+		/* and those waiting for a radius server or the shared state */
+		rad_clients_process();
+		acct_spools_process();
+		if (sec->kv)
+			kv_store_process(sec->kv);
+
+		if (pfd[2].revents & POLLIN) {
 			sa_len = sizeof(sa);
 			cfd = accept(sd, (struct sockaddr *)&sa, &sa_len);
 			if (cfd == -1) {
@@ -1072,8 +1405,8 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 					seclog(sec, LOG_DEBUG,
 					       "sec-mod error accepting connection: %s",
 					       strerror(e));
-					goto cont;
 				}
+				goto cont;
 			}
 			set_cloexec_flag (cfd, 1);
 
@@ -1084,11 +1417,11 @@ void sec_mod_server(void *main_pool, void *config_pool, struct list_head *vconfi
 					     &uid, &pid);
 			if (ret < 0) {
 				seclog(sec, LOG_INFO, "rejected unauthorized connection");
-			} else {
-				memset(buffer, 0, buffer_size);
-				serve_request_worker(sec, cfd, pid, buffer, buffer_size);
+				close(cfd);
+			} else if (worker_chan_new(sec, cfd, pid) == NULL) {
+				seclog(sec, LOG_ERR, "error in memory allocation");
+				close(cfd);
 			}
-			close(cfd);
 		}
  cont:
 		talloc_free(buffer);
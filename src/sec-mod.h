@@ -28,8 +28,14 @@
 #include "common/common.h"
 
 #include "vhost.h"
+#include "sealed-cookie.h"
+#include "kv-store.h"
+#include "common/timer-wheel.h"
 
 #define SESSION_STR "(session: %.6s)"
+
+/* the time the sessions in use are kept in the shared state */
+#define SHARED_SESSION_TTL (24*60*60)
 #define MAX_GROUPS 32
 
 typedef struct sec_mod_st {
@@ -37,6 +43,12 @@ typedef struct sec_mod_st {
 	void *config_pool;
 
 	struct htable *client_db;
+	struct htable *revoked_db; /* the invalidated sealed cookies */
+	int revoked_fd; /* the file keeping revoked_db over restarts; -1 if not used */
+	unsigned revoked_expired; /* the records of the file which expired */
+	cookie_key_st *cookie_key; /* NULL if the cookies are not sealed */
+	kv_store_st *kv; /* the state shared with the cluster; NULL if not used */
+	timer_wheel_st timers; /* the expiration of the entries of the databases */
 	int cmd_fd;
 	int cmd_fd_sync;
 
@@ -46,8 +58,48 @@ typedef struct sec_mod_st {
 	uint32_t avg_auth_time; /* the average time spent in (sucessful) authentication */
 	uint32_t total_authentications; /* successful authentications: to calculate the average above */
 	time_t last_stats_reset;
+
+	struct sec_threads_st *threads; /* NULL if the auth modules are called directly */
+	struct sec_threads_st *key_threads; /* NULL if the key operations are done directly */
+	struct sec_backend_st *key_backend;
+
+	/* the descriptors polled by the loop: SEC_POLL_CHANS fixed ones,
+	 * the worker connections, and the radius client sockets, which
+	 * are refilled at each iteration */
+	struct pollfd *pfd;
+	struct worker_chan_st **pfd_chans; /* the connection of each pfd entry */
+	unsigned pfd_max; /* allocated entries */
+	unsigned worker_chans_size;
 } sec_mod_st;
 
+/* the number of fixed descriptors which precede the worker connections
+ * in sec_mod_st.pfd */
+#define SEC_POLL_CHANS 6
+
+/* The persistent connection of a worker process. Requests carry an id
+ * which is echoed in their replies, so that several requests may be
+ * outstanding. */
+typedef struct worker_chan_st {
+	unsigned idx; /* the entry in sec_mod_st.pfd */
+	int fd;
+	pid_t pid;
+
+	/* requests completed by the sec-mod threads */
+	unsigned pending;
+	/* the connection was closed; the structure is released once no
+	 * request is pending */
+	unsigned closed;
+} worker_chan_st;
+
+typedef struct worker_req_st {
+	worker_chan_st *chan;
+	uint32_t id; /* zero if the worker expects no reply */
+	uint8_t cmd; /* the request, for the tracepoints */
+} worker_req_st;
+
+/* Identifies a worker request in the sec_request_* tracepoints */
+#define WORKER_REQ_TRACE_ID(req) (((uint64_t)(req)->chan->pid << 32) | (req)->id)
+
 typedef struct stats_st {
 	uint64_t bytes_in;
 	uint64_t bytes_out;
@@ -74,7 +126,7 @@ typedef struct common_acct_info_st {
 	unsigned id;
 } common_acct_info_st;
 
-#define IS_CLIENT_ENTRY_EXPIRED_FULL(sec, e, now, clean) (e->exptime != -1 && now >= e->exptime && e->in_use == 0)
+#define IS_CLIENT_ENTRY_EXPIRED_FULL(sec, e, now, clean) (e->exptime != -1 && now >= e->exptime && e->in_use == 0 && e->auth_pending == 0)
 #define IS_CLIENT_ENTRY_EXPIRED(sec, e, now) IS_CLIENT_ENTRY_EXPIRED_FULL(sec, e, now, 0)
 
 typedef struct client_entry_st {
@@ -88,6 +140,12 @@ typedef struct client_entry_st {
 	void *auth_ctx; /* the context of authentication */
 	unsigned session_is_open; /* whether open_session was done */
 	unsigned in_use; /* counter of users of this structure */
+	unsigned auth_pending; /* a module call for it is run by the auth threads */
+	/* the time the module calls waited for a thread and took; the
+	 * calls timed, excluding the time the client takes to reply */
+	uint64_t auth_queue_usecs;
+	uint64_t auth_backend_usecs;
+	unsigned auth_calls;
 	unsigned tls_auth_ok;
 
 	char *msg_str;
@@ -104,6 +162,9 @@ typedef struct client_entry_st {
 	time_t created;
 	/* The time this client entry is supposed to expire */
 	time_t exptime;
+	/* The time its sealed cookie expires; zero if none was issued */
+	time_t cookie_exptime;
+	wheel_timer_st timer; /* armed at exptime when not in use */
 
 	/* the auth type associated with the user */
 	unsigned auth_type;
@@ -131,9 +192,16 @@ void sec_mod_client_db_deinit(sec_mod_st *sec);
 unsigned sec_mod_client_db_elems(sec_mod_st *sec);
 client_entry_st * new_client_entry(sec_mod_st *sec, struct vhost_cfg_st *, const char *ip, unsigned pid);
 client_entry_st * find_client_entry(sec_mod_st *sec, uint8_t sid[SID_SIZE]);
+client_entry_st *new_client_entry_from_cookie(sec_mod_st *sec, struct vhost_cfg_st *vhost,
+					      const sealed_cookie_st *c);
+unsigned client_sid_is_revoked(sec_mod_st *sec, const uint8_t sid[SID_SIZE]);
+int sec_mod_revoked_open(sec_mod_st *sec, const char *file);
+void sec_mod_revoked_compact(sec_mod_st *sec, const char *file);
+void client_entry_to_cookie(const client_entry_st *e, sealed_cookie_st *c);
+void share_client_entry(sec_mod_st *sec, client_entry_st *e);
 void del_client_entry(sec_mod_st *sec, client_entry_st * e);
 void expire_client_entry(sec_mod_st *sec, client_entry_st * e);
-void cleanup_client_entries(sec_mod_st *sec);
+void arm_client_entry(sec_mod_st *sec, client_entry_st *e);
 
 #ifdef __GNUC__
 # define seclog(sec, prio, fmt, ...) \
@@ -153,9 +221,23 @@ void  seclog_hex(const struct sec_mod_st* sec, int priority,
 void sec_auth_init(struct vhost_cfg_st *vhost);
 
 void handle_secm_list_cookies_reply(void *pool, int fd, sec_mod_st *sec);
+
+worker_chan_st *worker_chan_new(sec_mod_st *sec, int fd, pid_t pid);
+void worker_chan_close(sec_mod_st *sec, worker_chan_st *chan);
+int sec_pollfd_reserve(sec_mod_st *sec, unsigned extra);
+
+/* A request completed asynchronously holds its channel until its
+ * reply is sent */
+void worker_req_hold(worker_req_st *req);
+void worker_req_release(worker_req_st *req, int result);
+
+int send_worker_reply(void *pool, const worker_req_st *req, uint8_t cmd,
+		      const void *msg, pack_size_func get_size, pack_func pack);
+
 void handle_sec_auth_ban_ip_reply(sec_mod_st *sec, const BanIpReplyMsg *msg);
-int handle_sec_auth_init(int cfd, sec_mod_st *sec, const SecAuthInitMsg * req, pid_t pid);
-int handle_sec_auth_cont(int cfd, sec_mod_st *sec, const SecAuthContMsg * req);
+int handle_sec_auth_init(worker_req_st *wreq, sec_mod_st *sec, const SecAuthInitMsg * req);
+int handle_sec_auth_cont(worker_req_st *wreq, sec_mod_st *sec, const SecAuthContMsg * req);
+int handle_sec_session_fetch(worker_req_st *wreq, sec_mod_st *sec, const SecSessionFetchMsg *req);
 int handle_secm_session_open_cmd(sec_mod_st *sec, int fd, const SecmSessionOpenMsg *req);
 int handle_secm_session_close_cmd(sec_mod_st *sec, int fd, const SecmSessionCloseMsg *req);
 int handle_sec_auth_stats_cmd(sec_mod_st * sec, const CliStatsMsg * req, pid_t pid);
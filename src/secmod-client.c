@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <talloc.h>
+#include <ccan/list/list.h>
+#include <cloexec.h>
+#include <defs.h>
+#include <secmod-client.h>
+
+typedef struct stashed_reply_st {
+	struct list_node list;
+	uint32_t id;
+	uint8_t cmd;
+	uint8_t *data;
+	size_t size;
+} stashed_reply_st;
+
+/* there is a single channel per worker process */
+static struct {
+	int fd;
+	uint32_t last_id;
+	struct sockaddr_un sa;
+	socklen_t sa_len;
+
+	void *pool;
+	struct list_head stash;
+	unsigned stash_size;
+} chan = {.fd = -1};
+
+void secmod_client_init(const struct sockaddr_un *sa, socklen_t sa_len)
+{
+	if (chan.pool == NULL) {
+		chan.pool = talloc_named_const(NULL, 0, "secmod-client");
+		list_head_init(&chan.stash);
+	}
+
+	if (chan.sa_len == 0) {
+		memcpy(&chan.sa, sa, sa_len);
+		chan.sa_len = sa_len;
+	}
+}
+
+void secmod_client_close(void)
+{
+	if (chan.fd != -1) {
+		close(chan.fd);
+		chan.fd = -1;
+	}
+}
+
+static int connect_chan(void)
+{
+	int sd, ret, e;
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd == -1) {
+		e = errno;
+		syslog(LOG_ERR, "error opening unix socket (for sec-mod) %s",
+		       strerror(e));
+		return -1;
+	}
+	set_cloexec_flag(sd, 1);
+
+	ret = connect(sd, (struct sockaddr *)&chan.sa, chan.sa_len);
+	if (ret < 0) {
+		e = errno;
+		close(sd);
+		syslog(LOG_ERR, "error connecting to sec-mod socket '%s': %s",
+		       chan.sa.sun_path, strerror(e));
+		return -1;
+	}
+
+	chan.fd = sd;
+	return 0;
+}
+
+int secmod_client_send(void *pool, uint8_t cmd, const void *msg,
+		       pack_size_func get_size, pack_func pack, uint32_t *id)
+{
+	uint32_t rid = 0;
+	unsigned retry;
+	int ret = -1;
+
+	if (id != NULL) {
+		/* zero is used for requests without reply */
+		if (++chan.last_id == 0)
+			chan.last_id++;
+		rid = chan.last_id;
+		*id = rid;
+	}
+
+	/* a connection closed by sec-mod is noticed on write; nothing
+	 * was delivered then, so the request is sent on a new one */
+	for (retry = 0; retry < 2; retry++) {
+		if (chan.fd == -1 && connect_chan() < 0)
+			return -1;
+
+		ret = send_msg_id(pool, chan.fd, cmd, rid, msg, get_size, pack);
+		if (ret >= 0)
+			return ret;
+
+		secmod_client_close();
+	}
+
+	return ret;
+}
+
+static void free_data(uint8_t *data, size_t size)
+{
+	if (data != NULL) {
+		/* replies may contain decrypted data */
+		safe_memset(data, 0, size);
+		talloc_free(data);
+	}
+}
+
+static void stash_reply(uint32_t id, uint8_t cmd, uint8_t *data, size_t size)
+{
+	stashed_reply_st *r;
+
+	if (chan.stash_size >= MAX_STASHED_REPLIES) {
+		r = list_top(&chan.stash, stashed_reply_st, list);
+		list_del(&r->list);
+		chan.stash_size--;
+		syslog(LOG_INFO, "discarding unclaimed sec-mod reply %u", (unsigned)r->id);
+		free_data(r->data, r->size);
+		talloc_free(r);
+	}
+
+	r = talloc_zero(chan.pool, stashed_reply_st);
+	if (r == NULL) {
+		free_data(data, size);
+		return;
+	}
+
+	r->id = id;
+	r->cmd = cmd;
+	r->data = data;
+	r->size = size;
+	list_add_tail(&chan.stash, &r->list);
+	chan.stash_size++;
+}
+
+static int find_stashed(uint32_t id, uint8_t *cmd, uint8_t **data, size_t *size)
+{
+	stashed_reply_st *r;
+
+	list_for_each(&chan.stash, r, list) {
+		if (r->id == id) {
+			*cmd = r->cmd;
+			*data = r->data;
+			*size = r->size;
+
+			list_del(&r->list);
+			chan.stash_size--;
+			talloc_free(r);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int secmod_client_recv(void *pool, uint32_t id, uint8_t cmd,
+		       void **msg, unpack_func unpack, unsigned timeout)
+{
+	uint8_t *data = NULL;
+	size_t length = 0;
+	uint8_t rcmd;
+	uint32_t rid;
+	int ret;
+	PROTOBUF_ALLOCATOR(pa, pool);
+
+	if (find_stashed(id, &rcmd, &data, &length) == 0) {
+		if (chan.fd == -1)
+			return ERR_PEER_TERMINATED;
+
+		for (;;) {
+			ret = recv_msg_headers_id(chan.fd, &rcmd, &rid, timeout);
+			if (ret < 0) {
+				syslog(LOG_ERR, "error receiving sec-mod reply: %s",
+				       (ret == ERR_PEER_TERMINATED)?"connection closed":"timeout");
+				goto fail;
+			}
+			length = ret;
+
+			if (length > 0) {
+				data = talloc_size(chan.pool, length);
+				if (data == NULL) {
+					ret = ERR_MEM;
+					goto fail;
+				}
+
+				if (force_read_timeout(chan.fd, data, length, timeout) < 0) {
+					ret = ERR_BAD_COMMAND;
+					goto fail;
+				}
+			}
+
+			if (rid == id)
+				break;
+
+			stash_reply(rid, rcmd, data, length);
+			data = NULL;
+		}
+	}
+
+	if (rcmd != cmd) {
+		syslog(LOG_ERR, "%s:%u: expected %d, received %d", __FILE__,
+		       __LINE__, (int)cmd, (int)rcmd);
+		ret = ERR_BAD_COMMAND;
+		goto cleanup;
+	}
+
+	if (length > 0 && msg != NULL) {
+		*msg = unpack(&pa, length, data);
+		if (*msg == NULL) {
+			syslog(LOG_ERR, "%s:%u: unpacking error", __FILE__,
+			       __LINE__);
+			ret = ERR_MEM;
+			goto cleanup;
+		}
+	}
+
+	ret = 0;
+	goto cleanup;
+
+ fail:
+	/* the stream is no longer in sync */
+	secmod_client_close();
+ cleanup:
+	free_data(data, length);
+	return ret;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SECMOD_CLIENT_H
+# define SECMOD_CLIENT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <common.h>
+
+/* The worker side of the channel to sec-mod. A worker process keeps a
+ * single connection, established on first use, and each request carries
+ * an id which is echoed in its reply. Replies received while waiting
+ * for another request are kept until asked for. */
+
+/* Replies received out of order which are kept */
+#define MAX_STASHED_REPLIES 16
+
+void secmod_client_init(const struct sockaddr_un *sa, socklen_t sa_len);
+
+/* Sends a request. When id is non-NULL a reply is expected and the
+ * request's id is stored there; otherwise sec-mod does not reply. */
+int secmod_client_send(void *pool, uint8_t cmd, const void *msg,
+		       pack_size_func get_size, pack_func pack, uint32_t *id);
+
+/* Waits for the reply to the request identified by id. If the reply
+ * carries no data, msg is not set. On error or timeout the connection
+ * is closed, and re-established by the next request. */
+int secmod_client_recv(void *pool, uint32_t id, uint8_t cmd,
+		       void **msg, unpack_func unpack, unsigned timeout);
+
+void secmod_client_close(void);
+
+#endif
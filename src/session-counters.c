@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <talloc.h>
+#include <session-counters.h>
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* the pages of the unused slots are never touched */
+#ifndef MAP_NORESERVE
+# define MAP_NORESERVE 0
+#endif
+
+/* Maps the slots to be shared with the processes forked after it */
+int session_counters_init(void *pool, session_counters_table_st *t, unsigned size)
+{
+	void *p;
+	unsigned i;
+	long page = sysconf(_SC_PAGESIZE);
+
+	memset(t, 0, sizeof(*t));
+
+	t->stride = sizeof(session_counters_st);
+	if (page > 0 && (size_t)page > t->stride)
+		t->stride = page;
+
+	t->free = talloc_array(pool, unsigned, size);
+	if (t->free == NULL)
+		return -1;
+
+	/* the mapping is page aligned, and so are the slots */
+	p = mmap(NULL, size * t->stride, PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		talloc_free(t->free);
+		t->free = NULL;
+		return -1;
+	}
+
+	t->slots = p;
+	t->size = size;
+
+	/* the lower slots are used first */
+	for (i = 0; i < size; i++)
+		t->free[i] = size - 1 - i;
+	t->nfree = size;
+
+	return 0;
+}
+
+void session_counters_deinit(session_counters_table_st *t)
+{
+	if (t->slots != NULL)
+		munmap(t->slots, t->size * t->stride);
+	talloc_free(t->free);
+	memset(t, 0, sizeof(*t));
+}
+
+void session_counters_isolate(session_counters_table_st *t, int slot)
+{
+	size_t len = t->size * t->stride, off;
+
+	if (t->slots == NULL)
+		return;
+
+	if (slot < 0) {
+		munmap(t->slots, len);
+	} else {
+		off = (size_t)slot * t->stride;
+		if (off > 0)
+			munmap(t->slots, off);
+		if (off + t->stride < len)
+			munmap(t->slots + off + t->stride, len - off - t->stride);
+	}
+
+	/* the slot is only known by the pointer taken before */
+	t->slots = NULL;
+	t->size = 0;
+}
+
+int session_counters_alloc(session_counters_table_st *t)
+{
+	int slot;
+
+	if (t->nfree == 0)
+		return -1;
+
+	slot = t->free[--t->nfree];
+	memset(session_counters_get(t, slot), 0, sizeof(session_counters_st));
+
+	return slot;
+}
+
+void session_counters_free(session_counters_table_st *t, int slot)
+{
+	if (slot < 0 || t->slots == NULL)
+		return;
+
+	memset(session_counters_get(t, slot), 0, sizeof(session_counters_st));
+	t->free[t->nfree++] = slot;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SESSION_COUNTERS_H
+# define SESSION_COUNTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The traffic counters of the sessions, in memory shared by main and the
+ * workers. Each worker writes the counters of its session to its slot,
+ * and main reads them when asked, without any message being exchanged.
+ *
+ * There is a single writer for each slot, so the counters are stored
+ * rather than incremented, with relaxed atomics which only ensure that a
+ * value is not read half-written. Each slot is in its own page, and a
+ * worker keeps only the page of its slot mapped, so that it cannot write
+ * the counters of the other sessions. The counters are still only used
+ * for display; accounting uses the statistics sent to sec-mod.
+ */
+
+#define CACHE_LINE_SIZE 64
+
+/* the slots when max-clients is not set */
+#define DEFAULT_SESSION_COUNTERS 8192
+
+typedef union session_counters_st {
+	struct {
+		uint64_t bytes_in;
+		uint64_t bytes_out;
+		uint64_t rx_per_sec; /* over the last second of traffic */
+		uint64_t tx_per_sec;
+	} c;
+	uint8_t pad[CACHE_LINE_SIZE];
+} session_counters_st;
+
+#ifdef __ATOMIC_RELAXED
+# define COUNTER_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+# define COUNTER_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+# define COUNTER_STORE(p, v) (*(volatile uint64_t *)(p) = (v))
+# define COUNTER_LOAD(p) (*(volatile uint64_t *)(p))
+#endif
+
+typedef struct session_counters_table_st {
+	uint8_t *slots; /* shared */
+	unsigned size;
+	size_t stride; /* the distance between the slots, a page */
+
+	/* the free slots; only used by main */
+	unsigned *free;
+	unsigned nfree;
+} session_counters_table_st;
+
+int session_counters_init(void *pool, session_counters_table_st *t, unsigned size);
+void session_counters_deinit(session_counters_table_st *t);
+
+/* Called by a worker after the fork: unmaps all the slots but @slot */
+void session_counters_isolate(session_counters_table_st *t, int slot);
+
+/* Returns a cleared slot, or -1 if none is free */
+int session_counters_alloc(session_counters_table_st *t);
+void session_counters_free(session_counters_table_st *t, int slot);
+
+/* Returns the counters of the slot, or NULL if it is -1 */
+inline static session_counters_st *session_counters_get(session_counters_table_st *t, int slot)
+{
+	if (slot < 0 || t->slots == NULL)
+		return NULL;
+	return (session_counters_st *)(t->slots + (size_t)slot * t->stride);
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <session-telemetry.h>
+
+void telemetry_to_msg(session_telemetry_st *t, SessionTelemetryMsg *msg)
+{
+	msg->rtt_samples = t->rtt_samples;
+	msg->rtt_usecs = t->rtt_usecs;
+	msg->min_rtt_usecs = t->min_rtt_usecs;
+	msg->rtt_sum_usecs = t->rtt_sum_usecs;
+	msg->has_rtt_sum_usecs = 1;
+	msg->rx_sizes = t->rx_sizes;
+	msg->n_rx_sizes = TELEMETRY_SIZE_CLASSES;
+	msg->tx_sizes = t->tx_sizes;
+	msg->n_tx_sizes = TELEMETRY_SIZE_CLASSES;
+	msg->rx_policed = t->rx_policed;
+	msg->tx_policed = t->tx_policed;
+	msg->comp_in = t->comp_in;
+	msg->comp_out = t->comp_out;
+	msg->mtu_decreases = t->mtu_decreases;
+	msg->mtu_increases = t->mtu_increases;
+	msg->to_tls = t->to_tls;
+	msg->to_dtls = t->to_dtls;
+	msg->eagain = t->eagain;
+}
+
+void telemetry_from_msg(session_telemetry_st *t, const SessionTelemetryMsg *msg)
+{
+	unsigned i;
+
+	memset(t, 0, sizeof(*t));
+
+	t->rtt_samples = msg->rtt_samples;
+	t->rtt_usecs = msg->rtt_usecs;
+	t->min_rtt_usecs = msg->min_rtt_usecs;
+	if (msg->has_rtt_sum_usecs)
+		t->rtt_sum_usecs = msg->rtt_sum_usecs;
+	for (i = 0; i < msg->n_rx_sizes && i < TELEMETRY_SIZE_CLASSES; i++)
+		t->rx_sizes[i] = msg->rx_sizes[i];
+	for (i = 0; i < msg->n_tx_sizes && i < TELEMETRY_SIZE_CLASSES; i++)
+		t->tx_sizes[i] = msg->tx_sizes[i];
+	t->rx_policed = msg->rx_policed;
+	t->tx_policed = msg->tx_policed;
+	t->comp_in = msg->comp_in;
+	t->comp_out = msg->comp_out;
+	t->mtu_decreases = msg->mtu_decreases;
+	t->mtu_increases = msg->mtu_increases;
+	t->to_tls = msg->to_tls;
+	t->to_dtls = msg->to_dtls;
+	t->eagain = msg->eagain;
+}
+
+/* the counters only grow, unless the worker is not trusted */
+#define ADD_CHANGE(field) \
+	do { \
+		if (cur->field > prev->field) \
+			total->field += cur->field - prev->field; \
+	} while (0)
+
+void telemetry_add_change(session_telemetry_st *total, const session_telemetry_st *prev,
+			  const session_telemetry_st *cur)
+{
+	unsigned i;
+
+	ADD_CHANGE(rtt_samples);
+	if (cur->rtt_samples > prev->rtt_samples) {
+		total->rtt_usecs = cur->rtt_usecs;
+		if (total->min_rtt_usecs == 0 || cur->min_rtt_usecs < total->min_rtt_usecs)
+			total->min_rtt_usecs = cur->min_rtt_usecs;
+	}
+	ADD_CHANGE(rtt_sum_usecs);
+
+	for (i = 0; i < TELEMETRY_SIZE_CLASSES; i++) {
+		ADD_CHANGE(rx_sizes[i]);
+		ADD_CHANGE(tx_sizes[i]);
+	}
+	ADD_CHANGE(rx_policed);
+	ADD_CHANGE(tx_policed);
+	ADD_CHANGE(comp_in);
+	ADD_CHANGE(comp_out);
+	ADD_CHANGE(mtu_decreases);
+	ADD_CHANGE(mtu_increases);
+	ADD_CHANGE(to_tls);
+	ADD_CHANGE(to_dtls);
+	ADD_CHANGE(eagain);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SESSION_TELEMETRY_H
+# define SESSION_TELEMETRY_H
+
+#include <stdint.h>
+#include "ipc.pb-c.h"
+
+/* The events of the data channel of a session, counted by its worker
+ * and sent to main along with the periodic statistics. main keeps the
+ * last report of each session, and adds the changes of the reports to
+ * the totals of the server.
+ */
+
+/* the packets are counted by size, up to each bound and beyond the last */
+#define TELEMETRY_SIZE_CLASSES 7
+#define TELEMETRY_SIZE_BOUND(i) ((i) < 5 ? 64U << (i) : 1400U)
+
+typedef struct session_telemetry_st {
+	uint64_t rtt_samples; /* the responses to our DPD requests */
+	uint32_t rtt_usecs; /* the round trip of the last one */
+	uint32_t min_rtt_usecs;
+	uint64_t rtt_sum_usecs; /* of all of them */
+
+	uint64_t rx_sizes[TELEMETRY_SIZE_CLASSES]; /* written to the device */
+	uint64_t tx_sizes[TELEMETRY_SIZE_CLASSES]; /* read from it */
+
+	uint64_t rx_policed; /* the packets dropped by the bandwidth limits */
+	uint64_t tx_policed;
+
+	uint64_t comp_in; /* the bytes given to compression */
+	uint64_t comp_out; /* the bytes sent for them */
+
+	uint32_t mtu_decreases; /* on packets too large for the path */
+	uint32_t mtu_increases;
+	uint32_t to_tls; /* the switches of the data between the channels */
+	uint32_t to_dtls;
+	uint64_t eagain; /* the reads which found nothing */
+} session_telemetry_st;
+
+inline static unsigned telemetry_size_class(unsigned size)
+{
+	unsigned i;
+
+	for (i = 0; i < TELEMETRY_SIZE_CLASSES - 1; i++) {
+		if (size <= TELEMETRY_SIZE_BOUND(i))
+			return i;
+	}
+
+	return TELEMETRY_SIZE_CLASSES - 1;
+}
+
+/* The message points to the arrays of @t */
+void telemetry_to_msg(session_telemetry_st *t, SessionTelemetryMsg *msg);
+void telemetry_from_msg(session_telemetry_st *t, const SessionTelemetryMsg *msg);
+
+/* Adds the change from @prev to @cur to @total */
+void telemetry_add_change(session_telemetry_st *total, const session_telemetry_st *prev,
+			  const session_telemetry_st *cur);
+
+#endif
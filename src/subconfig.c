@@ -240,6 +240,13 @@ void *radius_get_brackets_string(void *pool, struct perm_cfg_st *config, const c
 			} else if (c_strcasecmp(vals[i].name, "nas-identifier") == 0) {
 				additional->nas_identifier = vals[i].value;
 				vals[i].value = NULL;
+			} else if (c_strcasecmp(vals[i].name, "max-rate") == 0) {
+				additional->max_rate = atoi(vals[i].value);
+			} else if (c_strcasecmp(vals[i].name, "allow-no-message-authenticator") == 0) {
+				additional->no_msg_auth = CHECK_TRUE(vals[i].value);
+			} else if (c_strcasecmp(vals[i].name, "spool") == 0) {
+				additional->acct_spool = vals[i].value;
+				vals[i].value = NULL;
 			} else if (c_strcasecmp(vals[i].name, "groupconfig") == 0) {
 				if (CHECK_TRUE(vals[i].value))
 					config->sup_config_type = SUP_CONFIG_RADIUS;
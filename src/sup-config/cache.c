@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <talloc.h>
+#include <ccan/htable/htable.h>
+#include <ccan/hash/hash.h>
+#include <ccan/list/list.h>
+#include "cache.h"
+
+typedef struct sup_cache_entry_st {
+	char *file;
+	struct list_node list; /* in sup_cache_st.lru */
+
+	GroupCfgSt *cfg; /* a child of the entry, NULL on error */
+	int ret;
+
+	/* the file as parsed */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	time_t load_time;
+} sup_cache_entry_st;
+
+struct sup_cache_st {
+	struct htable ht;
+	struct list_head lru; /* the most recently used first */
+	unsigned entries;
+	unsigned max_entries;
+};
+
+static size_t entry_rehash(const void *_e, void *unused)
+{
+	const sup_cache_entry_st *e = _e;
+	return hash_any(e->file, strlen(e->file), 0);
+}
+
+static bool file_cmp(const void *_e, void *file)
+{
+	const sup_cache_entry_st *e = _e;
+	return strcmp(e->file, file) == 0;
+}
+
+static int sup_cache_destructor(struct sup_cache_st *cache)
+{
+	htable_clear(&cache->ht);
+	return 0;
+}
+
+sup_cache_st *sup_cache_new(void *pool, unsigned max_entries)
+{
+	struct sup_cache_st *cache;
+
+	cache = talloc_zero(pool, struct sup_cache_st);
+	if (cache == NULL)
+		return NULL;
+
+	htable_init(&cache->ht, entry_rehash, NULL);
+	list_head_init(&cache->lru);
+	cache->max_entries = max_entries;
+	talloc_set_destructor(cache, sup_cache_destructor);
+	return cache;
+}
+
+/* the sessions which use its configuration keep their reference */
+static void drop_entry(sup_cache_st *cache, sup_cache_entry_st *e)
+{
+	htable_del(&cache->ht, hash_any(e->file, strlen(e->file), 0), e);
+	list_del(&e->list);
+	cache->entries--;
+
+	if (e->cfg)
+		talloc_unlink(e, e->cfg);
+	talloc_free(e);
+}
+
+/* A modification within the second the file was parsed cannot be told
+ * by the time stamps, so such a file is parsed again until that second
+ * passes. */
+static unsigned entry_is_current(const sup_cache_entry_st *e, const struct stat *st)
+{
+	return (st->st_dev == e->dev && st->st_ino == e->ino &&
+		st->st_size == e->size && st->st_mtime == e->mtime &&
+		st->st_ctime == e->ctime && st->st_mtime < e->load_time &&
+		st->st_ctime < e->load_time);
+}
+
+int sup_cache_get(sup_cache_st *cache, void *pool, const char *file,
+		  sup_cache_parse_func parse, GroupCfgSt **cfg)
+{
+	sup_cache_entry_st *e;
+	struct stat st;
+	size_t hval;
+	unsigned have_st;
+	int ret;
+
+	have_st = (stat(file, &st) == 0);
+
+	hval = hash_any(file, strlen(file), 0);
+	e = htable_get(&cache->ht, hval, file_cmp, (void*)file);
+	if (e != NULL) {
+		list_del(&e->list);
+		list_add(&cache->lru, &e->list);
+
+		if (have_st && entry_is_current(e, &st))
+			goto found;
+
+		/* the sessions which use the previous configuration
+		 * keep their reference */
+		if (e->cfg)
+			talloc_unlink(e, e->cfg);
+		e->cfg = NULL;
+	} else {
+		if (cache->max_entries > 0 && cache->entries >= cache->max_entries)
+			drop_entry(cache, list_tail(&cache->lru, sup_cache_entry_st, list));
+
+		e = talloc_zero(cache, sup_cache_entry_st);
+		if (e == NULL)
+			return -1;
+
+		e->file = talloc_strdup(e, file);
+		if (e->file == NULL || !htable_add(&cache->ht, hval, e)) {
+			talloc_free(e);
+			return -1;
+		}
+		list_add(&cache->lru, &e->list);
+		cache->entries++;
+	}
+
+	e->load_time = time(0);
+	e->ret = parse(e, file, &e->cfg);
+	if (e->ret < 0 && e->cfg != NULL) {
+		talloc_free(e->cfg);
+		e->cfg = NULL;
+	}
+
+	if (have_st) {
+		e->dev = st.st_dev;
+		e->ino = st.st_ino;
+		e->size = st.st_size;
+		e->mtime = st.st_mtime;
+		e->ctime = st.st_ctime;
+	} else {
+		/* never current */
+		e->load_time = 0;
+	}
+
+ found:
+	ret = e->ret;
+	if (ret < 0)
+		return ret;
+
+	if (talloc_reference(pool, e->cfg) == NULL)
+		return -1;
+
+	*cfg = e->cfg;
+	return ret;
+}
+
+static int merge_list(void *pool, void ***dst, size_t *dst_size,
+		      void **src, size_t src_size)
+{
+	void **list;
+
+	if (src_size == 0)
+		return 0;
+
+	if (*dst_size == 0) {
+		*dst = src;
+		*dst_size = src_size;
+		return 0;
+	}
+
+	list = talloc_array(pool, void*, *dst_size + src_size + 1);
+	if (list == NULL)
+		return -1;
+
+	memcpy(list, *dst, *dst_size * sizeof(void*));
+	memcpy(&list[*dst_size], src, src_size * sizeof(void*));
+	*dst_size += src_size;
+	list[*dst_size] = NULL;
+
+	*dst = list;
+	return 0;
+}
+
+#define MERGE_NUMERIC(x) \
+	if (src->has_##x) { \
+		dst->x = src->x; \
+		dst->has_##x = 1; \
+	}
+
+#define MERGE_STRING(x) \
+	if (src->x != NULL) \
+		dst->x = src->x
+
+#define MERGE_LIST(x) \
+	if (merge_list(pool, (void***)&dst->x, &dst->n_##x, (void**)src->x, src->n_##x) < 0) \
+		return -1
+
+int sup_cfg_merge(void *pool, GroupCfgSt *dst, const GroupCfgSt *src)
+{
+	MERGE_NUMERIC(interim_update_secs);
+	MERGE_NUMERIC(session_timeout_secs);
+	MERGE_NUMERIC(no_udp);
+	MERGE_NUMERIC(deny_roaming);
+	MERGE_LIST(routes);
+	MERGE_LIST(iroutes);
+	MERGE_LIST(dns);
+	MERGE_LIST(nbns);
+	MERGE_STRING(ipv4_net);
+	MERGE_STRING(ipv4_netmask);
+	MERGE_STRING(ipv6_net);
+	MERGE_NUMERIC(ipv6_prefix);
+	MERGE_STRING(cgroup);
+	MERGE_STRING(xml_config_file);
+	MERGE_NUMERIC(rx_per_sec);
+	MERGE_NUMERIC(tx_per_sec);
+	MERGE_NUMERIC(net_priority);
+	MERGE_STRING(explicit_ipv4);
+	MERGE_STRING(explicit_ipv6);
+	MERGE_LIST(no_routes);
+	MERGE_NUMERIC(ipv6_subnet_prefix);
+	MERGE_NUMERIC(dpd);
+	MERGE_NUMERIC(mobile_dpd);
+	MERGE_NUMERIC(keepalive);
+	MERGE_NUMERIC(max_same_clients);
+	MERGE_NUMERIC(tunnel_all_dns);
+	MERGE_NUMERIC(restrict_user_to_routes);
+	MERGE_NUMERIC(mtu);
+	MERGE_NUMERIC(idle_timeout);
+	MERGE_NUMERIC(mobile_idle_timeout);
+	MERGE_LIST(fw_ports);
+	MERGE_STRING(hostname);
+
+	return 0;
+}
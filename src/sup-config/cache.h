@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SUP_CONFIG_CACHE_H
+#define SUP_CONFIG_CACHE_H
+
+#include <ipc.pb-c.h>
+
+/* A cache of the parsed per-user and per-group configuration files,
+ * keyed by path. A file is parsed again once it is replaced or
+ * modified. The cached configurations are shared by the sessions and
+ * must not be modified. Once the cache holds @max_entries files, the
+ * least recently used one is dropped for a new one. */
+
+typedef struct sup_cache_st sup_cache_st;
+
+/* Parses @file into a @cfg allocated under @pool; returns a negative
+ * error code on failure, which is cached as well. */
+typedef int (*sup_cache_parse_func)(void *pool, const char *file, GroupCfgSt **cfg);
+
+sup_cache_st *sup_cache_new(void *pool, unsigned max_entries);
+
+/* Returns in @cfg the configuration of @file, which stays valid while
+ * @pool is allocated, or the error of its parsing. */
+int sup_cache_get(sup_cache_st *cache, void *pool, const char *file,
+		  sup_cache_parse_func parse, GroupCfgSt **cfg);
+
+/* Appends the lists of @src to @dst and replaces the values @src sets.
+ * The values of @src are referenced, not copied. */
+int sup_cfg_merge(void *pool, GroupCfgSt *dst, const GroupCfgSt *src);
+
+#endif
@@ -38,6 +38,8 @@
 #include <main.h>
 #include <common-config.h>
 #include <sec-mod-sup-config.h>
+#include "file.h"
+#include "cache.h"
 
 #define READ_RAW_MULTI_LINE(varname, num) \
 	_add_multi_line_val(pool, &varname, &num, value)
@@ -77,7 +79,7 @@
 	}
 
 struct ini_ctx_st {
-	SecmSessionReplyMsg *msg;
+	GroupCfgSt *config;
 	const char *file;
 	void *pool;
 };
@@ -85,7 +87,7 @@ struct ini_ctx_st {
 static int group_cfg_ini_handler(void *_ctx, const char *section, const char *name, const char* _value)
 {
 	struct ini_ctx_st *ctx = _ctx;
-	SecmSessionReplyMsg *msg = ctx->msg;
+	GroupCfgSt *config = ctx->config;
 	const char *file = ctx->file;
 	void *pool = ctx->pool;
 	unsigned prefix = 0, prefix4 = 0;
@@ -102,91 +104,91 @@ static int group_cfg_ini_handler(void *_ctx, const char *section, const char *na
 		return 0;
 
 	if (strcmp(name, "no-udp") == 0) {
-		READ_TF(msg->config->no_udp, msg->config->has_no_udp);
+		READ_TF(config->no_udp, config->has_no_udp);
 	} else if (strcmp(name, "restrict-user-to-routes")==0) {
-		READ_TF(msg->config->restrict_user_to_routes, msg->config->has_restrict_user_to_routes);
+		READ_TF(config->restrict_user_to_routes, config->has_restrict_user_to_routes);
 	} else if (strcmp(name, "tunnel_all_dns") == 0) {
-		READ_TF(msg->config->tunnel_all_dns, msg->config->has_tunnel_all_dns);
+		READ_TF(config->tunnel_all_dns, config->has_tunnel_all_dns);
 	} else if (strcmp(name, "deny-roaming") == 0) {
-		READ_TF(msg->config->deny_roaming, msg->config->has_deny_roaming);
+		READ_TF(config->deny_roaming, config->has_deny_roaming);
 	} else if (strcmp(name, "route") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->routes, msg->config->n_routes);
+		READ_RAW_MULTI_LINE(config->routes, config->n_routes);
 	} else if (strcmp(name, "no-route") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->no_routes, msg->config->n_no_routes);
+		READ_RAW_MULTI_LINE(config->no_routes, config->n_no_routes);
 	} else if (strcmp(name, "iroute") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->iroutes, msg->config->n_iroutes);
+		READ_RAW_MULTI_LINE(config->iroutes, config->n_iroutes);
 	} else if (strcmp(name, "dns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->dns, msg->config->n_dns);
+		READ_RAW_MULTI_LINE(config->dns, config->n_dns);
 	} else if (strcmp(name, "ipv6-dns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->dns, msg->config->n_dns);
+		READ_RAW_MULTI_LINE(config->dns, config->n_dns);
 	} else if (strcmp(name, "ipv4-dns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->dns, msg->config->n_dns);
+		READ_RAW_MULTI_LINE(config->dns, config->n_dns);
 	} else if (strcmp(name, "nbns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->nbns, msg->config->n_nbns);
+		READ_RAW_MULTI_LINE(config->nbns, config->n_nbns);
 	} else if (strcmp(name, "ipv4-nbns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->nbns, msg->config->n_nbns);
+		READ_RAW_MULTI_LINE(config->nbns, config->n_nbns);
 	} else if (strcmp(name, "ipv6-nbns") == 0) {
-		READ_RAW_MULTI_LINE(msg->config->nbns, msg->config->n_nbns);
+		READ_RAW_MULTI_LINE(config->nbns, config->n_nbns);
 	} else if (strcmp(name, "cgroup") == 0) {
-		READ_RAW_STRING(msg->config->cgroup);
+		READ_RAW_STRING(config->cgroup);
 	} else if (strcmp(name, "ipv4-network") == 0) {
-		READ_RAW_STRING(msg->config->ipv4_net);
-		prefix4 = extract_prefix(msg->config->ipv4_net);
+		READ_RAW_STRING(config->ipv4_net);
+		prefix4 = extract_prefix(config->ipv4_net);
 		if (prefix4 != 0)
-			msg->config->ipv4_netmask = ipv4_prefix_to_strmask(pool, prefix4);
+			config->ipv4_netmask = ipv4_prefix_to_strmask(pool, prefix4);
 	} else if (strcmp(name, "ipv4-netmask") == 0) {
-		READ_RAW_STRING(msg->config->ipv4_netmask);
+		READ_RAW_STRING(config->ipv4_netmask);
 	} else if (strcmp(name, "explicit-ipv4") == 0) {
-		READ_RAW_STRING(msg->config->explicit_ipv4);
+		READ_RAW_STRING(config->explicit_ipv4);
 	} else if (strcmp(name, "ipv6-network") == 0) {
-		READ_RAW_STRING(msg->config->ipv6_net);
+		READ_RAW_STRING(config->ipv6_net);
 
-		prefix = extract_prefix(msg->config->ipv6_net);
+		prefix = extract_prefix(config->ipv6_net);
 		if (prefix != 0) {
 			if (valid_ipv6_prefix(prefix) == 0) {
-				syslog(LOG_ERR, "unknown ipv6-prefix '%u' in %s", msg->config->ipv6_prefix, file);
+				syslog(LOG_ERR, "unknown ipv6-prefix '%u' in %s", config->ipv6_prefix, file);
 			}
-			msg->config->ipv6_prefix = prefix;
-			msg->config->has_ipv6_prefix = 1;
+			config->ipv6_prefix = prefix;
+			config->has_ipv6_prefix = 1;
 		}
 	} else if (strcmp(name, "explicit-ipv6") == 0) {
-		READ_RAW_STRING(msg->config->explicit_ipv6);
+		READ_RAW_STRING(config->explicit_ipv6);
 	} else if (strcmp(name, "ipv6-subnet-prefix") == 0) {
-		READ_RAW_NUMERIC(msg->config->ipv6_subnet_prefix, msg->config->has_ipv6_subnet_prefix);
+		READ_RAW_NUMERIC(config->ipv6_subnet_prefix, config->has_ipv6_subnet_prefix);
 	} else if (strcmp(name, "hostname") == 0) {
-		READ_RAW_STRING(msg->config->hostname);
+		READ_RAW_STRING(config->hostname);
 	} else if (strcmp(name, "rx-data-per-sec") == 0) {
-		READ_RAW_NUMERIC(msg->config->rx_per_sec, msg->config->has_rx_per_sec);
-		msg->config->rx_per_sec /= 1000; /* in kb */
+		READ_RAW_NUMERIC(config->rx_per_sec, config->has_rx_per_sec);
+		config->rx_per_sec /= 1000; /* in kb */
 	} else if (strcmp(name, "tx-data-per-sec") == 0) {
-		READ_RAW_NUMERIC(msg->config->tx_per_sec, msg->config->has_tx_per_sec);
-		msg->config->tx_per_sec /= 1000; /* in kb */
+		READ_RAW_NUMERIC(config->tx_per_sec, config->has_tx_per_sec);
+		config->tx_per_sec /= 1000; /* in kb */
 	} else if (strcmp(name, "stats-report-time") == 0) {
-		READ_RAW_NUMERIC(msg->config->interim_update_secs, msg->config->has_interim_update_secs);
+		READ_RAW_NUMERIC(config->interim_update_secs, config->has_interim_update_secs);
 	} else if (strcmp(name, "session-timeout") == 0) {
-		READ_RAW_NUMERIC(msg->config->session_timeout_secs, msg->config->has_session_timeout_secs);
+		READ_RAW_NUMERIC(config->session_timeout_secs, config->has_session_timeout_secs);
 	} else if (strcmp(name, "mtu") == 0) {
-		READ_RAW_NUMERIC(msg->config->mtu, msg->config->has_mtu);
+		READ_RAW_NUMERIC(config->mtu, config->has_mtu);
 	} else if (strcmp(name, "dpd") == 0) {
-		READ_RAW_NUMERIC(msg->config->dpd, msg->config->has_dpd);
+		READ_RAW_NUMERIC(config->dpd, config->has_dpd);
 	} else if (strcmp(name, "mobile-dpd") == 0) {
-		READ_RAW_NUMERIC(msg->config->mobile_dpd, msg->config->has_mobile_dpd);
+		READ_RAW_NUMERIC(config->mobile_dpd, config->has_mobile_dpd);
 	} else if (strcmp(name, "idle-timeout") == 0) {
-		READ_RAW_NUMERIC(msg->config->idle_timeout, msg->config->has_idle_timeout);
+		READ_RAW_NUMERIC(config->idle_timeout, config->has_idle_timeout);
 	} else if (strcmp(name, "mobile-idle-timeout") == 0) {
-		READ_RAW_NUMERIC(msg->config->mobile_idle_timeout, msg->config->has_mobile_idle_timeout);
+		READ_RAW_NUMERIC(config->mobile_idle_timeout, config->has_mobile_idle_timeout);
 	} else if (strcmp(name, "keepalive") == 0) {
-		READ_RAW_NUMERIC(msg->config->keepalive, msg->config->has_keepalive);
+		READ_RAW_NUMERIC(config->keepalive, config->has_keepalive);
 	} else if (strcmp(name, "max-same-clients") == 0) {
-		READ_RAW_NUMERIC(msg->config->max_same_clients, msg->config->has_max_same_clients);
+		READ_RAW_NUMERIC(config->max_same_clients, config->has_max_same_clients);
 	} else if (strcmp(name, "net-priority") == 0) {
 		/* net-priority will contain the actual priority + 1,
 		 * to allow having zero as uninitialized. */
-		 READ_RAW_PRIO_TOS(msg->config->net_priority, msg->config->has_net_priority);
+		 READ_RAW_PRIO_TOS(config->net_priority, config->has_net_priority);
 	} else if (strcmp(name, "user-profile") == 0) {
-		READ_RAW_STRING(msg->config->xml_config_file);
+		READ_RAW_STRING(config->xml_config_file);
 	} else if (strcmp(name, "restrict-user-to-ports") == 0) {
-		ret = cfg_parse_ports(pool, &msg->config->fw_ports, &msg->config->n_fw_ports, value);
+		ret = cfg_parse_ports(pool, &config->fw_ports, &config->n_fw_ports, value);
 		if (ret < 0) {
 			talloc_free(value);
 			return -1;
@@ -199,21 +201,25 @@ static int group_cfg_ini_handler(void *_ctx, const char *section, const char *na
 	return 0;
 }
 
-/* This will parse the configuration file and append/replace data into
- * config. The provided config must either be memset to zero, or be
- * already allocated using this function.
+/* This will parse the configuration file into a new config
+ * allocated under pool.
  */
 static
-int parse_group_cfg_file(struct cfg_st *global_config,
-			 SecmSessionReplyMsg *msg, void *pool,
-			 const char* file)
+int parse_group_cfg_file(void *pool, const char* file, GroupCfgSt **_config)
 {
 	int ret;
 	unsigned j;
 	struct ini_ctx_st ctx;
+	GroupCfgSt *config;
 
-	ctx.pool = pool;
-	ctx.msg = msg;
+	config = talloc(pool, GroupCfgSt);
+	if (config == NULL)
+		return ERR_READ_CONFIG;
+	group_cfg_st__init(config);
+	*_config = config;
+
+	ctx.pool = config;
+	ctx.config = config;
 	ctx.file = file;
 
 	ret = ini_parse(file, group_cfg_ini_handler, &ctx);
@@ -222,22 +228,22 @@ int parse_group_cfg_file(struct cfg_st *global_config,
 		return 0;
 	}
 
-	for (j=0;j<msg->config->n_routes;j++) {
-		if (ip_route_sanity_check(msg->config->routes, &msg->config->routes[j]) != 0) {
+	for (j=0;j<config->n_routes;j++) {
+		if (ip_route_sanity_check(config->routes, &config->routes[j]) != 0) {
 			ret = ERR_READ_CONFIG;
 			goto fail;
 		}
 	}
 
-	for (j=0;j<msg->config->n_iroutes;j++) {
-		if (ip_route_sanity_check(msg->config->iroutes, &msg->config->iroutes[j]) != 0) {
+	for (j=0;j<config->n_iroutes;j++) {
+		if (ip_route_sanity_check(config->iroutes, &config->iroutes[j]) != 0) {
 			ret = ERR_READ_CONFIG;
 			goto fail;
 		}
 	}
 
-	for (j=0;j<msg->config->n_no_routes;j++) {
-		if (ip_route_sanity_check(msg->config->no_routes, &msg->config->no_routes[j]) != 0) {
+	for (j=0;j<config->n_no_routes;j++) {
+		if (ip_route_sanity_check(config->no_routes, &config->no_routes[j]) != 0) {
 			ret = ERR_READ_CONFIG;
 			goto fail;
 		}
@@ -249,8 +255,43 @@ int parse_group_cfg_file(struct cfg_st *global_config,
 	return ret;
 }
 
-static int read_sup_config_file(struct cfg_st *global_config,
-				SecmSessionReplyMsg *msg, void *pool,
+/* The parsed files, shared by the sessions until the next reload */
+static sup_cache_st *cache = NULL;
+
+/* the files kept parsed, past which the least recently used is dropped */
+#define SUP_CACHE_MAX_ENTRIES 1024
+
+void file_sup_config_reset(void)
+{
+	talloc_free(cache);
+	cache = NULL;
+}
+
+/* Appends or replaces the data of the file into msg->config */
+static int load_sup_config_file(SecmSessionReplyMsg *msg, void *pool,
+				const char *file)
+{
+	GroupCfgSt *config;
+	int ret;
+
+	if (cache == NULL) {
+		cache = sup_cache_new(NULL, SUP_CACHE_MAX_ENTRIES);
+		if (cache == NULL)
+			return ERR_READ_CONFIG;
+	}
+
+	ret = sup_cache_get(cache, pool, file, parse_group_cfg_file, &config);
+	if (ret < 0)
+		return ERR_READ_CONFIG;
+
+	ret = sup_cfg_merge(pool, msg->config, config);
+	if (ret < 0)
+		return ERR_READ_CONFIG;
+
+	return 0;
+}
+
+static int read_sup_config_file(SecmSessionReplyMsg *msg, void *pool,
 				const char *file, const char *fallback, const char *type)
 {
 	int ret;
@@ -259,14 +300,14 @@ static int read_sup_config_file(struct cfg_st *global_config,
 		syslog(LOG_DEBUG, "Loading %s configuration '%s'", type,
 		      file);
 
-		ret = parse_group_cfg_file(global_config, msg, pool, file);
+		ret = load_sup_config_file(msg, pool, file);
 		if (ret < 0)
 			return ERR_READ_CONFIG;
 	} else {
 		if (fallback != NULL) {
 			syslog(LOG_DEBUG, "Loading default %s configuration '%s'", type, fallback);
 
-			ret = parse_group_cfg_file(global_config, msg, pool, fallback);
+			ret = load_sup_config_file(msg, pool, fallback);
 			if (ret < 0)
 				return ERR_READ_CONFIG;
 		}
@@ -285,7 +326,7 @@ static int get_sup_config(struct cfg_st *cfg, client_entry_st *entry,
 		snprintf(file, sizeof(file), "%s/%s", cfg->per_group_dir,
 			 entry->acct_info.groupname);
 
-		ret = read_sup_config_file(cfg, msg, pool, file, cfg->default_group_conf, "group");
+		ret = read_sup_config_file(msg, pool, file, cfg->default_group_conf, "group");
 		if (ret < 0)
 			return ret;
 	}
@@ -293,7 +334,7 @@ static int get_sup_config(struct cfg_st *cfg, client_entry_st *entry,
 	if (cfg->per_user_dir != NULL) {
 		snprintf(file, sizeof(file), "%s/%s", cfg->per_user_dir,
 			 entry->acct_info.username);
-		ret = read_sup_config_file(cfg, msg, pool, file, cfg->default_user_conf, "user");
+		ret = read_sup_config_file(msg, pool, file, cfg->default_user_conf, "user");
 		if (ret < 0)
 			return ret;
 	}
@@ -25,4 +25,7 @@
 
 extern struct config_mod_st file_sup_config;
 
+/* Drops the parsed files; called on reload */
+void file_sup_config_reset(void);
+
 #endif
@@ -50,6 +50,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <c-ctype.h>
+#include <tracepoints.h>
 
 static void tls_reload_ocsp(main_server_st* s, struct vhost_cfg_st *vhost);
 
@@ -90,11 +91,14 @@ ssize_t cstp_send(worker_st *ws, const void *data,
 	int left = data_size;
 	const uint8_t* p = data;
 
+	TRACE1(cstp_send_start, data_size);
+
 	if (ws->session != NULL) {
 		while(left > 0) {
 			ret = gnutls_record_send(ws->session, p, data_size);
 			if (ret < 0) {
 				if (ret != GNUTLS_E_AGAIN && ret != GNUTLS_E_INTERRUPTED) {
+					TRACE1(cstp_send_done, ret);
 					return ret;
 				} else {
 					/* do not cause mayhem */
@@ -107,10 +111,13 @@ ssize_t cstp_send(worker_st *ws, const void *data,
 				p += ret;
 			}
 		}
-		return data_size;
+		ret = data_size;
 	} else {
-		return force_write(ws->conn_fd, data, data_size);
+		ret = force_write(ws->conn_fd, data, data_size);
 	}
+
+	TRACE1(cstp_send_done, ret);
+	return ret;
 }
 
 ssize_t cstp_send_file(worker_st *ws, const char *file)
@@ -229,6 +236,7 @@ ssize_t cstp_recv_packet(worker_st *ws, gnutls_datum_t *data, void **p)
 	data->data = ws->buffer;
 	data->size = ret;
 #endif
+	TRACE1(cstp_recv_packet, ret);
 	return ret;
 }
 
@@ -345,6 +353,7 @@ ssize_t dtls_recv_packet(worker_st *ws, gnutls_datum_t *data, void **p)
 	data->size = ret;
 #endif
 
+	TRACE1(dtls_recv_packet, ret);
 	return ret;
 }
 
@@ -355,10 +364,13 @@ ssize_t dtls_send(worker_st *ws, const void *data,
 	int left = data_size;
 	const uint8_t* p = data;
 
+	TRACE1(dtls_send_start, data_size);
+
 	while(left > 0) {
 		ret = gnutls_record_send(ws->dtls_session, p, data_size);
 		if (ret < 0) {
 			if (ret != GNUTLS_E_AGAIN && ret != GNUTLS_E_INTERRUPTED) {
+				TRACE1(dtls_send_done, ret);
 				return ret;
 			} else {
 				/* do not cause mayhem */
@@ -372,6 +384,7 @@ ssize_t dtls_send(worker_st *ws, const void *data,
 		}
 	}
 
+	TRACE1(dtls_send_done, data_size);
 	return data_size;
 }
 
@@ -649,6 +662,7 @@ static void set_dh_params(main_server_st* s, struct vhost_cfg_st *vhost)
 struct key_cb_data {
 	unsigned pk;
 	unsigned idx; /* the index of the key */
+	unsigned bits;
 	struct sockaddr_un sa;
 	unsigned sa_len;
 	const char *vhost;
@@ -659,27 +673,15 @@ int key_cb_common_func (gnutls_privkey_t key, void* userdata, const gnutls_datum
 	gnutls_datum_t * output, unsigned sigalgo, unsigned type)
 {
 	struct key_cb_data* cdata = userdata;
-	int sd = -1, ret, e;
+	int ret;
+	uint32_t id;
 	SecOpMsg msg = SEC_OP_MSG__INIT;
 	SecOpMsg *reply = NULL;
 	PROTOBUF_ALLOCATOR(pa, userdata);
 
 	output->data = NULL;
 
-	sd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sd == -1) {
-		e = errno;
-		syslog(LOG_ERR, "error opening socket: %s", strerror(e));
-		return GNUTLS_E_INTERNAL_ERROR;
-	}
-
-	ret = connect(sd, (struct sockaddr *)&cdata->sa, cdata->sa_len);
-	if (ret == -1) {
-		e = errno;
-		syslog(LOG_ERR, "error connecting to sec-mod socket '%s': %s",
-			cdata->sa.sun_path, strerror(e));
-		goto error;
-	}
+	secmod_client_init(&cdata->sa, cdata->sa_len);
 
 	msg.has_key_idx = 1;
 	msg.key_idx = cdata->idx;
@@ -688,24 +690,19 @@ int key_cb_common_func (gnutls_privkey_t key, void* userdata, const gnutls_datum
 	msg.data.len = raw_data->size;
 	msg.vhost = (char*)cdata->vhost;
 
-	ret = send_msg(userdata, sd, type, &msg,
+	ret = secmod_client_send(userdata, type, &msg,
 			(pack_size_func)sec_op_msg__get_packed_size,
-			(pack_func)sec_op_msg__pack);
+			(pack_func)sec_op_msg__pack, &id);
 	if (ret < 0) {
 		goto error;
 	}
 
-	ret = recv_msg(userdata, sd, type, (void*)&reply,
+	ret = secmod_client_recv(userdata, id, type, (void*)&reply,
 		       (unpack_func)sec_op_msg__unpack,
 		       DEFAULT_SOCKET_TIMEOUT);
-	if (ret < 0) {
-		e = errno;
-		syslog(LOG_ERR, "error receiving sec-mod reply: %s",
-				strerror(e));
+	if (ret < 0 || reply == NULL) {
 		goto error;
 	}
-	close(sd);
-	sd = -1;
 
 	output->size = reply->data.len;
 	output->data = gnutls_malloc(reply->data.len);
@@ -720,8 +717,6 @@ int key_cb_common_func (gnutls_privkey_t key, void* userdata, const gnutls_datum
 	return 0;
 
 error:
-	if (sd != -1)
-		close(sd);
 	gnutls_free(output->data);
 	if (reply != NULL)
 		sec_op_msg__free_unpacked(reply, &pa);
@@ -736,50 +731,33 @@ static
 int key_cb_get_pk (gnutls_privkey_t key, void* userdata)
 {
 	struct key_cb_data* cdata = userdata;
-	int sd = -1, ret, e;
+	int ret;
+	uint32_t id;
 	SecGetPkMsg msg = SEC_GET_PK_MSG__INIT;
 	SecGetPkMsg *reply = NULL;
 	PROTOBUF_ALLOCATOR(pa, userdata);
 	unsigned pk;
 
-	sd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sd == -1) {
-		e = errno;
-		syslog(LOG_ERR, "error opening socket: %s", strerror(e));
-		return GNUTLS_E_INTERNAL_ERROR;
-	}
-
-	ret = connect(sd, (struct sockaddr *)&cdata->sa, cdata->sa_len);
-	if (ret == -1) {
-		e = errno;
-		syslog(LOG_ERR, "error connecting to sec-mod socket '%s': %s",
-			cdata->sa.sun_path, strerror(e));
-		goto error;
-	}
+	secmod_client_init(&cdata->sa, cdata->sa_len);
 
 	msg.key_idx = cdata->idx;
 	msg.vhost = cdata->vhost;
 	msg.pk = 0;
 	msg.bits = 0;
 
-	ret = send_msg(userdata, sd, CMD_SEC_GET_PK, &msg,
+	ret = secmod_client_send(userdata, CMD_SEC_GET_PK, &msg,
 			(pack_size_func)sec_get_pk_msg__get_packed_size,
-			(pack_func)sec_get_pk_msg__pack);
+			(pack_func)sec_get_pk_msg__pack, &id);
 	if (ret < 0) {
 		goto error;
 	}
 
-	ret = recv_msg(userdata, sd, CMD_SEC_GET_PK, (void*)&reply,
+	ret = secmod_client_recv(userdata, id, CMD_SEC_GET_PK, (void*)&reply,
 		       (unpack_func)sec_get_pk_msg__unpack,
 		       DEFAULT_SOCKET_TIMEOUT);
-	if (ret < 0) {
-		e = errno;
-		syslog(LOG_ERR, "error receiving sec-mod reply: %s",
-				strerror(e));
+	if (ret < 0 || reply == NULL) {
 		goto error;
 	}
-	close(sd);
-	sd = -1;
 
 	pk = reply->pk;
 	cdata->pk = pk;
@@ -793,8 +771,6 @@ int key_cb_get_pk (gnutls_privkey_t key, void* userdata)
 	return pk;
 
 error:
-	if (sd != -1)
-		close(sd);
 	if (reply != NULL)
 		sec_get_pk_msg__free_unpacked(reply, &pa);
 	return 0;
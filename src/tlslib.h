@@ -27,6 +27,7 @@
 #include <vpn.h>
 #include <ccan/htable/htable.h>
 #include <errno.h>
+#include <timer-wheel.h>
 
 # if GNUTLS_VERSION_NUMBER < 0x030200
 #  define GNUTLS_DTLS1_2 202
@@ -119,6 +120,9 @@ typedef struct
   unsigned int session_data_size;
 
   char *vhostname;
+
+  /* armed at the expiration of the session */
+  wheel_timer_st timer;
 } tls_cache_st;
 
 #define TLS_SESSION_EXPIRATION_TIME(config) ((config)->cookie_timeout)
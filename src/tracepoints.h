@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACEPOINTS_H
+# define TRACEPOINTS_H
+
+#include <config.h>
+
+/* The static tracepoints (USDT) of the "ocserv" provider, for tracers
+ * such as bpftrace or perf. Each one is a nop in the code and a note in
+ * the binary, so they cost nothing until a tracer attaches to them. The
+ * arguments are evaluated regardless, and must be cheap scalars. The
+ * probes are listed in doc/README-tracing.md.
+ */
+
+#ifdef ENABLE_TRACEPOINTS
+# include <sys/sdt.h>
+
+# define TRACE0(name) DTRACE_PROBE(ocserv, name)
+# define TRACE1(name, a) DTRACE_PROBE1(ocserv, name, a)
+# define TRACE2(name, a, b) DTRACE_PROBE2(ocserv, name, a, b)
+# define TRACE3(name, a, b, c) DTRACE_PROBE3(ocserv, name, a, b, c)
+#else
+# define TRACE0(name)
+# define TRACE1(name, a)
+# define TRACE2(name, a, b)
+# define TRACE3(name, a, b, c)
+#endif
+
+#endif
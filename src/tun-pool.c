@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This file is part of ocserv.
+ *
+ * ocserv is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ocserv is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <vpn.h>
+#include <tun.h>
+#include <main.h>
+#include <ccan/list/list.h>
+
+/* The pool of pre-created tun devices.
+ *
+ * Creating a tun device requires several ioctl()s which happen on
+ * the main event loop during session setup. When tun-pool-size is set,
+ * main keeps a number of devices ready, which are created from an idle
+ * watcher while no other events are pending. The number of devices kept
+ * follows the connection rate: it is doubled each time a session finds
+ * the pool empty, and halved for each TUN_POOL_DECAY_TIME seconds without
+ * such a miss. The decay is also checked from the maintenance timer, so
+ * that the pool of an idle server shrinks.
+ */
+#define TUN_POOL_DECAY_TIME 60
+
+void tun_pool_init(main_server_st * s)
+{
+	list_head_init(&s->tun_pool.head);
+	s->tun_pool.total = 0;
+	s->tun_pool.failed = 0;
+	s->tun_pool.target = 0;
+	s->tun_pool.last_miss = s->tun_pool.last_adjust = time(0);
+}
+
+/* Destroys all the pooled devices. Used on exit and on reload. */
+void tun_pool_drain(main_server_st * s)
+{
+	struct tun_pool_entry_st *e = NULL, *pos;
+
+	list_for_each_safe(&s->tun_pool.head, e, pos, list) {
+		list_del(&e->list);
+		s->tun_pool.total--;
+		destroy_tun(s, &e->lease);
+		talloc_free(e);
+	}
+}
+
+/* Closes the descriptors of the pooled devices without destroying
+ * them. To be used after fork(). */
+void tun_pool_deinit(main_server_st * s)
+{
+	struct tun_pool_entry_st *e = NULL, *pos;
+
+	list_for_each_safe(&s->tun_pool.head, e, pos, list) {
+		list_del(&e->list);
+		s->tun_pool.total--;
+		close(e->lease.fd);
+		talloc_free(e);
+	}
+}
+
+/* Updates the target size of the pool; returns non-zero
+ * if devices need to be created or destroyed. */
+unsigned tun_pool_adjust(main_server_st * s)
+{
+	unsigned max = GETCONFIG(s)->tun_pool_size;
+	time_t now = time(0);
+	time_t idle;
+
+	if (s->tun_pool.target > max)
+		s->tun_pool.target = max;
+	else if (s->tun_pool.target == 0 && max > 0)
+		s->tun_pool.target = 1;
+
+	idle = now - MAX(s->tun_pool.last_miss, s->tun_pool.last_adjust);
+	if (s->tun_pool.target > 1 && idle >= TUN_POOL_DECAY_TIME) {
+		idle /= TUN_POOL_DECAY_TIME;
+		if (idle >= 32)
+			s->tun_pool.target = 1;
+		else
+			s->tun_pool.target = MAX(s->tun_pool.target >> idle, 1);
+		s->tun_pool.last_adjust = now;
+	}
+
+	if (s->tun_pool.failed)
+		return s->tun_pool.total > s->tun_pool.target;
+
+	return s->tun_pool.total != s->tun_pool.target;
+}
+
+/* Creates or destroys a single device to bring the pool closer to its
+ * target size. Returns non-zero if it needs to be called again.
+ */
+unsigned tun_pool_refill(main_server_st * s)
+{
+	struct tun_pool_entry_st *e;
+
+	if (s->tun_pool.total > s->tun_pool.target) {
+		e = list_top(&s->tun_pool.head, struct tun_pool_entry_st, list);
+		list_del(&e->list);
+		s->tun_pool.total--;
+		destroy_tun(s, &e->lease);
+		talloc_free(e);
+	} else if (s->tun_pool.total < s->tun_pool.target && !s->tun_pool.failed) {
+		e = talloc_zero(s, struct tun_pool_entry_st);
+		if (e == NULL)
+			return 0;
+
+		if (create_tun(s, &e->lease) < 0) {
+			talloc_free(e);
+			s->tun_pool.failed = 1;
+			return 0;
+		}
+
+		list_add_tail(&s->tun_pool.head, &e->list);
+		s->tun_pool.total++;
+	}
+
+	return tun_pool_adjust(s);
+}
+
+/* Obtains a tun device from the pool, or creates one if the pool is empty */
+int tun_pool_get(main_server_st * s, struct tun_lease_st *lease)
+{
+	struct tun_pool_entry_st *e;
+	unsigned max = GETCONFIG(s)->tun_pool_size;
+	int ret;
+
+	s->tun_pool.failed = 0;
+	e = list_top(&s->tun_pool.head, struct tun_pool_entry_st, list);
+	if (e != NULL) {
+		list_del(&e->list);
+		s->tun_pool.total--;
+		*lease = e->lease;
+		talloc_free(e);
+		ret = 0;
+	} else {
+		if (max > 0) {
+			s->tun_pool.last_miss = time(0);
+			s->tun_pool.target = s->tun_pool.target?s->tun_pool.target*2:1;
+			if (s->tun_pool.target > max)
+				s->tun_pool.target = max;
+		}
+		ret = create_tun(s, lease);
+	}
+
+#ifndef UNDER_TEST
+	if (tun_pool_adjust(s))
+		ev_idle_start(loop, &tun_pool_watcher);
+#endif
+
+	return ret;
+}
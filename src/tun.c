@@ -46,6 +46,7 @@
 #include <vpn.h>
 #include <tun.h>
 #include <main.h>
+#include <route-netlink.h>
 #include <ccan/list/list.h>
 
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
@@ -332,6 +333,9 @@ static int set_network_info(main_server_st * s, struct proc_st *proc)
 	struct ifreq ifr;
 #endif
 
+	if (s->nl_fd >= 0)
+		return nl_set_network_info(s, proc);
+
 	if (proc->ipv4 && proc->ipv4->lip_len > 0 && proc->ipv4->rip_len > 0) {
 		memset(&ifr, 0, sizeof(ifr));
 
@@ -531,26 +535,24 @@ static int bsd_open_tun(main_server_st * s)
 }
 #endif
 
-int open_tun(main_server_st * s, struct proc_st *proc)
+/* Creates a new tun device, owned by the configured uid/gid, and
+ * stores its name and descriptor in @lease. The device has no
+ * addresses assigned and is destroyed once its descriptor is closed.
+ */
+int create_tun(main_server_st * s, struct tun_lease_st *lease)
 {
 	int tunfd, ret, e;
 	struct ifreq ifr;
 	unsigned int t;
 
-	ret = get_ip_leases(s, proc);
-	if (ret < 0)
-		return ret;
-	ret = snprintf(proc->tun_lease.name, sizeof(proc->tun_lease.name), "%s%%d",
+	ret = snprintf(lease->name, sizeof(lease->name), "%s%%d",
 		       GETCONFIG(s)->network.name);
-	if (ret != strlen(proc->tun_lease.name)) {
+	if (ret != strlen(lease->name)) {
 		mslog(s, NULL, LOG_ERR, "Truncation error in tun name: %s; adjust 'device' option\n",
-		      proc->tun_lease.name);
+		      lease->name);
 		return -1;
 	}
 
-	/* No need to free the lease after this point.
-	 */
-
 	/* Obtain a free tun device */
 #ifdef __linux__
 	tunfd = open("/dev/net/tun", O_RDWR);
@@ -566,23 +568,21 @@ int open_tun(main_server_st * s, struct proc_st *proc)
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
 
-	memcpy(ifr.ifr_name, proc->tun_lease.name, IFNAMSIZ);
+	memcpy(ifr.ifr_name, lease->name, IFNAMSIZ);
 
 	if (ioctl(tunfd, TUNSETIFF, (void *)&ifr) < 0) {
 		e = errno;
 		mslog(s, NULL, LOG_ERR, "%s: TUNSETIFF: %s\n",
-		      proc->tun_lease.name, strerror(e));
+		      lease->name, strerror(e));
 		goto fail;
 	}
-	memcpy(proc->tun_lease.name, ifr.ifr_name, IFNAMSIZ);
-	mslog(s, proc, LOG_DEBUG, "assigning tun device %s\n",
-	      proc->tun_lease.name);
+	memcpy(lease->name, ifr.ifr_name, IFNAMSIZ);
 
 	/* we no longer use persistent tun */
 	if (ioctl(tunfd, TUNSETPERSIST, (void *)0) < 0) {
 		e = errno;
 		mslog(s, NULL, LOG_ERR, "%s: TUNSETPERSIST: %s\n",
-		      proc->tun_lease.name, strerror(e));
+		      lease->name, strerror(e));
 		goto fail;
 	}
 
@@ -592,7 +592,7 @@ int open_tun(main_server_st * s, struct proc_st *proc)
 		if (ret < 0) {
 			e = errno;
 			mslog(s, NULL, LOG_INFO, "%s: TUNSETOWNER: %s\n",
-			      proc->tun_lease.name, strerror(e));
+			      lease->name, strerror(e));
 			goto fail;
 		}
 	}
@@ -603,7 +603,7 @@ int open_tun(main_server_st * s, struct proc_st *proc)
 		if (ret < 0) {
 			e = errno;
 			mslog(s, NULL, LOG_ERR, "%s: TUNSETGROUP: %s\n",
-			      proc->tun_lease.name, strerror(e));
+			      lease->name, strerror(e));
 			/* kernels prior to 2.6.23 do not have this ioctl()
 			 * and return this error. In that case we ignore the
 			 * error. */
@@ -632,28 +632,66 @@ int open_tun(main_server_st * s, struct proc_st *proc)
 			goto fail;
 		}
 
-		strlcpy(proc->tun_lease.name, devname(st.st_rdev, S_IFCHR), sizeof(proc->tun_lease.name));
+		strlcpy(lease->name, devname(st.st_rdev, S_IFCHR), sizeof(lease->name));
 	}
 
 	set_cloexec_flag(tunfd, 1);
 #endif
 
-	if (proc->tun_lease.name[0] == 0) {
+	if (lease->name[0] == 0) {
 		mslog(s, NULL, LOG_ERR, "tun device with no name!");
 		goto fail;
 	}
 
-	/* set IP/mask */
+	lease->fd = tunfd;
+
+	return 0;
+ fail:
+	close(tunfd);
+	return -1;
+}
+
+/* Destroys a tun device which was never leased to a session */
+void destroy_tun(main_server_st * s, struct tun_lease_st *lease)
+{
+	struct proc_st tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.tun_lease = *lease;
+	close_tun(s, &tmp);
+}
+
+int open_tun(main_server_st * s, struct proc_st *proc)
+{
+	int ret;
+
+	/* The IP leases were obtained (and probed) in accept_user().
+	 */
+	if (proc->ipv4 == NULL && proc->ipv6 == NULL)
+		return -1;
+
+	ret = tun_pool_get(s, &proc->tun_lease);
+	if (ret < 0) {
+		proc->tun_lease.name[0] = 0;
+		proc->tun_lease.fd = -1;
+		return -1;
+	}
+
+	mslog(s, proc, LOG_DEBUG, "assigning tun device %s\n",
+	      proc->tun_lease.name);
+
+	/* set IP/mask; with netlink the setup completes in handle_tun_set() */
 	ret = set_network_info(s, proc);
+	if (ret == ERR_WAIT_FOR_NETLINK)
+		return ret;
 	if (ret < 0) {
 		goto fail;
 	}
 
-	proc->tun_lease.fd = tunfd;
-
 	return 0;
  fail:
-	close(tunfd);
+	close(proc->tun_lease.fd);
+	proc->tun_lease.fd = -1;
 	return -1;
 }
 
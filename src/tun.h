@@ -33,6 +33,22 @@ struct tun_lease_st {
 	int fd;
 };
 
+/* A pre-created, owner-assigned tun device waiting to be
+ * leased to a session */
+struct tun_pool_entry_st {
+	struct list_node list;
+	struct tun_lease_st lease;
+};
+
+struct tun_pool_st {
+	struct list_head head;
+	unsigned total;
+	unsigned target; /* adapts to the connection rate */
+	unsigned failed; /* creation failed; do not retry until next lease */
+	time_t last_miss; /* the last time a lease found the pool empty */
+	time_t last_adjust;
+};
+
 ssize_t tun_write(int sockfd, const void *buf, size_t len);
 ssize_t tun_read(int sockfd, void *buf, size_t len);
 
@@ -102,6 +102,15 @@ inline static const char *proto_to_str(fw_proto_t proto)
 #define DEFAULT_MAX_BAN_SCORE (MAX_PASSWORD_TRIES*DEFAULT_PASSWORD_POINTS)
 #define DEFAULT_BAN_RESET_TIME 300
 
+/* The scores of the addresses are also added up over their prefix of
+ * these lengths, when set shorter than those of an address (the IPv6
+ * addresses are scored by their /64); these prefixes are banned when
+ * their score reaches the maximum prefix score.
+ */
+#define DEFAULT_BAN_IPV4_PREFIX 32
+#define DEFAULT_BAN_IPV6_PREFIX 64
+#define DEFAULT_MAX_BAN_PREFIX_SCORE (4*DEFAULT_MAX_BAN_SCORE)
+
 #define MIN_NO_COMPRESS_LIMIT 64
 #define DEFAULT_NO_COMPRESS_LIMIT 256
 
@@ -115,6 +124,15 @@ inline static const char *proto_to_str(fw_proto_t proto)
 
 #define DEFAULT_DPD_TIME 600
 
+/* Admission control: the number of accepted connections which may wait
+ * for a worker slot, and the Retry-After value sent to new logins when
+ * the server is overloaded. */
+#define DEFAULT_PENDING_QUEUE_SIZE 256
+#define DEFAULT_OVERLOAD_RETRY_AFTER 10
+#define DEFAULT_MAX_CONCURRENT_HOOKS 16
+#define DEFAULT_AUTH_THREADS 4
+#define MAX_KEY_THREADS 64
+
 #define AC_PKT_DATA             0	/* Uncompressed data */
 #define AC_PKT_DPD_OUT          3	/* Dead Peer Detection */
 #define AC_PKT_DPD_RESP         4	/* DPD response */
@@ -154,6 +172,9 @@ extern int syslog_open;
 
 #define MAX_CIPHERSUITE_NAME 64
 #define SID_SIZE 32
+/* the cookies are either the SID, or when sealed-cookie-key-file is
+ * set, a sealed cookie containing it */
+#define MAX_COOKIE_SIZE 512
 
 
 struct vpn_st {
@@ -267,6 +288,9 @@ struct cfg_st {
 	time_t min_reauth_time;	/* after a failed auth, how soon one can reauthenticate -> in seconds */
 	int max_ban_score;	/* the score allowed before a user is banned (see vpn.h) */
 	int ban_reset_time;
+	unsigned ban_ipv4_prefix;
+	unsigned ban_ipv6_prefix;
+	int max_ban_prefix_score;
 
 	unsigned ban_points_wrong_password;
 	unsigned ban_points_connect;
@@ -298,7 +322,11 @@ struct cfg_st {
 	                               * and allow auth to complete in different
 	                               * TCP sessions. */
 	unsigned rate_limit_ms; /* if non zero force a connection every rate_limit milliseconds */
+	unsigned max_pending_clients; /* if non zero limits the workers which have not yet presented a cookie */
+	unsigned pending_queue_size; /* connections waiting for a worker slot */
+	unsigned overload_retry_after; /* Retry-After sent to new logins on overload */
 	unsigned ping_leases; /* non zero if we need to ping prior to leasing */
+	unsigned tun_pool_size; /* maximum number of pre-created tun devices */
 
 	size_t rx_per_sec;
 	size_t tx_per_sec;
@@ -359,6 +387,23 @@ struct perm_cfg_st {
 	char *chroot_dir;	/* where the xml files are served from */
 	char* occtl_socket_file;
 	char* socket_file_prefix;
+	char* event_socket_file; /* hook runner event stream */
+
+	unsigned hook_runner; /* run the scripts from a separate process */
+	unsigned max_concurrent_hooks;
+	unsigned auth_threads; /* sec-mod threads calling the auth modules */
+	unsigned key_threads; /* sec-mod threads performing the private key operations; zero for one per CPU */
+
+	char *sealed_cookie_key_file; /* the secret of the sealed cookies; NULL if not used */
+	unsigned sealed_cookie_lifetime;
+	char *sealed_cookie_revocation_file; /* keeps the revoked cookies over restarts; NULL if not used */
+
+	unsigned tls_session_tickets; /* resume with tickets rather than the sec-mod database */
+
+	char *shared_state_server; /* the memcached server of the cluster; NULL if not used */
+
+	char *metrics_socket_file; /* NULL if not used */
+	unsigned metrics_port; /* on the loopback interface; zero if not used */
 
 	uid_t uid;
 	gid_t gid;
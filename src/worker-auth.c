@@ -41,6 +41,7 @@
 #include <worker.h>
 #include <common.h>
 #include <tlslib.h>
+#include <gettime.h>
 
 #include <http_parser.h>
 
@@ -194,6 +195,26 @@ static int append_group_str(worker_st * ws, str_st *str, const char *group)
 	return 0;
 }
 
+/* When main has connections waiting for a worker, we only serve clients
+ * which reconnect using a cookie (or continue an authentication). New
+ * logins are asked to retry later, so that the available capacity is
+ * given to the already established sessions.
+ */
+static void reject_new_login_if_overloaded(worker_st * ws, unsigned http_ver)
+{
+	if (!ws->overloaded || ws->sid_set || ws->auth_state != S_AUTH_INACTIVE)
+		return;
+
+	oclog(ws, LOG_INFO, "server is overloaded; rejecting new login");
+	cstp_cork(ws);
+	cstp_printf(ws, "HTTP/1.%u 503 Service Unavailable\r\n", http_ver);
+	cstp_printf(ws, "Retry-After: %u\r\n", WSCONFIG(ws)->overload_retry_after);
+	cstp_puts(ws, "Content-Length: 0\r\n");
+	cstp_puts(ws, "Connection: close\r\n\r\n");
+	cstp_uncork(ws);
+	exit_worker(ws);
+}
+
 int get_auth_handler2(worker_st * ws, unsigned http_ver, const char *pmsg, unsigned pcounter)
 {
 	int ret;
@@ -438,6 +459,8 @@ int get_auth_handler2(worker_st * ws, unsigned http_ver, const char *pmsg, unsig
 
 int get_auth_handler(worker_st * ws, unsigned http_ver)
 {
+	reject_new_login_if_overloaded(ws, http_ver);
+
 	return get_auth_handler2(ws, http_ver, NULL, 0);
 }
 
@@ -697,34 +720,7 @@ static int recv_cookie_auth_reply(worker_st * ws)
 	return ret;
 }
 
-/* returns the fd */
-int connect_to_secmod(worker_st * ws)
-{
-	int sd, ret, e;
-
-	sd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sd == -1) {
-		e = errno;
-		oclog(ws, LOG_ERR, "error opening unix socket (for sec-mod) %s",
-		      strerror(e));
-		return -1;
-	}
-
-	ret =
-	    connect(sd, (struct sockaddr *)&ws->secmod_addr,
-		    ws->secmod_addr_len);
-	if (ret < 0) {
-		e = errno;
-		close(sd);
-		oclog(ws, LOG_ERR,
-		      "error connecting to sec-mod socket '%s': %s",
-		      ws->secmod_addr.sun_path, strerror(e));
-		return -1;
-	}
-	return sd;
-}
-
-static int recv_auth_reply(worker_st * ws, int sd, char **txt, unsigned *pcounter)
+static int recv_auth_reply(worker_st * ws, uint32_t id, char **txt, unsigned *pcounter)
 {
 	int ret;
 	SecAuthReplyMsg *msg = NULL;
@@ -733,9 +729,9 @@ static int recv_auth_reply(worker_st * ws, int sd, char **txt, unsigned *pcounte
 	/* We don't use the default socket timeout here, but rather the
 	 * longer WSCONFIG(ws)->auth_timeout to allow for authentication
 	 * methods which require the user input prior to returning a reply */
-	ret = recv_msg(ws, sd, CMD_SEC_AUTH_REPLY,
-		       (void *)&msg, (unpack_func) sec_auth_reply_msg__unpack,
-		       WSCONFIG(ws)->auth_timeout);
+	ret = secmod_client_recv(ws, id, CMD_SEC_AUTH_REPLY,
+				 (void *)&msg, (unpack_func) sec_auth_reply_msg__unpack,
+				 WSCONFIG(ws)->auth_timeout);
 	if (ret < 0) {
 		oclog(ws, LOG_ERR, "error receiving auth reply message");
 		return ret;
@@ -780,19 +776,33 @@ static int recv_auth_reply(worker_st * ws, int sd, char **txt, unsigned *pcounte
 		}
 
 		if (msg->has_sid == 0 ||
-		    msg->sid.len != sizeof(ws->cookie) ||
+		    msg->sid.len != SID_SIZE ||
+		    msg->cookie.len > sizeof(ws->cookie) ||
 		    msg->dtls_session_id.len != sizeof(ws->session_id)) {
 
 			ret = ERR_AUTH_FAIL;
 			goto cleanup;
 		}
 
-		memcpy(ws->cookie, msg->sid.data, msg->sid.len);
+		/* the sealed cookie is sent to the client instead of the sid */
+		if (msg->has_cookie && msg->cookie.len > 0) {
+			memcpy(ws->cookie, msg->cookie.data, msg->cookie.len);
+			ws->cookie_size = msg->cookie.len;
+		} else {
+			memcpy(ws->cookie, msg->sid.data, msg->sid.len);
+			ws->cookie_size = msg->sid.len;
+		}
 		ws->cookie_set = 1;
 
 		memcpy(ws->session_id, msg->dtls_session_id.data,
 		       msg->dtls_session_id.len);
 
+		/* timed by sec-mod; the client's think time is excluded */
+		if (msg->has_auth_backend_usecs) {
+			set_setup_time(ws, SETUP_AUTH_QUEUE, msg->auth_queue_usecs);
+			set_setup_time(ws, SETUP_AUTH, msg->auth_backend_usecs);
+		}
+
 		if (txt)
 			*txt = talloc_strdup(ws, msg->msg);
 
@@ -854,6 +864,7 @@ int get_cert_info(worker_st * ws)
  */
 void cookie_authenticate_or_exit(worker_st *ws)
 {
+	struct timespec start;
 	int ret;
 
 	if (ws->auth_state == S_AUTH_COMPLETE)
@@ -870,7 +881,8 @@ void cookie_authenticate_or_exit(worker_st *ws)
 
 	/* we have authenticated against sec-mod, we need to complete
 	 * our authentication by forwarding our cookie to main. */
-	ret = auth_cookie(ws, ws->cookie, sizeof(ws->cookie));
+	gettime_mono(&start);
+	ret = auth_cookie(ws, ws->cookie, ws->cookie_size);
 	if (ret < 0) {
 		oclog(ws, LOG_WARNING, "failed cookie authentication attempt");
 		if (ret == ERR_AUTH_FAIL) {
@@ -884,12 +896,39 @@ void cookie_authenticate_or_exit(worker_st *ws)
 		exit_worker(ws);
 	}
 	ws->auth_state = S_AUTH_COMPLETE;
+	time_setup_phase(ws, SETUP_COOKIE, &start);
 }
 
 /* sends a cookie authentication request to main thread and waits for
  * a reply.
  * Returns 0 on success.
  */
+/* Asks sec-mod to restore the session of an ID issued by another
+ * server of the cluster, which main only looks up locally. */
+static void fetch_shared_session(worker_st *ws, void *cookie, size_t cookie_size)
+{
+	SecSessionFetchMsg msg = SEC_SESSION_FETCH_MSG__INIT;
+	uint32_t id;
+	int ret;
+
+	if (WSPCONFIG(ws)->shared_state_server == NULL || cookie_size != SID_SIZE)
+		return;
+
+	msg.sid.data = cookie;
+	msg.sid.len = cookie_size;
+
+	ret = send_msg_to_secmod(ws, CMD_SEC_SESSION_FETCH, &msg,
+				 (pack_size_func)sec_session_fetch_msg__get_packed_size,
+				 (pack_func)sec_session_fetch_msg__pack, &id);
+	if (ret < 0) {
+		oclog(ws, LOG_DEBUG, "cannot send session fetch request to sec-mod");
+		return;
+	}
+
+	secmod_client_recv(ws, id, CMD_SEC_SESSION_FETCH, NULL, NULL,
+			   DEFAULT_SOCKET_TIMEOUT);
+}
+
 int auth_cookie(worker_st * ws, void *cookie, size_t cookie_size)
 {
 	int ret;
@@ -910,6 +949,8 @@ int auth_cookie(worker_st * ws, void *cookie, size_t cookie_size)
 		}
 	}
 
+	fetch_shared_session(ws, cookie, cookie_size);
+
 	msg.cookie.data = cookie;
 	msg.cookie.len = cookie_size;
 
@@ -964,7 +1005,7 @@ int post_common_handler(worker_st * ws, unsigned http_ver, const char *imsg)
 		success_msg_foot_size = strlen(success_msg_foot);
 	}
 
-	oc_base64_encode((char *)ws->cookie, sizeof(ws->cookie),
+	oc_base64_encode((char *)ws->cookie, ws->cookie_size,
 		      (char *)str_cookie, str_cookie_size);
 
 	/* reply */
@@ -1360,7 +1401,8 @@ static char *get_our_ip(worker_st * ws, char str[MAX_IP_STR])
 
 int post_auth_handler(worker_st * ws, unsigned http_ver)
 {
-	int ret = -1, sd = -1;
+	int ret = -1;
+	uint32_t id = 0;
 	struct http_req_st *req = &ws->req;
 	const char *reason = "Authentication failed";
 	char *username = NULL;
@@ -1376,6 +1418,8 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 		      req->body);
 	}
 
+	reject_new_login_if_overloaded(ws, http_ver);
+
 	if (ws->sid_set && ws->auth_state == S_AUTH_INACTIVE)
 		ws->auth_state = S_AUTH_INIT;
 
@@ -1476,17 +1520,10 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 		if (req->user_agent[0] != 0)
 			ireq.user_agent = req->user_agent;
 
-		sd = connect_to_secmod(ws);
-		if (sd == -1) {
-			reason = MSG_INTERNAL_ERROR;
-			oclog(ws, LOG_ERR, "failed connecting to sec mod");
-			goto auth_fail;
-		}
-
-		ret = send_msg_to_secmod(ws, sd, CMD_SEC_AUTH_INIT,
+		ret = send_msg_to_secmod(ws, CMD_SEC_AUTH_INIT,
 					 &ireq, (pack_size_func)
 					 sec_auth_init_msg__get_packed_size,
-					 (pack_func) sec_auth_init_msg__pack);
+					 (pack_func) sec_auth_init_msg__pack, &id);
 		if (ret < 0) {
 			reason = MSG_INTERNAL_ERROR;
 			oclog(ws, LOG_ERR,
@@ -1530,20 +1567,12 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 				areq.sid.len = sizeof(ws->sid);
 			}
 
-			sd = connect_to_secmod(ws);
-			if (sd == -1) {
-				reason = MSG_INTERNAL_ERROR;
-				oclog(ws, LOG_ERR,
-				      "failed connecting to sec mod");
-				goto auth_fail;
-			}
-
 			ret =
-			    send_msg_to_secmod(ws, sd, CMD_SEC_AUTH_CONT, &areq,
+			    send_msg_to_secmod(ws, CMD_SEC_AUTH_CONT, &areq,
 					       (pack_size_func)
 					       sec_auth_cont_msg__get_packed_size,
 					       (pack_func)
-					       sec_auth_cont_msg__pack);
+					       sec_auth_cont_msg__pack, &id);
 			talloc_free(password);
 
 			if (ret < 0) {
@@ -1564,11 +1593,7 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 		goto auth_fail;
 	}
 
-	ret = recv_auth_reply(ws, sd, &msg, &pcounter);
-	if (sd != -1) {
-		close(sd);
-		sd = -1;
-	}
+	ret = recv_auth_reply(ws, id, &msg, &pcounter);
 
 	if (ret == ERR_AUTH_CONTINUE) {
 		oclog(ws, LOG_DEBUG, "continuing authentication for '%s'",
@@ -1610,8 +1635,6 @@ int post_auth_handler(worker_st * ws, unsigned http_ver)
 
  auth_fail:
 
-	if (sd != -1)
-		close(sd);
 	oclog(ws, LOG_HTTP_DEBUG, "HTTP sending: 401 Unauthorized");
 	cstp_printf(ws,
 		   "HTTP/1.%d 401 %s\r\nContent-Length: 0\r\n\r\n",
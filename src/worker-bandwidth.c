@@ -23,6 +23,7 @@
 #include <worker.h>
 #include <worker-bandwidth.h>
 #include <gettime.h>
+#include <tracepoints.h>
 
 #include <stdio.h>
 
@@ -47,15 +48,19 @@ size_t transferred_kb;
 		b->allowed_kb = MIN(t, b->kb_per_sec);
 		b->transferred_bytes = bytes;
 		
+		TRACE3(bandwidth, b->kb_per_sec, bytes, 1);
 		return 1;
 	}
 	
 	sum = b->transferred_bytes + bytes;
-	if (sum > b->allowed_kb*1000)
+	if (sum > b->allowed_kb*1000) {
+		TRACE3(bandwidth, b->kb_per_sec, bytes, 0);
 		return 0; /* NO */
+	}
 
 	b->transferred_bytes = sum;
 	
+	TRACE3(bandwidth, b->kb_per_sec, bytes, 1);
 	return 1;
 }
 
@@ -40,13 +40,13 @@
 #include <tlslib.h>
 
 
-static int recv_resume_fetch_reply(worker_st *ws, int sd, gnutls_datum_t *sdata)
+static int recv_resume_fetch_reply(worker_st *ws, uint32_t id, gnutls_datum_t *sdata)
 {
 	int ret;
 	SessionResumeReplyMsg *resp;
 	PROTOBUF_ALLOCATOR(pa, ws);
 
-	ret = recv_msg(ws, sd, RESUME_FETCH_REP, (void*)&resp, 
+	ret = secmod_client_recv(ws, id, RESUME_FETCH_REP, (void*)&resp,
 		(unpack_func)session_resume_reply_msg__unpack, DEFAULT_SOCKET_TIMEOUT);
 	if (ret < 0) {
 		oclog(ws, LOG_ERR, "error receiving resumption reply (fetch)");
@@ -82,7 +82,8 @@ static gnutls_datum_t resume_db_fetch(void *dbf, gnutls_datum_t key)
 {
 	worker_st *ws = dbf;
 	gnutls_datum_t r = { NULL, 0 };
-	int ret, sd;
+	int ret;
+	uint32_t id;
 	SessionResumeFetchMsg msg = SESSION_RESUME_FETCH_MSG__INIT;
 
 	if (key.size > GNUTLS_MAX_SESSION_ID) {
@@ -90,29 +91,22 @@ static gnutls_datum_t resume_db_fetch(void *dbf, gnutls_datum_t key)
 		return r;
 	}
 
-	sd = connect_to_secmod(ws);
-	if (sd == -1) {
-		oclog(ws, LOG_DEBUG, "cannot connect to secmod");
-		return r;
-	}
-
 	msg.session_id.len = key.size;
 	msg.session_id.data = key.data;
 	msg.cli_addr.len = ws->remote_addr_len;
 	msg.cli_addr.data = (void*)&ws->remote_addr;
 	msg.vhost = ws->vhost->name;
 
-	ret = send_msg_to_secmod(ws, sd, RESUME_FETCH_REQ, &msg,
+	ret = send_msg_to_secmod(ws, RESUME_FETCH_REQ, &msg,
 		(pack_size_func)session_resume_fetch_msg__get_packed_size,
-		(pack_func)session_resume_fetch_msg__pack);
+		(pack_func)session_resume_fetch_msg__pack, &id);
 	if (ret < 0) {
-		goto cleanup;
+		oclog(ws, LOG_DEBUG, "cannot send resumption request to secmod");
+		return r;
 	}
 
-	recv_resume_fetch_reply(ws, sd, &r);
+	recv_resume_fetch_reply(ws, id, &r);
 
- cleanup:
- 	close(sd);
 	return r;
 }
 
@@ -122,7 +116,7 @@ resume_db_store (void *dbf, gnutls_datum_t key, gnutls_datum_t data)
 {
 	worker_st *ws = dbf;
 	SessionResumeStoreReqMsg msg = SESSION_RESUME_STORE_REQ_MSG__INIT;
-	int ret, sd;
+	int ret;
 
 	if (data.size > MAX_SESSION_DATA_SIZE) {
 		oclog(ws, LOG_DEBUG, "session data size exceeds the maximum %u", data.size);
@@ -145,18 +139,10 @@ resume_db_store (void *dbf, gnutls_datum_t key, gnutls_datum_t data)
 
 	msg.vhost = ws->vhost->name;
 
-	sd = connect_to_secmod(ws);
-	if (sd == -1) {
-		oclog(ws, LOG_DEBUG, "cannot connect to secmod");
-		return GNUTLS_E_DB_ERROR;
-	}
-
-	ret = send_msg_to_secmod(ws, sd, RESUME_STORE_REQ, &msg,
+	/* no reply is expected */
+	ret = send_msg_to_secmod(ws, RESUME_STORE_REQ, &msg,
 		(pack_size_func)session_resume_store_req_msg__get_packed_size,
-		(pack_func)session_resume_store_req_msg__pack);
-
-	close(sd);
-
+		(pack_func)session_resume_store_req_msg__pack, NULL);
 	if (ret < 0) {
 		return GNUTLS_E_DB_ERROR;
 	}
@@ -171,7 +157,7 @@ resume_db_store (void *dbf, gnutls_datum_t key, gnutls_datum_t data)
 static int resume_db_delete(void *dbf, gnutls_datum_t key)
 {
 	worker_st *ws = dbf;
-	int ret, sd;
+	int ret;
 	SessionResumeFetchMsg msg = SESSION_RESUME_FETCH_MSG__INIT;
 
 	if (key.size > GNUTLS_MAX_SESSION_ID) {
@@ -182,17 +168,9 @@ static int resume_db_delete(void *dbf, gnutls_datum_t key)
 	msg.session_id.len = key.size;
 	msg.session_id.data = key.data;
 
-	sd = connect_to_secmod(ws);
-	if (sd == -1) {
-		oclog(ws, LOG_DEBUG, "cannot connect to secmod");
-		return GNUTLS_E_DB_ERROR;
-	}
-
-	ret = send_msg_to_secmod(ws, sd, RESUME_DELETE_REQ, &msg,
+	ret = send_msg_to_secmod(ws, RESUME_DELETE_REQ, &msg,
 		(pack_size_func)session_resume_fetch_msg__get_packed_size,
-		(pack_func)session_resume_fetch_msg__pack);
-
-	close(sd);
+		(pack_func)session_resume_fetch_msg__pack, NULL);
 	if (ret < 0)
 		return GNUTLS_E_DB_ERROR;
 
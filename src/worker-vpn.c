@@ -56,6 +56,7 @@
 #include "ipc.pb-c.h"
 #include <worker.h>
 #include <tlslib.h>
+#include <tracepoints.h>
 
 #include <http_parser.h>
 
@@ -443,50 +444,88 @@ void ws_add_score_to_ip(worker_st *ws, unsigned points, unsigned final)
 	return;
 }
 
+static void send_telemetry_to_main(worker_st * ws)
+{
+	SessionTelemetryMsg msg = SESSION_TELEMETRY_MSG__INIT;
+
+	telemetry_to_msg(&ws->telemetry, &msg);
+
+	send_msg_to_main(ws, CMD_SESSION_TELEMETRY, &msg,
+			 (pack_size_func) session_telemetry_msg__get_packed_size,
+			 (pack_func) session_telemetry_msg__pack);
+}
+
+/* Times the response to the DPD request sent at @sent */
+static void dpd_rtt_update(worker_st * ws, struct timespec *sent)
+{
+	struct timespec now;
+	uint64_t usecs;
+
+	if (sent->tv_sec == 0)
+		return;
+
+	gettime_mono(&now);
+	usecs = timespec_sub_us(&now, sent);
+	if (usecs > UINT32_MAX)
+		usecs = UINT32_MAX;
+	sent->tv_sec = 0;
+
+	ws->telemetry.rtt_samples++;
+	ws->telemetry.rtt_usecs = usecs;
+	ws->telemetry.rtt_sum_usecs += usecs;
+	if (ws->telemetry.min_rtt_usecs == 0 || usecs < ws->telemetry.min_rtt_usecs)
+		ws->telemetry.min_rtt_usecs = usecs;
+}
+
+/* Sends the statistics of the session to sec-mod, and the telemetry
+ * to main */
 void send_stats_to_secmod(worker_st * ws, time_t now, unsigned discon_reason)
 {
 	CliStatsMsg msg = CLI_STATS_MSG__INIT;
-	int sd, ret, e;
+	int ret, e;
+	uint32_t id;
+	char buf[64];
 
 	ws->last_stats_msg = now;
 
-	sd = connect_to_secmod(ws);
-	if (sd >= 0) {
-		char buf[64];
-		msg.bytes_in = ws->tun_bytes_in;
-		msg.bytes_out = ws->tun_bytes_out;
-		msg.uptime = now - ws->session_start_time;
-		msg.sid.len = sizeof(ws->sid);
-		msg.sid.data = ws->sid;
-		msg.has_sid = 1;
-
-		if (discon_reason) {
-			msg.has_discon_reason = 1;
-			msg.discon_reason = discon_reason;
-		}
+	send_telemetry_to_main(ws);
 
-		msg.remote_ip = human_addr2((void *)&ws->remote_addr, ws->remote_addr_len,
-		       		     buf, sizeof(buf), 0);
+	msg.bytes_in = ws->tun_bytes_in;
+	msg.bytes_out = ws->tun_bytes_out;
+	msg.uptime = now - ws->session_start_time;
+	msg.sid.len = sizeof(ws->sid);
+	msg.sid.data = ws->sid;
+	msg.has_sid = 1;
 
-		msg.ipv4 = ws->vinfo.ipv4;
-		msg.ipv6 = ws->vinfo.ipv6;
+	if (discon_reason) {
+		msg.has_discon_reason = 1;
+		msg.discon_reason = discon_reason;
+	}
 
-		ret = send_msg_to_secmod(ws, sd, CMD_SEC_CLI_STATS, &msg,
-				 (pack_size_func)cli_stats_msg__get_packed_size,
-				 (pack_func) cli_stats_msg__pack);
-		if (discon_reason) /* wait for sec-mod to close connection to verify data have been accounted */
-			read(sd, buf, sizeof(buf));
-		close(sd);
+	msg.remote_ip = human_addr2((void *)&ws->remote_addr, ws->remote_addr_len,
+	       		     buf, sizeof(buf), 0);
 
-		if (ret >= 0) {
-			oclog(ws, LOG_INFO,
-			      "sent periodic stats (in: %lu, out: %lu) to sec-mod",
-			      (unsigned long)msg.bytes_in,
-			      (unsigned long)msg.bytes_out);
-		} else {
-			e = errno;
-			oclog(ws, LOG_WARNING, "could not send periodic stats to sec-mod: %s\n", strerror(e));
-		}
+	msg.ipv4 = ws->vinfo.ipv4;
+	msg.ipv6 = ws->vinfo.ipv6;
+
+	/* on disconnection wait for sec-mod's reply to verify data have
+	 * been accounted */
+	ret = send_msg_to_secmod(ws, CMD_SEC_CLI_STATS, &msg,
+			 (pack_size_func)cli_stats_msg__get_packed_size,
+			 (pack_func) cli_stats_msg__pack,
+			 discon_reason ? &id : NULL);
+	if (ret >= 0 && discon_reason)
+		secmod_client_recv(ws, id, CMD_SEC_CLI_STATS, NULL, NULL,
+				   DEFAULT_SOCKET_TIMEOUT);
+
+	if (ret >= 0) {
+		oclog(ws, LOG_INFO,
+		      "sent periodic stats (in: %lu, out: %lu) to sec-mod",
+		      (unsigned long)msg.bytes_in,
+		      (unsigned long)msg.bytes_out);
+	} else {
+		e = errno;
+		oclog(ws, LOG_WARNING, "could not send periodic stats to sec-mod: %s\n", strerror(e));
 	}
 }
 
@@ -500,6 +539,9 @@ void exit_worker(worker_st * ws)
 
 void exit_worker_reason(worker_st * ws, unsigned reason)
 {
+	/* e.g., the connection was only used to obtain the cookie */
+	send_setup_times(ws);
+
 	/* send statistics to parent */
 	if (ws->auth_state == S_AUTH_COMPLETE) {
 		send_stats_to_secmod(ws, time(0), reason);
@@ -548,21 +590,78 @@ void exit_worker_reason(worker_st * ws, unsigned reason)
 	GNUTLS_FATAL_ERR(ret); \
 	gnutls_db_set_cache_expiration(session, TLS_SESSION_EXPIRATION_TIME(WSCONFIG(ws)))
 
-/* Parse the TLS client hello to figure vhost */
+#if GNUTLS_VERSION_NUMBER >= 0x03060a
+# define TICKET_KEY_ROTATION
+
+#define TICKET_KEY_NAME_SIZE 16
+
+/* Returns true if @ticket was issued with @key. The tickets start with
+ * the name of the key which encrypted them; gnutls derives that key from
+ * @key anew every three session expiration periods, and accepts the
+ * previous period's key as well (see lib/stek.c). */
+static unsigned ticket_key_match(struct worker_st *ws, const gnutls_datum_t *key,
+				 const gnutls_datum_t *ticket)
+{
+	uint8_t in[8 + 64];
+	uint8_t out[64];
+	uint64_t t;
+	unsigned i, j;
+
+	if (ticket->size < TICKET_KEY_NAME_SIZE || key->size > 64)
+		return 0;
+
+	t = time(0) / (3 * TLS_SESSION_EXPIRATION_TIME(WSCONFIG(ws)));
+
+	for (i = 0; i < 2; i++, t--) {
+		for (j = 0; j < 8; j++)
+			in[j] = t >> (56 - 8 * j);
+		memcpy(in + 8, key->data, key->size);
+
+		if (gnutls_hash_fast(GNUTLS_DIG_SHA3_512, in, 8 + key->size, out) < 0)
+			return 0;
+
+		if (memcmp(out, ticket->data, TICKET_KEY_NAME_SIZE) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+#endif
+
+/* Enables the session tickets with the current key, unless the client
+ * resumes with a ticket of the previous one. That is accepted for one
+ * rotation period, but no new tickets are issued with it. */
+static int set_ticket_key(struct worker_st *ws, gnutls_session_t session,
+			  const gnutls_datum_t *ticket)
+{
+#ifdef TICKET_KEY_ROTATION
+	if (ticket != NULL && ws->prev_ticket_key.data != NULL &&
+	    ticket_key_match(ws, &ws->prev_ticket_key, ticket)) {
+		oclog(ws, LOG_DEBUG, "resuming with a ticket of the previous key");
+		ws->prev_ticket_used = 1;
+		return gnutls_session_ticket_enable_server(session, &ws->prev_ticket_key);
+	}
+#endif
+	return gnutls_session_ticket_enable_server(session, &ws->ticket_key);
+}
+
+/* Parse the TLS client hello to figure vhost and the offered session
+ * ticket */
 static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 			   unsigned when, unsigned int incoming,
 			   const gnutls_datum_t *msg)
 
 {
 	ssize_t ret;
-	size_t pos;
+	size_t pos, end;
 	size_t hsize;
 	struct worker_st *ws = gnutls_session_get_ptr(session);
+	gnutls_datum_t ticket = {NULL, 0};
 
 	if (htype != GNUTLS_HANDSHAKE_CLIENT_HELLO || when != GNUTLS_HOOK_PRE)
 		goto finish;
 
-	/* find the server name extension */
+	/* find the server name and the ticket extensions */
 
 	pos = HANDSHAKE_SESSION_ID_POS;
 	if (msg->size <= pos)
@@ -592,21 +691,25 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 		SKIP16(pos, msg->size);
 		type = (msg->data[pos-2] << 8) | msg->data[pos-1];
 
+		/* the extension data are within [pos, end) */
+		end = pos;
+		SKIP_V16(end, msg->size);
+		pos += 2;
+
 		if (type == 0) { /* server name ext */
-			SKIP16(pos, msg->size);
-			SKIP16(pos, msg->size); /* we don't support anything but a single name */
+			SKIP16(pos, end); /* we don't support anything but a single name */
 
-			SKIP8(pos, msg->size);
+			SKIP8(pos, end);
 			if (msg->data[pos-1] != 0) { /* HostName */
 				oclog(ws, LOG_DEBUG,
 				      "received server name extension with invalid name type field");
 				goto finish;
 			}
 
-			SKIP16(pos, msg->size);
+			SKIP16(pos, end);
 			hsize = (msg->data[pos-2] << 8) | msg->data[pos-1];
 
-			if (hsize == 0 || hsize + pos > msg->size || hsize > sizeof(ws->buffer)-1) {
+			if (hsize == 0 || hsize + pos > end || hsize > sizeof(ws->buffer)-1) {
 				oclog(ws, LOG_DEBUG,
 				      "received server name extension with too large name");
 				goto finish;
@@ -623,11 +726,21 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 				oclog(ws, LOG_INFO,
 				      "client requested hostname %s does not match known vhost", (char*)ws->buffer);
 			}
+		} else if (type == 35) { /* session ticket ext */
+			ticket.data = (void*)&msg->data[pos];
+			ticket.size = end - pos;
+		} else if (type == 41) { /* pre-shared key ext; the first identity */
+			SKIP16(pos, end);
+			SKIP16(pos, end);
+			hsize = (msg->data[pos-2] << 8) | msg->data[pos-1];
 
-			goto finish;
-		} else {
-			SKIP_V16(pos, msg->size);
+			if (hsize + pos <= end) {
+				ticket.data = (void*)&msg->data[pos];
+				ticket.size = hsize;
+			}
 		}
+
+		pos = end;
 	}
 
  finish:
@@ -635,6 +748,11 @@ static int hello_hook_func(gnutls_session_t session, unsigned int htype,
 	 * as they have not been previously set. */
 	SET_VHOST_CREDS;
 
+	if (ws->ticket_key.data != NULL) {
+		ret = set_ticket_key(ws, session, ticket.size > 0 ? &ticket : NULL);
+		GNUTLS_FATAL_ERR(ret);
+	}
+
 	return 0;
 }
 
@@ -722,6 +840,8 @@ void vpn_server(struct worker_st *ws)
 	ocsignal(SIGALRM, handle_alarm);
 
 	global_ws = ws;
+	time_setup_phase(ws, SETUP_FORK, &ws->spawn_time);
+
 	if (GETCONFIG(ws)->auth_timeout)
 		alarm(GETCONFIG(ws)->auth_timeout);
 
@@ -761,17 +881,28 @@ void vpn_server(struct worker_st *ws)
 		 * as we need to set some cipher priorities for handshake to start. */
 		ws->vhost = find_vhost(ws->vconfig, NULL);
 
-		/* initialize the session */
-		ret = gnutls_init(&session, GNUTLS_SERVER);
+		/* initialize the session; the tickets are sent once we know
+		 * the key they are issued with */
+#ifdef TICKET_KEY_ROTATION
+		if (ws->ticket_key.data != NULL)
+			ret = gnutls_init(&session, GNUTLS_SERVER|GNUTLS_NO_AUTO_SEND_TICKET);
+		else
+#endif
+			ret = gnutls_init(&session, GNUTLS_SERVER);
 		GNUTLS_FATAL_ERR(ret);
 
 		ret = gnutls_priority_set(session, WSCREDS(ws)->cprio);
 		GNUTLS_FATAL_ERR(ret);
 		gnutls_session_set_ptr(session, ws);
 
-		/* if we have a single vhost, avoid going through a callback to set credentials. */
-		if (!HAVE_VHOSTS(ws)) {
+		/* if we have a single vhost, avoid going through a callback to set credentials;
+		 * with a previous ticket key, the callback selects the key of the offered ticket. */
+		if (!HAVE_VHOSTS(ws) && ws->prev_ticket_key.data == NULL) {
 			SET_VHOST_CREDS;
+			if (ws->ticket_key.data != NULL) {
+				ret = set_ticket_key(ws, session, NULL);
+				GNUTLS_FATAL_ERR(ret);
+			}
 		} else {
 #ifdef SIMULATE_CLIENT_HELLO_HOOK
 			peek_client_hello(ws, session, ws->conn_fd);
@@ -784,8 +915,10 @@ void vpn_server(struct worker_st *ws)
 		gnutls_transport_set_ptr(session,
 				 (gnutls_transport_ptr_t) (long)ws->conn_fd);
 
-		set_resume_db_funcs(session);
-		gnutls_db_set_ptr(session, ws);
+		if (ws->ticket_key.data == NULL) {
+			set_resume_db_funcs(session);
+			gnutls_db_set_ptr(session, ws);
+		}
 
 		gnutls_handshake_set_timeout(session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT);
 		gnutls_transport_set_pull_timeout_function(session, tls_pull_timeout);
@@ -795,6 +928,18 @@ void vpn_server(struct worker_st *ws)
 		GNUTLS_FATAL_ERR(ret);
 
 		oclog(ws, LOG_DEBUG, "TLS handshake completed");
+		time_setup_phase(ws, SETUP_TLS_HANDSHAKE, &ws->setup_mark);
+
+#ifdef TICKET_KEY_ROTATION
+		/* under TLS 1.2 the tickets were sent during the handshake */
+		if (ws->ticket_key.data != NULL && ws->prev_ticket_used == 0 &&
+		    gnutls_protocol_get_version(session) == GNUTLS_TLS1_3) {
+			ret = gnutls_session_ticket_send(session, 1, 0);
+			if (ret < 0)
+				oclog(ws, LOG_DEBUG, "could not send session ticket: %s",
+				      gnutls_strerror(ret));
+		}
+#endif
 	} else {
 		ws->vhost = find_vhost(ws->vconfig, NULL);
 
@@ -935,6 +1080,54 @@ void data_mtu_send(worker_st * ws, unsigned mtu)
 	oclog(ws, LOG_DEBUG, "setting data MTU to %u", msg.mtu);
 }
 
+void set_setup_time(worker_st *ws, unsigned phase, uint64_t usecs)
+{
+	if (phase >= SETUP_PHASES)
+		return;
+
+	ws->setup_usecs[phase] = usecs;
+	ws->setup_timed |= 1U << phase;
+}
+
+/* Keeps the time a phase of the session setup took, from @start to now,
+ * and marks now as the end of the last phase */
+void time_setup_phase(worker_st *ws, unsigned phase, struct timespec *start)
+{
+	struct timespec now;
+
+	gettime_mono(&now);
+	set_setup_time(ws, phase, timespec_sub_us(&now, start));
+	ws->setup_mark = now;
+}
+
+/* Sends to main the phases timed so far, in a single message */
+void send_setup_times(worker_st *ws)
+{
+	SetupTimeMsg msg = SETUP_TIME_MSG__INIT;
+	uint32_t phase[SETUP_PHASES];
+	uint64_t usecs[SETUP_PHASES];
+	unsigned i;
+
+	if (ws->setup_timed == 0)
+		return;
+
+	for (i = 0; i < SETUP_PHASES; i++) {
+		if (!(ws->setup_timed & (1U << i)))
+			continue;
+		phase[msg.n_phase] = i;
+		usecs[msg.n_phase] = ws->setup_usecs[i];
+		msg.n_phase++;
+	}
+	msg.phase = phase;
+	msg.usecs = usecs;
+	msg.n_usecs = msg.n_phase;
+	ws->setup_timed = 0;
+
+	send_msg_to_main(ws, CMD_SETUP_TIME, &msg,
+			 (pack_size_func) setup_time_msg__get_packed_size,
+			 (pack_func) setup_time_msg__pack);
+}
+
 static
 void session_info_send(worker_st * ws)
 {
@@ -1042,6 +1235,8 @@ int mtu_not_ok(worker_st * ws)
 	if (WSCONFIG(ws)->try_mtu == 0 || ws->dtls_session == NULL)
 		return 0;
 
+	ws->telemetry.mtu_decreases++;
+
 	if (ws->proto == AF_INET) {
 		const unsigned min = MIN_MTU(ws);
 
@@ -1128,6 +1323,7 @@ void mtu_ok(worker_st * ws)
 	ws->last_good_mtu = ws->link_mtu;
 	c = (ws->link_mtu + ws->last_bad_mtu) / 2;
 
+	ws->telemetry.mtu_increases++;
 	link_mtu_set(ws, c);
 	return;
 }
@@ -1173,6 +1369,23 @@ int get_pmtu_approx(worker_st *ws)
 #endif
 }
 
+/* Publishes the rates of the traffic over the time since they were last
+ * updated, once a second at most */
+static void update_counters_rate(worker_st *ws, time_t now)
+{
+	time_t diff = now - ws->counters_time;
+
+	if (ws->counters == NULL || diff < 1)
+		return;
+
+	COUNTER_STORE(&ws->counters->c.rx_per_sec, (ws->tun_bytes_in - ws->counters_bytes_in) / diff);
+	COUNTER_STORE(&ws->counters->c.tx_per_sec, (ws->tun_bytes_out - ws->counters_bytes_out) / diff);
+
+	ws->counters_time = now;
+	ws->counters_bytes_in = ws->tun_bytes_in;
+	ws->counters_bytes_out = ws->tun_bytes_out;
+}
+
 static
 int periodic_check(worker_st * ws, struct timespec *tnow, unsigned dpd)
 {
@@ -1235,11 +1448,14 @@ int periodic_check(worker_st * ws, struct timespec *tnow, unsigned dpd)
 
 		ret = dtls_send(ws, ws->buffer, data_mtu+1);
 		DTLS_FATAL_ERR_CMD(ret, exit_worker_reason(ws, REASON_ERROR));
+		if (ws->dpd_udp_sent.tv_sec == 0)
+			gettime_mono(&ws->dpd_udp_sent);
 
 		if (now - ws->last_msg_udp > DPD_MAX_TRIES * dpd) {
 			oclog(ws, LOG_ERR,
 			      "have not received UDP message or DPD for very long; disabling UDP port");
 			ws->udp_state = UP_INACTIVE;
+			ws->telemetry.to_tls++;
 		}
 	}
 	if (dpd > 0 && now - ws->last_msg_tcp > DPD_TRIES * dpd) {
@@ -1257,6 +1473,8 @@ int periodic_check(worker_st * ws, struct timespec *tnow, unsigned dpd)
 
 		ret = cstp_send(ws, ws->buffer, 8);
 		CSTP_FATAL_ERR_CMD(ws, ret, exit_worker_reason(ws, REASON_ERROR));
+		if (ws->dpd_tcp_sent.tv_sec == 0)
+			gettime_mono(&ws->dpd_tcp_sent);
 
 		if (now - ws->last_msg_tcp > DPD_MAX_TRIES * dpd) {
 			oclog(ws, LOG_ERR,
@@ -1369,6 +1587,8 @@ static int dtls_mainloop(worker_st * ws, struct timespec *tnow)
 		} else if (ret >= 1) {
 			/* where we receive any DTLS UDP packet we reset the state
 			 * to active */
+			if (ws->udp_state == UP_INACTIVE)
+				ws->telemetry.to_dtls++;
 			ws->udp_state = UP_ACTIVE;
 
 			if (bandwidth_update
@@ -1381,10 +1601,15 @@ static int dtls_mainloop(worker_st * ws, struct timespec *tnow)
 					      "error parsing CSTP data");
 					goto cleanup;
 				}
+			} else {
+				ws->telemetry.rx_policed++;
 			}
-		} else
+		} else {
+			if (ret == GNUTLS_E_AGAIN)
+				ws->telemetry.eagain++;
 			oclog(ws, LOG_TRANSFER_DEBUG,
 			      "no data received (%d)", ret);
+		}
 
 		ws->udp_recv_time = tnow->tv_sec;
 		break;
@@ -1434,6 +1659,12 @@ static int dtls_mainloop(worker_st * ws, struct timespec *tnow)
 			      "DTLS handshake completed (link MTU: %u, data MTU: %u)\n",
 			      ws->link_mtu, data_mtu);
 			session_info_send(ws);
+
+			if (ws->dtls_setup_pending) {
+				ws->dtls_setup_pending = 0;
+				time_setup_phase(ws, SETUP_DTLS, &ws->setup_mark);
+				send_setup_times(ws);
+			}
 		}
 
 		break;
@@ -1473,9 +1704,13 @@ static int tls_mainloop(struct worker_st *ws, struct timespec *tnow)
 			if ((ret == AC_PKT_DATA || ret == AC_PKT_COMPRESSED) && ws->udp_state == UP_ACTIVE) {
 				/* client switched to TLS for some reason */
 				if (tnow->tv_sec - ws->udp_recv_time >
-				    UDP_SWITCH_TIME)
+				    UDP_SWITCH_TIME) {
 					ws->udp_state = UP_INACTIVE;
+					ws->telemetry.to_tls++;
+				}
 			}
+		} else {
+			ws->telemetry.rx_policed++;
 		}
 
 	} else if (ret == GNUTLS_E_REHANDSHAKE) {
@@ -1516,6 +1751,7 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 	gnutls_datum_t cstp_to_send;
 
 	l = tun_read(ws->tun_fd, ws->buffer + 8, DATA_MTU(ws, ws->link_mtu));
+	TRACE1(tun_read, l);
 	if (l < 0) {
 		e = errno;
 
@@ -1526,6 +1762,8 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 			return -1;
 		}
 
+		if (e == EAGAIN)
+			ws->telemetry.eagain++;
 		return 0;
 	}
 
@@ -1534,6 +1772,8 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 		return 0;
 	}
 
+	ws->telemetry.tx_sizes[telemetry_size_class(l)]++;
+
 
 	dtls_to_send.data = ws->buffer;
 	dtls_to_send.size = l;
@@ -1547,12 +1787,16 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 		oclog(ws, LOG_DEBUG, "No UDP data received for %li seconds, using TCP instead\n",
 				tnow->tv_sec - ws->udp_recv_time);
 		ws->udp_state = UP_INACTIVE;
+		ws->telemetry.to_tls++;
 	}
 
 	if (ws->udp_state == UP_ACTIVE && ws->dtls_selected_comp != NULL && l > WSCONFIG(ws)->no_compress_limit) {
 		/* otherwise don't compress */
 		ret = ws->dtls_selected_comp->compress(ws->decomp+8, sizeof(ws->decomp)-8, ws->buffer+8, l);
+		TRACE2(compress, l, ret);
 		oclog(ws, LOG_TRANSFER_DEBUG, "compressed %d to %d\n", (int)l, ret);
+		ws->telemetry.comp_in += l;
+		ws->telemetry.comp_out += (ret > 0 && ret < l) ? ret : l;
 		if (ret > 0 && ret < l) {
 			dtls_to_send.data = ws->decomp;
 			dtls_to_send.size = ret;
@@ -1569,7 +1813,10 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 	} else if (ws->cstp_selected_comp != NULL && l > WSCONFIG(ws)->no_compress_limit) {
 		/* otherwise don't compress */
 		ret = ws->cstp_selected_comp->compress(ws->decomp+8, sizeof(ws->decomp)-8, ws->buffer+8, l);
+		TRACE2(compress, l, ret);
 		oclog(ws, LOG_TRANSFER_DEBUG, "compressed %d to %d\n", (int)l, ret);
+		ws->telemetry.comp_in += l;
+		ws->telemetry.comp_out += (ret > 0 && ret < l) ? ret : l;
 		if (ret > 0 && ret < l) {
 			cstp_to_send.data = ws->decomp;
 			cstp_to_send.size = ret;
@@ -1587,6 +1834,8 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 		if (ws->udp_state == UP_ACTIVE) {
 
 			ws->tun_bytes_out += dtls_to_send.size;
+			if (ws->counters)
+				COUNTER_STORE(&ws->counters->c.bytes_out, ws->tun_bytes_out);
 
 			dtls_to_send.data[7] = dtls_type;
 			ret = dtls_send(ws, dtls_to_send.data + 7, dtls_to_send.size + 1);
@@ -1615,11 +1864,15 @@ static int tun_mainloop(struct worker_st *ws, struct timespec *tnow)
 			cstp_to_send.data[7] = 0;
 
 			ws->tun_bytes_out += cstp_to_send.size;
+			if (ws->counters)
+				COUNTER_STORE(&ws->counters->c.bytes_out, ws->tun_bytes_out);
 
 			ret = cstp_send(ws, cstp_to_send.data, cstp_to_send.size + 8);
 			CSTP_FATAL_ERR_CMD(ws, ret, exit_worker_reason(ws, REASON_ERROR));
 		}
 		ws->last_nc_msg = tnow->tv_sec;
+	} else {
+		ws->telemetry.tx_policed++;
 	}
 
 	return 0;
@@ -2271,6 +2524,12 @@ static int connect_handler(worker_st * ws)
 	ret = cstp_uncork(ws);
 	SEND_ERR(ret);
 
+	/* the setup times are sent once DTLS is up, if it is used */
+	time_setup_phase(ws, SETUP_CSTP_CONNECT, &ws->setup_mark);
+	ws->dtls_setup_pending = (ws->udp_state != UP_DISABLED);
+	if (!ws->dtls_setup_pending)
+		send_setup_times(ws);
+
 	/* start dead peer detection */
 	gettime(&tnow);
 	ws->last_msg_tcp = ws->last_msg_udp = ws->last_nc_msg = tnow.tv_sec;
@@ -2360,6 +2619,8 @@ static int connect_handler(worker_st * ws)
 		}
 		gettime(&tnow);
 
+		update_counters_rate(ws, tnow.tv_sec);
+
 		if (periodic_check(ws, &tnow, ws->user_config->dpd) < 0) {
 			terminate_reason = REASON_ERROR;
 			goto exit;
@@ -2449,6 +2710,7 @@ static int parse_data(struct worker_st *ws, uint8_t *buf, size_t buf_size,
 	switch (head) {
 	case AC_PKT_DPD_RESP:
 		oclog(ws, LOG_TRANSFER_DEBUG, "received DPD response");
+		dpd_rtt_update(ws, is_dtls ? &ws->dpd_udp_sent : &ws->dpd_tcp_sent);
 		break;
 	case AC_PKT_KEEPALIVE:
 		oclog(ws, LOG_TRANSFER_DEBUG, "received keepalive");
@@ -2508,6 +2770,7 @@ static int parse_data(struct worker_st *ws, uint8_t *buf, size_t buf_size,
 			}
 
 			plain_size = ws->cstp_selected_comp->decompress(ws->decomp, sizeof(ws->decomp), plain, plain_size);
+			TRACE2(decompress, buf_size-8, plain_size);
 			oclog(ws, LOG_DEBUG, "decompressed %d to %d\n", (int)buf_size-8, (int)plain_size);
 		} else { /* DTLS */
 			if (ws->dtls_selected_comp == NULL) {
@@ -2516,6 +2779,7 @@ static int parse_data(struct worker_st *ws, uint8_t *buf, size_t buf_size,
 			}
 
 			plain_size = ws->dtls_selected_comp->decompress(ws->decomp, sizeof(ws->decomp), plain, plain_size);
+			TRACE2(decompress, buf_size-1, plain_size);
 			oclog(ws, LOG_DEBUG, "decompressed %d to %d\n", (int)buf_size-1, (int)plain_size);
 		}
 
@@ -2529,6 +2793,7 @@ static int parse_data(struct worker_st *ws, uint8_t *buf, size_t buf_size,
 		oclog(ws, LOG_TRANSFER_DEBUG, "writing %d byte(s) to TUN",
 		      (int)plain_size);
 		ret = tun_write(ws->tun_fd, plain, plain_size);
+		TRACE2(tun_write, plain_size, ret);
 		if (ret == -1) {
 			e = errno;
 			oclog(ws, LOG_ERR, "could not write data to tun: %s",
@@ -2536,6 +2801,9 @@ static int parse_data(struct worker_st *ws, uint8_t *buf, size_t buf_size,
 			return -1;
 		}
 		ws->tun_bytes_in += plain_size;
+		if (ws->counters)
+			COUNTER_STORE(&ws->counters->c.bytes_in, ws->tun_bytes_in);
+		ws->telemetry.rx_sizes[telemetry_size_class(plain_size)]++;
 		ws->last_nc_msg = now;
 
 		break;
@@ -2576,6 +2844,7 @@ static int parse_cstp_data(struct worker_st *ws,
 		/* if we received a data packet in the CSTP channel we assume that
 		 * our peer wants to switch to it as the communication channel */
 		ws->udp_state = UP_INACTIVE;
+		ws->telemetry.to_tls++;
 	}
 
 	ret = parse_data(ws, buf, buf_size, now, 0);
@@ -33,10 +33,13 @@
 #include <common.h>
 #include <str.h>
 #include <worker-bandwidth.h>
+#include <secmod-client.h>
 #include <stdbool.h>
 #include <sys/un.h>
 #include <sys/uio.h>
 #include "vhost.h"
+#include "session-counters.h"
+#include "session-telemetry.h"
 
 typedef enum {
 	UP_DISABLED,
@@ -179,6 +182,10 @@ typedef struct worker_st {
 	int cmd_fd;
 	int conn_fd;
 	sock_type_t conn_type; /* AF_UNIX or something else */
+	unsigned overloaded; /* main has connections waiting for a worker */
+	gnutls_datum_t ticket_key; /* set by main if session tickets are used */
+	gnutls_datum_t prev_ticket_key; /* its predecessor; only accepted */
+	unsigned prev_ticket_used; /* the session was resumed with prev_ticket_key */
 	
 	http_parser *parser;
 
@@ -265,7 +272,8 @@ typedef struct worker_st {
 	unsigned cert_groups_size;
 
 	char hostname[MAX_HOSTNAME_SIZE];
-	uint8_t cookie[SID_SIZE];
+	uint8_t cookie[MAX_COOKIE_SIZE]; /* the sid or the sealed cookie */
+	unsigned cookie_size;
 
 	unsigned int cookie_set;
 
@@ -283,6 +291,24 @@ typedef struct worker_st {
 	uint64_t tun_bytes_in;
 	uint64_t tun_bytes_out;
 
+	/* where the stats are published to main; NULL if not */
+	session_counters_st *counters;
+	time_t counters_time; /* when the rates were last updated */
+	uint64_t counters_bytes_in; /* the stats at that time */
+	uint64_t counters_bytes_out;
+
+	/* the timing of the session setup */
+	struct timespec spawn_time; /* set by main before forking */
+	struct timespec setup_mark; /* the end of the last phase timed */
+	unsigned dtls_setup_pending; /* whether DTLS is to be timed */
+	uint64_t setup_usecs[SETUP_PHASES]; /* the phases timed but not yet sent */
+	unsigned setup_timed; /* a bit for each phase in setup_usecs */
+
+	/* the events of the data channel, reported to main */
+	session_telemetry_st telemetry;
+	struct timespec dpd_tcp_sent; /* zero unless a response is due */
+	struct timespec dpd_udp_sent;
+
 	/* information on the tun device addresses and network */
 	struct vpn_st vinfo;
 	unsigned default_route;
@@ -362,15 +388,17 @@ int ws_switch_auth_to(struct worker_st *ws, unsigned auth);
 int ws_switch_auth_to_next(struct worker_st *ws);
 void ws_add_score_to_ip(worker_st *ws, unsigned points, unsigned final);
 
-int connect_to_secmod(worker_st * ws);
+/* When id is non-NULL the request expects a reply, to be received with
+ * secmod_client_recv() */
 inline static
-int send_msg_to_secmod(worker_st * ws, int sd, uint8_t cmd,
-		       const void *msg, pack_size_func get_size, pack_func pack)
+int send_msg_to_secmod(worker_st * ws, uint8_t cmd,
+		       const void *msg, pack_size_func get_size, pack_func pack,
+		       uint32_t *id)
 {
 	oclog(ws, LOG_DEBUG, "sending message '%s' to secmod",
 	      cmd_request_to_str(cmd));
 
-	return send_msg(ws, sd, cmd, msg, get_size, pack);
+	return secmod_client_send(ws, cmd, msg, get_size, pack, id);
 }
 
 inline static
@@ -384,6 +412,9 @@ int send_msg_to_main(worker_st *ws, uint8_t cmd,
 int parse_proxy_proto_header(struct worker_st *ws, int fd);
 
 void cookie_authenticate_or_exit(worker_st *ws);
+void set_setup_time(worker_st *ws, unsigned phase, uint64_t usecs);
+void time_setup_phase(worker_st *ws, unsigned phase, struct timespec *start);
+void send_setup_times(worker_st *ws);
 
 /* after that time (secs) of inactivity in the UDP part, connection switches to 
  * TCP (if activity occurs there).
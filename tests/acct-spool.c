@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the accounting spool: the coalescing of the interim records,
+ * the bounded records in flight, the retries, the replay of the records
+ * which were not acknowledged before a restart, and the compaction.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <talloc.h>
+
+#include "../src/acct-spool.c"
+
+#define MAX_SENT 512
+
+struct sent_st {
+	void *handle;
+	unsigned type;
+	char data[64];
+};
+
+static struct sent_st sent[MAX_SENT];
+static unsigned sent_size;
+static unsigned fail_sends;
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static int test_send(void *priv, void *handle, unsigned type, time_t ts,
+		     const uint8_t *data, unsigned size)
+{
+	if (fail_sends)
+		return -1;
+
+	check(sent_size < MAX_SENT, __LINE__);
+	if (size >= sizeof(sent[0].data))
+		size = sizeof(sent[0].data) - 1;
+
+	sent[sent_size].handle = handle;
+	sent[sent_size].type = type;
+	memcpy(sent[sent_size].data, data, size);
+	sent[sent_size].data[size] = 0;
+	sent_size++;
+
+	return 0;
+}
+
+/* acknowledges the records sent so far */
+static void ack_all(int ok)
+{
+	unsigned i;
+
+	for (i = 0; i < sent_size; i++)
+		acct_spool_done(sent[i].handle, ok);
+	sent_size = 0;
+}
+
+static int add(acct_spool_st *sp, unsigned type, const char *key, time_t ts, const char *data)
+{
+	return acct_spool_add(sp, type, key, ts, data, strlen(data));
+}
+
+int main(void)
+{
+	char file[] = "acct-spool.tmp.XXXXXX";
+	static char big[2048];
+	acct_spool_stats_st st;
+	acct_spool_st *sp;
+	time_t now = time(0);
+	struct stat s;
+	unsigned i, last;
+	int fd;
+
+	fd = mkstemp(file);
+	check(fd != -1, __LINE__);
+	close(fd);
+
+	sp = acct_spool_open(NULL, file, 5, 2, test_send, NULL);
+	check(sp != NULL, __LINE__);
+
+	/* the interim records of a session are coalesced until the flush */
+	check(add(sp, ACCT_REC_START, "a", now, "start-a") == 0, __LINE__);
+	check(add(sp, ACCT_REC_INTERIM, "a", now, "interim-a1") == 0, __LINE__);
+	check(add(sp, ACCT_REC_INTERIM, "a", now, "interim-a2") == 0, __LINE__);
+	check(add(sp, ACCT_REC_INTERIM, "b", now, "interim-b1") == 0, __LINE__);
+	check(add(sp, ACCT_REC_STOP, "b", now, "stop-b") == 0, __LINE__);
+
+	acct_spool_stats(sp, now, &st);
+	check(st.records == 3 && st.coalesced == 2, __LINE__);
+	check(acct_spool_timeout(sp, now) == 0, __LINE__);
+
+	acct_spool_process(sp, now);
+	check(sent_size == 2, __LINE__);
+	check(strcmp(sent[0].data, "start-a") == 0 && sent[0].type == ACCT_REC_START, __LINE__);
+	check(strcmp(sent[1].data, "stop-b") == 0 && sent[1].type == ACCT_REC_STOP, __LINE__);
+	ack_all(1);
+
+	check(acct_spool_timeout(sp, now) == 5, __LINE__);
+	acct_spool_process(sp, now + 5);
+	check(sent_size == 1 && strcmp(sent[0].data, "interim-a2") == 0, __LINE__);
+	ack_all(1);
+	acct_spool_process(sp, now + 5);
+
+	/* everything acknowledged; the file is reset */
+	acct_spool_stats(sp, now + 5, &st);
+	check(st.records == 0 && st.bytes == 0 && st.sent == 3, __LINE__);
+	check(stat(file, &s) == 0 && s.st_size == HDR_SIZE, __LINE__);
+
+	/* at most two in flight */
+	for (i = 0; i < 5; i++) {
+		snprintf(big, sizeof(big), "start-%u", i);
+		check(add(sp, ACCT_REC_START, big, now, big) == 0, __LINE__);
+	}
+	acct_spool_process(sp, now);
+	check(sent_size == 2, __LINE__);
+	acct_spool_done(sent[1].handle, 1);
+	sent_size = 1;
+	acct_spool_process(sp, now);
+	check(sent_size == 2 && strcmp(sent[1].data, "start-2") == 0, __LINE__);
+
+	/* a failure pauses the sending */
+	ack_all(0);
+	acct_spool_stats(sp, now, &st);
+	check(st.records == 4 && st.retries == 2 && sp->backoff == ACCT_SPOOL_MIN_BACKOFF, __LINE__);
+	acct_spool_process(sp, now);
+	check(sent_size == 0, __LINE__);
+
+	/* the records not acknowledged are sent after a restart, in order */
+	talloc_free(sp);
+	sp = acct_spool_open(NULL, file, 5, 2, test_send, NULL);
+	check(sp != NULL, __LINE__);
+	acct_spool_stats(sp, now, &st);
+	check(st.records == 4, __LINE__);
+	acct_spool_process(sp, now);
+	check(sent_size == 2 && strcmp(sent[0].data, "start-0") == 0 &&
+	      strcmp(sent[1].data, "start-2") == 0, __LINE__);
+	ack_all(1);
+	acct_spool_process(sp, now);
+	ack_all(1);
+	acct_spool_process(sp, now);
+	check(sp->pending_size == 0, __LINE__);
+
+	/* a spooled interim record is replaced by a newer one, and the
+	 * buffered records are written on close */
+	fail_sends = 1;
+	check(add(sp, ACCT_REC_INTERIM, "c", now, "interim-c1") == 0, __LINE__);
+	acct_spool_process(sp, now + 5);
+	check(sp->pending_size == 1, __LINE__);
+	check(add(sp, ACCT_REC_INTERIM, "c", now + 10, "interim-c2") == 0, __LINE__);
+	talloc_free(sp);
+
+	fail_sends = 0;
+	sp = acct_spool_open(NULL, file, 5, 2, test_send, NULL);
+	check(sp != NULL, __LINE__);
+	check(sp->pending_size == 1, __LINE__);
+	acct_spool_process(sp, now);
+	check(sent_size == 1 && strcmp(sent[0].data, "interim-c2") == 0, __LINE__);
+	ack_all(1);
+
+	/* the acknowledged part is removed once large */
+	memset(big, 'x', sizeof(big) - 1);
+	for (i = 0; i < 2 * COMPACT_SIZE / sizeof(big) + 2; i++)
+		check(add(sp, ACCT_REC_START, "d", now, big) == 0, __LINE__);
+	check(add(sp, ACCT_REC_STOP, "d", now, "stop-d") == 0, __LINE__);
+
+	check(stat(file, &s) == 0 && s.st_size > 2 * COMPACT_SIZE, __LINE__);
+
+	/* all but the last are acknowledged */
+	sp->max_inflight = 64;
+	do {
+		acct_spool_process(sp, now);
+		last = 0;
+		for (i = 0; i < sent_size; i++) {
+			if (strcmp(sent[i].data, "stop-d") == 0)
+				last = 1;
+			else
+				acct_spool_done(sent[i].handle, 1);
+		}
+		sent_size = 0;
+	} while (!last);
+	acct_spool_process(sp, now);
+
+	check(sp->pending_size == 1, __LINE__);
+	check(stat(file, &s) == 0 && s.st_size < COMPACT_SIZE, __LINE__);
+
+	talloc_free(sp);
+	sp = acct_spool_open(NULL, file, 5, 2, test_send, NULL);
+	check(sp != NULL && sp->pending_size == 1, __LINE__);
+	acct_spool_process(sp, now);
+	check(sent_size == 1 && strcmp(sent[0].data, "stop-d") == 0, __LINE__);
+
+	talloc_free(sp);
+	unlink(file);
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <talloc.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "../src/main.h"
+#include "../src/main-admission.h"
+#include "../src/main-admission.c"
+
+#define MAX_SPAWNED 16
+static struct proc_st spawned[MAX_SPAWNED];
+static unsigned spawned_size = 0;
+
+/* Test the admission control queue */
+void spawn_worker(main_server_st *s, int fd, int stype)
+{
+	if (spawned_size >= MAX_SPAWNED) {
+		fprintf(stderr, "too many workers\n");
+		exit(1);
+	}
+
+	close(fd);
+	s->stats.active_clients++;
+	admission_track(s, &spawned[spawned_size++]);
+}
+
+void record_setup_time(main_server_st *s, unsigned phase, uint64_t usecs)
+{
+}
+
+static int new_fd(void)
+{
+	int fd = dup(STDIN_FILENO);
+	if (fd < 0) {
+		fprintf(stderr, "error in dup()\n");
+		exit(1);
+	}
+	return fd;
+}
+
+static void try_connect(main_server_st *s)
+{
+	int fd = new_fd();
+
+	if (admission_must_queue(s))
+		admission_enqueue(s, fd, SOCK_TYPE_TCP);
+	else
+		spawn_worker(s, fd, SOCK_TYPE_TCP);
+}
+
+int main()
+{
+	main_server_st *s = talloc(NULL, struct main_server_st);
+	vhost_cfg_st *vhost;
+	unsigned i;
+
+	if (s == NULL)
+		exit(1);
+
+	memset(s, 0, sizeof(*s));
+
+	s->ws = talloc_zero(s, struct worker_st);
+	if (s->ws == NULL)
+		exit(1);
+
+	s->vconfig = talloc_zero(s, struct list_head);
+	if (s->vconfig == NULL)
+		exit(1);
+	list_head_init(s->vconfig);
+
+	vhost = talloc_zero(s, struct vhost_cfg_st);
+	if (vhost == NULL)
+		exit(1);
+	vhost->perm_config.config = talloc_zero(vhost, struct cfg_st);
+
+	list_add(s->vconfig, &vhost->list);
+
+	vhost->perm_config.config->max_pending_clients = 2;
+	vhost->perm_config.config->pending_queue_size = 3;
+	vhost->perm_config.config->auth_timeout = 30;
+
+	admission_queue_init(s);
+
+	/* two are given a worker, three are queued and one is dropped */
+	for (i = 0; i < 6; i++)
+		try_connect(s);
+
+	if (spawned_size != 2 || s->stats.pending_clients != 2) {
+		fprintf(stderr, "%d: unexpected workers: %u/%u\n", __LINE__,
+			spawned_size, s->stats.pending_clients);
+		exit(1);
+	}
+
+	if (s->admission_queue.total != 3 || s->stats.admission_drops != 1) {
+		fprintf(stderr, "%d: unexpected queue: %u/%u\n", __LINE__,
+			s->admission_queue.total, (unsigned)s->stats.admission_drops);
+		exit(1);
+	}
+
+	/* no capacity; nothing is dispatched */
+	admission_dispatch(s);
+	if (spawned_size != 2) {
+		fprintf(stderr, "%d: unexpected dispatch\n", __LINE__);
+		exit(1);
+	}
+
+	/* while there is a queue, new connections are queued even if there
+	 * is capacity */
+	admission_release(s, &spawned[0]);
+	admission_release(s, &spawned[0]);
+	if (s->stats.pending_clients != 1 || !admission_must_queue(s)) {
+		fprintf(stderr, "%d: unexpected release\n", __LINE__);
+		exit(1);
+	}
+
+	admission_dispatch(s);
+	if (spawned_size != 3 || s->admission_queue.total != 2) {
+		fprintf(stderr, "%d: unexpected dispatch: %u/%u\n", __LINE__,
+			spawned_size, s->admission_queue.total);
+		exit(1);
+	}
+
+	/* stale entries are dropped */
+	admission_release(s, &spawned[1]);
+	list_top(&s->admission_queue.head, admission_entry_st, list)->queued -= 60;
+
+	admission_dispatch(s);
+	if (spawned_size != 4 || s->admission_queue.total != 0 || s->stats.admission_drops != 2) {
+		fprintf(stderr, "%d: unexpected dispatch: %u/%u\n", __LINE__,
+			spawned_size, s->admission_queue.total);
+		exit(1);
+	}
+
+	if (admission_must_queue(s) == 0) {
+		fprintf(stderr, "%d: expected to queue\n", __LINE__);
+		exit(1);
+	}
+
+	/* the queue is not served beyond max-clients */
+	vhost->perm_config.config->max_clients = s->stats.active_clients + 1;
+	try_connect(s);
+	try_connect(s);
+	admission_release(s, &spawned[2]);
+	admission_release(s, &spawned[3]);
+	if (spawned_size != 4 || s->admission_queue.total != 2) {
+		fprintf(stderr, "%d: unexpected queue: %u/%u\n", __LINE__,
+			spawned_size, s->admission_queue.total);
+		exit(1);
+	}
+
+	admission_dispatch(s);
+	if (spawned_size != 5 || s->admission_queue.total != 1) {
+		fprintf(stderr, "%d: unexpected dispatch: %u/%u\n", __LINE__,
+			spawned_size, s->admission_queue.total);
+		exit(1);
+	}
+
+	admission_dispatch(s);
+	if (spawned_size != 5 || s->admission_queue.total != 1) {
+		fprintf(stderr, "%d: dispatch beyond max-clients: %u/%u\n", __LINE__,
+			spawned_size, s->admission_queue.total);
+		exit(1);
+	}
+
+	vhost->perm_config.config->max_pending_clients = 0;
+	if (admission_must_queue(s) != 0) {
+		fprintf(stderr, "%d: admission control is disabled\n", __LINE__);
+		exit(1);
+	}
+
+	admission_queue_deinit(s);
+	talloc_free(s);
+
+	return 0;
+}
@@ -29,6 +29,7 @@
 #include "../src/main-ban.h"
 #include "../src/ip-util.h"
 #include "../src/main-ban.c"
+#include "../src/kv-store.c"
 
 /* Test the IP banning functionality */
 static
@@ -52,6 +53,177 @@ unsigned check_if_banned_str(main_server_st *s, const char *ip)
 	return check_if_banned(s, &addr, addr.ss_family==AF_INET?sizeof(struct sockaddr_in):sizeof(struct sockaddr_in6));
 }
 
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static ban_entry_st *find_entry(main_server_st *s, const char *ip, unsigned prefix)
+{
+	ban_node_st *n;
+	inaddr_st t;
+
+	t.size = strchr(ip, ':') ? 16 : 4;
+	check(inet_pton(t.size == 16 ? AF_INET6 : AF_INET, ip, t.ip) == 1, __LINE__);
+
+	n = trie_get(s->ban_db, ROOT(s->ban_db, t.size), t.ip, prefix, 0);
+	return n ? n->entry : NULL;
+}
+
+static int clear_entry(void *priv, const ban_entry_st *_e)
+{
+	ban_entry_st *e = (ban_entry_st *)_e;
+
+	e->score = 0;
+	e->expires = 0;
+	e->last_reset = 0;
+	update_entry(priv, e);
+	return 0;
+}
+
+/* Resets and removes all the entries */
+static void clear_entries(main_server_st *s)
+{
+	ban_db_st *db = s->ban_db;
+
+	main_ban_db_iterate(s, clear_entry, s);
+	cleanup_banned_entries(s);
+
+	check(main_ban_db_elems(s) == 0, __LINE__);
+	check(db->root[0] == NULL && db->root[1] == NULL, __LINE__);
+}
+
+/* The points of the addresses of a prefix are added up */
+static void check_prefixes(main_server_st *s)
+{
+	ban_entry_st *e;
+
+	GETCONFIG(s)->ban_reset_time = 60;
+	GETCONFIG(s)->ban_ipv4_prefix = 24;
+	GETCONFIG(s)->ban_ipv6_prefix = 48;
+	GETCONFIG(s)->max_ban_prefix_score = 40;
+	GETCONFIG(s)->ban_points_connect = 1;
+
+	add_str_ip_to_ban_list(s, "10.0.0.1", 10);
+	add_str_ip_to_ban_list(s, "10.0.0.2", 10);
+	add_str_ip_to_ban_list(s, "10.0.0.3", 10);
+	check(check_if_banned_str(s, "10.0.0.200") == 0, __LINE__);
+	add_str_ip_to_ban_list(s, "10.0.0.4", 10);
+
+	/* none is banned alone, but their /24 is */
+	check(find_entry(s, "10.0.0.4", 32)->score < 20, __LINE__);
+	e = find_entry(s, "10.0.0.0", 24);
+	check(e != NULL && e->score == 40, __LINE__);
+	check(check_if_banned_str(s, "10.0.0.200") != 0, __LINE__);
+	check(check_if_banned_str(s, "10.0.1.1") == 0, __LINE__);
+
+	/* the connection points are not added to the prefix */
+	check(e->score == 40, __LINE__);
+
+	/* unbanning an address resets its prefix */
+	check(remove_ip_from_ban_list(s, find_entry(s, "10.0.0.200", 32)->ip.ip, 4) != 0, __LINE__);
+	check(check_if_banned_str(s, "10.0.0.200") == 0, __LINE__);
+
+	add_str_ip_to_ban_list(s, "fc8e:899a:0624:5a89::1", 20);
+	add_str_ip_to_ban_list(s, "fc8e:899a:0624:5a8a::1", 20);
+	check(check_if_banned_str(s, "fc8e:899a:0624:ffff::1") != 0, __LINE__);
+	check(check_if_banned_str(s, "fc8e:899a:0625::1") == 0, __LINE__);
+
+	GETCONFIG(s)->ban_points_connect = 0;
+	clear_entries(s);
+}
+
+/* Each ban lasts twice as much as the previous */
+static void check_escalation(main_server_st *s)
+{
+	ban_entry_st *e;
+	time_t now;
+
+	add_str_ip_to_ban_list(s, "10.1.0.1", 20);
+	e = find_entry(s, "10.1.0.1", 32);
+	now = time(0);
+	check(e->bans == 1 && e->expires - now <= 30, __LINE__);
+
+	/* the ban ends */
+	e->expires = now - 1;
+	update_entry(s, e);
+	check(check_if_banned_str(s, "10.1.0.1") == 0, __LINE__);
+
+	add_str_ip_to_ban_list(s, "10.1.0.1", 20);
+	now = time(0);
+	check(check_if_banned_str(s, "10.1.0.1") != 0, __LINE__);
+	check(e->bans == 2 && e->expires - now > 30 && e->expires - now <= 60, __LINE__);
+
+	clear_entries(s);
+}
+
+/* The longest prefix match against a list of random prefixes */
+static void check_trie(main_server_st *s)
+{
+	static ban_entry_st *added[512];
+	ban_entry_st *found[MAX_BAN_MATCHES];
+	uint8_t ip[16];
+	unsigned i, j, k, n, prefix, expected;
+
+	srand(1);
+	for (i = 0; i < 512; i++) {
+		for (j = 0; j < 4; j++)
+			ip[j] = (j < 2) ? rand() % 2 : rand();
+		prefix = (i % 3 == 0) ? 32 : 16 + rand() % 16;
+		added[i] = get_entry(s, ip, 4, prefix, time(0));
+		check(added[i] != NULL && added[i]->prefix == prefix, __LINE__);
+	}
+
+	for (i = 0; i < 4096; i++) {
+		for (j = 0; j < 4; j++)
+			ip[j] = (j < 2) ? rand() % 2 : rand();
+		if (i % 2)
+			memcpy(ip, added[i % 512]->ip.ip, 4);
+
+		n = trie_match(*ROOT(s->ban_db, 4), ip, 32, found, MAX_BAN_MATCHES);
+
+		/* all the matches are found, from the shortest */
+		for (j = expected = 0; j < 512; j++) {
+			if (added[j] == NULL || common_bits(ip, added[j]->ip.ip, added[j]->prefix) != added[j]->prefix)
+				continue;
+			for (k = 0; k < j; k++)
+				if (added[k] == added[j])
+					break;
+			if (k == j)
+				expected++;
+		}
+		check(n == MIN(expected, MAX_BAN_MATCHES), __LINE__);
+		for (j = 1; j < n; j++)
+			check(found[j - 1]->prefix < found[j]->prefix, __LINE__);
+	}
+
+	/* the entries are removed in any order */
+	for (i = 0; i < 512; i++) {
+		j = rand() % 512;
+		if (added[j] != NULL) {
+			for (k = 0; k < 512; k++)
+				if (k != j && added[k] == added[j])
+					added[k] = NULL;
+			del_entry(s, added[j]);
+			added[j] = NULL;
+		}
+	}
+	for (i = 0; i < 512; i++) {
+		if (added[i] != NULL) {
+			for (k = i + 1; k < 512; k++)
+				if (added[k] == added[i])
+					added[k] = NULL;
+			del_entry(s, added[i]);
+		}
+	}
+
+	check(main_ban_db_elems(s) == 0, __LINE__);
+	check(s->ban_db->root[0] == NULL && s->ban_db->root[1] == NULL, __LINE__);
+}
+
 int main()
 {
 	main_server_st *s = talloc(NULL, struct main_server_st);
@@ -171,6 +343,10 @@ int main()
 		exit(1);
 	}
 
+	check_prefixes(s);
+	check_escalation(s);
+	check_trie(s);
+
 	main_ban_db_deinit(s);
 	talloc_free(s);
 	return 0;
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the hook runner executes the scripts of a session in
+ * order, and that it skips the disconnect script of a session whose
+ * connect script failed.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <talloc.h>
+
+#include "../src/hook-runner.c"
+
+static char dir[] = "/tmp/ocserv-hook-runner-XXXXXX";
+static char script[64];
+static char log_file[64];
+static void *pool;
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+/* the script logs its name, after a delay, and exits with the given status */
+static void write_script(void)
+{
+	FILE *fp;
+
+	snprintf(script, sizeof(script), "%s/hook", dir);
+	snprintf(log_file, sizeof(log_file), "%s/log", dir);
+
+	fp = fopen(script, "w");
+	check(fp != NULL, __LINE__);
+	fprintf(fp, "#!/bin/sh\nsleep $HOOK_DELAY\necho $HOOK_NAME >>%s\nexit $HOOK_STATUS\n", log_file);
+	fclose(fp);
+	check(chmod(script, 0700) == 0, __LINE__);
+}
+
+static void run(int fd, uint32_t id, const char *reason, uint32_t session,
+		const char *name, unsigned status, const char *delay)
+{
+	HookRunMsg msg = HOOK_RUN_MSG__INIT;
+	char *env[3];
+	char buf[3][64];
+
+	snprintf(buf[0], sizeof(buf[0]), "HOOK_NAME=%s", name);
+	snprintf(buf[1], sizeof(buf[1]), "HOOK_STATUS=%u", status);
+	snprintf(buf[2], sizeof(buf[2]), "HOOK_DELAY=%s", delay);
+	env[0] = buf[0];
+	env[1] = buf[1];
+	env[2] = buf[2];
+
+	msg.id = id;
+	msg.script = script;
+	msg.reason = (char*)reason;
+	msg.session = session;
+	msg.env = env;
+	msg.n_env = 3;
+
+	check(send_msg(pool, fd, CMD_HOOK_RUN, &msg,
+		       (pack_size_func) hook_run_msg__get_packed_size,
+		       (pack_func) hook_run_msg__pack) >= 0, __LINE__);
+}
+
+static unsigned result(int fd, uint32_t id)
+{
+	HookResultMsg *msg;
+	unsigned status;
+
+	check(recv_msg(pool, fd, CMD_HOOK_RESULT, (void *)&msg,
+		       (unpack_func) hook_result_msg__unpack, 10000) >= 0, __LINE__);
+	check(msg->id == id, __LINE__);
+	status = msg->status;
+	talloc_free(msg);
+
+	return status;
+}
+
+/* returns the position of the line, or n if not found */
+static unsigned find_line(char logged[][64], unsigned n, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < n && strcmp(logged[i], name) != 0; i++);
+	return i;
+}
+
+int main(void)
+{
+	int fd[2];
+	pid_t pid;
+	FILE *fp;
+	char line[64];
+	char logged[16][64];
+	unsigned i, n = 0;
+	int status;
+
+	pool = talloc_new(NULL);
+	check(pool != NULL, __LINE__);
+
+	check(mkdtemp(dir) != NULL, __LINE__);
+	write_script();
+
+	check(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0, __LINE__);
+
+	pid = fork();
+	check(pid != -1, __LINE__);
+	if (pid == 0) {
+		close(fd[1]);
+		hook_runner_server(fd[0], 4, NULL);
+		exit(1);
+	}
+	close(fd[0]);
+
+	/* the disconnect scripts are queued while the connect ones run */
+	run(fd[1], 1, "connect", 100, "connect-100", 0, "0.3");
+	run(fd[1], 0, "disconnect", 100, "disconnect-100", 0, "0");
+	run(fd[1], 2, "connect", 200, "connect-200", 1, "0.3");
+	run(fd[1], 0, "disconnect", 200, "disconnect-200", 0, "0");
+
+	/* and are followed by a script waited for, in each session */
+	run(fd[1], 3, "host-update", 100, "update-100", 0, "0");
+	run(fd[1], 4, "host-update", 200, "update-200", 0, "0");
+
+	/* the results arrive as the scripts complete */
+	for (i = 0; i < 4; i++) {
+		HookResultMsg *msg;
+
+		check(recv_msg(pool, fd[1], CMD_HOOK_RESULT, (void *)&msg,
+			       (unpack_func) hook_result_msg__unpack, 10000) >= 0, __LINE__);
+		if (msg->id == 2)
+			check(msg->status == 1, __LINE__);
+		else
+			check(msg->id <= 4 && msg->status == 0, __LINE__);
+		talloc_free(msg);
+	}
+
+	/* a new session with the same pid runs its disconnect script */
+	run(fd[1], 5, "connect", 200, "connect-200b", 0, "0");
+	check(result(fd[1], 5) == 0, __LINE__);
+	run(fd[1], 0, "disconnect", 200, "disconnect-200b", 0, "0");
+	run(fd[1], 6, "host-update", 200, "update-200b", 0, "0");
+	check(result(fd[1], 6) == 0, __LINE__);
+
+	close(fd[1]);
+	check(waitpid(pid, &status, 0) == pid, __LINE__);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, __LINE__);
+
+	fp = fopen(log_file, "r");
+	check(fp != NULL, __LINE__);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		check(n < 16, __LINE__);
+		line[strcspn(line, "\n")] = 0;
+		strcpy(logged[n++], line);
+	}
+	fclose(fp);
+
+#define POS(name) find_line(logged, n, name)
+	check(n == 8, __LINE__);
+	check(POS("connect-100") < POS("disconnect-100"), __LINE__);
+	check(POS("disconnect-100") < POS("update-100"), __LINE__);
+	check(POS("update-100") < n, __LINE__);
+	check(POS("connect-200") < POS("update-200"), __LINE__);
+	check(POS("update-200") < n, __LINE__);
+	check(POS("disconnect-200") == n, __LINE__);
+	check(POS("connect-200b") < POS("disconnect-200b"), __LINE__);
+	check(POS("disconnect-200b") < POS("update-200b"), __LINE__);
+	check(POS("update-200b") < n, __LINE__);
+
+	unlink(log_file);
+	unlink(script);
+	rmdir(dir);
+	talloc_free(pool);
+
+	return 0;
+}
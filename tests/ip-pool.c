@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <talloc.h>
+
+#include "../src/ip-pool.h"
+#include "../src/ip-pool.c"
+
+static void check_pool(uint32_t size)
+{
+	ip_pool_st *p;
+	uint32_t i;
+	int64_t r;
+
+	p = ip_pool_new(NULL, size);
+	if (p == NULL) {
+		fprintf(stderr, "error in %d: %u\n", __LINE__, (unsigned)size);
+		exit(1);
+	}
+
+	if (ip_pool_fragments(p) != 1) {
+		fprintf(stderr, "error in %d: %u\n", __LINE__, (unsigned)size);
+		exit(1);
+	}
+
+	/* slots are returned in order until the pool is exhausted */
+	for (i = 0; i < size; i++) {
+		r = ip_pool_get(p);
+		if (r != i) {
+			fprintf(stderr, "error in %d: %u: %d\n", __LINE__, (unsigned)i, (int)r);
+			exit(1);
+		}
+	}
+
+	if (ip_pool_get(p) != -1 || p->used != size || ip_pool_fragments(p) != 0) {
+		fprintf(stderr, "error in %d: %u\n", __LINE__, (unsigned)size);
+		exit(1);
+	}
+
+	/* release every other slot of the last 300 */
+	for (i = (size > 300) ? size - 300 : 0; i < size; i += 2)
+		ip_pool_put(p, i);
+
+	for (i = (size > 300) ? size - 300 : 0; i < size; i += 2) {
+		r = ip_pool_get(p);
+		if (r != i) {
+			fprintf(stderr, "error in %d: %u: %d\n", __LINE__, (unsigned)i, (int)r);
+			exit(1);
+		}
+	}
+
+	if (ip_pool_get(p) != -1) {
+		fprintf(stderr, "error in %d: %u\n", __LINE__, (unsigned)size);
+		exit(1);
+	}
+
+	talloc_free(p);
+}
+
+int main()
+{
+	ip_pool_st *p;
+	int64_t r;
+
+	check_pool(1);
+	check_pool(4);
+	check_pool(64);
+	check_pool(65);
+	check_pool(4096);
+	check_pool(4097);
+	check_pool(1 << 18);
+
+	if (ip_pool_new(NULL, (1 << IP_POOL_MAX_BITS) + 1) != NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	p = ip_pool_new(NULL, 1 << IP_POOL_MAX_BITS);
+	if (p == NULL || p->levels != 4) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* sticky slots */
+	if (ip_pool_take(p, 100000) != 0 || ip_pool_take(p, 100000) != -1 ||
+	    ip_pool_take(p, 1 << IP_POOL_MAX_BITS) != -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (ip_pool_take(p, 0) != 0 || ip_pool_fragments(p) != 2) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	r = ip_pool_get(p);
+	if (r != 1) {
+		fprintf(stderr, "error in %d: %d\n", __LINE__, (int)r);
+		exit(1);
+	}
+
+	ip_pool_put(p, 100000);
+	ip_pool_put(p, 100000);
+	if (p->used != 2 || ip_pool_fragments(p) != 1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	talloc_free(p);
+
+	/* searches which skip the rejected slots */
+	p = ip_pool_new(NULL, 1 << 18);
+	if (p == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	for (r = 0; r <= 70000; r++) {
+		if (ip_pool_get(p) != r) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+	ip_pool_put(p, 5);
+	ip_pool_put(p, 69000);
+
+	if (ip_pool_get_from(p, 6) != 69000 || ip_pool_get_from(p, 69000) != 70001 ||
+	    ip_pool_get_from(p, 0) != 5 || ip_pool_get_from(p, (1 << 18) - 1) != (1 << 18) - 1 ||
+	    ip_pool_get_from(p, 1 << 18) != -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	while (ip_pool_get(p) >= 0)
+		;
+	if (p->used != p->size || ip_pool_get_from(p, 0) != -1) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	talloc_free(p);
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the private key operations performed by the sec-mod key
+ * threads, and reports the signing rate for an increasing number of
+ * threads. It can be used as a handshake rate benchmark with:
+ *   ./key-ops <key file> <operations>
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <talloc.h>
+
+#include "../src/sec-mod-threads.h"
+#include "../src/sec-mod-threads.c"
+#include "../src/sec-mod-keys.h"
+#include "../src/sec-mod-keys.c"
+
+#define DEFAULT_OPS 64
+#define MAX_THREADS 8
+
+static gnutls_privkey_t key;
+static gnutls_pubkey_t pubkey;
+static unsigned done;
+
+/* the digest info of a TLS 1.0 handshake */
+static unsigned char hash[36];
+
+static void check_sig(const gnutls_datum_t *sig, int line)
+{
+	gnutls_datum_t data = {hash, sizeof(hash)};
+	int ret;
+
+	ret = gnutls_pubkey_verify_hash2(pubkey, GNUTLS_SIGN_UNKNOWN,
+					 GNUTLS_PUBKEY_VERIFY_FLAG_TLS1_RSA,
+					 &data, sig);
+	if (ret < 0) {
+		fprintf(stderr, "error in %d: %s\n", line, gnutls_strerror(ret));
+		exit(1);
+	}
+}
+
+static void op_done(sec_job_st *job)
+{
+	key_op_st *op = (key_op_st *)job;
+
+	if (op->ret < 0) {
+		fprintf(stderr, "error in %d: %s\n", __LINE__, gnutls_strerror(op->ret));
+		exit(1);
+	}
+
+	check_sig(&op->out, __LINE__);
+	done++;
+	talloc_free(op);
+}
+
+static double run_inline(unsigned ops)
+{
+	gnutls_datum_t data = {hash, sizeof(hash)};
+	gnutls_datum_t out;
+	struct timespec start, end;
+	unsigned i;
+	int ret;
+
+	gettime_mono(&start);
+	for (i = 0; i < ops; i++) {
+		ret = sec_key_op(key, CMD_SEC_SIGN, 0, &data, &out);
+		if (ret < 0) {
+			fprintf(stderr, "error in %d: %s\n", __LINE__, gnutls_strerror(ret));
+			exit(1);
+		}
+		check_sig(&out, __LINE__);
+		gnutls_free(out.data);
+	}
+	gettime_mono(&end);
+
+	return ops * 1000000.0 / (timespec_sub_us(&end, &start) + 1);
+}
+
+static double run_threads(unsigned nthreads, unsigned ops)
+{
+	gnutls_datum_t data = {hash, sizeof(hash)};
+	sec_threads_st *t;
+	sec_backend_st *b;
+	key_op_st *op;
+	struct pollfd pfd;
+	struct timespec start, end;
+	unsigned i;
+
+	t = sec_threads_new(NULL, nthreads);
+	if (t == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	b = sec_threads_backend(t, &key, "private-keys", 0);
+	if (b == NULL) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	done = 0;
+	gettime_mono(&start);
+	for (i = 0; i < ops; i++) {
+		op = key_op_new(t, key, CMD_SEC_SIGN, 0, &data);
+		if (op == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+		op->job.done = op_done;
+
+		if (sec_threads_submit(t, b, &op->job) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	pfd.fd = t->notify_fd[0];
+	pfd.events = POLLIN;
+	while (done < ops) {
+		if (poll(&pfd, 1, 10000) <= 0) {
+			fprintf(stderr, "error in %d: timeout\n", __LINE__);
+			exit(1);
+		}
+		sec_threads_complete(t);
+	}
+	gettime_mono(&end);
+
+	if (b->running != 0 || b->completed != ops) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	talloc_free(t);
+
+	return ops * 1000000.0 / (timespec_sub_us(&end, &start) + 1);
+}
+
+int main(int argc, char **argv)
+{
+	char file[512];
+	const char *srcdir;
+	gnutls_datum_t data;
+	unsigned ops = DEFAULT_OPS, n;
+	int ret;
+
+	if (argc > 1) {
+		snprintf(file, sizeof(file), "%s", argv[1]);
+	} else {
+		srcdir = getenv("srcdir");
+		snprintf(file, sizeof(file), "%s/certs/server-key.pem", srcdir ? srcdir : ".");
+	}
+	if (argc > 2)
+		ops = atoi(argv[2]);
+
+	ret = gnutls_load_file(file, &data);
+	if (ret < 0) {
+		fprintf(stderr, "could not load %s: %s\n", file, gnutls_strerror(ret));
+		exit(77);
+	}
+
+	if (gnutls_privkey_init(&key) < 0 ||
+	    gnutls_privkey_import_x509_raw(key, &data, GNUTLS_X509_FMT_PEM, NULL, 0) < 0 ||
+	    gnutls_pubkey_init(&pubkey) < 0 ||
+	    gnutls_pubkey_import_privkey(pubkey, key, 0, 0) < 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+	gnutls_free(data.data);
+
+	memset(hash, 0x42, sizeof(hash));
+
+	printf("inline: %.1f ops/sec\n", run_inline(ops));
+	for (n = 1; n <= MAX_THREADS; n *= 2)
+		printf("%u threads: %.1f ops/sec\n", n, run_threads(n, ops));
+
+	gnutls_pubkey_deinit(pubkey);
+	gnutls_privkey_deinit(key);
+
+	return 0;
+}
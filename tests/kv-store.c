@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the shared state client against a local memcached stand-in,
+ * with two clients acting as the servers of a cluster: the values and
+ * counters seen by both, the local cache, the pipelined requests, the
+ * sealing with the cluster key, and the failure of the requests on a
+ * timeout and once the server is gone.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <talloc.h>
+
+#include "../src/kv-store.c"
+
+#define MAX_CLIENTS 8
+#define FORGED "a session entry which is not sealed"
+#define MAX_ITEMS 64
+
+struct item {
+	char key[MAX_KEY_SIZE+1];
+	uint8_t data[KV_MAX_VALUE_SIZE];
+	unsigned size;
+};
+
+struct client {
+	int fd;
+	char buf[MAX_LINE_SIZE + KV_MAX_VALUE_SIZE + 2];
+	unsigned len;
+};
+
+static struct item items[MAX_ITEMS];
+static unsigned done, not_found, failed;
+static char last_value[64];
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static struct item *find_item(const char *key, unsigned create)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_ITEMS; i++) {
+		if (items[i].key[0] != 0 && strcmp(items[i].key, key) == 0)
+			return &items[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	for (i = 0; i < MAX_ITEMS; i++) {
+		if (items[i].key[0] == 0) {
+			strcpy(items[i].key, key);
+			return &items[i];
+		}
+	}
+	return NULL;
+}
+
+static void reply(int fd, const void *data, unsigned size)
+{
+	check(send(fd, data, size, MSG_NOSIGNAL) == (int)size, __LINE__);
+}
+
+/* Serves the complete requests in the buffer */
+static void serve(struct client *c)
+{
+	char key[MAX_KEY_SIZE+1], line[MAX_LINE_SIZE];
+	unsigned flags, ttl, size, delta, used;
+	struct item *it;
+	char *eol;
+
+	while ((eol = memmem(c->buf, c->len, "\r\n", 2)) != NULL) {
+		used = eol - c->buf + 2;
+		memcpy(line, c->buf, used - 2);
+		line[used - 2] = 0;
+
+		if (sscanf(line, "get %250s", key) == 1) {
+			/* never answered */
+			if (strncmp(key, "ocserv:slow:", 12) == 0)
+				return;
+
+			it = find_item(key, 0);
+			if (it != NULL) {
+				snprintf(line, sizeof(line), "VALUE %s 0 %u\r\n", key, it->size);
+				reply(c->fd, line, strlen(line));
+				reply(c->fd, it->data, it->size);
+				reply(c->fd, "\r\nEND\r\n", 7);
+			} else {
+				reply(c->fd, "END\r\n", 5);
+			}
+		} else if (sscanf(line, "set %250s %u %u %u", key, &flags, &ttl, &size) == 4 ||
+			   sscanf(line, "add %250s %u %u %u", key, &flags, &ttl, &size) == 4) {
+			if (c->len < used + size + 2)
+				return;
+
+			it = find_item(key, 0);
+			if (line[0] == 'a' && it != NULL) {
+				reply(c->fd, "NOT_STORED\r\n", 12);
+			} else {
+				it = find_item(key, 1);
+				check(it != NULL, __LINE__);
+				memcpy(it->data, c->buf + used, size);
+				it->size = size;
+				reply(c->fd, "STORED\r\n", 8);
+			}
+			used += size + 2;
+		} else if (sscanf(line, "delete %250s", key) == 1) {
+			it = find_item(key, 0);
+			if (it != NULL) {
+				it->key[0] = 0;
+				reply(c->fd, "DELETED\r\n", 9);
+			} else {
+				reply(c->fd, "NOT_FOUND\r\n", 11);
+			}
+		} else if (sscanf(line, "incr %250s %u", key, &delta) == 2) {
+			it = find_item(key, 0);
+			if (it != NULL) {
+				it->data[it->size] = 0;
+				it->size = snprintf((char*)it->data, sizeof(it->data), "%lu",
+						    strtoul((char*)it->data, NULL, 10) + delta);
+				snprintf(line, sizeof(line), "%.*s\r\n", it->size, (char*)it->data);
+				reply(c->fd, line, strlen(line));
+			} else {
+				reply(c->fd, "NOT_FOUND\r\n", 11);
+			}
+		} else {
+			reply(c->fd, "ERROR\r\n", 7);
+		}
+
+		memmove(c->buf, c->buf + used, c->len - used);
+		c->len -= used;
+	}
+}
+
+static void stand_in(int sd)
+{
+	struct client clients[MAX_CLIENTS];
+	struct pollfd pfd[MAX_CLIENTS + 1];
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	for (;;) {
+		pfd[0].fd = sd;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			pfd[i + 1].fd = clients[i].fd;
+			pfd[i + 1].events = POLLIN;
+		}
+
+		check(poll(pfd, MAX_CLIENTS + 1, -1) > 0, __LINE__);
+
+		if (pfd[0].revents & POLLIN) {
+			for (i = 0; i < MAX_CLIENTS; i++) {
+				if (clients[i].fd == -1) {
+					clients[i].fd = accept(sd, NULL, NULL);
+					clients[i].len = 0;
+					break;
+				}
+			}
+		}
+
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd == -1 || !(pfd[i + 1].revents & (POLLIN|POLLHUP)))
+				continue;
+
+			ret = recv(clients[i].fd, clients[i].buf + clients[i].len,
+				   sizeof(clients[i].buf) - clients[i].len, 0);
+			if (ret <= 0) {
+				close(clients[i].fd);
+				clients[i].fd = -1;
+				continue;
+			}
+			clients[i].len += ret;
+			serve(&clients[i]);
+		}
+	}
+}
+
+static void get_done(void *priv, int status, const kv_value_st *value)
+{
+	done++;
+	if (status == KV_OK) {
+		snprintf(last_value, sizeof(last_value), "%.*s", value->size, value->data);
+	} else if (status == KV_ERR_NOT_FOUND) {
+		not_found++;
+	} else {
+		failed++;
+	}
+}
+
+static uint64_t counter;
+
+static void incr_done(void *priv, int status, uint64_t value)
+{
+	done++;
+	check(status == KV_OK, __LINE__);
+	counter = value;
+}
+
+/* runs the clients until @n requests are completed */
+static void run(kv_store_st *kv, unsigned n)
+{
+	struct pollfd pfd;
+	unsigned loops = 0;
+
+	while (done < n) {
+		pfd.fd = kv_store_fd(kv);
+		pfd.events = kv_store_events(kv);
+		poll(&pfd, 1, 100);
+		kv_store_process(kv);
+		check(loops++ < 100, __LINE__);
+	}
+}
+
+/* waits for the replies to the outstanding requests */
+static void wait_replies(kv_store_st *kv)
+{
+	struct pollfd pfd;
+	unsigned loops = 0;
+
+	while (kv->npending > 0) {
+		pfd.fd = kv_store_fd(kv);
+		pfd.events = kv_store_events(kv);
+		poll(&pfd, 1, 100);
+		kv_store_process(kv);
+		check(loops++ < 100, __LINE__);
+	}
+}
+
+struct wait_st {
+	unsigned finished;
+	int status;
+	void *pool;
+	uint8_t *data;
+	unsigned size;
+};
+
+static void wait_done(void *priv, int status, const kv_value_st *value)
+{
+	struct wait_st *w = priv;
+
+	w->finished = 1;
+	w->status = status;
+	if (status == KV_OK) {
+		w->data = talloc_memdup(w->pool, value->data, value->size);
+		w->size = value->size;
+		if (w->data == NULL && value->size > 0)
+			w->status = KV_ERR_SERVER;
+	}
+}
+
+/* Looks up a value and waits for the reply; the value is allocated
+ * under @pool. Returns 1 if found, zero if not, or a negative status. */
+static int get_wait(kv_store_st *kv, const char *prefix, const void *id, unsigned id_size,
+		    void *pool, uint8_t **data, unsigned *size)
+{
+	struct wait_st w;
+	kv_value_st value;
+	struct pollfd pfd;
+	int ret;
+
+	memset(&w, 0, sizeof(w));
+	w.pool = pool;
+
+	ret = kv_store_get(kv, prefix, id, id_size, &value, wait_done, &w);
+	if (ret < 0)
+		return ret;
+
+	if (ret == 1)
+		wait_done(&w, KV_OK, &value);
+
+	/* the request is completed by its reply, its timeout, or the
+	 * failure of the connection; all of them are detected by
+	 * kv_store_process(), whatever poll() returns */
+	while (w.finished == 0) {
+		pfd.fd = kv_store_fd(kv);
+		pfd.events = kv_store_events(kv);
+		pfd.revents = 0;
+
+		poll(&pfd, 1, kv_store_timeout(kv));
+		kv_store_process(kv);
+	}
+
+	if (w.status == KV_ERR_NOT_FOUND)
+		return 0;
+	if (w.status < 0)
+		return w.status;
+
+	*data = w.data;
+	*size = w.size;
+	return 1;
+}
+
+int main(void)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	kv_store_st *kv, *kv2, *kv3, *kv4;
+	uint8_t secret[KV_KEY_SIZE], mac[32];
+	char key[MAX_KEY_SIZE+1];
+	kv_value_st value;
+	char server[64];
+	uint8_t *data;
+	unsigned size, i;
+	uint8_t id[16], id2[16];
+	pid_t pid;
+	int sd, ret;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	sd = socket(AF_INET, SOCK_STREAM, 0);
+	check(sd >= 0, __LINE__);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	check(bind(sd, (struct sockaddr *)&sa, sizeof(sa)) == 0, __LINE__);
+	check(getsockname(sd, (struct sockaddr *)&sa, &len) == 0, __LINE__);
+	check(listen(sd, 8) == 0, __LINE__);
+
+	pid = fork();
+	check(pid >= 0, __LINE__);
+	if (pid == 0) {
+		stand_in(sd);
+		exit(0);
+	}
+	close(sd);
+
+	snprintf(server, sizeof(server), "127.0.0.1:%u", (unsigned)ntohs(sa.sin_port));
+	check(kv_store_new(NULL, "[::1", 0, 0) == NULL, __LINE__);
+
+	/* two servers of a cluster; the second caches nothing */
+	kv = kv_store_new(NULL, server, 300, KV_DEFAULT_CACHE_SECS);
+	check(kv != NULL, __LINE__);
+	kv2 = kv_store_new(NULL, server, 300, 0);
+	check(kv2 != NULL, __LINE__);
+
+	memset(id, 1, sizeof(id));
+	memset(id2, 2, sizeof(id2));
+
+	/* a value stored by one is seen by the other */
+	check(kv_store_set(kv, "tls", id, sizeof(id), "session one", 11, 60) == 0, __LINE__);
+	wait_replies(kv);
+	ret = get_wait(kv2, "tls", id, sizeof(id), kv2, &data, &size);
+	check(ret == 1 && size == 11 && memcmp(data, "session one", 11) == 0, __LINE__);
+
+	/* and is cached by the one which stored it */
+	check(kv_store_get(kv, "tls", id, sizeof(id), &value, get_done, NULL) == 1, __LINE__);
+	check(value.size == 11 && memcmp(value.data, "session one", 11) == 0, __LINE__);
+
+	/* the same id in another database */
+	check(get_wait(kv2, "sid", id, sizeof(id), kv2, &data, &size) == 0, __LINE__);
+
+	/* pipelined requests are completed in order */
+	check(kv_store_set(kv2, "tls", id2, sizeof(id2), "session two", 11, 60) == 0, __LINE__);
+	wait_replies(kv2);
+	check(kv_store_get(kv, "tls", id2, sizeof(id2), &value, get_done, NULL) == 0, __LINE__);
+	check(kv_store_get(kv, "sid", id2, sizeof(id2), &value, get_done, NULL) == 0, __LINE__);
+	run(kv, 2);
+	check(strcmp(last_value, "session two") == 0 && not_found == 1, __LINE__);
+
+	/* the counters of both */
+	check(kv_store_incr(kv, "ban", id, 4, 3, 60, incr_done, NULL) == 0, __LINE__);
+	run(kv, 3);
+	check(counter == 3, __LINE__);
+	check(kv_store_incr(kv2, "ban", id, 4, 4, 60, incr_done, NULL) == 0, __LINE__);
+	run(kv2, 4);
+	check(counter == 7, __LINE__);
+	check(kv_store_incr(kv, "ban", id, 4, 0, 60, incr_done, NULL) == 0, __LINE__);
+	run(kv, 5);
+	check(counter == 7, __LINE__);
+
+	/* a deletion by the other */
+	check(kv_store_del(kv2, "tls", id, sizeof(id)) == 0, __LINE__);
+	wait_replies(kv2);
+	check(get_wait(kv2, "tls", id, sizeof(id), kv2, &data, &size) == 0, __LINE__);
+
+	/* many outstanding requests */
+	for (i = 0; i < 100; i++)
+		check(kv_store_get(kv2, "tls", id2, sizeof(id2), &value, get_done, NULL) == 0, __LINE__);
+	run(kv2, 105);
+	check(failed == 0 && not_found == 1, __LINE__);
+
+	/* with the cluster key, the server sees neither the ids nor the
+	 * values, and the values not sealed with the key are ignored */
+	memset(secret, 3, sizeof(secret));
+	kv3 = kv_store_new(NULL, server, 300, 0);
+	kv4 = kv_store_new(NULL, server, 300, 0);
+	check(kv3 != NULL && kv4 != NULL, __LINE__);
+	check(kv_store_set_key(kv3, secret) == 0, __LINE__);
+	check(kv_store_set_key(kv4, secret) == 0, __LINE__);
+
+	check(kv_store_set(kv3, "sid", id, sizeof(id), "session three", 13, 60) == 0, __LINE__);
+	wait_replies(kv3);
+	ret = get_wait(kv4, "sid", id, sizeof(id), kv4, &data, &size);
+	check(ret == 1 && size == 13 && memcmp(data, "session three", 13) == 0, __LINE__);
+	check(get_wait(kv2, "sid", id, sizeof(id), kv2, &data, &size) == 0, __LINE__);
+
+	/* a value written in the clear under the same key */
+	check(make_key(kv3, key, sizeof(key), "sid", id, sizeof(id)) == 0, __LINE__);
+	check(strlen(key) == 11 + 2*sizeof(mac), __LINE__);
+	for (i = 0; i < sizeof(mac); i++)
+		check(sscanf(&key[11 + 2*i], "%2hhx", &mac[i]) == 1, __LINE__);
+	check(kv_store_set(kv2, "sid", mac, sizeof(mac), FORGED, sizeof(FORGED)-1, 60) == 0, __LINE__);
+	wait_replies(kv2);
+	check(get_wait(kv4, "sid", id, sizeof(id), kv4, &data, &size) == 0, __LINE__);
+	check(kv4->rejected == 1, __LINE__);
+
+	talloc_free(kv3);
+	talloc_free(kv4);
+
+	/* a request which is not answered fails the connection, and the
+	 * requests fail until it is retried */
+	check(kv_store_get(kv2, "slow", id, sizeof(id), &value, get_done, NULL) == 0, __LINE__);
+	check(kv_store_get(kv2, "tls", id2, sizeof(id2), &value, get_done, NULL) == 0, __LINE__);
+	run(kv2, 107);
+	check(failed == 2 && kv_store_fd(kv2) == -1, __LINE__);
+	check(kv_store_get(kv2, "tls", id2, sizeof(id2), &value, get_done, NULL) < 0, __LINE__);
+	check(kv_store_set(kv2, "tls", id2, sizeof(id2), "x", 1, 60) < 0, __LINE__);
+
+	/* the server is gone */
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	check(kv_store_get(kv, "sid", id, sizeof(id), &value, get_done, NULL) == 0, __LINE__);
+	run(kv, 108);
+	check(failed == 3, __LINE__);
+
+	talloc_free(kv);
+	talloc_free(kv2);
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the buckets of the histograms cover the values without
+ * gaps, that the percentiles are within a bucket of the values, and that
+ * the counts below the powers of two are exact.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/latency-hist.c"
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	static latency_hist_st h;
+	uint64_t v, p;
+	unsigned i, prev = 0;
+
+	/* consecutive buckets, each within a quarter of its values */
+	for (v = 0; v < (1 << 20); v++) {
+		i = bucket_of(v);
+		check(i == prev || i == prev + 1, __LINE__);
+		check(v < bucket_end(i), __LINE__);
+		check(i == 0 || v >= bucket_end(i - 1), __LINE__);
+		check(v < 8 || bucket_end(i) - 1 - v <= v / HIST_SUB_BUCKETS, __LINE__);
+		prev = i;
+	}
+	check(bucket_of((uint64_t)1 << 40) == HIST_BUCKETS - 1, __LINE__);
+	check(bucket_end(HIST_BUCKETS - 1) == (uint64_t)1 << HIST_MAX_BITS, __LINE__);
+
+	check(latency_hist_percentile(&h, 50) == 0, __LINE__);
+
+	/* 1..1000 us */
+	for (v = 1; v <= 1000; v++)
+		latency_hist_add(&h, v);
+	check(h.count == 1000, __LINE__);
+	check(h.sum == 500500, __LINE__);
+	check(h.max == 1000, __LINE__);
+
+	p = latency_hist_percentile(&h, 50);
+	check(p >= 500 && p <= 500 + 500 / HIST_SUB_BUCKETS, __LINE__);
+	p = latency_hist_percentile(&h, 90);
+	check(p >= 900 && p <= 1000, __LINE__);
+	check(latency_hist_percentile(&h, 100) == 1000, __LINE__);
+	check(latency_hist_percentile(&h, 0) == 1, __LINE__);
+
+	for (i = 0; i < 10; i++)
+		check(latency_hist_count_below(&h, 1 << i) == (1 << i) - 1, __LINE__);
+	check(latency_hist_count_below(&h, 1024) == 1000, __LINE__);
+	check(latency_hist_count_below(&h, (uint64_t)1 << 40) == 1000, __LINE__);
+
+	/* the values beyond the range */
+	latency_hist_add(&h, (uint64_t)1 << 40);
+	check(latency_hist_percentile(&h, 100) == (uint64_t)1 << 40, __LINE__);
+	check(latency_hist_count_below(&h, (uint64_t)1 << 40) == 1000, __LINE__);
+
+	/* several values at once */
+	memset(&h, 0, sizeof(h));
+	latency_hist_add_n(&h, 100, 3);
+	latency_hist_add_n(&h, 5000, 0);
+	latency_hist_add(&h, 200);
+	check(h.count == 4 && h.sum == 500 && h.max == 200, __LINE__);
+	check(latency_hist_count_below(&h, 128) == 3, __LINE__);
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the plain authentication over the index of the password file,
+ * and the reading of the file when modified.
+ *
+ * When given file sizes as arguments it measures the authentication
+ * throughput instead, e.g.: ./plain-index 1000 10000 100000 1000000
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <talloc.h>
+
+#include "../src/auth/plain-index.c"
+#include "../src/auth/plain.c"
+#include "../src/auth/common.c"
+
+/* "pass" with a DES salt; cheap enough not to hide the lookup */
+#define CPASS "abccBcrPOxnLU"
+
+static char file[] = "plain-index.tmp.XXXXXX";
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static void write_file(const char *name, const char *data)
+{
+	FILE *fp = fopen(name, "w");
+
+	check(fp != NULL, __LINE__);
+	check(fputs(data, fp) >= 0, __LINE__);
+	check(fclose(fp) == 0, __LINE__);
+}
+
+/* Runs the password authentication of @username, and returns its
+ * result and its group */
+static int auth(void *vctx, const char *username, const char *pass,
+		const char *suggested, char *group, unsigned group_size)
+{
+	common_auth_init_st st;
+	void *ctx = NULL;
+	int ret;
+
+	memset(&st, 0, sizeof(st));
+	st.username = username;
+
+	ret = plain_auth_funcs.auth_init(&ctx, NULL, vctx, &st);
+	if (ret != ERR_AUTH_CONTINUE)
+		goto exit;
+
+	ret = plain_auth_funcs.auth_pass(ctx, pass, strlen(pass));
+	if (ret == 0 && group != NULL)
+		ret = plain_auth_funcs.auth_group(ctx, suggested, group, group_size);
+ exit:
+	if (ctx)
+		plain_auth_funcs.auth_deinit(ctx);
+	return ret;
+}
+
+static double now_secs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void bench(void *vctx, unsigned entries)
+{
+	struct plain_vctx_st *vc = vctx;
+	char username[64];
+	unsigned i, auths;
+	double start, load, elapsed;
+	FILE *fp;
+
+	fp = fopen(file, "w");
+	check(fp != NULL, __LINE__);
+	for (i = 0; i < entries; i++)
+		fprintf(fp, "user%u:group%u,users:%s\n", i, i % 16, CPASS);
+	check(fclose(fp) == 0, __LINE__);
+
+	/* the file is read once the current second passes */
+	sleep(1);
+	start = now_secs();
+	check(plain_index_size(vc->passwd) == (int)entries, __LINE__);
+	load = now_secs() - start;
+	sleep(1);
+	check(plain_index_size(vc->passwd) == (int)entries, __LINE__);
+
+	auths = 0;
+	start = now_secs();
+	do {
+		for (i = 0; i < 1000; i++) {
+			snprintf(username, sizeof(username), "user%u",
+				 (unsigned)random() % entries);
+			check(auth(vctx, username, "pass", NULL, NULL, 0) == 0, __LINE__);
+		}
+		auths += i;
+		elapsed = now_secs() - start;
+	} while (elapsed < 2);
+
+	printf("%8u entries: read in %.3f sec, %.0f auths/sec\n",
+	       entries, load, auths / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+	struct plain_cfg_st config;
+	char newfile[sizeof(file) + 4];
+	char group[MAX_GROUPNAME_SIZE];
+	void *vctx;
+	int fd, i;
+
+	fd = mkstemp(file);
+	check(fd != -1, __LINE__);
+	close(fd);
+
+	memset(&config, 0, sizeof(config));
+	config.passwd = file;
+	plain_auth_funcs.vhost_init(&vctx, NULL, &config);
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			bench(vctx, atoi(argv[i]));
+		goto exit;
+	}
+
+	write_file(file,
+		   "test:group1, group2:"CPASS"\n"
+		   "crlf:*:"CPASS"\r\n"
+		   "test:group3:"CPASS"\n"
+		   "nopass:group1:\n"
+		   "short\n"
+		   "nofields:"CPASS"\n");
+
+	check(plain_index_size(((struct plain_vctx_st*)vctx)->passwd) == 3, __LINE__);
+
+	/* the first entry of a user applies */
+	check(auth(vctx, "test", "pass", NULL, group, sizeof(group)) == 0, __LINE__);
+	check(strcmp(group, "group1") == 0, __LINE__);
+	check(auth(vctx, "test", "pass", "group2", group, sizeof(group)) == 0, __LINE__);
+	check(strcmp(group, "group2") == 0, __LINE__);
+	check(auth(vctx, "test", "pass", "group3", group, sizeof(group)) != 0, __LINE__);
+	check(auth(vctx, "test", "wrong", NULL, NULL, 0) == ERR_AUTH_CONTINUE, __LINE__);
+
+	check(auth(vctx, "crlf", "pass", NULL, group, sizeof(group)) == 0, __LINE__);
+	check(strcmp(group, "*") == 0, __LINE__);
+
+	/* unknown users are asked for a password, which fails */
+	check(auth(vctx, "unknown", "pass", NULL, NULL, 0) == ERR_AUTH_CONTINUE, __LINE__);
+	check(auth(vctx, "nofields", "pass", NULL, NULL, 0) == ERR_AUTH_CONTINUE, __LINE__);
+
+	/* no password and no OTP file */
+	check(auth(vctx, "nopass", "", NULL, NULL, 0) == 0, __LINE__);
+
+	/* a modification of the same size, within the second of the read */
+	write_file(file,
+		   "test:group4, group2:"CPASS"\n"
+		   "crlf:*:"CPASS"\r\n"
+		   "test:group3:"CPASS"\n"
+		   "nopass:group1:\n"
+		   "short\n"
+		   "nofields:"CPASS"\n");
+	check(auth(vctx, "test", "pass", NULL, group, sizeof(group)) == 0, __LINE__);
+	check(strcmp(group, "group4") == 0, __LINE__);
+
+	/* a replacement of the file */
+	snprintf(newfile, sizeof(newfile), "%s.new", file);
+	write_file(newfile, "new:group5:"CPASS"\n");
+	check(rename(newfile, file) == 0, __LINE__);
+	check(auth(vctx, "new", "pass", NULL, group, sizeof(group)) == 0, __LINE__);
+	check(strcmp(group, "group5") == 0, __LINE__);
+	check(auth(vctx, "test", "pass", NULL, NULL, 0) == ERR_AUTH_CONTINUE, __LINE__);
+
+	/* a removed file fails the authentication */
+	unlink(file);
+	check(auth(vctx, "new", "pass", NULL, NULL, 0) == ERR_AUTH_FAIL, __LINE__);
+
+ exit:
+	talloc_free(vctx);
+	unlink(file);
+	return 0;
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the asynchronous radius client against local stand-in servers:
+ * the matching of out of order replies, the password hiding and the
+ * authenticators, the rejection of forged replies, the failover to a
+ * secondary server and the rate limit.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <talloc.h>
+
+#include "../src/radius-client.c"
+
+#define SECRET "testing123"
+#define PASSWORD "a password longer than sixteen bytes"
+#define MAX_HELD 8
+
+struct stand_in {
+	int fd;
+	unsigned port;
+	unsigned received;
+	unsigned mode; /* 0: silent, 1: replies, 2: replies with a wrong secret,
+			* 3: replies without a Message-Authenticator */
+	unsigned hold; /* replies are sent in reverse order once that many are received */
+
+	uint8_t held[MAX_HELD][RAD_MAX_PACKET_SIZE];
+	unsigned held_size[MAX_HELD];
+	struct sockaddr_storage held_addr[MAX_HELD];
+	socklen_t held_addr_len[MAX_HELD];
+	unsigned nheld;
+};
+
+static unsigned done, accepted;
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static void stand_in_init(struct stand_in *si, unsigned mode, unsigned hold)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+
+	memset(si, 0, sizeof(*si));
+	si->mode = mode;
+	si->hold = hold;
+
+	si->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	check(si->fd >= 0, __LINE__);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	check(bind(si->fd, (struct sockaddr *)&sa, sizeof(sa)) == 0, __LINE__);
+	check(getsockname(si->fd, (struct sockaddr *)&sa, &len) == 0, __LINE__);
+	si->port = ntohs(sa.sin_port);
+	set_non_block(si->fd);
+}
+
+static void hmac(const char *secret, const uint8_t *data, unsigned len, uint8_t out[16])
+{
+	struct hmac_md5_ctx ctx;
+
+	hmac_md5_set_key(&ctx, strlen(secret), (uint8_t *)secret);
+	hmac_md5_update(&ctx, len, data);
+	hmac_md5_digest(&ctx, 16, out);
+}
+
+static void md5_auth(const char *secret, const uint8_t *pkt, unsigned len,
+		     const uint8_t *auth, uint8_t out[16])
+{
+	struct md5_ctx ctx;
+
+	md5_init(&ctx);
+	md5_update(&ctx, 4, pkt);
+	md5_update(&ctx, 16, auth);
+	md5_update(&ctx, len - 20, pkt + 20);
+	md5_update(&ctx, strlen(secret), (uint8_t *)secret);
+	md5_digest(&ctx, 16, out);
+}
+
+/* verifies the request and returns the length of the reply */
+static unsigned make_reply(struct stand_in *si, uint8_t *req, unsigned len, uint8_t *rep)
+{
+	const char *secret = (si->mode == 2) ? "wrong" : SECRET;
+	uint8_t zero[16], digest[16], mac[16], pass[RAD_MAX_PASSWORD_SIZE];
+	char user[64] = "";
+	unsigned pos, alen, i, j, mac_pos = 0, pass_len = 0, rlen;
+	struct md5_ctx ctx;
+	uint16_t l16;
+
+	check(len >= 20 && req[2] * 256 + req[3] == len, __LINE__);
+
+	for (pos = 20; pos < len; pos += alen) {
+		alen = req[pos + 1];
+		check(alen >= 2 && pos + alen <= len, __LINE__);
+
+		if (req[pos] == RAD_ATTR_USER_NAME) {
+			memcpy(user, &req[pos + 2], alen - 2);
+			user[alen - 2] = 0;
+		} else if (req[pos] == RAD_ATTR_MESSAGE_AUTHENTICATOR) {
+			mac_pos = pos + 2;
+		} else if (req[pos] == RAD_ATTR_USER_PASSWORD) {
+			pass_len = alen - 2;
+			check(pass_len % 16 == 0, __LINE__);
+			for (i = 0; i < pass_len; i += 16) {
+				md5_init(&ctx);
+				md5_update(&ctx, strlen(SECRET), (uint8_t *)SECRET);
+				md5_update(&ctx, 16, i ? &req[pos + 2 + i - 16] : &req[4]);
+				md5_digest(&ctx, 16, digest);
+				for (j = 0; j < 16; j++)
+					pass[i + j] = req[pos + 2 + i + j] ^ digest[j];
+			}
+		}
+	}
+
+	rep[1] = req[1];
+	rlen = 20;
+
+	if (req[0] == RAD_CODE_ACCESS_REQUEST) {
+		check(mac_pos != 0, __LINE__);
+		memcpy(mac, &req[mac_pos], 16);
+		memset(&req[mac_pos], 0, 16);
+		hmac(SECRET, req, len, digest);
+		check(memcmp(digest, mac, 16) == 0, __LINE__);
+
+		check(pass_len >= sizeof(PASSWORD) - 1, __LINE__);
+		if (memcmp(pass, PASSWORD, sizeof(PASSWORD) - 1) == 0 &&
+		    pass[sizeof(PASSWORD) - 1] == 0) {
+			rep[0] = RAD_CODE_ACCESS_ACCEPT;
+		} else {
+			rep[0] = RAD_CODE_ACCESS_REJECT;
+		}
+
+		/* the user name is echoed */
+		rep[rlen++] = RAD_ATTR_REPLY_MESSAGE;
+		rep[rlen++] = strlen(user) + 2;
+		memcpy(&rep[rlen], user, strlen(user));
+		rlen += strlen(user);
+
+		/* MS-Primary-DNS-Server */
+		memcpy(&rep[rlen], "\x1a\x0c\x00\x00\x01\x37\x1c\x06\xc0\x00\x02\x01", 12);
+		rlen += 12;
+
+		if (si->mode != 3) {
+			rep[rlen++] = RAD_ATTR_MESSAGE_AUTHENTICATOR;
+			rep[rlen++] = 18;
+			memset(&rep[rlen], 0, 16);
+			rlen += 16;
+		}
+
+		l16 = htons(rlen);
+		memcpy(&rep[2], &l16, 2);
+		if (si->mode != 3) {
+			memcpy(&rep[4], &req[4], 16);
+			hmac(secret, rep, rlen, &rep[rlen - 16]);
+		}
+	} else {
+		check(req[0] == RAD_CODE_ACCOUNTING_REQUEST, __LINE__);
+
+		memset(zero, 0, sizeof(zero));
+		md5_auth(SECRET, req, len, zero, digest);
+		check(memcmp(digest, &req[4], 16) == 0, __LINE__);
+
+		rep[0] = RAD_CODE_ACCOUNTING_RESPONSE;
+		l16 = htons(rlen);
+		memcpy(&rep[2], &l16, 2);
+	}
+
+	md5_auth(secret, rep, rlen, &req[4], &rep[4]);
+	return rlen;
+}
+
+static void stand_in_serve(struct stand_in *si)
+{
+	uint8_t rep[RAD_MAX_PACKET_SIZE];
+	unsigned i, len;
+	ssize_t ret;
+
+	for (;;) {
+		i = si->nheld;
+		check(i < MAX_HELD, __LINE__);
+
+		si->held_addr_len[i] = sizeof(si->held_addr[i]);
+		ret = recvfrom(si->fd, si->held[i], sizeof(si->held[i]), 0,
+			       (struct sockaddr *)&si->held_addr[i], &si->held_addr_len[i]);
+		if (ret < 0)
+			break;
+		si->received++;
+
+		if (si->mode == 0)
+			continue;
+
+		si->held_size[i] = ret;
+		si->nheld++;
+
+		if (si->nheld < si->hold)
+			continue;
+
+		while (si->nheld > 0) {
+			i = --si->nheld;
+			len = make_reply(si, si->held[i], si->held_size[i], rep);
+			check(sendto(si->fd, rep, len, 0, (struct sockaddr *)&si->held_addr[i],
+				     si->held_addr_len[i]) == (ssize_t)len, __LINE__);
+		}
+	}
+}
+
+static void serve_one(struct stand_in *si)
+{
+	struct pollfd pfd;
+	unsigned received = si->received;
+
+	pfd.fd = si->fd;
+	pfd.events = POLLIN;
+	while (si->received == received) {
+		check(poll(&pfd, 1, 5000) == 1, __LINE__);
+		stand_in_serve(si);
+	}
+}
+
+/* runs the client and the stand-ins until the expected requests are done */
+static void run(struct stand_in *si, unsigned si_size, unsigned expected)
+{
+	struct pollfd pfd[16];
+	unsigned n, i, loops = 0;
+	int t;
+
+	while (done < expected) {
+		check(loops++ < 1000, __LINE__);
+
+		n = rad_clients_fill_pollfd(pfd);
+		for (i = 0; i < si_size; i++) {
+			pfd[n].fd = si[i].fd;
+			pfd[n].events = POLLIN;
+			n++;
+		}
+
+		t = rad_clients_timeout();
+		if (t == -1 || t > 100)
+			t = 100;
+		poll(pfd, n, t);
+
+		for (i = 0; i < si_size; i++)
+			stand_in_serve(&si[i]);
+		rad_clients_process();
+	}
+}
+
+static void auth_done(void *priv, int status, const rad_reply_st *reply)
+{
+	const char *user = priv;
+	rad_attr_st a;
+	unsigned seen = 0;
+
+	check(status == RAD_OK, __LINE__);
+	check(reply->code == RAD_CODE_ACCESS_ACCEPT, __LINE__);
+
+	memset(&a, 0, sizeof(a));
+	while (rad_reply_next(reply, &a)) {
+		if (a.vendor == 0 && a.type == RAD_ATTR_REPLY_MESSAGE) {
+			/* the reply is of this request */
+			check(a.len == strlen(user) && memcmp(a.data, user, a.len) == 0, __LINE__);
+			seen |= 1;
+		} else if (a.vendor == 311 && a.type == 28) {
+			check(a.len == 4 && memcmp(a.data, "\xc0\x00\x02\x01", 4) == 0, __LINE__);
+			seen |= 2;
+		}
+	}
+	check(seen == 3, __LINE__);
+
+	accepted++;
+	done++;
+}
+
+static void status_done(void *priv, int status, const rad_reply_st *reply)
+{
+	int *expected = priv;
+
+	check(status == *expected, __LINE__);
+	done++;
+}
+
+static rad_req_st *new_auth(rad_client_st *c, const char *user, const char *pass)
+{
+	rad_req_st *r;
+
+	r = rad_req_new(c, RAD_CODE_ACCESS_REQUEST);
+	check(r != NULL, __LINE__);
+	check(rad_req_add_str(r, RAD_ATTR_USER_NAME, user) == 0, __LINE__);
+	check(rad_req_set_password(r, pass, strlen(pass)) == 0, __LINE__);
+	check(rad_req_add_int(r, RAD_ATTR_NAS_PORT, 1) == 0, __LINE__);
+	return r;
+}
+
+/* As rad_req_send(), but waits for the request's completion, and calls
+ * done() before returning. The other requests of the client progress
+ * meanwhile; their completion functions are called on the next
+ * rad_clients_process(). Returns the reply code or a negative status. */
+static int send_wait(rad_req_st *r, rad_done_func done, void *priv)
+{
+	rad_client_st *c = r->c;
+	struct pollfd pfd[RAD_MAX_SERVERS];
+	unsigned i;
+	int ret;
+
+	r->waiting = 1;
+	ret = rad_req_send(r, done, priv);
+	if (ret < 0)
+		return ret;
+
+	while (!r->finished) {
+		for (i = 0; i < c->servers_size; i++) {
+			pfd[i].fd = c->servers[i].fd;
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+
+		/* the completed requests of others are left for later */
+		ret = client_timeout(c, 1);
+		if (ret == -1)
+			ret = c->timeout_ms;
+
+		ret = poll(pfd, c->servers_size, ret);
+		if (ret == -1 && errno != EINTR)
+			break;
+
+		run_client(c);
+	}
+
+	if (!r->finished) {
+		/* cannot be left in the client */
+		if (r->server != -1 && c->servers[r->server].inflight[r->id] == r)
+			release_id(r);
+		else {
+			list_del(&r->list);
+			c->queued--;
+		}
+		r->status = RAD_ERR_CANCELLED;
+	}
+
+	ret = (r->status == RAD_OK) ? r->reply[0] : r->status;
+	call_done(r);
+	talloc_free(r);
+
+	return ret;
+}
+
+int main(void)
+{
+	static const char *users[] = {"user0", "user1", "user2"};
+	static int ok = RAD_OK, timeout = RAD_ERR_TIMEOUT;
+	struct stand_in si[2];
+	rad_server_stats_st st;
+	rad_client_st *c;
+	rad_req_st *r;
+	unsigned i;
+	int ret, status;
+	pid_t pid;
+
+	/* out of order replies */
+	stand_in_init(&si[0], 1, 3);
+	c = rad_client_new(NULL, 1000, 1, 10, 0);
+	check(c != NULL, __LINE__);
+	check(rad_client_add_server(c, "127.0.0.1", si[0].port, 1812, SECRET) == 0, __LINE__);
+
+	for (i = 0; i < 3; i++)
+		check(rad_req_send(new_auth(c, users[i], PASSWORD), auth_done, (void *)users[i]) == 0, __LINE__);
+	run(si, 1, 3);
+	check(accepted == 3 && si[0].received == 3, __LINE__);
+
+	/* accounting and waiting for a request */
+	si[0].hold = 1;
+	r = rad_req_new(c, RAD_CODE_ACCOUNTING_REQUEST);
+	check(rad_req_add_str(r, RAD_ATTR_USER_NAME, "user0") == 0, __LINE__);
+	check(rad_req_send(r, status_done, &ok) == 0, __LINE__);
+	run(si, 1, 4);
+
+	talloc_free(c);
+	close(si[0].fd);
+
+	/* forged replies are ignored, and the request is retransmitted */
+	done = 0;
+	stand_in_init(&si[0], 2, 1);
+	c = rad_client_new(NULL, 100, 1, 0, 0);
+	check(rad_client_add_server(c, "127.0.0.1", si[0].port, 1812, SECRET) == 0, __LINE__);
+	check(rad_req_send(new_auth(c, "user0", PASSWORD), status_done, &timeout) == 0, __LINE__);
+	run(si, 1, 1);
+	check(si[0].received == 2, __LINE__);
+	talloc_free(c);
+	close(si[0].fd);
+
+	/* replies without a Message-Authenticator are ignored, unless
+	 * allowed */
+	done = 0;
+	accepted = 0;
+	stand_in_init(&si[0], 3, 1);
+	c = rad_client_new(NULL, 100, 1, 0, 0);
+	check(rad_client_add_server(c, "127.0.0.1", si[0].port, 1812, SECRET) == 0, __LINE__);
+	check(rad_req_send(new_auth(c, "user0", PASSWORD), status_done, &timeout) == 0, __LINE__);
+	run(si, 1, 1);
+	check(si[0].received == 2, __LINE__);
+
+	rad_client_allow_no_msg_auth(c, 1);
+	check(rad_req_send(new_auth(c, "user0", PASSWORD), auth_done, "user0") == 0, __LINE__);
+	run(si, 1, 2);
+	check(accepted == 1 && si[0].received == 3, __LINE__);
+	talloc_free(c);
+	close(si[0].fd);
+
+	/* failover */
+	done = 0;
+	accepted = 0;
+	stand_in_init(&si[0], 0, 1);
+	stand_in_init(&si[1], 1, 1);
+	c = rad_client_new(NULL, 100, 0, 10, 0);
+	check(rad_client_add_server(c, "127.0.0.1", si[0].port, 1812, SECRET) == 0, __LINE__);
+	check(rad_client_add_server(c, "127.0.0.1", si[1].port, 1812, SECRET) == 0, __LINE__);
+
+	for (i = 0; i < 2; i++) {
+		check(rad_req_send(new_auth(c, "user0", PASSWORD), auth_done, "user0") == 0, __LINE__);
+		run(si, 2, i + 1);
+		check(si[0].received == i + 1 && si[1].received == i + 1, __LINE__);
+	}
+
+	/* the primary is no longer used */
+	rad_client_server_stats(c, 0, &st);
+	check(st.dead != 0 && st.timeouts == 2 && st.score < RAD_DEAD_SCORE, __LINE__);
+
+	/* the stand-in runs in another process while the request is waited */
+	pid = fork();
+	check(pid != -1, __LINE__);
+	if (pid == 0) {
+		serve_one(&si[1]);
+		exit(0);
+	}
+
+	ret = send_wait(new_auth(c, "user1", PASSWORD), auth_done, "user1");
+	check(ret == RAD_CODE_ACCESS_ACCEPT, __LINE__);
+	check(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+	      WEXITSTATUS(status) == 0, __LINE__);
+
+	rad_client_server_stats(c, 0, &st);
+	check(st.requests == 2, __LINE__);
+	rad_client_server_stats(c, 1, &st);
+	check(st.dead == 0 && st.score == 100 && st.requests == 3, __LINE__);
+	talloc_free(c);
+	close(si[0].fd);
+	close(si[1].fd);
+
+	/* rate limit */
+	done = 0;
+	accepted = 0;
+	stand_in_init(&si[0], 1, 1);
+	c = rad_client_new(NULL, 1000, 0, 0, 2);
+	check(rad_client_add_server(c, "127.0.0.1", si[0].port, 1812, SECRET) == 0, __LINE__);
+
+	for (i = 0; i < 5; i++)
+		check(rad_req_send(new_auth(c, "user0", PASSWORD), auth_done, "user0") == 0, __LINE__);
+	check(rad_client_queued(c) == 3, __LINE__);
+	run(si, 1, 5);
+	check(accepted == 5 && si[0].received == 5, __LINE__);
+	talloc_free(c);
+	close(si[0].fd);
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the sealed cookies are opened by the servers which share
+ * their key within their lifetime, and that the modified cookies are
+ * rejected.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sealed-cookie.c"
+
+#define LIFETIME 3600
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static const char secret[] = "0123456789abcdef0123456789abcdef";
+
+int main(void)
+{
+	cookie_key_st key, key2;
+	sealed_cookie_st c, c2;
+	uint8_t cookie[MAX_COOKIE_SIZE], cookie2[MAX_COOKIE_SIZE];
+	unsigned cookie_size = sizeof(cookie), cookie2_size = sizeof(cookie2);
+	time_t now = 1000*LIFETIME + 10;
+	unsigned i;
+
+	check(cookie_key_init(&key, secret, 15, LIFETIME) < 0, __LINE__);
+	check(cookie_key_init(&key, secret, sizeof(secret)-1, LIFETIME) == 0, __LINE__);
+
+	memset(&c, 0, sizeof(c));
+	for (i = 0; i < sizeof(c.sid); i++)
+		c.sid[i] = i;
+	c.created = now;
+	c.auth_type = 3;
+	c.tls_auth_ok = 1;
+	strcpy(c.username, "test");
+	strcpy(c.groupname, "group");
+	strcpy(c.vhost, "www.example.com");
+	strcpy(c.remote_ip, "192.168.1.1");
+	strcpy(c.our_ip, "192.168.1.2");
+	strcpy(c.user_agent, "Open AnyConnect VPN Agent v7.08");
+
+	check(cookie_seal(&key, &c, cookie, &cookie_size) == 0, __LINE__);
+	check(c.expires == now + LIFETIME, __LINE__);
+	check(cookie_size > SID_SIZE && cookie_size <= MAX_COOKIE_SIZE, __LINE__);
+
+	/* a server sharing the secret */
+	check(cookie_key_init(&key2, secret, sizeof(secret)-1, LIFETIME) == 0, __LINE__);
+	check(cookie_open(&key2, now + 1, cookie, cookie_size, &c2) == 0, __LINE__);
+	check(memcmp(c.sid, c2.sid, sizeof(c.sid)) == 0, __LINE__);
+	check(c2.created == c.created && c2.expires == c.expires, __LINE__);
+	check(c2.auth_type == 3 && c2.tls_auth_ok == 1, __LINE__);
+	check(strcmp(c2.username, "test") == 0 && strcmp(c2.groupname, "group") == 0, __LINE__);
+	check(strcmp(c2.vhost, "www.example.com") == 0, __LINE__);
+	check(strcmp(c2.remote_ip, "192.168.1.1") == 0 && strcmp(c2.our_ip, "192.168.1.2") == 0, __LINE__);
+	check(strcmp(c2.user_agent, c.user_agent) == 0, __LINE__);
+
+	/* the key of the previous period is accepted, up to the expiration */
+	check(cookie_open(&key, now + LIFETIME - 1, cookie, cookie_size, &c2) == 0, __LINE__);
+	check(cookie_open(&key, now + LIFETIME, cookie, cookie_size, &c2) < 0, __LINE__);
+	check(cookie_open(&key, now + 2*LIFETIME, cookie, cookie_size, &c2) < 0, __LINE__);
+
+	/* another secret */
+	check(cookie_key_init(&key2, "fedcba9876543210", 16, LIFETIME) == 0, __LINE__);
+	check(cookie_open(&key2, now, cookie, cookie_size, &c2) < 0, __LINE__);
+
+	/* any modified byte, including the header */
+	for (i = 0; i < cookie_size; i++) {
+		cookie[i] ^= 1;
+		check(cookie_open(&key, now, cookie, cookie_size, &c2) < 0, __LINE__);
+		cookie[i] ^= 1;
+	}
+	check(cookie_open(&key, now, cookie, cookie_size - 1, &c2) < 0, __LINE__);
+	check(cookie_open(&key, now, cookie, SID_SIZE, &c2) < 0, __LINE__);
+
+	/* the nonce is random */
+	cookie_size = sizeof(cookie);
+	check(cookie_seal(&key, &c, cookie, &cookie_size) == 0, __LINE__);
+	check(cookie_seal(&key, &c, cookie2, &cookie2_size) == 0, __LINE__);
+	check(cookie2_size == cookie_size && memcmp(cookie, cookie2, cookie_size) != 0, __LINE__);
+
+	/* a buffer which cannot hold the cookie */
+	cookie_size = 40;
+	check(cookie_seal(&key, &c, cookie, &cookie_size) < 0, __LINE__);
+
+	/* the fields in the clear */
+	cookie_size = sizeof(cookie);
+	check(cookie_encode(&c, cookie, &cookie_size) == 0, __LINE__);
+	check(cookie_decode(cookie, cookie_size, &c2) == 0, __LINE__);
+	check(memcmp(c.sid, c2.sid, sizeof(c.sid)) == 0 && c2.expires == c.expires, __LINE__);
+	check(strcmp(c2.username, "test") == 0 && strcmp(c2.user_agent, c.user_agent) == 0, __LINE__);
+	check(cookie_decode(cookie, cookie_size - 1, &c2) < 0, __LINE__);
+
+	return 0;
+}
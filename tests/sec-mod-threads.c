@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <talloc.h>
+
+#include "../src/sec-mod-threads.h"
+#include "../src/sec-mod-threads.c"
+
+#define THREADS 4
+#define JOBS 32
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned running[2];
+static unsigned max_running[2];
+static unsigned done[2];
+
+struct test_job_st {
+	sec_job_st job;
+	unsigned backend;
+};
+
+static void test_work(sec_job_st *job)
+{
+	struct test_job_st *t = (struct test_job_st *)job;
+
+	pthread_mutex_lock(&lock);
+	running[t->backend]++;
+	if (running[t->backend] > max_running[t->backend])
+		max_running[t->backend] = running[t->backend];
+	pthread_mutex_unlock(&lock);
+
+	usleep(10000);
+
+	pthread_mutex_lock(&lock);
+	running[t->backend]--;
+	pthread_mutex_unlock(&lock);
+}
+
+static void test_done(sec_job_st *job)
+{
+	struct test_job_st *t = (struct test_job_st *)job;
+
+	done[t->backend]++;
+	talloc_free(t);
+}
+
+int main()
+{
+	sec_threads_st *t;
+	sec_backend_st *b[2];
+	struct test_job_st *job;
+	struct pollfd pfd;
+	unsigned i;
+
+	t = sec_threads_new(NULL, THREADS);
+	if (t == NULL || t->nthreads != THREADS) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	/* a serialized backend and one which may use all threads */
+	b[0] = sec_threads_backend(t, &b[0], "serial", 1);
+	b[1] = sec_threads_backend(t, &b[1], "parallel", 0);
+	if (b[0] == NULL || b[1] == NULL || b[0]->limit != 1 || b[1]->limit != THREADS ||
+	    sec_threads_backend(t, &b[0], "serial", 1) != b[0]) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < JOBS; i++) {
+		job = talloc_zero(t, struct test_job_st);
+		if (job == NULL) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+
+		job->backend = i % 2;
+		job->job.work = test_work;
+		job->job.done = test_done;
+
+		if (sec_threads_submit(t, b[job->backend], &job->job) < 0) {
+			fprintf(stderr, "error in %d\n", __LINE__);
+			exit(1);
+		}
+	}
+
+	if (b[0]->queued != JOBS/2 - 1 || b[0]->max_queued != JOBS/2 - 1) {
+		fprintf(stderr, "error in %d: %u\n", __LINE__, b[0]->queued);
+		exit(1);
+	}
+
+	pfd.fd = t->notify_fd[0];
+	pfd.events = POLLIN;
+	while (done[0] + done[1] < JOBS) {
+		if (poll(&pfd, 1, 5000) <= 0) {
+			fprintf(stderr, "error in %d: timeout\n", __LINE__);
+			exit(1);
+		}
+		sec_threads_complete(t);
+	}
+
+	if (done[0] != JOBS/2 || done[1] != JOBS/2 ||
+	    b[0]->completed != JOBS/2 || b[1]->completed != JOBS/2) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	if (max_running[0] != 1 || max_running[1] > THREADS || max_running[1] < 2) {
+		fprintf(stderr, "error in %d: %u %u\n", __LINE__, max_running[0], max_running[1]);
+		exit(1);
+	}
+
+	if (b[0]->running != 0 || b[0]->queued != 0 || t->total_queued != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	sec_threads_reset_stats(t);
+	if (b[0]->max_queued != 0 || b[0]->max_wait_ms != 0) {
+		fprintf(stderr, "error in %d\n", __LINE__);
+		exit(1);
+	}
+
+	talloc_free(t);
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that replies on the worker to sec-mod channel are matched to
+ * their requests when received out of order, that requests without a
+ * reply are delivered, and that a connection closed by sec-mod is
+ * re-established.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <talloc.h>
+
+#include "../src/secmod-client.c"
+
+#define CMD_TEST 1
+
+static size_t get_size(const void *msg)
+{
+	return sizeof(uint32_t);
+}
+
+static size_t pack(const void *msg, uint8_t *out)
+{
+	memcpy(out, msg, sizeof(uint32_t));
+	return sizeof(uint32_t);
+}
+
+static void *unpack(ProtobufCAllocator *a, size_t len, const uint8_t *data)
+{
+	uint32_t *v;
+
+	if (len != sizeof(*v))
+		return NULL;
+
+	v = a->alloc(a->allocator_data, sizeof(*v));
+	if (v != NULL)
+		memcpy(v, data, sizeof(*v));
+	return v;
+}
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static uint32_t recv_req(int fd, uint32_t *id)
+{
+	uint8_t cmd;
+	uint32_t v;
+	int ret;
+
+	ret = recv_msg_headers_id(fd, &cmd, id, 5);
+	check(ret == sizeof(v) && cmd == CMD_TEST, __LINE__);
+	check(force_read_timeout(fd, &v, sizeof(v), 5) == sizeof(v), __LINE__);
+	return v;
+}
+
+static void send_rep(int fd, uint32_t id, uint32_t v)
+{
+	check(send_msg_id(NULL, fd, CMD_TEST, id, &v, get_size, pack) >= 0, __LINE__);
+}
+
+/* plays sec-mod; replies in reverse order and closes the connection
+ * after the last request */
+static void server(int sd)
+{
+	uint32_t id[3], v[3];
+	int fd;
+
+	fd = accept(sd, NULL, NULL);
+	check(fd >= 0, __LINE__);
+
+	v[0] = recv_req(fd, &id[0]);
+	v[1] = recv_req(fd, &id[1]);
+	check(id[0] != 0 && id[1] != 0 && id[0] != id[1], __LINE__);
+
+	/* no reply is expected */
+	v[2] = recv_req(fd, &id[2]);
+	check(id[2] == 0 && v[2] == 3, __LINE__);
+
+	send_rep(fd, id[1], v[1] * 10);
+	send_rep(fd, id[0], v[0] * 10);
+
+	/* closed with the request unanswered */
+	v[0] = recv_req(fd, &id[0]);
+	close(fd);
+
+	fd = accept(sd, NULL, NULL);
+	check(fd >= 0, __LINE__);
+	v[0] = recv_req(fd, &id[0]);
+	send_rep(fd, id[0], v[0] * 10);
+	close(fd);
+
+	exit(0);
+}
+
+static uint32_t *recv_rep(void *pool, uint32_t id)
+{
+	uint32_t *r = NULL;
+	int ret;
+
+	ret = secmod_client_recv(pool, id, CMD_TEST, (void *)&r, unpack, 5);
+	check(ret >= 0 && r != NULL, __LINE__);
+	return r;
+}
+
+int main(void)
+{
+	struct sockaddr_un sa;
+	uint32_t id[3], v;
+	void *pool;
+	int sd, status;
+	pid_t pid;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "./secmod-client.%u.sock", (unsigned)getpid());
+	remove(sa.sun_path);
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	check(sd >= 0, __LINE__);
+	check(bind(sd, (struct sockaddr *)&sa, SUN_LEN(&sa)) == 0, __LINE__);
+	check(listen(sd, 4) == 0, __LINE__);
+
+	pid = fork();
+	check(pid != -1, __LINE__);
+	if (pid == 0)
+		server(sd);
+	close(sd);
+
+	pool = talloc_new(NULL);
+	secmod_client_init(&sa, SUN_LEN(&sa));
+
+	v = 1;
+	check(secmod_client_send(pool, CMD_TEST, &v, get_size, pack, &id[0]) >= 0, __LINE__);
+	v = 2;
+	check(secmod_client_send(pool, CMD_TEST, &v, get_size, pack, &id[1]) >= 0, __LINE__);
+	v = 3;
+	check(secmod_client_send(pool, CMD_TEST, &v, get_size, pack, NULL) >= 0, __LINE__);
+
+	/* the reply to the second request arrives first and is kept */
+	check(*recv_rep(pool, id[0]) == 10, __LINE__);
+	check(chan.stash_size == 1, __LINE__);
+	check(*recv_rep(pool, id[1]) == 20, __LINE__);
+	check(chan.stash_size == 0, __LINE__);
+
+	/* the connection is closed by the server */
+	v = 4;
+	check(secmod_client_send(pool, CMD_TEST, &v, get_size, pack, &id[2]) >= 0, __LINE__);
+	check(secmod_client_recv(pool, id[2], CMD_TEST, NULL, NULL, 5) < 0, __LINE__);
+	check(chan.fd == -1, __LINE__);
+
+	/* and re-established by the next request */
+	v = 5;
+	check(secmod_client_send(pool, CMD_TEST, &v, get_size, pack, &id[2]) >= 0, __LINE__);
+	check(*recv_rep(pool, id[2]) == 50, __LINE__);
+
+	secmod_client_close();
+	talloc_free(pool);
+
+	check(waitpid(pid, &status, 0) == pid, __LINE__);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, __LINE__);
+	remove(sa.sun_path);
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the slots of the counters are handed out once until freed,
+ * are cleared when reused, that the values written by a forked
+ * process are seen by its parent, and that an isolated process can only
+ * write to its own slot.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "../src/session-counters.c"
+
+#define SLOTS 64
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	session_counters_table_st t;
+	session_counters_st *sc;
+	unsigned used[SLOTS];
+	void *pool = talloc_new(NULL);
+	int slot, status;
+	unsigned i;
+	pid_t pid;
+
+	check(sizeof(session_counters_st) == CACHE_LINE_SIZE, __LINE__);
+	check(session_counters_init(pool, &t, SLOTS) == 0, __LINE__);
+	check(session_counters_get(&t, -1) == NULL, __LINE__);
+
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < SLOTS; i++) {
+		slot = session_counters_alloc(&t);
+		check(slot >= 0 && slot < SLOTS, __LINE__);
+		check(used[slot] == 0, __LINE__);
+		used[slot] = 1;
+	}
+	check(session_counters_alloc(&t) == -1, __LINE__);
+
+	/* a freed slot is reused, cleared */
+	sc = session_counters_get(&t, 7);
+	COUNTER_STORE(&sc->c.bytes_in, 1000);
+	session_counters_free(&t, 7);
+	check(session_counters_alloc(&t) == 7, __LINE__);
+	check(COUNTER_LOAD(&sc->c.bytes_in) == 0, __LINE__);
+
+	/* written by a worker, read by main */
+	pid = fork();
+	check(pid != -1, __LINE__);
+	if (pid == 0) {
+		for (i = 0; i < SLOTS; i++) {
+			sc = session_counters_get(&t, i);
+			COUNTER_STORE(&sc->c.bytes_in, i * 2);
+			COUNTER_STORE(&sc->c.bytes_out, i * 3);
+			COUNTER_STORE(&sc->c.tx_per_sec, i);
+		}
+		_exit(0);
+	}
+	check(waitpid(pid, &status, 0) == pid, __LINE__);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, __LINE__);
+
+	for (i = 0; i < SLOTS; i++) {
+		sc = session_counters_get(&t, i);
+		check(COUNTER_LOAD(&sc->c.bytes_in) == i * 2, __LINE__);
+		check(COUNTER_LOAD(&sc->c.bytes_out) == i * 3, __LINE__);
+		check(COUNTER_LOAD(&sc->c.rx_per_sec) == 0, __LINE__);
+		check(COUNTER_LOAD(&sc->c.tx_per_sec) == i, __LINE__);
+	}
+
+	/* an isolated worker writes its slot, and faults on the others */
+	pid = fork();
+	check(pid != -1, __LINE__);
+	if (pid == 0) {
+		sc = session_counters_get(&t, 5);
+		session_counters_isolate(&t, 5);
+		check(session_counters_get(&t, 5) == NULL, __LINE__);
+		COUNTER_STORE(&sc->c.bytes_in, 12345);
+		sc = (session_counters_st *)((uint8_t *)sc + t.stride);
+		COUNTER_STORE(&sc->c.bytes_in, 54321);
+		_exit(0);
+	}
+	check(waitpid(pid, &status, 0) == pid, __LINE__);
+	check(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, __LINE__);
+	check(COUNTER_LOAD(&session_counters_get(&t, 5)->c.bytes_in) == 12345, __LINE__);
+	check(COUNTER_LOAD(&session_counters_get(&t, 6)->c.bytes_in) == 12, __LINE__);
+
+	session_counters_deinit(&t);
+	check(t.slots == NULL && t.nfree == 0, __LINE__);
+	talloc_free(pool);
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the size classes of the packets, that the telemetry survives
+ * its message, and that only the increases of the reports of a session
+ * are added to the totals.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/session-telemetry.c"
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	session_telemetry_st t, t2, prev, total;
+	SessionTelemetryMsg msg;
+	uint64_t short_sizes[2] = {5, 6};
+	unsigned i;
+
+	check(telemetry_size_class(0) == 0, __LINE__);
+	check(telemetry_size_class(64) == 0, __LINE__);
+	check(telemetry_size_class(65) == 1, __LINE__);
+	check(telemetry_size_class(1024) == 4, __LINE__);
+	check(telemetry_size_class(1025) == 5, __LINE__);
+	check(telemetry_size_class(1400) == 5, __LINE__);
+	check(telemetry_size_class(1401) == TELEMETRY_SIZE_CLASSES - 1, __LINE__);
+	check(telemetry_size_class(65535) == TELEMETRY_SIZE_CLASSES - 1, __LINE__);
+
+	/* the message is not packed, so its descriptor is not needed */
+	memset(&t, 0, sizeof(t));
+	memset(&msg, 0, sizeof(msg));
+	t.rtt_samples = 3;
+	t.rtt_usecs = 1500;
+	t.min_rtt_usecs = 900;
+	t.rtt_sum_usecs = 3600;
+	for (i = 0; i < TELEMETRY_SIZE_CLASSES; i++) {
+		t.rx_sizes[i] = i + 1;
+		t.tx_sizes[i] = 10 * i;
+	}
+	t.rx_policed = 7;
+	t.comp_in = 1000;
+	t.comp_out = 400;
+	t.mtu_decreases = 2;
+	t.to_tls = 1;
+	t.eagain = 99;
+
+	telemetry_to_msg(&t, &msg);
+	check(msg.n_rx_sizes == TELEMETRY_SIZE_CLASSES, __LINE__);
+	telemetry_from_msg(&t2, &msg);
+	check(memcmp(&t, &t2, sizeof(t)) == 0, __LINE__);
+
+	/* fewer classes than known are accepted */
+	msg.rx_sizes = short_sizes;
+	msg.n_rx_sizes = 2;
+	msg.n_tx_sizes = 0;
+	telemetry_from_msg(&t2, &msg);
+	check(t2.rx_sizes[1] == 6 && t2.rx_sizes[2] == 0, __LINE__);
+	check(t2.tx_sizes[1] == 0 && t2.eagain == 99, __LINE__);
+
+	/* a first report is added whole */
+	memset(&prev, 0, sizeof(prev));
+	memset(&total, 0, sizeof(total));
+	telemetry_add_change(&total, &prev, &t);
+	check(memcmp(&total, &t, sizeof(t)) == 0, __LINE__);
+
+	/* then only what changed */
+	t2 = t;
+	t2.rx_sizes[3] += 5;
+	t2.eagain += 1;
+	t2.rtt_samples++;
+	t2.rtt_usecs = 2000;
+	t2.rtt_sum_usecs += 2000;
+	telemetry_add_change(&total, &t, &t2);
+	check(total.rx_sizes[3] == t.rx_sizes[3] + 5, __LINE__);
+	check(total.eagain == 100, __LINE__);
+	check(total.rtt_samples == 4 && total.rtt_usecs == 2000, __LINE__);
+	check(total.min_rtt_usecs == 900 && total.rtt_sum_usecs == 5600, __LINE__);
+	check(total.comp_in == 1000 && total.tx_sizes[6] == 60, __LINE__);
+
+	/* and never a decrease */
+	prev = t2;
+	t2.comp_in = 0;
+	t2.to_tls = 0;
+	telemetry_add_change(&total, &prev, &t2);
+	check(total.comp_in == 1000 && total.to_tls == 1, __LINE__);
+	check(total.rtt_usecs == 2000, __LINE__);
+
+	return 0;
+}
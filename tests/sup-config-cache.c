@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the cache of the per-user and per-group configuration files:
+ * the parsing on modification, the configurations kept by their users
+ * once replaced, the dropping of the least recently used files, and the
+ * merging of a group and a user configuration.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <talloc.h>
+
+#include "../src/sup-config/cache.c"
+
+static unsigned parsed;
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+static void write_file(const char *name, const char *data)
+{
+	FILE *fp = fopen(name, "w");
+
+	check(fp != NULL, __LINE__);
+	check(fputs(data, fp) >= 0, __LINE__);
+	check(fclose(fp) == 0, __LINE__);
+}
+
+/* A configuration of a route per line; a line "error" fails */
+static int test_parse(void *pool, const char *file, GroupCfgSt **_cfg)
+{
+	GroupCfgSt *cfg;
+	char line[256];
+	FILE *fp;
+
+	parsed++;
+
+	cfg = talloc_zero(pool, GroupCfgSt);
+	check(cfg != NULL, __LINE__);
+	*_cfg = cfg;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return 0;
+
+	cfg->routes = talloc_array(cfg, char*, 16);
+	while (fgets(line, sizeof(line), fp) != NULL && cfg->n_routes < 15) {
+		line[strcspn(line, "\n")] = 0;
+		if (strcmp(line, "error") == 0) {
+			fclose(fp);
+			return -1;
+		}
+		cfg->routes[cfg->n_routes++] = talloc_strdup(cfg->routes, line);
+	}
+	cfg->routes[cfg->n_routes] = NULL;
+
+	fclose(fp);
+	return 0;
+}
+
+/* A cache of two files */
+static void check_lru(void)
+{
+	char files[3][32];
+	sup_cache_st *cache;
+	GroupCfgSt *cfg, *kept;
+	void *pool = talloc_new(NULL);
+	unsigned i;
+	int fd;
+
+	for (i = 0; i < 3; i++) {
+		snprintf(files[i], sizeof(files[i]), "sup-config-cache.tmp.XXXXXX");
+		fd = mkstemp(files[i]);
+		check(fd != -1, __LINE__);
+		close(fd);
+		write_file(files[i], "10.0.0.0/8\n");
+	}
+	sleep(1);
+
+	cache = sup_cache_new(NULL, 2);
+	check(cache != NULL, __LINE__);
+
+	parsed = 0;
+	check(sup_cache_get(cache, pool, files[0], test_parse, &cfg) == 0, __LINE__);
+	check(sup_cache_get(cache, pool, files[1], test_parse, &kept) == 0, __LINE__);
+	check(sup_cache_get(cache, pool, files[0], test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 2 && cache->entries == 2, __LINE__);
+
+	/* the second file is the least recently used, and is dropped */
+	check(sup_cache_get(cache, pool, files[2], test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 3 && cache->entries == 2, __LINE__);
+	check(sup_cache_get(cache, pool, files[0], test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 3, __LINE__);
+	check(sup_cache_get(cache, pool, files[1], test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 4 && cache->entries == 2, __LINE__);
+
+	/* its configuration is kept by its user */
+	check(kept != cfg && strcmp(kept->routes[0], "10.0.0.0/8") == 0, __LINE__);
+
+	talloc_free(cache);
+	check(strcmp(kept->routes[0], "10.0.0.0/8") == 0, __LINE__);
+	talloc_free(pool);
+
+	for (i = 0; i < 3; i++)
+		unlink(files[i]);
+	parsed = 0;
+}
+
+static void check_merge(void)
+{
+	GroupCfgSt group, user, dst;
+	char *group_routes[] = {"10.0.0.0/8", NULL};
+	char *user_routes[] = {"10.1.0.0/16", "10.2.0.0/16", NULL};
+	char *user_dns[] = {"192.168.1.1", NULL};
+	void *pool = talloc_new(NULL);
+
+	memset(&group, 0, sizeof(group));
+	memset(&user, 0, sizeof(user));
+	memset(&dst, 0, sizeof(dst));
+
+	group.routes = group_routes;
+	group.n_routes = 1;
+	group.cgroup = "group";
+	group.hostname = "group";
+	group.has_mtu = 1;
+	group.mtu = 1400;
+	group.has_dpd = 1;
+	group.dpd = 60;
+
+	user.routes = user_routes;
+	user.n_routes = 2;
+	user.dns = user_dns;
+	user.n_dns = 1;
+	user.hostname = "user";
+	user.has_dpd = 1;
+	user.dpd = 0;
+
+	check(sup_cfg_merge(pool, &dst, &group) == 0, __LINE__);
+
+	/* a single configuration is referenced */
+	check(dst.routes == group.routes && dst.n_routes == 1, __LINE__);
+	check(dst.cgroup == group.cgroup && dst.mtu == 1400, __LINE__);
+
+	check(sup_cfg_merge(pool, &dst, &user) == 0, __LINE__);
+
+	/* the lists are appended and the set values replaced */
+	check(dst.n_routes == 3 && dst.routes[3] == NULL, __LINE__);
+	check(strcmp(dst.routes[0], "10.0.0.0/8") == 0, __LINE__);
+	check(strcmp(dst.routes[2], "10.2.0.0/16") == 0, __LINE__);
+	check(dst.dns == user.dns && dst.n_dns == 1, __LINE__);
+	check(strcmp(dst.cgroup, "group") == 0, __LINE__);
+	check(strcmp(dst.hostname, "user") == 0, __LINE__);
+	check(dst.has_mtu && dst.mtu == 1400, __LINE__);
+	check(dst.has_dpd && dst.dpd == 0, __LINE__);
+
+	/* the configurations are not modified */
+	check(group.n_routes == 1 && strcmp(group.hostname, "group") == 0, __LINE__);
+
+	talloc_free(pool);
+}
+
+int main(void)
+{
+	char file[] = "sup-config-cache.tmp.XXXXXX";
+	char newfile[sizeof(file) + 4];
+	sup_cache_st *cache;
+	GroupCfgSt *cfg, *cfg2;
+	void *pool, *pool2;
+	int fd;
+
+	check_merge();
+	check_lru();
+
+	fd = mkstemp(file);
+	check(fd != -1, __LINE__);
+	close(fd);
+	write_file(file, "10.0.0.0/8\n");
+
+	cache = sup_cache_new(NULL, 0);
+	check(cache != NULL, __LINE__);
+
+	pool = talloc_new(NULL);
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 1 && cfg->n_routes == 1, __LINE__);
+
+	/* a file modified within the second it was parsed */
+	write_file(file, "10.1.0.0/8\n");
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg2) == 0, __LINE__);
+	check(parsed == 2 && strcmp(cfg2->routes[0], "10.1.0.0/8") == 0, __LINE__);
+
+	/* the replaced configuration is kept by its user */
+	check(strcmp(cfg->routes[0], "10.0.0.0/8") == 0, __LINE__);
+	talloc_free(pool);
+
+	/* an unmodified file is parsed once */
+	sleep(1);
+	pool = talloc_new(NULL);
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) == 0, __LINE__);
+	pool2 = talloc_new(NULL);
+	check(sup_cache_get(cache, pool2, file, test_parse, &cfg2) == 0, __LINE__);
+	check(parsed == 3 && cfg == cfg2, __LINE__);
+	talloc_free(pool);
+	check(strcmp(cfg2->routes[0], "10.1.0.0/8") == 0, __LINE__);
+
+	/* a replaced file */
+	snprintf(newfile, sizeof(newfile), "%s.new", file);
+	write_file(newfile, "10.2.0.0/8\n10.3.0.0/8\n");
+	check(rename(newfile, file) == 0, __LINE__);
+	pool = talloc_new(NULL);
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) == 0, __LINE__);
+	check(parsed == 4 && cfg->n_routes == 2, __LINE__);
+	check(strcmp(cfg2->routes[0], "10.1.0.0/8") == 0, __LINE__);
+	talloc_free(pool2);
+
+	/* the failures are cached as well */
+	sleep(1);
+	write_file(file, "error\n");
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) < 0, __LINE__);
+	sleep(1);
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) < 0, __LINE__);
+	check(parsed == 6, __LINE__);
+	check(sup_cache_get(cache, pool, file, test_parse, &cfg) < 0, __LINE__);
+	check(parsed == 6, __LINE__);
+
+	talloc_free(pool);
+	talloc_free(cache);
+	unlink(file);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the timers are run once the wheel is run for their time,
+ * and not before, over spans covering all the levels of the wheel and
+ * beyond them, and that the deleted timers are not run.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common/timer-wheel.c"
+
+#define MAX_TIMERS 4096
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+typedef struct test_timer_st {
+	wheel_timer_st timer;
+	time_t expires;
+	unsigned rearm; /* re-armed when run */
+	struct test_timer_st *victim; /* deleted when run */
+	unsigned runs;
+} test_timer_st;
+
+static test_timer_st timers[MAX_TIMERS];
+static time_t prev_now, cur_now;
+
+static void timer_run(void *priv, wheel_timer_st *t)
+{
+	timer_wheel_st *w = priv;
+	test_timer_st *tt = container_of(t, test_timer_st, timer);
+
+	/* neither early nor late */
+	check(!wheel_timer_armed(t), __LINE__);
+	check(tt->expires <= cur_now, __LINE__);
+	check(tt->expires > prev_now, __LINE__);
+	tt->runs++;
+
+	if (tt->victim != NULL) {
+		timer_wheel_del(w, &tt->victim->timer);
+		tt->victim = NULL;
+	}
+
+	if (tt->rearm) {
+		tt->rearm = 0;
+		tt->expires = cur_now + 1 + rand() % 100000;
+		timer_wheel_add(w, t, tt->expires);
+	}
+}
+
+static time_t random_delay(unsigned i)
+{
+	switch (i % 4) {
+	case 0:
+		return rand() % WHEEL_SLOTS;
+	case 1:
+		return rand() % (WHEEL_SLOTS * WHEEL_SLOTS);
+	case 2:
+		return rand() % (1 << 22);
+	default:
+		/* beyond the span of the wheel */
+		return (1 << 24) + rand() % (1 << 25);
+	}
+}
+
+int main(void)
+{
+	timer_wheel_st w;
+	time_t start = 1500000000;
+	time_t last = 0;
+	unsigned i, ran, total = 0, expected = 0;
+
+	srand(1);
+	timer_wheel_init(&w, start, &w);
+	prev_now = start - 1;
+	cur_now = start;
+
+	/* nothing to run */
+	check(timer_wheel_run(&w, start) == 0, __LINE__);
+	prev_now = start;
+
+	for (i = 0; i < MAX_TIMERS; i++) {
+		timers[i].expires = start + 1 + random_delay(i);
+		timers[i].rearm = (i % 7 == 0);
+		wheel_timer_init(&timers[i].timer, timer_run);
+		timer_wheel_add(&w, &timers[i].timer, timers[i].expires);
+		check(wheel_timer_armed(&timers[i].timer), __LINE__);
+	}
+	check(w.elems == MAX_TIMERS, __LINE__);
+
+	/* re-arming moves a timer */
+	timers[1].expires = start + 10;
+	timer_wheel_add(&w, &timers[1].timer, timers[1].expires);
+	check(w.elems == MAX_TIMERS, __LINE__);
+
+	/* deleted ones are not run */
+	for (i = 2; i < MAX_TIMERS; i += 11)
+		timer_wheel_del(&w, &timers[i].timer);
+	timer_wheel_del(&w, &timers[2].timer);
+
+	/* a timer deleting another due at the same second */
+	timers[3].expires = timers[5].expires = start + 100;
+	timers[3].victim = &timers[5];
+	timer_wheel_add(&w, &timers[3].timer, timers[3].expires);
+	timer_wheel_add(&w, &timers[5].timer, timers[5].expires);
+
+	for (i = 0; i < MAX_TIMERS; i++) {
+		if (i % 11 == 2 || i == 5)
+			continue;
+		expected += timers[i].rearm ? 2 : 1;
+		if (timers[i].expires > last)
+			last = timers[i].expires;
+	}
+
+	/* run in steps of a second up to long jumps */
+	while (w.elems > 0) {
+		check(cur_now < last + 1000000, __LINE__);
+
+		if (rand() % 4 == 0)
+			cur_now += 1 + rand() % 4;
+		else
+			cur_now += 1 + rand() % 200000;
+
+		ran = timer_wheel_run(&w, cur_now);
+		total += ran;
+		prev_now = cur_now;
+	}
+	check(total == expected, __LINE__);
+
+	for (i = 0; i < MAX_TIMERS; i++) {
+		if (i % 11 == 2 || i == 5)
+			check(timers[i].runs == 0, __LINE__);
+		else
+			check(timers[i].runs == ((i % 7 == 0) ? 2 : 1), __LINE__);
+		check(!wheel_timer_armed(&timers[i].timer), __LINE__);
+	}
+	check(timers[1].runs == 1, __LINE__);
+
+	/* the timers armed in the past are run on the next run */
+	timers[0].expires = cur_now - 100;
+	timer_wheel_add(&w, &timers[0].timer, timers[0].expires);
+	prev_now = cur_now - 101;
+	check(timer_wheel_run(&w, cur_now) == 1, __LINE__);
+	check(timers[0].runs == 3, __LINE__);
+
+	/* an idle wheel catches up */
+	prev_now = cur_now;
+	cur_now += 365 * 24 * 3600;
+	check(timer_wheel_run(&w, cur_now) == 0, __LINE__);
+	check(w.now == cur_now + 1, __LINE__);
+
+	timers[0].expires = cur_now + 1;
+	timer_wheel_add(&w, &timers[0].timer, timers[0].expires);
+	prev_now = cur_now;
+	check(timer_wheel_run(&w, cur_now) == 0, __LINE__);
+	cur_now++;
+	check(timer_wheel_run(&w, cur_now) == 1, __LINE__);
+
+	return 0;
+}
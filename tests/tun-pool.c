@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the pool of tun devices grows on the misses up to
+ * tun-pool-size, is refilled to its target, stops on creation
+ * failures, and shrinks when idle.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <talloc.h>
+
+#include "../src/main.h"
+#include "../src/tun-pool.c"
+
+static unsigned created, destroyed, fail_create;
+
+static void check(int cond, int line)
+{
+	if (!cond) {
+		fprintf(stderr, "error in %d\n", line);
+		exit(1);
+	}
+}
+
+int create_tun(main_server_st *s, struct tun_lease_st *lease)
+{
+	if (fail_create)
+		return -1;
+
+	memset(lease, 0, sizeof(*lease));
+	snprintf(lease->name, sizeof(lease->name), "vpns%u", created);
+	lease->fd = -1;
+	created++;
+	return 0;
+}
+
+void destroy_tun(main_server_st *s, struct tun_lease_st *lease)
+{
+	destroyed++;
+}
+
+static void refill(main_server_st *s)
+{
+	unsigned i;
+
+	for (i = 0; i < 1000 && tun_pool_refill(s); i++);
+	check(i < 1000, __LINE__);
+}
+
+int main(void)
+{
+	main_server_st *s = talloc_zero(NULL, struct main_server_st);
+	vhost_cfg_st *vhost;
+	struct tun_lease_st lease;
+	unsigned i;
+
+	check(s != NULL, __LINE__);
+
+	s->vconfig = talloc_zero(s, struct list_head);
+	check(s->vconfig != NULL, __LINE__);
+	list_head_init(s->vconfig);
+
+	vhost = talloc_zero(s, struct vhost_cfg_st);
+	check(vhost != NULL, __LINE__);
+	vhost->perm_config.config = talloc_zero(vhost, struct cfg_st);
+	check(vhost->perm_config.config != NULL, __LINE__);
+	list_add(s->vconfig, &vhost->list);
+
+	vhost->perm_config.config->tun_pool_size = 16;
+	tun_pool_init(s);
+
+	/* a single device is kept initially */
+	check(tun_pool_adjust(s) != 0, __LINE__);
+	refill(s);
+	check(s->tun_pool.total == 1 && created == 1, __LINE__);
+
+	/* a lease is served from the pool */
+	check(tun_pool_get(s, &lease) == 0, __LINE__);
+	check(strcmp(lease.name, "vpns0") == 0, __LINE__);
+	check(s->tun_pool.total == 0 && created == 1, __LINE__);
+
+	/* each miss doubles the target, up to the maximum */
+	for (i = 0; i < 6; i++)
+		check(tun_pool_get(s, &lease) == 0, __LINE__);
+	check(s->tun_pool.target == 16, __LINE__);
+	check(created == 7, __LINE__);
+
+	refill(s);
+	check(s->tun_pool.total == 16, __LINE__);
+
+	/* a failure stops the creation until the next lease */
+	fail_create = 1;
+	for (i = 0; i < 4; i++)
+		check(tun_pool_get(s, &lease) == 0, __LINE__);
+	check(tun_pool_refill(s) == 0, __LINE__);
+	check(s->tun_pool.failed != 0 && s->tun_pool.total == 12, __LINE__);
+	fail_create = 0;
+	check(tun_pool_get(s, &lease) == 0, __LINE__);
+	check(s->tun_pool.failed == 0, __LINE__);
+	refill(s);
+	check(s->tun_pool.total == 16, __LINE__);
+
+	/* not shrunk while in use */
+	check(tun_pool_adjust(s) == 0, __LINE__);
+	check(s->tun_pool.target == 16, __LINE__);
+
+	/* halved for each decay period while idle */
+	s->tun_pool.last_miss -= 3 * TUN_POOL_DECAY_TIME;
+	s->tun_pool.last_adjust -= 3 * TUN_POOL_DECAY_TIME;
+	check(tun_pool_adjust(s) != 0, __LINE__);
+	check(s->tun_pool.target == 2, __LINE__);
+	refill(s);
+	check(s->tun_pool.total == 2 && destroyed == 14, __LINE__);
+
+	/* and never below a device */
+	s->tun_pool.last_miss -= 3600;
+	s->tun_pool.last_adjust -= 3600;
+	tun_pool_adjust(s);
+	check(s->tun_pool.target == 1, __LINE__);
+	refill(s);
+	check(s->tun_pool.total == 1, __LINE__);
+
+	/* disabled */
+	vhost->perm_config.config->tun_pool_size = 0;
+	refill(s);
+	check(s->tun_pool.total == 0 && s->tun_pool.target == 0, __LINE__);
+
+	tun_pool_drain(s);
+	talloc_free(s);
+
+	return 0;
+}